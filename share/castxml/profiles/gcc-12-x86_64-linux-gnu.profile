@@ -0,0 +1,456 @@
+castxml-cc-profile 1
+triple x86_64-unknown-linux-gnu
+include =/usr/include/c++/12
+include =/usr/include/x86_64-linux-gnu/c++/12
+include =/usr/include/c++/12/backward
+builtin
+include =/usr/local/include
+include =/usr/include/x86_64-linux-gnu
+include =/usr/include
+macro _GNU_SOURCE 1
+macro _LP64 1
+macro _STDC_PREDEF_H 1
+macro __ATOMIC_ACQUIRE 2
+macro __ATOMIC_ACQ_REL 4
+macro __ATOMIC_CONSUME 1
+macro __ATOMIC_HLE_ACQUIRE 65536
+macro __ATOMIC_HLE_RELEASE 131072
+macro __ATOMIC_RELAXED 0
+macro __ATOMIC_RELEASE 3
+macro __ATOMIC_SEQ_CST 5
+macro __BIGGEST_ALIGNMENT__ 16
+macro __BYTE_ORDER__ __ORDER_LITTLE_ENDIAN__
+macro __CHAR16_TYPE__ short unsigned int
+macro __CHAR32_TYPE__ unsigned int
+macro __CHAR_BIT__ 8
+macro __DBL_DECIMAL_DIG__ 17
+macro __DBL_DENORM_MIN__ double(4.94065645841246544176568792868221372e-324L)
+macro __DBL_DIG__ 15
+macro __DBL_EPSILON__ double(2.22044604925031308084726333618164062e-16L)
+macro __DBL_HAS_DENORM__ 1
+macro __DBL_HAS_INFINITY__ 1
+macro __DBL_HAS_QUIET_NAN__ 1
+macro __DBL_IS_IEC_60559__ 2
+macro __DBL_MANT_DIG__ 53
+macro __DBL_MAX_10_EXP__ 308
+macro __DBL_MAX_EXP__ 1024
+macro __DBL_MAX__ double(1.79769313486231570814527423731704357e+308L)
+macro __DBL_MIN_10_EXP__(-307)
+macro __DBL_MIN_EXP__(-1021)
+macro __DBL_MIN__ double(2.22507385850720138309023271733240406e-308L)
+macro __DBL_NORM_MAX__ double(1.79769313486231570814527423731704357e+308L)
+macro __DEC128_EPSILON__ 1E-33DL
+macro __DEC128_MANT_DIG__ 34
+macro __DEC128_MAX_EXP__ 6145
+macro __DEC128_MAX__ 9.999999999999999999999999999999999E6144DL
+macro __DEC128_MIN_EXP__(-6142)
+macro __DEC128_MIN__ 1E-6143DL
+macro __DEC128_SUBNORMAL_MIN__ 0.000000000000000000000000000000001E-6143DL
+macro __DEC32_EPSILON__ 1E-6DF
+macro __DEC32_MANT_DIG__ 7
+macro __DEC32_MAX_EXP__ 97
+macro __DEC32_MAX__ 9.999999E96DF
+macro __DEC32_MIN_EXP__(-94)
+macro __DEC32_MIN__ 1E-95DF
+macro __DEC32_SUBNORMAL_MIN__ 0.000001E-95DF
+macro __DEC64_EPSILON__ 1E-15DD
+macro __DEC64_MANT_DIG__ 16
+macro __DEC64_MAX_EXP__ 385
+macro __DEC64_MAX__ 9.999999999999999E384DD
+macro __DEC64_MIN_EXP__(-382)
+macro __DEC64_MIN__ 1E-383DD
+macro __DEC64_SUBNORMAL_MIN__ 0.000000000000001E-383DD
+macro __DECIMAL_BID_FORMAT__ 1
+macro __DECIMAL_DIG__ 21
+macro __DEC_EVAL_METHOD__ 2
+macro __DEPRECATED 1
+macro __ELF__ 1
+macro __EXCEPTIONS 1
+macro __FINITE_MATH_ONLY__ 0
+macro __FLOAT_WORD_ORDER__ __ORDER_LITTLE_ENDIAN__
+macro __FLT128_DECIMAL_DIG__ 36
+macro __FLT128_DENORM_MIN__ 6.47517511943802511092443895822764655e-4966F128
+macro __FLT128_DIG__ 33
+macro __FLT128_EPSILON__ 1.92592994438723585305597794258492732e-34F128
+macro __FLT128_HAS_DENORM__ 1
+macro __FLT128_HAS_INFINITY__ 1
+macro __FLT128_HAS_QUIET_NAN__ 1
+macro __FLT128_IS_IEC_60559__ 2
+macro __FLT128_MANT_DIG__ 113
+macro __FLT128_MAX_10_EXP__ 4932
+macro __FLT128_MAX_EXP__ 16384
+macro __FLT128_MAX__ 1.18973149535723176508575932662800702e+4932F128
+macro __FLT128_MIN_10_EXP__(-4931)
+macro __FLT128_MIN_EXP__(-16381)
+macro __FLT128_MIN__ 3.36210314311209350626267781732175260e-4932F128
+macro __FLT128_NORM_MAX__ 1.18973149535723176508575932662800702e+4932F128
+macro __FLT16_DECIMAL_DIG__ 5
+macro __FLT16_DENORM_MIN__ 5.96046447753906250000000000000000000e-8F16
+macro __FLT16_DIG__ 3
+macro __FLT16_EPSILON__ 9.76562500000000000000000000000000000e-4F16
+macro __FLT16_HAS_DENORM__ 1
+macro __FLT16_HAS_INFINITY__ 1
+macro __FLT16_HAS_QUIET_NAN__ 1
+macro __FLT16_IS_IEC_60559__ 2
+macro __FLT16_MANT_DIG__ 11
+macro __FLT16_MAX_10_EXP__ 4
+macro __FLT16_MAX_EXP__ 16
+macro __FLT16_MAX__ 6.55040000000000000000000000000000000e+4F16
+macro __FLT16_MIN_10_EXP__(-4)
+macro __FLT16_MIN_EXP__(-13)
+macro __FLT16_MIN__ 6.10351562500000000000000000000000000e-5F16
+macro __FLT16_NORM_MAX__ 6.55040000000000000000000000000000000e+4F16
+macro __FLT32X_DECIMAL_DIG__ 17
+macro __FLT32X_DENORM_MIN__ 4.94065645841246544176568792868221372e-324F32x
+macro __FLT32X_DIG__ 15
+macro __FLT32X_EPSILON__ 2.22044604925031308084726333618164062e-16F32x
+macro __FLT32X_HAS_DENORM__ 1
+macro __FLT32X_HAS_INFINITY__ 1
+macro __FLT32X_HAS_QUIET_NAN__ 1
+macro __FLT32X_IS_IEC_60559__ 2
+macro __FLT32X_MANT_DIG__ 53
+macro __FLT32X_MAX_10_EXP__ 308
+macro __FLT32X_MAX_EXP__ 1024
+macro __FLT32X_MAX__ 1.79769313486231570814527423731704357e+308F32x
+macro __FLT32X_MIN_10_EXP__(-307)
+macro __FLT32X_MIN_EXP__(-1021)
+macro __FLT32X_MIN__ 2.22507385850720138309023271733240406e-308F32x
+macro __FLT32X_NORM_MAX__ 1.79769313486231570814527423731704357e+308F32x
+macro __FLT32_DECIMAL_DIG__ 9
+macro __FLT32_DENORM_MIN__ 1.40129846432481707092372958328991613e-45F32
+macro __FLT32_DIG__ 6
+macro __FLT32_EPSILON__ 1.19209289550781250000000000000000000e-7F32
+macro __FLT32_HAS_DENORM__ 1
+macro __FLT32_HAS_INFINITY__ 1
+macro __FLT32_HAS_QUIET_NAN__ 1
+macro __FLT32_IS_IEC_60559__ 2
+macro __FLT32_MANT_DIG__ 24
+macro __FLT32_MAX_10_EXP__ 38
+macro __FLT32_MAX_EXP__ 128
+macro __FLT32_MAX__ 3.40282346638528859811704183484516925e+38F32
+macro __FLT32_MIN_10_EXP__(-37)
+macro __FLT32_MIN_EXP__(-125)
+macro __FLT32_MIN__ 1.17549435082228750796873653722224568e-38F32
+macro __FLT32_NORM_MAX__ 3.40282346638528859811704183484516925e+38F32
+macro __FLT64X_DECIMAL_DIG__ 21
+macro __FLT64X_DENORM_MIN__ 3.64519953188247460252840593361941982e-4951F64x
+macro __FLT64X_DIG__ 18
+macro __FLT64X_EPSILON__ 1.08420217248550443400745280086994171e-19F64x
+macro __FLT64X_HAS_DENORM__ 1
+macro __FLT64X_HAS_INFINITY__ 1
+macro __FLT64X_HAS_QUIET_NAN__ 1
+macro __FLT64X_IS_IEC_60559__ 2
+macro __FLT64X_MANT_DIG__ 64
+macro __FLT64X_MAX_10_EXP__ 4932
+macro __FLT64X_MAX_EXP__ 16384
+macro __FLT64X_MAX__ 1.18973149535723176502126385303097021e+4932F64x
+macro __FLT64X_MIN_10_EXP__(-4931)
+macro __FLT64X_MIN_EXP__(-16381)
+macro __FLT64X_MIN__ 3.36210314311209350626267781732175260e-4932F64x
+macro __FLT64X_NORM_MAX__ 1.18973149535723176502126385303097021e+4932F64x
+macro __FLT64_DECIMAL_DIG__ 17
+macro __FLT64_DENORM_MIN__ 4.94065645841246544176568792868221372e-324F64
+macro __FLT64_DIG__ 15
+macro __FLT64_EPSILON__ 2.22044604925031308084726333618164062e-16F64
+macro __FLT64_HAS_DENORM__ 1
+macro __FLT64_HAS_INFINITY__ 1
+macro __FLT64_HAS_QUIET_NAN__ 1
+macro __FLT64_IS_IEC_60559__ 2
+macro __FLT64_MANT_DIG__ 53
+macro __FLT64_MAX_10_EXP__ 308
+macro __FLT64_MAX_EXP__ 1024
+macro __FLT64_MAX__ 1.79769313486231570814527423731704357e+308F64
+macro __FLT64_MIN_10_EXP__(-307)
+macro __FLT64_MIN_EXP__(-1021)
+macro __FLT64_MIN__ 2.22507385850720138309023271733240406e-308F64
+macro __FLT64_NORM_MAX__ 1.79769313486231570814527423731704357e+308F64
+macro __FLT_DECIMAL_DIG__ 9
+macro __FLT_DENORM_MIN__ 1.40129846432481707092372958328991613e-45F
+macro __FLT_DIG__ 6
+macro __FLT_EPSILON__ 1.19209289550781250000000000000000000e-7F
+macro __FLT_EVAL_METHOD_TS_18661_3__ 0
+macro __FLT_EVAL_METHOD__ 0
+macro __FLT_HAS_DENORM__ 1
+macro __FLT_HAS_INFINITY__ 1
+macro __FLT_HAS_QUIET_NAN__ 1
+macro __FLT_IS_IEC_60559__ 2
+macro __FLT_MANT_DIG__ 24
+macro __FLT_MAX_10_EXP__ 38
+macro __FLT_MAX_EXP__ 128
+macro __FLT_MAX__ 3.40282346638528859811704183484516925e+38F
+macro __FLT_MIN_10_EXP__(-37)
+macro __FLT_MIN_EXP__(-125)
+macro __FLT_MIN__ 1.17549435082228750796873653722224568e-38F
+macro __FLT_NORM_MAX__ 3.40282346638528859811704183484516925e+38F
+macro __FLT_RADIX__ 2
+macro __FXSR__ 1
+macro __GCC_ASM_FLAG_OUTPUTS__ 1
+macro __GCC_ATOMIC_BOOL_LOCK_FREE 2
+macro __GCC_ATOMIC_CHAR16_T_LOCK_FREE 2
+macro __GCC_ATOMIC_CHAR32_T_LOCK_FREE 2
+macro __GCC_ATOMIC_CHAR_LOCK_FREE 2
+macro __GCC_ATOMIC_INT_LOCK_FREE 2
+macro __GCC_ATOMIC_LLONG_LOCK_FREE 2
+macro __GCC_ATOMIC_LONG_LOCK_FREE 2
+macro __GCC_ATOMIC_POINTER_LOCK_FREE 2
+macro __GCC_ATOMIC_SHORT_LOCK_FREE 2
+macro __GCC_ATOMIC_TEST_AND_SET_TRUEVAL 1
+macro __GCC_ATOMIC_WCHAR_T_LOCK_FREE 2
+macro __GCC_CONSTRUCTIVE_SIZE 64
+macro __GCC_DESTRUCTIVE_SIZE 64
+macro __GCC_HAVE_DWARF2_CFI_ASM 1
+macro __GCC_HAVE_SYNC_COMPARE_AND_SWAP_1 1
+macro __GCC_HAVE_SYNC_COMPARE_AND_SWAP_2 1
+macro __GCC_HAVE_SYNC_COMPARE_AND_SWAP_4 1
+macro __GCC_HAVE_SYNC_COMPARE_AND_SWAP_8 1
+macro __GCC_IEC_559 2
+macro __GCC_IEC_559_COMPLEX 2
+macro __GLIBCXX_BITSIZE_INT_N_0 128
+macro __GLIBCXX_TYPE_INT_N_0 __int128
+macro __GNUC_EXECUTION_CHARSET_NAME "UTF-8"
+macro __GNUC_MINOR__ 2
+macro __GNUC_PATCHLEVEL__ 0
+macro __GNUC_STDC_INLINE__ 1
+macro __GNUC_WIDE_EXECUTION_CHARSET_NAME "UTF-32LE"
+macro __GNUC__ 12
+macro __GNUG__ 12
+macro __GXX_ABI_VERSION 1017
+macro __GXX_EXPERIMENTAL_CXX0X__ 1
+macro __GXX_RTTI 1
+macro __GXX_WEAK__ 1
+macro __HAVE_SPECULATION_SAFE_VALUE 1
+macro __INT16_C(c) c
+macro __INT16_MAX__ 0x7fff
+macro __INT16_TYPE__ short int
+macro __INT32_C(c) c
+macro __INT32_MAX__ 0x7fffffff
+macro __INT32_TYPE__ int
+macro __INT64_C(c) c ## L
+macro __INT64_MAX__ 0x7fffffffffffffffL
+macro __INT64_TYPE__ long int
+macro __INT8_C(c) c
+macro __INT8_MAX__ 0x7f
+macro __INT8_TYPE__ signed char
+macro __INTMAX_C(c) c ## L
+macro __INTMAX_MAX__ 0x7fffffffffffffffL
+macro __INTMAX_TYPE__ long int
+macro __INTMAX_WIDTH__ 64
+macro __INTPTR_MAX__ 0x7fffffffffffffffL
+macro __INTPTR_TYPE__ long int
+macro __INTPTR_WIDTH__ 64
+macro __INT_FAST16_MAX__ 0x7fffffffffffffffL
+macro __INT_FAST16_TYPE__ long int
+macro __INT_FAST16_WIDTH__ 64
+macro __INT_FAST32_MAX__ 0x7fffffffffffffffL
+macro __INT_FAST32_TYPE__ long int
+macro __INT_FAST32_WIDTH__ 64
+macro __INT_FAST64_MAX__ 0x7fffffffffffffffL
+macro __INT_FAST64_TYPE__ long int
+macro __INT_FAST64_WIDTH__ 64
+macro __INT_FAST8_MAX__ 0x7f
+macro __INT_FAST8_TYPE__ signed char
+macro __INT_FAST8_WIDTH__ 8
+macro __INT_LEAST16_MAX__ 0x7fff
+macro __INT_LEAST16_TYPE__ short int
+macro __INT_LEAST16_WIDTH__ 16
+macro __INT_LEAST32_MAX__ 0x7fffffff
+macro __INT_LEAST32_TYPE__ int
+macro __INT_LEAST32_WIDTH__ 32
+macro __INT_LEAST64_MAX__ 0x7fffffffffffffffL
+macro __INT_LEAST64_TYPE__ long int
+macro __INT_LEAST64_WIDTH__ 64
+macro __INT_LEAST8_MAX__ 0x7f
+macro __INT_LEAST8_TYPE__ signed char
+macro __INT_LEAST8_WIDTH__ 8
+macro __INT_MAX__ 0x7fffffff
+macro __INT_WIDTH__ 32
+macro __LDBL_DECIMAL_DIG__ 21
+macro __LDBL_DENORM_MIN__ 3.64519953188247460252840593361941982e-4951L
+macro __LDBL_DIG__ 18
+macro __LDBL_EPSILON__ 1.08420217248550443400745280086994171e-19L
+macro __LDBL_HAS_DENORM__ 1
+macro __LDBL_HAS_INFINITY__ 1
+macro __LDBL_HAS_QUIET_NAN__ 1
+macro __LDBL_IS_IEC_60559__ 2
+macro __LDBL_MANT_DIG__ 64
+macro __LDBL_MAX_10_EXP__ 4932
+macro __LDBL_MAX_EXP__ 16384
+macro __LDBL_MAX__ 1.18973149535723176502126385303097021e+4932L
+macro __LDBL_MIN_10_EXP__(-4931)
+macro __LDBL_MIN_EXP__(-16381)
+macro __LDBL_MIN__ 3.36210314311209350626267781732175260e-4932L
+macro __LDBL_NORM_MAX__ 1.18973149535723176502126385303097021e+4932L
+macro __LONG_LONG_MAX__ 0x7fffffffffffffffLL
+macro __LONG_LONG_WIDTH__ 64
+macro __LONG_MAX__ 0x7fffffffffffffffL
+macro __LONG_WIDTH__ 64
+macro __LP64__ 1
+macro __MMX_WITH_SSE__ 1
+macro __MMX__ 1
+macro __NO_INLINE__ 1
+macro __ORDER_BIG_ENDIAN__ 4321
+macro __ORDER_LITTLE_ENDIAN__ 1234
+macro __ORDER_PDP_ENDIAN__ 3412
+macro __PIC__ 2
+macro __PIE__ 2
+macro __PRAGMA_REDEFINE_EXTNAME 1
+macro __PTRDIFF_MAX__ 0x7fffffffffffffffL
+macro __PTRDIFF_TYPE__ long int
+macro __PTRDIFF_WIDTH__ 64
+macro __REGISTER_PREFIX__
+macro __SCHAR_MAX__ 0x7f
+macro __SCHAR_WIDTH__ 8
+macro __SEG_FS 1
+macro __SEG_GS 1
+macro __SHRT_MAX__ 0x7fff
+macro __SHRT_WIDTH__ 16
+macro __SIG_ATOMIC_MAX__ 0x7fffffff
+macro __SIG_ATOMIC_MIN__(-__SIG_ATOMIC_MAX__ - 1)
+macro __SIG_ATOMIC_TYPE__ int
+macro __SIG_ATOMIC_WIDTH__ 32
+macro __SIZEOF_DOUBLE__ 8
+macro __SIZEOF_FLOAT128__ 16
+macro __SIZEOF_FLOAT80__ 16
+macro __SIZEOF_FLOAT__ 4
+macro __SIZEOF_INT128__ 16
+macro __SIZEOF_INT__ 4
+macro __SIZEOF_LONG_DOUBLE__ 16
+macro __SIZEOF_LONG_LONG__ 8
+macro __SIZEOF_LONG__ 8
+macro __SIZEOF_POINTER__ 8
+macro __SIZEOF_PTRDIFF_T__ 8
+macro __SIZEOF_SHORT__ 2
+macro __SIZEOF_SIZE_T__ 8
+macro __SIZEOF_WCHAR_T__ 4
+macro __SIZEOF_WINT_T__ 4
+macro __SIZE_MAX__ 0xffffffffffffffffUL
+macro __SIZE_TYPE__ long unsigned int
+macro __SIZE_WIDTH__ 64
+macro __SSE2_MATH__ 1
+macro __SSE2__ 1
+macro __SSE_MATH__ 1
+macro __SSE__ 1
+macro __STDCPP_DEFAULT_NEW_ALIGNMENT__ 16
+macro __STDCPP_THREADS__ 1
+macro __STDC_HOSTED__ 1
+macro __STDC_IEC_559_COMPLEX__ 1
+macro __STDC_IEC_559__ 1
+macro __STDC_IEC_60559_BFP__ 201404L
+macro __STDC_IEC_60559_COMPLEX__ 201404L
+macro __STDC_ISO_10646__ 201706L
+macro __STDC_UTF_16__ 1
+macro __STDC_UTF_32__ 1
+macro __STDC__ 1
+macro __UINT16_C(c) c
+macro __UINT16_MAX__ 0xffff
+macro __UINT16_TYPE__ short unsigned int
+macro __UINT32_C(c) c ## U
+macro __UINT32_MAX__ 0xffffffffU
+macro __UINT32_TYPE__ unsigned int
+macro __UINT64_C(c) c ## UL
+macro __UINT64_MAX__ 0xffffffffffffffffUL
+macro __UINT64_TYPE__ long unsigned int
+macro __UINT8_C(c) c
+macro __UINT8_MAX__ 0xff
+macro __UINT8_TYPE__ unsigned char
+macro __UINTMAX_C(c) c ## UL
+macro __UINTMAX_MAX__ 0xffffffffffffffffUL
+macro __UINTMAX_TYPE__ long unsigned int
+macro __UINTPTR_MAX__ 0xffffffffffffffffUL
+macro __UINTPTR_TYPE__ long unsigned int
+macro __UINT_FAST16_MAX__ 0xffffffffffffffffUL
+macro __UINT_FAST16_TYPE__ long unsigned int
+macro __UINT_FAST32_MAX__ 0xffffffffffffffffUL
+macro __UINT_FAST32_TYPE__ long unsigned int
+macro __UINT_FAST64_MAX__ 0xffffffffffffffffUL
+macro __UINT_FAST64_TYPE__ long unsigned int
+macro __UINT_FAST8_MAX__ 0xff
+macro __UINT_FAST8_TYPE__ unsigned char
+macro __UINT_LEAST16_MAX__ 0xffff
+macro __UINT_LEAST16_TYPE__ short unsigned int
+macro __UINT_LEAST32_MAX__ 0xffffffffU
+macro __UINT_LEAST32_TYPE__ unsigned int
+macro __UINT_LEAST64_MAX__ 0xffffffffffffffffUL
+macro __UINT_LEAST64_TYPE__ long unsigned int
+macro __UINT_LEAST8_MAX__ 0xff
+macro __UINT_LEAST8_TYPE__ unsigned char
+macro __USER_LABEL_PREFIX__
+macro __VERSION__ "12.2.0"
+macro __WCHAR_MAX__ 0x7fffffff
+macro __WCHAR_MIN__(-__WCHAR_MAX__ - 1)
+macro __WCHAR_TYPE__ int
+macro __WCHAR_WIDTH__ 32
+macro __WINT_MAX__ 0xffffffffU
+macro __WINT_MIN__ 0U
+macro __WINT_TYPE__ unsigned int
+macro __WINT_WIDTH__ 32
+macro __amd64 1
+macro __amd64__ 1
+macro __code_model_small__ 1
+macro __cplusplus 201703L
+macro __cpp_aggregate_bases 201603L
+macro __cpp_aggregate_nsdmi 201304L
+macro __cpp_alias_templates 200704L
+macro __cpp_aligned_new 201606L
+macro __cpp_attributes 200809L
+macro __cpp_binary_literals 201304L
+macro __cpp_capture_star_this 201603L
+macro __cpp_constexpr 201603L
+macro __cpp_decltype 200707L
+macro __cpp_decltype_auto 201304L
+macro __cpp_deduction_guides 201703L
+macro __cpp_delegating_constructors 200604L
+macro __cpp_digit_separators 201309L
+macro __cpp_enumerator_attributes 201411L
+macro __cpp_exceptions 199711L
+macro __cpp_fold_expressions 201603L
+macro __cpp_generic_lambdas 201304L
+macro __cpp_guaranteed_copy_elision 201606L
+macro __cpp_hex_float 201603L
+macro __cpp_if_constexpr 201606L
+macro __cpp_inheriting_constructors 201511L
+macro __cpp_init_captures 201304L
+macro __cpp_initializer_lists 200806L
+macro __cpp_inline_variables 201606L
+macro __cpp_lambdas 200907L
+macro __cpp_namespace_attributes 201411L
+macro __cpp_nested_namespace_definitions 201411L
+macro __cpp_noexcept_function_type 201510L
+macro __cpp_nontype_template_args 201411L
+macro __cpp_nontype_template_parameter_auto 201606L
+macro __cpp_nsdmi 200809L
+macro __cpp_range_based_for 201603L
+macro __cpp_raw_strings 200710L
+macro __cpp_ref_qualifiers 200710L
+macro __cpp_return_type_deduction 201304L
+macro __cpp_rtti 199711L
+macro __cpp_runtime_arrays 198712L
+macro __cpp_rvalue_reference 200610L
+macro __cpp_rvalue_references 200610L
+macro __cpp_sized_deallocation 201309L
+macro __cpp_static_assert 201411L
+macro __cpp_structured_bindings 201606L
+macro __cpp_template_auto 201606L
+macro __cpp_template_template_args 201611L
+macro __cpp_threadsafe_static_init 200806L
+macro __cpp_unicode_characters 201411L
+macro __cpp_unicode_literals 200710L
+macro __cpp_user_defined_literals 200809L
+macro __cpp_variable_templates 201304L
+macro __cpp_variadic_templates 200704L
+macro __cpp_variadic_using 201611L
+macro __gnu_linux__ 1
+macro __k8 1
+macro __k8__ 1
+macro __linux 1
+macro __linux__ 1
+macro __pic__ 2
+macro __pie__ 2
+macro __unix 1
+macro __unix__ 1
+macro __x86_64 1
+macro __x86_64__ 1
+macro linux 1
+macro unix 1
+predefines 74
+typedef struct {   char x[16] __attribute__((aligned(16))); } __float128;
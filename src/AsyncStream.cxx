@@ -0,0 +1,158 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "AsyncStream.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//----------------------------------------------------------------------------
+/// Stream handing its own buffers to a writer thread.  The buffers form
+/// a ring: the producer fills buffer Tail while the writer writes
+/// buffers Head up to Tail, so no data are copied between threads and
+/// handing over a buffer takes no lock.
+class AsyncStream: public llvm::raw_ostream
+{
+  // Number of buffers: one being filled and the rest being written.
+  static const unsigned int NumBuffers = 4;
+
+  llvm::raw_ostream& OS;
+  uint64_t Pos;
+  size_t BufferSize;
+  std::vector<char> Buffers[NumBuffers];
+  size_t Sizes[NumBuffers];
+
+  // Number of buffers handed to the writer, and written by it.  Each is
+  // changed by one thread only.
+  std::atomic<unsigned int> Tail;
+  std::atomic<unsigned int> Head;
+  std::atomic<bool> Done;
+
+  // Let either thread sleep while the ring is full or empty.  The other
+  // thread takes the lock before waking it so the wake-up is not lost.
+  std::atomic<bool> ProducerWaiting;
+  std::atomic<bool> WriterWaiting;
+  std::mutex Lock;
+  std::condition_variable Wake;
+  std::thread Writer;
+
+  char* BufferAt(unsigned int n) {
+    return this->Buffers[n % NumBuffers].data();
+  }
+
+  void Notify(std::atomic<bool>& waiting) {
+    if(waiting) {
+      { std::lock_guard<std::mutex> lock(this->Lock); }
+      this->Wake.notify_all();
+    }
+  }
+
+  template <typename F> void WaitFor(std::atomic<bool>& waiting, F ready) {
+    if(ready()) {
+      return;
+    }
+    std::unique_lock<std::mutex> lock(this->Lock);
+    waiting = true;
+    this->Wake.wait(lock, ready);
+    waiting = false;
+  }
+
+  // Hand over the buffer being filled and start filling the next one
+  // once the writer is done with it.
+  void Publish(size_t size) {
+    unsigned int const tail = this->Tail;
+    this->Sizes[tail % NumBuffers] = size;
+    this->Tail = tail + 1;
+    this->Notify(this->WriterWaiting);
+    this->WaitFor(this->ProducerWaiting, [this, tail]() {
+        return tail + 2 - this->Head <= NumBuffers;
+      });
+    this->SetBuffer(this->BufferAt(tail + 1), this->BufferSize);
+  }
+
+  void write_impl(const char* ptr, size_t size) override {
+    this->Pos += size;
+    if(ptr == this->BufferAt(this->Tail)) {
+      // The usual case: our buffer is full or being flushed.
+      this->Publish(size);
+      return;
+    }
+    // Large writes bypass the buffer.  Copy them into our buffers.
+    while(size > 0) {
+      size_t const n = std::min(size, this->BufferSize);
+      memcpy(this->BufferAt(this->Tail), ptr, n);
+      this->Publish(n);
+      ptr += n;
+      size -= n;
+    }
+  }
+
+  uint64_t current_pos() const override {
+    return this->Pos;
+  }
+
+  void WriterLoop() {
+    for(;;) {
+      unsigned int const head = this->Head;
+      this->WaitFor(this->WriterWaiting, [this, head]() {
+          return this->Done || this->Tail != head;
+        });
+      if(this->Tail == head) {
+        break;
+      }
+      this->OS.write(this->BufferAt(head), this->Sizes[head % NumBuffers]);
+      this->Head = head + 1;
+      this->Notify(this->ProducerWaiting);
+    }
+  }
+
+public:
+  AsyncStream(llvm::raw_ostream& os, size_t chunkSize):
+    OS(os), Pos(0), BufferSize(std::max<size_t>(chunkSize, 1)),
+    Tail(0), Head(0), Done(false),
+    ProducerWaiting(false), WriterWaiting(false) {
+    for(unsigned int i = 0; i < NumBuffers; ++i) {
+      this->Buffers[i].resize(this->BufferSize);
+    }
+    this->SetBuffer(this->BufferAt(0), this->BufferSize);
+    this->Writer = std::thread(&AsyncStream::WriterLoop, this);
+  }
+
+  ~AsyncStream() {
+    this->flush();
+    this->Done = true;
+    {
+      std::lock_guard<std::mutex> lock(this->Lock);
+    }
+    this->Wake.notify_all();
+    this->Writer.join();
+    this->OS.flush();
+  }
+};
+
+//----------------------------------------------------------------------------
+std::unique_ptr<llvm::raw_ostream>
+createAsyncStream(llvm::raw_ostream& os, size_t chunkSize)
+{
+  return std::unique_ptr<llvm::raw_ostream>(new AsyncStream(os, chunkSize));
+}
@@ -0,0 +1,35 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_ASYNCSTREAM_H
+#define CASTXML_ASYNCSTREAM_H
+
+#include <cxsys/Configure.hxx>
+
+#include <memory>
+
+namespace llvm {
+  class raw_ostream;
+}
+
+/// createAsyncStream - Create a stream that collects everything written
+/// to it in chunks of the given size and writes them to another stream
+/// on a separate thread, in order.  Writing to the other stream, which
+/// may compress its input, then overlaps with producing the output.
+/// All data have been written once the stream is destroyed.
+std::unique_ptr<llvm::raw_ostream>
+createAsyncStream(llvm::raw_ostream& os, size_t chunkSize);
+
+#endif // CASTXML_ASYNCSTREAM_H
@@ -0,0 +1,1756 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Batch.h"
+#include "Context.h"
+#include "Detect.h"
+#include "Merge.h"
+#include "Options.h"
+#include "Prefetch.h"
+#include "RunClang.h"
+#include "Schedule.h"
+#include "SharedFS.h"
+#include "StringPool.h"
+#include "TimeReport.h"
+#include "Utils.h"
+
+#include <cxsys/SystemTools.hxx>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "clang/Basic/VirtualFileSystem.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/YAMLParser.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+# include <io.h>
+#else
+# include <errno.h>
+# include <poll.h>
+# include <signal.h>
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
+#if defined(__linux__)
+# include <sys/socket.h>
+# include <sys/stat.h>
+# include <sys/syscall.h>
+#endif
+
+//----------------------------------------------------------------------------
+/// The compiler named by '--castxml-cc-<id>' in the arguments of one or
+/// more batch entries, detected once for all of them.
+struct BatchCompiler
+{
+  BatchCompiler(): Detected(false) {}
+  std::string Id;
+  std::vector<std::string> Arguments;
+  Options Settings;
+  bool Detected;
+};
+
+//----------------------------------------------------------------------------
+struct BatchEntry
+{
+  std::string Directory;
+  std::string File;
+  std::string Output;
+  std::string Content;
+  bool HaveContent;
+  std::vector<std::string> Arguments;
+
+  // The '--castxml-cc-<id>' of the entry, if any, and the compiler
+  // detected for it.
+  std::string CCId;
+  std::vector<std::string> CCArguments;
+  BatchCompiler const* Compiler;
+  BatchEntry(): HaveContent(false), Compiler(nullptr) {}
+};
+
+//----------------------------------------------------------------------------
+class BatchStringSaver: public llvm::cl::StringSaver {
+  std::list<std::string> Strings;
+public:
+  const char* SaveString(const char* s) {
+    this->Strings.push_back(s);
+    return this->Strings.back().c_str();
+  }
+};
+
+//----------------------------------------------------------------------------
+static bool getScalar(llvm::yaml::Node* node, std::string& value)
+{
+  llvm::yaml::ScalarNode* scalar =
+    llvm::dyn_cast_or_null<llvm::yaml::ScalarNode>(node);
+  if(!scalar) {
+    return false;
+  }
+  llvm::SmallString<128> storage;
+  value = scalar->getValue(storage).str();
+  return true;
+}
+
+//----------------------------------------------------------------------------
+static bool extractEntryCC(BatchEntry& entry, std::string& error)
+{
+  // Take '--castxml-cc-<id> <cc>' or '--castxml-cc-<id> ( <cc> ... )'
+  // out of the compiler command line, which the real compiler never
+  // sees.
+  std::vector<std::string> args;
+  for(size_t i = 0; i < entry.Arguments.size(); ++i) {
+    std::string const& a = entry.Arguments[i];
+    if(i == 0 || a.compare(0, 13, "--castxml-cc-") != 0) {
+      args.push_back(a);
+      continue;
+    }
+    if(!entry.CCId.empty()) {
+      error = "'--castxml-cc-<id>' may be given at most once";
+      return false;
+    }
+    entry.CCId = a.substr(13);
+    if(++i == entry.Arguments.size() || entry.Arguments[i][0] == '-') {
+      error = "'" + a + "' must be followed by a compiler command";
+      return false;
+    }
+    if(entry.Arguments[i] != "(") {
+      entry.CCArguments.push_back(entry.Arguments[i]);
+      continue;
+    }
+    unsigned int depth = 1;
+    for(++i; i < entry.Arguments.size(); ++i) {
+      std::string const& c = entry.Arguments[i];
+      if(c == "(") {
+        ++depth;
+      } else if(c == ")" && --depth == 0) {
+        break;
+      }
+      entry.CCArguments.push_back(c);
+    }
+    if(depth) {
+      error = "unbalanced parentheses after '" + a + "'";
+      return false;
+    }
+    if(entry.CCArguments.empty()) {
+      error = "'" + a + "' must be followed by a compiler command";
+      return false;
+    }
+  }
+  entry.Arguments.swap(args);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+static bool parseBatchEntry(llvm::yaml::MappingNode* object,
+                            BatchEntry& entry, std::string& error)
+{
+  std::string command;
+  bool haveCommand = false;
+  bool haveArguments = false;
+  for(llvm::yaml::KeyValueNode& kv : *object) {
+    std::string key;
+    if(!getScalar(kv.getKey(), key)) {
+      error = "expected a string key";
+      return false;
+    }
+    llvm::yaml::Node* value = kv.getValue();
+    if(key == "arguments") {
+      llvm::yaml::SequenceNode* args =
+        llvm::dyn_cast_or_null<llvm::yaml::SequenceNode>(value);
+      if(!args) {
+        error = "expected an array for \"arguments\"";
+        return false;
+      }
+      for(llvm::yaml::Node& arg : *args) {
+        std::string a;
+        if(!getScalar(&arg, a)) {
+          error = "expected strings in \"arguments\"";
+          return false;
+        }
+        entry.Arguments.push_back(a);
+      }
+      haveArguments = true;
+    } else {
+      std::string s;
+      if(!getScalar(value, s)) {
+        error = "expected a string for \"" + key + "\"";
+        return false;
+      }
+      if(key == "directory") {
+        entry.Directory = s;
+      } else if(key == "file") {
+        entry.File = s;
+      } else if(key == "output") {
+        entry.Output = s;
+      } else if(key == "content") {
+        entry.Content = s;
+        entry.HaveContent = true;
+      } else if(key == "command") {
+        command = s;
+        haveCommand = true;
+      }
+    }
+  }
+
+  if(entry.File.empty()) {
+    error = "missing \"file\"";
+    return false;
+  }
+  if(!haveArguments) {
+    if(!haveCommand) {
+      error = "missing \"arguments\" or \"command\"";
+      return false;
+    }
+    BatchStringSaver saver;
+    llvm::SmallVector<const char*, 64> args;
+    llvm::cl::TokenizeGNUCommandLine(command, saver, args);
+    entry.Arguments.assign(args.begin(), args.end());
+  }
+  if(entry.Arguments.empty()) {
+    error = "missing compiler command";
+    return false;
+  }
+  return extractEntryCC(entry, error);
+}
+
+//----------------------------------------------------------------------------
+static bool loadBatchFile(std::string const& fname,
+                          std::vector<BatchEntry>& entries)
+{
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+    llvm::MemoryBuffer::getFile(fname);
+  if(!buffer) {
+    std::cerr << "error: unable to read batch file '" << fname << "': " <<
+      buffer.getError().message() << "\n";
+    return false;
+  }
+
+  llvm::SourceMgr sm;
+  llvm::yaml::Stream stream(buffer.get()->getBuffer(), sm);
+  llvm::yaml::document_iterator di = stream.begin();
+  llvm::yaml::SequenceNode* array = 0;
+  if(di != stream.end()) {
+    array = llvm::dyn_cast_or_null<llvm::yaml::SequenceNode>(di->getRoot());
+  }
+  if(!array) {
+    std::cerr << "error: batch file '" << fname <<
+      "' does not contain a JSON array\n";
+    return false;
+  }
+
+  for(llvm::yaml::Node& node : *array) {
+    std::string error = "expected an object";
+    BatchEntry entry;
+    llvm::yaml::MappingNode* object =
+      llvm::dyn_cast<llvm::yaml::MappingNode>(&node);
+    if(!object || !parseBatchEntry(object, entry, error)) {
+      std::cerr << "error: batch file '" << fname << "' entry " <<
+        (entries.size() + 1) << ": " << error << "\n";
+      return false;
+    }
+    entries.push_back(entry);
+  }
+  if(stream.failed()) {
+    std::cerr << "error: batch file '" << fname << "' is not valid JSON\n";
+    return false;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+static std::string fullPath(std::string const& path, std::string const& dir)
+{
+  if(dir.empty()) {
+    return cxsys::SystemTools::CollapseFullPath(path);
+  }
+  return cxsys::SystemTools::CollapseFullPath(path, dir);
+}
+
+//----------------------------------------------------------------------------
+static void filterEntryArguments(BatchEntry const& entry,
+                                 std::string const& file,
+                                 std::vector<std::string>& args)
+{
+  // The first argument names the real compiler.  Drop it along with
+  // options that name the real compiler's outputs and the source file,
+  // which is given explicitly at the end unless the entry holds its
+  // content.
+  for(size_t i = 1; i < entry.Arguments.size(); ++i) {
+    std::string const& a = entry.Arguments[i];
+    if(a == "-c" || a == "-MD" || a == "-MMD") {
+      continue;
+    } else if(a == "-o" || a == "-MF" || a == "-MT" || a == "-MQ") {
+      ++i;
+      continue;
+    } else if(a.size() > 2 && (a.compare(0, 2, "-o") == 0 ||
+                               a.compare(0, 3, "-MF") == 0 ||
+                               a.compare(0, 3, "-MT") == 0 ||
+                               a.compare(0, 3, "-MQ") == 0)) {
+      continue;
+    } else if(a[0] != '-' && fullPath(a, entry.Directory) == file) {
+      continue;
+    }
+    args.push_back(a);
+  }
+  if(!entry.HaveContent) {
+    args.push_back(file);
+  }
+}
+
+//----------------------------------------------------------------------------
+static void readEntryIncludes(BatchEntry const& entry,
+                              std::vector<std::string>& includes)
+{
+  // Find the dependency file the real compiler wrote for the entry,
+  // named by -MF or else beside the -o output of -MD or -MMD.
+  std::string depfile;
+  std::string output;
+  bool md = false;
+  for(size_t i = 1; i < entry.Arguments.size(); ++i) {
+    std::string const& a = entry.Arguments[i];
+    if(a == "-MF" && i + 1 < entry.Arguments.size()) {
+      depfile = entry.Arguments[++i];
+    } else if(a == "-o" && i + 1 < entry.Arguments.size()) {
+      output = entry.Arguments[++i];
+    } else if(a.size() > 3 && a.compare(0, 3, "-MF") == 0) {
+      depfile = a.substr(3);
+    } else if(a.size() > 2 && a.compare(0, 2, "-o") == 0) {
+      output = a.substr(2);
+    } else if(a == "-MD" || a == "-MMD") {
+      md = true;
+    }
+  }
+  if(depfile.empty() && md && !output.empty()) {
+    std::string const dir = cxsys::SystemTools::GetFilenamePath(output);
+    depfile = (dir.empty()? "" : dir + "/") +
+      cxsys::SystemTools::GetFilenameWithoutLastExtension(output) + ".d";
+  }
+  if(depfile.empty()) {
+    return;
+  }
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+    llvm::MemoryBuffer::getFile(fullPath(depfile, entry.Directory));
+  if(!buffer) {
+    return;
+  }
+  parseDependencyFile(buffer.get()->getBuffer(), includes);
+  for(std::string& f : includes) {
+    f = fullPath(f, entry.Directory);
+  }
+}
+
+//----------------------------------------------------------------------------
+static void detectEntryCompilers(std::vector<BatchEntry>& entries,
+                                 std::list<BatchCompiler>& compilers,
+                                 Options const& opts, Context const& ctx)
+{
+  // Group the entries by compiler command so that each is detected
+  // once however many entries name it.
+  std::map<std::vector<std::string>, BatchCompiler*> byCommand;
+  for(BatchEntry& entry : entries) {
+    if(entry.CCId.empty()) {
+      continue;
+    }
+    std::vector<std::string> command(1, entry.CCId);
+    command.insert(command.end(), entry.CCArguments.begin(),
+                   entry.CCArguments.end());
+    BatchCompiler*& c = byCommand[command];
+    if(!c) {
+      compilers.push_back(BatchCompiler());
+      c = &compilers.back();
+      c->Id = entry.CCId;
+      c->Arguments = entry.CCArguments;
+      c->Settings = opts;
+    }
+    entry.Compiler = c;
+  }
+  if(compilers.empty()) {
+    return;
+  }
+
+  // Detection mostly waits for the compiler processes, so run the
+  // probes of all the compilers at once.
+  PhaseRegion t("Compiler detection");
+  std::vector<std::thread> threads;
+  for(BatchCompiler& c : compilers) {
+    threads.push_back(std::thread([&c, &ctx]() {
+      TraceRegion tr("Compiler detection", c.Arguments[0]);
+      std::vector<const char*> args;
+      for(std::string const& a : c.Arguments) {
+        args.push_back(a.c_str());
+      }
+      c.Detected = detectCC(c.Id.c_str(), args.data(),
+                            args.data() + args.size(), ctx, c.Settings);
+    }));
+  }
+  for(std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+//----------------------------------------------------------------------------
+struct BatchJob
+{
+  BatchJob(): Size(0), Memory(0), Seconds(0), Result(0) {}
+  std::string File;
+  uint64_t Size;
+  size_t Memory;
+  double Seconds;
+  std::string Diagnostics;
+  int Result;
+};
+
+//----------------------------------------------------------------------------
+static void runBatchEntry(BatchEntry const& entry, BatchJob& job,
+                          const char* const* argBeg,
+                          const char* const* argEnd,
+                          Options const& opts, Context& ctx,
+                          bool buffer, JobPipeline* pipeline = nullptr)
+{
+  std::chrono::steady_clock::time_point const start =
+    std::chrono::steady_clock::now();
+  std::string const& file = job.File;
+
+  std::vector<std::string> entryArgs;
+  if(!entry.Directory.empty()) {
+    entryArgs.push_back("-working-directory");
+    entryArgs.push_back(entry.Directory);
+  }
+  filterEntryArguments(entry, file, entryArgs);
+
+  std::vector<const char*> args(argBeg, argEnd);
+  for(std::vector<std::string>::const_iterator ai = entryArgs.begin();
+      ai != entryArgs.end(); ++ai) {
+    args.push_back(ai->c_str());
+  }
+
+  // Configure the entry for the compiler it names, if any.  An entry
+  // whose compiler was not detected fails as the run would.
+  Options entryOpts = opts;
+  if(BatchCompiler const* c = entry.Compiler) {
+    if(!c->Detected) {
+      job.Result = 1;
+      return;
+    }
+    entryOpts.HaveCC = true;
+    entryOpts.Predefines = c->Settings.Predefines;
+    entryOpts.PredefinedMacros = c->Settings.PredefinedMacros;
+    entryOpts.Includes = c->Settings.Includes;
+    entryOpts.Triple = c->Settings.Triple;
+  }
+  if(!entry.Output.empty()) {
+    entryOpts.OutputFile = fullPath(entry.Output, entry.Directory);
+  } else if(opts.GccXml) {
+    entryOpts.OutputFile = fullPath(
+      cxsys::SystemTools::GetFilenameWithoutLastExtension(file) + ".xml",
+      entry.Directory);
+  }
+  if(entry.HaveContent) {
+    entryOpts.SourceBufferName = file;
+    entryOpts.SourceBuffer = entry.Content;
+  }
+  entryOpts.JobCostsFile.clear();
+  entryOpts.MemoryUsed = &job.Memory;
+  JobLimits limits(opts.Timeout, opts.MemoryLimit);
+  entryOpts.Limits = &limits;
+
+  // Wait for the parsing stage of a pipeline, which the job leaves
+  // once it starts its output or fails.
+  std::unique_ptr<PipelineJob> stage;
+  if(pipeline) {
+    stage.reset(new PipelineJob(*pipeline));
+    entryOpts.Pipeline = stage.get();
+  }
+
+  // Buffer diagnostics so they can be printed in order of the entries.
+  llvm::raw_string_ostream diagOS(job.Diagnostics);
+  if(buffer) {
+    entryOpts.DiagnosticStream = &diagOS;
+  }
+  job.Result = runClang(args.data(), args.data() + args.size(), entryOpts,
+                        ctx);
+  diagOS.flush();
+
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  job.Seconds = d.count();
+}
+
+#if !defined(_WIN32)
+//----------------------------------------------------------------------------
+/// A forked process to which the parent gives batch entries to run.
+/// The parent writes the number of each job as a line to JobFD.  The
+/// worker runs it and replies on ResultFD with a line holding the
+/// result, memory, seconds, and diagnostics size, followed by the
+/// diagnostics.  A worker exits when JobFD is closed.
+struct BatchWorker
+{
+  BatchWorker(): Pid(-1), JobFD(-1), ResultFD(-1), Job(0), Busy(false) {}
+  pid_t Pid;
+  int JobFD;
+  int ResultFD;
+  size_t Job;
+  bool Busy;
+  std::string Reply;
+};
+
+//----------------------------------------------------------------------------
+static bool writeAll(int fd, std::string const& data)
+{
+  const char* p = data.data();
+  size_t n = data.size();
+  while(n > 0) {
+    ssize_t r = write(fd, p, n);
+    if(r < 0 && errno == EINTR) {
+      continue;
+    }
+    if(r <= 0) {
+      return false;
+    }
+    p += r;
+    n -= size_t(r);
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+static void runBatchWorkerProcess(int jobFD, int resultFD,
+                                  std::vector<BatchEntry> const& entries,
+                                  std::vector<BatchJob>& jobs,
+                                  const char* const* argBeg,
+                                  const char* const* argEnd,
+                                  Options const& opts, Context& ctx)
+{
+  std::string line;
+  char c;
+  for(;;) {
+    ssize_t r = read(jobFD, &c, 1);
+    if(r < 0 && errno == EINTR) {
+      continue;
+    }
+    if(r <= 0) {
+      break;
+    }
+    if(c != '\n') {
+      line += c;
+      continue;
+    }
+    size_t const i = strtoul(line.c_str(), 0, 10);
+    line.clear();
+    if(i >= jobs.size()) {
+      break;
+    }
+    BatchJob& job = jobs[i];
+    runBatchEntry(entries[i], job, argBeg, argEnd, opts, ctx, true);
+    char header[128];
+    snprintf(header, sizeof(header), "%d %llu %.6f %llu\n", job.Result,
+             static_cast<unsigned long long>(job.Memory), job.Seconds,
+             static_cast<unsigned long long>(job.Diagnostics.size()));
+    if(!writeAll(resultFD, header + job.Diagnostics)) {
+      break;
+    }
+    job.Diagnostics.clear();
+  }
+}
+
+//----------------------------------------------------------------------------
+static bool startBatchWorker(std::vector<BatchWorker>& workers, size_t w,
+                             std::vector<BatchEntry> const& entries,
+                             std::vector<BatchJob>& jobs,
+                             const char* const* argBeg,
+                             const char* const* argEnd,
+                             Options const& opts, Context& ctx)
+{
+  int jobPipe[2];
+  int resultPipe[2];
+  if(pipe(jobPipe) != 0) {
+    return false;
+  }
+  if(pipe(resultPipe) != 0) {
+    close(jobPipe[0]);
+    close(jobPipe[1]);
+    return false;
+  }
+
+  // Flush buffered output so the child does not write it again.
+  llvm::outs().flush();
+  llvm::errs().flush();
+  std::cout.flush();
+  std::cerr.flush();
+
+  pid_t pid = fork();
+  if(pid < 0) {
+    close(jobPipe[0]);
+    close(jobPipe[1]);
+    close(resultPipe[0]);
+    close(resultPipe[1]);
+    return false;
+  }
+  if(pid == 0) {
+    // Close the parent's ends of the pipes of every worker so that
+    // each worker sees the end of its jobs when the parent closes it.
+    close(jobPipe[1]);
+    close(resultPipe[0]);
+    for(BatchWorker const& other : workers) {
+      if(other.JobFD >= 0) {
+        close(other.JobFD);
+      }
+      if(other.ResultFD >= 0) {
+        close(other.ResultFD);
+      }
+    }
+    signal(SIGPIPE, SIG_DFL);
+    if(opts.Numa) {
+      NumaPlacement(workers.size()).Bind(w);
+    }
+    runBatchWorkerProcess(jobPipe[0], resultPipe[1], entries, jobs,
+                          argBeg, argEnd, opts, ctx);
+
+    // Skip the exit-time reports of the parent process.
+    _exit(0);
+  }
+  close(jobPipe[0]);
+  close(resultPipe[1]);
+  BatchWorker& worker = workers[w];
+  worker.Pid = pid;
+  worker.JobFD = jobPipe[1];
+  worker.ResultFD = resultPipe[0];
+  worker.Busy = false;
+  worker.Reply.clear();
+  return true;
+}
+
+//----------------------------------------------------------------------------
+static void stopBatchWorker(BatchWorker& worker, int* status)
+{
+  close(worker.JobFD);
+  close(worker.ResultFD);
+  worker.JobFD = -1;
+  worker.ResultFD = -1;
+  int s = 0;
+  while(waitpid(worker.Pid, &s, 0) < 0 && errno == EINTR) {
+  }
+  worker.Pid = -1;
+  if(status) {
+    *status = s;
+  }
+}
+
+//----------------------------------------------------------------------------
+static bool parseBatchReply(BatchWorker& worker, BatchJob& job)
+{
+  std::string::size_type const eol = worker.Reply.find('\n');
+  if(eol == std::string::npos) {
+    return false;
+  }
+  int result;
+  unsigned long long memory;
+  double seconds;
+  unsigned long long size;
+  if(sscanf(worker.Reply.c_str(), "%d %llu %lf %llu", &result, &memory,
+            &seconds, &size) != 4) {
+    return false;
+  }
+  if(worker.Reply.size() - (eol + 1) < size) {
+    return false;
+  }
+  job.Result = result;
+  job.Memory = size_t(memory);
+  job.Seconds = seconds;
+  job.Diagnostics = worker.Reply.substr(eol + 1, size_t(size));
+  worker.Reply.erase(0, eol + 1 + size_t(size));
+  return true;
+}
+
+//----------------------------------------------------------------------------
+static void runBatchWorkers(std::vector<BatchEntry> const& entries,
+                            std::vector<BatchJob>& jobs,
+                            std::vector<double> const& estimates,
+                            std::vector<uint64_t> const& memory,
+                            size_t processes,
+                            const char* const* argBeg,
+                            const char* const* argEnd,
+                            Options const& opts, Context& ctx)
+{
+  // Do the setup shared by all entries once so that the workers share
+  // it copy-on-write instead of each doing it again.
+  prepareRunClang(opts, ctx);
+
+  // A write to a worker that has crashed must not end this process.
+  void (*oldPipeHandler)(int) = signal(SIGPIPE, SIG_IGN);
+
+  std::vector<BatchWorker> workers(processes);
+  for(size_t w = 0; w < processes; ++w) {
+    startBatchWorker(workers, w, entries, jobs, argBeg, argEnd, opts, ctx);
+  }
+
+  std::vector<size_t> const order = orderJobs(estimates);
+  size_t next = 0;
+  size_t running = 0;
+  uint64_t reserved = 0;
+  while(next < order.size() || running > 0) {
+    // Give the next jobs to idle workers while they fit in the budget.
+    for(BatchWorker& worker : workers) {
+      if(next >= order.size()) {
+        break;
+      }
+      size_t const i = order[next];
+      if(opts.MemoryBudget && running > 0 &&
+         reserved + memory[i] > opts.MemoryBudget) {
+        break;
+      }
+      if(worker.Pid < 0 || worker.Busy) {
+        continue;
+      }
+      worker.Job = i;
+      worker.Busy = true;
+      ++next;
+      ++running;
+      reserved += memory[i];
+      // A failed write shows up below as the end of the reply.
+      writeAll(worker.JobFD, std::to_string(i) + "\n");
+    }
+    if(running == 0) {
+      // No worker is left to run the remaining jobs.
+      for(; next < order.size(); ++next) {
+        BatchJob& job = jobs[order[next]];
+        job.Result = 1;
+        job.Diagnostics = "error: unable to start a castxml worker "
+          "process for '" + job.File + "'\n";
+      }
+      break;
+    }
+
+    // Wait for a busy worker to reply or exit.
+    std::vector<struct pollfd> fds;
+    std::vector<size_t> polled;
+    for(size_t w = 0; w < workers.size(); ++w) {
+      if(workers[w].Busy) {
+        struct pollfd pfd;
+        pfd.fd = workers[w].ResultFD;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        fds.push_back(pfd);
+        polled.push_back(w);
+      }
+    }
+    if(poll(&fds[0], fds.size(), -1) < 0) {
+      continue;
+    }
+    for(size_t p = 0; p < fds.size(); ++p) {
+      if(!fds[p].revents) {
+        continue;
+      }
+      size_t const w = polled[p];
+      BatchWorker& worker = workers[w];
+      BatchJob& job = jobs[worker.Job];
+      char buf[4096];
+      ssize_t r = read(worker.ResultFD, buf, sizeof(buf));
+      if(r < 0 && errno == EINTR) {
+        continue;
+      }
+      if(r > 0) {
+        worker.Reply.append(buf, size_t(r));
+        if(!parseBatchReply(worker, job)) {
+          continue;
+        }
+      } else {
+        // The worker ended without replying.  Fail its job and start
+        // another worker in its place.
+        int status;
+        stopBatchWorker(worker, &status);
+        job.Result = 1;
+        job.Memory = 0;
+        job.Diagnostics += "error: castxml worker process ";
+        if(WIFSIGNALED(status)) {
+          job.Diagnostics += "killed by signal " +
+            std::to_string(WTERMSIG(status));
+        } else {
+          job.Diagnostics += "exited unexpectedly";
+        }
+        job.Diagnostics += " while processing '" + job.File + "'\n";
+        if(next < order.size()) {
+          startBatchWorker(workers, w, entries, jobs, argBeg, argEnd, opts,
+                           ctx);
+        }
+      }
+      worker.Busy = false;
+      --running;
+      reserved -= memory[worker.Job];
+    }
+  }
+
+  for(BatchWorker& worker : workers) {
+    if(worker.Pid >= 0) {
+      stopBatchWorker(worker, nullptr);
+    }
+  }
+  signal(SIGPIPE, oldPipeHandler);
+}
+#endif
+
+//----------------------------------------------------------------------------
+int runBatch(const char* const* argBeg,
+             const char* const* argEnd,
+             Options const& batchOpts,
+             Context& ctx)
+{
+  std::vector<BatchEntry> entries;
+  if(!loadBatchFile(batchOpts.BatchFile, entries)) {
+    return 1;
+  }
+
+  // Load the headers the prefetch list expects in batches through
+  // io_uring, if requested, into a file system the entries share.
+  // Forked workers inherit what is loaded.
+  Options opts = batchOpts;
+  StringPool strings;
+  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> preloaded;
+  if(opts.PrefetchIoUring && !opts.SharedFiles) {
+    std::vector<std::string> files;
+    readPrefetchList(opts.PrefetchFile, files);
+    preloaded =
+      createSharedFileSystem(clang::vfs::getRealFileSystem(), &files);
+    opts.SharedFiles = preloaded.get();
+  }
+
+  // Detect the compilers named by the entries before any worker is
+  // started, so that forked workers share the results.
+  std::list<BatchCompiler> compilers;
+  detectEntryCompilers(entries, compilers, opts, ctx);
+
+  // Estimate the time and memory each entry will take so the longest
+  // can start first and no more run at once than fit in the memory
+  // budget.  Preprocessed output goes to stdout, so with -E the entries
+  // run one at a time in order.
+  JobCosts costs;
+  if(!opts.JobCostsFile.empty()) {
+    costs.Load(opts.JobCostsFile);
+  }
+  std::vector<BatchJob> jobs(entries.size());
+  std::vector<double> estimates;
+  std::vector<uint64_t> memory;
+  for(size_t i = 0; i < entries.size(); ++i) {
+    BatchEntry const& entry = entries[i];
+    BatchJob& job = jobs[i];
+    job.File = fullPath(entry.File, entry.Directory);
+    job.Size = entry.HaveContent? entry.Content.size() :
+      cxsys::SystemTools::FileLength(job.File);
+    estimates.push_back(costs.Estimate(job.File, job.Size));
+    memory.push_back(costs.EstimateMemory(job.File, job.Size));
+  }
+  size_t threads =
+    opts.PPOnly? 1 : std::min<size_t>(opts.Jobs, entries.size());
+
+  // A pipeline parses on one worker while the other writes output.
+  std::unique_ptr<JobPipeline> pipeline;
+  if(opts.Pipelined && entries.size() > 1) {
+    pipeline.reset(new JobPipeline);
+    threads = 2;
+  }
+
+#if !defined(_WIN32)
+  if(threads > 1 && opts.WorkerProcesses) {
+    runBatchWorkers(entries, jobs, estimates, memory, threads,
+                    argBeg, argEnd, opts, ctx);
+  } else
+#endif
+  {
+    // The worker threads intern the strings of their output in one
+    // pool.  Worker processes could not share it.
+    if(!opts.Strings && threads > 1) {
+      opts.Strings = &strings;
+    }
+
+    // Each worker thread but the first runs with a context of its own.
+    std::vector<std::unique_ptr<Context> > contexts(threads);
+    for(size_t w = 1; w < threads; ++w) {
+      contexts[w].reset(new Context);
+      contexts[w]->ResourceDir = ctx.ResourceDir;
+      contexts[w]->ClangResourceDir = ctx.ClangResourceDir;
+    }
+
+    // Bind the workers to NUMA nodes if requested, with the files read
+    // by the workers of each node shared by them alone.
+    std::unique_ptr<NumaPlacement> numa;
+    std::vector<Options> nodeOpts;
+    std::vector<llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> > nodeFiles;
+    if(opts.Numa && threads > 1) {
+      numa.reset(new NumaPlacement(threads));
+      nodeOpts.assign(numa->NodeCount(), opts);
+      for(Options& o : nodeOpts) {
+        if(!o.SharedFiles) {
+          nodeFiles.push_back(
+            createSharedFileSystem(clang::vfs::getRealFileSystem()));
+          o.SharedFiles = nodeFiles.back().get();
+        }
+      }
+    }
+    auto run = [&](size_t i, size_t worker) {
+      runBatchEntry(entries[i], jobs[i], argBeg, argEnd,
+                    numa? nodeOpts[numa->NodeOf(worker)] : opts,
+                    worker? *contexts[worker] : ctx, threads > 1,
+                    pipeline.get());
+    };
+    if(opts.JobAffinity && !pipeline && threads > 1) {
+      std::vector<std::vector<std::string> > includes(entries.size());
+      for(size_t i = 0; i < entries.size(); ++i) {
+        readEntryIncludes(entries[i], includes[i]);
+      }
+      runJobsByAffinity(estimates, memory, opts.MemoryBudget, threads,
+                        includes, run, numa.get());
+    } else {
+      runJobs(estimates, memory, opts.MemoryBudget, threads, run,
+              numa.get());
+    }
+  }
+
+  int result = 0;
+  for(BatchJob const& job : jobs) {
+    costs.Record(job.File, job.Size, job.Seconds, job.Memory);
+    if(threads > 1) {
+      llvm::errs() << job.Diagnostics;
+    }
+    if(job.Result != 0) {
+      result = 1;
+    }
+  }
+  if(!opts.JobCostsFile.empty()) {
+    costs.Save(opts.JobCostsFile);
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------
+/// A '--castxml-server' request read from its line, waiting to run.
+struct ServerRequest
+{
+  ServerRequest(): BufferSize(0), Query(false), Memory(false),
+    Parsed(false), Batch(false), Cancelled(false) {}
+  BatchStringSaver Saver;
+  Options Opts;
+  std::vector<const char*> Args;
+  size_t BufferSize;
+  bool Query;
+  bool Memory;
+  bool Parsed;
+
+  // Whether '--castxml-priority batch' lets interactive requests read
+  // later run first.
+  bool Batch;
+
+  // The '--castxml-request-id' printed with the result, if any.
+  std::string Id;
+
+  // Whether a "castxml-cancel" line followed the request before it ran.
+  bool Cancelled;
+
+  // The digest of what the request computes, if its output may be
+  // shared with identical requests waiting at the same time.
+  std::string Key;
+};
+
+//----------------------------------------------------------------------------
+static bool parseServerRequest(llvm::SmallVectorImpl<const char*>& reqArgs,
+                               ServerRequest& req)
+{
+  Options& opts = req.Opts;
+  std::vector<const char*>& args = req.Args;
+  size_t& bufferSize = req.BufferSize;
+  bool& query = req.Query;
+  bool& memory = req.Memory;
+  size_t const argCount = args.size();
+  bool haveStart = false;
+  for(size_t i = 0; i < reqArgs.size(); ++i) {
+    if(strcmp(reqArgs[i], "-o") == 0) {
+      if((i+1) < reqArgs.size()) {
+        opts.OutputFile = reqArgs[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '-o' is missing (expected 1 value)\n";
+        return false;
+      }
+    } else if(strcmp(reqArgs[i], "--castxml-start") == 0) {
+      if((i+1) < reqArgs.size()) {
+        if(!haveStart) {
+          opts.StartNames.clear();
+          haveStart = true;
+        }
+        opts.StartNames.push_back(reqArgs[++i]);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-start' is missing "
+          "(expected 1 value)\n";
+        return false;
+      }
+    } else if(strcmp(reqArgs[i], "--castxml-query") == 0) {
+      if((i+1) < reqArgs.size()) {
+        if(!query) {
+          opts.StartNames.clear();
+          query = true;
+        }
+        opts.StartNames.push_back(reqArgs[++i]);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-query' is missing "
+          "(expected 1 value)\n";
+        return false;
+      }
+    } else if(strcmp(reqArgs[i], "--castxml-output-memfd") == 0) {
+      memory = true;
+    } else if(strcmp(reqArgs[i], "--castxml-priority") == 0) {
+      if((i+1) < reqArgs.size()) {
+        ++i;
+        if(strcmp(reqArgs[i], "batch") == 0) {
+          req.Batch = true;
+        } else if(strcmp(reqArgs[i], "interactive") == 0) {
+          req.Batch = false;
+        } else {
+          std::cerr <<
+            "error: '--castxml-priority' expects 'interactive' or "
+            "'batch'\n";
+          return false;
+        }
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-priority' is missing "
+          "(expected 1 value)\n";
+        return false;
+      }
+    } else if(strcmp(reqArgs[i], "--castxml-request-id") == 0) {
+      if((i+1) < reqArgs.size()) {
+        req.Id = reqArgs[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-request-id' is missing "
+          "(expected 1 value)\n";
+        return false;
+      }
+    } else if(strcmp(reqArgs[i], "--castxml-retain-ast") == 0) {
+      opts.RetainAST = true;
+    } else if(strcmp(reqArgs[i], "--castxml-source-buffer") == 0) {
+      if((i+2) < reqArgs.size()) {
+        char* end;
+        opts.SourceBufferName = reqArgs[++i];
+        bufferSize = strtoul(reqArgs[++i], &end, 10);
+        if(*end != '\0' || opts.SourceBufferName.empty()) {
+          std::cerr <<
+            "error: '--castxml-source-buffer' expects a file name and a "
+            "size\n";
+          return false;
+        }
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-source-buffer' is missing "
+          "(expected 2 values)\n";
+        return false;
+      }
+    } else {
+      args.push_back(reqArgs[i]);
+    }
+  }
+
+  // A query naming an input is answered from the translation unit kept
+  // for it, parsed and kept again if it is not, and otherwise from the
+  // one used last.
+  if(query && haveStart) {
+    std::cerr <<
+      "error: '--castxml-query' may not be given with '--castxml-start'\n";
+    return false;
+  }
+  if(query && (opts.RetainAST || !opts.SourceBufferName.empty() ||
+               args.size() != argCount)) {
+    opts.RetainAST = true;
+    query = false;
+  }
+  if(query && opts.OutputFile.empty()) {
+    std::cerr << "error: '--castxml-query' requires '-o'\n";
+    return false;
+  }
+  if(memory && (!opts.GccXml || query || !opts.OutputFile.empty())) {
+    std::cerr <<
+      "error: '--castxml-output-memfd' requires '--castxml-gccxml' and "
+      "may not be given with '-o' or '--castxml-query'\n";
+    return false;
+  }
+#if !defined(__linux__) || !defined(SYS_memfd_create)
+  if(memory) {
+    std::cerr <<
+      "error: '--castxml-output-memfd' is not supported on this host\n";
+    return false;
+  }
+#endif
+  return true;
+}
+
+#if defined(__linux__) && defined(SYS_memfd_create)
+//----------------------------------------------------------------------------
+static void sendOutputMemory(int fd, uint64_t size)
+{
+  // Name the descriptor so that a client on this host may open and map
+  // it, and pass it along with the line to a client connected by a
+  // Unix domain socket.
+  std::string const line = "castxml-output /proc/" +
+    std::to_string(getpid()) + "/fd/" + std::to_string(fd) + " " +
+    std::to_string(size) + "\n";
+  std::cout.flush();
+  struct stat st;
+  if(fstat(STDOUT_FILENO, &st) == 0 && S_ISSOCK(st.st_mode)) {
+    struct iovec iov;
+    iov.iov_base = const_cast<char*>(line.data());
+    iov.iov_len = line.size();
+    union {
+      struct cmsghdr Header;
+      char Space[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.Space;
+    msg.msg_controllen = sizeof(control.Space);
+    struct cmsghdr* c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(c), &fd, sizeof(int));
+    ssize_t const n = sendmsg(STDOUT_FILENO, &msg, 0);
+    if(n >= 0) {
+      std::cout << line.substr(size_t(n)) << std::flush;
+      return;
+    }
+  }
+  std::cout << line << std::flush;
+}
+#endif
+
+//----------------------------------------------------------------------------
+/// The requests of '--castxml-server' and the source buffers following
+/// them, read from standard input.  What is read ahead while a request
+/// runs is kept for the requests after it.
+class ServerInput
+{
+  std::string Buffer;
+  size_t Pos;
+  bool End;
+public:
+  ServerInput(): Pos(0), End(false) {}
+
+  /** Read more of the input, waiting for it if none is available.
+      Return false at the end of the input.  */
+  bool Fill();
+
+  /** Take the next line, without its newline, as std::getline does.  */
+  bool ReadLine(std::string& line);
+
+  /** Take the given number of bytes.  */
+  bool Read(char* data, size_t size);
+
+  /** Return whether more of the input has been sent, so that reading
+      it does not wait for the client.  */
+  bool Ready();
+
+  /** Return whether the next line has been read completely, and if it
+      is "castxml-cancel", take it and set cancel.  */
+  bool TakeCancel(bool& cancel);
+};
+
+//----------------------------------------------------------------------------
+bool ServerInput::Fill()
+{
+  if(this->End) {
+    return false;
+  }
+  this->Buffer.erase(0, this->Pos);
+  this->Pos = 0;
+  char data[65536];
+#if defined(_WIN32)
+  int const n = _read(0, data, sizeof(data));
+#else
+  ssize_t n;
+  do {
+    n = read(STDIN_FILENO, data, sizeof(data));
+  } while(n < 0 && errno == EINTR);
+#endif
+  if(n <= 0) {
+    this->End = true;
+    return false;
+  }
+  this->Buffer.append(data, size_t(n));
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool ServerInput::ReadLine(std::string& line)
+{
+  size_t nl;
+  while((nl = this->Buffer.find('\n', this->Pos)) == std::string::npos) {
+    if(!this->Fill()) {
+      if(this->Pos == this->Buffer.size()) {
+        return false;
+      }
+      nl = this->Buffer.size();
+      break;
+    }
+  }
+  line.assign(this->Buffer, this->Pos, nl - this->Pos);
+  this->Pos = std::min(nl + 1, this->Buffer.size());
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool ServerInput::Read(char* data, size_t size)
+{
+  while(this->Buffer.size() - this->Pos < size) {
+    if(!this->Fill()) {
+      return false;
+    }
+  }
+  memcpy(data, this->Buffer.data() + this->Pos, size);
+  this->Pos += size;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool ServerInput::Ready()
+{
+  if(this->Pos < this->Buffer.size()) {
+    return true;
+  }
+  if(this->End) {
+    return false;
+  }
+#if defined(_WIN32)
+  return false;
+#else
+  struct pollfd fd;
+  fd.fd = STDIN_FILENO;
+  fd.events = POLLIN;
+  fd.revents = 0;
+  return poll(&fd, 1, 0) > 0;
+#endif
+}
+
+//----------------------------------------------------------------------------
+bool ServerInput::TakeCancel(bool& cancel)
+{
+  size_t const nl = this->Buffer.find('\n', this->Pos);
+  if(nl == std::string::npos) {
+    return this->End;
+  }
+  llvm::StringRef line(this->Buffer.data() + this->Pos, nl - this->Pos);
+  if(line.rtrim("\r") == "castxml-cancel") {
+    this->Pos = nl + 1;
+    cancel = true;
+  }
+  return true;
+}
+
+#if !defined(_WIN32)
+//----------------------------------------------------------------------------
+/// Watch the client of '--castxml-server' on another thread while a
+/// request runs, and cancel the request if the client sends a line
+/// "castxml-cancel" or closes its end of standard output.  A cancel
+/// refers to the request read last, so it is taken only if the
+/// running request is that one.
+class ServerWatch
+{
+  ServerInput& Input;
+  std::atomic<bool>& Cancel;
+  bool TakeCancel;
+  bool Gone;
+  int StopPipe[2];
+  std::thread Thread;
+  void Run();
+public:
+  ServerWatch(ServerInput& input, std::atomic<bool>& cancel,
+              bool takeCancel);
+  ~ServerWatch() { this->Stop(); }
+
+  /** Stop watching.  Return whether the client has gone away.  */
+  bool Stop();
+};
+
+//----------------------------------------------------------------------------
+ServerWatch::ServerWatch(ServerInput& input, std::atomic<bool>& cancel,
+                         bool takeCancel):
+  Input(input), Cancel(cancel), TakeCancel(takeCancel), Gone(false)
+{
+  if(pipe(this->StopPipe) == 0) {
+    this->Thread = std::thread(&ServerWatch::Run, this);
+  } else {
+    this->StopPipe[0] = this->StopPipe[1] = -1;
+  }
+}
+
+//----------------------------------------------------------------------------
+bool ServerWatch::Stop()
+{
+  if(this->Thread.joinable()) {
+    char const c = 0;
+    while(write(this->StopPipe[1], &c, 1) < 0 && errno == EINTR) {
+    }
+    this->Thread.join();
+    close(this->StopPipe[0]);
+    close(this->StopPipe[1]);
+  }
+  return this->Gone;
+}
+
+//----------------------------------------------------------------------------
+void ServerWatch::Run()
+{
+  // Input is read only until the line after the request is complete,
+  // since a cancel must come first to refer to the running request.
+  // Standard output reports an error or hangup once the client closes
+  // its end, even with no events requested.
+  struct pollfd fds[3];
+  fds[0].fd = this->StopPipe[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = STDOUT_FILENO;
+  fds[1].events = 0;
+  fds[2].fd = STDIN_FILENO;
+  fds[2].events = POLLIN;
+  bool cancel = false;
+  if(!this->TakeCancel || this->Input.TakeCancel(cancel)) {
+    fds[2].fd = -1;
+  }
+  while(!cancel) {
+    if(poll(fds, 3, -1) < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    if(fds[0].revents) {
+      return;
+    }
+    if(fds[1].revents & (POLLERR | POLLHUP)) {
+      this->Gone = true;
+      cancel = true;
+    } else if(fds[1].revents & POLLNVAL) {
+      fds[1].fd = -1;
+    } else if(fds[2].revents &&
+              (!this->Input.Fill() || this->Input.TakeCancel(cancel))) {
+      fds[2].fd = -1;
+    }
+  }
+  this->Cancel = true;
+}
+#endif
+
+//----------------------------------------------------------------------------
+static int readServerRequest(ServerInput& input,
+                             const char* const* argBeg,
+                             const char* const* argEnd,
+                             Options const& opts,
+                             std::unique_ptr<ServerRequest>& req)
+{
+  // Return 0 at the end of the input, -1 if it ends within a source
+  // buffer, 2 for a cancel, and 1 for any other line, with req holding
+  // its request unless the line is blank.
+  std::string line;
+  if(!input.ReadLine(line)) {
+    return 0;
+  }
+  std::unique_ptr<ServerRequest> r(new ServerRequest);
+  llvm::SmallVector<const char*, 64> reqArgs;
+  llvm::cl::TokenizeGNUCommandLine(line, r->Saver, reqArgs);
+  if(reqArgs.empty()) {
+    return 1;
+  }
+  if(reqArgs.size() == 1 && strcmp(reqArgs[0], "castxml-cancel") == 0) {
+    return 2;
+  }
+  req = std::move(r);
+  req->Opts = opts;
+  req->Args.assign(argBeg, argEnd);
+  req->Parsed = parseServerRequest(reqArgs, *req);
+
+  // The source buffer follows its request line.  Read it even if
+  // the request is bad to stay in step with the client.
+  Options& reqOpts = req->Opts;
+  if(!reqOpts.SourceBufferName.empty()) {
+    reqOpts.SourceBuffer.resize(req->BufferSize);
+    if(req->BufferSize > 0 && !input.Read(&reqOpts.SourceBuffer[0],
+                                          req->BufferSize)) {
+      std::cerr << "error: source buffer for '" <<
+        reqOpts.SourceBufferName << "' ends early\n";
+      return -1;
+    }
+  }
+
+  // Requests writing to a file or to memory for the client may share
+  // one run.  The arguments naming where the output goes or how the
+  // request is scheduled and answered do not change what it computes.
+  if(req->Parsed && !req->Query &&
+     (req->Memory ||
+      (!reqOpts.OutputFile.empty() && reqOpts.OutputFile != "-"))) {
+    Hasher h;
+    for(size_t i = 0; i < reqArgs.size(); ++i) {
+      if(i + 1 < reqArgs.size() &&
+         (strcmp(reqArgs[i], "-o") == 0 ||
+          strcmp(reqArgs[i], "--castxml-priority") == 0 ||
+          strcmp(reqArgs[i], "--castxml-request-id") == 0)) {
+        ++i;
+      } else {
+        h.Append(reqArgs[i]);
+      }
+    }
+    h.Append(reqOpts.SourceBuffer);
+    req->Key = h.FinalizeHex();
+  }
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+static void printServerResult(int result, ServerRequest const& req)
+{
+  std::cerr.flush();
+  std::cout << "castxml-result " << result;
+  if(!req.Id.empty()) {
+    std::cout << ' ' << req.Id;
+  }
+  std::cout << std::endl;
+}
+
+//----------------------------------------------------------------------------
+int runServer(const char* const* argBeg,
+              const char* const* argEnd,
+              Options const& opts,
+              Context& ctx)
+{
+#if defined(__linux__)
+  // The memory holding the output of the last '--castxml-output-memfd'
+  // request, kept until the client sends the next request.
+  int outputFD = -1;
+#endif
+  ServerInput input;
+
+  // Requests read but not yet run, and the one read last while it
+  // waits, which a "castxml-cancel" line that follows it refers to.
+  std::list<std::unique_ptr<ServerRequest> > queue;
+  ServerRequest* last = nullptr;
+  bool end = false;
+  for(;;) {
+    // Take every request already sent before choosing one to run, so
+    // that interactive requests pass batch requests read before them.
+    while(!end && (queue.empty() || input.Ready())) {
+      std::unique_ptr<ServerRequest> req;
+      int const r = readServerRequest(input, argBeg, argEnd, opts, req);
+      if(r < 0) {
+        std::cout << "castxml-result 1" << std::endl;
+        return 1;
+      }
+      if(r == 0) {
+        end = true;
+        break;
+      }
+#if defined(__linux__)
+      if(outputFD >= 0) {
+        close(outputFD);
+        outputFD = -1;
+      }
+#endif
+      if(r == 2) {
+        // A cancel read after its request is done has nothing to cancel.
+        if(last) {
+          last->Cancelled = true;
+        }
+      } else if(req) {
+        last = req.get();
+        queue.push_back(std::move(req));
+      }
+    }
+    if(queue.empty()) {
+      break;
+    }
+    std::list<std::unique_ptr<ServerRequest> >::iterator next =
+      std::find_if(queue.begin(), queue.end(),
+                   [](std::unique_ptr<ServerRequest> const& r) {
+                     return !r->Batch;
+                   });
+    if(next == queue.end()) {
+      next = queue.begin();
+    }
+    std::unique_ptr<ServerRequest> req = std::move(*next);
+    queue.erase(next);
+    bool isLast = req.get() == last;
+
+    // Identical requests waiting with this one take its output instead
+    // of computing it again.  A cancel then refers to only one of the
+    // requests sharing the run, so it cancels none.
+    std::vector<std::unique_ptr<ServerRequest> > shared;
+    if(!req->Key.empty() && !req->Cancelled) {
+      for(std::list<std::unique_ptr<ServerRequest> >::iterator
+            i = queue.begin(); i != queue.end();) {
+        if((*i)->Key == req->Key && !(*i)->Cancelled) {
+          isLast = isLast || i->get() == last;
+          shared.push_back(std::move(*i));
+          i = queue.erase(i);
+        } else {
+          ++i;
+        }
+      }
+    }
+    if(isLast) {
+      last = nullptr;
+    }
+
+    Options& reqOpts = req->Opts;
+    std::vector<const char*>& args = req->Args;
+    bool const parsed = req->Parsed;
+    bool const query = req->Query;
+    int result = 1;
+    uint64_t outputSize = 0;
+
+    // A request that parses is cancelled at the safe points where its
+    // limits are checked.  Queries of a kept translation unit have no
+    // limits, since failing one would leave errors in its diagnostics.
+    std::atomic<bool> cancel(false);
+    JobLimits limits(reqOpts.Timeout, reqOpts.MemoryLimit);
+    limits.SetCancelFlag(&cancel);
+#if !defined(_WIN32)
+    std::unique_ptr<ServerWatch> watch;
+    if(parsed && !query && !req->Cancelled) {
+      watch.reset(new ServerWatch(input, cancel, isLast && shared.empty()));
+    }
+#endif
+    if(req->Cancelled) {
+      std::cerr << "error: request was cancelled by the client\n";
+    } else if(parsed && query) {
+      result = queryRetainedAST(reqOpts, ctx);
+#if defined(__linux__) && defined(SYS_memfd_create)
+    } else if(parsed && req->Memory) {
+      // Write the output to anonymous memory the client maps in place
+      // of reading it from a file or this process.
+      outputFD = static_cast<int>(
+        syscall(SYS_memfd_create, "castxml-output", 0));
+      if(outputFD >= 0) {
+        uint64_t& size = outputSize;
+        {
+          llvm::raw_fd_ostream os(outputFD, /*shouldClose=*/false);
+          os.SetBufferSize(reqOpts.OutputBufferSize);
+          reqOpts.Limits = &limits;
+          reqOpts.OutputStream = &os;
+          result = runClang(args.data(), args.data() + args.size(), reqOpts,
+                            ctx);
+          os.flush();
+          size = os.tell();
+          if(os.has_error()) {
+            os.clear_error();
+            result = 1;
+          }
+        }
+        if(result == 0) {
+          std::cerr.flush();
+          sendOutputMemory(outputFD, size);
+        }
+      } else {
+        std::cerr << "error: unable to create output memory: " <<
+          strerror(errno) << "\n";
+      }
+#endif
+    } else if(parsed) {
+      reqOpts.Limits = &limits;
+      result = runClang(args.data(), args.data() + args.size(), reqOpts, ctx);
+    }
+#if !defined(_WIN32)
+    // A client that has gone away reads neither the result nor more
+    // requests.
+    if(watch && watch->Stop()) {
+      break;
+    }
+#endif
+    printServerResult(result, *req);
+    for(std::unique_ptr<ServerRequest> const& s : shared) {
+      int sharedResult = result;
+      std::string const& file = s->Opts.OutputFile;
+      if(sharedResult == 0 && !s->Memory && file != reqOpts.OutputFile &&
+         !cxsys::SystemTools::CopyFileAlways(reqOpts.OutputFile, file)) {
+        std::cerr << "error: unable to copy output to '" << file << "'\n";
+        sharedResult = 1;
+      }
+#if defined(__linux__) && defined(SYS_memfd_create)
+      if(sharedResult == 0 && s->Memory) {
+        sendOutputMemory(outputFD, outputSize);
+      }
+#endif
+      printServerResult(sharedResult, *s);
+    }
+  }
+#if defined(__linux__)
+  if(outputFD >= 0) {
+    close(outputFD);
+  }
+#endif
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+static std::string targetFile(std::string const& file,
+                              std::string const& name)
+{
+  // Name the output of a target by inserting its name before the
+  // extension, as "out.xml" becomes "out.<name>.xml".
+  if(file.empty() || file == "-") {
+    return file;
+  }
+  std::string const dir = cxsys::SystemTools::GetFilenamePath(file);
+  std::string const base =
+    cxsys::SystemTools::GetFilenameWithoutLastExtension(file);
+  std::string const ext = cxsys::SystemTools::GetFilenameLastExtension(file);
+  return (dir.empty()? "" : dir + "/") + base + "." + name + ext;
+}
+
+//----------------------------------------------------------------------------
+struct TargetJob
+{
+  TargetJob(): Result(0) {}
+  std::vector<const char*> Args;
+  Options Opts;
+  Context Ctx;
+  std::string Diagnostics;
+  int Result;
+};
+
+//----------------------------------------------------------------------------
+static void runTargetJob(TargetJob& job)
+{
+  JobLimits limits(job.Opts.Timeout, job.Opts.MemoryLimit);
+  job.Opts.Limits = &limits;
+  llvm::raw_string_ostream diagOS(job.Diagnostics);
+  job.Opts.DiagnosticStream = &diagOS;
+  job.Result = runClang(job.Args.data(), job.Args.data() + job.Args.size(),
+                        job.Opts, job.Ctx);
+  diagOS.flush();
+}
+
+//----------------------------------------------------------------------------
+int runTargets(const char* const* argBeg,
+               const char* const* argEnd,
+               Options const& opts,
+               Context& ctx)
+{
+  // All configurations read the same headers, so the files are read
+  // once through a file system shared by the threads, and they intern
+  // many of the same strings in one pool.
+  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> shared =
+    createSharedFileSystem(clang::vfs::getRealFileSystem());
+  StringPool strings;
+
+  // The first job is the configuration given without a target.
+  std::vector<std::unique_ptr<TargetJob> > jobs;
+  jobs.push_back(std::unique_ptr<TargetJob>(new TargetJob));
+  jobs[0]->Args.assign(argBeg, argEnd);
+  jobs[0]->Opts = opts;
+  if(opts.MergeVariants) {
+    // The merged document takes the output file of the default.
+    jobs[0]->Opts.OutputFile = targetFile(opts.OutputFile, "default");
+  }
+  for(Options::Target const& t : opts.Targets) {
+    std::unique_ptr<TargetJob> job(new TargetJob);
+    job->Args.assign(argBeg, argEnd);
+    job->Opts = opts;
+    for(std::string const& a : t.Arguments) {
+      job->Args.push_back(a.c_str());
+      if(a == "-target" || a == "--target" ||
+         a.compare(0, 8, "-target=") == 0 ||
+         a.compare(0, 9, "--target=") == 0) {
+        job->Opts.HaveTarget = true;
+      }
+    }
+    job->Opts.OutputFile = targetFile(opts.OutputFile, t.Name);
+    for(Options::Output& o : job->Opts.ExtraOutputs) {
+      o.File = targetFile(o.File, t.Name);
+    }
+    jobs.push_back(std::move(job));
+  }
+  for(std::unique_ptr<TargetJob>& job : jobs) {
+    job->Ctx.ResourceDir = ctx.ResourceDir;
+    job->Ctx.ClangResourceDir = ctx.ClangResourceDir;
+    job->Opts.Targets.clear();
+    job->Opts.SharedFiles = shared.get();
+    if(!job->Opts.Strings) {
+      job->Opts.Strings = &strings;
+    }
+    job->Opts.JobCostsFile.clear();
+  }
+
+  {
+    std::vector<std::thread> threads;
+    for(size_t i = 1; i < jobs.size(); ++i) {
+      TargetJob& job = *jobs[i];
+      threads.push_back(std::thread([&job]() { runTargetJob(job); }));
+    }
+    runTargetJob(*jobs[0]);
+    for(std::thread& t : threads) {
+      t.join();
+    }
+  }
+
+  // Print the diagnostics of each configuration in order.
+  int result = 0;
+  for(size_t i = 0; i < jobs.size(); ++i) {
+    TargetJob const& job = *jobs[i];
+    if(!job.Diagnostics.empty()) {
+      if(i) {
+        llvm::errs() << "In target '" << opts.Targets[i - 1].Name << "':\n";
+      }
+      llvm::errs() << job.Diagnostics;
+    }
+    if(job.Result != 0) {
+      result = 1;
+    }
+  }
+
+  // Merge the outputs of all configurations into one document noting
+  // where they differ, and keep only that.
+  if(opts.MergeVariants && result == 0) {
+    std::vector<std::string> inputs;
+    inputs.push_back("default=" + jobs[0]->Opts.OutputFile);
+    for(size_t i = 1; i < jobs.size(); ++i) {
+      inputs.push_back(opts.Targets[i - 1].Name + "=" +
+                       jobs[i]->Opts.OutputFile);
+    }
+    std::vector<const char*> args;
+    for(std::string const& in : inputs) {
+      args.push_back(in.c_str());
+    }
+    result = runMerge(args.data(), args.data() + args.size(), opts);
+    for(std::unique_ptr<TargetJob> const& job : jobs) {
+      cxsys::SystemTools::RemoveFile(job->Opts.OutputFile);
+    }
+  }
+  return result;
+}
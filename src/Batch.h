@@ -0,0 +1,57 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_BATCH_H
+#define CASTXML_BATCH_H
+
+class Context;
+struct Options;
+
+/// runBatch - Run Clang once for each entry of a compilation database
+/// given by Options::BatchFile.  The given user arguments and detected
+/// options are shared by all entries.
+int runBatch(const char* const* argBeg,
+             const char* const* argEnd,
+             Options const& opts,
+             Context& ctx);
+
+/// runServer - Read requests from standard input, one command line per
+/// line, and run Clang for each one with the given user arguments and
+/// detected options.  A request with "--castxml-source-buffer <src>
+/// <size>" is followed by <size> bytes of source text for <src>.
+/// A request with "--castxml-retain-ast" keeps its translation unit,
+/// and a later request giving only "--castxml-query <name>" options
+/// and "-o <file>" writes the output for those start names from it.
+/// A query or retaining request also giving an input is answered from
+/// the translation unit kept for the same input and options, if any.
+/// A "castxml-result <code>" line is printed to standard output after
+/// each request is done.
+int runServer(const char* const* argBeg,
+              const char* const* argEnd,
+              Options const& opts,
+              Context& ctx);
+
+/// runTargets - Run Clang with the given user arguments and detected
+/// options, and at the same time on one thread for each entry of
+/// Options::Targets with the arguments of that target added, writing
+/// the output of each target to a file named for it.  The threads
+/// share the files they read.  With Options::MergeVariants the outputs
+/// are merged into the output file instead.
+int runTargets(const char* const* argBeg,
+               const char* const* argEnd,
+               Options const& opts,
+               Context& ctx);
+
+#endif // CASTXML_BATCH_H
@@ -0,0 +1,79 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "CastXML.h"
+#include "Context.h"
+#include "Detect.h"
+#include "RunClang.h"
+#include "Utils.h"
+
+#include <ostream>
+
+//----------------------------------------------------------------------------
+bool castxmlInitialize(const char* castxmlPath, Context& ctx,
+                       std::ostream& error)
+{
+  return findResourceDir(castxmlPath, ctx, error);
+}
+
+//----------------------------------------------------------------------------
+bool castxmlDetect(const char* id,
+                   const char* const* argBeg,
+                   const char* const* argEnd,
+                   Context const& ctx,
+                   Options& opts)
+{
+  opts.HaveCC = true;
+  return detectCC(id, argBeg, argEnd, ctx, opts);
+}
+
+//----------------------------------------------------------------------------
+int castxmlRun(const char* const* argBeg,
+               const char* const* argEnd,
+               Options const& opts,
+               Context& ctx,
+               llvm::raw_ostream& output)
+{
+  Options runOpts = opts;
+  runOpts.OutputStream = &output;
+  return runClang(argBeg, argEnd, runOpts, ctx);
+}
+
+//----------------------------------------------------------------------------
+int castxmlRunTable(const char* const* argBeg,
+                    const char* const* argEnd,
+                    Options const& opts,
+                    Context& ctx,
+                    OutputTable& table)
+{
+  Options runOpts = opts;
+  runOpts.GccXml = true;
+  runOpts.Table = &table;
+  return runClang(argBeg, argEnd, runOpts, ctx);
+}
+
+//----------------------------------------------------------------------------
+int castxmlRunHandler(const char* const* argBeg,
+                      const char* const* argEnd,
+                      Options const& opts,
+                      Context& ctx,
+                      OutputHandler& handler)
+{
+  Options runOpts = opts;
+  runOpts.GccXml = true;
+  runOpts.Handler = &handler;
+  return runClang(argBeg, argEnd, runOpts, ctx);
+}
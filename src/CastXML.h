@@ -0,0 +1,81 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_CASTXML_H
+#define CASTXML_CASTXML_H
+
+// Interface of the castxml library for applications that run castxml
+// in their own process instead of running the castxml executable.
+
+#include "Options.h"
+
+#include <iosfwd>
+
+namespace llvm {
+  class raw_ostream;
+}
+class Context;
+class OutputHandler;
+class OutputTable;
+
+/// castxmlInitialize - Find the castxml and Clang resource directories
+/// relative to the castxml executable at the given path, as its main()
+/// does, and store them in the context.  Call once for a context before
+/// passing it to the functions below.  On success returns true.  On
+/// failure returns false and writes a message to the stream.  Threads
+/// may run at the same time with separate contexts; see Context.h.
+bool castxmlInitialize(const char* castxmlPath, Context& ctx,
+                       std::ostream& error);
+
+/// castxmlDetect - Store in the options the settings detected from the
+/// given compiler command, as '--castxml-cc-<id>' does.
+bool castxmlDetect(const char* id,
+                   const char* const* argBeg,
+                   const char* const* argEnd,
+                   Context const& ctx,
+                   Options& opts);
+
+/// castxmlRun - Run the internal Clang compiler with the given Clang
+/// arguments and options, as the castxml executable does after parsing
+/// its command line, and return 0 on success.  With Options::GccXml the
+/// output for each source file is written to the given stream in place
+/// of a file.  Later calls with the same context reuse file information
+/// cached by earlier ones until a file they read changes.
+int castxmlRun(const char* const* argBeg,
+               const char* const* argEnd,
+               Options const& opts,
+               Context& ctx,
+               llvm::raw_ostream& output);
+
+/// castxmlRunTable - Run as castxmlRun but add the gccxml-format output
+/// elements to the given table instead of writing them.  The table
+/// outlives the compiler and may be read after this returns.  Give
+/// one source file for each table.
+int castxmlRunTable(const char* const* argBeg,
+                    const char* const* argEnd,
+                    Options const& opts,
+                    Context& ctx,
+                    OutputTable& table);
+
+/// castxmlRunHandler - Run as castxmlRun but give the gccxml-format
+/// output to the given handler as element and attribute events instead
+/// of writing it.  See OutputHandler.h.
+int castxmlRunHandler(const char* const* argBeg,
+                      const char* const* argEnd,
+                      Options const& opts,
+                      Context& ctx,
+                      OutputHandler& handler);
+
+#endif // CASTXML_CASTXML_H
@@ -0,0 +1,224 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "CastXMLC.h"
+#include "CastXML.h"
+#include "Context.h"
+#include "Options.h"
+#include "OutputTable.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <iostream>
+#include <map>
+#include <new>
+#include <stddef.h>
+#include <utility>
+#include <vector>
+
+// The node and attribute arrays are given out in place.
+static_assert(sizeof(castxml_node) == sizeof(OutputTable::Node) &&
+              offsetof(castxml_node, id) ==
+              offsetof(OutputTable::Node, Id) &&
+              offsetof(castxml_node, file) ==
+              offsetof(OutputTable::Node, File) &&
+              offsetof(castxml_node, tag) ==
+              offsetof(OutputTable::Node, Tag) &&
+              offsetof(castxml_node, first_attribute) ==
+              offsetof(OutputTable::Node, FirstAttribute) &&
+              offsetof(castxml_node, num_attributes) ==
+              offsetof(OutputTable::Node, NumAttributes) &&
+              offsetof(castxml_node, first_child) ==
+              offsetof(OutputTable::Node, FirstChild) &&
+              offsetof(castxml_node, num_children) ==
+              offsetof(OutputTable::Node, NumChildren),
+              "castxml_node must match OutputTable::Node");
+static_assert(sizeof(castxml_attribute) == sizeof(OutputTable::Attribute) &&
+              offsetof(castxml_attribute, name) ==
+              offsetof(OutputTable::Attribute, Name) &&
+              offsetof(castxml_attribute, value) ==
+              offsetof(OutputTable::Attribute, Value),
+              "castxml_attribute must match OutputTable::Attribute");
+
+//----------------------------------------------------------------------------
+struct castxml_result
+{
+  int Status;
+  OutputTable Table;
+  llvm::StringMap<uint32_t> Ids;
+  std::map<std::pair<uint32_t, uint32_t>, std::vector<uint32_t> > Refs;
+};
+
+//----------------------------------------------------------------------------
+static castxml_string makeString(llvm::StringRef s)
+{
+  castxml_string cs = { s.data(), s.size() };
+  return cs;
+}
+
+//----------------------------------------------------------------------------
+static castxml_ids makeIds(std::vector<uint32_t> const& v)
+{
+  castxml_ids ids = { v.empty()? nullptr : &v[0], v.size() };
+  return ids;
+}
+
+//----------------------------------------------------------------------------
+// The resource directories found by castxml_initialize.  Each parse
+// copies them into a context of its own so that parses on separate
+// threads share no state.
+static Context initialContext;
+
+//----------------------------------------------------------------------------
+int castxml_initialize(const char* castxml_path)
+{
+  return castxmlInitialize(castxml_path, initialContext, std::cerr)? 0 : 1;
+}
+
+//----------------------------------------------------------------------------
+castxml_result* castxml_parse(const char* cc_id,
+                              const char* const* cc_args, size_t num_cc_args,
+                              const char* const* start_names,
+                              size_t num_start_names,
+                              const char* const* args, size_t num_args)
+{
+  castxml_result* r = new(std::nothrow) castxml_result;
+  if(!r) {
+    return nullptr;
+  }
+  r->Status = 1;
+
+  Context ctx;
+  ctx.ResourceDir = initialContext.ResourceDir;
+  ctx.ClangResourceDir = initialContext.ClangResourceDir;
+
+  Options opts;
+  if(cc_id && !castxmlDetect(cc_id, cc_args, cc_args + num_cc_args,
+                             ctx, opts)) {
+    return r;
+  }
+  opts.StartNames.assign(start_names, start_names + num_start_names);
+  r->Status = castxmlRunTable(args, args + num_args, opts, ctx, r->Table);
+
+  // Index the top-level elements by their gccxml id.
+  for(uint32_t n : r->Table.GetElements()) {
+    uint32_t const a = castxml_find_attribute(r, n, "id");
+    if(a != CASTXML_NONE) {
+      uint32_t const v = r->Table.GetAttribute(a).Value;
+      r->Ids[r->Table.GetString(v)] = n;
+    }
+  }
+  return r;
+}
+
+//----------------------------------------------------------------------------
+int castxml_status(castxml_result const* r)
+{
+  return r->Status;
+}
+
+//----------------------------------------------------------------------------
+castxml_ids castxml_elements(castxml_result const* r)
+{
+  return makeIds(r->Table.GetElements());
+}
+
+//----------------------------------------------------------------------------
+castxml_node const* castxml_nodes(castxml_result const* r, size_t* count)
+{
+  std::vector<OutputTable::Node> const& nodes = r->Table.GetNodes();
+  *count = nodes.size();
+  return nodes.empty()? nullptr :
+    reinterpret_cast<castxml_node const*>(&nodes[0]);
+}
+
+//----------------------------------------------------------------------------
+castxml_attribute const* castxml_attributes(castxml_result const* r,
+                                            size_t* count)
+{
+  std::vector<OutputTable::Attribute> const& attrs =
+    r->Table.GetAttributes();
+  *count = attrs.size();
+  return attrs.empty()? nullptr :
+    reinterpret_cast<castxml_attribute const*>(&attrs[0]);
+}
+
+//----------------------------------------------------------------------------
+castxml_string castxml_get_string(castxml_result const* r, uint32_t s)
+{
+  if(s >= r->Table.GetNumStrings()) {
+    return makeString(llvm::StringRef());
+  }
+  return makeString(r->Table.GetString(s));
+}
+
+//----------------------------------------------------------------------------
+uint32_t castxml_find_attribute(castxml_result const* r, uint32_t node,
+                                const char* name)
+{
+  if(node >= r->Table.GetNodes().size()) {
+    return CASTXML_NONE;
+  }
+  OutputTable::Node const& n = r->Table.GetNode(node);
+  for(uint32_t a = n.FirstAttribute; a != n.FirstAttribute + n.NumAttributes;
+      ++a) {
+    if(r->Table.GetString(r->Table.GetAttribute(a).Name) == name) {
+      return a;
+    }
+  }
+  return CASTXML_NONE;
+}
+
+//----------------------------------------------------------------------------
+uint32_t castxml_lookup_id(castxml_result const* r, castxml_string id)
+{
+  llvm::StringMap<uint32_t>::const_iterator i =
+    r->Ids.find(llvm::StringRef(id.data, id.size));
+  return i != r->Ids.end()? i->second : CASTXML_NONE;
+}
+
+//----------------------------------------------------------------------------
+castxml_ids castxml_refs(castxml_result* r, uint32_t node, const char* name)
+{
+  uint32_t const a = castxml_find_attribute(r, node, name);
+  if(a == CASTXML_NONE) {
+    return makeIds(std::vector<uint32_t>());
+  }
+  std::vector<uint32_t>& refs = r->Refs[std::make_pair(node, a)];
+  if(refs.empty()) {
+    llvm::SmallVector<llvm::StringRef, 16> ids;
+    r->Table.GetString(r->Table.GetAttribute(a).Value).split(
+      ids, " ", -1, false);
+    for(llvm::StringRef id : ids) {
+      // Skip the access of a non-public base, as in "private:_8".
+      if(id.startswith("private:")) {
+        id = id.substr(8);
+      } else if(id.startswith("protected:")) {
+        id = id.substr(10);
+      }
+      refs.push_back(castxml_lookup_id(r, makeString(id)));
+    }
+  }
+  return makeIds(refs);
+}
+
+//----------------------------------------------------------------------------
+void castxml_free(castxml_result* r)
+{
+  delete r;
+}
@@ -0,0 +1,128 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_CASTXMLC_H
+#define CASTXML_CASTXMLC_H
+
+/* C interface of the castxml library.  A parse produces the table of
+   gccxml-format output elements, which callers walk in place: every
+   view returned points into memory owned by the result and is valid
+   until the result is freed.  The layout of the structures below is
+   part of the interface.  */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Index meaning "no node" or "no attribute".  */
+#define CASTXML_NONE 0xffffffffu
+
+/** A string that is not null-terminated.  */
+typedef struct castxml_string {
+  const char* data;
+  size_t size;
+} castxml_string;
+
+/** An array of node indices.  */
+typedef struct castxml_ids {
+  const uint32_t* data;
+  size_t size;
+} castxml_ids;
+
+/** An element.  The tag is a string index.  Attributes are at
+    first_attribute and following in the attribute array, and nested
+    elements (e.g. Argument and Base) are at first_child and following
+    in the node array.  Top-level elements have the numeric part of
+    their gccxml id in id and that of their File element in file.  */
+typedef struct castxml_node {
+  uint32_t id;
+  uint32_t file;
+  uint32_t tag;
+  uint32_t first_attribute;
+  uint32_t num_attributes;
+  uint32_t first_child;
+  uint32_t num_children;
+} castxml_node;
+
+/** An attribute, with string indices of its name and value.  */
+typedef struct castxml_attribute {
+  uint32_t name;
+  uint32_t value;
+} castxml_attribute;
+
+typedef struct castxml_result castxml_result;
+
+/** Find the castxml resources relative to the castxml executable at
+    the given path.  Call once before a parse.  Returns 0 on success.  */
+int castxml_initialize(const char* castxml_path);
+
+/** Parse one source file named in the Clang arguments and collect
+    the output elements for the declarations named by the start names,
+    as --castxml-gccxml and --castxml-start do.  A null cc_id skips
+    compiler detection; otherwise the cc_args are a compiler command
+    as given to --castxml-cc-<cc_id>.  Returns null only when out of
+    memory.  Parses may run at the same time on separate threads.  */
+castxml_result* castxml_parse(const char* cc_id,
+                              const char* const* cc_args, size_t num_cc_args,
+                              const char* const* start_names,
+                              size_t num_start_names,
+                              const char* const* args, size_t num_args);
+
+/** Get 0 if the parse succeeded or 1 if it failed.  Diagnostics are
+    printed to stderr.  */
+int castxml_status(castxml_result const* r);
+
+/** Get the top-level elements in output order.  */
+castxml_ids castxml_elements(castxml_result const* r);
+
+/** Get the node array and its size.  */
+castxml_node const* castxml_nodes(castxml_result const* r, size_t* count);
+
+/** Get the attribute array and its size.  */
+castxml_attribute const* castxml_attributes(castxml_result const* r,
+                                            size_t* count);
+
+/** Get the string with a given index.  */
+castxml_string castxml_get_string(castxml_result const* r, uint32_t s);
+
+/** Get the index of the named attribute of a node, or CASTXML_NONE.  */
+uint32_t castxml_find_attribute(castxml_result const* r, uint32_t node,
+                                const char* name);
+
+/** Get the node index of the top-level element with a given gccxml
+    id (e.g. "_12" or "f1"), or CASTXML_NONE.  */
+uint32_t castxml_lookup_id(castxml_result const* r, castxml_string id);
+
+/** Get the node indices of the elements named by the space-separated
+    ids in an attribute such as "members", "befriending" or "type".
+    The access prefix of non-public ids in "bases" (e.g. "private:")
+    is skipped; the Base elements nested in the class give the access.
+    Unknown ids map to CASTXML_NONE.  The array is computed on first
+    request and kept with the result, so calls on one result must not
+    run concurrently.  */
+castxml_ids castxml_refs(castxml_result* r, uint32_t node,
+                         const char* name);
+
+/** Free a result and everything it owns.  */
+void castxml_free(castxml_result* r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CASTXML_CASTXMLC_H */
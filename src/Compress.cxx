@@ -0,0 +1,136 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Compress.h"
+
+#include "clang/Basic/Diagnostic.h"
+
+#include "llvm/Support/raw_ostream.h"
+
+#include <vector>
+#include <string.h>
+
+#ifdef CASTXML_HAVE_ZLIB
+# include <zlib.h>
+
+//----------------------------------------------------------------------------
+/// Stream writing gzip-compressed data to another stream.
+class GzipStream: public llvm::raw_ostream
+{
+  llvm::raw_ostream& OS;
+  clang::DiagnosticsEngine& Diags;
+  z_stream Z;
+
+  // Whether the compressor is initialized and must be ended, and
+  // whether it has not failed since.
+  bool Initialized;
+  bool Ok;
+
+  uint64_t Pos;
+  std::vector<char> Out;
+
+  void Fail(int code) {
+    // Report only the first failure.  The rest of the output is
+    // dropped, and the error fails the run.
+    this->Ok = false;
+    this->Diags.Report(this->Diags.getCustomDiagID(
+      clang::DiagnosticsEngine::Error,
+      "unable to compress output with zlib: %0")) <<
+      (this->Z.msg? this->Z.msg : zError(code));
+  }
+
+  void Deflate(const char* ptr, size_t size, int flush) {
+    this->Z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(ptr));
+    this->Z.avail_in = static_cast<uInt>(size);
+    do {
+      this->Z.next_out = reinterpret_cast<Bytef*>(&this->Out[0]);
+      this->Z.avail_out = static_cast<uInt>(this->Out.size());
+      // A buffer error only means that no progress was possible.
+      int const r = deflate(&this->Z, flush);
+      if(r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR) {
+        this->Fail(r);
+        return;
+      }
+      this->OS.write(&this->Out[0], this->Out.size() - this->Z.avail_out);
+    } while(this->Z.avail_out == 0);
+  }
+
+  void write_impl(const char* ptr, size_t size) override {
+    this->Pos += size;
+    if(this->Ok) {
+      this->Deflate(ptr, size, Z_NO_FLUSH);
+    }
+  }
+
+  uint64_t current_pos() const override {
+    return this->Pos;
+  }
+
+public:
+  GzipStream(llvm::raw_ostream& os, clang::DiagnosticsEngine& diags):
+    OS(os), Diags(diags), Initialized(false), Ok(false), Pos(0),
+    Out(1 << 18) {
+    memset(&this->Z, 0, sizeof(this->Z));
+    // A window of 15 bits plus 16 selects the gzip format.
+    int const r = deflateInit2(&this->Z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                               15 + 16, 8, Z_DEFAULT_STRATEGY);
+    this->Initialized = this->Ok = r == Z_OK;
+    if(!this->Initialized) {
+      this->Fail(r);
+    }
+    this->SetBufferSize(1 << 18);
+  }
+
+  ~GzipStream() {
+    this->flush();
+    if(this->Ok) {
+      this->Deflate(nullptr, 0, Z_FINISH);
+    }
+    // Free the compressor even if it failed after it was initialized.
+    if(this->Initialized) {
+      deflateEnd(&this->Z);
+    }
+    this->OS.flush();
+  }
+};
+#endif
+
+//----------------------------------------------------------------------------
+bool haveCompression(std::string const& format)
+{
+#ifdef CASTXML_HAVE_ZLIB
+  if(format == "gzip") {
+    return true;
+  }
+#endif
+  return format == "none";
+}
+
+//----------------------------------------------------------------------------
+std::unique_ptr<llvm::raw_ostream>
+createCompressedStream(std::string const& format, llvm::raw_ostream& os,
+                       clang::DiagnosticsEngine& diags)
+{
+#ifdef CASTXML_HAVE_ZLIB
+  if(format == "gzip") {
+    return std::unique_ptr<llvm::raw_ostream>(new GzipStream(os, diags));
+  }
+#endif
+  (void)format;
+  (void)os;
+  (void)diags;
+  return std::unique_ptr<llvm::raw_ostream>();
+}
@@ -0,0 +1,45 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_COMPRESS_H
+#define CASTXML_COMPRESS_H
+
+#include <cxsys/Configure.hxx>
+
+#include <memory>
+#include <string>
+
+namespace clang {
+  class DiagnosticsEngine;
+}
+
+namespace llvm {
+  class raw_ostream;
+}
+
+/// haveCompression - Check whether output compression in the given
+/// format (e.g. "gzip") is available in this build.
+bool haveCompression(std::string const& format);
+
+/// createCompressedStream - Create a stream that compresses everything
+/// written to it in the given format and writes the result to another
+/// stream.  The compressed data are complete once the stream is destroyed.
+/// A failure of the compressor is reported as an error to the given
+/// diagnostics, and the output written after it is dropped.
+std::unique_ptr<llvm::raw_ostream>
+createCompressedStream(std::string const& format, llvm::raw_ostream& os,
+                       clang::DiagnosticsEngine& diags);
+
+#endif // CASTXML_COMPRESS_H
@@ -0,0 +1,36 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Context.h"
+
+#include "clang/Basic/FileManager.h"
+#include "llvm/Support/FileSystem.h"
+
+//----------------------------------------------------------------------------
+Context::Context()
+{
+}
+
+//----------------------------------------------------------------------------
+Context::~Context()
+{
+  if(!this->MainPreamble.File.empty()) {
+    llvm::sys::fs::remove(this->MainPreamble.File);
+  }
+  if(!this->SessionTokens.File.empty()) {
+    llvm::sys::fs::remove(this->SessionTokens.File);
+  }
+}
@@ -0,0 +1,104 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_CONTEXT_H
+#define CASTXML_CONTEXT_H
+
+#include <cxsys/Configure.hxx>
+
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+
+#include <list>
+#include <memory>
+#include <string>
+
+namespace clang {
+  class FileManager;
+}
+
+class RetainedAST;
+
+/// Context - State that castxml keeps from one run to the next.  The
+/// parallel jobs of one run share its context, but runs with the same
+/// context must not overlap.  Threads of one process may run parses
+/// at the same time, each with its own context.
+class Context
+{
+public:
+  Context();
+  ~Context();
+
+  /** The castxml resource directory found by findResourceDir.  */
+  std::string ResourceDir;
+
+  /** The Clang resource directory found by findResourceDir.  */
+  std::string ClangResourceDir;
+
+  /** FileManager reused by the compiler instances run one at a time
+      with this context so that each input does not stat and look up
+      the same headers again.  Parallel jobs use their own.  */
+  llvm::IntrusiveRefCntPtr<clang::FileManager> FileManager;
+
+  /// Preamble - A precompiled header holding the leading includes of
+  /// the last input parsed by a server or watch, kept to parse that
+  /// input again when only the rest of it has changed.
+  struct Preamble
+  {
+    Preamble(): EndsAtStartOfLine(false) {}
+
+    /** The precompiled header file, removed with the context.  */
+    std::string File;
+
+    /** The hash of the invocation and input it was built for.  */
+    std::string Key;
+
+    /** The leading text of the input that it covers.  */
+    std::string Text;
+    bool EndsAtStartOfLine;
+
+    /** The files read to build it, other than the input.  */
+    llvm::IntrusiveRefCntPtr<clang::FileManager> Files;
+  };
+  Preamble MainPreamble;
+
+  /// Tokens - A pretokenized header (PTH) holding the tokens of the
+  /// files read by one input of a batch or server with
+  /// '--castxml-token-cache', from which later inputs lex those files
+  /// instead of reading and lexing them again.
+  struct Tokens
+  {
+    /** The PTH file, removed with the context.  */
+    std::string File;
+
+    /** The hash of the target and language options it was built for.  */
+    std::string Key;
+
+    /** The files read to build it.  */
+    llvm::IntrusiveRefCntPtr<clang::FileManager> Files;
+  };
+  Tokens SessionTokens;
+
+  /** The translation units kept by server requests with
+      '--castxml-retain-ast' for later requests, most recently used
+      first, within the memory of Options::RetainMemory.  They are
+      shared so that their type need not be complete here.  */
+  std::list<std::shared_ptr<RetainedAST> > Retained;
+
+private:
+  Context(Context const&);
+  Context& operator=(Context const&);
+};
+
+#endif // CASTXML_CONTEXT_H
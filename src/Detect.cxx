@@ -15,21 +15,38 @@
 */
 
 #include "Detect.h"
+#include "Context.h"
 #include "Options.h"
+#include "ResourceFS.h"
+#include "TimeReport.h"
 #include "Utils.h"
 
+#include "clang/Basic/VirtualFileSystem.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/Triple.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Host.h"
+#include "llvm/Support/LockFileManager.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/raw_ostream.h"
 
 #include <cxsys/SystemTools.hxx>
 
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <system_error>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 //----------------------------------------------------------------------------
-static std::string getClangBuiltinIncludeDir()
+static std::string getClangBuiltinIncludeDir(Context const& ctx)
 {
-  return getClangResourceDir() + "/include";
+  return ctx.ClangResourceDir + "/include";
 }
 
 //----------------------------------------------------------------------------
@@ -56,58 +73,130 @@ static bool failedCC(const char* id,
 }
 
 //----------------------------------------------------------------------------
-static void fixPredefines(Options& opts)
+static void addMacro(llvm::StringRef def,
+                     std::map<std::string, std::string>& macros)
 {
-  // Remove any detected conflicting definition of a Clang builtin macro.
-  std::string& pd = opts.Predefines;
-  std::string::size_type beg = 0;
-  while ((beg = pd.find("#define __has", beg),
-          beg != std::string::npos)) {
-    std::string::size_type end = pd.find('\n', beg);
-    if (end != std::string::npos) {
-      pd.erase(beg, end+1 - beg);
-    } else {
-      pd.erase(beg);
+  // Split "<name>[(<params>)] <value>" after the name.  A later
+  // definition of a name replaces an earlier one as it would in text.
+  def = def.ltrim();
+  llvm::StringRef const name = def.substr(0, def.find_first_of(" ("));
+  llvm::StringRef rest = def.substr(name.size());
+  if(!rest.startswith("(")) {
+    rest = rest.ltrim();
+  }
+  if(!name.empty()) {
+    macros[name] = rest;
+  }
+}
+
+//----------------------------------------------------------------------------
+static std::string parsePredefines(llvm::StringRef text, Options& opts)
+{
+  // Parse the "#define" lines once into the table of macros.  Return
+  // any other lines so that they can be kept after the definitions.
+  opts.PredefinedMacros.clear();
+  std::string other;
+  llvm::SmallVector<llvm::StringRef, 256> lines;
+  text.split(lines, "\n", -1, false);
+  for(llvm::StringRef line : lines) {
+    line = line.rtrim();
+    if(line.startswith("#define ")) {
+      addMacro(line.drop_front(8), opts.PredefinedMacros);
+    } else if(!line.ltrim().empty()) {
+      other += line.str() + "\n";
     }
   }
+  return other;
+}
+
+//----------------------------------------------------------------------------
+static std::string formatMacro(
+  std::map<std::string, std::string>::value_type const& m)
+{
+  std::string def = m.first;
+  if(!m.second.empty() && m.second[0] != '(') {
+    def += ' ';
+  }
+  def += m.second;
+  return def;
+}
+
+//----------------------------------------------------------------------------
+static std::string formatMacros(Options const& opts)
+{
+  std::string pd;
+  for(auto const& m : opts.PredefinedMacros) {
+    pd += "#define " + formatMacro(m) + "\n";
+  }
+  return pd;
+}
+
+//----------------------------------------------------------------------------
+static bool hasMacro(Options const& opts, const char* name)
+{
+  return opts.PredefinedMacros.count(name) > 0;
+}
+
+//----------------------------------------------------------------------------
+static bool hasMacro(Options const& opts, const char* name,
+                     const char* value)
+{
+  std::map<std::string, std::string>::const_iterator i =
+    opts.PredefinedMacros.find(name);
+  return i != opts.PredefinedMacros.end() && i->second == value;
+}
+
+//----------------------------------------------------------------------------
+static void fixPredefines(Options& opts, std::string other)
+{
+  // Remove any detected conflicting definition of a Clang builtin macro.
+  // The names starting in "__has" are adjacent in the sorted table.
+  std::map<std::string, std::string>& macros = opts.PredefinedMacros;
+  std::map<std::string, std::string>::iterator beg =
+    macros.lower_bound("__has");
+  std::map<std::string, std::string>::iterator end = beg;
+  while(end != macros.end() && end->first.compare(0, 5, "__has") == 0) {
+    ++end;
+  }
+  macros.erase(beg, end);
 
   // Provide __float128 if simulating the actual GNU compiler.
-  if (pd.find("#define __GNUC__ ") != pd.npos &&
-      pd.find("#define __clang__ ") == pd.npos &&
-      pd.find("#define __INTEL_COMPILER ") == pd.npos &&
-      pd.find("#define __CUDACC__ ") == pd.npos &&
-      pd.find("#define __PGI ") == pd.npos &&
-      (pd.find("#define __i386__ ") != pd.npos ||
-       pd.find("#define __x86_64__ ") != pd.npos ||
-       pd.find("#define __ia64__ ") != pd.npos)) {
-    pd += "\n"
+  if (hasMacro(opts, "__GNUC__") &&
+      !hasMacro(opts, "__clang__") &&
+      !hasMacro(opts, "__INTEL_COMPILER") &&
+      !hasMacro(opts, "__CUDACC__") &&
+      !hasMacro(opts, "__PGI") &&
+      (hasMacro(opts, "__i386__") ||
+       hasMacro(opts, "__x86_64__") ||
+       hasMacro(opts, "__ia64__"))) {
+    other +=
       "typedef struct { "
       "  char x[16] __attribute__((aligned(16))); "
       "} __float128;\n"
       ;
   }
+
+  // Give Clang the definitions first and then the other lines.
+  opts.Predefines = formatMacros(opts) + other;
 }
 
 //----------------------------------------------------------------------------
 static void setTriple(Options& opts)
 {
-  std::string const& pd = opts.Predefines;
   llvm::Triple triple(llvm::sys::getDefaultTargetTriple());
-  if(pd.find("#define __x86_64__ 1") != pd.npos ||
-     pd.find("#define _M_X64 ") != pd.npos) {
+  if(hasMacro(opts, "__x86_64__", "1") || hasMacro(opts, "_M_X64")) {
     triple.setArchName("x86_64");
-  } else if(pd.find("#define __amd64__ 1") != pd.npos ||
-            pd.find("#define _M_AMD64 ") != pd.npos) {
+  } else if(hasMacro(opts, "__amd64__", "1") ||
+            hasMacro(opts, "_M_AMD64")) {
     triple.setArchName("amd64");
-  } else if(pd.find("#define __i386__ 1") != pd.npos ||
-            pd.find("#define _M_IX86 ") != pd.npos) {
+  } else if(hasMacro(opts, "__i386__", "1") || hasMacro(opts, "_M_IX86")) {
     triple.setArchName("i386");
   }
-  if(pd.find("#define _WIN32 1") != pd.npos) {
+  if(hasMacro(opts, "_WIN32", "1")) {
     triple.setVendorName("pc");
     triple.setOSName("windows");
   }
-  if(pd.find("#define __MINGW32__ 1") != pd.npos) {
+  if(hasMacro(opts, "__MINGW32__", "1")) {
     triple.setEnvironmentName("gnu");
   }
   opts.Triple = triple.getTriple();
@@ -116,12 +205,12 @@ static void setTriple(Options& opts)
 //----------------------------------------------------------------------------
 static bool detectCC_GNU(const char* const* argBeg,
                          const char* const* argEnd,
+                         Context const& ctx,
                          Options& opts)
 {
   std::string const fwExplicitSuffix = " (framework directory)";
   std::string const fwImplicitSuffix = "/Frameworks";
   std::vector<const char*> cc_args(argBeg, argEnd);
-  std::string empty_cpp = getResourceDir() + "/empty.cpp";
   int ret;
   std::string out;
   std::string err;
@@ -129,10 +218,13 @@ static bool detectCC_GNU(const char* const* argBeg,
   cc_args.push_back("-E");
   cc_args.push_back("-dM");
   cc_args.push_back("-v");
-  cc_args.push_back(empty_cpp.c_str());
+  // Preprocess an empty C++ source read from stdin, which is null.
+  cc_args.push_back("-x");
+  cc_args.push_back("c++");
+  cc_args.push_back("-");
   if(runCommand(int(cc_args.size()), &cc_args[0], ret, out, err, msg) &&
      ret == 0) {
-    opts.Predefines = out;
+    std::string const other = parsePredefines(out, opts);
     const char* start_line = "#include <...> search starts here:";
     if(const char* c = strstr(err.c_str(), start_line)) {
       if((c = strchr(c, '\n'), c++)) {
@@ -157,14 +249,14 @@ static bool detectCC_GNU(const char* const* argBeg,
             }
             // Replace the compiler builtin include directory with ours.
             if(!fw && cxsys::SystemTools::FileExists((inc+"/emmintrin.h"))) {
-              inc = getClangBuiltinIncludeDir();
+              inc = getClangBuiltinIncludeDir(ctx);
             }
             opts.Includes.push_back(Options::Include(inc, fw));
           }
         }
       }
     }
-    fixPredefines(opts);
+    fixPredefines(opts, other);
     setTriple(opts);
     return true;
   } else {
@@ -172,24 +264,127 @@ static bool detectCC_GNU(const char* const* argBeg,
   }
 }
 
+//----------------------------------------------------------------------------
+static const char* const detectVSMacros[] = {
+  "_ATL_VER",
+  "_CHAR_UNSIGNED",
+  "_CPPRTTI",
+  "_CPPUNWIND",
+  "_DEBUG",
+  "_DLL",
+  "_INTEGRAL_MAX_BITS",
+  "_MANAGED",
+  "_MFC_VER",
+  "_MSC_BUILD",
+  "_MSC_EXTENSIONS",
+  "_MSC_FULL_VER",
+  "_MSC_VER",
+  "_MT",
+  "_M_ALPHA",
+  "_M_AMD64",
+  "_M_ARM_FP",
+  "_M_CEE",
+  "_M_CEE_PURE",
+  "_M_CEE_SAFE",
+  "_M_IA64",
+  "_M_IX86",
+  "_M_IX86_FP",
+  "_M_MPPC",
+  "_M_MRX000",
+  "_M_PPC",
+  "_M_X64",
+  "_NATIVE_WCHAR_T_DEFINED",
+  "_OPENMP",
+  "_VC_NODEFAULTLIB",
+  "_WCHAR_T_DEFINED",
+  "_WIN32",
+  "_WIN64",
+  "_Wp64",
+  "__CLR_VER",
+  "__MSVC_RUNTIME_CHECKS",
+  "__cplusplus",
+  "__cplusplus_cli",
+  0
+};
+
+//----------------------------------------------------------------------------
+static std::string detectVSFile;
+static std::mutex detectVSFileMutex;
+
+//----------------------------------------------------------------------------
+static void removeDetectVSFile()
+{
+  llvm::sys::fs::remove(detectVSFile);
+}
+
+//----------------------------------------------------------------------------
+static bool writeDetectVSFile(std::string& msg)
+{
+  // Write the probe source once per process to a temporary file since
+  // cl does not read sources from stdin.
+  std::lock_guard<std::mutex> lock(detectVSFileMutex);
+  if(!detectVSFile.empty()) {
+    return true;
+  }
+  int fd;
+  llvm::SmallString<128> tmp;
+  if(std::error_code ec =
+     llvm::sys::fs::createTemporaryFile("castxml-detect_vs", "cpp",
+                                        fd, tmp)) {
+    msg = "unable to create probe source: " + ec.message();
+    return false;
+  }
+  llvm::sys::RemoveFileOnSignal(tmp.str());
+  {
+    // 'cl -c -FoNUL' prints a #define line for each predefined macro.
+    llvm::raw_fd_ostream fout(fd, /*shouldClose=*/true);
+    fout <<
+      "#define TO_STRING0(x) #x\n"
+      "#define TO_STRING(x) TO_STRING0(x)\n"
+      "#define TO_DEFINE(x) \"#define \" #x \" \" TO_STRING(x)\n"
+      "\n"
+      "#pragma message(\"\")\n";
+    for(const char* const* m = detectVSMacros; *m; ++m) {
+      fout <<
+        "#ifdef " << *m << "\n"
+        "# pragma message(TO_DEFINE(" << *m << "))\n"
+        "#endif\n";
+    }
+    fout << "#pragma message(\"class type_info;\")\n";
+    fout.close();
+    if(fout.has_error()) {
+      fout.clear_error();
+      llvm::sys::fs::remove(tmp.str());
+      msg = "unable to write probe source: " + tmp.str().str();
+      return false;
+    }
+  }
+  detectVSFile = tmp.str();
+  atexit(removeDetectVSFile);
+  return true;
+}
+
 //----------------------------------------------------------------------------
 static bool detectCC_MSVC(const char* const* argBeg,
                           const char* const* argEnd,
                           Options& opts)
 {
   std::vector<const char*> cc_args(argBeg, argEnd);
-  std::string detect_vs_cpp = getResourceDir() + "/detect_vs.cpp";
   int ret;
   std::string out;
   std::string err;
   std::string msg;
+  if(!writeDetectVSFile(msg)) {
+    return failedCC("msvc", cc_args, out, err, msg);
+  }
   cc_args.push_back("-c");
   cc_args.push_back("-FoNUL");
-  cc_args.push_back(detect_vs_cpp.c_str());
+  cc_args.push_back(detectVSFile.c_str());
   if(runCommand(int(cc_args.size()), &cc_args[0], ret, out, err, msg) &&
      ret == 0) {
+    std::string other;
     if(const char* predefs = strstr(out.c_str(), "\n#define")) {
-      opts.Predefines = predefs+1;
+      other = parsePredefines(predefs+1, opts);
     }
     if(const char* includes_str = cxsys::SystemTools::GetEnv("INCLUDE")) {
       std::vector<std::string> includes;
@@ -203,7 +398,7 @@ static bool detectCC_MSVC(const char* const* argBeg,
         }
       }
     }
-    fixPredefines(opts);
+    fixPredefines(opts, other);
     setTriple(opts);
     return true;
   } else {
@@ -212,13 +407,14 @@ static bool detectCC_MSVC(const char* const* argBeg,
 }
 
 //----------------------------------------------------------------------------
-bool detectCC(const char* id,
-              const char* const* argBeg,
-              const char* const* argEnd,
-              Options& opts)
+static bool detectCCImpl(const char* id,
+                         const char* const* argBeg,
+                         const char* const* argEnd,
+                         Context const& ctx,
+                         Options& opts)
 {
   if(strcmp(id, "gnu") == 0) {
-    return detectCC_GNU(argBeg, argEnd, opts);
+    return detectCC_GNU(argBeg, argEnd, ctx, opts);
   } else if(strcmp(id, "msvc") == 0) {
     return detectCC_MSVC(argBeg, argEnd, opts);
   } else {
@@ -226,3 +422,353 @@ bool detectCC(const char* id,
     return false;
   }
 }
+
+//----------------------------------------------------------------------------
+static char const detectCacheMagic[] = "castxml-detect-cache 2";
+
+//----------------------------------------------------------------------------
+static std::string detectCacheKey(const char* id,
+                                  const char* const* argBeg,
+                                  const char* const* argEnd,
+                                  Context const& ctx)
+{
+  // The compiler itself is identified by its location and timestamp.
+  std::string cc = cxsys::SystemTools::FindProgram(argBeg[0]);
+  if(cc.empty()) {
+    return std::string();
+  }
+  char buf[64];
+
+  Hasher h;
+  h.Append(detectCacheMagic);
+  h.Append(getVersionString());
+  h.Append(ctx.ResourceDir);
+  h.Append(ctx.ClangResourceDir);
+  h.Append(id);
+  h.Append(cc);
+  sprintf(buf, "%ld", cxsys::SystemTools::ModifiedTime(cc));
+  h.Append(buf);
+  sprintf(buf, "%lu", cxsys::SystemTools::FileLength(cc));
+  h.Append(buf);
+  for(const char* const* a = argBeg + 1; a != argEnd; ++a) {
+    h.Append(*a);
+  }
+
+  // Environment variables that affect the compiler's search paths.
+  static const char* const envVars[] = {
+    "INCLUDE",
+    "CPATH",
+    "C_INCLUDE_PATH",
+    "CPLUS_INCLUDE_PATH",
+    "GCC_EXEC_PREFIX",
+    "COMPILER_PATH",
+    0
+  };
+  for(const char* const* v = envVars; *v; ++v) {
+    h.Append(*v);
+    if(const char* value = cxsys::SystemTools::GetEnv(*v)) {
+      h.Append(value);
+    }
+  }
+
+  return h.FinalizeHex();
+}
+
+//----------------------------------------------------------------------------
+static char const profileMagic[] = "castxml-cc-profile 1";
+
+//----------------------------------------------------------------------------
+static bool readSettings(std::istream& fin, char const* magic,
+                         Context const* ctx, std::string const& sysroot,
+                         Options& opts)
+{
+  // A profile, read with a context, names include directories below
+  // the sysroot with a leading '=' and the builtin directory with a
+  // 'builtin' line.
+  std::string line;
+  if(!fin || !cxsys::SystemTools::GetLineFromStream(fin, line) ||
+     line != magic) {
+    return false;
+  }
+
+  std::string triple;
+  std::vector<Options::Include> includes;
+  std::map<std::string, std::string> macros;
+  while(cxsys::SystemTools::GetLineFromStream(fin, line)) {
+    if(line.compare(0, 7, "triple ") == 0) {
+      triple = line.substr(7);
+    } else if(line.compare(0, 8, "include ") == 0 ||
+              line.compare(0, 10, "framework ") == 0) {
+      bool const fw = line[0] == 'f';
+      std::string dir = line.substr(fw? 10 : 8);
+      if(ctx && !dir.empty() && dir[0] == '=') {
+        dir = sysroot + dir.substr(1);
+      }
+      includes.push_back(Options::Include(dir, fw));
+    } else if(ctx && line == "builtin") {
+      includes.push_back(Options::Include(getClangBuiltinIncludeDir(*ctx)));
+    } else if(line.compare(0, 6, "macro ") == 0) {
+      addMacro(llvm::StringRef(line).substr(6), macros);
+    } else if(line.compare(0, 11, "predefines ") == 0) {
+      // The predefines other than the macros are last and stored
+      // verbatim.
+      std::string::size_type len = strtoul(line.c_str() + 11, 0, 10);
+      std::string other(len, '\0');
+      if(len > 0 && !fin.read(&other[0], len)) {
+        return false;
+      }
+      opts.PredefinedMacros.swap(macros);
+      opts.Predefines = formatMacros(opts) + other;
+      opts.Includes = includes;
+      opts.Triple = triple;
+      return true;
+    } else {
+      return false;
+    }
+  }
+  return false;
+}
+
+//----------------------------------------------------------------------------
+static void writeSettings(llvm::raw_ostream& fout, char const* magic,
+                          Context const* ctx, std::string const& sysroot,
+                          Options const& opts)
+{
+  // Write what readSettings reads back, relative to the sysroot and
+  // builtin directory if given a context.
+  std::string const builtin =
+    ctx? getClangBuiltinIncludeDir(*ctx) : std::string();
+  fout << magic << "\n";
+  fout << "triple " << opts.Triple << "\n";
+  for(std::vector<Options::Include>::const_iterator
+        i = opts.Includes.begin(), e = opts.Includes.end(); i != e; ++i) {
+    std::string const& dir = i->Directory;
+    if(ctx && !i->Framework && dir == builtin) {
+      fout << "builtin\n";
+      continue;
+    }
+    fout << (i->Framework? "framework " : "include ");
+    if(ctx && !sysroot.empty() &&
+       dir.compare(0, sysroot.size(), sysroot) == 0 &&
+       (dir.size() == sysroot.size() || dir[sysroot.size()] == '/')) {
+      fout << "=" << dir.substr(sysroot.size()) << "\n";
+    } else {
+      fout << dir << "\n";
+    }
+  }
+  for(auto const& m : opts.PredefinedMacros) {
+    fout << "macro " << formatMacro(m) << "\n";
+  }
+  // The predefines text starts with the macros as formatted by
+  // fixPredefines.
+  std::string const other =
+    opts.Predefines.substr(formatMacros(opts).size());
+  fout << "predefines " << other.size() << "\n";
+  fout << other;
+}
+
+//----------------------------------------------------------------------------
+static bool loadDetectCache(std::string const& entry, Options& opts)
+{
+  std::ifstream fin(entry.c_str(), std::ios::in | std::ios::binary);
+  return readSettings(fin, detectCacheMagic, nullptr, std::string(), opts);
+}
+
+//----------------------------------------------------------------------------
+static void saveDetectCache(std::string const& entry, Options const& opts)
+{
+  std::string text;
+  {
+    llvm::raw_string_ostream out(text);
+    writeSettings(out, detectCacheMagic, nullptr, std::string(), opts);
+  }
+  // The cache is only an optimization, so ignore failure to write it.
+  std::string msg;
+  replaceFile(entry, text, msg);
+}
+
+//----------------------------------------------------------------------------
+bool detectCC(const char* id,
+              const char* const* argBeg,
+              const char* const* argEnd,
+              Context const& ctx,
+              Options& opts)
+{
+  std::string entry;
+  if(!opts.DetectCacheDir.empty()) {
+    std::string key = detectCacheKey(id, argBeg, argEnd, ctx);
+    if(!key.empty()) {
+      entry = opts.DetectCacheDir + "/" + key;
+    }
+  }
+  if(entry.empty()) {
+    return detectCCImpl(id, argBeg, argEnd, ctx, opts);
+  }
+
+  // Use the settings from a previous detection if available.
+  if(loadDetectCache(entry, opts)) {
+    countMetric(MetricDetectCacheHits);
+    return true;
+  }
+
+  // Let only one process run the compiler for a given entry.
+  // Others wait for it to finish and then use its result.
+  cxsys::SystemTools::MakeDirectory(opts.DetectCacheDir);
+  llvm::LockFileManager lock(entry);
+  switch(lock.getState()) {
+  case llvm::LockFileManager::LFS_Error:
+    // Locking is not possible.  Detect without coordination.
+    break;
+  case llvm::LockFileManager::LFS_Owned:
+    // Another process may have finished since we first looked.
+    if(loadDetectCache(entry, opts)) {
+      countMetric(MetricDetectCacheHits);
+      return true;
+    }
+    break;
+  case llvm::LockFileManager::LFS_Shared:
+    // Fall through to our own detection if the owner failed.
+    lock.waitForUnlock();
+    if(loadDetectCache(entry, opts)) {
+      countMetric(MetricDetectCacheHits);
+      return true;
+    }
+    break;
+  }
+
+  countMetric(MetricDetectCacheMisses);
+  if(!detectCCImpl(id, argBeg, argEnd, ctx, opts)) {
+    return false;
+  }
+
+  saveDetectCache(entry, opts);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+std::vector<std::string> getDetectedArgs(Options const& opts)
+{
+  std::vector<std::string> args;
+  if(!opts.HaveCC) {
+    return args;
+  }
+
+  // Configure target to match that of given compiler.
+  if(!opts.HaveTarget && !opts.Triple.empty()) {
+    args.push_back("-target");
+    args.push_back(opts.Triple);
+  }
+
+  // Tell Clang driver not to add its header search paths.
+  args.push_back("-nobuiltininc");
+  args.push_back("-nostdlibinc");
+
+  // Add header search paths detected from given compiler.
+  for(std::vector<Options::Include>::const_iterator
+        i = opts.Includes.begin(), e = opts.Includes.end();
+      i != e; ++i) {
+    args.push_back(i->Framework? "-iframework" : "-isystem");
+    args.push_back(i->Directory);
+  }
+
+  // Tell Clang not to add its predefines.
+  args.push_back("-undef");
+
+  // Configure language options to match given compiler.
+  if(hasMacro(opts, "_MSC_EXTENSIONS")) {
+    args.push_back("-fms-extensions");
+  }
+  std::map<std::string, std::string>::const_iterator msc =
+    opts.PredefinedMacros.find("_MSC_VER");
+  if(msc != opts.PredefinedMacros.end()) {
+    args.push_back("-fms-compatibility");
+    args.push_back("-fmsc-version=" + msc->second);
+  }
+  return args;
+}
+
+//----------------------------------------------------------------------------
+static void appendResponseFileArg(std::string& out, std::string const& arg)
+{
+  // Quote every argument as TokenizeGNUCommandLine reads it back.
+  out += '"';
+  for(char c : arg) {
+    if(c == '"' || c == '\\') {
+      out += '\\';
+    }
+    out += c;
+  }
+  out += "\"\n";
+}
+
+//----------------------------------------------------------------------------
+bool writeDetectedConfig(std::string const& fname, Options const& opts)
+{
+  // Give the predefines in a header included before each input.  Undo
+  // any that Clang forces despite '-undef' before defining them.
+  std::string const header =
+    cxsys::SystemTools::CollapseFullPath(fname + ".h");
+  std::string pd;
+  for(auto const& m : opts.PredefinedMacros) {
+    pd += "#undef " + m.first + "\n";
+  }
+  pd += opts.Predefines;
+
+  std::string args;
+  for(std::string const& a : getDetectedArgs(opts)) {
+    appendResponseFileArg(args, a);
+  }
+  appendResponseFileArg(args, "-include");
+  appendResponseFileArg(args, header);
+
+  std::string msg;
+  if(!replaceFile(header, pd, msg) || !replaceFile(fname, args, msg)) {
+    std::cerr << "error: " << msg << "\n";
+    return false;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool loadCCProfile(std::string const& name, std::string const& sysroot,
+                   Context const& ctx, Options& opts)
+{
+  // A name without a directory is that of a bundled profile, read
+  // through the resource overlay in case it is embedded.
+  std::string const fname = name.find_first_of("/\\") != name.npos?
+    name : ctx.ResourceDir + "/profiles/" + name + ".profile";
+  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> fs =
+    overlayResourceFileSystem(clang::vfs::getRealFileSystem(), ctx);
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buf =
+    fs->getBufferForFile(fname);
+  if(!buf) {
+    std::cerr << "error: '--castxml-cc-profile' file '" << fname
+              << "' could not be read\n";
+    return false;
+  }
+  std::istringstream in((*buf)->getBuffer().str());
+  if(!readSettings(in, profileMagic, &ctx, sysroot, opts)) {
+    std::cerr << "error: '--castxml-cc-profile' file '" << fname
+              << "' is not a castxml compiler profile\n";
+    return false;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool writeDetectedProfile(std::string const& fname,
+                          std::string const& sysroot,
+                          Context const& ctx, Options const& opts)
+{
+  std::string text;
+  {
+    llvm::raw_string_ostream out(text);
+    writeSettings(out, profileMagic, &ctx, sysroot, opts);
+  }
+  std::string msg;
+  if(!replaceFile(fname, text, msg)) {
+    std::cerr << "error: " << msg << "\n";
+    return false;
+  }
+  return true;
+}
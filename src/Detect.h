@@ -16,6 +16,10 @@
 #ifndef CASTXML_DETECT_H
 #define CASTXML_DETECT_H
 
+#include <string>
+#include <vector>
+
+class Context;
 struct Options;
 
 /// detectCC - Detect settings from given compiler command.
@@ -23,6 +27,32 @@ struct Options;
 bool detectCC(const char* id,
               const char* const* argBeg,
               const char* const* argEnd,
+              Context const& ctx,
               Options& opts);
 
+/// getDetectedArgs - Get the Clang driver arguments that configure it
+/// to match the compiler detected by detectCC, apart from the
+/// predefines, or none if nothing was detected.
+std::vector<std::string> getDetectedArgs(Options const& opts);
+
+/// writeDetectedConfig - Write the arguments given by getDetectedArgs
+/// to the named response file for '--castxml-cc-emit-config', with an
+/// '-include' of a header holding the detected predefines written
+/// next to it.
+bool writeDetectedConfig(std::string const& fname, Options const& opts);
+
+/// loadCCProfile - Load the settings detectCC would give from the
+/// compiler profile of '--castxml-cc-profile', either a file or the
+/// name of one bundled in the resource directory, placing include
+/// directories it names relative to the sysroot under the sysroot.
+bool loadCCProfile(std::string const& name, std::string const& sysroot,
+                   Context const& ctx, Options& opts);
+
+/// writeDetectedProfile - Write the settings detected by detectCC to
+/// the named profile for '--castxml-cc-emit-profile', naming include
+/// directories under the sysroot, if any, relative to it.
+bool writeDetectedProfile(std::string const& fname,
+                          std::string const& sysroot,
+                          Context const& ctx, Options const& opts);
+
 #endif // CASTXML_DETECT_H
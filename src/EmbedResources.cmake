@@ -0,0 +1,54 @@
+#=============================================================================
+# Copyright Kitware, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#=============================================================================
+
+# Generate a C++ source holding the content of the castxml and Clang
+# resource directories for ResourceFS.cxx.  Run in script mode with
+#   -DOUTPUT=<file> -DCASTXML_DIR=<dir> -DCLANG_DIR=<dir>
+
+set(data "")
+set(table "")
+set(n 0)
+set(cast "reinterpret_cast<char const*>")
+
+macro(embed_dir dir prefix)
+  file(GLOB_RECURSE files RELATIVE "${dir}" "${dir}/*")
+  list(SORT files)
+  foreach(f ${files})
+    file(READ "${dir}/${f}" hex HEX)
+    string(LENGTH "${hex}" len)
+    math(EXPR size "${len} / 2")
+    string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+    set(data "${data}static unsigned char const data${n}[] = {${bytes}0};\n")
+    set(table "${table}  { \"${prefix}/${f}\",\n")
+    set(table "${table}    ${cast}(data${n}), ${size} },\n")
+    math(EXPR n "${n} + 1")
+  endforeach()
+endmacro()
+
+embed_dir("${CASTXML_DIR}" "castxml")
+embed_dir("${CLANG_DIR}/include" "clang/include")
+
+file(WRITE "${OUTPUT}.tmp" "// Generated by EmbedResources.cmake.
+#include \"ResourceFS.h\"
+
+${data}
+extern EmbeddedResource const embeddedResources[] = {
+${table}  { 0, 0, 0 }
+};
+")
+execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different
+  "${OUTPUT}.tmp" "${OUTPUT}")
+file(REMOVE "${OUTPUT}.tmp")
@@ -0,0 +1,374 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "HeaderCache.h"
+#include "Options.h"
+#include "TimeReport.h"
+#include "Utils.h"
+
+#include <cxsys/SystemTools.hxx>
+
+#include "clang/Basic/SourceManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Lex/Preprocessor.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+static const char* const headerCacheMagic = "castxml-header-cache 1";
+
+//----------------------------------------------------------------------------
+static bool replaceFileId(std::string& xml, std::string const& from,
+                          std::string const& to)
+{
+  // Replace the File id in the location and file attributes of the
+  // element and its nested elements, and report whether all of them
+  // had it.  Values cannot hold a quote, so the text of an attribute
+  // is never found inside the value of another.
+  bool only = true;
+  std::string out;
+  out.reserve(xml.size());
+  std::string::size_type pos = 0;
+  for(;;) {
+    std::string::size_type const next = xml.find("=\"f", pos);
+    if(next == std::string::npos) {
+      break;
+    }
+    std::string::size_type const id = next + 3;
+    out.append(xml, pos, id - pos);
+    pos = id;
+    llvm::StringRef const head(xml.data(), next);
+    bool const isLoc = head.endswith(" location");
+    if(!isLoc && !head.endswith(" file")) {
+      continue;
+    }
+    std::string::size_type const end = id + from.size();
+    if(xml.compare(id, from.size(), from) == 0 && end < xml.size() &&
+       xml[end] == (isLoc? ':' : '"')) {
+      out += to;
+      pos = end;
+    } else {
+      only = false;
+    }
+  }
+  out.append(xml, pos, std::string::npos);
+  xml.swap(out);
+  return only;
+}
+
+//----------------------------------------------------------------------------
+HeaderCache::HeaderCache(clang::CompilerInstance& ci, OutputHandler& out,
+                         Options const& opts):
+  CI(ci), Out(out), Dir(opts.HeaderCacheDir), IncludesFound(false),
+  Muted(false), Capture(nullptr), TextStream(Text),
+  CaptureXML(createXMLHandler(TextStream))
+{
+  // Key every header also on what the translation unit gives all of
+  // them: the predefined macros, target, and options that change the
+  // text of the elements.
+  Hasher h;
+  h.Append(getVersionString());
+  h.Append(ci.getPreprocessor().getPredefines());
+  h.Append(ci.getTargetOpts().Triple);
+  appendOutputOptions(h, opts);
+  this->Salt = h.FinalizeHex();
+}
+
+//----------------------------------------------------------------------------
+HeaderCache::~HeaderCache()
+{
+}
+
+//----------------------------------------------------------------------------
+void HeaderCache::FindIncludes()
+{
+  // List the files included by each file, local or loaded from a PCH,
+  // in the order of their inclusion.
+  clang::SourceManager const& sm = this->CI.getSourceManager();
+  auto const add = [this, &sm](clang::SrcMgr::SLocEntry const& e) {
+    if(!e.isFile()) {
+      return;
+    }
+    clang::SourceLocation const inc = e.getFile().getIncludeLoc();
+    if(inc.isInvalid()) {
+      return;
+    }
+    clang::FileID const fid =
+      sm.getFileID(clang::SourceLocation::getFromRawEncoding(e.getOffset()));
+    this->Includes[sm.getFileID(inc).getHashValue()].push_back(fid);
+  };
+  for(unsigned int i = 0; i < sm.local_sloc_entry_size(); ++i) {
+    add(sm.getLocalSLocEntry(i));
+  }
+  for(unsigned int i = 0; i < sm.loaded_sloc_entry_size(); ++i) {
+    add(sm.getLoadedSLocEntry(i));
+  }
+  this->IncludesFound = true;
+}
+
+//----------------------------------------------------------------------------
+std::string const& HeaderCache::HashFile(clang::FileID fid)
+{
+  unsigned int const fidHash = fid.getHashValue();
+  auto i = this->FileHashes.find(fidHash);
+  if(i != this->FileHashes.end()) {
+    return i->second;
+  }
+  if(!this->IncludesFound) {
+    this->FindIncludes();
+  }
+  Hasher h;
+  h.Append(this->CI.getSourceManager().getBufferData(fid).str());
+  std::map<unsigned int, std::vector<clang::FileID>>::const_iterator inc =
+    this->Includes.find(fidHash);
+  if(inc != this->Includes.end()) {
+    for(clang::FileID const& f : inc->second) {
+      h.Append(this->HashFile(f));
+    }
+  }
+  return this->FileHashes[fidHash] = h.FinalizeHex();
+}
+
+//----------------------------------------------------------------------------
+HeaderCache::Header* HeaderCache::GetHeader(clang::FileID fid)
+{
+  unsigned int const fidHash = fid.getHashValue();
+  auto i = this->FileHeaders.find(fidHash);
+  if(i != this->FileHeaders.end()) {
+    return i->second;
+  }
+
+  // The main file of each translation unit differs, and only files
+  // read from disk are shared with other translation units.
+  clang::SourceManager const& sm = this->CI.getSourceManager();
+  Header* header = nullptr;
+  if(fid.isValid() && fid != sm.getMainFileID() &&
+     sm.getFileEntryForID(fid)) {
+    Hasher h;
+    h.Append(this->Salt);
+    h.Append(this->HashFile(fid));
+    std::string const key = h.FinalizeHex();
+    std::unique_ptr<Header>& hp = this->Headers[key];
+    if(!hp) {
+      hp.reset(new Header);
+      hp->Key = key;
+      this->Load(*hp);
+    }
+    header = hp.get();
+  }
+  this->FileHeaders[fidHash] = header;
+  return header;
+}
+
+//----------------------------------------------------------------------------
+void HeaderCache::Load(Header& h)
+{
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+    llvm::MemoryBuffer::getFile(this->Dir + "/" + h.Key + ".xml");
+  if(!buffer) {
+    return;
+  }
+
+  // After the magic line, each element is given by its key on one
+  // line, the length of its text on the next, and then the text.
+  llvm::StringRef data = buffer.get()->getBuffer();
+  std::pair<llvm::StringRef, llvm::StringRef> line = data.split('\n');
+  if(line.first != headerCacheMagic) {
+    return;
+  }
+  data = line.second;
+  std::map<std::string, std::string> elements;
+  while(!data.empty()) {
+    std::pair<llvm::StringRef, llvm::StringRef> key = data.split('\n');
+    std::pair<llvm::StringRef, llvm::StringRef> size =
+      key.second.split('\n');
+    unsigned long long n;
+    if(size.first.getAsInteger(10, n) || n > size.second.size()) {
+      return;
+    }
+    elements[key.first.str()] = size.second.substr(0, n).str();
+    data = size.second.substr(n);
+  }
+  h.Elements.swap(elements);
+}
+
+//----------------------------------------------------------------------------
+void HeaderCache::Store(Header const& h)
+{
+  std::string data = headerCacheMagic;
+  data += "\n";
+  for(std::map<std::string, std::string>::const_iterator
+        i = h.Elements.begin(), e = h.Elements.end(); i != e; ++i) {
+    data += i->first + "\n" + std::to_string(i->second.size()) + "\n";
+    data += i->second;
+  }
+
+  // An entry that cannot be written is produced again by a later run.
+  std::string msg;
+  cxsys::SystemTools::MakeDirectory(this->Dir);
+  replaceFile(this->Dir + "/" + h.Key + ".xml", data, msg);
+}
+
+//----------------------------------------------------------------------------
+std::string const* HeaderCache::Find(clang::FileID fid,
+                                     std::string const& key)
+{
+  Header* h = this->GetHeader(fid);
+  if(!h) {
+    return nullptr;
+  }
+  std::map<std::string, std::string>::const_iterator i =
+    h->Elements.find(key);
+  if(i != h->Elements.end()) {
+    countMetric(MetricHeaderCacheHits);
+    return &i->second;
+  }
+  countMetric(MetricHeaderCacheMisses);
+  this->Capture = h;
+  this->CaptureKey = key;
+  return nullptr;
+}
+
+//----------------------------------------------------------------------------
+void HeaderCache::Splice(std::string const& xml, unsigned int file)
+{
+  this->Muted = false;
+  std::string text = xml;
+  replaceFileId(text, "@", std::to_string(file));
+  this->Out.ElementText(text);
+}
+
+//----------------------------------------------------------------------------
+void HeaderCache::Save()
+{
+  for(auto const& h : this->Headers) {
+    if(h.second->Dirty) {
+      this->Store(*h.second);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+void HeaderCache::StartDocument()
+{
+  this->Out.StartDocument();
+}
+
+//----------------------------------------------------------------------------
+void HeaderCache::StartElement(llvm::StringRef tag)
+{
+  if(!this->Muted) {
+    this->Out.StartElement(tag);
+  }
+  if(this->Capture) {
+    this->CaptureXML->StartElement(tag);
+  }
+}
+
+//----------------------------------------------------------------------------
+void HeaderCache::StringAttribute(llvm::StringRef name,
+                                  llvm::StringRef value)
+{
+  if(!this->Muted) {
+    this->Out.StringAttribute(name, value);
+  }
+  if(this->Capture) {
+    this->CaptureXML->StringAttribute(name, value);
+  }
+}
+
+//----------------------------------------------------------------------------
+void HeaderCache::IntAttribute(llvm::StringRef name, int64_t value)
+{
+  if(!this->Muted) {
+    this->Out.IntAttribute(name, value);
+  }
+  if(this->Capture) {
+    this->CaptureXML->IntAttribute(name, value);
+  }
+}
+
+//----------------------------------------------------------------------------
+void HeaderCache::UIntAttribute(llvm::StringRef name, uint64_t value)
+{
+  if(!this->Muted) {
+    this->Out.UIntAttribute(name, value);
+  }
+  if(this->Capture) {
+    this->CaptureXML->UIntAttribute(name, value);
+  }
+}
+
+//----------------------------------------------------------------------------
+void HeaderCache::RefAttribute(llvm::StringRef name,
+                               llvm::ArrayRef<Ref> refs)
+{
+  if(!this->Muted) {
+    this->Out.RefAttribute(name, refs);
+  }
+  if(this->Capture) {
+    this->CaptureXML->RefAttribute(name, refs);
+  }
+}
+
+//----------------------------------------------------------------------------
+void HeaderCache::LocationAttribute(llvm::StringRef name, unsigned int file,
+                                    unsigned int line)
+{
+  if(!this->Muted) {
+    this->Out.LocationAttribute(name, file, line);
+  }
+  if(this->Capture) {
+    this->CaptureXML->LocationAttribute(name, file, line);
+  }
+}
+
+//----------------------------------------------------------------------------
+void HeaderCache::EndElement()
+{
+  if(!this->Muted) {
+    this->Out.EndElement();
+  }
+  if(this->Capture) {
+    this->CaptureXML->EndElement();
+  }
+}
+
+//----------------------------------------------------------------------------
+void HeaderCache::EndNode(uint64_t id, unsigned int file)
+{
+  this->Out.EndNode(id, file);
+  if(!this->Capture) {
+    return;
+  }
+  this->CaptureXML->EndNode(id, file);
+  this->TextStream.flush();
+
+  // Keep the element only if it refers to no File but its header's,
+  // which it names by the id the next translation unit gives it.
+  if(replaceFileId(this->Text, file? std::to_string(file) : "", "@")) {
+    this->Capture->Elements[this->CaptureKey] = this->Text;
+    this->Capture->Dirty = true;
+  }
+  this->Text.clear();
+  this->Capture = nullptr;
+}
+
+//----------------------------------------------------------------------------
+void HeaderCache::EndDocument()
+{
+  this->Out.EndDocument();
+}
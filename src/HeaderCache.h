@@ -0,0 +1,131 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_HEADERCACHE_H
+#define CASTXML_HEADERCACHE_H
+
+#include <cxsys/Configure.hxx>
+
+#include "OutputHandler.h"
+
+#include "clang/Basic/SourceLocation.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace clang {
+  class CompilerInstance;
+}
+
+struct Options;
+
+/// HeaderCache - The gccxml-format text of the elements declared in
+/// each header, kept in the directory given by '--castxml-header-cache'
+/// under a key hashing the content of the header, of the headers it
+/// includes, and the predefined macros and options of the translation
+/// unit.  The cache also forwards the output events of a translation
+/// unit to the XML handler writing it, so that the events of an element
+/// whose text is found in the cache can be replaced by that text, and
+/// the text of other elements of headers can be added to the cache.
+class HeaderCache: public OutputHandler
+{
+  struct Header
+  {
+    Header(): Dirty(false) {}
+    std::string Key;
+    bool Dirty;
+
+    // The text of each element, by its id and completeness, with the
+    // id of the header's File element replaced by '@'.
+    std::map<std::string, std::string> Elements;
+  };
+
+  clang::CompilerInstance& CI;
+  OutputHandler& Out;
+  std::string Dir;
+  std::string Salt;
+
+  // Headers by key, and the header of each file id of the source
+  // manager, or null for the main file and files that are not headers.
+  std::map<std::string, std::unique_ptr<Header>> Headers;
+  llvm::DenseMap<unsigned int, Header*> FileHeaders;
+
+  // The files included by each file id, and the hash of the content
+  // of each file id and those it includes.
+  std::map<unsigned int, std::vector<clang::FileID>> Includes;
+  bool IncludesFound;
+  llvm::DenseMap<unsigned int, std::string> FileHashes;
+
+  // Whether the events of the current element are dropped because its
+  // text was found in the cache.
+  bool Muted;
+
+  // The element being added to the cache, if any, written by a second
+  // XML handler to Text.
+  Header* Capture;
+  std::string CaptureKey;
+  std::string Text;
+  llvm::raw_string_ostream TextStream;
+  std::unique_ptr<OutputHandler> CaptureXML;
+
+  void FindIncludes();
+  std::string const& HashFile(clang::FileID fid);
+  Header* GetHeader(clang::FileID fid);
+  void Load(Header& h);
+  void Store(Header const& h);
+
+public:
+  HeaderCache(clang::CompilerInstance& ci, OutputHandler& out,
+              Options const& opts);
+  ~HeaderCache();
+
+  /** Find the text cached for the element with the given key declared
+      in the given file of the source manager, with the id of the File
+      element of the header replaced by '@', or null if there is none.
+      Otherwise, if the file is a header, the events of the element up
+      to the next EndNode are kept and added to the cache.  */
+  std::string const* Find(clang::FileID fid, std::string const& key);
+
+  /** Drop the events of the element whose text was found by Find
+      until Splice is called.  */
+  void Mute() { this->Muted = true; }
+
+  /** Write the text found by Find in place of the dropped events, with
+      the given id of the File element of the header.  */
+  void Splice(std::string const& xml, unsigned int file);
+
+  /** Write the entries of the headers whose elements were added.  */
+  void Save();
+
+  void StartDocument() override;
+  void StartElement(llvm::StringRef tag) override;
+  void StringAttribute(llvm::StringRef name,
+                       llvm::StringRef value) override;
+  void IntAttribute(llvm::StringRef name, int64_t value) override;
+  void UIntAttribute(llvm::StringRef name, uint64_t value) override;
+  void RefAttribute(llvm::StringRef name,
+                    llvm::ArrayRef<Ref> refs) override;
+  void LocationAttribute(llvm::StringRef name, unsigned int file,
+                         unsigned int line) override;
+  void EndElement() override;
+  void EndNode(uint64_t id, unsigned int file) override;
+  void EndDocument() override;
+};
+
+#endif // CASTXML_HEADERCACHE_H
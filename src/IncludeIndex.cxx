@@ -0,0 +1,296 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "IncludeIndex.h"
+#include "Options.h"
+#include "TimeReport.h"
+#include "Utils.h"
+
+#include <cxsys/SystemTools.hxx>
+
+#include "clang/Basic/VirtualFileSystem.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/TimeValue.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+static const char* const includeIndexMagic = "castxml-include-index-1";
+
+//----------------------------------------------------------------------------
+/// Listings of the directories under the detected system include
+/// directories, shared by all compiler instances in this process.
+/// Names are stored in lower case so that a lookup on a case-insensitive
+/// file system is never wrongly reported missing.
+class IncludeIndex
+{
+  struct Listing
+  {
+    Listing(): MTime(0), Checked(false), Present(false), Known(false),
+      Persist(false) {}
+    uint64_t MTime;
+    bool Checked;
+    bool Present;
+    bool Known;
+    bool Persist;
+    llvm::StringSet<> Names;
+  };
+  std::mutex Mutex;
+  std::string File;
+  std::vector<std::string> Roots;
+  llvm::StringMap<Listing> Dirs;
+  bool Dirty;
+
+  void Load() {
+    std::ifstream fin(this->File.c_str(), std::ios::in | std::ios::binary);
+    std::string line;
+    if(!fin || !cxsys::SystemTools::GetLineFromStream(fin, line) ||
+       line != includeIndexMagic) {
+      return;
+    }
+    Listing* l = nullptr;
+    while(cxsys::SystemTools::GetLineFromStream(fin, line)) {
+      if(line.compare(0, 4, "dir ") == 0) {
+        // The modification time is followed by the directory path.
+        char* end;
+        uint64_t mtime = strtoull(line.c_str() + 4, &end, 10);
+        if(*end != ' ') {
+          return;
+        }
+        l = &this->Dirs[end + 1];
+        l->MTime = mtime;
+        l->Known = true;
+        l->Persist = true;
+      } else if(line.compare(0, 5, "name ") == 0 && l) {
+        l->Names.insert(line.substr(5));
+      } else {
+        return;
+      }
+    }
+  }
+
+  Listing& GetListing(clang::vfs::FileSystem& fs, std::string const& dir) {
+    Listing& l = this->Dirs[dir];
+    if(l.Checked) {
+      return l;
+    }
+    l.Checked = true;
+
+    // One status check validates a stored listing by the directory
+    // modification time, which changes when entries come or go.
+    llvm::ErrorOr<clang::vfs::Status> st = fs.status(dir);
+    if(!st || !st->isDirectory()) {
+      l.Present = false;
+      l.Known = false;
+      l.Persist = false;
+      return l;
+    }
+    l.Present = true;
+    uint64_t const mtime = st->getLastModificationTime().toEpochTime();
+    if(l.Known && l.MTime == mtime) {
+      return l;
+    }
+
+    l.MTime = mtime;
+    l.Names.clear();
+    std::error_code ec;
+    for(clang::vfs::directory_iterator i = fs.dir_begin(dir, ec), e;
+        !ec && i != e; i.increment(ec)) {
+      l.Names.insert(llvm::sys::path::filename(i->getName()).lower());
+    }
+    l.Known = !ec;
+
+    // A directory changed within the resolution of its modification
+    // time may change again unnoticed.  Use the listing only here.
+    uint64_t const now = llvm::sys::TimeValue::now().toEpochTime();
+    l.Persist = l.Known && mtime + 1 < now;
+    this->Dirty = this->Dirty || l.Persist;
+    return l;
+  }
+
+public:
+  IncludeIndex(): Dirty(false) {}
+
+  void AddRoots(Options const& opts) {
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    if(this->File.empty()) {
+      this->File = opts.DetectCacheDir + "/include-index";
+      this->Load();
+    }
+    for(Options::Include const& inc : opts.Includes) {
+      std::string root = inc.Directory;
+      while(root.size() > 1 &&
+            llvm::sys::path::is_separator(root[root.size() - 1])) {
+        root.resize(root.size() - 1);
+      }
+      if(std::find(this->Roots.begin(), this->Roots.end(), root) ==
+         this->Roots.end()) {
+        this->Roots.push_back(root);
+      }
+    }
+  }
+
+  bool MayExist(clang::vfs::FileSystem& fs, llvm::StringRef path) {
+    ReportedLock lock(this->Mutex, "Include index");
+    std::vector<std::string>::const_iterator r = this->Roots.begin();
+    for(; r != this->Roots.end(); ++r) {
+      if(path.size() > r->size() + 1 && path.startswith(*r) &&
+         llvm::sys::path::is_separator(path[r->size()])) {
+        break;
+      }
+    }
+    if(r == this->Roots.end()) {
+      return true;
+    }
+
+    // Check each component against the listing of its directory.
+    // Leave paths we cannot follow lexically to the file system.
+    llvm::SmallVector<llvm::StringRef, 8> parts;
+    for(llvm::sys::path::const_iterator
+          i = llvm::sys::path::begin(path.substr(r->size() + 1)),
+          e = llvm::sys::path::end(path.substr(r->size() + 1));
+        i != e; ++i) {
+      if(*i == "." || *i == ".." || llvm::sys::path::is_separator((*i)[0])) {
+        return true;
+      }
+      parts.push_back(*i);
+    }
+    std::string dir = *r;
+    for(llvm::StringRef part : parts) {
+      Listing const& l = this->GetListing(fs, dir);
+      if(!l.Present) {
+        return false;
+      }
+      if(!l.Known) {
+        return true;
+      }
+      if(!l.Names.count(part.lower())) {
+        return false;
+      }
+      dir += "/";
+      dir += part;
+    }
+    return true;
+  }
+
+  void Save() {
+    std::lock_guard<std::mutex> lock(this->Mutex);
+
+    // Validate each listing again on its next use in case this process
+    // serves later requests after the directories change.
+    for(llvm::StringMap<Listing>::iterator i = this->Dirs.begin(),
+          e = this->Dirs.end(); i != e; ++i) {
+      i->second.Checked = false;
+    }
+    if(!this->Dirty) {
+      return;
+    }
+    this->Dirty = false;
+
+    std::string text;
+    {
+      llvm::raw_string_ostream out(text);
+      out << includeIndexMagic << "\n";
+      for(llvm::StringMap<Listing>::const_iterator i = this->Dirs.begin(),
+            e = this->Dirs.end(); i != e; ++i) {
+        Listing const& l = i->second;
+        if(!l.Persist) {
+          continue;
+        }
+        out << "dir " << l.MTime << " " << i->getKey() << "\n";
+        for(llvm::StringSet<>::const_iterator ni = l.Names.begin(),
+              ne = l.Names.end(); ni != ne; ++ni) {
+          out << "name " << ni->getKey() << "\n";
+        }
+      }
+    }
+    // An index that cannot be written is built again by a later run.
+    std::string msg;
+    cxsys::SystemTools::MakeDirectory(
+      llvm::sys::path::parent_path(this->File).str().c_str());
+    replaceFile(this->File, text, msg);
+  }
+};
+
+static IncludeIndex includeIndex;
+
+//----------------------------------------------------------------------------
+/// Report paths the index does not list as missing without asking the
+/// underlying file system.  Header search probes each include directory
+/// in turn, so most lookups it makes are for such paths.
+class IncludeIndexFileSystem: public clang::vfs::FileSystem
+{
+  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> Base;
+public:
+  IncludeIndexFileSystem(
+    llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> const& base):
+    Base(base) {}
+
+  llvm::ErrorOr<clang::vfs::Status> status(llvm::Twine const& path) override {
+    llvm::SmallString<256> p;
+    if(!includeIndex.MayExist(*this->Base, path.toStringRef(p))) {
+      return std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+    return this->Base->status(p);
+  }
+
+  llvm::ErrorOr<std::unique_ptr<clang::vfs::File>>
+  openFileForRead(llvm::Twine const& path) override {
+    llvm::SmallString<256> p;
+    if(!includeIndex.MayExist(*this->Base, path.toStringRef(p))) {
+      return std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+    return this->Base->openFileForRead(p);
+  }
+
+  clang::vfs::directory_iterator
+  dir_begin(llvm::Twine const& dir, std::error_code& ec) override {
+    return this->Base->dir_begin(dir, ec);
+  }
+};
+
+//----------------------------------------------------------------------------
+llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem>
+overlayIncludeIndex(
+  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> const& base,
+  Options const& opts)
+{
+  if(opts.DetectCacheDir.empty() || !opts.HaveCC || opts.Includes.empty()) {
+    return base;
+  }
+  includeIndex.AddRoots(opts);
+  return new IncludeIndexFileSystem(base);
+}
+
+//----------------------------------------------------------------------------
+void saveIncludeIndex()
+{
+  includeIndex.Save();
+}
@@ -0,0 +1,46 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_INCLUDEINDEX_H
+#define CASTXML_INCLUDEINDEX_H
+
+#include <cxsys/Configure.hxx>
+
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+
+namespace clang {
+  namespace vfs {
+    class FileSystem;
+  }
+}
+
+struct Options;
+
+/// overlayIncludeIndex - Answer lookups of paths that do not exist
+/// under the system include directories detected from the compiler
+/// given by '--castxml-cc-<id>' from an index of their contents stored
+/// under '--castxml-detect-cache'.  Other lookups, and those of paths
+/// the index lists, are passed through to the given file system.
+llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem>
+overlayIncludeIndex(
+  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> const& base,
+  Options const& opts);
+
+/// saveIncludeIndex - Store the directory listings read since the
+/// index was loaded so that later processes need not read them again.
+/// Each listing is validated again on its next use.
+void saveIncludeIndex();
+
+#endif // CASTXML_INCLUDEINDEX_H
@@ -0,0 +1,534 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Merge.h"
+#include "Options.h"
+#include "OutputSink.h"
+#include "OutputTable.h"
+#include "Utils.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+//----------------------------------------------------------------------------
+/// One gccxml-format document to merge.
+struct MergeInput
+{
+  MergeInput(): Variants(false) {}
+  std::string Name;
+
+  // The configuration whose output this is, and whether attributes
+  // that differ between configurations are left out of identities.
+  std::string Config;
+  bool Variants;
+
+  std::unique_ptr<llvm::MemoryBuffer> Buffer;
+  std::vector<OutputElement> Elements;
+  llvm::StringMap<size_t> Ids;
+  llvm::StringMap<std::string> Files;
+  llvm::StringMap<std::string> FileHashes;
+  std::vector<std::string> Identities;
+  std::vector<char> Visiting;
+};
+
+//----------------------------------------------------------------------------
+/// One element of the merged document and where it was found.
+struct MergeNode
+{
+  MergeNode(): Input(0), Element(0), Index(0) {}
+  size_t Input;
+  size_t Element;
+  unsigned int Index;
+  std::string Id;
+  std::vector<std::pair<size_t, size_t> > Occurrences;
+};
+
+//----------------------------------------------------------------------------
+static const char* findAttribute(OutputElement const& e, const char* name)
+{
+  for(OutputElement::Attribute const& a : e.Attributes) {
+    if(a.Name == name) {
+      return a.Value.c_str();
+    }
+  }
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+static bool isRecordTag(llvm::StringRef tag)
+{
+  return tag == "Class" || tag == "Struct" || tag == "Union";
+}
+
+//----------------------------------------------------------------------------
+static bool isIdListAttribute(llvm::StringRef name)
+{
+  return (name == "members" || name == "befriending" ||
+          name == "bases" || name == "throw");
+}
+
+//----------------------------------------------------------------------------
+static bool isIdAttribute(llvm::StringRef name)
+{
+  return (name == "type" || name == "returns" || name == "context" ||
+          name == "basetype" || isIdListAttribute(name));
+}
+
+//----------------------------------------------------------------------------
+static bool isVariantAttribute(llvm::StringRef name)
+{
+  // Attributes of the same declaration that depend on the target.
+  return (name == "size" || name == "align" || name == "offset" ||
+          name == "mangled");
+}
+
+//----------------------------------------------------------------------------
+static bool loadMergeInput(MergeInput& in)
+{
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+    llvm::MemoryBuffer::getFile(in.Name);
+  if(!buffer) {
+    std::cerr << "error: unable to read '" << in.Name << "': " <<
+      buffer.getError().message() << "\n";
+    return false;
+  }
+  in.Buffer = std::move(buffer.get());
+
+  // Skip the XML declaration and the document element's start tag.
+  llvm::StringRef xml = in.Buffer->getBuffer();
+  size_t start = xml.find("<GCC_XML");
+  if(start != llvm::StringRef::npos) {
+    start = xml.find('>', start);
+  }
+  if(start == llvm::StringRef::npos) {
+    std::cerr << "error: '" << in.Name <<
+      "' is not a gccxml-format document\n";
+    return false;
+  }
+  xml = xml.drop_front(start + 1);
+
+  for(;;) {
+    xml = xml.ltrim();
+    if(xml.empty() || xml.startswith("</GCC_XML>")) {
+      break;
+    }
+    OutputElement e;
+    if(!parseOutputElement(xml, e)) {
+      std::cerr << "error: '" << in.Name << "' is not well-formed\n";
+      return false;
+    }
+    if(e.Tag == "String") {
+      std::cerr << "error: '" << in.Name << "' was written with "
+        "'--castxml-intern-strings' and cannot be merged\n";
+      return false;
+    }
+    if(e.Tag == "File") {
+      if(const char* id = findAttribute(e, "id")) {
+        const char* name = findAttribute(e, "name");
+        in.Files[id] = name? name : "";
+        if(const char* hash = findAttribute(e, "hash")) {
+          in.FileHashes[name? name : ""] = hash;
+        }
+      }
+      continue;
+    }
+    if(const char* id = findAttribute(e, "id")) {
+      in.Ids[id] = in.Elements.size();
+    }
+    in.Elements.push_back(std::move(e));
+  }
+  in.Identities.resize(in.Elements.size());
+  in.Visiting.resize(in.Elements.size(), 0);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+static std::string const& getIdentity(MergeInput& in, size_t i);
+
+//----------------------------------------------------------------------------
+static void appendValueIdentity(MergeInput& in, Hasher& h,
+                                llvm::StringRef name, llvm::StringRef value)
+{
+  if(name == "location" || name == "file") {
+    // Refer to files by name since their ids differ between inputs.
+    std::pair<llvm::StringRef, llvm::StringRef> loc = value.split(':');
+    llvm::StringMap<std::string>::const_iterator f = in.Files.find(loc.first);
+    h.Append(f != in.Files.end()? f->second : loc.first.str());
+    h.Append(loc.second.str());
+  } else if(isIdAttribute(name)) {
+    llvm::SmallVector<llvm::StringRef, 8> refs;
+    value.split(refs, " ", -1, false);
+    for(llvm::StringRef ref : refs) {
+      // Base class references may have an access prefix.
+      std::pair<llvm::StringRef, llvm::StringRef> a = ref.rsplit(':');
+      if(!a.second.empty()) {
+        h.Append(a.first.str());
+        ref = a.second;
+      }
+      llvm::StringMap<size_t>::const_iterator r = in.Ids.find(ref);
+      h.Append(r != in.Ids.end()? getIdentity(in, r->second) : ref.str());
+    }
+  } else {
+    h.Append(value.str());
+  }
+}
+
+//----------------------------------------------------------------------------
+static void appendElementIdentity(MergeInput& in, Hasher& h,
+                                  OutputElement const& e)
+{
+  // Records are identified by name and scope alone so that incomplete
+  // and complete elements for one class merge.  Anonymous records also
+  // need their location.
+  bool const record = isRecordTag(e.Tag);
+  const char* name = findAttribute(e, "name");
+  bool const anonymous = !name || !*name;
+  h.Append(e.Tag.str());
+  for(OutputElement::Attribute const& a : e.Attributes) {
+    if(a.Name == "id" || a.Name == "members" || a.Name == "befriending" ||
+       (in.Variants && isVariantAttribute(a.Name))) {
+      continue;
+    }
+    if(record && !(a.Name == "name" || a.Name == "context" ||
+                   (a.Name == "mangled" && !in.Variants) ||
+                   (anonymous && a.Name == "location"))) {
+      continue;
+    }
+    h.Append(a.Name.str());
+    appendValueIdentity(in, h, a.Name, a.Value);
+  }
+  for(OutputElement const& c : e.Children) {
+    appendElementIdentity(in, h, c);
+  }
+}
+
+//----------------------------------------------------------------------------
+static std::string const& getIdentity(MergeInput& in, size_t i)
+{
+  if(in.Identities[i].empty()) {
+    if(in.Visiting[i]) {
+      // A reference cycle not broken by the attributes skipped above.
+      // Identify the back-reference by a placeholder.
+      static std::string const cycle = "cycle";
+      return cycle;
+    }
+    in.Visiting[i] = 1;
+    Hasher h;
+    appendElementIdentity(in, h, in.Elements[i]);
+    in.Identities[i] = h.FinalizeHex();
+    in.Visiting[i] = 0;
+  }
+  return in.Identities[i];
+}
+
+//----------------------------------------------------------------------------
+class Merger
+{
+  std::vector<MergeInput>& Inputs;
+  std::vector<MergeNode> Nodes;
+  llvm::StringMap<size_t> NodeIndex;
+  llvm::StringMap<unsigned int> FileIds;
+  std::vector<std::string> FileNames;
+  std::vector<std::string> FileHashes;
+  std::vector<std::string> Strings;
+
+  MergeNode const* Lookup(MergeInput& in, llvm::StringRef ref) {
+    llvm::StringMap<size_t>::const_iterator r = in.Ids.find(ref);
+    if(r == in.Ids.end()) {
+      return 0;
+    }
+    return &this->Nodes[this->NodeIndex[getIdentity(in, r->second)]];
+  }
+
+  std::string RemapIds(MergeInput& in, llvm::StringRef value) {
+    std::string out;
+    llvm::SmallVector<llvm::StringRef, 8> refs;
+    value.split(refs, " ", -1, false);
+    for(llvm::StringRef ref : refs) {
+      if(!out.empty()) {
+        out += " ";
+      }
+      std::pair<llvm::StringRef, llvm::StringRef> a = ref.rsplit(':');
+      if(!a.second.empty()) {
+        out += a.first.str() + ":";
+        ref = a.second;
+      }
+      MergeNode const* n = this->Lookup(in, ref);
+      out += n? n->Id : ref.str();
+    }
+    return out;
+  }
+
+  std::string RemapFile(MergeInput& in, llvm::StringRef value) {
+    std::pair<llvm::StringRef, llvm::StringRef> loc = value.split(':');
+    llvm::StringMap<std::string>::const_iterator f = in.Files.find(loc.first);
+    if(f == in.Files.end()) {
+      return value.str();
+    }
+    std::pair<llvm::StringMap<unsigned int>::iterator, bool> r =
+      this->FileIds.insert(std::make_pair(
+        f->second, static_cast<unsigned int>(this->FileNames.size() + 1)));
+    if(r.second) {
+      this->FileNames.push_back(f->second);
+      llvm::StringMap<std::string>::const_iterator h =
+        in.FileHashes.find(f->second);
+      this->FileHashes.push_back(
+        h != in.FileHashes.end()? h->second : std::string());
+    }
+    std::string out = "f" + std::to_string(r.first->getValue());
+    if(!loc.second.empty()) {
+      out += ":" + loc.second.str();
+    }
+    return out;
+  }
+
+  void Remap(MergeInput& in, OutputElement const& e, OutputElement& out,
+             MergeNode const* node) {
+    out.Tag = e.Tag;
+    for(OutputElement::Attribute const& a : e.Attributes) {
+      OutputElement::Attribute r;
+      r.Name = a.Name;
+      if(a.Name == "id" && node) {
+        r.Value = node->Id;
+      } else if(a.Name == "members" && node &&
+                (!isRecordTag(e.Tag) || in.Variants)) {
+        r.Value = this->UnionMembers(*node);
+      } else if(isIdAttribute(a.Name)) {
+        r.Value = this->RemapIds(in, a.Value);
+      } else if(a.Name == "location" || a.Name == "file") {
+        r.Value = this->RemapFile(in, a.Value);
+      } else {
+        r.Value = a.Value;
+      }
+      out.Attributes.push_back(r);
+    }
+    for(OutputElement const& c : e.Children) {
+      out.Children.push_back(OutputElement());
+      this->Remap(in, c, out.Children.back(), 0);
+    }
+  }
+
+  std::string UnionMembers(MergeNode const& node) {
+    // Namespaces hold different members in each input, as do records
+    // in each configuration.
+    std::string out;
+    llvm::StringMap<bool> seen;
+    for(std::pair<size_t, size_t> const& o : node.Occurrences) {
+      MergeInput& in = this->Inputs[o.first];
+      const char* members = findAttribute(in.Elements[o.second], "members");
+      if(!members) {
+        continue;
+      }
+      llvm::SmallVector<llvm::StringRef, 16> refs;
+      llvm::StringRef(members).split(refs, " ", -1, false);
+      for(llvm::StringRef ref : refs) {
+        MergeNode const* n = this->Lookup(in, ref);
+        std::string const id = n? n->Id : ref.str();
+        if(seen.insert(std::make_pair(id, true)).second) {
+          out += out.empty()? "" : " ";
+          out += id;
+        }
+      }
+    }
+    return out;
+  }
+
+  void AddVariants(MergeNode const& node, OutputElement& out) {
+    // Name the configurations holding the element unless it is in all.
+    std::vector<size_t> inputs;
+    for(std::pair<size_t, size_t> const& o : node.Occurrences) {
+      if(inputs.empty() || inputs.back() != o.first) {
+        inputs.push_back(o.first);
+      }
+    }
+    OutputElement::Attribute a;
+    if(inputs.size() < this->Inputs.size()) {
+      a.Name = "configurations";
+      for(size_t i : inputs) {
+        a.Value += a.Value.empty()? "" : " ";
+        a.Value += this->Inputs[i].Config;
+      }
+      out.Attributes.push_back(a);
+    }
+
+    // Give each target-dependent attribute of a configuration that
+    // differs from the written one as "<name>.<configuration>".
+    OutputElement const& e = this->Inputs[node.Input].Elements[node.Element];
+    static const char* const names[] = { "size", "align", "offset",
+                                         "mangled" };
+    for(const char* name : names) {
+      const char* value = findAttribute(e, name);
+      for(size_t i : inputs) {
+        if(i == node.Input) {
+          continue;
+        }
+        size_t element = 0;
+        for(std::pair<size_t, size_t> const& o : node.Occurrences) {
+          if(o.first == i) {
+            element = o.second;
+            break;
+          }
+        }
+        OutputElement const& oe = this->Inputs[i].Elements[element];
+        if(findAttribute(oe, "incomplete")) {
+          continue;
+        }
+        const char* other = findAttribute(oe, name);
+        if(llvm::StringRef(value? value : "") !=
+           llvm::StringRef(other? other : "")) {
+          a.Name = std::string(name) + "." + this->Inputs[i].Config;
+          a.Value = other? other : "";
+          out.Attributes.push_back(a);
+        }
+      }
+    }
+  }
+
+public:
+  Merger(std::vector<MergeInput>& inputs): Inputs(inputs) {}
+
+  void Collect() {
+    for(size_t ii = 0; ii < this->Inputs.size(); ++ii) {
+      MergeInput& in = this->Inputs[ii];
+      for(size_t ei = 0; ei < in.Elements.size(); ++ei) {
+        std::string const& identity = getIdentity(in, ei);
+        std::pair<llvm::StringMap<size_t>::iterator, bool> r =
+          this->NodeIndex.insert(std::make_pair(identity,
+                                                this->Nodes.size()));
+        if(r.second) {
+          this->Nodes.push_back(MergeNode());
+          this->Nodes.back().Input = ii;
+          this->Nodes.back().Element = ei;
+        }
+        MergeNode& n = this->Nodes[r.first->getValue()];
+        n.Occurrences.push_back(std::make_pair(ii, ei));
+
+        // Prefer a complete element over an incomplete one.
+        OutputElement const& cur = this->Inputs[n.Input].Elements[n.Element];
+        if(findAttribute(cur, "incomplete") &&
+           !findAttribute(in.Elements[ei], "incomplete")) {
+          n.Input = ii;
+          n.Element = ei;
+        }
+      }
+    }
+
+    // Number the elements in order of first appearance.  A cv-qualified
+    // type is named by the id of its unqualified type and qualifiers.
+    unsigned int next = 0;
+    for(MergeNode& n : this->Nodes) {
+      OutputElement const& e = this->Inputs[n.Input].Elements[n.Element];
+      if(e.Tag != "CvQualifiedType") {
+        n.Index = ++next;
+        n.Id = "_" + std::to_string(n.Index);
+      }
+    }
+    for(MergeNode& n : this->Nodes) {
+      MergeInput& in = this->Inputs[n.Input];
+      OutputElement const& e = in.Elements[n.Element];
+      if(e.Tag == "CvQualifiedType") {
+        llvm::StringRef id = findAttribute(e, "id");
+        const char* type = findAttribute(e, "type");
+        MergeNode const* base = type? this->Lookup(in, type) : 0;
+        n.Id = (base? base->Id : "_0") + id.substr(id.find_first_of("cvr"))
+          .str();
+        n.Index = base? base->Index : 0;
+      }
+    }
+  }
+
+  void Write(OutputTable& table) {
+    for(MergeNode const& n : this->Nodes) {
+      MergeInput& in = this->Inputs[n.Input];
+      OutputElement out;
+      this->Remap(in, in.Elements[n.Element], out, &n);
+      if(in.Variants) {
+        this->AddVariants(n, out);
+      }
+      table.Add(n.Index, 0, out);
+    }
+    for(size_t i = 0; i < this->FileNames.size(); ++i) {
+      std::string const id = "f" + std::to_string(i + 1);
+      OutputElement f;
+      f.Tag = "File";
+      OutputElement::Attribute a;
+      a.Name = "id";
+      a.Value = id;
+      f.Attributes.push_back(a);
+      a.Name = "name";
+      a.Value = this->FileNames[i];
+      f.Attributes.push_back(a);
+      if(!this->FileHashes[i].empty()) {
+        a.Name = "hash";
+        a.Value = this->FileHashes[i];
+        f.Attributes.push_back(a);
+      }
+      table.Add(0, static_cast<unsigned int>(i + 1), f);
+    }
+  }
+};
+
+//----------------------------------------------------------------------------
+int runMerge(const char* const* argBeg,
+             const char* const* argEnd,
+             Options const& opts)
+{
+  std::vector<MergeInput> inputs(argEnd - argBeg);
+  for(size_t i = 0; i < inputs.size(); ++i) {
+    inputs[i].Name = argBeg[i];
+    if(opts.MergeVariants) {
+      // Name each configuration by "<name>=" or by the file name.
+      std::pair<llvm::StringRef, llvm::StringRef> config =
+        llvm::StringRef(argBeg[i]).split('=');
+      if(!config.second.empty()) {
+        inputs[i].Config = config.first.str();
+        inputs[i].Name = config.second.str();
+      } else {
+        inputs[i].Config = llvm::sys::path::stem(argBeg[i]).str();
+      }
+      inputs[i].Variants = true;
+    }
+    if(!loadMergeInput(inputs[i])) {
+      return 1;
+    }
+  }
+
+  Merger merger(inputs);
+  merger.Collect();
+  OutputTable table;
+  merger.Write(table);
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(opts.OutputFile, ec, llvm::sys::fs::F_Text);
+  if(ec) {
+    std::cerr << "error: unable to write '" << opts.OutputFile << "': " <<
+      ec.message() << "\n";
+    return 1;
+  }
+  table.WriteXML(os);
+  return 0;
+}
@@ -0,0 +1,33 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_MERGE_H
+#define CASTXML_MERGE_H
+
+struct Options;
+
+/// runMerge - Merge the gccxml-format output files named by the given
+/// arguments into one document written to Options::OutputFile.
+/// Elements describing the same declaration or type in several inputs
+/// are written once, with ids renumbered across the merged document.
+/// With Options::MergeVariants each argument names the output of one
+/// configuration of the same sources, as "<config>=<file>" or by the
+/// file name alone, and attributes that depend on the target are noted
+/// where they differ instead of keeping the elements apart.
+int runMerge(const char* const* argBeg,
+             const char* const* argEnd,
+             Options const& opts);
+
+#endif // CASTXML_MERGE_H
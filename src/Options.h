@@ -17,16 +17,160 @@
 #define CASTXML_OPTIONS_H
 
 #include <cxsys/Configure.hxx>
+#include <map>
 #include <string>
 #include <vector>
 
+namespace llvm {
+  class raw_ostream;
+}
+namespace clang {
+  class Decl;
+  namespace vfs {
+    class FileSystem;
+  }
+}
+class HeaderCache;
+class OutputHandler;
+class JobLimits;
+class PipelineJob;
+class OutputTable;
+class StringPool;
+struct TemplateOutputCounts;
+
 struct Options
 {
-  Options(): PPOnly(false), GccXml(false), HaveCC(false), HaveTarget(false) {}
+  Options(): PPOnly(false), GccXml(false), HaveCC(false), HaveTarget(false),
+    HaveDepTarget(false),
+    Server(false), SkipFunctionBodies(false), LimitImplicitMembers(false),
+    StubSystemHeaders(false), InternStrings(false), MemReport(false),
+    Stats(false), DisableFree(false), AsyncOutput(false), Merge(false),
+    MergeVariants(false),
+    StableIds(false), DeclareImplicitMembers(false),
+    DeferInstantiations(false), WorkerProcesses(false),
+    ForkPrelude(false), ReferencedSpecializations(false), RetainAST(false),
+    Watch(false), Estimate(false), CanonicalTypes(false), Pipelined(false),
+    JobAffinity(false), FileHashes(false), TopologicalOrder(false),
+    PreprocessedSnapshot(false), Index(false), Layout(false),
+    Snippets(false), ScanDeps(false), TokenCache(false), Numa(false),
+    PrefetchIoUring(false), ReleaseParseState(false),
+    DropSourceBuffers(false), Progressive(false), PublicOnly(false),
+    SkipInternal(false),
+    Jobs(1), MangleThreads(1), MaxDepth(~0u), PartitionIndex(0),
+    PartitionCount(1), ImplicitMembersReport(0),
+    TemplateReport(0),
+    Timeout(0),
+    Attributes(AttributeAll),
+    OutputBufferSize(1 << 20), MemoryBudget(0), MemoryLimit(0),
+    RetainMemory(0),
+    OutputStream(nullptr), DiagnosticStream(nullptr), Table(nullptr),
+    Handler(nullptr), MemoryUsed(nullptr), TemplateOutput(nullptr),
+    Limits(nullptr), HeaderFragments(nullptr), Pipeline(nullptr),
+    SharedFiles(nullptr), Strings(nullptr), StartDecls(nullptr) {}
   bool PPOnly;
   bool GccXml;
   bool HaveCC;
   bool HaveTarget;
+  bool HaveDepTarget;
+  bool Server;
+  bool SkipFunctionBodies;
+  bool LimitImplicitMembers;
+  bool StubSystemHeaders;
+  bool InternStrings;
+  bool MemReport;
+  bool Stats;
+  bool DisableFree;
+  bool AsyncOutput;
+  bool Merge;
+  bool MergeVariants;
+  bool StableIds;
+  bool DeclareImplicitMembers;
+  bool DeferInstantiations;
+  bool WorkerProcesses;
+  bool ForkPrelude;
+  bool ReferencedSpecializations;
+  bool RetainAST;
+  bool Watch;
+  bool Estimate;
+  bool CanonicalTypes;
+  bool Pipelined;
+  bool JobAffinity;
+  bool FileHashes;
+  bool TopologicalOrder;
+  bool PreprocessedSnapshot;
+  bool Index;
+  bool Layout;
+  bool Snippets;
+  bool ScanDeps;
+  bool TokenCache;
+  bool Numa;
+  bool PrefetchIoUring;
+  bool ReleaseParseState;
+  bool DropSourceBuffers;
+  bool Progressive;
+  bool PublicOnly;
+  bool SkipInternal;
+  unsigned int Jobs;
+  unsigned int MangleThreads;
+  unsigned int MaxDepth;
+  unsigned int PartitionIndex;
+  unsigned int PartitionCount;
+  unsigned int ImplicitMembersReport;
+  unsigned int TemplateReport;
+  unsigned int Timeout;
+  enum Attribute {
+    AttributeMangled  = (1<<0),
+    AttributeLocation = (1<<1),
+    AttributeSize     = (1<<2),
+    AttributeOffset   = (1<<3),
+    AttributeInit     = (1<<4),
+    AttributeDefault  = (1<<5),
+    AttributeAll      = (1<<6) - 1
+  };
+  unsigned int Attributes;
+  size_t OutputBufferSize;
+  size_t MemoryBudget;
+  size_t MemoryLimit;
+  size_t RetainMemory;
+  llvm::raw_ostream* OutputStream;
+  llvm::raw_ostream* DiagnosticStream;
+  OutputTable* Table;
+  OutputHandler* Handler;
+  size_t* MemoryUsed;
+  TemplateOutputCounts* TemplateOutput;
+  JobLimits* Limits;
+  HeaderCache* HeaderFragments;
+  PipelineJob* Pipeline;
+  clang::vfs::FileSystem* SharedFiles;
+  // The strings interned by the parallel jobs of a run, if shared.
+  StringPool* Strings;
+  // The declarations to start from in place of StartNames, if any.
+  std::vector<clang::Decl const*> const* StartDecls;
+  struct Output {
+    Output(std::string const& format, std::string const& file):
+      Format(format), File(file) {}
+    std::string Format;
+    std::string File;
+  };
+  std::vector<Output> ExtraOutputs;
+  struct StartGroup {
+    std::vector<std::string> Names;
+    std::string File;
+  };
+  std::vector<StartGroup> StartGroups;
+  struct Target {
+    Target(std::string const& name): Name(name) {}
+    std::string Name;
+    std::vector<std::string> Arguments;
+  };
+  std::vector<Target> Targets;
+  struct PathPrefix {
+    PathPrefix(std::string const& from, std::string const& to):
+      From(from), To(to) {}
+    std::string From;
+    std::string To;
+  };
+  std::vector<PathPrefix> PathPrefixMaps;
   struct Include {
     Include(std::string const& d, bool f = false):
       Directory(d), Framework(f) {}
@@ -34,8 +178,38 @@ struct Options
     bool Framework;
   };
   std::string OutputFile;
+  std::string OutputCompression;
+  std::string OutputDir;
+  std::string OutputFormat;
+  std::string OutputIndexFile;
+  std::string OutputShardDir;
+  std::string BatchFile;
+  std::string DetectCacheDir;
+  std::string DiffAgainstFile;
+  std::string DriverCacheDir;
+  std::string EmitASTFile;
+  std::string EmitConfigFile;
+  std::string EmitProfileFile;
+  std::string HeaderCacheDir;
+  std::string JobCostsFile;
+  std::string LoadASTFile;
+  std::string PreludePCHDir;
+  std::string PrefetchFile;
+  std::string PrefixHeader;
+  std::string PreprocessedCacheDir;
+  std::string ResultCacheDir;
+  std::string ResultCacheRemote;
+  std::string SourceBufferName;
+  std::string SourceBuffer;
   std::vector<Include> Includes;
+  std::vector<std::string> FileFilters;
+  std::vector<std::string> SkipNamespaces;
+  std::vector<std::string> UnityHeaders;
   std::string Predefines;
+  // The macros in Predefines, by name, each mapped to the text after
+  // the name: the value of an object-like macro, or the parameters and
+  // value of a function-like one.
+  std::map<std::string, std::string> PredefinedMacros;
   std::string Triple;
   std::vector<std::string> StartNames;
 };
@@ -15,10 +15,25 @@
 */
 
 #include "Output.h"
+#include "HeaderCache.h"
 #include "Options.h"
+#include "OutputBinary.h"
+#include "OutputFingerprint.h"
+#include "OutputHandler.h"
+#include "OutputJSON.h"
+#include "OutputSQL.h"
+#include "OutputSink.h"
+#include "OutputTable.h"
+#include "OutputXML.h"
+#include "Schedule.h"
+#include "StringPool.h"
+#include "TimeReport.h"
 #include "Utils.h"
 
+#include <cxsys/RegularExpression.hxx>
+
 #include "clang/AST/ASTContext.h"
+#include "clang/AST/Attr.h"
 #include "clang/AST/Decl.h"
 #include "clang/AST/DeclCXX.h"
 #include "clang/AST/DeclFriend.h"
@@ -27,16 +42,105 @@
 #include "clang/AST/DeclTemplate.h"
 #include "clang/AST/Mangle.h"
 #include "clang/Basic/Specifiers.h"
+#include "clang/Basic/TargetInfo.h"
 #include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendDiagnostic.h"
+#include "clang/Frontend/Utils.h"
 #include "clang/Lex/Preprocessor.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/PointerIntPair.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
-#include <queue>
-#include <set>
+#include <map>
 #include <string>
+#include <thread>
 #include <vector>
+#include <ctype.h>
+
+//----------------------------------------------------------------------------
+/// Pass output events through to another handler while counting the
+/// elements started and the attribute values that need XML escapes.
+class OutputStatsHandler: public OutputHandler
+{
+  OutputHandler& Handler;
+public:
+  OutputStatsHandler(OutputHandler& handler):
+    Handler(handler), EscapedValues(0) {}
+
+  void StartDocument() override {
+    this->Handler.StartDocument();
+  }
+  void StartElement(llvm::StringRef tag) override {
+    ++this->Elements[tag];
+    this->Handler.StartElement(tag);
+  }
+  void StringAttribute(llvm::StringRef name,
+                       llvm::StringRef value) override {
+    // Only string values may hold characters needing escapes.
+    if(value.find_first_of("&<>'\"") != llvm::StringRef::npos) {
+      ++this->EscapedValues;
+    }
+    this->Handler.StringAttribute(name, value);
+  }
+  void IntAttribute(llvm::StringRef name, int64_t value) override {
+    this->Handler.IntAttribute(name, value);
+  }
+  void UIntAttribute(llvm::StringRef name, uint64_t value) override {
+    this->Handler.UIntAttribute(name, value);
+  }
+  void RefAttribute(llvm::StringRef name, llvm::ArrayRef<Ref> refs) override {
+    this->Handler.RefAttribute(name, refs);
+  }
+  void LocationAttribute(llvm::StringRef name, unsigned int file,
+                         unsigned int line) override {
+    this->Handler.LocationAttribute(name, file, line);
+  }
+  void EndElement() override {
+    this->Handler.EndElement();
+  }
+  void ElementText(llvm::StringRef xml) override {
+    this->Handler.ElementText(xml);
+  }
+  void EndNode(uint64_t id, unsigned int file) override {
+    this->Handler.EndNode(id, file);
+  }
+  void EndDocument() override {
+    this->Handler.EndDocument();
+  }
+
+  // Number of elements started with each tag.
+  llvm::StringMap<unsigned int> Elements;
+
+  // Number of attribute values containing an XML escape.
+  unsigned int EscapedValues;
+};
+
+//----------------------------------------------------------------------------
+/// Ignore output events, for traversals writing their own output.
+class NullOutputHandler: public OutputHandler
+{
+public:
+  void StartElement(llvm::StringRef) override {}
+  void StringAttribute(llvm::StringRef, llvm::StringRef) override {}
+  void IntAttribute(llvm::StringRef, int64_t) override {}
+  void UIntAttribute(llvm::StringRef, uint64_t) override {}
+  void RefAttribute(llvm::StringRef, llvm::ArrayRef<Ref>) override {}
+  void LocationAttribute(llvm::StringRef, unsigned int,
+                         unsigned int) override {}
+  void EndElement() override {}
+};
+
+static bool matchStartPattern(llvm::StringRef pattern, llvm::StringRef name);
 
 //----------------------------------------------------------------------------
 class ASTVisitorBase
@@ -44,121 +148,116 @@ class ASTVisitorBase
 protected:
   clang::CompilerInstance& CI;
   clang::ASTContext const& CTX;
-  llvm::raw_ostream& OS;
+  OutputHandler& OH;
 
   ASTVisitorBase(clang::CompilerInstance& ci,
                  clang::ASTContext const& ctx,
-                 llvm::raw_ostream& os): CI(ci), CTX(ctx), OS(os) {}
+                 OutputHandler& oh): CI(ci), CTX(ctx), OH(oh) {}
 
   // Represent cv qualifier state of one dump node.
   struct DumpQual {
   private:
     typedef void (DumpQual::*bool_type)() const;
     void bool_true() const {}
+    // Encode qualifiers as bits that sort in the order of the id
+    // suffixes: const, then volatile, then restrict.
+    enum { ConstBit = 4, VolatileBit = 2, RestrictBit = 1 };
+    unsigned char QualBits;
   public:
-    bool IsConst;
-    bool IsVolatile;
-    bool IsRestrict;
-    DumpQual(): IsConst(false), IsVolatile(false), IsRestrict(false) {}
+    DumpQual(): QualBits(0) {}
+    bool IsConst() const { return (this->QualBits & ConstBit) != 0; }
+    bool IsVolatile() const { return (this->QualBits & VolatileBit) != 0; }
+    bool IsRestrict() const { return (this->QualBits & RestrictBit) != 0; }
+    unsigned int Bits() const { return this->QualBits; }
+    static DumpQual FromBits(unsigned int bits) {
+      DumpQual dq;
+      dq.QualBits = static_cast<unsigned char>(bits & 7);
+      return dq;
+    }
+    // Add the qualifiers local to a type.
+    void AddLocal(clang::QualType t) {
+      this->QualBits |= static_cast<unsigned char>(
+        (t.isLocalConstQualified()? ConstBit : 0) |
+        (t.isLocalVolatileQualified()? VolatileBit : 0) |
+        (t.isLocalRestrictQualified()? RestrictBit : 0));
+    }
+    DumpQual& operator |= (DumpQual const& r) {
+      this->QualBits |= r.QualBits;
+      return *this;
+    }
     operator bool_type() const {
-      return (this->IsConst || this->IsVolatile || this->IsRestrict)?
-        &DumpQual::bool_true : nullptr;
+      return this->QualBits? &DumpQual::bool_true : nullptr;
     }
     friend bool operator < (DumpQual const& l, DumpQual const& r) {
-      if (!l.IsConst && r.IsConst) {
-        return true;
-      } else if (l.IsConst && !r.IsConst) {
-        return false;
-      } else if (!l.IsVolatile && r.IsVolatile) {
-        return true;
-      } else if (l.IsVolatile && !r.IsVolatile) {
-        return false;
-      } else if (!l.IsRestrict && r.IsRestrict) {
-        return true;
-      } else if (l.IsRestrict && !r.IsRestrict) {
-        return false;
-      } else {
-        return false;
-      }
+      return l.QualBits < r.QualBits;
     }
-    friend llvm::raw_ostream& operator << (llvm::raw_ostream& os,
-                                           DumpQual const& dq) {
-      return os << (dq.IsConst? "c":"")
-                << (dq.IsVolatile? "v":"")
-                << (dq.IsRestrict? "r":"");
+    // Get the id suffix naming the qualifiers.
+    llvm::StringRef Suffix() const {
+      static const char* const suffixes[] = {
+        "", "r", "v", "vr", "c", "cr", "cv", "cvr"
+      };
+      return suffixes[this->QualBits];
     }
   };
 
-  // Represent id of one dump node.
+  // Represent id of one dump node.  The node number and qualifier
+  // bits are packed in one integer so that ids order and compare as
+  // integers, leaving room for 2^61 nodes.
   struct DumpId {
   private:
     typedef void (DumpId::*bool_type)() const;
     void bool_true() const {}
+    uint64_t Packed;
   public:
-    unsigned int Id;
-    DumpQual Qual;
-    DumpId(): Id(0), Qual() {}
-    DumpId(unsigned int id, DumpQual dq): Id(id), Qual(dq) {}
+    DumpId(): Packed(0) {}
+    DumpId(uint64_t id, DumpQual dq): Packed(id << 3 | dq.Bits()) {}
+    uint64_t Id() const { return this->Packed >> 3; }
+    DumpQual Qual() const {
+      return DumpQual::FromBits(static_cast<unsigned int>(this->Packed & 7));
+    }
     operator bool_type() const {
-      return this->Id != 0? &DumpId::bool_true : nullptr;
+      return this->Id() != 0? &DumpId::bool_true : nullptr;
     }
     friend bool operator < (DumpId const& l, DumpId const& r) {
-      if (l.Id < r.Id) {
-        return true;
-      } else if (l.Id > r.Id) {
-        return false;
-      } else {
-        return l.Qual < r.Qual;
-      }
+      return l.Packed < r.Packed;
     }
-    friend llvm::raw_ostream& operator << (llvm::raw_ostream& os,
-                                           DumpId const& id) {
-      return os << id.Id << id.Qual;
+    friend bool operator == (DumpId const& l, DumpId const& r) {
+      return l.Packed == r.Packed;
     }
   };
 
+  // Stable id of each node indexed by its id, if requested.
+  std::vector<std::string> StableIds;
+
+  /** Get a reference to the given node id with its "_" prefix.  */
+  OutputHandler::Ref GetRef(DumpId id) const {
+    OutputHandler::Ref r('_', id.Id());
+    if(id.Id() < this->StableIds.size()) {
+      r.Stable = this->StableIds[id.Id()];
+    }
+    r.Qual = id.Qual().Suffix();
+    return r;
+  }
+
+  /** Print an attribute referencing the given node id.  */
+  void PrintIdRefAttribute(llvm::StringRef name, DumpId id) {
+    this->OH.RefAttribute(name, this->GetRef(id));
+  }
+
   // Record status of one AST node to be dumped.
   struct DumpNode {
-    DumpNode(): Index(), Complete(false) {}
+    DumpNode(): Index(), Complete(false), Depth(0) {}
 
     // Index in nodes ordered by first encounter.
     DumpId Index;
 
     // Whether the node is to be traversed completely.
-    bool Complete;
-  };
+    unsigned int Complete : 1;
 
-  // Report all decl nodes as unimplemented until overridden.
-#define ABSTRACT_DECL(DECL)
-#define DECL(CLASS, BASE) \
-  void Output##CLASS##Decl(clang::CLASS##Decl const* d, DumpNode const* dn) { \
-    this->OutputUnimplementedDecl(d, dn); \
-  }
-#include "clang/AST/DeclNodes.inc"
-
-  void OutputUnimplementedDecl(clang::Decl const* d, DumpNode const* dn) {
-    this->OS << "  <Unimplemented id=\"_" << dn->Index
-             << "\" kind=\"" << encodeXML(d->getDeclKindName()) << "\"/>\n";
-  }
-
-  // Report all type nodes as unimplemented until overridden.
-#define ABSTRACT_TYPE(CLASS, BASE)
-#define TYPE(CLASS, BASE) \
-  void Output##CLASS##Type(clang::CLASS##Type const* t, DumpNode const* dn) { \
-    this->OutputUnimplementedType(t, dn); \
-    }
-#include "clang/AST/TypeNodes.def"
-
-  void OutputUnimplementedType(clang::Type const* t, DumpNode const* dn) {
-    this->OS << "  <Unimplemented id=\"_" << dn->Index
-             << "\" type_class=\"" << encodeXML(t->getTypeClassName())
-             << "\"/>\n";
-  }
-};
+    // Fewest reference hops from a starting declaration.
+    unsigned int Depth : 31;
+  };
 
-//----------------------------------------------------------------------------
-class ASTVisitor: public ASTVisitorBase
-{
   // Store a type to be visited, possibly as a record member.
   struct DumpType {
     DumpType(): Type(), Class(0) {}
@@ -183,7 +282,54 @@ class ASTVisitor: public ASTVisitorBase
     clang::Type const* Class;
   };
 
-  // Store an entry in the node traversal queue.
+  // Hash DumpType keys by pointer value, including qualifier bits.
+  struct DumpTypeMapInfo {
+    static DumpType getEmptyKey() {
+      return DumpType(llvm::DenseMapInfo<clang::QualType>::getEmptyKey());
+    }
+    static DumpType getTombstoneKey() {
+      return DumpType(
+        llvm::DenseMapInfo<clang::QualType>::getTombstoneKey());
+    }
+    static unsigned getHashValue(DumpType const& dt) {
+      return llvm::DenseMapInfo<
+        std::pair<void const*, clang::Type const*> >::getHashValue(
+          std::make_pair(dt.Type.getAsOpaquePtr(), dt.Class));
+    }
+    static bool isEqual(DumpType const& l, DumpType const& r) {
+      return (l.Type.getAsOpaquePtr() == r.Type.getAsOpaquePtr() &&
+              l.Class == r.Class);
+    }
+  };
+
+  // What a type referenced by the output resolves to after removing
+  // its sugar: a declaration or a desugared unqualified type, and the
+  // qualifiers collected on the way.
+  struct DumpTarget {
+    DumpTarget(): Decl(nullptr), Type(), Qual() {}
+    clang::Decl const* Decl;
+    DumpType Type;
+    DumpQual Qual;
+  };
+
+  // List of member ids collected for a members attribute.
+  typedef llvm::SmallVector<DumpId, 64> DumpIdList;
+
+  // Dump status of a node for a Clang declaration.
+  struct DeclDumpNode: public DumpNode {
+    DeclDumpNode(clang::Decl const* d): Decl(d) {}
+    clang::Decl const* Decl;
+  };
+
+  // Dump status of a node for a Clang type.
+  struct TypeDumpNode: public DumpNode {
+    TypeDumpNode(DumpType t): Type(t) {}
+    DumpType Type;
+  };
+
+  // Store an entry in the node traversal queue.  It is only a pointer
+  // to the dump status node tagged with the kind of node, from which
+  // the declaration or type is found.
   struct QueueEntry {
     // Available node kinds.
     enum Kinds {
@@ -192,46 +338,159 @@ class ASTVisitor: public ASTVisitorBase
       KindType
     };
 
-    QueueEntry(DumpNode const* dn):
-      Kind(KindQual), Decl(nullptr), Type(), DN(dn) {}
-    QueueEntry(clang::Decl const* d, DumpNode const* dn):
-      Kind(KindDecl), Decl(d), Type(), DN(dn) {}
-    QueueEntry(DumpType t, DumpNode const* dn):
-      Kind(KindType), Decl(nullptr), Type(t), DN(dn) {}
+    QueueEntry(): Node(nullptr, KindQual) {}
+    QueueEntry(DumpNode const* dn): Node(dn, KindQual) {}
+    QueueEntry(DeclDumpNode const* dn): Node(dn, KindDecl) {}
+    QueueEntry(TypeDumpNode const* dn): Node(dn, KindType) {}
 
     // Kind of node at this entry.
-    Kinds Kind;
+    Kinds Kind() const { return this->Node.getInt(); }
 
-    // The declaration when Kind == KindDecl.
-    clang::Decl const* Decl;
+    // The dump status for this node.
+    DumpNode const* DN() const { return this->Node.getPointer(); }
 
-    // The type when Kind == KindType.
-    DumpType Type;
+    // The declaration when Kind() == KindDecl.
+    clang::Decl const* Decl() const {
+      return static_cast<DeclDumpNode const*>(this->DN())->Decl;
+    }
 
-    // The dump status for this node.
-    DumpNode const* DN;
+    // The type when Kind() == KindType.
+    DumpType const& Type() const {
+      return static_cast<TypeDumpNode const*>(this->DN())->Type;
+    }
 
     friend bool operator < (QueueEntry const& l, QueueEntry const& r) {
-      return l.DN->Index < r.DN->Index;
+      return l.DN()->Index < r.DN()->Index;
     }
+
+  private:
+    llvm::PointerIntPair<DumpNode const*, 2, Kinds> Node;
+  };
+
+  // Store the queued entries sharing one node id.
+  struct QueueSlot {
+    QueueSlot(): Entry(), Pending(0) {}
+
+    // The entry for the unqualified node, if queued.
+    QueueEntry Entry;
+
+    // Bit mask of queued entries indexed by DumpQual::Bits().  Bit 0
+    // is the unqualified node in Entry.  Others are CvQualified nodes.
+    unsigned char Pending;
   };
 
+  // Location of one element in the output document.
+  struct OffsetIndexEntry {
+    OffsetIndexEntry(DumpId id, uint64_t offset, uint64_t size):
+      Id(id), Offset(offset), Size(size) {}
+    DumpId Id;
+    uint64_t Offset;
+    uint64_t Size;
+    bool operator<(OffsetIndexEntry const& r) const {
+      return this->Id < r.Id;
+    }
+  };
+
+  // Report all decl nodes as unimplemented until overridden.
+#define ABSTRACT_DECL(DECL)
+#define DECL(CLASS, BASE) \
+  void Output##CLASS##Decl(clang::CLASS##Decl const* d, DumpNode const* dn) { \
+    this->OutputUnimplementedDecl(d, dn); \
+  }
+#include "clang/AST/DeclNodes.inc"
+
+  void OutputUnimplementedDecl(clang::Decl const* d, DumpNode const* dn) {
+    this->OH.StartElement("Unimplemented");
+    this->PrintIdRefAttribute("id", dn->Index);
+    this->OH.StringAttribute("kind", d->getDeclKindName());
+    this->OH.EndElement();
+  }
+
+  // Report all type nodes as unimplemented until overridden.
+#define ABSTRACT_TYPE(CLASS, BASE)
+#define TYPE(CLASS, BASE) \
+  void Output##CLASS##Type(clang::CLASS##Type const* t, DumpNode const* dn) { \
+    this->OutputUnimplementedType(t, dn); \
+    }
+#include "clang/AST/TypeNodes.def"
+
+  void OutputUnimplementedType(clang::Type const* t, DumpNode const* dn) {
+    this->OH.StartElement("Unimplemented");
+    this->PrintIdRefAttribute("id", dn->Index);
+    this->OH.StringAttribute("type_class", t->getTypeClassName());
+    this->OH.EndElement();
+  }
+};
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+class ASTVisitor: public ASTVisitorBase
+{
+  // The handler receiving the output events.  This hides the
+  // OutputHandler of the base so that the traversal calls the
+  // methods of a final handler type directly.
+  Handler& OH;
+
+  /** Print an attribute referencing the given node id.  */
+  void PrintIdRefAttribute(llvm::StringRef name, DumpId id) {
+    this->OH.RefAttribute(name, this->GetRef(id));
+  }
+
+  /** Add an entry to the traversal queue unless already queued.  */
+  void QueuePush(QueueEntry const& qe);
+
+  /** Allocate a dump status node in the node arena.  */
+  DumpNode* NewDumpNode() {
+    ++this->NodeArenaCounts.Qual;
+    return new (this->NodeArena) DumpNode();
+  }
+
   /** Get the dump status node for a Clang declaration.  */
-  DumpNode* GetDumpNode(clang::Decl const* d) {
-    return &this->DeclNodes[d];
+  DeclDumpNode* GetDumpNode(clang::Decl const* d) {
+    DeclDumpNode*& dn = this->DeclNodes[d];
+    if(!dn) {
+      ++this->NodeArenaCounts.Decl;
+      dn = new (this->NodeArena) DeclDumpNode(d);
+    }
+    return dn;
   }
 
   /** Get the dump status node for a Clang type.  */
-  DumpNode* GetDumpNode(DumpType t) {
-    return &this->TypeNodes[t];
+  TypeDumpNode* GetDumpNode(DumpType t) {
+    TypeDumpNode*& dn = this->TypeNodes[t];
+    if(!dn) {
+      ++this->NodeArenaCounts.Type;
+      dn = new (this->NodeArena) TypeDumpNode(t);
+    }
+    return dn;
   }
 
   /** Get the dump status node for a qualified DumpId.  */
   DumpNode* GetDumpNode(DumpId id) {
-    assert(id.Qual);
-    return &this->QualNodes[id];
+    assert(id.Qual());
+    if(id.Id() >= this->QualSlotIndex.size()) {
+      this->QualSlotIndex.resize(
+        std::max<size_t>(id.Id() + 1, this->QualSlotIndex.size() * 2), 0);
+    }
+    size_t& slots = this->QualSlotIndex[id.Id()];
+    if(!slots) {
+      this->QualSlots.push_back(QualNodeSlots());
+      slots = this->QualSlots.size();
+    }
+    DumpNode*& dn = this->QualSlots[slots - 1].Nodes[id.Qual().Bits() - 1];
+    if(!dn) {
+      dn = this->NewDumpNode();
+    }
+    return dn;
   }
 
+  /** Get the declaration whose node represents the given one, or
+      nullptr if it is not dumped, computing it on first use.  */
+  clang::Decl const* GetDumpDecl(clang::Decl const* d);
+
+  /** Canonicalize a declaration and apply the filters that skip it.  */
+  clang::Decl const* ResolveDumpDecl(clang::Decl const* d);
+
   /** Allocate a dump node for a Clang declaration.  */
   DumpId AddDeclDumpNode(clang::Decl const* d, bool complete);
   DumpId AddDeclDumpNode(clang::Decl const* d, bool complete, DumpQual dq);
@@ -242,27 +501,69 @@ class ASTVisitor: public ASTVisitorBase
   /** Allocate a dump node for a qualified DumpId.  */
   DumpId AddQualDumpNode(DumpId id);
 
+  /** Get what a type resolves to, computing it on first use.  */
+  DumpTarget GetDumpTarget(DumpType dt);
+
+  /** Strip the sugar from a type to find what it resolves to.  */
+  DumpTarget ResolveDumpTarget(DumpType dt);
+
   /** Helper common to AddDeclDumpNode and AddTypeDumpNode.  */
   template <typename K> DumpId AddDumpNodeImpl(K k, bool complete);
 
+  /** Get the identity of a node from which its stable id is hashed.  */
+  std::string GetStableKey(clang::Decl const* d);
+  std::string GetStableKey(DumpType dt);
+
+  /** Assign the stable id of a new node from its identity.  */
+  void AddStableId(uint64_t id, std::string const& key);
+
   /** Allocate a dump node for a source file entry.  */
   unsigned int AddDumpFile(clang::FileEntry const* f);
 
+  /** Get the index of the source file with the given id, or 0 if it
+      is not a file.  */
+  unsigned int GetLocationFile(clang::FileID fid);
+
   /** Add class template specializations and instantiations for output.  */
   void AddClassTemplateDecl(clang::ClassTemplateDecl const* d,
-                            std::set<DumpId>* emitted = 0);
+                            DumpIdList* emitted = 0);
 
   /** Add function template specializations and instantiations for output.  */
   void AddFunctionTemplateDecl(clang::FunctionTemplateDecl const* d,
-                               std::set<DumpId>* emitted = 0);
+                               DumpIdList* emitted = 0);
 
   /** Add declaration context members for output.  */
   void AddDeclContextMembers(clang::DeclContext const* dc,
-                             std::set<DumpId>& emitted);
+                             DumpIdList& emitted);
 
   /** Add a starting declaration for output.  */
   void AddStartDecl(clang::Decl const* d);
 
+  /** Return whether a member of a context is in the
+      '--castxml-partition' part of the output.  Without start names the
+      members of the translation unit are dealt to the parts, so each
+      part writes the global namespace listing only its own.  */
+  bool IsInPartition(clang::Decl const* d);
+
+  /** Return whether the declaration is in a file matched by the
+      file filters, if any, and so may be output completely.  */
+  bool FileFilterMatches(clang::Decl const* d);
+
+  /** Return whether the declaration is left out of the traversal by
+      '--castxml-skip-internal' or '--castxml-skip-namespace'.  */
+  bool IsSkippedDecl(clang::Decl const* d);
+
+  /** Return whether the declaration is in a system header under
+      Options::Includes and so gets only a minimal element.  */
+  bool IsSystemStubDecl(clang::Decl const* d);
+
+  /** Get the file containing the expansion location of a declaration.  */
+  clang::FileEntry const* GetDeclFile(clang::Decl const* d);
+
+  /** Get the original file named by the line markers of a preprocessed
+      snapshot at a presumed location, or null if it is not a file.  */
+  clang::FileEntry const* GetPresumedFile(clang::PresumedLoc const& pl);
+
   /** Queue leftover nodes that do not need complete output.  */
   void QueueIncompleteDumpNodes();
 
@@ -270,9 +571,34 @@ class ASTVisitor: public ASTVisitorBase
   void ProcessQueue();
   void ProcessFileQueue();
 
+  /** Output the table of interned strings.  */
+  void ProcessStringTable();
+
+  /** Output the complete nodes queued from the start declarations
+      added so far, then the incomplete nodes they reference, then the
+      File and String elements not yet written.  */
+  void ProcessStart();
+
+  /** Write the offset index of the elements output by ProcessQueue.  */
+  void WriteOffsetIndex();
+
+  /** Print the memory used by the AST and our own tables to stderr.  */
+  void WriteMemoryReport();
+
+  /** Print counts of the output written and work done to stderr.  */
+  void WriteStatsReport();
+
   /** Dispatch output of a declaration.  */
   void OutputDecl(clang::Decl const* d, DumpNode const* dn);
 
+  /** Output a declaration with the text cached for it by
+      '--castxml-header-cache' if any, or else add its text.  */
+  void OutputDeclCached(clang::Decl const* d, DumpNode const* dn);
+
+  /** Write the '--castxml-index' line of a declaration and queue the
+      members of the namespace or class it defines.  */
+  void OutputIndexEntry(clang::Decl const* d, DumpNode const* dn);
+
   /** Dispatch output of a qualified or unqualified type.  */
   void OutputType(DumpType dt, DumpNode const* dn);
 
@@ -285,25 +611,49 @@ class ASTVisitor: public ASTVisitorBase
 
   /** Return the unqualified name of the declaration context
       (class, struct, union) of the given method.  */
-  std::string GetContextName(clang::CXXMethodDecl const* d);
+  llvm::StringRef GetContextName(clang::CXXMethodDecl const* d);
 
-  /** Print the XML IDREF value referencing the given type.
-      If the type has top-level cv-qualifiers, they are
+  /** Print an attribute with the XML IDREF value referencing the
+      given type.  If the type has top-level cv-qualifiers, they are
       appended to the numeric id as single characters (c=const,
       v=volatile, r=restrict) to reference the XML ID of
       a CvQualifiedType element describing the qualifiers
       and referencing the unqualified type.  */
-  void PrintTypeIdRef(clang::QualType t, bool complete);
+  void PrintTypeIdRefAttribute(llvm::StringRef name, clang::QualType t,
+                               bool complete);
 
   /** Print an id="_<n>" XML unique ID attribute.  */
   void PrintIdAttribute(DumpNode const* dn);
 
+  /** Return whether the given optional attribute is to be printed.  */
+  bool WantAttribute(unsigned int a) const {
+    return !this->Splicing && (this->Opts.Attributes & a) != 0;
+  }
+
+  /** Print an attribute holding the given string, or referencing the
+      id="s<n>" of its String element when interning strings.  */
+  void PrintStringAttribute(llvm::StringRef name, llvm::StringRef s);
+
+  /** Print a hash="..." attribute with the digest of a file's content.  */
+  void PrintFileHashAttribute(clang::FileEntry const* f);
+
   /** Print a name="..." attribute.  */
-  void PrintNameAttribute(std::string const& name);
+  void PrintNameAttribute(llvm::StringRef name);
 
   /** Print a mangled="..." attribute.  */
   void PrintMangledAttribute(clang::NamedDecl const* d);
 
+  /** Get the mangled name of a declaration, valid until the next.  */
+  llvm::StringRef GetMangledName(clang::NamedDecl const* d);
+
+  /** Whether a declaration gets a mangled="..." attribute whose value
+      does not depend on the names mangled before it.  */
+  bool CanMangleAhead(clang::Decl const* d);
+
+  /** Compute on worker threads the mangled names of the given
+      declaration and those queued for output after it.  */
+  void MangleAhead(clang::NamedDecl const* d);
+
   /** Print an offset="..." attribute. */
   void PrintOffsetAttribute(unsigned int const& offset);
 
@@ -333,7 +683,10 @@ class ASTVisitor: public ASTVisitorBase
       members of the given declaration context.  Also queues the
       context members for later output.  */
   void PrintMembersAttribute(clang::DeclContext const* dc);
-  void PrintMembersAttribute(std::set<DumpId> const& emitted);
+  void PrintMembersAttribute(DumpIdList& emitted);
+
+  /** Print an attribute listing the XML IDREFs for the given nodes.  */
+  void PrintIdListAttribute(llvm::StringRef name, DumpIdList const& ids);
 
   /** Print a bases="..." attribute listing the XML IDREFs for
       bases of the given class type.  Also queues the base classes
@@ -371,7 +724,7 @@ class ASTVisitor: public ASTVisitorBase
       the caller.  This encompasses functionality common to all the
       function declaration output methods.  */
   void OutputFunctionHelper(clang::FunctionDecl const* d, DumpNode const* dn,
-                            const char* tag, std::string const& name,
+                            const char* tag, llvm::StringRef name,
                             unsigned int flags);
 
   /** Output a function type element using the tag given by the caller.
@@ -381,6 +734,10 @@ class ASTVisitor: public ASTVisitorBase
                                 DumpNode const* dn, const char* tag,
                                 clang::Type const* c);
 
+  /** Print an attribute holding the value of an integer.  */
+  void PrintIntAttribute(llvm::StringRef name, llvm::APInt const& v,
+                         bool isSigned);
+
   /** Output an <Argument/> element inside a function element.  */
   void OutputFunctionArgument(clang::ParmVarDecl const* a, bool complete,
                               clang::Expr const* def);
@@ -435,65 +792,239 @@ class ASTVisitor: public ASTVisitorBase
   void OutputPointerType(clang::PointerType const* t, DumpNode const* dn);
 
   /** Queue declarations matching given qualified name in given context.  */
-  void LookupStart(clang::DeclContext const* dc, std::string const& name);
+  void LookupStart(clang::DeclContext const* dc,
+                   std::vector<std::string> const& names);
 
 private:
   // List of starting declaration names.
   Options const& Opts;
 
   // Total number of nodes to be dumped.
-  unsigned int NodeCount;
-
-  // Total number of source files to be referenced.
-  unsigned int FileCount;
+  uint64_t NodeCount;
 
-  // Whether we need a File element for compiler builtins.
+  // Whether we need a File element for compiler builtins, and whether
+  // it has been written.
   bool FileBuiltin;
+  bool FileBuiltinWritten;
 
   // Whether we are in the complete or incomplete output step.
   bool RequireComplete;
 
-  // Mangling context for target ABI.
-  std::unique_ptr<clang::MangleContext> MangleContext;
+  // Whether the declaration being output only queues the nodes it
+  // references because its cached text is written in its place.
+  bool Splicing;
+
+  // Depth given to nodes referenced by the node being output.
+  unsigned int NodeDepth;
+
+  // Mangling context for target ABI, owned unless given by the caller.
+  // An owned context is created when the first name is mangled.
+  std::unique_ptr<clang::MangleContext> OwnedMangleContext;
+  clang::MangleContext* MangleContext;
+
+  // Whether the mangled name of a C declaration not renamed by an
+  // attribute is its identifier, as on targets other than Windows,
+  // whose calling conventions (e.g. __vectorcall) decorate C names.
+  bool PlainCNames;
+
+  // Number of nodes given each stable id hash, to number repeats.
+  llvm::StringMap<unsigned int, llvm::BumpPtrAllocator> StableIdCounts;
+
+  // Buffer reused for each mangled name.
+  llvm::SmallString<256> MangledName;
+
+  // Buffer reused for each name or expression printed by clang.
+  llvm::SmallString<256> PrintScratch;
+
+  // Printed text of each default argument expression.  Instantiated
+  // methods share the uninstantiated expression of their pattern, so
+  // the same defaults recur across many nodes.
+  llvm::DenseMap<clang::Expr const*, std::string> DefaultArgTexts;
+
+  // Mangled names computed by MangleAhead and not yet printed, the
+  // queue size at which it may run again, and a mangling context for
+  // each of its worker threads.
+  llvm::DenseMap<clang::NamedDecl const*, std::string> MangledAhead;
+  size_t MangleAheadMark;
+  std::vector<std::unique_ptr<clang::MangleContext> > WorkerMangleContexts;
 
   // Control declaration and type printing.
   clang::PrintingPolicy PrintingPolicy;
 
+  // Arena holding the dump status nodes of qualified ids,
+  // declarations, and types at stable addresses.  The nodes are
+  // trivially destructible, so the arena frees them all at once with
+  // the visitor.
+  llvm::BumpPtrAllocator NodeArena;
+  struct NodeCounts {
+    NodeCounts(): Qual(0), Decl(0), Type(0) {}
+    size_t Qual;
+    size_t Decl;
+    size_t Type;
+  };
+  NodeCounts NodeArenaCounts;
+
   // Map from clang AST declaration node to our dump status node.
-  typedef std::map<clang::Decl const*, DumpNode> DeclNodesMap;
+  typedef llvm::DenseMap<clang::Decl const*, DeclDumpNode*> DeclNodesMap;
   DeclNodesMap DeclNodes;
 
+  // Map from clang AST declaration node, as referenced, to the one
+  // GetDumpDecl selects for it, or nullptr if it is skipped.  The same
+  // redeclarations are referenced many times, so each is canonicalized
+  // and filtered only once.
+  typedef llvm::DenseMap<clang::Decl const*, clang::Decl const*>
+    DumpDeclsMap;
+  DumpDeclsMap DumpDecls;
+
   // Map from clang AST type node to our dump status node.
-  typedef std::map<DumpType, DumpNode> TypeNodesMap;
+  typedef llvm::DenseMap<DumpType, TypeDumpNode*, DumpTypeMapInfo>
+    TypeNodesMap;
   TypeNodesMap TypeNodes;
 
-  // Map from qualified DumpId to our dump status node.
-  typedef std::map<DumpId, DumpNode> QualNodesMap;
-  QualNodesMap QualNodes;
+  // Map from clang DeclContext to the declaration whose node its
+  // members name as their context, or nullptr if none.
+  typedef llvm::DenseMap<clang::DeclContext const*, clang::Decl const*>
+    ContextDeclsMap;
+  ContextDeclsMap ContextDecls;
+
+  // Map from clang AST type node to what it resolves to.  The same
+  // types are referenced many times, so each is desugared only once.
+  typedef llvm::DenseMap<DumpType, DumpTarget, DumpTypeMapInfo>
+    TypeTargetsMap;
+  TypeTargetsMap TypeTargets;
+
+  // Dump status nodes of the seven qualified variants of one node,
+  // indexed by DumpQual::Bits() - 1.
+  struct QualNodeSlots {
+    QualNodeSlots() { std::fill(this->Nodes, this->Nodes + 7, nullptr); }
+    DumpNode* Nodes[7];
+  };
+
+  // Slots holding the qualified variants of nodes that have any.
+  // QualSlotIndex maps each node id to 1 + the position of its slots
+  // in QualSlots, or to 0 if it has none.
+  std::vector<size_t> QualSlotIndex;
+  std::vector<QualNodeSlots> QualSlots;
 
   // Map from clang file entry to our source file index.
-  typedef std::map<clang::FileEntry const*, unsigned int> FileNodesMap;
+  typedef llvm::DenseMap<clang::FileEntry const*, unsigned int> FileNodesMap;
   FileNodesMap FileNodes;
 
-  // Node traversal queue.
-  std::set<QueueEntry> Queue;
+  // Map from clang file id to our source file index, or ~0u if it is
+  // not a file, and the last file id looked up.
+  llvm::DenseMap<clang::FileID, unsigned int> LocationFiles;
+  clang::FileID LastLocationFileID;
+  unsigned int LastLocationFile;
+
+  // Map from the file names of the line markers of a preprocessed
+  // snapshot to their file entries, or null if not a file.
+  llvm::StringMap<clang::FileEntry const*> PresumedFiles;
+
+  // Scratch buffer reused by each members attribute.
+  DumpIdList MemberScratch;
+
+  // The '--castxml-partition' slot of each name declared in the
+  // translation unit, numbered in the order the names are first met.
+  llvm::DenseMap<void const*, unsigned int> PartitionSlots;
+
+  // Scratch buffer reused by each attribute listing references.
+  llvm::SmallVector<OutputHandler::Ref, 64> RefScratch;
+
+  // Nodes created incomplete during the complete output step.
+  std::vector<QueueEntry> IncompleteNodes;
+
+  // Node traversal queue indexed by node id.  Entries are processed in
+  // order of id and qualifiers, starting from the QueueCursor slot.
+  std::vector<QueueSlot> Queue;
+  uint64_t QueueCursor;
+  size_t QueueSize;
+
+  // Source files to be referenced, indexed by their file index - 1.
+  // ProcessFileQueue writes them in order of their index, starting
+  // after those it wrote before.
+  std::vector<clang::FileEntry const*> Files;
+  size_t FilesWritten;
+
+  // Patterns matching files whose declarations may be complete.
+  std::vector<cxsys::RegularExpression> FileFilters;
+
+  // Map from clang file entry to whether the file filters match it.
+  typedef llvm::DenseMap<clang::FileEntry const*, bool> FileFilterMap;
+  FileFilterMap FileFilterCache;
+
+  // Map from clang file entry to whether it is a system header stub.
+  FileFilterMap SystemStubCache;
+
+  // Source file of the element being written, or 0 if not yet known.
+  unsigned int NodeFile;
+
+  // Stream holding the output document, or a null stream if the
+  // handler writes none.
+  llvm::raw_ostream& Out;
+
+  // Map from interned string to its String element id.  The strings
+  // are kept in the map's own arena for the life of the visitor.
+  typedef llvm::StringMap<unsigned int, llvm::BumpPtrAllocator>
+    StringIdsMap;
+  StringIdsMap StringIds;
+
+  // Map from a string of the pool shared by parallel jobs, by address,
+  // to its String element id, used in place of StringIds if there is
+  // a pool.
+  llvm::DenseMap<char const*, unsigned int> PooledStringIds;
+
+  // Interned strings in order of their ids, and how many of them have
+  // been written.
+  std::vector<llvm::StringRef> StringTable;
+  size_t StringsWritten;
+
+  // Location of each element, if an offset index is requested.
+  std::vector<OffsetIndexEntry> OffsetIndex;
+
+  // Counts of output work reported by '--castxml-stats'.
+  struct OutputCounts {
+    OutputCounts(): Complete(0), Incomplete(0), QueueInserts(0),
+                    Mangles(0) {}
+    unsigned int Complete;
+    unsigned int Incomplete;
+    unsigned int QueueInserts;
+    unsigned int Mangles;
+  };
+  OutputCounts Counts;
 
-  // File traversal queue.
-  std::queue<clang::FileEntry const*> FileQueue;
+  // Element and escape counts of the output, if requested.
+  OutputStatsHandler* Stats;
 
 public:
   ASTVisitor(clang::CompilerInstance& ci,
              clang::ASTContext& ctx,
              llvm::raw_ostream& os,
-             Options const& opts):
-    ASTVisitorBase(ci, ctx, os),
+             Options const& opts,
+             Handler& oh,
+             OutputStatsHandler* stats,
+             clang::MangleContext* mangle = 0):
+    ASTVisitorBase(ci, ctx, oh), OH(oh),
     Opts(opts),
-    NodeCount(0), FileCount(0),
-    FileBuiltin(false),
+    NodeCount(0),
+    FileBuiltin(false), FileBuiltinWritten(false),
     RequireComplete(true),
-    MangleContext(ctx.createMangleContext()),
-    PrintingPolicy(ctx.getPrintingPolicy()) {
+    Splicing(false),
+    NodeDepth(0),
+    MangleContext(mangle),
+    PlainCNames(!ctx.getLangOpts().CPlusPlus &&
+                !ctx.getTargetInfo().getTriple().isOSWindows()),
+    MangleAheadMark(0),
+    PrintingPolicy(ctx.getPrintingPolicy()),
+    LastLocationFile(0),
+    QueueCursor(0), QueueSize(0),
+    FilesWritten(0), NodeFile(0), Out(os), StringsWritten(0),
+    Stats(stats) {
     this->PrintingPolicy.SuppressUnwrittenScope = true;
+    for(std::vector<std::string>::const_iterator
+          i = opts.FileFilters.begin(), e = opts.FileFilters.end();
+        i != e; ++i) {
+      this->FileFilters.push_back(cxsys::RegularExpression(i->c_str()));
+    }
   }
 
   /** Visit declarations in the given translation unit.
@@ -502,8 +1033,22 @@ public:
 };
 
 //----------------------------------------------------------------------------
-ASTVisitor::DumpId ASTVisitor::AddDeclDumpNode(clang::Decl const* d,
-                                               bool complete) {
+template <typename Handler>
+clang::Decl const* ASTVisitor<Handler>::GetDumpDecl(clang::Decl const* d) {
+  DumpDeclsMap::const_iterator i = this->DumpDecls.find(d);
+  if(i != this->DumpDecls.end()) {
+    return i->second;
+  }
+  // Resolving may add other entries, so insert only once done.
+  clang::Decl const* dd = this->ResolveDumpDecl(d);
+  this->DumpDecls[d] = dd;
+  return dd;
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+clang::Decl const*
+ASTVisitor<Handler>::ResolveDumpDecl(clang::Decl const* d) {
   // Select the definition or canonical declaration.
   d = d->getCanonicalDecl();
   if(clang::RecordDecl const* rd = clang::dyn_cast<clang::RecordDecl>(d)) {
@@ -515,14 +1060,12 @@ ASTVisitor::DumpId ASTVisitor::AddDeclDumpNode(clang::Decl const* d,
   // Replace some decls with those they reference.
   switch (d->getKind()) {
   case clang::Decl::UsingShadow:
-    return this->AddDeclDumpNode(
-      static_cast<clang::UsingShadowDecl const*>(d)->getTargetDecl(),
-      complete);
+    return this->GetDumpDecl(
+      static_cast<clang::UsingShadowDecl const*>(d)->getTargetDecl());
   case clang::Decl::LinkageSpec: {
     clang::DeclContext const* dc =
       static_cast<clang::LinkageSpecDecl const*>(d)->getDeclContext();
-    return this->AddDeclDumpNode(clang::Decl::castFromDeclContext(dc),
-                                 complete);
+    return this->GetDumpDecl(clang::Decl::castFromDeclContext(dc));
   } break;
   default:
     break;
@@ -530,104 +1073,160 @@ ASTVisitor::DumpId ASTVisitor::AddDeclDumpNode(clang::Decl const* d,
 
   // Skip invalid declarations.
   if(d->isInvalidDecl()) {
-    return DumpId();
+    return nullptr;
   }
 
-  // Skip C++11 declarations gccxml does not support.
-  if (this->Opts.GccXml) {
+  // Skip C++11 declarations gccxml does not support.  C has no deleted
+  // functions or rvalue references, so its parameters are not walked.
+  if (this->Opts.GccXml && this->CTX.getLangOpts().CPlusPlus) {
     if (clang::FunctionDecl const* fd =
         clang::dyn_cast<clang::FunctionDecl>(d)) {
       if (fd->isDeleted()) {
-        return DumpId();
+        return nullptr;
       }
 
       if (clang::FunctionProtoType const* fpt =
           fd->getType()->getAs<clang::FunctionProtoType>()) {
         if (fpt->getReturnType()->isRValueReferenceType()) {
-          return DumpId();
+          return nullptr;
         }
         for (clang::FunctionProtoType::param_type_iterator
                i = fpt->param_type_begin(), e = fpt->param_type_end();
              i != e; ++i) {
           if((*i)->isRValueReferenceType()) {
-            return DumpId();
+            return nullptr;
           }
         }
       }
     }
   }
 
+  return d;
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+ASTVisitorBase::DumpId
+ASTVisitor<Handler>::AddDeclDumpNode(clang::Decl const* d,
+                                     bool complete) {
+  d = this->GetDumpDecl(d);
+  if(!d) {
+    return DumpId();
+  }
+
+  // Declarations in files outside the filters, and system headers
+  // that are stubbed, are never completed.
+  if(complete && (!this->FileFilterMatches(d) ||
+                  this->IsSystemStubDecl(d))) {
+    complete = false;
+  }
+
   return this->AddDumpNodeImpl(d, complete);
 }
 
 //----------------------------------------------------------------------------
-ASTVisitor::DumpId ASTVisitor::AddDeclDumpNode(clang::Decl const* d,
-                                               bool complete, DumpQual dq) {
+template <typename Handler>
+ASTVisitorBase::DumpId
+ASTVisitor<Handler>::AddDeclDumpNode(clang::Decl const* d,
+                                     bool complete, DumpQual dq) {
   // Get the id for the canonical decl.
   DumpId id = this->AddDeclDumpNode(d, complete);
 
   // If any qualifiers were collected through layers of desugaring
   // then get the id of the qualified type referencing this decl.
   if (id && dq) {
-    id = this->AddQualDumpNode(DumpId(id.Id, dq));
+    id = this->AddQualDumpNode(DumpId(id.Id(), dq));
+  }
+
+  return id;
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+ASTVisitorBase::DumpId
+ASTVisitor<Handler>::AddTypeDumpNode(DumpType dt, bool complete,
+                                     DumpQual dq) {
+  DumpTarget const target = this->GetDumpTarget(dt);
+  dq |= target.Qual;
+
+  // Some types are replaced with their decls.
+  if(target.Decl) {
+    return this->AddDeclDumpNode(target.Decl, complete, dq);
+  }
+
+  // Get the id for the fully desugared, unqualified type.
+  DumpId id = this->AddDumpNodeImpl(target.Type, complete);
+
+  // If any qualifiers were collected through layers of desugaring
+  // then get the id of the qualified type.
+  if (id && dq) {
+    id = this->AddQualDumpNode(DumpId(id.Id(), dq));
   }
 
   return id;
 }
 
 //----------------------------------------------------------------------------
-ASTVisitor::DumpId ASTVisitor::AddTypeDumpNode(DumpType dt, bool complete,
-                                               DumpQual dq) {
+template <typename Handler>
+ASTVisitorBase::DumpTarget ASTVisitor<Handler>::GetDumpTarget(DumpType dt)
+{
+  TypeTargetsMap::const_iterator i = this->TypeTargets.find(dt);
+  if(i != this->TypeTargets.end()) {
+    return i->second;
+  }
+  // Resolving may add other entries, so insert only once done.
+  DumpTarget const target = this->ResolveDumpTarget(dt);
+  this->TypeTargets[dt] = target;
+  return target;
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+ASTVisitorBase::DumpTarget ASTVisitor<Handler>::ResolveDumpTarget(DumpType dt)
+{
   clang::QualType t = dt.Type;
   clang::Type const* c = dt.Class;
 
   // Extract local qualifiers and recurse with locally unqualified type.
   if(t.hasLocalQualifiers()) {
-    dq.IsConst = dq.IsConst || t.isLocalConstQualified();
-    dq.IsVolatile = dq.IsVolatile || t.isLocalVolatileQualified();
-    dq.IsRestrict = dq.IsRestrict || t.isLocalRestrictQualified();
-    return this->AddTypeDumpNode(DumpType(t.getLocalUnqualifiedType(), c),
-                                 complete, dq);
+    DumpTarget target =
+      this->GetDumpTarget(DumpType(t.getLocalUnqualifiedType(), c));
+    target.Qual.AddLocal(t);
+    return target;
   }
 
   // Replace some types with their decls.
+  DumpTarget target;
   switch (t->getTypeClass()) {
   case clang::Type::Adjusted:
-    return this->AddTypeDumpNode(DumpType(
-      t->getAs<clang::AdjustedType>()->getAdjustedType(), c),
-      complete, dq);
+    return this->GetDumpTarget(DumpType(
+      t->getAs<clang::AdjustedType>()->getAdjustedType(), c));
   case clang::Type::Attributed:
-    return this->AddTypeDumpNode(DumpType(
-      t->getAs<clang::AttributedType>()->getEquivalentType(), c),
-      complete, dq);
+    return this->GetDumpTarget(DumpType(
+      t->getAs<clang::AttributedType>()->getEquivalentType(), c));
   case clang::Type::Decayed:
-    return this->AddTypeDumpNode(DumpType(
-      t->getAs<clang::DecayedType>()->getDecayedType(), c),
-      complete, dq);
+    return this->GetDumpTarget(DumpType(
+      t->getAs<clang::DecayedType>()->getDecayedType(), c));
   case clang::Type::Elaborated:
-    return this->AddTypeDumpNode(DumpType(
-      t->getAs<clang::ElaboratedType>()->getNamedType(), c),
-      complete, dq);
+    return this->GetDumpTarget(DumpType(
+      t->getAs<clang::ElaboratedType>()->getNamedType(), c));
   case clang::Type::Enum:
-    return this->AddDeclDumpNode(t->getAs<clang::EnumType>()->getDecl(),
-                                 complete, dq);
+    target.Decl = t->getAs<clang::EnumType>()->getDecl();
+    return target;
   case clang::Type::Paren:
-    return this->AddTypeDumpNode(DumpType(
-      t->getAs<clang::ParenType>()->getInnerType(), c),
-      complete, dq);
+    return this->GetDumpTarget(DumpType(
+      t->getAs<clang::ParenType>()->getInnerType(), c));
   case clang::Type::Record:
-    return this->AddDeclDumpNode(t->getAs<clang::RecordType>()->getDecl(),
-                                 complete, dq);
+    target.Decl = t->getAs<clang::RecordType>()->getDecl();
+    return target;
   case clang::Type::SubstTemplateTypeParm:
-    return this->AddTypeDumpNode(DumpType(
-      t->getAs<clang::SubstTemplateTypeParmType>()->getReplacementType(), c),
-      complete, dq);
+    return this->GetDumpTarget(DumpType(
+      t->getAs<clang::SubstTemplateTypeParmType>()->getReplacementType(), c));
   case clang::Type::TemplateSpecialization: {
     clang::TemplateSpecializationType const* tst =
       t->getAs<clang::TemplateSpecializationType>();
     if(tst->isSugared()) {
-      return this->AddTypeDumpNode(DumpType(tst->desugar(), c),
-                                   complete, dq);
+      return this->GetDumpTarget(DumpType(tst->desugar(), c));
     }
   } break;
   case clang::Type::Typedef: {
@@ -644,61 +1243,89 @@ ASTVisitor::DumpId ASTVisitor::AddTypeDumpNode(DumpType dt, bool complete,
             // format does not include uninstantiated templates we
             // must use the desugared type so that we do not end up
             // referencing a class template as context.
-            return this->AddTypeDumpNode(tdt->desugar(), complete, dq);
+            return this->GetDumpTarget(tdt->desugar());
           }
         }
       }
     }
-    return this->AddDeclDumpNode(tdt->getDecl(), complete, dq);
+    target.Decl = tdt->getDecl();
+    return target;
   } break;
+  case clang::Type::ConstantArray:
+  case clang::Type::FunctionNoProto:
+  case clang::Type::FunctionProto:
+  case clang::Type::IncompleteArray:
+  case clang::Type::LValueReference:
+  case clang::Type::MemberPointer:
+  case clang::Type::Pointer:
+  case clang::Type::RValueReference:
+    // Share one node among the spellings of a derived type through
+    // different typedefs if requested.
+    if(this->Opts.CanonicalTypes && !t.isCanonical() &&
+       !t->isInstantiationDependentType()) {
+      return this->GetDumpTarget(DumpType(t.getCanonicalType(), c));
+    }
+    break;
   default:
     break;
   }
 
-  // Get the id for the fully desugared, unqualified type.
-  DumpId id = this->AddDumpNodeImpl(dt, complete);
-
-  // If any qualifiers were collected through layers of desugaring
-  // then get the id of the qualified type.
-  if (id && dq) {
-    id = this->AddQualDumpNode(DumpId(id.Id, dq));
-  }
-
-  return id;
+  // The type is its own target.
+  target.Type = dt;
+  return target;
 }
 
 //----------------------------------------------------------------------------
-ASTVisitor::DumpId ASTVisitor::AddQualDumpNode(DumpId id) {
+template <typename Handler>
+ASTVisitorBase::DumpId ASTVisitor<Handler>::AddQualDumpNode(DumpId id) {
   DumpNode* dn = this->GetDumpNode(id);
   if (!dn->Index) {
     dn->Index = id;
+    dn->Depth = this->NodeDepth;
     // Always treat CvQualifiedType nodes as complete.
     dn->Complete = true;
-    this->Queue.insert(QueueEntry(dn));
+    this->QueuePush(QueueEntry(dn));
   }
   return dn->Index;
 }
 
 //----------------------------------------------------------------------------
+template <typename Handler>
 template <typename K>
-ASTVisitor::DumpId ASTVisitor::AddDumpNodeImpl(K k, bool complete)
+ASTVisitorBase::DumpId ASTVisitor<Handler>::AddDumpNodeImpl(K k, bool complete)
 {
+  // Nodes beyond the depth limit are never completed.
+  if(complete && this->NodeDepth > this->Opts.MaxDepth) {
+    complete = false;
+  }
+
   // Update an existing node or add one.
-  DumpNode* dn = this->GetDumpNode(k);
+  auto* dn = this->GetDumpNode(k);
   if (dn->Index) {
+    // Keep the shortest path seen from a starting declaration.
+    if(this->NodeDepth < dn->Depth) {
+      dn->Depth = this->NodeDepth;
+    }
     // Node was already encountered.  See if it is now complete.
     if(complete && !dn->Complete) {
       // Node is now complete, but wasn't before.  Queue it.
       dn->Complete = true;
-      this->Queue.insert(QueueEntry(k, dn));
+      this->QueuePush(QueueEntry(dn));
     }
   } else {
     // This is a new node.  Assign it an index.
-    dn->Index.Id = ++this->NodeCount;
+    dn->Index = DumpId(++this->NodeCount, DumpQual());
+    if(this->Opts.StableIds) {
+      this->AddStableId(dn->Index.Id(), this->GetStableKey(k));
+    }
     dn->Complete = complete;
+    dn->Depth = this->NodeDepth;
     if(complete || !this->RequireComplete) {
       // Node is complete.  Queue it.
-      this->Queue.insert(QueueEntry(k, dn));
+      this->QueuePush(QueueEntry(dn));
+    } else {
+      // Node may need incomplete output later, unless promoted first.
+      this->IncompleteNodes.push_back(QueueEntry(dn));
     }
   }
   // Return node's index.
@@ -706,34 +1333,150 @@ ASTVisitor::DumpId ASTVisitor::AddDumpNodeImpl(K k, bool complete)
 }
 
 //----------------------------------------------------------------------------
-unsigned int ASTVisitor::AddDumpFile(clang::FileEntry const* f)
+template <typename Handler>
+std::string ASTVisitor<Handler>::GetStableKey(clang::Decl const* d)
+{
+  // Identify a declaration by those of its enclosing contexts, its
+  // kind and name, and the type of a value to tell overloads apart.
+  std::string key;
+  clang::DeclContext const* dc = d->getDeclContext();
+  while(dc && dc->isTransparentContext()) {
+    dc = dc->getParent();
+  }
+  if(dc && !dc->isTranslationUnit()) {
+    key = this->GetStableKey(clang::Decl::castFromDeclContext(dc));
+    key += "::";
+  }
+  llvm::raw_string_ostream os(key);
+  os << d->getDeclKindName() << ' ';
+  clang::NamedDecl const* nd = clang::dyn_cast<clang::NamedDecl>(d);
+  if(nd) {
+    nd->getNameForDiagnostic(os, this->PrintingPolicy, false);
+  }
+  if(clang::ValueDecl const* vd = clang::dyn_cast<clang::ValueDecl>(d)) {
+    os << ' ' << vd->getType().getCanonicalType().getAsString(
+      this->PrintingPolicy);
+  }
+
+  // Unnamed declarations are told apart only by where they appear.
+  if(!nd || nd->getDeclName().isEmpty()) {
+    clang::PresumedLoc ploc =
+      this->CTX.getSourceManager().getPresumedLoc(d->getLocation());
+    if(ploc.isValid()) {
+      os << ' ' << mapPathPrefix(this->Opts, ploc.getFilename()) << ':'
+         << ploc.getLine() << ':' << ploc.getColumn();
+    }
+  }
+  return os.str();
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+std::string ASTVisitor<Handler>::GetStableKey(DumpType dt)
+{
+  // Identify a type by its structure as written and its canonical form,
+  // and by the declaration it names, if any.
+  std::string key;
+  llvm::raw_string_ostream os(key);
+  clang::QualType t = dt.Type;
+  os << t->getTypeClassName() << ' ' << t.getAsString(this->PrintingPolicy)
+     << ' ' << t.getCanonicalType().getAsString(this->PrintingPolicy);
+  if(clang::TagType const* tt = t->getAs<clang::TagType>()) {
+    os << ' ' << this->GetStableKey(tt->getDecl());
+  } else if(clang::TypedefType const* tdt =
+            clang::dyn_cast<clang::TypedefType>(t.getTypePtr())) {
+    os << ' ' << this->GetStableKey(tdt->getDecl());
+  }
+  if(dt.Class) {
+    os << " in " << clang::QualType(dt.Class, 0).getCanonicalType()
+      .getAsString(this->PrintingPolicy);
+  }
+  return os.str();
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void ASTVisitor<Handler>::AddStableId(uint64_t id, std::string const& key)
+{
+  Hasher h;
+  h.Append(key);
+  std::string sid = h.FinalizeHex().substr(0, 16);
+
+  // Use upper case digits so that the lower case cv-qualifier suffix of
+  // a CvQualifiedType id remains distinct.
+  std::transform(sid.begin(), sid.end(), sid.begin(), ::toupper);
+
+  // Distinct nodes may have the same identity, such as sugared types
+  // that print alike.  Number repeats in order of first encounter.
+  unsigned int& count = this->StableIdCounts[sid];
+  if(count++) {
+    sid += "_" + std::to_string(count);
+  }
+  if(id >= this->StableIds.size()) {
+    this->StableIds.resize(std::max<size_t>(id + 1,
+                                            this->StableIds.size() * 2));
+  }
+  this->StableIds[id] = sid;
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+unsigned int ASTVisitor<Handler>::GetLocationFile(clang::FileID fid)
+{
+  // Consecutive declarations are usually in the same file.
+  if(fid == this->LastLocationFileID) {
+    return this->LastLocationFile;
+  }
+  unsigned int& index = this->LocationFiles[fid];
+  if(index == 0) {
+    clang::FileEntry const* f =
+      this->CI.getSourceManager().getFileEntryForID(fid);
+    index = f? this->AddDumpFile(f) : ~0u;
+  }
+  this->LastLocationFileID = fid;
+  this->LastLocationFile = index == ~0u? 0 : index;
+  return this->LastLocationFile;
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+unsigned int ASTVisitor<Handler>::AddDumpFile(clang::FileEntry const* f)
 {
   unsigned int& index = this->FileNodes[f];
   if(index == 0) {
-    index = ++this->FileCount;
-    this->FileQueue.push(f);
+    this->Files.push_back(f);
+    index = static_cast<unsigned int>(this->Files.size());
   }
   return index;
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::AddClassTemplateDecl(clang::ClassTemplateDecl const* d,
-                                      std::set<DumpId>* emitted)
+template <typename Handler>
+void
+ASTVisitor<Handler>::AddClassTemplateDecl(clang::ClassTemplateDecl const* d,
+                                          DumpIdList* emitted)
 {
   // Queue all the instantiations of this class template.
   for(clang::ClassTemplateDecl::spec_iterator i = d->spec_begin(),
         e = d->spec_end(); i != e; ++i) {
-    clang::CXXRecordDecl const* rd = *i;
+    clang::ClassTemplateSpecializationDecl const* rd = *i;
     DumpId id = this->AddDeclDumpNode(rd, true);
     if(id && emitted) {
-      emitted->insert(id);
+      emitted->push_back(id);
+    }
+    if(id && this->Opts.TemplateOutput &&
+       rd->getTemplateSpecializationKind() !=
+       clang::TSK_ExplicitSpecialization) {
+      this->Opts.TemplateOutput->Specializations[d->getCanonicalDecl()]
+        .insert(rd);
     }
   }
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::AddFunctionTemplateDecl(clang::FunctionTemplateDecl const* d,
-                                         std::set<DumpId>* emitted)
+template <typename Handler>
+void ASTVisitor<Handler>::AddFunctionTemplateDecl(
+  clang::FunctionTemplateDecl const* d, DumpIdList* emitted)
 {
   // Queue all the instantiations of this function template.
   for(clang::FunctionTemplateDecl::spec_iterator i = d->spec_begin(),
@@ -741,14 +1484,15 @@ void ASTVisitor::AddFunctionTemplateDecl(clang::FunctionTemplateDecl const* d,
     clang::FunctionDecl const* fd = *i;
     DumpId id = this->AddDeclDumpNode(fd, true);
     if(id && emitted) {
-      emitted->insert(id);
+      emitted->push_back(id);
     }
   }
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::AddDeclContextMembers(clang::DeclContext const* dc,
-                                       std::set<DumpId>& emitted)
+template <typename Handler>
+void ASTVisitor<Handler>::AddDeclContextMembers(clang::DeclContext const* dc,
+                                                DumpIdList& emitted)
 {
   for(clang::DeclContext::decl_iterator i = dc->decls_begin(),
         e = dc->decls_end(); i != e; ++i) {
@@ -759,6 +1503,29 @@ void ASTVisitor::AddDeclContextMembers(clang::DeclContext const* dc,
       continue;
     }
 
+    // Skip declarations from modules that were not imported.
+    if(d->isHidden()) {
+      continue;
+    }
+
+    // Skip members of classes that bindings cannot use, and so the
+    // declarations reached only through them.
+    if(this->Opts.PublicOnly && dc->isRecord() &&
+       (d->getAccess() == clang::AS_private ||
+        d->getAccess() == clang::AS_protected)) {
+      continue;
+    }
+
+    // Skip implementation details no consumer wants.
+    if(this->IsSkippedDecl(d)) {
+      continue;
+    }
+
+    // Skip the members of the translation unit dealt to other parts.
+    if(!this->IsInPartition(d)) {
+      continue;
+    }
+
     // Ignore certain members.
     switch (d->getKind()) {
     case clang::Decl::CXXRecord: {
@@ -770,8 +1537,11 @@ void ASTVisitor::AddDeclContextMembers(clang::DeclContext const* dc,
       continue;
     } break;
     case clang::Decl::ClassTemplate: {
-      this->AddClassTemplateDecl(
-        static_cast<clang::ClassTemplateDecl const*>(d), &emitted);
+      // Specializations may be left to be queued when referenced.
+      if(!this->Opts.ReferencedSpecializations) {
+        this->AddClassTemplateDecl(
+          static_cast<clang::ClassTemplateDecl const*>(d), &emitted);
+      }
       continue;
     } break;
     case clang::Decl::ClassTemplatePartialSpecialization: {
@@ -784,8 +1554,10 @@ void ASTVisitor::AddDeclContextMembers(clang::DeclContext const* dc,
       continue;
     } break;
     case clang::Decl::FunctionTemplate: {
-      this->AddFunctionTemplateDecl(
-        static_cast<clang::FunctionTemplateDecl const*>(d), &emitted);
+      if(!this->Opts.Layout) {
+        this->AddFunctionTemplateDecl(
+          static_cast<clang::FunctionTemplateDecl const*>(d), &emitted);
+      }
       continue;
     } break;
     case clang::Decl::LinkageSpec: {
@@ -811,16 +1583,179 @@ void ASTVisitor::AddDeclContextMembers(clang::DeclContext const* dc,
       break;
     }
 
+    // The layout lists only the types and fields that make up data.
+    if(this->Opts.Layout && !clang::isa<clang::TypeDecl>(d) &&
+       !clang::isa<clang::FieldDecl>(d) &&
+       !clang::isa<clang::NamespaceDecl>(d)) {
+      continue;
+    }
+
+    // Skip declarations from files outside the filters.  They
+    // are output only if referenced by other declarations.
+    if(!this->FileFilterMatches(d)) {
+      continue;
+    }
+
     // Queue this decl and print its id.
     if(DumpId id = this->AddDeclDumpNode(d, true)) {
-      emitted.insert(id);
+      emitted.push_back(id);
     }
   }
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::AddStartDecl(clang::Decl const* d)
+template <typename Handler>
+bool ASTVisitor<Handler>::FileFilterMatches(clang::Decl const* d)
 {
+  // Namespaces may span files so the filters do not apply to them.
+  if(this->FileFilters.empty() ||
+     clang::isa<clang::NamespaceDecl>(d) ||
+     clang::isa<clang::TranslationUnitDecl>(d)) {
+    return true;
+  }
+
+  clang::FileEntry const* f = this->GetDeclFile(d);
+  if(!f) {
+    return false;
+  }
+
+  // Match each file once.
+  FileFilterMap::iterator i = this->FileFilterCache.find(f);
+  if(i == this->FileFilterCache.end()) {
+    bool match = false;
+    for(std::vector<cxsys::RegularExpression>::iterator
+          ri = this->FileFilters.begin(), re = this->FileFilters.end();
+        !match && ri != re; ++ri) {
+      match = ri->find(f->getName());
+    }
+    i = this->FileFilterCache.insert(std::make_pair(f, match)).first;
+  }
+  return i->second;
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+bool ASTVisitor<Handler>::IsSkippedDecl(clang::Decl const* d)
+{
+  if(!this->Opts.SkipInternal && this->Opts.SkipNamespaces.empty()) {
+    return false;
+  }
+
+  if(clang::NamespaceDecl const* nd =
+     clang::dyn_cast<clang::NamespaceDecl>(d)) {
+    if(this->Opts.SkipInternal && nd->isAnonymousNamespace()) {
+      return true;
+    }
+    std::string qualified;
+    for(std::string const& p : this->Opts.SkipNamespaces) {
+      llvm::StringRef name = nd->getName();
+      if(p.find("::") != p.npos) {
+        if(qualified.empty()) {
+          qualified = nd->getQualifiedNameAsString();
+        }
+        name = qualified;
+      }
+      if(matchStartPattern(p, name)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Only 'static' gives internal linkage to declarations of functions
+  // and variables at namespace scope, as in an 'extern "C"' block.
+  if(!this->Opts.SkipInternal ||
+     !d->getDeclContext()->getRedeclContext()->isFileContext()) {
+    return false;
+  }
+  if(clang::FunctionTemplateDecl const* ftd =
+     clang::dyn_cast<clang::FunctionTemplateDecl>(d)) {
+    d = ftd->getTemplatedDecl();
+  }
+  if(clang::FunctionDecl const* fd = clang::dyn_cast<clang::FunctionDecl>(d)) {
+    return fd->getStorageClass() == clang::SC_Static;
+  }
+  if(clang::VarDecl const* vd = clang::dyn_cast<clang::VarDecl>(d)) {
+    return vd->getStorageClass() == clang::SC_Static;
+  }
+  return false;
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+bool ASTVisitor<Handler>::IsSystemStubDecl(clang::Decl const* d)
+{
+  if(!this->Opts.StubSystemHeaders ||
+     clang::isa<clang::NamespaceDecl>(d) ||
+     clang::isa<clang::TranslationUnitDecl>(d)) {
+    return false;
+  }
+  clang::FileEntry const* f = this->GetDeclFile(d);
+  if(!f) {
+    return false;
+  }
+
+  // Check each file once.
+  FileFilterMap::iterator i = this->SystemStubCache.find(f);
+  if(i == this->SystemStubCache.end()) {
+    llvm::StringRef name = f->getName();
+    bool stub = false;
+    for(std::vector<Options::Include>::const_iterator
+          ii = this->Opts.Includes.begin(), ie = this->Opts.Includes.end();
+        !stub && ii != ie; ++ii) {
+      llvm::StringRef dir = llvm::StringRef(ii->Directory).rtrim("/\\");
+      stub = (name.size() > dir.size() && name.startswith(dir) &&
+              (name[dir.size()] == '/' || name[dir.size()] == '\\'));
+    }
+    i = this->SystemStubCache.insert(std::make_pair(f, stub)).first;
+  }
+  return i->second;
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+clang::FileEntry const* ASTVisitor<Handler>::GetDeclFile(clang::Decl const* d)
+{
+  // Find the file as PrintLocationAttribute does.
+  clang::SourceLocation sl = d->getLocation();
+  if(sl.isInvalid()) {
+    return 0;
+  }
+  clang::FullSourceLoc fsl = this->CTX.getFullLoc(sl).getExpansionLoc();
+  if(this->Opts.PreprocessedSnapshot) {
+    return this->GetPresumedFile(fsl.getManager().getPresumedLoc(fsl));
+  }
+  return this->CI.getSourceManager().getFileEntryForID(fsl.getFileID());
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+clang::FileEntry const*
+ASTVisitor<Handler>::GetPresumedFile(clang::PresumedLoc const& pl)
+{
+  if(pl.isInvalid()) {
+    return 0;
+  }
+  llvm::StringMap<clang::FileEntry const*>::iterator i =
+    this->PresumedFiles.find(pl.getFilename());
+  if(i != this->PresumedFiles.end()) {
+    return i->second;
+  }
+  // Names such as "<built-in>" are not files.
+  clang::FileEntry const* f =
+    this->CI.getFileManager().getFile(pl.getFilename());
+  this->PresumedFiles[pl.getFilename()] = f;
+  return f;
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void ASTVisitor<Handler>::AddStartDecl(clang::Decl const* d)
+{
+  if(this->IsSkippedDecl(d)) {
+    return;
+  }
+
   switch (d->getKind()) {
   case clang::Decl::ClassTemplate:
     this->AddClassTemplateDecl(
@@ -849,68 +1784,370 @@ void ASTVisitor::AddStartDecl(clang::Decl const* d)
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::QueueIncompleteDumpNodes()
+template <typename Handler>
+void ASTVisitor<Handler>::QueueIncompleteDumpNodes()
 {
-  // Queue declaration nodes that do not need complete output.
-  for(DeclNodesMap::const_iterator i = this->DeclNodes.begin(),
-        e = this->DeclNodes.end(); i != e; ++i) {
-    if(!i->second.Complete) {
-      this->Queue.insert(QueueEntry(i->first, &i->second));
+  // Queue declaration and type nodes that do not need complete output.
+  // They were recorded in order of id when created, and any that have
+  // since been promoted to complete output were already queued.
+  for(std::vector<QueueEntry>::const_iterator
+        i = this->IncompleteNodes.begin(), e = this->IncompleteNodes.end();
+      i != e; ++i) {
+    if(!i->DN()->Complete) {
+      this->QueuePush(*i);
     }
   }
+  std::vector<QueueEntry>().swap(this->IncompleteNodes);
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void ASTVisitor<Handler>::QueuePush(QueueEntry const& qe)
+{
+  DumpId const& id = qe.DN()->Index;
+  if(id.Id() >= this->Queue.size()) {
+    this->Queue.resize(std::max<size_t>(id.Id() + 1, this->Queue.size() * 2));
+  }
+  QueueSlot& slot = this->Queue[id.Id()];
+  unsigned char const bit = static_cast<unsigned char>(1 << id.Qual().Bits());
+  if(slot.Pending & bit) {
+    return;
+  }
+  slot.Pending |= bit;
+  if(qe.Kind() != QueueEntry::KindQual) {
+    slot.Entry = qe;
+  }
+  ++this->QueueSize;
+  ++this->Counts.QueueInserts;
 
-  // Queue type nodes that do not need complete output.
-  for(TypeNodesMap::const_iterator i = this->TypeNodes.begin(),
-        e = this->TypeNodes.end(); i != e; ++i) {
-    if(!i->second.Complete) {
-      this->Queue.insert(QueueEntry(i->first, &i->second));
-    }
+  // Nodes may become complete after later ids have been processed.
+  if(id.Id() < this->QueueCursor) {
+    this->QueueCursor = id.Id();
   }
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::ProcessQueue()
+template <typename Handler>
+void ASTVisitor<Handler>::ProcessQueue()
 {
+  TraceRegion tr("Process queue");
+
+  // Entries may be queued again below the cursor for this pass.
+  this->MangleAheadMark = 0;
+
   // Dispatch each entry in the queue based on its node kind.
-  while(!this->Queue.empty()) {
-    QueueEntry qe = *this->Queue.begin();
-    this->Queue.erase(this->Queue.begin());
-    switch(qe.Kind) {
+  while(this->QueueSize > 0) {
+    if(this->Opts.Limits &&
+       this->Opts.Limits->Exceeded(this->CI.getDiagnostics())) {
+      return;
+    }
+    QueueSlot& slot = this->Queue[this->QueueCursor];
+    if(!slot.Pending) {
+      ++this->QueueCursor;
+      continue;
+    }
+
+    // Take the lowest queued entry in this slot.
+    unsigned int bits = 0;
+    while(!(slot.Pending & (1 << bits))) {
+      ++bits;
+    }
+    slot.Pending &= static_cast<unsigned char>(~(1 << bits));
+    --this->QueueSize;
+    QueueEntry qe = slot.Entry;
+    if(bits) {
+      qe = QueueEntry(this->GetDumpNode(
+        DumpId(this->QueueCursor, DumpQual::FromBits(bits))));
+    }
+
+    // Nodes referenced by this one are one hop further from the start.
+    this->NodeDepth = qe.DN()->Depth + 1;
+
+    // Record where the element starts in the output document.
+    uint64_t const offset = this->Out.tell();
+    ++(qe.DN()->Complete? this->Counts.Complete : this->Counts.Incomplete);
+
+    switch(qe.Kind()) {
     case QueueEntry::KindQual:
-      this->OutputCvQualifiedType(qe.DN);
+      this->OutputCvQualifiedType(qe.DN());
       break;
     case QueueEntry::KindDecl:
-      this->OutputDecl(qe.Decl, qe.DN);
+      if(this->Opts.Index) {
+        this->OutputIndexEntry(qe.Decl(), qe.DN());
+      } else if(this->Opts.HeaderFragments) {
+        this->OutputDeclCached(qe.Decl(), qe.DN());
+      } else {
+        this->OutputDecl(qe.Decl(), qe.DN());
+      }
       break;
     case QueueEntry::KindType:
-      this->OutputType(qe.Type, qe.DN);
+      this->OutputType(qe.Type(), qe.DN());
       break;
     }
+    this->OH.EndNode(qe.DN()->Index.Id(), this->NodeFile);
+    this->NodeFile = 0;
+    if(!this->Opts.OutputIndexFile.empty()) {
+      this->OffsetIndex.push_back(
+        OffsetIndexEntry(qe.DN()->Index, offset, this->Out.tell() - offset));
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void
+ASTVisitor<Handler>::OutputDeclCached(clang::Decl const* d, DumpNode const* dn)
+{
+  // Only explicit declarations located in a header are cached.  The
+  // implicit ones may refer to the builtin File.
+  clang::SourceLocation const sl = d->getLocation();
+  uint64_t const id = dn->Index.Id();
+  if(d->isImplicit() || sl.isInvalid() || id >= this->StableIds.size() ||
+     this->StableIds[id].empty()) {
+    this->OutputDecl(d, dn);
+    return;
+  }
+  clang::FileID const fid =
+    this->CI.getSourceManager().getDecomposedExpansionLoc(sl).first;
+  std::string key = this->StableIds[id];
+  if(!dn->Complete) {
+    key += " incomplete";
+  }
+  HeaderCache& hc = *this->Opts.HeaderFragments;
+  std::string const* xml = hc.Find(fid, key);
+  unsigned int file = 0;
+  if(xml && xml->find("=\"f@") != std::string::npos) {
+    file = this->GetLocationFile(fid);
+  }
+  if(!xml || (!file && xml->find("=\"f@") != std::string::npos)) {
+    this->OutputDecl(d, dn);
+    return;
+  }
+
+  // Traverse the declaration only to queue the nodes it references,
+  // skipping the optional attributes, and write the cached text.
+  hc.Mute();
+  this->Splicing = true;
+  this->OutputDecl(d, dn);
+  this->Splicing = false;
+  this->NodeFile = file;
+  hc.Splice(*xml, file);
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void ASTVisitor<Handler>::ProcessStringTable()
+{
+  for(size_t i = this->StringsWritten; i < this->StringTable.size(); ++i) {
+    this->OH.StartElement("String");
+    this->OH.RefAttribute("id", OutputHandler::Ref(
+                            's', static_cast<unsigned int>(i + 1)));
+    this->OH.StringAttribute("value", this->StringTable[i]);
+    this->OH.EndElement();
+    this->OH.EndNode(0, 0);
+  }
+  this->StringsWritten = this->StringTable.size();
+}
+
+//----------------------------------------------------------------------------
+static void writeIndexValue(llvm::raw_ostream& os, uint64_t v, size_t n)
+{
+  // Write the low n bytes of the value in little-endian order.
+  for(size_t i = 0; i < n; ++i) {
+    os << char(v >> (8 * i));
+  }
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void ASTVisitor<Handler>::WriteStatsReport()
+{
+  llvm::raw_ostream& os = llvm::errs();
+  os << "castxml output statistics:\n";
+  os << "  nodes: " << (this->Counts.Complete + this->Counts.Incomplete) <<
+    " (" << this->Counts.Complete << " complete, " <<
+    this->Counts.Incomplete << " incomplete)\n";
+  os << "  queue inserts: " << this->Counts.QueueInserts << "\n";
+  os << "  mangled names: " << this->Counts.Mangles << "\n";
+  os << "  escaped attribute values: " << this->Stats->EscapedValues << "\n";
+  os << "  bytes written: " << this->Out.tell() << "\n";
+  os << "  elements:\n";
+  std::vector<llvm::StringRef> tags;
+  for(llvm::StringMap<unsigned int>::const_iterator
+        i = this->Stats->Elements.begin(), e = this->Stats->Elements.end();
+      i != e; ++i) {
+    tags.push_back(i->getKey());
+  }
+  std::sort(tags.begin(), tags.end());
+  for(llvm::StringRef tag : tags) {
+    os << "    " << tag << ": " << this->Stats->Elements.lookup(tag) << "\n";
+  }
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void ASTVisitor<Handler>::WriteMemoryReport()
+{
+  // Our tables only grow during output, so their sizes now are their
+  // peak sizes.
+  clang::SourceManager const& sm = this->CI.getSourceManager();
+  clang::SourceManager::MemoryBufferSizes buffers =
+    sm.getMemoryBufferSizes();
+  llvm::raw_ostream& os = llvm::errs();
+  os << "castxml memory report:\n";
+  os << "  peak resident size: " << getPeakResidentSize() << " bytes\n";
+  os << "  ASTContext: " << (this->CTX.getASTAllocatedMemory() +
+                             this->CTX.getSideTableAllocatedMemory()) <<
+    " bytes\n";
+  os << "  SourceManager: " << (sm.getContentCacheSize() +
+                                sm.getDataStructureSizes()) <<
+    " bytes, buffers " << (buffers.malloc_bytes + buffers.mmap_bytes) <<
+    " bytes\n";
+  NodeCounts const& nc = this->NodeArenaCounts;
+  os << "  DumpNode arena: " << this->NodeArena.getTotalMemory() <<
+    " bytes (" << (nc.Qual + nc.Decl + nc.Type) << " nodes)\n";
+  os << "  DeclNodes: " << this->DeclNodes.getMemorySize() <<
+    " bytes (" << this->DeclNodes.size() << " entries)\n";
+  os << "  DumpDecls: " << this->DumpDecls.getMemorySize() <<
+    " bytes (" << this->DumpDecls.size() << " entries)\n";
+  os << "  TypeNodes: " << this->TypeNodes.getMemorySize() <<
+    " bytes (" << this->TypeNodes.size() << " entries)\n";
+  os << "  QualNodes: " <<
+    (this->QualSlotIndex.capacity() * sizeof(size_t) +
+     this->QualSlots.capacity() * sizeof(QualNodeSlots)) <<
+    " bytes (" << this->QualSlots.size() << " slots)\n";
+  os << "  FileNodes: " << this->FileNodes.getMemorySize() <<
+    " bytes (" << this->FileNodes.size() << " entries)\n";
+  os << "  Queue: " << (this->Queue.capacity() * sizeof(QueueSlot)) <<
+    " bytes (" << this->Queue.size() << " slots)\n";
+  os << "  IncompleteNodes: " <<
+    (this->IncompleteNodes.capacity() * sizeof(QueueEntry)) << " bytes\n";
+  os << "  DefaultArgTexts: " << this->DefaultArgTexts.getMemorySize() <<
+    " bytes (" << this->DefaultArgTexts.size() << " entries)\n";
+  if(this->Opts.Strings) {
+    os << "  PooledStringIds: " << this->PooledStringIds.getMemorySize() <<
+      " bytes (" << this->PooledStringIds.size() << " entries)\n";
+    os << "  StringPool (shared): " << this->Opts.Strings->GetMemorySize() <<
+      " bytes (" << this->Opts.Strings->GetSize() << " strings)\n";
+  }
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void ASTVisitor<Handler>::WriteOffsetIndex()
+{
+  std::string const& fname = this->Opts.OutputIndexFile;
+  std::error_code ec;
+  llvm::raw_fd_ostream os(fname, ec, llvm::sys::fs::F_None);
+  if(ec) {
+    this->CI.getDiagnostics().Report(
+      clang::diag::err_fe_unable_to_open_output) << fname << ec.message();
+    return;
+  }
+
+  // Write a header followed by one fixed-size entry per element,
+  // sorted by id so that readers may search for an element.
+  std::sort(this->OffsetIndex.begin(), this->OffsetIndex.end());
+  os << "CastXMLI";
+  writeIndexValue(os, 2, 4);
+  writeIndexValue(os, this->OffsetIndex.size(), 8);
+  for(std::vector<OffsetIndexEntry>::const_iterator
+        i = this->OffsetIndex.begin(), e = this->OffsetIndex.end();
+      i != e; ++i) {
+    writeIndexValue(os, i->Id.Id(), 8);
+    writeIndexValue(os, i->Id.Qual().Bits(), 4);
+    writeIndexValue(os, i->Offset, 8);
+    writeIndexValue(os, i->Size, 8);
+  }
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void
+ASTVisitor<Handler>::OutputIndexEntry(clang::Decl const* d, DumpNode const* dn)
+{
+  // Namespaces and class definitions lead to their members.
+  DumpIdList& emitted = this->MemberScratch;
+  emitted.clear();
+  if(clang::NamespaceDecl const* nd =
+     clang::dyn_cast<clang::NamespaceDecl>(d)) {
+    for(clang::NamespaceDecl const* r: nd->redecls()) {
+      this->AddDeclContextMembers(r, emitted);
+    }
+  } else if(clang::isa<clang::TranslationUnitDecl>(d)) {
+    this->AddDeclContextMembers(clang::cast<clang::DeclContext>(d), emitted);
+    return;
+  } else if(clang::RecordDecl const* rd =
+            clang::dyn_cast<clang::RecordDecl>(d)) {
+    if(rd->getDefinition() && dn->Complete) {
+      this->AddDeclContextMembers(rd->getDefinition(), emitted);
+    }
+  }
+
+  // Write "<kind>\t<qualified name>\t<file>:<line>\t<mangled>".
+  clang::NamedDecl const* nd = clang::dyn_cast<clang::NamedDecl>(d);
+  if(!nd) {
+    return;
+  }
+  this->PrintScratch.clear();
+  {
+    llvm::raw_svector_ostream rso(this->PrintScratch);
+    nd->getNameForDiagnostic(rso, this->PrintingPolicy, true);
+  }
+  this->Out << d->getDeclKindName() << '\t' << this->PrintScratch.str()
+            << '\t';
+  clang::SourceManager const& sm = this->CI.getSourceManager();
+  clang::PresumedLoc const pl =
+    sm.getPresumedLoc(sm.getExpansionLoc(d->getLocation()));
+  if(pl.isValid()) {
+    this->Out << mapPathPrefix(this->Opts, pl.getFilename()) << ':'
+              << pl.getLine();
+  }
+  this->Out << '\t';
+  if(this->WantAttribute(Options::AttributeMangled) &&
+     !this->IsSystemStubDecl(d)) {
+    clang::FunctionDecl const* fd = clang::dyn_cast<clang::FunctionDecl>(d);
+    if((fd && !clang::isa<clang::CXXConstructorDecl>(d) &&
+        !clang::isa<clang::CXXDestructorDecl>(d) &&
+        fd->getType()->getAs<clang::FunctionProtoType>()) ||
+       d->getKind() == clang::Decl::Var) {
+      this->Out << this->GetMangledName(nd);
+    }
   }
+  this->Out << '\n';
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::ProcessFileQueue()
+template <typename Handler>
+void ASTVisitor<Handler>::ProcessFileQueue()
 {
-  if(this->FileBuiltin) {
-    this->OS <<
-      "  <File id=\"f0\" name=\"" << encodeXML("<builtin>") << "\"/>\n"
-      ;
+  if(this->FileBuiltin && !this->FileBuiltinWritten) {
+    this->FileBuiltinWritten = true;
+    this->OH.StartElement("File");
+    this->OH.RefAttribute("id", OutputHandler::Ref('f', 0));
+    this->PrintStringAttribute("name", "<builtin>");
+    this->OH.EndElement();
+    this->OH.EndNode(0, 0);
   }
-  while(!this->FileQueue.empty()) {
-    clang::FileEntry const* f = this->FileQueue.front();
-    this->FileQueue.pop();
-    this->OS <<
-      "  <File"
-      " id=\"f" << this->FileNodes[f] << "\""
-      " name=\"" << encodeXML(f->getName()) << "\""
-      "/>\n"
-      ;
+  for(size_t i = this->FilesWritten; i < this->Files.size(); ++i) {
+    clang::FileEntry const* f = this->Files[i];
+    unsigned int const id = static_cast<unsigned int>(i + 1);
+    this->OH.StartElement("File");
+    this->OH.RefAttribute("id", OutputHandler::Ref('f', id));
+    this->PrintStringAttribute("name", mapPathPrefix(this->Opts,
+                                                     f->getName()));
+    if(this->Opts.FileHashes) {
+      this->PrintFileHashAttribute(f);
+    }
+    this->OH.EndElement();
+    this->OH.EndNode(0, id);
   }
+  this->FilesWritten = this->Files.size();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputDecl(clang::Decl const* d, DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputDecl(clang::Decl const* d, DumpNode const* dn)
 {
   // Dispatch output of the declaration.
   switch (d->getKind()) {
@@ -925,7 +2162,8 @@ void ASTVisitor::OutputDecl(clang::Decl const* d, DumpNode const* dn)
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputType(DumpType dt, DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputType(DumpType dt, DumpNode const* dn)
 {
   clang::QualType t = dt.Type;
   clang::Type const* c = dt.Class;
@@ -948,103 +2186,329 @@ void ASTVisitor::OutputType(DumpType dt, DumpNode const* dn)
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputCvQualifiedType(DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputCvQualifiedType(DumpNode const* dn)
 {
   DumpId id = dn->Index;
 
   // Create a special CvQualifiedType element to hold top-level
   // cv-qualifiers for a real type node.
-  this->OS << "  <CvQualifiedType id=\"_" << id << "\"";
+  this->OH.StartElement("CvQualifiedType");
+  this->PrintIdRefAttribute("id", id);
 
   // Refer to the unqualified type.
-  this->OS << " type=\"_" << id.Id << "\"";
+  this->PrintIdRefAttribute("type", DumpId(id.Id(), DumpQual()));
 
   // Add the cv-qualification attributes.
-  if (id.Qual.IsConst) {
-    this->OS << " const=\"1\"";
+  if (id.Qual().IsConst()) {
+    this->OH.UIntAttribute("const", 1);
   }
-  if (id.Qual.IsVolatile) {
-    this->OS << " volatile=\"1\"";
+  if (id.Qual().IsVolatile()) {
+    this->OH.UIntAttribute("volatile", 1);
   }
-  if (id.Qual.IsRestrict) {
-    this->OS << " restrict=\"1\"";
+  if (id.Qual().IsRestrict()) {
+    this->OH.UIntAttribute("restrict", 1);
   }
-  this->OS << "/>\n";
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-ASTVisitor::DumpId ASTVisitor::GetContextIdRef(clang::DeclContext const* dc)
+template <typename Handler>
+ASTVisitorBase::DumpId
+ASTVisitor<Handler>::GetContextIdRef(clang::DeclContext const* dc)
 {
-  while (dc->isInlineNamespace()) {
-    dc = dc->getParent();
+  // All members of a context share its node, so find the declaration
+  // it represents only once.
+  ContextDeclsMap::iterator i = this->ContextDecls.find(dc);
+  if(i == this->ContextDecls.end()) {
+    clang::DeclContext const* odc = dc;
+    while (odc->isInlineNamespace()) {
+      odc = odc->getParent();
+    }
+    clang::Decl const* d = clang::dyn_cast<clang::Decl>(odc);
+    i = this->ContextDecls.insert(
+      std::make_pair(dc, d? this->GetDumpDecl(d) : nullptr)).first;
   }
 
-  if(clang::Decl const* d = clang::dyn_cast<clang::Decl>(dc)) {
-    return this->AddDeclDumpNode(d, false);
+  // Contexts are never completed by a reference, and the filters
+  // checked by AddDeclDumpNode apply only to complete nodes.
+  if(clang::Decl const* d = i->second) {
+    return this->AddDumpNodeImpl(d, false);
   } else {
     return DumpId();
   }
 }
 
 //----------------------------------------------------------------------------
-std::string ASTVisitor::GetContextName(clang::CXXMethodDecl const* d)
+template <typename Handler>
+llvm::StringRef
+ASTVisitor<Handler>::GetContextName(clang::CXXMethodDecl const* d)
 {
   clang::DeclContext const* dc = d->getDeclContext();
   if(clang::RecordDecl const* rd = clang::dyn_cast<clang::RecordDecl>(dc)) {
-    return rd->getName().str();
+    return rd->getName();
   }
-  return "";
+  return llvm::StringRef();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintTypeIdRef(clang::QualType t, bool complete)
+template <typename Handler>
+void
+ASTVisitor<Handler>::PrintTypeIdRefAttribute(llvm::StringRef name,
+                                             clang::QualType t, bool complete)
 {
   // Add the type node.
   DumpId id = this->AddTypeDumpNode(t, complete);
 
   // Print the reference.
-  this->OS << "_" << id;
+  this->PrintIdRefAttribute(name, id);
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void ASTVisitor<Handler>::PrintIdAttribute(DumpNode const* dn)
+{
+  this->PrintIdRefAttribute("id", dn->Index);
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void ASTVisitor<Handler>::PrintStringAttribute(llvm::StringRef name,
+                                               llvm::StringRef s)
+{
+  if(!this->Opts.InternStrings) {
+    this->OH.StringAttribute(name, s);
+    return;
+  }
+  if(this->Opts.Strings) {
+    llvm::StringRef const p = this->Opts.Strings->Intern(s);
+    std::pair<llvm::DenseMap<char const*, unsigned int>::iterator, bool> r =
+      this->PooledStringIds.insert(
+        std::make_pair(p.data(), static_cast<unsigned int>(
+                         this->StringTable.size() + 1)));
+    if(r.second) {
+      this->StringTable.push_back(p);
+    }
+    this->OH.RefAttribute(name, OutputHandler::Ref('s', r.first->second));
+    return;
+  }
+  std::pair<StringIdsMap::iterator, bool> r =
+    this->StringIds.insert(
+      std::make_pair(s, static_cast<unsigned int>(
+                       this->StringTable.size() + 1)));
+  if(r.second) {
+    this->StringTable.push_back(r.first->getKey());
+  }
+  this->OH.RefAttribute(name, OutputHandler::Ref('s', r.first->getValue()));
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void ASTVisitor<Handler>::PrintFileHashAttribute(clang::FileEntry const* f)
+{
+  // Hash the buffer the source manager parsed, so that the digest
+  // matches the content the output describes even if the file has
+  // since changed on disk or was given by a virtual file system.
+  bool invalid = false;
+  llvm::MemoryBuffer* buffer =
+    this->CI.getSourceManager().getMemoryBufferForFile(f, &invalid);
+  if(invalid || !buffer) {
+    return;
+  }
+  Hasher h;
+  h.AppendBytes(buffer->getBufferStart(), buffer->getBufferSize());
+  this->OH.StringAttribute("hash", h.FinalizeHex());
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintIdAttribute(DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::PrintNameAttribute(llvm::StringRef name)
 {
-  this->OS << " id=\"_" << dn->Index << "\"";
+  this->PrintStringAttribute("name", name);
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintNameAttribute(std::string const& name)
+template <typename Handler>
+void ASTVisitor<Handler>::PrintMangledAttribute(clang::NamedDecl const* d)
 {
-  this->OS << " name=\"" << encodeXML(name) << "\"";
+  // System header stubs have no mangled names.
+  if(!this->WantAttribute(Options::AttributeMangled) ||
+     this->IsSystemStubDecl(d)) {
+    return;
+  }
+  this->PrintStringAttribute("mangled", this->GetMangledName(d));
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintMangledAttribute(clang::NamedDecl const* d)
+template <typename Handler>
+llvm::StringRef ASTVisitor<Handler>::GetMangledName(clang::NamedDecl const* d)
 {
-  // Compute the mangled name.
-  std::string s;
+  // Mangling a C name gives back its identifier unless it is renamed
+  // by an asm label or overloadable.  Large C headers declare so many
+  // functions that the mangling context and its worker threads would
+  // dominate the cost of the attribute.
+  if(this->PlainCNames && !d->hasAttr<clang::AsmLabelAttr>() &&
+     !d->hasAttr<clang::OverloadableAttr>()) {
+    ++this->Counts.Mangles;
+    return d->getName();
+  }
+
+  // Use the name computed ahead on a worker thread, if any.
+  if(this->Opts.MangleThreads > 1 &&
+     this->Queue.size() >= this->MangleAheadMark) {
+    this->MangleAhead(d);
+  }
+  this->MangledName.clear();
+  llvm::DenseMap<clang::NamedDecl const*, std::string>::iterator i =
+    this->MangledAhead.find(d);
+  if(i != this->MangledAhead.end()) {
+    ++this->Counts.Mangles;
+    this->MangledName.append(i->second.begin(), i->second.end());
+    this->MangledAhead.erase(i);
+    return this->MangledName.str();
+  }
+
+  // Compute the mangled name in our reusable buffer.
+  if(!this->MangleContext) {
+    this->OwnedMangleContext.reset(this->CTX.createMangleContext());
+    this->MangleContext = this->OwnedMangleContext.get();
+  }
   {
-    llvm::raw_string_ostream rso(s);
+    llvm::raw_svector_ostream rso(this->MangledName);
     this->MangleContext->mangleName(d, rso);
   }
+  ++this->Counts.Mangles;
+  llvm::StringRef s = this->MangledName.str();
 
   // Strip a leading 1 byte in MS mangling.
   if (!s.empty() && s[0] == '\1') {
     s = s.substr(1);
   }
+  return s;
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+bool ASTVisitor<Handler>::CanMangleAhead(clang::Decl const* d)
+{
+  // Only the declarations whose elements print a mangled name.
+  if(clang::FunctionDecl const* fd =
+     clang::dyn_cast<clang::FunctionDecl>(d)) {
+    if(clang::isa<clang::CXXConstructorDecl>(d) ||
+       clang::isa<clang::CXXDestructorDecl>(d) ||
+       !fd->getType()->getAs<clang::FunctionProtoType>()) {
+      return false;
+    }
+  } else if(d->getKind() != clang::Decl::Var) {
+    return false;
+  }
+
+  // A mangling context numbers local entities and unnamed types in the
+  // order it meets them, so names involving them are left to the one
+  // context that mangles in output order.  Those are the names of
+  // declarations without external or internal linkage.
+  clang::NamedDecl const* nd = clang::cast<clang::NamedDecl>(d);
+  clang::Linkage const linkage = nd->getFormalLinkage();
+  return ((linkage == clang::ExternalLinkage ||
+           linkage == clang::InternalLinkage) &&
+          !d->getParentFunctionOrMethod() &&
+          !this->IsSystemStubDecl(d) &&
+          !this->MangledAhead.count(nd));
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void ASTVisitor<Handler>::MangleAhead(clang::NamedDecl const* d)
+{
+  // Look at the queue again only after it has grown by half of what
+  // is left to process, so that the scans cost linear time in all.
+  size_t const left = this->Queue.size() - this->QueueCursor;
+  this->MangleAheadMark = this->Queue.size() + std::max<size_t>(64, left / 2);
+
+  // Mangling reads the AST concurrently, which is safe only when no
+  // external source loads declarations lazily.  The Microsoft ABI
+  // numbers more entities than the Itanium ABI in its contexts.
+  if(this->CTX.getExternalSource() ||
+     this->CTX.getTargetInfo().getCXXABI().isMicrosoft()) {
+    return;
+  }
 
-  this->OS << " mangled=\"" << encodeXML(s) << "\"";
+  std::vector<clang::NamedDecl const*> decls;
+  if(this->CanMangleAhead(d)) {
+    decls.push_back(d);
+  }
+  for(size_t i = this->QueueCursor; i < this->Queue.size(); ++i) {
+    QueueSlot const& slot = this->Queue[i];
+    if((slot.Pending & 1) && slot.Entry.Kind() == QueueEntry::KindDecl &&
+       this->CanMangleAhead(slot.Entry.Decl())) {
+      decls.push_back(clang::cast<clang::NamedDecl>(slot.Entry.Decl()));
+    }
+  }
+
+  // A few names are mangled faster than threads start.
+  size_t const threads = std::min<size_t>(this->Opts.MangleThreads,
+                                          decls.size() / 16);
+  if(threads < 2) {
+    return;
+  }
+  TraceRegion tr("Mangle ahead");
+  while(this->WorkerMangleContexts.size() < threads) {
+    this->WorkerMangleContexts.emplace_back(this->CTX.createMangleContext());
+  }
+  std::vector<std::string> names(decls.size());
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for(size_t t = 0; t < threads; ++t) {
+    clang::MangleContext* mc = this->WorkerMangleContexts[t].get();
+    workers.emplace_back([&decls, &names, &next, mc]() {
+      llvm::SmallString<256> buf;
+      for(size_t i = next++; i < decls.size(); i = next++) {
+        buf.clear();
+        {
+          llvm::raw_svector_ostream rso(buf);
+          mc->mangleName(decls[i], rso);
+        }
+        names[i] = buf.str();
+      }
+    });
+  }
+  for(std::thread& w : workers) {
+    w.join();
+  }
+  for(size_t i = 0; i < decls.size(); ++i) {
+    this->MangledAhead[decls[i]] = std::move(names[i]);
+  }
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void ASTVisitor<Handler>::PrintOffsetAttribute(unsigned int const& offset)
+{
+  this->OH.UIntAttribute("offset", offset);
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintOffsetAttribute(unsigned int const& offset)
+template <typename Handler>
+void
+ASTVisitor<Handler>::PrintIntAttribute(llvm::StringRef name,
+                                       llvm::APInt const& v, bool isSigned)
 {
-  this->OS << " offset=\"" << offset << "\"";
+  if(isSigned && v.getMinSignedBits() <= 64) {
+    this->OH.IntAttribute(name, v.getSExtValue());
+  } else if(!isSigned && v.getActiveBits() <= 64) {
+    this->OH.UIntAttribute(name, v.getZExtValue());
+  } else {
+    this->OH.StringAttribute(name, v.toString(10, isSigned));
+  }
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintABIAttributes(clang::TypeDecl const* d)
+template <typename Handler>
+void ASTVisitor<Handler>::PrintABIAttributes(clang::TypeDecl const* d)
 {
+  if(!this->WantAttribute(Options::AttributeSize)) {
+    return;
+  }
   if(clang::TypeDecl const* td = clang::dyn_cast<clang::TypeDecl>(d)) {
     clang::Type const* ty = td->getTypeForDecl();
     if(!ty->isIncompleteType()) {
@@ -1054,77 +2518,110 @@ void ASTVisitor::PrintABIAttributes(clang::TypeDecl const* d)
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintABIAttributes(clang::TypeInfo const& t)
+template <typename Handler>
+void ASTVisitor<Handler>::PrintABIAttributes(clang::TypeInfo const& t)
 {
-  this->OS << " size=\"" << t.Width << "\"";
-  this->OS << " align=\"" << t.Align << "\"";
+  this->OH.UIntAttribute("size", t.Width);
+  this->OH.UIntAttribute("align", t.Align);
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintBaseTypeAttribute(clang::Type const* c, bool complete)
+template <typename Handler>
+void ASTVisitor<Handler>::PrintBaseTypeAttribute(
+  clang::Type const* c, bool complete)
 {
-  this->OS << " basetype=\"";
-  this->PrintTypeIdRef(clang::QualType(c, 0), complete);
-  this->OS << "\"";
+  this->PrintTypeIdRefAttribute("basetype", clang::QualType(c, 0), complete);
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintTypeAttribute(clang::QualType t, bool complete)
+template <typename Handler>
+void ASTVisitor<Handler>::PrintTypeAttribute(clang::QualType t, bool complete)
 {
-  this->OS << " type=\"";
-  this->PrintTypeIdRef(t, complete);
-  this->OS << "\"";
+  this->PrintTypeIdRefAttribute("type", t, complete);
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintReturnsAttribute(clang::QualType t, bool complete)
+template <typename Handler>
+void
+ASTVisitor<Handler>::PrintReturnsAttribute(clang::QualType t, bool complete)
 {
-  this->OS << " returns=\"";
-  this->PrintTypeIdRef(t, complete);
-  this->OS << "\"";
+  this->PrintTypeIdRefAttribute("returns", t, complete);
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintLocationAttribute(clang::Decl const* d)
+template <typename Handler>
+void ASTVisitor<Handler>::PrintLocationAttribute(clang::Decl const* d)
 {
+  // System header stubs have no locations, so their files are not
+  // listed either.
+  if(!this->WantAttribute(Options::AttributeLocation) ||
+     this->IsSystemStubDecl(d)) {
+    return;
+  }
+
   clang::SourceLocation sl = d->getLocation();
-  if(sl.isValid()) {
-    clang::FullSourceLoc fsl = this->CTX.getFullLoc(sl).getExpansionLoc();
-    if (clang::FileEntry const* f =
-        this->CI.getSourceManager().getFileEntryForID(fsl.getFileID())) {
-      unsigned int id = this->AddDumpFile(f);
-      unsigned int line = fsl.getExpansionLineNumber();
-      this->OS <<
-        " location=\"f" << id << ":" << line << "\""
-        " file=\"f" << id << "\""
-        " line=\"" << line << "\"";
+  if(sl.isValid() && this->Opts.PreprocessedSnapshot) {
+    // The line markers of a snapshot name the original file and line.
+    clang::SourceManager const& sm = this->CI.getSourceManager();
+    clang::PresumedLoc const pl =
+      sm.getPresumedLoc(sm.getExpansionLoc(sl));
+    if(clang::FileEntry const* f = this->GetPresumedFile(pl)) {
+      unsigned int const id = this->AddDumpFile(f);
+      if(!this->NodeFile) {
+        this->NodeFile = id;
+      }
+      this->OH.LocationAttribute("location", id, pl.getLine());
+      this->OH.RefAttribute("file", OutputHandler::Ref('f', id));
+      this->OH.UIntAttribute("line", pl.getLine());
+      return;
+    }
+  } else if(sl.isValid()) {
+    // Decompose the expansion location once for both the file and the
+    // line.  The line table lookup starts from the line found for the
+    // last query in the same file, so declarations that follow one
+    // another are found quickly.
+    clang::SourceManager const& sm = this->CI.getSourceManager();
+    std::pair<clang::FileID, unsigned int> const loc =
+      sm.getDecomposedExpansionLoc(sl);
+    if(unsigned int id = this->GetLocationFile(loc.first)) {
+      unsigned int line = sm.getLineNumber(loc.first, loc.second);
+      if(!this->NodeFile) {
+        this->NodeFile = id;
+      }
+      this->OH.LocationAttribute("location", id, line);
+      this->OH.RefAttribute("file", OutputHandler::Ref('f', id));
+      this->OH.UIntAttribute("line", line);
       return;
     }
   }
   if(d->isImplicit()) {
     this->FileBuiltin = true;
-    this->OS << " location=\"f0:0\" file=\"f0\" line=\"0\"";
+    this->OH.LocationAttribute("location", 0, 0);
+    this->OH.RefAttribute("file", OutputHandler::Ref('f', 0));
+    this->OH.UIntAttribute("line", 0);
   }
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintAccessAttribute(clang::AccessSpecifier as)
+template <typename Handler>
+void ASTVisitor<Handler>::PrintAccessAttribute(clang::AccessSpecifier as)
 {
   if (as == clang::AS_private) {
-    this->OS << " access=\"private\"";
+    this->OH.StringAttribute("access", "private");
   } else if (as == clang::AS_protected) {
-    this->OS << " access=\"protected\"";
+    this->OH.StringAttribute("access", "protected");
   } else {
-    this->OS << " access=\"public\"";
+    this->OH.StringAttribute("access", "public");
   }
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintContextAttribute(clang::Decl const* d)
+template <typename Handler>
+void ASTVisitor<Handler>::PrintContextAttribute(clang::Decl const* d)
 {
   clang::DeclContext const* dc = d->getDeclContext();
   if(DumpId id = this->GetContextIdRef(dc)) {
-    this->OS << " context=\"_" << id << "\"";
+    this->PrintIdRefAttribute("context", id);
     if (dc->isRecord()) {
       this->PrintAccessAttribute(d->getAccess());
     }
@@ -1132,61 +2629,84 @@ void ASTVisitor::PrintContextAttribute(clang::Decl const* d)
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintMembersAttribute(clang::DeclContext const* dc)
+template <typename Handler>
+void ASTVisitor<Handler>::PrintMembersAttribute(clang::DeclContext const* dc)
 {
-  std::set<DumpId> emitted;
+  DumpIdList& emitted = this->MemberScratch;
+  emitted.clear();
   this->AddDeclContextMembers(dc, emitted);
   this->PrintMembersAttribute(emitted);
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintMembersAttribute(std::set<DumpId> const& emitted)
+template <typename Handler>
+void ASTVisitor<Handler>::PrintMembersAttribute(DumpIdList& emitted)
 {
   if(!emitted.empty()) {
-    this->OS << " members=\"";
-    const char* sep = "";
-    for(std::set<DumpId>::const_iterator i = emitted.begin(),
-          e = emitted.end(); i != e; ++i) {
-      this->OS << sep << "_" << *i;
-      sep = " ";
-    }
-    this->OS << "\"";
+    // Print each member once in order of id.
+    std::sort(emitted.begin(), emitted.end());
+    emitted.erase(std::unique(emitted.begin(), emitted.end()),
+                  emitted.end());
+    this->PrintIdListAttribute("members", emitted);
+  }
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void ASTVisitor<Handler>::PrintIdListAttribute(llvm::StringRef name,
+                                               DumpIdList const& ids)
+{
+  // Take the references only after all the nodes have been added
+  // because new stable ids may move the storage of earlier ones.
+  this->RefScratch.clear();
+  for(DumpIdList::const_iterator i = ids.begin(), e = ids.end();
+      i != e; ++i) {
+    this->RefScratch.push_back(this->GetRef(*i));
   }
+  this->OH.RefAttribute(name, this->RefScratch);
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintBasesAttribute(clang::CXXRecordDecl const* dx)
+template <typename Handler>
+void ASTVisitor<Handler>::PrintBasesAttribute(clang::CXXRecordDecl const* dx)
 {
-  this->OS << " bases=\"";
-  const char* sep = "";
+  DumpIdList ids;
+  llvm::SmallVector<llvm::StringRef, 4> access;
   for(clang::CXXRecordDecl::base_class_const_iterator i = dx->bases_begin(),
         e = dx->bases_end(); i != e; ++i) {
-    this->OS << sep;
-    sep = " ";
     switch (i->getAccessSpecifier()) {
-    case clang::AS_private: this->OS << "private:"; break;
-    case clang::AS_protected: this->OS << "protected:"; break;
-    default: break;
+    case clang::AS_private: access.push_back("private"); break;
+    case clang::AS_protected: access.push_back("protected"); break;
+    default: access.push_back(""); break;
     }
-    this->PrintTypeIdRef(i->getType().getCanonicalType(), true);
+    ids.push_back(
+      this->AddTypeDumpNode(i->getType().getCanonicalType(), true));
   }
-  this->OS << "\"";
+  this->RefScratch.clear();
+  for(size_t i = 0; i < ids.size(); ++i) {
+    OutputHandler::Ref r = this->GetRef(ids[i]);
+    r.Access = access[i];
+    this->RefScratch.push_back(r);
+  }
+  this->OH.RefAttribute("bases", this->RefScratch);
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintFunctionTypeAttributes(clang::FunctionProtoType const* t)
+template <typename Handler>
+void ASTVisitor<Handler>::PrintFunctionTypeAttributes(
+  clang::FunctionProtoType const* t)
 {
   switch (t->getExtInfo().getCC()) {
   case clang::CallingConv::CC_C:
     break;
   case clang::CallingConv::CC_X86StdCall:
-    this->OS << " attributes=\"__stdcall__\"";
+    this->OH.StringAttribute("attributes", "__stdcall__");
     break;
   case clang::CallingConv::CC_X86FastCall:
-    this->OS << " attributes=\"__fastcall__\"";
+    this->OH.StringAttribute("attributes", "__fastcall__");
     break;
   case clang::CallingConv::CC_X86ThisCall:
-    this->OS << " attributes=\"__thiscall__\"";
+    this->OH.StringAttribute("attributes", "__thiscall__");
     break;
   default:
     break;
@@ -1194,29 +2714,29 @@ void ASTVisitor::PrintFunctionTypeAttributes(clang::FunctionProtoType const* t)
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintThrowsAttribute(clang::FunctionProtoType const* fpt,
-                                      bool complete)
+template <typename Handler>
+void
+ASTVisitor<Handler>::PrintThrowsAttribute(clang::FunctionProtoType const* fpt,
+                                          bool complete)
 {
   if(fpt && fpt->hasDynamicExceptionSpec()) {
     clang::FunctionProtoType::exception_iterator i = fpt->exception_begin();
     clang::FunctionProtoType::exception_iterator e = fpt->exception_end();
-    this->OS << " throw=\"";
-    const char* sep = "";
+    DumpIdList ids;
     for(;i != e; ++i) {
-      this->OS << sep;
-      this->PrintTypeIdRef(*i, complete);
-      sep = " ";
+      ids.push_back(this->AddTypeDumpNode(*i, complete));
     }
-    this->OS << "\"";
+    this->PrintIdListAttribute("throw", ids);
   }
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::PrintBefriendingAttribute(clang::CXXRecordDecl const* dx)
+template <typename Handler>
+void
+ASTVisitor<Handler>::PrintBefriendingAttribute(clang::CXXRecordDecl const* dx)
 {
-  if(dx && dx->hasFriends()) {
-    this->OS << " befriending=\"";
-    const char* sep = "";
+  if(!this->Opts.Layout && dx && dx->hasFriends()) {
+    DumpIdList ids;
     for(clang::CXXRecordDecl::friend_iterator i = dx->friend_begin(),
           e = dx->friend_end(); i != e; ++i) {
       clang::FriendDecl const* fd = *i;
@@ -1227,27 +2747,25 @@ void ASTVisitor::PrintBefriendingAttribute(clang::CXXRecordDecl const* dx)
         }
 
         if(DumpId id = this->AddDeclDumpNode(nd, false)) {
-          this->OS << sep << "_" << id;
-          sep = " ";
+          ids.push_back(id);
         }
       } else if(clang::TypeSourceInfo const* tsi = fd->getFriendType()) {
-        this->OS << sep;
-        this->PrintTypeIdRef(tsi->getType(), false);
-        sep = " ";
+        ids.push_back(this->AddTypeDumpNode(tsi->getType(), false));
       }
     }
-    this->OS << "\"";
+    this->PrintIdListAttribute("befriending", ids);
   }
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputFunctionHelper(clang::FunctionDecl const* d,
-                                      DumpNode const* dn,
-                                      const char* tag,
-                                      std::string const& name,
-                                      unsigned int flags)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputFunctionHelper(clang::FunctionDecl const* d,
+                                               DumpNode const* dn,
+                                               const char* tag,
+                                               llvm::StringRef name,
+                                               unsigned int flags)
 {
-  this->OS << "  <" << tag;
+  this->OH.StartElement(tag);
   this->PrintIdAttribute(dn);
   if(!name.empty()) {
     this->PrintNameAttribute(name);
@@ -1259,28 +2777,28 @@ void ASTVisitor::OutputFunctionHelper(clang::FunctionDecl const* d,
   this->PrintLocationAttribute(d);
 
   if(flags & FH_Static) {
-    this->OS << " static=\"1\"";
+    this->OH.UIntAttribute("static", 1);
   }
   if(flags & FH_Explicit) {
-    this->OS << " explicit=\"1\"";
+    this->OH.UIntAttribute("explicit", 1);
   }
   if(flags & FH_Const) {
-    this->OS << " const=\"1\"";
+    this->OH.UIntAttribute("const", 1);
   }
   if(flags & FH_Virtual) {
-    this->OS << " virtual=\"1\"";
+    this->OH.UIntAttribute("virtual", 1);
   }
   if(flags & FH_Pure) {
-    this->OS << " pure_virtual=\"1\"";
+    this->OH.UIntAttribute("pure_virtual", 1);
   }
   if(d->isInlined()) {
-    this->OS << " inline=\"1\"";
+    this->OH.UIntAttribute("inline", 1);
   }
   if(d->getStorageClass() == clang::SC_Extern) {
-    this->OS << " extern=\"1\"";
+    this->OH.UIntAttribute("extern", 1);
   }
   if(d->isImplicit()) {
-    this->OS << " artificial=\"1\"";
+    this->OH.UIntAttribute("artificial", 1);
   }
 
   if (clang::FunctionProtoType const* fpt =
@@ -1294,7 +2812,6 @@ void ASTVisitor::OutputFunctionHelper(clang::FunctionDecl const* d,
   }
 
   if(unsigned np = d->getNumParams()) {
-    this->OS << ">\n";
     for (unsigned i = 0; i < np; ++i) {
       // Use the default argument from the most recent declaration.
       // Clang accumulates the defaults and only the last one has
@@ -1309,111 +2826,116 @@ void ASTVisitor::OutputFunctionHelper(clang::FunctionDecl const* d,
       this->OutputFunctionArgument(d->getParamDecl(i), dn->Complete, def);
     }
     if(d->isVariadic()) {
-      this->OS << "    <Ellipsis/>\n";
+      this->OH.StartElement("Ellipsis");
+      this->OH.EndElement();
     }
-    this->OS << "  </" << tag << ">\n";
-  } else {
-    this->OS << "/>\n";
   }
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputFunctionTypeHelper(clang::FunctionProtoType const* t,
-                                          DumpNode const* dn, const char* tag,
-                                          clang::Type const* c)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputFunctionTypeHelper(
+  clang::FunctionProtoType const* t, DumpNode const* dn, const char* tag,
+  clang::Type const* c)
 {
-  this->OS << "  <" << tag;
+  this->OH.StartElement(tag);
   this->PrintIdAttribute(dn);
   if(c) {
     this->PrintBaseTypeAttribute(c, dn->Complete);
   }
   this->PrintReturnsAttribute(t->getReturnType(), dn->Complete);
   if(t->isConst()) {
-    this->OS << " const=\"1\"";
+    this->OH.UIntAttribute("const", 1);
   }
   if(t->isVolatile()) {
-    this->OS << " volatile=\"1\"";
+    this->OH.UIntAttribute("volatile", 1);
   }
   if(t->isRestrict()) {
-    this->OS << " restrict=\"1\"";
+    this->OH.UIntAttribute("restrict", 1);
   }
   this->PrintFunctionTypeAttributes(t);
   if(t->param_type_begin() != t->param_type_end()) {
-    this->OS << ">\n";
     for (clang::FunctionProtoType::param_type_iterator
            i = t->param_type_begin(), e = t->param_type_end(); i != e; ++i) {
-      this->OS << "    <Argument";
+      this->OH.StartElement("Argument");
       this->PrintTypeAttribute(*i, dn->Complete);
-      this->OS << "/>\n";
+      this->OH.EndElement();
     }
     if(t->isVariadic()) {
-      this->OS << "    <Ellipsis/>\n";
+      this->OH.StartElement("Ellipsis");
+      this->OH.EndElement();
     }
-    this->OS << "  </" << tag << ">\n";
-  } else {
-    this->OS << "/>\n";
   }
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputFunctionArgument(clang::ParmVarDecl const* a,
-                                        bool complete, clang::Expr const* def)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputFunctionArgument(
+  clang::ParmVarDecl const* a, bool complete, clang::Expr const* def)
 {
-  this->OS << "    <Argument";
-  std::string name = a->getName().str();
+  this->OH.StartElement("Argument");
+  llvm::StringRef name = a->getName();
   if(!name.empty()) {
     this->PrintNameAttribute(name);
   }
   this->PrintTypeAttribute(a->getType(), complete);
   this->PrintLocationAttribute(a);
-  if(def) {
-    this->OS << " default=\"";
-    std::string s;
-    llvm::raw_string_ostream rso(s);
-    def->printPretty(rso, 0, this->PrintingPolicy);
-    this->OS << encodeXML(rso.str());
-    this->OS << "\"";
+  if(def && this->WantAttribute(Options::AttributeDefault)) {
+    std::pair<llvm::DenseMap<clang::Expr const*, std::string>::iterator,
+              bool> r =
+      this->DefaultArgTexts.insert(std::make_pair(def, std::string()));
+    if(r.second) {
+      llvm::raw_string_ostream rso(r.first->second);
+      def->printPretty(rso, 0, this->PrintingPolicy);
+    }
+    this->OH.StringAttribute("default", r.first->second);
   }
-  this->OS << "/>\n";
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputTranslationUnitDecl(
+template <typename Handler>
+void ASTVisitor<Handler>::OutputTranslationUnitDecl(
   clang::TranslationUnitDecl const* d, DumpNode const* dn)
 {
-  this->OS << "  <Namespace";
+  this->OH.StartElement("Namespace");
   this->PrintIdAttribute(dn);
   this->PrintNameAttribute("::");
   if(dn->Complete) {
     this->PrintMembersAttribute(d);
   }
-  this->OS << "/>\n";
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputNamespaceDecl(
+template <typename Handler>
+void ASTVisitor<Handler>::OutputNamespaceDecl(
   clang::NamespaceDecl const* d, DumpNode const* dn)
 {
-  this->OS << "  <Namespace";
+  this->OH.StartElement("Namespace");
   this->PrintIdAttribute(dn);
-  std::string name = d->getName().str();
+  llvm::StringRef name = d->getName();
   if (!name.empty()) {
     this->PrintNameAttribute(name);
   }
   this->PrintContextAttribute(d);
   if(dn->Complete) {
-    std::set<DumpId> emitted;
+    DumpIdList& emitted = this->MemberScratch;
+    emitted.clear();
     for (clang::NamespaceDecl const* r: d->redecls()) {
       this->AddDeclContextMembers(r, emitted);
     }
     this->PrintMembersAttribute(emitted);
   }
-  this->OS << "/>\n";
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputRecordDecl(clang::RecordDecl const* d,
-                                  DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputRecordDecl(clang::RecordDecl const* d,
+                                           DumpNode const* dn)
 {
   const char* tag;
   switch (d->getTagKind()) {
@@ -1426,11 +2948,11 @@ void ASTVisitor::OutputRecordDecl(clang::RecordDecl const* d,
   clang::CXXRecordDecl const* dx = clang::dyn_cast<clang::CXXRecordDecl>(d);
   bool doBases = false;
 
-  this->OS << "  <" << tag;
+  this->OH.StartElement(tag);
   this->PrintIdAttribute(dn);
   if(!d->isAnonymousStructOrUnion()) {
-    std::string s;
-    llvm::raw_string_ostream rso(s);
+    this->PrintScratch.clear();
+    llvm::raw_svector_ostream rso(this->PrintScratch);
     d->getNameForDiagnostic(rso, this->PrintingPolicy, false);
     this->PrintNameAttribute(rso.str());
   }
@@ -1438,7 +2960,7 @@ void ASTVisitor::OutputRecordDecl(clang::RecordDecl const* d,
   this->PrintLocationAttribute(d);
   if(d->getDefinition()) {
     if(dx && dx->isAbstract()) {
-      this->OS << " abstract=\"1\"";
+      this->OH.UIntAttribute("abstract", 1);
     }
     if(dn->Complete) {
       this->PrintMembersAttribute(d);
@@ -1449,28 +2971,26 @@ void ASTVisitor::OutputRecordDecl(clang::RecordDecl const* d,
       this->PrintBefriendingAttribute(dx);
     }
   } else {
-    this->OS << " incomplete=\"1\"";
+    this->OH.UIntAttribute("incomplete", 1);
   }
   this->PrintABIAttributes(d);
   if(doBases) {
-    this->OS << ">\n";
     for(clang::CXXRecordDecl::base_class_const_iterator i = dx->bases_begin(),
           e = dx->bases_end(); i != e; ++i) {
-      this->OS << "    <Base";
+      this->OH.StartElement("Base");
       this->PrintTypeAttribute(i->getType().getCanonicalType(), true);
       this->PrintAccessAttribute(i->getAccessSpecifier());
-      this->OS << " virtual=\"" << (i->isVirtual()? 1 : 0) << "\"";
-      this->OS << "/>\n";
+      this->OH.UIntAttribute("virtual", i->isVirtual()? 1 : 0);
+      this->OH.EndElement();
     }
-    this->OS << "  </" << tag << ">\n";
-  } else {
-    this->OS << "/>\n";
   }
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputCXXRecordDecl(clang::CXXRecordDecl const* d,
-                                     DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputCXXRecordDecl(clang::CXXRecordDecl const* d,
+                                              DumpNode const* dn)
 {
   if(d->getDescribedClassTemplate()) {
     // We do not implement class template output yet.
@@ -1482,109 +3002,121 @@ void ASTVisitor::OutputCXXRecordDecl(clang::CXXRecordDecl const* d,
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputClassTemplateSpecializationDecl(
+template <typename Handler>
+void ASTVisitor<Handler>::OutputClassTemplateSpecializationDecl(
   clang::ClassTemplateSpecializationDecl const* d, DumpNode const* dn)
 {
   this->OutputCXXRecordDecl(d, dn);
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputTypedefDecl(clang::TypedefDecl const* d,
-                                   DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputTypedefDecl(clang::TypedefDecl const* d,
+                                            DumpNode const* dn)
 {
-  this->OS << "  <Typedef";
+  this->OH.StartElement("Typedef");
   this->PrintIdAttribute(dn);
-  this->PrintNameAttribute(d->getName().str());
+  this->PrintNameAttribute(d->getName());
   this->PrintTypeAttribute(d->getUnderlyingType(), dn->Complete);
   this->PrintContextAttribute(d);
   this->PrintLocationAttribute(d);
-  this->OS << "/>\n";
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputEnumDecl(clang::EnumDecl const* d, DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputEnumDecl(
+  clang::EnumDecl const* d, DumpNode const* dn)
 {
-  this->OS << "  <Enumeration";
+  this->OH.StartElement("Enumeration");
   this->PrintIdAttribute(dn);
-  std::string name = d->getName().str();
+  llvm::StringRef name = d->getName();
   if(name.empty()) {
     if(clang::TypedefNameDecl const* td = d->getTypedefNameForAnonDecl()) {
-      name = td->getName().str();
+      name = td->getName();
     }
   }
   this->PrintNameAttribute(name);
   this->PrintContextAttribute(d);
   this->PrintLocationAttribute(d);
+  // The layout gives the storage of the underlying integer type.
+  if(this->Opts.Layout) {
+    this->PrintABIAttributes(d);
+  }
   clang::EnumDecl::enumerator_iterator enum_begin = d->enumerator_begin();
   clang::EnumDecl::enumerator_iterator enum_end = d->enumerator_end();
   if(enum_begin != enum_end) {
-    this->OS << ">\n";
     for(clang::EnumDecl::enumerator_iterator i = enum_begin;
         i != enum_end; ++i) {
       clang::EnumConstantDecl const* ecd = *i;
-      this->OS << "    <EnumValue";
+      this->OH.StartElement("EnumValue");
       this->PrintNameAttribute(ecd->getName());
-      this->OS << " init=\"" << ecd->getInitVal() << "\"";
-      this->OS << "/>\n";
+      this->PrintIntAttribute("init", ecd->getInitVal(),
+                              ecd->getInitVal().isSigned());
+      this->OH.EndElement();
     }
-    this->OS << "  </Enumeration>\n";
-  } else {
-    this->OS << "/>\n";
   }
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputFieldDecl(clang::FieldDecl const* d, DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputFieldDecl(
+  clang::FieldDecl const* d, DumpNode const* dn)
 {
-  this->OS << "  <Field";
+  this->OH.StartElement("Field");
   this->PrintIdAttribute(dn);
-  this->PrintNameAttribute(d->getName().str());
+  this->PrintNameAttribute(d->getName());
   this->PrintTypeAttribute(d->getType(), dn->Complete);
   if(d->isBitField()) {
     unsigned bits = d->getBitWidthValue(this->CTX);
-    this->OS << " bits=\"" << bits << "\"";
+    this->OH.UIntAttribute("bits", bits);
   }
   this->PrintContextAttribute(d);
   this->PrintLocationAttribute(d);
-  this->PrintOffsetAttribute(this->CTX.getFieldOffset(d));
+  if(this->WantAttribute(Options::AttributeOffset)) {
+    this->PrintOffsetAttribute(this->CTX.getFieldOffset(d));
+  }
   if(d->isMutable()) {
-    this->OS << " mutable=\"1\"";
+    this->OH.UIntAttribute("mutable", 1);
   }
 
-  this->OS << "/>\n";
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputVarDecl(clang::VarDecl const* d, DumpNode const* dn)
+template <typename Handler>
+void
+ASTVisitor<Handler>::OutputVarDecl(clang::VarDecl const* d, DumpNode const* dn)
 {
-  this->OS << "  <Variable";
+  this->OH.StartElement("Variable");
   this->PrintIdAttribute(dn);
-  this->PrintNameAttribute(d->getName().str());
+  this->PrintNameAttribute(d->getName());
   this->PrintTypeAttribute(d->getType(), dn->Complete);
-  if(clang::Expr const* init = d->getInit()) {
-    this->OS << " init=\"";
-    std::string s;
-    llvm::raw_string_ostream rso(s);
+  clang::Expr const* init = d->getInit();
+  if(init && this->WantAttribute(Options::AttributeInit)) {
+    this->PrintScratch.clear();
+    llvm::raw_svector_ostream rso(this->PrintScratch);
     init->printPretty(rso, 0, this->PrintingPolicy);
-    this->OS << encodeXML(rso.str());
-    this->OS << "\"";
+    this->OH.StringAttribute("init", rso.str());
   }
   this->PrintContextAttribute(d);
   this->PrintLocationAttribute(d);
   if(d->getStorageClass() == clang::SC_Static) {
-    this->OS << " static=\"1\"";
+    this->OH.UIntAttribute("static", 1);
   }
   if(d->getStorageClass() == clang::SC_Extern) {
-    this->OS << " extern=\"1\"";
+    this->OH.UIntAttribute("extern", 1);
   }
   this->PrintMangledAttribute(d);
 
-  this->OS << "/>\n";
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputFunctionDecl(clang::FunctionDecl const* d,
-                                    DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputFunctionDecl(clang::FunctionDecl const* d,
+                                             DumpNode const* dn)
 {
   if(d->getDescribedFunctionTemplate()) {
     // We do not implement function template output yet.
@@ -1600,13 +3132,14 @@ void ASTVisitor::OutputFunctionDecl(clang::FunctionDecl const* d,
     this->OutputFunctionHelper(d, dn, "OperatorFunction",
       clang::getOperatorSpelling(d->getOverloadedOperator()), flags);
   } else {
-    this->OutputFunctionHelper(d, dn, "Function", d->getName().str(), flags);
+    this->OutputFunctionHelper(d, dn, "Function", d->getName(), flags);
   }
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputCXXMethodDecl(clang::CXXMethodDecl const* d,
-                                     DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputCXXMethodDecl(clang::CXXMethodDecl const* d,
+                                              DumpNode const* dn)
 {
   if(d->getDescribedFunctionTemplate()) {
     // We do not implement function template output yet.
@@ -1631,13 +3164,15 @@ void ASTVisitor::OutputCXXMethodDecl(clang::CXXMethodDecl const* d,
     this->OutputFunctionHelper(d, dn, "OperatorMethod",
       clang::getOperatorSpelling(d->getOverloadedOperator()), flags);
   } else {
-    this->OutputFunctionHelper(d, dn, "Method", d->getName().str(), flags);
+    this->OutputFunctionHelper(d, dn, "Method", d->getName(), flags);
   }
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputCXXConversionDecl(clang::CXXConversionDecl const* d,
-                                         DumpNode const* dn)
+template <typename Handler>
+void
+ASTVisitor<Handler>::OutputCXXConversionDecl(clang::CXXConversionDecl const* d,
+                                             DumpNode const* dn)
 {
   if(d->getDescribedFunctionTemplate()) {
     // We do not implement function template output yet.
@@ -1659,8 +3194,9 @@ void ASTVisitor::OutputCXXConversionDecl(clang::CXXConversionDecl const* d,
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputCXXConstructorDecl(clang::CXXConstructorDecl const* d,
-                                          DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputCXXConstructorDecl(
+  clang::CXXConstructorDecl const* d, DumpNode const* dn)
 {
   if(d->getDescribedFunctionTemplate()) {
     // We do not implement function template output yet.
@@ -1677,8 +3213,10 @@ void ASTVisitor::OutputCXXConstructorDecl(clang::CXXConstructorDecl const* d,
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputCXXDestructorDecl(clang::CXXDestructorDecl const* d,
-                                         DumpNode const* dn)
+template <typename Handler>
+void
+ASTVisitor<Handler>::OutputCXXDestructorDecl(clang::CXXDestructorDecl const* d,
+                                             DumpNode const* dn)
 {
   if(d->getDescribedFunctionTemplate()) {
     // We do not implement function template output yet.
@@ -1698,14 +3236,15 @@ void ASTVisitor::OutputCXXDestructorDecl(clang::CXXDestructorDecl const* d,
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputBuiltinType(clang::BuiltinType const* t,
-                                   DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputBuiltinType(clang::BuiltinType const* t,
+                                            DumpNode const* dn)
 {
-  this->OS << "  <FundamentalType";
+  this->OH.StartElement("FundamentalType");
   this->PrintIdAttribute(dn);
 
   // gccxml used different name variants than Clang for some types
-  std::string name;
+  llvm::StringRef name;
   switch (t->getKind()) {
   case clang::BuiltinType::Short: name = "short int"; break;
   case clang::BuiltinType::UShort: name = "short unsigned int"; break;
@@ -1713,172 +3252,640 @@ void ASTVisitor::OutputBuiltinType(clang::BuiltinType const* t,
   case clang::BuiltinType::ULong: name = "long unsigned int"; break;
   case clang::BuiltinType::LongLong: name = "long long int"; break;
   case clang::BuiltinType::ULongLong: name = "long long unsigned int"; break;
-  default: name = t->getName(this->PrintingPolicy).str(); break;
+  default: name = t->getName(this->PrintingPolicy); break;
   };
   this->PrintNameAttribute(name);
-  this->PrintABIAttributes(this->CTX.getTypeInfo(t));
+  if(this->WantAttribute(Options::AttributeSize)) {
+    this->PrintABIAttributes(this->CTX.getTypeInfo(t));
+  }
 
-  this->OS << "/>\n";
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputConstantArrayType(clang::ConstantArrayType const* t,
-                                         DumpNode const* dn)
+template <typename Handler>
+void
+ASTVisitor<Handler>::OutputConstantArrayType(clang::ConstantArrayType const* t,
+                                             DumpNode const* dn)
 {
-  this->OS << "  <ArrayType";
+  this->OH.StartElement("ArrayType");
   this->PrintIdAttribute(dn);
-  this->OS << " min=\"0\" max=\"" << (t->getSize()-1) << "\"";
+  this->OH.UIntAttribute("min", 0);
+  this->PrintIntAttribute("max", t->getSize() - 1, true);
   this->PrintTypeAttribute(t->getElementType(), dn->Complete);
-  this->OS << "/>\n";
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputIncompleteArrayType(clang::IncompleteArrayType const* t,
-                                           DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputIncompleteArrayType(
+  clang::IncompleteArrayType const* t, DumpNode const* dn)
 {
-  this->OS << "  <ArrayType";
+  this->OH.StartElement("ArrayType");
   this->PrintIdAttribute(dn);
-  this->OS << " min=\"0\" max=\"\"";
+  this->OH.UIntAttribute("min", 0);
+  this->OH.StringAttribute("max", "");
   this->PrintTypeAttribute(t->getElementType(), dn->Complete);
-  this->OS << "/>\n";
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputFunctionProtoType(clang::FunctionProtoType const* t,
-                                         DumpNode const* dn)
+template <typename Handler>
+void
+ASTVisitor<Handler>::OutputFunctionProtoType(clang::FunctionProtoType const* t,
+                                             DumpNode const* dn)
 {
   this->OutputFunctionTypeHelper(t, dn, "FunctionType", 0);
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputLValueReferenceType(clang::LValueReferenceType const* t,
-                                           DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputLValueReferenceType(
+  clang::LValueReferenceType const* t, DumpNode const* dn)
 {
-  this->OS << "  <ReferenceType";
+  this->OH.StartElement("ReferenceType");
   this->PrintIdAttribute(dn);
   this->PrintTypeAttribute(t->getPointeeType(), false);
-  this->OS << "/>\n";
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputMemberPointerType(clang::MemberPointerType const* t,
-                                         DumpNode const* dn)
+template <typename Handler>
+void
+ASTVisitor<Handler>::OutputMemberPointerType(clang::MemberPointerType const* t,
+                                             DumpNode const* dn)
 {
   if(t->isMemberDataPointerType()) {
     this->OutputOffsetType(t->getPointeeType(), t->getClass(), dn);
   } else {
-    this->OS << "  <PointerType";
+    this->OH.StartElement("PointerType");
     this->PrintIdAttribute(dn);
     DumpId id = this->AddTypeDumpNode(
       DumpType(t->getPointeeType(), t->getClass()), false);
-    this->OS << " type=\"_" << id << "\"";
-    this->OS << "/>\n";
+    this->PrintIdRefAttribute("type", id);
+    this->OH.EndElement();
   }
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputMethodType(clang::FunctionProtoType const* t,
-                                  clang::Type const* c, DumpNode const* dn)
+template <typename Handler>
+void
+ASTVisitor<Handler>::OutputMethodType(clang::FunctionProtoType const* t,
+                                      clang::Type const* c, DumpNode const* dn)
 {
   this->OutputFunctionTypeHelper(t, dn, "MethodType", c);
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputOffsetType(clang::QualType t, clang::Type const* c,
-                                  DumpNode const* dn)
+template <typename Handler>
+void
+ASTVisitor<Handler>::OutputOffsetType(clang::QualType t, clang::Type const* c,
+                                      DumpNode const* dn)
 {
-  this->OS << "  <OffsetType";
+  this->OH.StartElement("OffsetType");
   this->PrintIdAttribute(dn);
   this->PrintBaseTypeAttribute(c, dn->Complete);
   this->PrintTypeAttribute(t, dn->Complete);
-  this->OS << "/>\n";
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::OutputPointerType(clang::PointerType const* t,
-                                   DumpNode const* dn)
+template <typename Handler>
+void ASTVisitor<Handler>::OutputPointerType(clang::PointerType const* t,
+                                            DumpNode const* dn)
 {
-  this->OS << "  <PointerType";
+  this->OH.StartElement("PointerType");
   this->PrintIdAttribute(dn);
   this->PrintTypeAttribute(t->getPointeeType(), false);
-  this->OS << "/>\n";
+  this->OH.EndElement();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::LookupStart(clang::DeclContext const* dc,
-                             std::string const& name)
+template <typename Handler>
+bool ASTVisitor<Handler>::IsInPartition(clang::Decl const* d)
 {
-  std::string::size_type pos = name.find("::");
-  std::string cur = name.substr(0, pos);
+  // Start names or declarations are dealt to the parts instead.
+  if(this->Opts.PartitionCount < 2 || !this->Opts.StartNames.empty() ||
+     this->Opts.StartDecls) {
+    return true;
+  }
 
-  clang::IdentifierTable& ids = CI.getPreprocessor().getIdentifierTable();
-  auto const& result = dc->lookup(clang::DeclarationName(&ids.get(cur)));
-  if(pos == name.npos) {
-    for (clang::NamedDecl const* n: result) {
-      this->AddStartDecl(n);
+  // The members of these contexts are members of the enclosing one,
+  // and are dealt one by one.
+  if(clang::isa<clang::LinkageSpecDecl>(d)) {
+    return true;
+  }
+  if(clang::NamespaceDecl const* nd =
+     clang::dyn_cast<clang::NamespaceDecl>(d)) {
+    if(nd->isInline()) {
+      return true;
     }
-  } else {
-    std::string rest = name.substr(pos+2);
-    for (clang::NamedDecl const* n: result) {
-      if (clang::DeclContext const* idc =
-          clang::dyn_cast<clang::DeclContext const>(n)) {
-        this->LookupStart(idc, rest);
-      }
+  }
+  clang::DeclContext const* dc = d->getDeclContext();
+  while(dc->isTransparentContext() || dc->isInlineNamespace()) {
+    dc = dc->getParent();
+  }
+  if(!dc->isTranslationUnit()) {
+    return true;
+  }
+
+  // All declarations of one name share a slot so that overloads and
+  // the parts of a reopened namespace are written by one part.
+  clang::NamedDecl const* nd = clang::dyn_cast<clang::NamedDecl>(d);
+  void const* key = nd && !nd->getDeclName().isEmpty()?
+    nd->getDeclName().getAsOpaquePtr() :
+    static_cast<void const*>(d->getCanonicalDecl());
+  unsigned int const slot = this->PartitionSlots.insert(
+    std::make_pair(key, this->PartitionSlots.size())).first->second;
+  return slot % this->Opts.PartitionCount == this->Opts.PartitionIndex;
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+void ASTVisitor<Handler>::LookupStart(clang::DeclContext const* dc,
+                                      std::vector<std::string> const& names)
+{
+  // Add the declarations in the order of the names so the ids do not
+  // depend on the order the lookup finds them.
+  std::vector<std::vector<clang::NamedDecl const*>> decls;
+  {
+    TraceRegion tr("Lookup start",
+                   traceEnabled()? std::to_string(names.size()) + " names" :
+                   std::string());
+    lookupStartDecls(this->CI, dc, names, decls);
+  }
+  for(std::vector<clang::NamedDecl const*> const& d : decls) {
+    for (clang::NamedDecl const* n: d) {
+      this->AddStartDecl(n);
     }
   }
+}
 
-  for (clang::UsingDirectiveDecl const* i : dc->using_directives()) {
-    this->LookupStart(i->getNominatedNamespace(), name);
+//----------------------------------------------------------------------------
+template <typename Handler>
+void ASTVisitor<Handler>::ProcessStart()
+{
+  // Dump the complete nodes.
+  this->RequireComplete = true;
+  {
+    PhaseRegion t("Complete elements");
+    TraceRegion tr("Complete elements");
+    this->ProcessQueue();
+  }
+
+  // Queue all the incomplete nodes.
+  this->RequireComplete = false;
+  {
+    PhaseRegion t("Incomplete elements");
+    TraceRegion tr("Incomplete elements");
+    this->QueueIncompleteDumpNodes();
+
+    // Dump the incomplete nodes.
+    this->ProcessQueue();
+  }
+
+  // Dump the filename queue.
+  {
+    PhaseRegion t("File elements");
+    TraceRegion tr("File elements");
+    this->ProcessFileQueue();
   }
+
+  // Dump the strings referenced by the elements above.
+  this->ProcessStringTable();
 }
 
 //----------------------------------------------------------------------------
-void ASTVisitor::HandleTranslationUnit(clang::TranslationUnitDecl const* tu)
+template <typename Handler>
+void ASTVisitor<Handler>::HandleTranslationUnit(
+  clang::TranslationUnitDecl const* tu)
 {
+  // Deal the start names to the parts of '--castxml-partition'.
+  std::vector<std::string> names;
+  for(size_t i = this->Opts.PartitionIndex;
+      i < this->Opts.StartNames.size(); i += this->Opts.PartitionCount) {
+    names.push_back(this->Opts.StartNames[i]);
+  }
+
   // Add the starting nodes for the dump.
-  if(!this->Opts.StartNames.empty()) {
-    // Use the specified starting locations.
-    for(std::vector<std::string>::const_iterator
-          i = this->Opts.StartNames.begin(), e = this->Opts.StartNames.end();
-        i != e; ++i) {
-      this->LookupStart(tu, *i);
+  std::vector<std::vector<clang::NamedDecl const*>> progressive;
+  if(this->Opts.StartDecls) {
+    // Use this part of the declarations given by the caller.
+    std::vector<clang::Decl const*> const& decls = *this->Opts.StartDecls;
+    for(size_t i = this->Opts.PartitionIndex; i < decls.size();
+        i += this->Opts.PartitionCount) {
+      this->AddStartDecl(decls[i]);
     }
+  } else if(!this->Opts.StartNames.empty() && this->Opts.Progressive) {
+    // Add the declarations of each name when its turn comes.
+    TraceRegion tr("Lookup start",
+                   traceEnabled()?
+                   std::to_string(names.size()) + " names" :
+                   std::string());
+    lookupStartDecls(this->CI, tu, names, progressive);
+  } else if(!this->Opts.StartNames.empty()) {
+    // Use the specified starting locations.
+    this->LookupStart(tu, names);
   } else {
-    // No start specified.  Use whole translation unit.
+    // No start specified.  Use whole translation unit, or with
+    // '--castxml-partition' the members IsInPartition deals this part.
     this->AddStartDecl(tu);
   }
 
+  // The index lists the declarations reached from the start without
+  // following their types, so there are no incomplete nodes or files.
+  if(this->Opts.Index) {
+    PhaseRegion t("Index entries");
+    TraceRegion tr("Index entries");
+    this->ProcessQueue();
+    return;
+  }
+
   // Start dump with gccxml-compatible format.
-  this->OS <<
-    "<?xml version=\"1.0\"?>\n"
-    "<GCC_XML version=\"0.9.0\" cvs_revision=\"1.136\">\n"
-    ;
+  this->OH.StartDocument();
 
-  // Dump the complete nodes.
-  this->ProcessQueue();
+  if(progressive.empty()) {
+    this->ProcessStart();
+  } else {
+    // Write the elements reached from each start name in turn and give
+    // them to the client before looking at the next name.
+    for(std::vector<clang::NamedDecl const*> const& decls : progressive) {
+      for(clang::NamedDecl const* n : decls) {
+        this->AddStartDecl(n);
+      }
+      this->ProcessStart();
+      this->Out.flush();
+    }
+  }
 
-  // Queue all the incomplete nodes.
-  this->RequireComplete = false;
-  this->QueueIncompleteDumpNodes();
+  // Write the offset index now that every element has been output.
+  if(!this->Opts.OutputIndexFile.empty()) {
+    this->WriteOffsetIndex();
+  }
 
-  // Dump the incomplete nodes.
-  this->ProcessQueue();
+  // Finish dump.
+  this->OH.EndDocument();
 
-  // Dump the filename queue.
-  this->ProcessFileQueue();
+  // Report memory use now that every table is at its largest.
+  if(this->Opts.MemReport) {
+    this->WriteMemoryReport();
+  }
 
-  // Finish dump.
-  this->OS <<
-    "</GCC_XML>\n"
-    ;
+  if(this->Stats) {
+    this->WriteStatsReport();
+  }
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+static void outputToVisitor(clang::CompilerInstance& ci,
+                            clang::ASTContext& ctx,
+                            llvm::raw_ostream& os,
+                            Options const& opts,
+                            Handler& oh,
+                            OutputStatsHandler* stats,
+                            clang::MangleContext* mangle)
+{
+  if(opts.DisableFree) {
+    // Leak the node tables rather than free them one by one.  Their
+    // output has been given to the handler by now.
+    ASTVisitor<Handler>* v =
+      new ASTVisitor<Handler>(ci, ctx, os, opts, oh, stats, mangle);
+    v->HandleTranslationUnit(ctx.getTranslationUnitDecl());
+    clang::BuryPointer(v);
+    return;
+  }
+  ASTVisitor<Handler> v(ci, ctx, os, opts, oh, stats, mangle);
+  v.HandleTranslationUnit(ctx.getTranslationUnitDecl());
+}
+
+//----------------------------------------------------------------------------
+static void outputToHandler(clang::CompilerInstance& ci,
+                            clang::ASTContext& ctx,
+                            llvm::raw_ostream& os,
+                            Options const& opts,
+                            OutputHandler& oh,
+                            clang::MangleContext* mangle)
+{
+  if(opts.Stats) {
+    // The statistics handler counts the events on their way to oh.
+    std::unique_ptr<OutputStatsHandler> stats(new OutputStatsHandler(oh));
+    outputToVisitor<OutputHandler>(ci, ctx, os, opts, *stats, stats.get(),
+                                   mangle);
+    return;
+  }
+  outputToVisitor<OutputHandler>(ci, ctx, os, opts, oh, nullptr, mangle);
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+static void outputToFinalHandler(clang::CompilerInstance& ci,
+                                 clang::ASTContext& ctx,
+                                 llvm::raw_ostream& os,
+                                 Options const& opts,
+                                 Handler& oh,
+                                 clang::MangleContext* mangle)
+{
+  // Give the events straight to the handler's own methods unless they
+  // are to be counted on the way.
+  if(opts.Stats) {
+    outputToHandler(ci, ctx, os, opts, oh, mangle);
+    return;
+  }
+  outputToVisitor<Handler>(ci, ctx, os, opts, oh, nullptr, mangle);
+}
+
+//----------------------------------------------------------------------------
+template <typename Handler>
+static void outputToFormat(clang::CompilerInstance& ci,
+                           clang::ASTContext& ctx,
+                           llvm::raw_ostream& os,
+                           Options const& opts,
+                           Handler& oh,
+                           clang::MangleContext* mangle)
+{
+  if(!opts.HeaderCacheDir.empty()) {
+    // Give the events to the cache, which replaces those of elements
+    // it has and adds the others.
+    HeaderCache headers(ci, oh, opts);
+    Options cacheOpts = opts;
+    cacheOpts.HeaderFragments = &headers;
+    outputToHandler(ci, ctx, os, cacheOpts, headers, mangle);
+    headers.Save();
+    return;
+  }
+  outputToFinalHandler(ci, ctx, os, opts, oh, mangle);
+}
+
+//----------------------------------------------------------------------------
+void outputEvents(clang::CompilerInstance& ci,
+                  clang::ASTContext& ctx,
+                  OutputHandler& handler,
+                  Options const& opts)
+{
+  // The handler takes the output so there is no document stream.
+  llvm::raw_null_ostream os;
+  outputToHandler(ci, ctx, os, opts, handler, 0);
+}
+
+//----------------------------------------------------------------------------
+void outputTable(clang::CompilerInstance& ci,
+                 clang::ASTContext& ctx,
+                 OutputTable& table,
+                 Options const& opts)
+{
+  std::unique_ptr<OutputHandler> handler = createTableHandler(table);
+  outputEvents(ci, ctx, *handler, opts);
+  if(table.Overflowed()) {
+    clang::DiagnosticsEngine& diags = ci.getDiagnostics();
+    diags.Report(diags.getCustomDiagID(
+      clang::DiagnosticsEngine::Error,
+      "output has too many elements for the in-memory table; "
+      "write one format at a time"));
+  }
+}
+
+//----------------------------------------------------------------------------
+void outputEstimate(clang::CompilerInstance& ci,
+                    clang::ASTContext& ctx,
+                    llvm::raw_ostream& os,
+                    Options const& opts)
+{
+  XMLSize size;
+  XMLSizeHandler handler(size);
+  // The handler measures the output so there is no document stream.
+  llvm::raw_null_ostream doc;
+  outputToFinalHandler(ci, ctx, doc, opts, handler, 0);
+  os << "castxml estimate:\n"
+    "  nodes: " << size.Nodes << "\n"
+    "  files: " << size.Files << "\n"
+    "  bytes: " << size.Bytes << "\n";
+}
+
+//----------------------------------------------------------------------------
+namespace {
+/// StartTrie - The qualified start names split at each "::", with the
+/// names sharing leading components sharing their nodes so that each
+/// component is looked up once in a context however many names use it.
+/// A component containing '*' or '?' is a pattern matched against the
+/// names of the declarations in the context instead.
+struct StartTrie
+{
+  struct Node
+  {
+    Node(llvm::StringRef name): Name(name) {}
+    llvm::StringRef Name;
+
+    // The node of each next component, those of the next components
+    // that are patterns, and the names ending here.
+    std::map<llvm::StringRef, size_t> Children;
+    std::vector<size_t> Patterns;
+    std::vector<size_t> Names;
+  };
+  std::vector<Node> Nodes;
+
+  StartTrie(std::vector<std::string> const& names):
+    Nodes(1, Node(llvm::StringRef())) {
+    for(size_t i = 0; i < names.size(); ++i) {
+      size_t node = 0;
+      llvm::StringRef rest = names[i];
+      for(;;) {
+        size_t const pos = rest.find("::");
+        llvm::StringRef const cur = rest.substr(0, pos);
+        std::map<llvm::StringRef, size_t>::iterator c =
+          this->Nodes[node].Children.find(cur);
+        if(c == this->Nodes[node].Children.end()) {
+          size_t const child = this->Nodes.size();
+          this->Nodes[node].Children[cur] = child;
+          if(cur.find_first_of("*?") != cur.npos) {
+            this->Nodes[node].Patterns.push_back(child);
+          }
+          this->Nodes.push_back(Node(cur));
+          node = child;
+        } else {
+          node = c->second;
+        }
+        if(pos == rest.npos) {
+          break;
+        }
+        rest = rest.substr(pos + 2);
+      }
+      this->Nodes[node].Names.push_back(i);
+    }
+  }
+};
+}
+
+//----------------------------------------------------------------------------
+static bool matchStartPattern(llvm::StringRef pattern, llvm::StringRef name)
+{
+  // Match '*' to any run of characters and '?' to any one character,
+  // retrying from the last '*' after a mismatch.
+  size_t p = 0;
+  size_t n = 0;
+  size_t star = pattern.npos;
+  size_t mark = 0;
+  while(n < name.size()) {
+    if(p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+      ++p;
+      ++n;
+    } else if(p < pattern.size() && pattern[p] == '*') {
+      star = p++;
+      mark = n;
+    } else if(star != pattern.npos) {
+      p = star + 1;
+      n = ++mark;
+    } else {
+      return false;
+    }
+  }
+  while(p < pattern.size() && pattern[p] == '*') {
+    ++p;
+  }
+  return p == pattern.size();
+}
+
+static void lookupStartTrie(clang::IdentifierTable& ids,
+                            clang::DeclContext const* dc,
+                            StartTrie const& trie, size_t node,
+                            std::vector<std::vector<
+                              clang::NamedDecl const*>>& decls);
+
+//----------------------------------------------------------------------------
+static void matchStartTrie(clang::IdentifierTable& ids,
+                           clang::DeclContext const* dc,
+                           StartTrie const& trie, size_t node,
+                           std::vector<std::vector<
+                             clang::NamedDecl const*>>& decls)
+{
+  StartTrie::Node const& parent = trie.Nodes[node];
+  for (clang::Decl const* d : dc->decls()) {
+    // Members of transparent contexts, such as linkage specifications
+    // and unscoped enumerations, and of inline namespaces are visible
+    // in the enclosing context.
+    if (clang::DeclContext const* tdc =
+        clang::dyn_cast<clang::DeclContext const>(d)) {
+      if(tdc->isTransparentContext() || tdc->isInlineNamespace()) {
+        matchStartTrie(ids, tdc, trie, node, decls);
+      }
+    }
+
+    // Match each entity once, by its name, as lookup would find it.
+    clang::NamedDecl const* n = clang::dyn_cast<clang::NamedDecl const>(d);
+    if(!n || n->isImplicit() || n->getCanonicalDecl() != n ||
+       !n->getDeclName().isIdentifier()) {
+      continue;
+    }
+    for(size_t p : parent.Patterns) {
+      StartTrie::Node const& child = trie.Nodes[p];
+      if(!matchStartPattern(child.Name, n->getName())) {
+        continue;
+      }
+      for(size_t i : child.Names) {
+        decls[i].push_back(n);
+      }
+      if(!child.Children.empty()) {
+        if (clang::DeclContext const* idc =
+            clang::dyn_cast<clang::DeclContext const>(n)) {
+          lookupStartTrie(ids, idc, trie, p, decls);
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+static void lookupStartTrie(clang::IdentifierTable& ids,
+                            clang::DeclContext const* dc,
+                            StartTrie const& trie, size_t node,
+                            std::vector<std::vector<
+                              clang::NamedDecl const*>>& decls)
+{
+  for(auto const& c : trie.Nodes[node].Children) {
+    StartTrie::Node const& child = trie.Nodes[c.second];
+    if(c.first.find_first_of("*?") != c.first.npos) {
+      continue;
+    }
+    auto const& result =
+      dc->lookup(clang::DeclarationName(&ids.get(c.first)));
+    for (clang::NamedDecl const* n: result) {
+      for(size_t i : child.Names) {
+        decls[i].push_back(n);
+      }
+      if(!child.Children.empty()) {
+        if (clang::DeclContext const* idc =
+            clang::dyn_cast<clang::DeclContext const>(n)) {
+          lookupStartTrie(ids, idc, trie, c.second, decls);
+        }
+      }
+    }
+  }
+
+  // Match the patterns against the declarations of every part of a
+  // namespace, in order, in the same walk.
+  if(!trie.Nodes[node].Patterns.empty()) {
+    llvm::SmallVector<clang::DeclContext*, 4> contexts;
+    const_cast<clang::DeclContext*>(dc)->collectAllContexts(contexts);
+    for(clang::DeclContext const* ctx : contexts) {
+      matchStartTrie(ids, ctx, trie, node, decls);
+    }
+  }
+
+  for (clang::UsingDirectiveDecl const* i : dc->using_directives()) {
+    lookupStartTrie(ids, i->getNominatedNamespace(), trie, node, decls);
+  }
+}
+
+//----------------------------------------------------------------------------
+void lookupStartDecls(clang::CompilerInstance& ci,
+                      clang::DeclContext const* dc,
+                      std::vector<std::string> const& names,
+                      std::vector<std::vector<
+                        clang::NamedDecl const*>>& decls)
+{
+  StartTrie trie(names);
+  decls.resize(names.size());
+  lookupStartTrie(ci.getPreprocessor().getIdentifierTable(), dc, trie, 0,
+                  decls);
 }
 
 //----------------------------------------------------------------------------
 void outputXML(clang::CompilerInstance& ci,
                clang::ASTContext& ctx,
                llvm::raw_ostream& os,
-               Options const& opts)
+               Options const& opts,
+               clang::MangleContext* mangle)
 {
-  ASTVisitor v(ci, ctx, os, opts);
-  v.HandleTranslationUnit(ctx.getTranslationUnitDecl());
+  // The index is written directly to the stream.
+  if(opts.Index) {
+    NullOutputHandler handler;
+    outputToHandler(ci, ctx, os, opts, handler, mangle);
+    return;
+  }
+
+  // Each format's final handler gets a traversal of its own.
+  std::unique_ptr<OutputSink> sink;
+  if(!opts.DiffAgainstFile.empty()) {
+    sink = createDiffSink(ci, os, opts.DiffAgainstFile);
+  } else if(!opts.OutputShardDir.empty()) {
+    sink = createShardSink(ci, os, opts.OutputShardDir);
+  } else if(opts.OutputFormat == "bin") {
+    BinaryHandler handler(os);
+    outputToFormat(ci, ctx, os, opts, handler, mangle);
+    return;
+  } else if(opts.OutputFormat == "json") {
+    JSONHandler handler(os);
+    outputToFormat(ci, ctx, os, opts, handler, mangle);
+    return;
+  } else if(opts.OutputFormat == "sql") {
+    SQLHandler handler(os);
+    outputToFormat(ci, ctx, os, opts, handler, mangle);
+    return;
+  } else if(opts.OutputFormat == "fingerprint") {
+    FingerprintHandler handler(os);
+    outputToFormat(ci, ctx, os, opts, handler, mangle);
+    return;
+  }
+  XMLOutputHandler handler(sink? sink->NodeStream() : os, sink.get());
+  outputToFormat(ci, ctx, os, opts, handler, mangle);
 }
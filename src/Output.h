@@ -18,6 +18,11 @@
 
 #include <cxsys/Configure.hxx>
 
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
 namespace llvm {
   class raw_ostream;
 }
@@ -25,14 +30,68 @@ namespace llvm {
 namespace clang {
   class CompilerInstance;
   class ASTContext;
+  class ClassTemplateDecl;
+  class Decl;
+  class DeclContext;
+  class MangleContext;
+  class NamedDecl;
 }
 
+class OutputHandler;
+class OutputTable;
 struct Options;
 
-/// outputXML - Print a gccxml-compatible AST dump.
+/// TemplateOutputCounts - The specializations of each class template
+/// that were instantiated and given to the output along with their
+/// template, collected for '--castxml-template-report' when the
+/// Options::TemplateOutput given to the output names it.
+struct TemplateOutputCounts
+{
+  std::map<clang::ClassTemplateDecl const*,
+           std::set<clang::Decl const*> > Specializations;
+};
+
+/// outputXML - Print a gccxml-compatible AST dump.  Mangled names are
+/// computed with the given mangling context, if any, so that several
+/// dumps of one translation unit share its state.
 void outputXML(clang::CompilerInstance& ci,
                clang::ASTContext& ctx,
                llvm::raw_ostream& os,
-               Options const& opts);
+               Options const& opts,
+               clang::MangleContext* mangle = 0);
+
+/// outputTable - Fill a table with the gccxml-compatible AST dump
+/// elements so that it may be written by several consumers.  The
+/// output index file option is not supported.
+void outputTable(clang::CompilerInstance& ci,
+                 clang::ASTContext& ctx,
+                 OutputTable& table,
+                 Options const& opts);
+
+/// outputEvents - Give the gccxml-compatible AST dump to a handler as
+/// element and attribute events.  The output index file option is not
+/// supported.
+void outputEvents(clang::CompilerInstance& ci,
+                  clang::ASTContext& ctx,
+                  OutputHandler& handler,
+                  Options const& opts);
+
+/// outputEstimate - Write to the stream the number of nodes and File
+/// elements and the bytes of the document outputXML would write.
+void outputEstimate(clang::CompilerInstance& ci,
+                    clang::ASTContext& ctx,
+                    llvm::raw_ostream& os,
+                    Options const& opts);
+
+/// lookupStartDecls - Find the declarations named by each (qualified)
+/// --castxml-start name within the given context, in one walk of the
+/// contexts shared by all the names, and give those of each name in the
+/// corresponding entry of decls.  Components of a name containing '*'
+/// or '?' are glob patterns matching the names of declarations.
+void lookupStartDecls(clang::CompilerInstance& ci,
+                      clang::DeclContext const* dc,
+                      std::vector<std::string> const& names,
+                      std::vector<std::vector<
+                        clang::NamedDecl const*>>& decls);
 
 #endif // CASTXML_OUTPUT_H
@@ -0,0 +1,240 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_OUTPUTBINARY_H
+#define CASTXML_OUTPUTBINARY_H
+
+#include <cxsys/Configure.hxx>
+
+#include "OutputHandler.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <utility>
+#include <vector>
+#include <stdint.h>
+
+/// BinaryHandler - Handler writing each element as a length-prefixed
+/// binary record, created by createBinaryHandler.  Attribute values are
+/// typed as the events give them, and strings refer to a string table
+/// written at the end.
+class BinaryHandler final: public OutputHandler
+{
+  enum { Version = 3 };
+
+  // The kind of value of each attribute.
+  enum {
+    KindString, KindUInt, KindInt, KindLocation, KindRefs
+  };
+
+  // The flags of each reference.
+  enum {
+    RefConst = 1, RefVolatile = 2, RefRestrict = 4,
+    RefPrivate = 8, RefProtected = 16, RefStable = 32
+  };
+
+  llvm::raw_ostream& OS;
+  llvm::StringMap<uint32_t> StringIndex;
+  std::vector<llvm::StringRef> Strings;
+  llvm::SmallVector<char, 512> Record;
+  uint64_t Offset;
+  uint64_t Records;
+
+  // The offset in Record of each element begun and not yet ended, and
+  // the numbers of its attributes and nested elements so far.
+  struct Open {
+    Open(size_t start): Start(start), Attributes(0), Children(0) {}
+    size_t Start;
+    uint32_t Attributes;
+    uint32_t Children;
+  };
+  llvm::SmallVector<Open, 4> Stack;
+
+  uint32_t Intern(llvm::StringRef s) {
+    std::pair<llvm::StringMap<uint32_t>::iterator, bool> r =
+      this->StringIndex.insert(
+        std::make_pair(s, static_cast<uint32_t>(this->Strings.size())));
+    if(r.second) {
+      this->Strings.push_back(r.first->getKey());
+    }
+    return r.first->getValue();
+  }
+
+  static void Put32(llvm::SmallVectorImpl<char>& out, uint32_t v) {
+    char b[4] = { char(v), char(v >> 8), char(v >> 16), char(v >> 24) };
+    out.append(b, b + 4);
+  }
+
+  static void Put64(llvm::SmallVectorImpl<char>& out, uint64_t v) {
+    Put32(out, static_cast<uint32_t>(v));
+    Put32(out, static_cast<uint32_t>(v >> 32));
+  }
+
+  static void Set32(llvm::SmallVectorImpl<char>& out, size_t at,
+                    uint32_t v) {
+    for(int i = 0; i < 4; ++i) {
+      out[at + i] = char(v >> (8 * i));
+    }
+  }
+
+  void Write(llvm::SmallVectorImpl<char> const& out) {
+    this->OS.write(out.data(), out.size());
+    this->Offset += out.size();
+  }
+
+  void PutAttribute(llvm::StringRef name, uint32_t kind, uint64_t value) {
+    ++this->Stack.back().Attributes;
+    Put32(this->Record, this->Intern(name));
+    Put32(this->Record, kind);
+    Put64(this->Record, value);
+  }
+
+  void PutRef(Ref const& r) {
+    uint32_t flags = 0;
+    for(char q : r.Qual) {
+      flags |= q == 'c'? RefConst : q == 'v'? RefVolatile : RefRestrict;
+    }
+    if(r.Access == "private") {
+      flags |= RefPrivate;
+    } else if(r.Access == "protected") {
+      flags |= RefProtected;
+    }
+    uint64_t value = r.Id;
+    if(!r.Stable.empty()) {
+      flags |= RefStable;
+      value = this->Intern(r.Stable);
+    }
+    Put32(this->Record, static_cast<unsigned char>(r.Prefix));
+    Put32(this->Record, flags);
+    Put64(this->Record, value);
+  }
+
+public:
+  BinaryHandler(llvm::raw_ostream& os): OS(os), Offset(0), Records(0) {}
+
+  void StartDocument() override {
+    llvm::SmallVector<char, 16> header;
+    header.append("CastXMLB", "CastXMLB" + 8);
+    Put32(header, Version);
+    Put32(header, 0);
+    this->Write(header);
+  }
+
+  void StartElement(llvm::StringRef tag) override {
+    if(!this->Stack.empty()) {
+      ++this->Stack.back().Children;
+    }
+    this->Stack.push_back(Open(this->Record.size()));
+    Put32(this->Record, 0);
+    Put32(this->Record, this->Intern(tag));
+    Put64(this->Record, 0);
+    Put32(this->Record, 0);
+    Put32(this->Record, 0);
+  }
+
+  void StringAttribute(llvm::StringRef name,
+                       llvm::StringRef value) override {
+    this->PutAttribute(name, KindString, this->Intern(value));
+  }
+
+  void IntAttribute(llvm::StringRef name, int64_t value) override {
+    // Only negative values are signed so that a value is written the
+    // same whichever method gives it.
+    if(value < 0) {
+      this->PutAttribute(name, KindInt, static_cast<uint64_t>(value));
+    } else {
+      this->PutAttribute(name, KindUInt, static_cast<uint64_t>(value));
+    }
+  }
+
+  void UIntAttribute(llvm::StringRef name, uint64_t value) override {
+    this->PutAttribute(name, KindUInt, value);
+  }
+
+  void RefAttribute(llvm::StringRef name,
+                    llvm::ArrayRef<Ref> refs) override {
+    this->PutAttribute(name, KindRefs, refs.size());
+    for(Ref const& r : refs) {
+      this->PutRef(r);
+    }
+  }
+
+  void LocationAttribute(llvm::StringRef name, unsigned int file,
+                         unsigned int line) override {
+    this->PutAttribute(name, KindLocation, uint64_t(file) << 32 | line);
+  }
+
+  void EndElement() override {
+    // Fill in the size of the record after its size field, and the
+    // numbers of its attributes and nested elements.
+    Open const& open = this->Stack.back();
+    llvm::SmallVectorImpl<char>& r = this->Record;
+    Set32(r, open.Start, static_cast<uint32_t>(r.size() - open.Start - 4));
+    Set32(r, open.Start + 16, open.Attributes);
+    Set32(r, open.Start + 20, open.Children);
+    this->Stack.pop_back();
+  }
+
+  void ElementText(llvm::StringRef xml) override {
+    replayOutputText(*this, xml);
+  }
+
+  void EndNode(uint64_t id, unsigned int) override {
+    Set32(this->Record, 8, static_cast<uint32_t>(id));
+    Set32(this->Record, 12, static_cast<uint32_t>(id >> 32));
+    this->Write(this->Record);
+    this->Record.clear();
+    ++this->Records;
+  }
+
+  void EndDocument() override {
+    // Write the strings, each NUL-terminated and 4-byte aligned,
+    // followed by a table of their offsets within the strings.
+    uint64_t const stringsOffset = this->Offset;
+    std::vector<uint64_t> offsets;
+    offsets.reserve(this->Strings.size());
+    llvm::SmallVector<char, 256> out;
+    for(std::vector<llvm::StringRef>::const_iterator
+          i = this->Strings.begin(), e = this->Strings.end(); i != e; ++i) {
+      offsets.push_back(this->Offset - stringsOffset);
+      out.clear();
+      Put32(out, static_cast<uint32_t>(i->size()));
+      out.append(i->begin(), i->end());
+      do {
+        out.push_back('\0');
+      } while(out.size() % 4);
+      this->Write(out);
+    }
+    uint64_t const offsetsOffset = this->Offset;
+    out.clear();
+    for(std::vector<uint64_t>::const_iterator i = offsets.begin(),
+          e = offsets.end(); i != e; ++i) {
+      Put64(out, *i);
+    }
+    this->Write(out);
+
+    // Write a fixed-size trailer locating the tables.
+    out.clear();
+    Put64(out, stringsOffset);
+    Put64(out, offsetsOffset);
+    Put64(out, this->Strings.size());
+    Put64(out, this->Records);
+    this->Write(out);
+  }
+};
+
+#endif // CASTXML_OUTPUTBINARY_H
@@ -0,0 +1,148 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "OutputSink.h"
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendDiagnostic.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <system_error>
+
+//----------------------------------------------------------------------------
+static llvm::StringRef getElementId(llvm::StringRef xml)
+{
+  // The id is the first attribute of an element's start tag.
+  size_t const end = xml.find('>');
+  size_t const start = xml.substr(0, end).find(" id=\"");
+  if(start == llvm::StringRef::npos) {
+    return llvm::StringRef();
+  }
+  llvm::StringRef id = xml.substr(start + 5);
+  return id.substr(0, id.find('"'));
+}
+
+//----------------------------------------------------------------------------
+/// Sink writing only the elements that differ from those with the same
+/// stable id in an earlier gccxml-format document, followed by a
+/// Removed element for each id that no longer appears and by every
+/// File element.
+class DiffSink: public OutputSink
+{
+  llvm::raw_ostream& OS;
+  std::unique_ptr<llvm::MemoryBuffer> Old;
+
+  // The text of each element of the earlier document by id, and
+  // whether an element with that id was seen in this one.
+  struct OldElement {
+    OldElement(): Seen(false) {}
+    llvm::StringRef Text;
+    bool Seen;
+  };
+  llvm::StringMap<OldElement> OldElements;
+  std::vector<llvm::StringRef> OldOrder;
+  std::string Files;
+
+  bool Load(llvm::StringRef xml) {
+    // Skip the XML declaration and the document element's start tag.
+    size_t start = xml.find("<GCC_XML");
+    if(start != llvm::StringRef::npos) {
+      start = xml.find('>', start);
+    }
+    if(start == llvm::StringRef::npos) {
+      return false;
+    }
+    xml = xml.drop_front(start + 1);
+    for(;;) {
+      xml = xml.ltrim();
+      if(xml.empty() || xml.startswith("</GCC_XML>")) {
+        return true;
+      }
+      llvm::StringRef const text = xml;
+      OutputElement e;
+      if(!parseOutputElement(xml, e)) {
+        return false;
+      }
+      llvm::StringRef const id = getElementId(text);
+      if(e.Tag == "File" || e.Tag == "Removed" || id.empty()) {
+        continue;
+      }
+      OldElement& old = this->OldElements[id];
+      if(old.Text.empty()) {
+        this->OldOrder.push_back(id);
+      }
+      old.Text = text.substr(0, text.size() - xml.size()).rtrim();
+    }
+  }
+
+public:
+  DiffSink(clang::CompilerInstance& ci, llvm::raw_ostream& os,
+           std::string const& old): OS(os) {
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+      llvm::MemoryBuffer::getFile(old);
+    if(buffer) {
+      this->Old = std::move(buffer.get());
+    }
+    if(!this->Old || !this->Load(this->Old->getBuffer())) {
+      ci.getDiagnostics().Report(clang::diag::err_fe_error_reading) << old;
+      this->OldElements.clear();
+      this->OldOrder.clear();
+    }
+    this->OS <<
+      "<?xml version=\"1.0\"?>\n"
+      "<GCC_XML version=\"0.9.0\" cvs_revision=\"1.136\">\n"
+      ;
+  }
+
+  void Node(uint64_t id, unsigned int file,
+            llvm::StringRef xml) override {
+    if(id == 0) {
+      // File elements are always listed since ids refer to them.
+      this->Files.append(xml.data(), xml.size());
+      return;
+    }
+    llvm::StringMap<OldElement>::iterator i =
+      this->OldElements.find(getElementId(xml));
+    if(i != this->OldElements.end()) {
+      i->getValue().Seen = true;
+      if(i->getValue().Text == xml.trim()) {
+        return;
+      }
+    }
+    this->OS << xml;
+  }
+
+  void Finish() override {
+    for(llvm::StringRef id : this->OldOrder) {
+      if(!this->OldElements[id].Seen) {
+        this->OS << "  <Removed id=\"" << id << "\"/>\n";
+      }
+    }
+    this->OS << this->Files <<
+      "</GCC_XML>\n"
+      ;
+  }
+};
+
+//----------------------------------------------------------------------------
+std::unique_ptr<OutputSink> createDiffSink(clang::CompilerInstance& ci,
+                                           llvm::raw_ostream& os,
+                                           std::string const& old)
+{
+  return std::unique_ptr<OutputSink>(new DiffSink(ci, os, old));
+}
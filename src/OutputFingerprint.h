@@ -0,0 +1,129 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_OUTPUTFINGERPRINT_H
+#define CASTXML_OUTPUTFINGERPRINT_H
+
+#include <cxsys/Configure.hxx>
+
+#include "OutputHandler.h"
+#include "OutputXML.h"
+#include "Utils.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/raw_ostream.h"
+
+/// FingerprintHandler - Handler writing for each element with a node id
+/// the id and a hash of its tag, attributes and nested elements apart
+/// from their locations, created by createFingerprintHandler.  A change
+/// of the declaration changes its hash but moving it within its file
+/// does not.
+class FingerprintHandler final: public OutputHandler
+{
+  llvm::raw_ostream& OS;
+
+  // Digest of the top-level element begun last, and the text of its id.
+  std::unique_ptr<Hasher> Hash;
+  llvm::SmallString<32> Id;
+
+  // Number of elements begun and not yet ended.
+  unsigned int Depth;
+
+  // Text of the value of the attribute given last.
+  llvm::SmallString<64> Value;
+
+  static bool IsLocation(llvm::StringRef name) {
+    return name == "location" || name == "file" || name == "line";
+  }
+
+  void Attribute(llvm::StringRef name) {
+    if(this->Depth == 1 && name == "id") {
+      this->Id = this->Value;
+    }
+    if(!IsLocation(name)) {
+      this->Hash->AppendBytes(name.data(), name.size());
+      this->Hash->AppendBytes("", 1);
+      this->Hash->AppendBytes(this->Value.data(), this->Value.size());
+      this->Hash->AppendBytes("", 1);
+    }
+    this->Value.clear();
+  }
+
+public:
+  FingerprintHandler(llvm::raw_ostream& os): OS(os), Depth(0) {}
+
+  void StartElement(llvm::StringRef tag) override {
+    // Mark the nesting so that children are not taken as attributes.
+    if(this->Depth++) {
+      this->Hash->AppendBytes("<", 1);
+    } else {
+      this->Hash.reset(new Hasher);
+      this->Id.clear();
+    }
+    this->Hash->AppendBytes(tag.data(), tag.size());
+    this->Hash->AppendBytes("", 1);
+  }
+
+  void StringAttribute(llvm::StringRef name,
+                       llvm::StringRef value) override {
+    this->Value = value;
+    this->Attribute(name);
+  }
+
+  void IntAttribute(llvm::StringRef name, int64_t value) override {
+    appendDecimal(this->Value, value);
+    this->Attribute(name);
+  }
+
+  void UIntAttribute(llvm::StringRef name, uint64_t value) override {
+    appendDecimal(this->Value, value);
+    this->Attribute(name);
+  }
+
+  void RefAttribute(llvm::StringRef name,
+                    llvm::ArrayRef<Ref> refs) override {
+    for(size_t i = 0; i < refs.size(); ++i) {
+      if(i) {
+        this->Value.push_back(' ');
+      }
+      appendOutputRef(this->Value, refs[i]);
+    }
+    this->Attribute(name);
+  }
+
+  void LocationAttribute(llvm::StringRef name, unsigned int,
+                         unsigned int) override {
+    this->Attribute(name);
+  }
+
+  void EndElement() override {
+    if(--this->Depth) {
+      this->Hash->AppendBytes(">", 1);
+    }
+  }
+
+  void ElementText(llvm::StringRef xml) override {
+    replayOutputText(*this, xml);
+  }
+
+  void EndNode(uint64_t id, unsigned int) override {
+    // File and String elements are not declarations.
+    if(id) {
+      this->OS << this->Id << ' ' << this->Hash->FinalizeHex() << '\n';
+    }
+  }
+};
+
+#endif // CASTXML_OUTPUTFINGERPRINT_H
@@ -0,0 +1,215 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "OutputHandler.h"
+#include "OutputBinary.h"
+#include "OutputFingerprint.h"
+#include "OutputJSON.h"
+#include "OutputSQL.h"
+#include "OutputSink.h"
+#include "OutputXML.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/raw_ostream.h"
+
+//----------------------------------------------------------------------------
+void writeOutputRef(llvm::raw_ostream& os, OutputHandler::Ref const& r)
+{
+  llvm::SmallString<64> buf;
+  appendOutputRef(buf, r);
+  os << buf.str();
+}
+
+//----------------------------------------------------------------------------
+static bool isRefAttribute(llvm::StringRef name, bool internStrings)
+{
+  static char const* const names[] = {
+    "id", "type", "returns", "context", "basetype", "members",
+    "befriending", "bases", "throw", "file"
+  };
+  for(char const* n : names) {
+    if(name == n) {
+      return true;
+    }
+  }
+  return internStrings && (name == "name" || name == "mangled");
+}
+
+//----------------------------------------------------------------------------
+static bool isIntAttribute(llvm::StringRef tag, llvm::StringRef name,
+                           llvm::StringRef value)
+{
+  static char const* const names[] = {
+    "size", "align", "offset", "line", "bits", "min", "const",
+    "volatile", "restrict", "static", "explicit", "virtual",
+    "pure_virtual", "inline", "extern", "artificial", "abstract",
+    "incomplete", "mutable"
+  };
+  for(char const* n : names) {
+    if(name == n) {
+      return true;
+    }
+  }
+  // The init of a Variable is an expression, and the max of an
+  // IncompleteArrayType is empty.
+  return (name == "init" && tag == "EnumValue") ||
+    (name == "max" && !value.empty());
+}
+
+//----------------------------------------------------------------------------
+static bool parseOutputRef(llvm::StringRef text, OutputHandler::Ref& r)
+{
+  // A base class reference may be prefixed by its access.
+  std::pair<llvm::StringRef, llvm::StringRef> a = text.split(':');
+  if(!a.second.empty()) {
+    r.Access = a.first;
+    text = a.second;
+  }
+  if(text.size() < 2 || (text[0] != '_' && text[0] != 'f' &&
+                         text[0] != 's')) {
+    return false;
+  }
+  r.Prefix = text[0];
+  text = text.drop_front(1);
+
+  // Stable ids use upper case digits, so a lower case suffix is the
+  // cv-qualifier of a CvQualifiedType id.
+  size_t const q = text.find_last_not_of("cvr");
+  if(q == llvm::StringRef::npos) {
+    return false;
+  }
+  r.Qual = text.substr(q + 1);
+  text = text.substr(0, q + 1);
+
+  // Stable ids have 16 digits, more than any node number.
+  if(text.size() < 16 &&
+     text.find_first_not_of("0123456789") == llvm::StringRef::npos) {
+    return !text.getAsInteger(10, r.Id);
+  }
+  r.Stable = text;
+  return r.Prefix == '_';
+}
+
+//----------------------------------------------------------------------------
+void replayOutputAttribute(OutputHandler& h, llvm::StringRef tag,
+                           llvm::StringRef name, llvm::StringRef value,
+                           bool internStrings)
+{
+  if(isRefAttribute(name, internStrings)) {
+    llvm::SmallVector<llvm::StringRef, 16> texts;
+    value.split(texts, " ", -1, false);
+    llvm::SmallVector<OutputHandler::Ref, 16> refs;
+    bool ok = true;
+    for(llvm::StringRef t : texts) {
+      refs.push_back(OutputHandler::Ref(0, 0));
+      ok = ok && parseOutputRef(t, refs.back());
+    }
+    if(ok) {
+      h.RefAttribute(name, refs);
+      return;
+    }
+  } else if(isIntAttribute(tag, name, value)) {
+    // Values beyond 64 bits were given as text.
+    int64_t i;
+    uint64_t u;
+    if(value.startswith("-") && !value.getAsInteger(10, i)) {
+      h.IntAttribute(name, i);
+      return;
+    } else if(!value.startswith("-") && !value.getAsInteger(10, u)) {
+      h.UIntAttribute(name, u);
+      return;
+    }
+  } else if(name == "location" && value.startswith("f")) {
+    std::pair<llvm::StringRef, llvm::StringRef> l =
+      value.drop_front(1).split(':');
+    unsigned int file;
+    unsigned int line;
+    if(!l.first.getAsInteger(10, file) && !l.second.getAsInteger(10, line)) {
+      h.LocationAttribute(name, file, line);
+      return;
+    }
+  }
+  h.StringAttribute(name, value);
+}
+
+//----------------------------------------------------------------------------
+void replayOutputElement(OutputHandler& h, OutputElement const& e,
+                         bool internStrings)
+{
+  h.StartElement(e.Tag);
+  for(OutputElement::Attribute const& a : e.Attributes) {
+    replayOutputAttribute(h, e.Tag, a.Name, a.Value, internStrings);
+  }
+  for(OutputElement const& c : e.Children) {
+    replayOutputElement(h, c, internStrings);
+  }
+  h.EndElement();
+}
+
+//----------------------------------------------------------------------------
+void replayOutputText(OutputHandler& h, llvm::StringRef xml)
+{
+  OutputElement e;
+  while(parseOutputElement(xml, e)) {
+    replayOutputElement(h, e, false);
+    e.Clear();
+  }
+}
+
+//----------------------------------------------------------------------------
+std::unique_ptr<OutputHandler> createXMLHandler(llvm::raw_ostream& os)
+{
+  return std::unique_ptr<OutputHandler>(new XMLOutputHandler(os, nullptr));
+}
+
+//----------------------------------------------------------------------------
+std::unique_ptr<OutputHandler> createXMLHandler(OutputSink& sink)
+{
+  return std::unique_ptr<OutputHandler>(
+    new XMLOutputHandler(sink.NodeStream(), &sink));
+}
+
+//----------------------------------------------------------------------------
+std::unique_ptr<OutputHandler> createXMLSizeHandler(XMLSize& size)
+{
+  return std::unique_ptr<OutputHandler>(new XMLSizeHandler(size));
+}
+
+//----------------------------------------------------------------------------
+std::unique_ptr<OutputHandler> createJSONHandler(llvm::raw_ostream& os)
+{
+  return std::unique_ptr<OutputHandler>(new JSONHandler(os));
+}
+
+//----------------------------------------------------------------------------
+std::unique_ptr<OutputHandler> createBinaryHandler(llvm::raw_ostream& os)
+{
+  return std::unique_ptr<OutputHandler>(new BinaryHandler(os));
+}
+
+//----------------------------------------------------------------------------
+std::unique_ptr<OutputHandler> createSQLHandler(llvm::raw_ostream& os)
+{
+  return std::unique_ptr<OutputHandler>(new SQLHandler(os));
+}
+
+//----------------------------------------------------------------------------
+std::unique_ptr<OutputHandler>
+createFingerprintHandler(llvm::raw_ostream& os)
+{
+  return std::unique_ptr<OutputHandler>(new FingerprintHandler(os));
+}
@@ -0,0 +1,188 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_OUTPUTHANDLER_H
+#define CASTXML_OUTPUTHANDLER_H
+
+#include <cxsys/Configure.hxx>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace llvm {
+  class raw_ostream;
+}
+
+namespace clang {
+  class CompilerInstance;
+}
+
+class OutputSink;
+struct OutputElement;
+
+/// OutputHandler - Receive the gccxml-format output as a sequence of
+/// element and attribute events instead of as text.  The traversal
+/// calls StartElement, then the attribute methods for that element,
+/// then any nested elements, then EndElement.  Attribute values are
+/// given typed and unescaped so that a handler need not parse them.
+class OutputHandler
+{
+public:
+  /// Ref - One reference to another element in an attribute value,
+  /// such as type="_12c" or file="f1".
+  struct Ref {
+    Ref(char prefix, uint64_t id): Prefix(prefix), Id(id) {}
+
+    // The '_' of a node id, the 'f' of a File id, or the 's' of a
+    // String id.
+    char Prefix;
+
+    // The number of the referenced element.
+    uint64_t Id;
+
+    // The stable id printed in place of the number, if not empty.
+    llvm::StringRef Stable;
+
+    // The cv-qualifier suffix naming a CvQualifiedType, such as "cv".
+    llvm::StringRef Qual;
+
+    // The "private" or "protected" access of a base class, if any.
+    llvm::StringRef Access;
+  };
+
+  virtual ~OutputHandler() {}
+
+  /** Called before the first element.  */
+  virtual void StartDocument() {}
+
+  /** Begin an element nested in the one begun last, if not yet ended.  */
+  virtual void StartElement(llvm::StringRef tag) = 0;
+
+  /** Give an attribute of the element begun last.  */
+  virtual void StringAttribute(llvm::StringRef name,
+                               llvm::StringRef value) = 0;
+  virtual void IntAttribute(llvm::StringRef name, int64_t value) = 0;
+  virtual void UIntAttribute(llvm::StringRef name, uint64_t value) = 0;
+
+  /** Give an attribute listing references to other elements.  */
+  virtual void RefAttribute(llvm::StringRef name,
+                            llvm::ArrayRef<Ref> refs) = 0;
+
+  /** Give an attribute naming a line of a File, as location="f1:12".  */
+  virtual void LocationAttribute(llvm::StringRef name, unsigned int file,
+                                 unsigned int line) = 0;
+
+  /** End the element begun last.  */
+  virtual void EndElement() = 0;
+
+  /** Give the XML text of a whole top-level element, as written by
+      the handler of createXMLHandler, in place of its events.  Other
+      handlers ignore it.  */
+  virtual void ElementText(llvm::StringRef xml) {}
+
+  /** Called after each top-level element with the id and file given
+      to OutputSink::Node for it.  */
+  virtual void EndNode(uint64_t id, unsigned int file) {}
+
+  /** Called after the last element.  */
+  virtual void EndDocument() {}
+};
+
+/// writeOutputRef - Write a reference as it appears in the XML text.
+void writeOutputRef(llvm::raw_ostream& os, OutputHandler::Ref const& r);
+
+/// replayOutputAttribute - Give a handler an attribute of an element
+/// with the given tag from its XML value text, by the method and with
+/// the typed value the traversal gave it.  The name and mangled
+/// attributes reference String elements if strings are interned.
+void replayOutputAttribute(OutputHandler& h, llvm::StringRef tag,
+                           llvm::StringRef name, llvm::StringRef value,
+                           bool internStrings);
+
+/// replayOutputElement - Give a handler the events of an element parsed
+/// back from its XML text, and of the elements nested in it.
+void replayOutputElement(OutputHandler& h, OutputElement const& e,
+                         bool internStrings);
+
+/// replayOutputText - Give a handler the events of the elements in the
+/// XML text of OutputHandler::ElementText, which comes only from the
+/// header cache and so never has interned strings.
+void replayOutputText(OutputHandler& h, llvm::StringRef xml);
+
+/// createXMLHandler - Create a handler writing the events as the
+/// gccxml-format XML document to the given stream.
+std::unique_ptr<OutputHandler> createXMLHandler(llvm::raw_ostream& os);
+
+/// createXMLHandler - Create a handler writing the XML text of each
+/// top-level element to the given sink.
+std::unique_ptr<OutputHandler> createXMLHandler(OutputSink& sink);
+
+/// XMLSize - What a handler from createXMLSizeHandler measured of the
+/// gccxml-format XML document without writing it.
+struct XMLSize
+{
+  XMLSize(): Bytes(0), Nodes(0), Files(0) {}
+
+  // Bytes of the document as createXMLHandler would write it.
+  uint64_t Bytes;
+
+  // Top-level elements with a node id, and File elements.
+  uint64_t Nodes;
+  uint64_t Files;
+};
+
+/// createXMLSizeHandler - Create a handler adding to the given sizes
+/// those of the XML document createXMLHandler would write for the
+/// same events.
+std::unique_ptr<OutputHandler> createXMLSizeHandler(XMLSize& size);
+
+/// createBinaryHandler - Create a handler writing each element to the
+/// given stream in the binary format documented for
+/// '--castxml-output bin'.
+std::unique_ptr<OutputHandler> createBinaryHandler(llvm::raw_ostream& os);
+
+/// createJSONHandler - Create a handler writing each element to the
+/// given stream as one line of JSON, as documented for
+/// '--castxml-output json'.
+std::unique_ptr<OutputHandler> createJSONHandler(llvm::raw_ostream& os);
+
+/// createSQLHandler - Create a handler writing all elements to the
+/// given stream as a SQL script, as documented for
+/// '--castxml-output sql'.
+std::unique_ptr<OutputHandler> createSQLHandler(llvm::raw_ostream& os);
+
+/// createFingerprintHandler - Create a handler writing the id and hash
+/// of each element to the given stream, as documented for
+/// '--castxml-output fingerprint'.
+std::unique_ptr<OutputHandler>
+createFingerprintHandler(llvm::raw_ostream& os);
+
+/// createUnityHandler - Create a handler writing the output of the
+/// translation unit of '--castxml-unity' to one file for each header,
+/// named by the corresponding entry of files, holding the elements of
+/// the header and those they reference.  Elements of other headers and
+/// of none list only the members also written.
+std::unique_ptr<OutputHandler>
+createUnityHandler(clang::CompilerInstance& ci,
+                   std::vector<std::string> const& headers,
+                   std::vector<std::string> const& files,
+                   std::string const& compression);
+
+#endif // CASTXML_OUTPUTHANDLER_H
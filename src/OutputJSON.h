@@ -0,0 +1,135 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_OUTPUTJSON_H
+#define CASTXML_OUTPUTJSON_H
+
+#include <cxsys/Configure.hxx>
+
+#include "OutputHandler.h"
+#include "OutputXML.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Format.h"
+
+/// JSONHandler - Handler writing each top-level element as a JSON
+/// object on its own line, created by createJSONHandler.  Integer
+/// attributes are numbers and all others are strings.
+class JSONHandler final: public OutputHandler
+{
+  llvm::raw_ostream& OS;
+
+  // Whether each element begun and not yet ended has nested elements.
+  llvm::SmallVector<bool, 4> Stack;
+
+  // Text of a reference list attribute.
+  llvm::SmallString<64> Refs;
+
+  void WriteString(llvm::StringRef s) {
+    this->OS << '"';
+    const char* last = s.begin();
+    for(const char* c = s.begin(), *e = s.end(); c != e; ++c) {
+      unsigned char const ch = static_cast<unsigned char>(*c);
+      if(ch != '"' && ch != '\\' && ch >= 0x20) {
+        continue;
+      }
+      this->OS.write(last, c - last);
+      last = c + 1;
+      switch(ch) {
+      case '"': this->OS << "\\\""; break;
+      case '\\': this->OS << "\\\\"; break;
+      case '\n': this->OS << "\\n"; break;
+      case '\t': this->OS << "\\t"; break;
+      default: this->OS << llvm::format("\\u%04x", ch); break;
+      }
+    }
+    this->OS.write(last, s.end() - last);
+    this->OS << '"';
+  }
+
+  void WriteName(llvm::StringRef name) {
+    this->OS << ',';
+    this->WriteString(name);
+    this->OS << ':';
+  }
+
+public:
+  JSONHandler(llvm::raw_ostream& os): OS(os) {}
+
+  void StartElement(llvm::StringRef tag) override {
+    if(!this->Stack.empty()) {
+      if(this->Stack.back()) {
+        this->OS << ',';
+      } else {
+        this->Stack.back() = true;
+        this->OS << ",\"children\":[";
+      }
+    }
+    this->Stack.push_back(false);
+    this->OS << "{\"tag\":";
+    this->WriteString(tag);
+  }
+
+  void StringAttribute(llvm::StringRef name,
+                       llvm::StringRef value) override {
+    this->WriteName(name);
+    this->WriteString(value);
+  }
+
+  void IntAttribute(llvm::StringRef name, int64_t value) override {
+    this->WriteName(name);
+    this->OS << value;
+  }
+
+  void UIntAttribute(llvm::StringRef name, uint64_t value) override {
+    this->WriteName(name);
+    this->OS << value;
+  }
+
+  void RefAttribute(llvm::StringRef name,
+                    llvm::ArrayRef<Ref> refs) override {
+    this->Refs.clear();
+    for(size_t i = 0; i < refs.size(); ++i) {
+      if(i) {
+        this->Refs.push_back(' ');
+      }
+      appendOutputRef(this->Refs, refs[i]);
+    }
+    this->WriteName(name);
+    this->WriteString(this->Refs);
+  }
+
+  void LocationAttribute(llvm::StringRef name, unsigned int file,
+                         unsigned int line) override {
+    this->WriteName(name);
+    this->OS << "\"f" << file << ':' << line << '"';
+  }
+
+  void EndElement() override {
+    this->OS << (this->Stack.back()? "]}" : "}");
+    this->Stack.pop_back();
+  }
+
+  void ElementText(llvm::StringRef xml) override {
+    replayOutputText(*this, xml);
+  }
+
+  void EndNode(uint64_t, unsigned int) override {
+    this->OS << '\n';
+  }
+};
+
+#endif // CASTXML_OUTPUTJSON_H
@@ -0,0 +1,297 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_OUTPUTSQL_H
+#define CASTXML_OUTPUTSQL_H
+
+#include <cxsys/Configure.hxx>
+
+#include "OutputHandler.h"
+#include "OutputXML.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/// SQLHandler - Handler collecting elements into one table per element
+/// kind, plus tables for id lists and nested elements, created by
+/// createSQLHandler.  The tables are written as a SQL script that loads
+/// them in one transaction.
+class SQLHandler final: public OutputHandler
+{
+  // Insert up to this many rows per statement, within SQLite's limit
+  // on compound selects.
+  static const size_t RowsPerInsert = 256;
+
+  // A value written as a number if it is an integer, or else as text.
+  struct Value {
+    Value(std::string const& text, bool integer):
+      Text(text), Integer(integer) {}
+    std::string Text;
+    bool Integer;
+  };
+
+  struct Table {
+    std::string Name;
+    std::vector<std::string> Columns;
+    llvm::StringMap<unsigned int> ColumnIndex;
+    // Each row holds values for the columns it has, by column index.
+    typedef std::vector<std::pair<unsigned int, Value> > Row;
+    std::vector<Row> Rows;
+    bool Keyed;
+
+    Table(std::string const& name, bool keyed): Name(name), Keyed(keyed) {}
+
+    unsigned int Column(llvm::StringRef name) {
+      std::pair<llvm::StringMap<unsigned int>::iterator, bool> r =
+        this->ColumnIndex.insert(std::make_pair(
+          name, static_cast<unsigned int>(this->Columns.size())));
+      if(r.second) {
+        this->Columns.push_back(name.str());
+      }
+      return r.first->getValue();
+    }
+  };
+
+  llvm::raw_ostream& OS;
+  std::vector<Table> Tables;
+  llvm::StringMap<size_t> TableIndex;
+
+  // The table and row of each element begun and not yet ended, its id,
+  // and the number of elements nested in it so far.  Tables are named
+  // by index since adding one may move the others.
+  struct Open {
+    Open(size_t table, size_t row): Table(table), Row(row), Children(0) {}
+    size_t Table;
+    size_t Row;
+    std::string Id;
+    size_t Children;
+  };
+  std::vector<Open> Stack;
+
+  // Text of the value of the attribute given last.
+  llvm::SmallString<64> Text;
+
+  size_t GetTable(llvm::StringRef name, bool keyed) {
+    std::pair<llvm::StringMap<size_t>::iterator, bool> r =
+      this->TableIndex.insert(std::make_pair(name, this->Tables.size()));
+    if(r.second) {
+      this->Tables.push_back(Table(name.str(), keyed));
+    }
+    return r.first->getValue();
+  }
+
+  static bool IsIdList(llvm::StringRef name) {
+    return name == "members" || name == "befriending";
+  }
+
+  // Add rows for an id list attribute to the table of its name.
+  void AddIdList(llvm::StringRef name, std::string const& parent,
+                 llvm::ArrayRef<Ref> refs) {
+    Table& t = this->Tables[this->GetTable(name, false)];
+    unsigned int const cp = t.Column("parent");
+    unsigned int const cn = t.Column("position");
+    unsigned int const cv =
+      t.Column(name == "members"? "member" : "befriending");
+    for(size_t i = 0; i < refs.size(); ++i) {
+      this->Text.clear();
+      appendOutputRef(this->Text, refs[i]);
+      t.Rows.push_back(Table::Row());
+      Table::Row& row = t.Rows.back();
+      row.push_back(std::make_pair(cp, Value(parent, false)));
+      row.push_back(std::make_pair(cn, Value(std::to_string(i), true)));
+      row.push_back(std::make_pair(cv, Value(this->Text.str().str(), false)));
+    }
+    this->Text.clear();
+  }
+
+  // Add a value to the row of the element begun last.
+  void AddValue(llvm::StringRef name, bool integer) {
+    Open& open = this->Stack.back();
+    if(name == "id") {
+      open.Id = this->Text.str().str();
+    }
+    Table& t = this->Tables[open.Table];
+    t.Rows[open.Row].push_back(
+      std::make_pair(t.Column(name), Value(this->Text.str().str(), integer)));
+    this->Text.clear();
+  }
+
+  void WriteName(llvm::StringRef name) {
+    this->OS << '"';
+    for(char c : name) {
+      this->OS << c;
+      if(c == '"') {
+        this->OS << c;
+      }
+    }
+    this->OS << '"';
+  }
+
+  void WriteValue(Value const& value) {
+    // Write integers bare so that they compare as numbers.
+    if(value.Integer) {
+      this->OS << value.Text;
+      return;
+    }
+    this->OS << '\'';
+    for(char c : value.Text) {
+      this->OS << c;
+      if(c == '\'') {
+        this->OS << c;
+      }
+    }
+    this->OS << '\'';
+  }
+
+  void WriteTable(Table const& t) {
+    this->OS << "CREATE TABLE ";
+    this->WriteName(t.Name);
+    this->OS << " (";
+    for(size_t c = 0; c < t.Columns.size(); ++c) {
+      this->OS << (c? ", " : "");
+      this->WriteName(t.Columns[c]);
+      if(t.Keyed && t.Columns[c] == "id") {
+        this->OS << " PRIMARY KEY";
+      }
+    }
+    this->OS << ");\n";
+
+    std::vector<Value const*> values(t.Columns.size());
+    std::vector<bool> present(t.Columns.size());
+    for(size_t r = 0; r < t.Rows.size(); ++r) {
+      if(r % RowsPerInsert == 0) {
+        this->OS << "INSERT INTO ";
+        this->WriteName(t.Name);
+        this->OS << " VALUES\n";
+      }
+      present.assign(t.Columns.size(), false);
+      for(std::pair<unsigned int, Value> const& v : t.Rows[r]) {
+        values[v.first] = &v.second;
+        present[v.first] = true;
+      }
+      this->OS << "(";
+      for(size_t c = 0; c < t.Columns.size(); ++c) {
+        this->OS << (c? "," : "");
+        if(present[c]) {
+          this->WriteValue(*values[c]);
+        } else {
+          this->OS << "NULL";
+        }
+      }
+      bool const last = (r + 1 == t.Rows.size() ||
+                         (r + 1) % RowsPerInsert == 0);
+      this->OS << (last? ");\n" : "),\n");
+    }
+
+    // Index the columns by which queries join the tables.
+    for(std::string const& c : t.Columns) {
+      if(c == "context" || c == "parent" || c == "member" ||
+         c == "type") {
+        this->OS << "CREATE INDEX ";
+        this->WriteName(t.Name + "_" + c);
+        this->OS << " ON ";
+        this->WriteName(t.Name);
+        this->OS << " (";
+        this->WriteName(c);
+        this->OS << ");\n";
+      }
+    }
+  }
+
+public:
+  SQLHandler(llvm::raw_ostream& os): OS(os) {}
+
+  void StartElement(llvm::StringRef tag) override {
+    // Nested elements go to the tables of their tags with the parent
+    // id and position.
+    size_t const t = this->GetTable(tag, this->Stack.empty());
+    Table& table = this->Tables[t];
+    table.Rows.push_back(Table::Row());
+    Table::Row& row = table.Rows.back();
+    if(!this->Stack.empty()) {
+      Open& parent = this->Stack.back();
+      row.push_back(std::make_pair(table.Column("parent"),
+                                   Value(parent.Id, false)));
+      row.push_back(std::make_pair(table.Column("position"),
+                                   Value(std::to_string(parent.Children++),
+                                         true)));
+    }
+    this->Stack.push_back(Open(t, table.Rows.size() - 1));
+  }
+
+  void StringAttribute(llvm::StringRef name,
+                       llvm::StringRef value) override {
+    this->Text = value;
+    this->AddValue(name, false);
+  }
+
+  void IntAttribute(llvm::StringRef name, int64_t value) override {
+    appendDecimal(this->Text, value);
+    this->AddValue(name, true);
+  }
+
+  void UIntAttribute(llvm::StringRef name, uint64_t value) override {
+    appendDecimal(this->Text, value);
+    this->AddValue(name, true);
+  }
+
+  void RefAttribute(llvm::StringRef name,
+                    llvm::ArrayRef<Ref> refs) override {
+    if(IsIdList(name)) {
+      this->AddIdList(name, this->Stack.back().Id, refs);
+      return;
+    }
+    for(size_t i = 0; i < refs.size(); ++i) {
+      if(i) {
+        this->Text.push_back(' ');
+      }
+      appendOutputRef(this->Text, refs[i]);
+    }
+    this->AddValue(name, false);
+  }
+
+  void LocationAttribute(llvm::StringRef name, unsigned int file,
+                         unsigned int line) override {
+    this->Text.push_back('f');
+    appendDecimal(this->Text, uint64_t(file));
+    this->Text.push_back(':');
+    appendDecimal(this->Text, uint64_t(line));
+    this->AddValue(name, false);
+  }
+
+  void EndElement() override {
+    this->Stack.pop_back();
+  }
+
+  void ElementText(llvm::StringRef xml) override {
+    replayOutputText(*this, xml);
+  }
+
+  void EndDocument() override {
+    this->OS << "BEGIN TRANSACTION;\n";
+    for(Table const& t : this->Tables) {
+      this->WriteTable(t);
+    }
+    this->OS << "COMMIT;\n";
+  }
+};
+
+#endif // CASTXML_OUTPUTSQL_H
@@ -0,0 +1,173 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "OutputSink.h"
+#include "Utils.h"
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendDiagnostic.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+
+#include <map>
+#include <system_error>
+
+//----------------------------------------------------------------------------
+/// Sink writing the elements for each source file to their own
+/// gccxml-format file.  Elements of declarations with no source file
+/// (and types, which have no location) go to a common file.
+class ShardSink: public OutputSink
+{
+  // Bound the number of shard files open at once.  Inputs may
+  // include far more headers than a process may open files.
+  enum { MaxOpenShards = 64 };
+
+  struct Shard {
+    Shard(): Created(false), LastUse(0) {}
+    std::unique_ptr<llvm::raw_fd_ostream> OS;
+    bool Created;
+    unsigned long LastUse;
+  };
+  typedef std::map<unsigned int, Shard> ShardMap;
+
+  clang::CompilerInstance& CI;
+  llvm::raw_ostream& Manifest;
+  std::string Dir;
+  ShardMap Shards;
+  std::string Files;
+  unsigned int OpenShards;
+  unsigned long Clock;
+  bool Failed;
+
+  static std::string ShardName(unsigned int file) {
+    if(file == 0) {
+      return "common.xml";
+    }
+    return ("f" + llvm::Twine(file) + ".xml").str();
+  }
+
+  void CloseLeastRecentlyUsed() {
+    ShardMap::iterator lru = this->Shards.end();
+    for(ShardMap::iterator i = this->Shards.begin(), e = this->Shards.end();
+        i != e; ++i) {
+      if(i->second.OS && (lru == e ||
+                          i->second.LastUse < lru->second.LastUse)) {
+        lru = i;
+      }
+    }
+    if(lru != this->Shards.end()) {
+      lru->second.OS.reset();
+      --this->OpenShards;
+    }
+  }
+
+  llvm::raw_ostream* GetShard(unsigned int file) {
+    if(this->Failed) {
+      return 0;
+    }
+    Shard& shard = this->Shards[file];
+    shard.LastUse = ++this->Clock;
+    if(shard.OS) {
+      return shard.OS.get();
+    }
+    if(this->OpenShards == MaxOpenShards) {
+      this->CloseLeastRecentlyUsed();
+    }
+
+    // Create the file on first use and append to it when reopened.
+    llvm::SmallString<256> path(this->Dir);
+    llvm::sys::path::append(path, ShardName(file));
+    std::error_code ec;
+    if(!shard.Created) {
+      ec = llvm::sys::fs::create_directories(this->Dir);
+    }
+    if(!ec) {
+      shard.OS.reset(new llvm::raw_fd_ostream(
+        path, ec, shard.Created? llvm::sys::fs::F_Append :
+        llvm::sys::fs::F_None));
+    }
+    if(ec) {
+      this->CI.getDiagnostics().Report(
+        clang::diag::err_fe_unable_to_open_output) << path << ec.message();
+      shard.OS.reset();
+      this->Failed = true;
+      return 0;
+    }
+    ++this->OpenShards;
+
+    if(!shard.Created) {
+      shard.Created = true;
+      *shard.OS <<
+        "<?xml version=\"1.0\"?>\n"
+        "<GCC_XML version=\"0.9.0\" cvs_revision=\"1.136\">\n"
+        ;
+    }
+    return shard.OS.get();
+  }
+
+public:
+  ShardSink(clang::CompilerInstance& ci, llvm::raw_ostream& os,
+            std::string const& dir):
+    CI(ci), Manifest(os), Dir(dir), OpenShards(0), Clock(0),
+    Failed(false) {}
+
+  void Node(uint64_t id, unsigned int file,
+            llvm::StringRef xml) override {
+    if(id == 0) {
+      // File elements are listed in the manifest.
+      this->Files.append(xml.data(), xml.size());
+    } else if(llvm::raw_ostream* os = this->GetShard(file)) {
+      *os << xml;
+    }
+  }
+
+  void Finish() override {
+    this->Manifest <<
+      "<?xml version=\"1.0\"?>\n"
+      "<CastXMLShards dir=\"" << escapeXML(this->Dir) << "\">\n"
+      ;
+    for(ShardMap::iterator i = this->Shards.begin(), e = this->Shards.end();
+        i != e; ++i) {
+      if(!i->second.Created) {
+        continue;
+      }
+      if(llvm::raw_ostream* os = this->GetShard(i->first)) {
+        *os << "</GCC_XML>\n";
+        i->second.OS.reset();
+        --this->OpenShards;
+      }
+      this->Manifest << "  <Shard";
+      if(i->first) {
+        this->Manifest << " file=\"f" << i->first << "\"";
+      }
+      this->Manifest << " name=\"" << ShardName(i->first) << "\"/>\n";
+    }
+    this->Manifest << this->Files <<
+      "</CastXMLShards>\n"
+      ;
+  }
+};
+
+//----------------------------------------------------------------------------
+std::unique_ptr<OutputSink> createShardSink(clang::CompilerInstance& ci,
+                                            llvm::raw_ostream& os,
+                                            std::string const& dir)
+{
+  return std::unique_ptr<OutputSink>(new ShardSink(ci, os, dir));
+}
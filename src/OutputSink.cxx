@@ -0,0 +1,110 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "OutputSink.h"
+
+//----------------------------------------------------------------------------
+static void unescapeXML(llvm::StringRef in, std::string& out)
+{
+  out.clear();
+  for(;;) {
+    size_t amp = in.find('&');
+    if(amp == llvm::StringRef::npos) {
+      out.append(in.data(), in.size());
+      return;
+    }
+    out.append(in.data(), amp);
+    in = in.drop_front(amp);
+    if(in.startswith("&amp;")) {
+      out += '&';
+      in = in.drop_front(5);
+    } else if(in.startswith("&lt;")) {
+      out += '<';
+      in = in.drop_front(4);
+    } else if(in.startswith("&gt;")) {
+      out += '>';
+      in = in.drop_front(4);
+    } else if(in.startswith("&apos;")) {
+      out += '\'';
+      in = in.drop_front(6);
+    } else if(in.startswith("&quot;")) {
+      out += '"';
+      in = in.drop_front(6);
+    } else {
+      out += '&';
+      in = in.drop_front(1);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+bool parseOutputElement(llvm::StringRef& xml, OutputElement& e)
+{
+  xml = xml.ltrim();
+  if(!xml.startswith("<")) {
+    return false;
+  }
+  xml = xml.drop_front(1);
+  size_t n = xml.find_first_of(" />");
+  if(n == llvm::StringRef::npos) {
+    return false;
+  }
+  e.Tag = xml.substr(0, n);
+  xml = xml.drop_front(n);
+
+  // Parse the attributes up to the end of the start tag.
+  for(;;) {
+    xml = xml.ltrim();
+    if(xml.startswith("/>")) {
+      xml = xml.drop_front(2);
+      return true;
+    } else if(xml.startswith(">")) {
+      xml = xml.drop_front(1);
+      break;
+    }
+    size_t eq = xml.find("=\"");
+    if(eq == llvm::StringRef::npos) {
+      return false;
+    }
+    e.Attributes.push_back(OutputElement::Attribute());
+    OutputElement::Attribute& a = e.Attributes.back();
+    a.Name = xml.substr(0, eq);
+    xml = xml.drop_front(eq + 2);
+    size_t q = xml.find('"');
+    if(q == llvm::StringRef::npos) {
+      return false;
+    }
+    unescapeXML(xml.substr(0, q), a.Value);
+    xml = xml.drop_front(q + 1);
+  }
+
+  // Parse nested elements up to the end tag.
+  for(;;) {
+    xml = xml.ltrim();
+    if(xml.startswith("</")) {
+      size_t gt = xml.find('>');
+      if(gt == llvm::StringRef::npos) {
+        return false;
+      }
+      xml = xml.drop_front(gt + 1);
+      return true;
+    }
+    e.Children.push_back(OutputElement());
+    if(!parseOutputElement(xml, e.Children.back())) {
+      return false;
+    }
+  }
+}
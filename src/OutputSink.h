@@ -0,0 +1,103 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_OUTPUTSINK_H
+#define CASTXML_OUTPUTSINK_H
+
+#include <cxsys/Configure.hxx>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace clang {
+  class CompilerInstance;
+}
+
+/// OutputSink - Receive gccxml-format output one top-level element at
+/// a time instead of as one document written to a single stream.
+class OutputSink
+{
+  std::string Text;
+  llvm::raw_string_ostream Stream;
+public:
+  OutputSink(): Stream(Text) {}
+  virtual ~OutputSink() {}
+
+  /** Get the stream to which the next element is written.  */
+  llvm::raw_ostream& NodeStream() { return this->Stream; }
+
+  /** Hand the element written to NodeStream to the sink.  */
+  void FinishNode(uint64_t id, unsigned int file) {
+    this->Stream.flush();
+    this->Node(id, file, this->Text);
+    this->Text.clear();
+  }
+
+  /** Receive the XML text of one element.  The id is the number in
+      the element's id="_<id>" attribute, or 0 for a File element.
+      The file is the number of the File element id="f<file>" naming
+      the source file containing the declaration, or 0 for none.  */
+  virtual void Node(uint64_t id, unsigned int file,
+                    llvm::StringRef xml) = 0;
+
+  /** Called after the last element.  */
+  virtual void Finish() = 0;
+};
+
+/// OutputElement - One element given to an OutputSink, parsed back
+/// from its XML text so that it may be written in another format.
+struct OutputElement
+{
+  struct Attribute {
+    llvm::StringRef Name;
+    std::string Value;
+  };
+  llvm::StringRef Tag;
+  std::vector<Attribute> Attributes;
+  std::vector<OutputElement> Children;
+
+  void Clear() {
+    this->Tag = llvm::StringRef();
+    this->Attributes.clear();
+    this->Children.clear();
+  }
+};
+
+/// parseOutputElement - Parse one element, with its nested elements,
+/// from the front of the given XML text written by the gccxml-format
+/// output and drop it from the text.  The parsed tag and attribute
+/// names refer to the text.  Values have XML escapes replaced.
+bool parseOutputElement(llvm::StringRef& xml, OutputElement& e);
+
+/// createShardSink - Create a sink writing each element to a
+/// gccxml-format file in the given directory for the element's source
+/// file, and a manifest of the files to the given stream.
+std::unique_ptr<OutputSink> createShardSink(clang::CompilerInstance& ci,
+                                            llvm::raw_ostream& os,
+                                            std::string const& dir);
+
+/// createDiffSink - Create a sink writing to the given stream a
+/// gccxml-format document of the elements that differ from those with
+/// the same id in the named earlier document, as documented for
+/// '--castxml-diff-against'.
+std::unique_ptr<OutputSink> createDiffSink(clang::CompilerInstance& ci,
+                                           llvm::raw_ostream& os,
+                                           std::string const& old);
+
+#endif // CASTXML_OUTPUTSINK_H
@@ -0,0 +1,427 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "OutputTable.h"
+#include "OutputHandler.h"
+#include "OutputSink.h"
+#include "StringPool.h"
+#include "Utils.h"
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+//----------------------------------------------------------------------------
+uint32_t OutputTable::Intern(llvm::StringRef s)
+{
+  // A pooled string is found again by its address.
+  if(this->Pool) {
+    llvm::StringRef const p = this->Pool->Intern(s);
+    std::pair<llvm::DenseMap<char const*, uint32_t>::iterator, bool> r =
+      this->PoolIndex.insert(
+        std::make_pair(p.data(), static_cast<uint32_t>(this->Strings.size())));
+    if(r.second) {
+      this->Strings.push_back(p);
+    }
+    return r.first->second;
+  }
+  std::pair<llvm::StringMap<uint32_t>::iterator, bool> r =
+    this->StringIndex.insert(
+      std::make_pair(s, static_cast<uint32_t>(this->Strings.size())));
+  if(r.second) {
+    this->Strings.push_back(r.first->getKey());
+  }
+  return r.first->getValue();
+}
+
+//----------------------------------------------------------------------------
+void OutputTable::Fill(uint32_t n, OutputElement const& e)
+{
+  // Nested elements are stored contiguously after their siblings'
+  // records are reserved, so each node refers to them by a range.
+  Node node;
+  node.Id = 0;
+  node.File = 0;
+  node.Tag = this->Intern(e.Tag);
+  node.FirstAttribute = static_cast<uint32_t>(this->Attributes.size());
+  node.NumAttributes = static_cast<uint32_t>(e.Attributes.size());
+  for(OutputElement::Attribute const& a : e.Attributes) {
+    Attribute attr;
+    attr.Name = this->Intern(a.Name);
+    attr.Value = this->Intern(a.Value);
+    this->Attributes.push_back(attr);
+  }
+  node.FirstChild = static_cast<uint32_t>(this->Nodes.size());
+  node.NumChildren = static_cast<uint32_t>(e.Children.size());
+  this->Nodes.resize(this->Nodes.size() + e.Children.size());
+  for(uint32_t i = 0; i < node.NumChildren; ++i) {
+    this->Fill(node.FirstChild + i, e.Children[i]);
+  }
+  this->Nodes[n] = node;
+}
+
+//----------------------------------------------------------------------------
+void OutputTable::Add(uint64_t id, unsigned int file,
+                      OutputElement const& e)
+{
+  // Records, attributes and ids are numbered in 32 bits.  Leave room
+  // for the records of a forward element per node.
+  uint64_t const limit = 0x7fffffff;
+  if(this->Overflow || id > limit || this->Nodes.size() > limit ||
+     this->Attributes.size() > limit || this->Strings.size() > limit) {
+    this->Overflow = true;
+    return;
+  }
+  uint32_t const n = static_cast<uint32_t>(this->Nodes.size());
+  this->Nodes.push_back(Node());
+  this->Fill(n, e);
+  this->Nodes[n].Id = id;
+  this->Nodes[n].File = file;
+  this->Top.push_back(n);
+}
+
+//----------------------------------------------------------------------------
+void OutputTable::AddReferences(uint32_t n,
+                                std::vector<uint32_t> const& names,
+                                llvm::StringMap<uint32_t> const& index,
+                                std::vector<uint32_t>& refs) const
+{
+  Node const& node = this->Nodes[n];
+  for(uint32_t a = node.FirstAttribute,
+        ae = node.FirstAttribute + node.NumAttributes; a != ae; ++a) {
+    Attribute const& attr = this->Attributes[a];
+    if(std::find(names.begin(), names.end(), attr.Name) == names.end()) {
+      continue;
+    }
+    llvm::SmallVector<llvm::StringRef, 8> ids;
+    this->Strings[attr.Value].split(ids, " ", -1, false);
+    for(llvm::StringRef id : ids) {
+      // A base class reference may be prefixed by its access.
+      std::pair<llvm::StringRef, llvm::StringRef> p = id.rsplit(':');
+      llvm::StringMap<uint32_t>::const_iterator i =
+        index.find(p.second.empty()? p.first : p.second);
+      if(i != index.end()) {
+        refs.push_back(i->getValue());
+      }
+    }
+  }
+  for(uint32_t c = node.FirstChild,
+        ce = node.FirstChild + node.NumChildren; c != ce; ++c) {
+    this->AddReferences(c, names, index, refs);
+  }
+}
+
+//----------------------------------------------------------------------------
+uint32_t OutputTable::AddForward(uint32_t n, uint32_t id)
+{
+  Node const& node = this->Nodes[n];
+  Node forward;
+  forward.Id = 0;
+  forward.File = 0;
+  forward.Tag = this->Intern("Forward");
+  forward.FirstAttribute = static_cast<uint32_t>(this->Attributes.size());
+  forward.NumAttributes = 2;
+  forward.FirstChild = 0;
+  forward.NumChildren = 0;
+  Attribute attr;
+  attr.Name = this->Intern("id");
+  attr.Value = id;
+  this->Attributes.push_back(attr);
+  attr.Name = this->Intern("tag");
+  attr.Value = node.Tag;
+  this->Attributes.push_back(attr);
+  this->Nodes.push_back(forward);
+  return static_cast<uint32_t>(this->Nodes.size() - 1);
+}
+
+//----------------------------------------------------------------------------
+void OutputTable::SortTopologically()
+{
+  // Find the top-level element of each id.
+  uint32_t const n = static_cast<uint32_t>(this->Top.size());
+  uint32_t const idName = this->Intern("id");
+  std::vector<uint32_t> ids(n);
+  llvm::StringMap<uint32_t> index;
+  for(uint32_t i = 0; i < n; ++i) {
+    Node const& node = this->Nodes[this->Top[i]];
+    for(uint32_t a = node.FirstAttribute,
+          ae = node.FirstAttribute + node.NumAttributes; a != ae; ++a) {
+      if(this->Attributes[a].Name == idName) {
+        ids[i] = this->Attributes[a].Value;
+        index[this->Strings[ids[i]]] = i;
+        break;
+      }
+    }
+  }
+
+  // The attributes holding references to other elements with node ids.
+  // References to File and String elements are satisfied by writing
+  // those first.
+  static char const* const referenceNames[] = {
+    "type", "returns", "context", "basetype", "members", "befriending",
+    "bases", "throw"
+  };
+  std::vector<uint32_t> names;
+  for(char const* name : referenceNames) {
+    llvm::StringMap<uint32_t>::const_iterator i =
+      this->StringIndex.find(name);
+    if(i != this->StringIndex.end()) {
+      names.push_back(i->getValue());
+    }
+  }
+
+  // The references of each top-level element, as positions in Top.
+  std::vector<uint32_t> firstRef(n + 1);
+  std::vector<uint32_t> refs;
+  for(uint32_t i = 0; i < n; ++i) {
+    firstRef[i] = static_cast<uint32_t>(refs.size());
+    this->AddReferences(this->Top[i], names, index, refs);
+  }
+  firstRef[n] = static_cast<uint32_t>(refs.size());
+
+  enum { Unvisited, Visiting, Written };
+  std::vector<char> state(n, Unvisited);
+  std::vector<char> forwarded(n, 0);
+  std::vector<uint32_t> order;
+  order.reserve(n);
+  for(uint32_t i = 0; i < n; ++i) {
+    if(!this->Nodes[this->Top[i]].Id) {
+      order.push_back(this->Top[i]);
+      state[i] = Written;
+    }
+  }
+
+  // Write each element after those it references, depth first with an
+  // explicit stack of the elements visited and their next reference.
+  std::vector<std::pair<uint32_t, uint32_t> > stack;
+  for(uint32_t root = 0; root < n; ++root) {
+    if(state[root] != Unvisited) {
+      continue;
+    }
+    state[root] = Visiting;
+    stack.push_back(std::make_pair(root, firstRef[root]));
+    while(!stack.empty()) {
+      uint32_t const e = stack.back().first;
+      uint32_t const r = stack.back().second;
+      if(r == firstRef[e + 1]) {
+        order.push_back(this->Top[e]);
+        state[e] = Written;
+        stack.pop_back();
+        continue;
+      }
+      ++stack.back().second;
+      uint32_t const d = refs[r];
+      if(state[d] == Unvisited) {
+        state[d] = Visiting;
+        stack.push_back(std::make_pair(d, firstRef[d]));
+      } else if(state[d] == Visiting && !forwarded[d]) {
+        forwarded[d] = 1;
+        order.push_back(this->AddForward(this->Top[d], ids[d]));
+      }
+    }
+  }
+  this->Top.swap(order);
+}
+
+//----------------------------------------------------------------------------
+void OutputTable::WriteNodeXML(llvm::raw_ostream& os, uint32_t n,
+                               unsigned int indent) const
+{
+  Node const& node = this->Nodes[n];
+  os.indent(indent) << '<' << this->Strings[node.Tag];
+  for(uint32_t a = node.FirstAttribute,
+        ae = node.FirstAttribute + node.NumAttributes; a != ae; ++a) {
+    os << ' ' << this->Strings[this->Attributes[a].Name] << "=\"";
+    writeXML(os, this->Strings[this->Attributes[a].Value]);
+    os << '"';
+  }
+  if(!node.NumChildren) {
+    os << "/>\n";
+    return;
+  }
+  os << ">\n";
+  for(uint32_t c = node.FirstChild,
+        ce = node.FirstChild + node.NumChildren; c != ce; ++c) {
+    this->WriteNodeXML(os, c, indent + 2);
+  }
+  os.indent(indent) << "</" << this->Strings[node.Tag] << ">\n";
+}
+
+//----------------------------------------------------------------------------
+void OutputTable::WriteXML(llvm::raw_ostream& os) const
+{
+  os <<
+    "<?xml version=\"1.0\"?>\n"
+    "<GCC_XML version=\"0.9.0\" cvs_revision=\"1.136\">\n"
+    ;
+  for(uint32_t n : this->Top) {
+    this->WriteNodeXML(os, n);
+  }
+  os <<
+    "</GCC_XML>\n"
+    ;
+}
+
+//----------------------------------------------------------------------------
+void OutputTable::ReplayNode(OutputHandler& h, uint32_t n,
+                             bool internStrings) const
+{
+  Node const& node = this->Nodes[n];
+  llvm::StringRef const tag = this->Strings[node.Tag];
+  h.StartElement(tag);
+  for(uint32_t a = node.FirstAttribute,
+        ae = node.FirstAttribute + node.NumAttributes; a != ae; ++a) {
+    replayOutputAttribute(h, tag, this->Strings[this->Attributes[a].Name],
+                          this->Strings[this->Attributes[a].Value],
+                          internStrings);
+  }
+  for(uint32_t c = node.FirstChild,
+        ce = node.FirstChild + node.NumChildren; c != ce; ++c) {
+    this->ReplayNode(h, c, internStrings);
+  }
+  h.EndElement();
+}
+
+//----------------------------------------------------------------------------
+void OutputTable::Replay(OutputHandler& h, bool internStrings) const
+{
+  h.StartDocument();
+  for(uint32_t n : this->Top) {
+    this->ReplayNode(h, n, internStrings);
+    h.EndNode(this->Nodes[n].Id, this->Nodes[n].File);
+  }
+  h.EndDocument();
+}
+
+//----------------------------------------------------------------------------
+size_t OutputTable::GetMemorySize() const
+{
+  size_t size = this->Nodes.capacity() * sizeof(Node) +
+    this->Attributes.capacity() * sizeof(Attribute) +
+    this->Top.capacity() * sizeof(uint32_t) +
+    this->Strings.capacity() * sizeof(llvm::StringRef);
+  if(this->Pool) {
+    // The pool's strings are shared and not counted here.
+    return size + this->PoolIndex.getMemorySize();
+  }
+  for(llvm::StringRef s : this->Strings) {
+    size += s.size() + 1;
+  }
+  return size;
+}
+
+//----------------------------------------------------------------------------
+/// Handler adding each top-level element to an OutputTable.
+class TableHandler: public OutputHandler
+{
+  OutputTable& Table;
+  OutputElement Element;
+
+  // Elements begun and not yet ended.  Only the innermost one grows.
+  std::vector<OutputElement*> Stack;
+
+  std::string& AddAttribute(llvm::StringRef name) {
+    std::vector<OutputElement::Attribute>& attrs =
+      this->Stack.back()->Attributes;
+    attrs.push_back(OutputElement::Attribute());
+    attrs.back().Name = name;
+    return attrs.back().Value;
+  }
+
+public:
+  TableHandler(OutputTable& table): Table(table) {}
+
+  void StartElement(llvm::StringRef tag) override {
+    OutputElement* e = &this->Element;
+    if(this->Stack.empty()) {
+      e->Clear();
+    } else {
+      std::vector<OutputElement>& children = this->Stack.back()->Children;
+      children.push_back(OutputElement());
+      e = &children.back();
+    }
+    e->Tag = tag;
+    this->Stack.push_back(e);
+  }
+
+  void StringAttribute(llvm::StringRef name,
+                       llvm::StringRef value) override {
+    this->AddAttribute(name) = value.str();
+  }
+
+  void IntAttribute(llvm::StringRef name, int64_t value) override {
+    this->AddAttribute(name) = std::to_string(value);
+  }
+
+  void UIntAttribute(llvm::StringRef name, uint64_t value) override {
+    this->AddAttribute(name) = std::to_string(value);
+  }
+
+  void RefAttribute(llvm::StringRef name,
+                    llvm::ArrayRef<Ref> refs) override {
+    llvm::raw_string_ostream os(this->AddAttribute(name));
+    const char* sep = "";
+    for(Ref const& r : refs) {
+      os << sep;
+      writeOutputRef(os, r);
+      sep = " ";
+    }
+  }
+
+  void LocationAttribute(llvm::StringRef name, unsigned int file,
+                         unsigned int line) override {
+    this->AddAttribute(name) =
+      "f" + std::to_string(file) + ":" + std::to_string(line);
+  }
+
+  void EndElement() override {
+    this->Stack.pop_back();
+  }
+
+  void EndNode(uint64_t id, unsigned int file) override {
+    this->Table.Add(id, file, this->Element);
+  }
+};
+
+//----------------------------------------------------------------------------
+std::unique_ptr<OutputHandler> createTableHandler(OutputTable& table)
+{
+  return std::unique_ptr<OutputHandler>(new TableHandler(table));
+}
+
+//----------------------------------------------------------------------------
+void writeOutputTable(OutputTable const& table, llvm::raw_ostream& os,
+                      std::string const& format, bool internStrings)
+{
+  std::unique_ptr<OutputHandler> handler;
+  if(format == "bin") {
+    handler = createBinaryHandler(os);
+  } else if(format == "json") {
+    handler = createJSONHandler(os);
+  } else if(format == "sql") {
+    handler = createSQLHandler(os);
+  } else if(format == "fingerprint") {
+    handler = createFingerprintHandler(os);
+  }
+  if(handler) {
+    table.Replay(*handler, internStrings);
+  } else {
+    table.WriteXML(os);
+  }
+}
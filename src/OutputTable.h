@@ -0,0 +1,145 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_OUTPUTTABLE_H
+#define CASTXML_OUTPUTTABLE_H
+
+#include <cxsys/Configure.hxx>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace llvm {
+  class raw_ostream;
+}
+
+class OutputHandler;
+class StringPool;
+struct OutputElement;
+
+/// OutputTable - Compact in-memory table of the gccxml-format output
+/// elements of one traversal.  Each element is a record holding its
+/// tag, its attributes, and its nested elements, with every name and
+/// value stored once in a string table.  The table may be written by
+/// any number of consumers after the traversal has filled it.
+class OutputTable
+{
+public:
+  struct Attribute {
+    uint32_t Name;
+    uint32_t Value;
+  };
+  struct Node {
+    uint32_t Id;
+    uint32_t File;
+    uint32_t Tag;
+    uint32_t FirstAttribute;
+    uint32_t NumAttributes;
+    uint32_t FirstChild;
+    uint32_t NumChildren;
+  };
+
+  OutputTable(): Pool(nullptr), Overflow(false) {}
+
+  /** Keep the strings of the table in the given pool shared with the
+      tables of other jobs, which must outlive the table.  Call this
+      before adding any element.  */
+  void SetStringPool(StringPool* pool) { this->Pool = pool; }
+
+  /** Add a top-level element with the id and file given to an
+      OutputSink for it.  Elements that do not fit the 32-bit records
+      are dropped and mark the table as overflowed.  */
+  void Add(uint64_t id, unsigned int file, OutputElement const& e);
+
+  /** Get whether an element was dropped by Add.  */
+  bool Overflowed() const { return this->Overflow; }
+
+  /** Get the top-level elements in the order they were added, or as
+      reordered by SortTopologically.  */
+  std::vector<uint32_t> const& GetElements() const { return this->Top; }
+
+  /** Reorder the top-level elements so that every reference names an
+      element written earlier, keeping the order they were added where
+      references allow.  Elements without a node id come first.  Where
+      references form a cycle, as between a class and its members, a
+      <Forward id="..." tag="..."/> element with the id and tag of the
+      element first reached is written before the cycle, and the other
+      elements of the cycle refer to that.  */
+  void SortTopologically();
+
+  Node const& GetNode(uint32_t n) const { return this->Nodes[n]; }
+  std::vector<Node> const& GetNodes() const { return this->Nodes; }
+  std::vector<Attribute> const& GetAttributes() const {
+    return this->Attributes;
+  }
+  size_t GetNumStrings() const { return this->Strings.size(); }
+  Attribute const& GetAttribute(uint32_t a) const {
+    return this->Attributes[a];
+  }
+  llvm::StringRef GetString(uint32_t s) const { return this->Strings[s]; }
+
+  /** Write the XML text of a node, as the traversal wrote it.  */
+  void WriteNodeXML(llvm::raw_ostream& os, uint32_t n,
+                    unsigned int indent = 2) const;
+
+  /** Write the whole gccxml-format document.  */
+  void WriteXML(llvm::raw_ostream& os) const;
+
+  /** Give the events of the whole document to a handler, with the
+      value of each attribute typed as the traversal gave it.  */
+  void Replay(OutputHandler& h, bool internStrings) const;
+
+  /** Get the memory used by the table.  */
+  size_t GetMemorySize() const;
+
+private:
+  uint32_t Intern(llvm::StringRef s);
+  void Fill(uint32_t n, OutputElement const& e);
+  void ReplayNode(OutputHandler& h, uint32_t n, bool internStrings) const;
+  void AddReferences(uint32_t n, std::vector<uint32_t> const& names,
+                     llvm::StringMap<uint32_t> const& index,
+                     std::vector<uint32_t>& refs) const;
+  uint32_t AddForward(uint32_t n, uint32_t id);
+
+  std::vector<Node> Nodes;
+  std::vector<Attribute> Attributes;
+  std::vector<uint32_t> Top;
+  llvm::StringMap<uint32_t> StringIndex;
+  std::vector<llvm::StringRef> Strings;
+
+  // The pool holding the strings, if any, and the index of each of its
+  // strings in Strings.
+  StringPool* Pool;
+  llvm::DenseMap<char const*, uint32_t> PoolIndex;
+  bool Overflow;
+};
+
+/// createTableHandler - Create a handler adding each top-level element
+/// to a table.
+std::unique_ptr<OutputHandler> createTableHandler(OutputTable& table);
+
+/// writeOutputTable - Write the elements of a table to a stream in the
+/// named '--castxml-output' format.  The table holds interned strings
+/// if '--castxml-intern-strings' is given.
+void writeOutputTable(OutputTable const& table, llvm::raw_ostream& os,
+                      std::string const& format, bool internStrings);
+
+#endif // CASTXML_OUTPUTTABLE_H
@@ -0,0 +1,379 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "OutputHandler.h"
+#include "Compress.h"
+
+#include <cxsys/SystemTools.hxx>
+
+#include "clang/Frontend/CompilerInstance.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+//----------------------------------------------------------------------------
+/// Handler keeping the events of every top-level element of a unity
+/// translation unit, then writing to the output of each header the
+/// elements of its declarations and of everything they reference.
+/// Elements of other headers and of no header are written as found,
+/// except that their members are limited to those written, so they
+/// appear as the incomplete references a start declaration would see.
+class UnityOutputHandler: public OutputHandler
+{
+  struct StoredRef {
+    StoredRef(Ref const& r):
+      Prefix(r.Prefix), Id(r.Id), Stable(r.Stable), Qual(r.Qual),
+      Access(r.Access) {}
+    char Prefix;
+    uint64_t Id;
+    std::string Stable;
+    std::string Qual;
+    std::string Access;
+
+    Ref Get() const {
+      Ref r(this->Prefix, this->Id);
+      r.Stable = this->Stable;
+      r.Qual = this->Qual;
+      r.Access = this->Access;
+      return r;
+    }
+  };
+
+  struct Event {
+    enum Kind { Start, String, Int, UInt, Refs, Location, End };
+    Event(Kind k, llvm::StringRef name = llvm::StringRef()):
+      K(k), Name(name), Int(0), UInt(0) {}
+    Kind K;
+    std::string Name;
+    std::string Text;
+    int64_t Int;
+    uint64_t UInt;
+    std::vector<StoredRef> RefList;
+  };
+
+  // A node is identified by its number and cv-qualifier suffix.
+  typedef std::pair<uint64_t, std::string> NodeKey;
+
+  struct Element {
+    Element(): File(0), Depth(0) {}
+    std::vector<Event> Events;
+    NodeKey Key;
+    unsigned int File;
+    unsigned int Depth;
+    std::string Tag;
+  };
+
+  clang::CompilerInstance& CI;
+  std::vector<std::string> const& Headers;
+  std::vector<std::string> const& Files;
+  std::string Compression;
+  std::vector<Element> Elements;
+  Element Current;
+
+  // The index in Elements of each node, File, and String element.
+  std::map<NodeKey, size_t> Nodes;
+  std::map<unsigned int, size_t> FileElements;
+  std::map<unsigned int, size_t> StringElements;
+
+  // Find the element a reference names, or give Elements.size().
+  template <typename M, typename K>
+  size_t FindIn(M const& m, K const& k) const {
+    typename M::const_iterator i = m.find(k);
+    return i != m.end()? i->second : this->Elements.size();
+  }
+  size_t FindFile(unsigned int file) const {
+    return this->FindIn(this->FileElements, file);
+  }
+  size_t Find(StoredRef const& r) const {
+    switch(r.Prefix) {
+    case '_': return this->FindIn(this->Nodes, NodeKey(r.Id, r.Qual));
+    case 'f': return this->FindFile(r.Id);
+    case 's': return this->FindIn(this->StringElements, r.Id);
+    default: return this->Elements.size();
+    }
+  }
+
+  static bool IsMembers(Event const& e) {
+    return e.K == Event::Refs && e.Name == "members";
+  }
+
+  std::string GetFileName(Element const& f) const;
+  void Reach(size_t header, std::vector<int> const& headerOf,
+             std::vector<bool>& written) const;
+  void Write(size_t header, std::vector<int> const& headerOf);
+
+public:
+  UnityOutputHandler(clang::CompilerInstance& ci,
+                     std::vector<std::string> const& headers,
+                     std::vector<std::string> const& files,
+                     std::string const& compression):
+    CI(ci), Headers(headers), Files(files), Compression(compression) {}
+
+  void StartElement(llvm::StringRef tag) override {
+    if(this->Current.Depth++ == 0) {
+      this->Current.Tag = tag;
+    }
+    Event e(Event::Start);
+    e.Text = tag;
+    this->Current.Events.push_back(e);
+  }
+
+  void StringAttribute(llvm::StringRef name,
+                       llvm::StringRef value) override {
+    Event e(Event::String, name);
+    e.Text = value;
+    this->Current.Events.push_back(e);
+  }
+
+  void IntAttribute(llvm::StringRef name, int64_t value) override {
+    Event e(Event::Int, name);
+    e.Int = value;
+    this->Current.Events.push_back(e);
+  }
+
+  void UIntAttribute(llvm::StringRef name, uint64_t value) override {
+    Event e(Event::UInt, name);
+    e.UInt = value;
+    this->Current.Events.push_back(e);
+  }
+
+  void RefAttribute(llvm::StringRef name,
+                    llvm::ArrayRef<Ref> refs) override {
+    if(name == "id" && this->Current.Depth == 1 && refs.size() == 1) {
+      this->Current.Key = NodeKey(refs[0].Id, refs[0].Qual);
+    }
+    Event e(Event::Refs, name);
+    e.RefList.assign(refs.begin(), refs.end());
+    this->Current.Events.push_back(e);
+  }
+
+  void LocationAttribute(llvm::StringRef name, unsigned int file,
+                         unsigned int line) override {
+    Event e(Event::Location, name);
+    e.UInt = file;
+    e.Int = line;
+    this->Current.Events.push_back(e);
+  }
+
+  void EndElement() override {
+    --this->Current.Depth;
+    this->Current.Events.push_back(Event(Event::End));
+  }
+
+  void EndNode(uint64_t id, unsigned int file) override {
+    this->Current.File = file;
+    size_t const index = this->Elements.size();
+    if(id != 0) {
+      this->Nodes[this->Current.Key] = index;
+    } else if(this->Current.Tag == "File") {
+      this->FileElements[file] = index;
+    } else if(this->Current.Tag == "String") {
+      this->StringElements[this->Current.Key.first] = index;
+    }
+    this->Elements.push_back(std::move(this->Current));
+    this->Current = Element();
+  }
+
+  void EndDocument() override;
+};
+
+//----------------------------------------------------------------------------
+std::string UnityOutputHandler::GetFileName(Element const& f) const
+{
+  // The name is a string, or a reference to a String element with
+  // '--castxml-intern-strings'.
+  for(Event const& e : f.Events) {
+    if(e.Name != "name") {
+      continue;
+    }
+    if(e.K == Event::String) {
+      return e.Text;
+    }
+    if(e.K == Event::Refs && e.RefList.size() == 1) {
+      size_t const i = this->Find(e.RefList[0]);
+      if(i != this->Elements.size()) {
+        for(Event const& s : this->Elements[i].Events) {
+          if(s.K == Event::String && s.Name == "value") {
+            return s.Text;
+          }
+        }
+      }
+    }
+  }
+  return std::string();
+}
+
+//----------------------------------------------------------------------------
+void UnityOutputHandler::Reach(size_t header,
+                               std::vector<int> const& headerOf,
+                               std::vector<bool>& written) const
+{
+  // Start from the elements of the header's own declarations.
+  std::vector<size_t> queue;
+  for(size_t i = 0; i < this->Elements.size(); ++i) {
+    Element const& e = this->Elements[i];
+    if(e.Key.first != 0 && e.File < headerOf.size() &&
+       headerOf[e.File] == int(header)) {
+      written[i] = true;
+      queue.push_back(i);
+    }
+  }
+
+  // Follow references other than the members of elements that are
+  // not the header's own.
+  size_t const none = this->Elements.size();
+  while(!queue.empty()) {
+    size_t const i = queue.back();
+    queue.pop_back();
+    Element const& e = this->Elements[i];
+    bool const own = e.File < headerOf.size() &&
+      headerOf[e.File] == int(header);
+    for(Event const& ev : e.Events) {
+      std::vector<size_t> targets;
+      if(ev.K == Event::Location) {
+        targets.push_back(this->FindFile(unsigned(ev.UInt)));
+      } else if(ev.K == Event::Refs && ev.Name != "id" &&
+                (own || !IsMembers(ev))) {
+        for(StoredRef const& r : ev.RefList) {
+          targets.push_back(this->Find(r));
+        }
+      }
+      for(size_t t : targets) {
+        if(t != none && !written[t]) {
+          written[t] = true;
+          queue.push_back(t);
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+void UnityOutputHandler::Write(size_t header,
+                               std::vector<int> const& headerOf)
+{
+  std::vector<bool> written(this->Elements.size(), false);
+  this->Reach(header, headerOf, written);
+
+  llvm::raw_ostream* os =
+    this->CI.createOutputFile(this->Files[header], /*Binary=*/false,
+                              /*RemoveFileOnSignal=*/true, "", "",
+                              /*UseTemporary=*/true);
+  if(!os) {
+    return;
+  }
+  std::unique_ptr<llvm::raw_ostream> compressed =
+    createCompressedStream(this->Compression, *os,
+                           this->CI.getDiagnostics());
+  std::unique_ptr<OutputHandler> xml =
+    createXMLHandler(compressed? *compressed : *os);
+
+  // Replay the elements written in their original order.
+  xml->StartDocument();
+  std::vector<Ref> refs;
+  for(size_t i = 0; i < this->Elements.size(); ++i) {
+    if(!written[i]) {
+      continue;
+    }
+    Element const& e = this->Elements[i];
+    bool const own = e.File < headerOf.size() &&
+      headerOf[e.File] == int(header);
+    for(Event const& ev : e.Events) {
+      switch(ev.K) {
+      case Event::Start:
+        xml->StartElement(ev.Text);
+        break;
+      case Event::String:
+        xml->StringAttribute(ev.Name, ev.Text);
+        break;
+      case Event::Int:
+        xml->IntAttribute(ev.Name, ev.Int);
+        break;
+      case Event::UInt:
+        xml->UIntAttribute(ev.Name, ev.UInt);
+        break;
+      case Event::Refs:
+        refs.clear();
+        for(StoredRef const& r : ev.RefList) {
+          if(own || !IsMembers(ev)) {
+            refs.push_back(r.Get());
+            continue;
+          }
+          size_t const t = this->Find(r);
+          if(t != this->Elements.size() && written[t]) {
+            refs.push_back(r.Get());
+          }
+        }
+        if(!refs.empty()) {
+          xml->RefAttribute(ev.Name, refs);
+        }
+        break;
+      case Event::Location:
+        xml->LocationAttribute(ev.Name, unsigned(ev.UInt),
+                               unsigned(ev.Int));
+        break;
+      case Event::End:
+        xml->EndElement();
+        break;
+      }
+    }
+    xml->EndNode(e.Key.first, e.File);
+  }
+  xml->EndDocument();
+}
+
+//----------------------------------------------------------------------------
+void UnityOutputHandler::EndDocument()
+{
+  // Find the header named by each File element.
+  std::map<std::string, size_t> headers;
+  for(size_t h = 0; h < this->Headers.size(); ++h) {
+    headers[this->Headers[h]] = h;
+  }
+  std::vector<int> headerOf;
+  for(std::map<unsigned int, size_t>::const_iterator
+        i = this->FileElements.begin(), e = this->FileElements.end();
+      i != e; ++i) {
+    std::string name = cxsys::SystemTools::CollapseFullPath(
+      this->GetFileName(this->Elements[i->second]));
+    cxsys::SystemTools::ConvertToUnixSlashes(name);
+    std::map<std::string, size_t>::const_iterator h = headers.find(name);
+    if(h != headers.end()) {
+      if(headerOf.size() <= i->first) {
+        headerOf.resize(i->first + 1, -1);
+      }
+      headerOf[i->first] = int(h->second);
+    }
+  }
+
+  for(size_t h = 0; h < this->Headers.size(); ++h) {
+    this->Write(h, headerOf);
+  }
+}
+
+//----------------------------------------------------------------------------
+std::unique_ptr<OutputHandler>
+createUnityHandler(clang::CompilerInstance& ci,
+                   std::vector<std::string> const& headers,
+                   std::vector<std::string> const& files,
+                   std::string const& compression)
+{
+  return std::unique_ptr<OutputHandler>(
+    new UnityOutputHandler(ci, headers, files, compression));
+}
@@ -0,0 +1,369 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#ifndef CASTXML_OUTPUTXML_H
+#define CASTXML_OUTPUTXML_H
+
+#include <cxsys/Configure.hxx>
+
+#include "OutputHandler.h"
+#include "OutputSink.h"
+#include "Utils.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/raw_ostream.h"
+
+// The handlers writing and measuring the gccxml-format XML text are
+// final so that the traversal instantiated for them calls their
+// methods directly, with no virtual dispatch for each attribute.
+
+/// appendDecimal - Append the decimal text of a value to a buffer.
+inline void appendDecimal(llvm::SmallVectorImpl<char>& buf, uint64_t value)
+{
+  // Format two digits at a time from the end of a stack buffer since
+  // the generic stream formatting dominates the cost of small values.
+  static char const digits[] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+  char text[20];
+  char* end = text + sizeof(text);
+  char* p = end;
+  while(value >= 100) {
+    unsigned int const i = static_cast<unsigned int>(value % 100) * 2;
+    value /= 100;
+    *--p = digits[i + 1];
+    *--p = digits[i];
+  }
+  if(value >= 10) {
+    unsigned int const i = static_cast<unsigned int>(value) * 2;
+    *--p = digits[i + 1];
+    *--p = digits[i];
+  } else {
+    *--p = static_cast<char>('0' + value);
+  }
+  buf.append(p, end);
+}
+
+inline void appendDecimal(llvm::SmallVectorImpl<char>& buf, int64_t value)
+{
+  if(value < 0) {
+    buf.push_back('-');
+    appendDecimal(buf, uint64_t(0) - static_cast<uint64_t>(value));
+  } else {
+    appendDecimal(buf, static_cast<uint64_t>(value));
+  }
+}
+
+/// appendOutputRef - Append a reference as it appears in the XML text.
+inline void appendOutputRef(llvm::SmallVectorImpl<char>& buf,
+                            OutputHandler::Ref const& r)
+{
+  if(!r.Access.empty()) {
+    buf.append(r.Access.begin(), r.Access.end());
+    buf.push_back(':');
+  }
+  buf.push_back(r.Prefix);
+  if(!r.Stable.empty()) {
+    buf.append(r.Stable.begin(), r.Stable.end());
+  } else {
+    appendDecimal(buf, r.Id);
+  }
+  buf.append(r.Qual.begin(), r.Qual.end());
+}
+
+/// XMLOutputHandler - Handler writing the events as gccxml-format XML
+/// text, created by createXMLHandler.
+class XMLOutputHandler final: public OutputHandler
+{
+  llvm::raw_ostream& OS;
+
+  // Receive each top-level element separately, if not writing one
+  // document.
+  OutputSink* Sink;
+
+  // Elements begun and not yet ended, and whether each has written
+  // the end of its start tag for a nested element.
+  struct Open {
+    Open(llvm::StringRef tag): Tag(tag), HasChildren(false) {}
+    llvm::StringRef Tag;
+    bool HasChildren;
+  };
+  llvm::SmallVector<Open, 4> Stack;
+
+  // Text of the top-level element being formatted.  Each element is
+  // built in this one contiguous buffer, reused from element to
+  // element, and given to the stream with a single write when it ends.
+  llvm::SmallString<4096> Chunk;
+
+  void Indent() {
+    this->Chunk.append(2 * this->Stack.size(), ' ');
+  }
+
+  void Append(llvm::StringRef text) {
+    this->Chunk.append(text.begin(), text.end());
+  }
+
+  void StartAttribute(llvm::StringRef name) {
+    this->Chunk.push_back(' ');
+    this->Append(name);
+    this->Append("=\"");
+  }
+
+  void EndAttribute() {
+    this->Chunk.push_back('"');
+  }
+
+  void Flush() {
+    this->OS.write(this->Chunk.data(), this->Chunk.size());
+    this->Chunk.clear();
+  }
+
+public:
+  XMLOutputHandler(llvm::raw_ostream& os, OutputSink* sink):
+    OS(os), Sink(sink) {}
+
+  void StartDocument() override {
+    // A sink writes its own document.
+    if(!this->Sink) {
+      this->OS <<
+        "<?xml version=\"1.0\"?>\n"
+        "<GCC_XML version=\"0.9.0\" cvs_revision=\"1.136\">\n"
+        ;
+    }
+  }
+
+  void StartElement(llvm::StringRef tag) override {
+    if(!this->Stack.empty() && !this->Stack.back().HasChildren) {
+      this->Stack.back().HasChildren = true;
+      this->Append(">\n");
+    }
+    this->Stack.push_back(Open(tag));
+    this->Indent();
+    this->Chunk.push_back('<');
+    this->Append(tag);
+  }
+
+  void StringAttribute(llvm::StringRef name,
+                       llvm::StringRef value) override {
+    this->StartAttribute(name);
+    appendXML(this->Chunk, value);
+    this->EndAttribute();
+  }
+
+  void IntAttribute(llvm::StringRef name, int64_t value) override {
+    this->StartAttribute(name);
+    appendDecimal(this->Chunk, value);
+    this->EndAttribute();
+  }
+
+  void UIntAttribute(llvm::StringRef name, uint64_t value) override {
+    this->StartAttribute(name);
+    appendDecimal(this->Chunk, value);
+    this->EndAttribute();
+  }
+
+  void RefAttribute(llvm::StringRef name,
+                    llvm::ArrayRef<Ref> refs) override {
+    this->StartAttribute(name);
+    for(size_t i = 0; i < refs.size(); ++i) {
+      if(i) {
+        this->Chunk.push_back(' ');
+      }
+      appendOutputRef(this->Chunk, refs[i]);
+    }
+    this->EndAttribute();
+  }
+
+  void LocationAttribute(llvm::StringRef name, unsigned int file,
+                         unsigned int line) override {
+    this->StartAttribute(name);
+    this->Chunk.push_back('f');
+    appendDecimal(this->Chunk, uint64_t(file));
+    this->Chunk.push_back(':');
+    appendDecimal(this->Chunk, uint64_t(line));
+    this->EndAttribute();
+  }
+
+  void EndElement() override {
+    Open const& open = this->Stack.back();
+    if(open.HasChildren) {
+      this->Indent();
+      this->Append("</");
+      this->Append(open.Tag);
+      this->Append(">\n");
+    } else {
+      this->Append("/>\n");
+    }
+    this->Stack.pop_back();
+  }
+
+  void ElementText(llvm::StringRef xml) override {
+    this->Append(xml);
+  }
+
+  void EndNode(uint64_t id, unsigned int file) override {
+    // The caller measures the stream around each top-level element,
+    // so its text must be written before returning.
+    this->Flush();
+    if(this->Sink) {
+      this->Sink->FinishNode(id, file);
+    }
+  }
+
+  void EndDocument() override {
+    this->Flush();
+    if(this->Sink) {
+      this->Sink->Finish();
+    } else {
+      this->OS <<
+        "</GCC_XML>\n"
+        ;
+    }
+  }
+};
+
+/// decimalSize - Count the digits of the decimal text of a value.
+inline uint64_t decimalSize(uint64_t value)
+{
+  uint64_t n = 1;
+  while(value >= 10) {
+    value /= 10;
+    ++n;
+  }
+  return n;
+}
+
+/// escapedXMLSize - Count the bytes of the text as appendXML escapes it.
+inline uint64_t escapedXMLSize(llvm::StringRef in)
+{
+  // Count the bytes writeXML gives each character.
+  uint64_t n = in.size();
+  for(char c : in) {
+    switch(c) {
+    case '&': n += 4; break;
+    case '<': case '>': n += 3; break;
+    case '\'': case '"': n += 5; break;
+    default: break;
+    }
+  }
+  return n;
+}
+
+/// XMLSizeHandler - Handler measuring the text XMLOutputHandler would
+/// write for the events, added up without formatting it.
+class XMLSizeHandler final: public OutputHandler
+{
+  XMLSize& Size;
+
+  // Elements begun and not yet ended, and whether each has children.
+  struct Open {
+    Open(llvm::StringRef tag): Tag(tag), HasChildren(false) {}
+    llvm::StringRef Tag;
+    bool HasChildren;
+  };
+  llvm::SmallVector<Open, 4> Stack;
+
+  // Whether the top-level element begun last is a File element.
+  bool InFile;
+
+  void Attribute(llvm::StringRef name, uint64_t value) {
+    // Space, name, equals sign, and quotes around the value.
+    this->Size.Bytes += name.size() + 4 + value;
+  }
+
+  static uint64_t RefSize(Ref const& r) {
+    uint64_t n = r.Access.empty()? 0 : r.Access.size() + 1;
+    n += 1 + (r.Stable.empty()? decimalSize(r.Id) : r.Stable.size());
+    return n + r.Qual.size();
+  }
+
+public:
+  XMLSizeHandler(XMLSize& size): Size(size), InFile(false) {}
+
+  void StartDocument() override {
+    this->Size.Bytes += llvm::StringRef(
+      "<?xml version=\"1.0\"?>\n"
+      "<GCC_XML version=\"0.9.0\" cvs_revision=\"1.136\">\n").size();
+  }
+
+  void StartElement(llvm::StringRef tag) override {
+    if(!this->Stack.empty() && !this->Stack.back().HasChildren) {
+      this->Stack.back().HasChildren = true;
+      this->Size.Bytes += 2;
+    }
+    if(this->Stack.empty()) {
+      this->InFile = tag == "File";
+    }
+    this->Stack.push_back(Open(tag));
+    this->Size.Bytes += 2 * this->Stack.size() + 1 + tag.size();
+  }
+
+  void StringAttribute(llvm::StringRef name,
+                       llvm::StringRef value) override {
+    this->Attribute(name, escapedXMLSize(value));
+  }
+
+  void IntAttribute(llvm::StringRef name, int64_t value) override {
+    this->Attribute(name, value < 0?
+                    1 + decimalSize(uint64_t(0) - uint64_t(value)) :
+                    decimalSize(uint64_t(value)));
+  }
+
+  void UIntAttribute(llvm::StringRef name, uint64_t value) override {
+    this->Attribute(name, decimalSize(value));
+  }
+
+  void RefAttribute(llvm::StringRef name,
+                    llvm::ArrayRef<Ref> refs) override {
+    uint64_t n = refs.empty()? 0 : refs.size() - 1;
+    for(Ref const& r : refs) {
+      n += RefSize(r);
+    }
+    this->Attribute(name, n);
+  }
+
+  void LocationAttribute(llvm::StringRef name, unsigned int file,
+                         unsigned int line) override {
+    this->Attribute(name, 2 + decimalSize(file) + decimalSize(line));
+  }
+
+  void EndElement() override {
+    Open const& open = this->Stack.back();
+    if(open.HasChildren) {
+      this->Size.Bytes += 2 * this->Stack.size() + 4 + open.Tag.size();
+    } else {
+      this->Size.Bytes += 3;
+    }
+    this->Stack.pop_back();
+  }
+
+  void EndNode(uint64_t id, unsigned int) override {
+    if(id) {
+      ++this->Size.Nodes;
+    } else if(this->InFile) {
+      ++this->Size.Files;
+    }
+  }
+
+  void EndDocument() override {
+    this->Size.Bytes += llvm::StringRef("</GCC_XML>\n").size();
+  }
+};
+
+#endif // CASTXML_OUTPUTXML_H
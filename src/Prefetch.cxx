@@ -0,0 +1,195 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Prefetch.h"
+#include "TimeReport.h"
+#include "Utils.h"
+
+#include <cxsys/SystemTools.hxx>
+
+#include "clang/Basic/FileManager.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char* const prefetchMagic = "castxml-prefetch-1";
+
+//----------------------------------------------------------------------------
+/// The files left to read, shared by the background threads.  Each
+/// thread holds a reference so that none touches state destroyed when
+/// the process exits before the list is done.
+struct PrefetchQueue
+{
+  PrefetchQueue(): Next(0) {}
+  std::vector<std::string> Files;
+  std::atomic<size_t> Next;
+};
+
+//----------------------------------------------------------------------------
+static void prefetchFiles(std::shared_ptr<PrefetchQueue> queue)
+{
+  // Reading each file through fills the cache of any file system,
+  // where an advisory hint may be ignored by a network client.
+  char buffer[64 * 1024];
+  for(;;) {
+    size_t const i = queue->Next++;
+    if(i >= queue->Files.size()) {
+      break;
+    }
+    if(FILE* f = fopen(queue->Files[i].c_str(), "rb")) {
+      while(fread(buffer, 1, sizeof(buffer), f) == sizeof(buffer)) {
+      }
+      fclose(f);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+/// The files read by this run, in order of first use, written at exit
+/// to replace the list read at startup.
+class PrefetchList
+{
+  std::mutex Mutex;
+  std::string File;
+  std::vector<std::string> Files;
+  llvm::StringSet<> Seen;
+public:
+  void SetFile(std::string const& fname) {
+    this->File = fname;
+  }
+
+  void Add(clang::CompilerInstance& ci) {
+    std::string const& workDir = ci.getFileSystemOpts().WorkingDir;
+    llvm::SmallVector<clang::FileEntry const*, 256> entries;
+    ci.getFileManager().GetUniqueIDMapping(entries);
+    ReportedLock lock(this->Mutex, "Prefetch list");
+    for(clang::FileEntry const* fe : entries) {
+      if(!fe) {
+        continue;
+      }
+      std::string const path = workDir.empty()?
+        cxsys::SystemTools::CollapseFullPath(fe->getName()) :
+        cxsys::SystemTools::CollapseFullPath(fe->getName(), workDir);
+      if(this->Seen.insert(path).second) {
+        this->Files.push_back(path);
+      }
+    }
+  }
+
+  void Save() {
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    if(this->Files.empty()) {
+      return;
+    }
+
+    std::string text = prefetchMagic;
+    text += "\n";
+    for(std::string const& f : this->Files) {
+      text += f + "\n";
+    }
+    // A list that cannot be written is recorded again by a later run.
+    std::string msg;
+    replaceFile(this->File, text, msg);
+  }
+};
+
+static PrefetchList* prefetchList;
+
+//----------------------------------------------------------------------------
+static void savePrefetchList()
+{
+  prefetchList->Save();
+}
+
+//----------------------------------------------------------------------------
+static bool loadPrefetchList(std::string const& fname,
+                             std::vector<std::string>& files)
+{
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+    llvm::MemoryBuffer::getFile(fname);
+  if(buffer) {
+    llvm::StringRef text = buffer.get()->getBuffer();
+    std::pair<llvm::StringRef, llvm::StringRef> first = text.split('\n');
+    if(first.first.rtrim() == prefetchMagic) {
+      llvm::SmallVector<llvm::StringRef, 256> lines;
+      first.second.split(lines, "\n", -1, false);
+      for(llvm::StringRef line : lines) {
+        line = line.rtrim();
+        if(!line.empty()) {
+          files.push_back(line.str());
+        }
+      }
+    } else {
+      // A dependency file is written by the build, not by us.
+      parseDependencyFile(text, files);
+      return false;
+    }
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void readPrefetchList(std::string const& fname,
+                      std::vector<std::string>& files)
+{
+  loadPrefetchList(fname, files);
+}
+
+//----------------------------------------------------------------------------
+void startPrefetch(std::string const& fname, unsigned int threads)
+{
+  PhaseRegion t("Prefetch start");
+  std::shared_ptr<PrefetchQueue> queue = std::make_shared<PrefetchQueue>();
+  bool const writable = loadPrefetchList(fname, queue->Files);
+
+  // The list lives until exit, after any thread using it.
+  if(writable && !prefetchList) {
+    prefetchList = new PrefetchList;
+    prefetchList->SetFile(fname);
+    atexit(savePrefetchList);
+  }
+
+  if(queue->Files.empty()) {
+    return;
+  }
+  for(unsigned int i = 0; i < threads; ++i) {
+    std::thread(prefetchFiles, queue).detach();
+  }
+}
+
+//----------------------------------------------------------------------------
+void recordPrefetch(clang::CompilerInstance& ci)
+{
+  if(prefetchList) {
+    prefetchList->Add(ci);
+  }
+}
@@ -0,0 +1,47 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_PREFETCH_H
+#define CASTXML_PREFETCH_H
+
+#include <cxsys/Configure.hxx>
+
+#include <string>
+#include <vector>
+
+namespace clang {
+  class CompilerInstance;
+}
+
+/// startPrefetch - Read the files listed in the named file on the given
+/// number of background threads so that their first reads by the parse
+/// find them in the operating system's cache, as for headers on a
+/// network file system.  The file is a list written by an earlier run,
+/// or a Make-style dependency file such as one written by '-MD'.  If
+/// it is missing or such a list, its content is replaced at exit with
+/// the files read by this run, in order of first use.
+void startPrefetch(std::string const& fname, unsigned int threads);
+
+/// readPrefetchList - Append to files those listed in the named file as
+/// startPrefetch reads them.
+void readPrefetchList(std::string const& fname,
+                      std::vector<std::string>& files);
+
+/// recordPrefetch - Add the files read by the given compiler instance to
+/// the list written at exit by startPrefetch.  Parallel jobs may call
+/// this at the same time.
+void recordPrefetch(clang::CompilerInstance& ci);
+
+#endif // CASTXML_PREFETCH_H
@@ -0,0 +1,186 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "ResourceFS.h"
+#include "Context.h"
+#include "TimeReport.h"
+#include "Utils.h"
+
+#include "clang/Basic/VirtualFileSystem.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#ifdef CASTXML_EMBED_RESOURCES
+// Generated by EmbedResources.cmake.
+extern EmbeddedResource const embeddedResources[];
+#else
+static EmbeddedResource const embeddedResources[] = { { 0, 0, 0 } };
+#endif
+
+//----------------------------------------------------------------------------
+bool haveEmbeddedResources()
+{
+  return embeddedResources[0].Path != 0;
+}
+
+//----------------------------------------------------------------------------
+class ResourceFile: public clang::vfs::File
+{
+  clang::vfs::Status Status;
+  llvm::StringRef Data;
+public:
+  ResourceFile(clang::vfs::Status const& status, llvm::StringRef data):
+    Status(status), Data(data) {}
+
+  llvm::ErrorOr<clang::vfs::Status> status() override {
+    return this->Status;
+  }
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>>
+  getBuffer(llvm::Twine const& name, int64_t, bool, bool) override {
+    // The generated data are followed by a null terminator.
+    return llvm::MemoryBuffer::getMemBuffer(this->Data, name.str(), true);
+  }
+
+  std::error_code close() override {
+    return std::error_code();
+  }
+
+  void setName(llvm::StringRef name) override {
+    this->Status.setName(name);
+  }
+};
+
+//----------------------------------------------------------------------------
+/// Serve the embedded resources from memory.  Every path is given an
+/// unchanging status at construction so that the FileManager and any
+/// PCH built from these files see the same identity on each lookup.
+class ResourceFileSystem: public clang::vfs::FileSystem
+{
+  struct Entry
+  {
+    clang::vfs::Status Status;
+    llvm::StringRef Data;
+  };
+  llvm::StringMap<Entry> Entries;
+
+  void AddEntry(std::string const& path, llvm::sys::fs::file_type type,
+                llvm::StringRef data) {
+    Entry& e = this->Entries[path];
+    e.Status = clang::vfs::Status(
+      path, path, clang::vfs::getNextVirtualUniqueID(),
+      llvm::sys::TimeValue(), 0, 0, data.size(), type,
+      llvm::sys::fs::all_read);
+    e.Data = data;
+  }
+
+  void AddDirectories(std::string const& root, std::string const& path) {
+    // Add the directories between the root and the file, inclusive.
+    std::string dir = llvm::sys::path::parent_path(path);
+    while(dir.size() >= root.size() && !this->Entries.count(dir)) {
+      this->AddEntry(dir, llvm::sys::fs::file_type::directory_file,
+                     llvm::StringRef());
+      dir = llvm::sys::path::parent_path(dir);
+    }
+  }
+
+public:
+  ResourceFileSystem(std::string const& resourceDir,
+                     std::string const& clangResourceDir) {
+    for(EmbeddedResource const* r = embeddedResources; r->Path; ++r) {
+      // Map "castxml/..." and "clang/..." to the resource directories.
+      llvm::StringRef const rel = r->Path;
+      std::string const root = rel.startswith("castxml/")?
+        resourceDir : clangResourceDir;
+      std::string const path = root + rel.substr(rel.find('/')).str();
+      this->AddEntry(path, llvm::sys::fs::file_type::regular_file,
+                     llvm::StringRef(r->Data, r->Size));
+      this->AddDirectories(root, path);
+    }
+  }
+
+  llvm::ErrorOr<clang::vfs::Status> status(llvm::Twine const& path) override {
+    llvm::StringMap<Entry>::const_iterator i =
+      this->Entries.find(path.str());
+    if(i == this->Entries.end()) {
+      return std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+    return i->second.Status;
+  }
+
+  llvm::ErrorOr<std::unique_ptr<clang::vfs::File>>
+  openFileForRead(llvm::Twine const& path) override {
+    llvm::StringMap<Entry>::const_iterator i =
+      this->Entries.find(path.str());
+    if(i == this->Entries.end()) {
+      return std::make_error_code(std::errc::no_such_file_or_directory);
+    }
+    if(i->second.Status.isDirectory()) {
+      return std::make_error_code(std::errc::is_a_directory);
+    }
+    return std::unique_ptr<clang::vfs::File>(
+      new ResourceFile(i->second.Status, i->second.Data));
+  }
+
+  clang::vfs::directory_iterator
+  dir_begin(llvm::Twine const&, std::error_code& ec) override {
+    // Header search does not list directories.  Report none here so
+    // that an overlay lists those of the underlying file system.
+    ec = std::error_code();
+    return clang::vfs::directory_iterator();
+  }
+};
+
+//----------------------------------------------------------------------------
+llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem>
+overlayResourceFileSystem(
+  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> const& base,
+  Context const& ctx)
+{
+  if(!haveEmbeddedResources()) {
+    return base;
+  }
+
+  // Build the resources once for each pair of directories and share
+  // them between contexts and threads since they never change.
+  typedef std::pair<std::string, std::string> ResourceDirs;
+  static std::mutex mutex;
+  static std::map<ResourceDirs,
+                  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> > cache;
+  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> resources;
+  {
+    ReportedLock lock(mutex, "Resource files");
+    llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem>& r =
+      cache[ResourceDirs(ctx.ResourceDir, ctx.ClangResourceDir)];
+    if(!r) {
+      r = new ResourceFileSystem(ctx.ResourceDir, ctx.ClangResourceDir);
+    }
+    resources = r;
+  }
+  llvm::IntrusiveRefCntPtr<clang::vfs::OverlayFileSystem>
+    overlay(new clang::vfs::OverlayFileSystem(base));
+  overlay->pushOverlay(resources);
+  return overlay;
+}
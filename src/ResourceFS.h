@@ -0,0 +1,55 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_RESOURCEFS_H
+#define CASTXML_RESOURCEFS_H
+
+#include <cxsys/Configure.hxx>
+
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+
+#include <stddef.h>
+
+namespace clang {
+  namespace vfs {
+    class FileSystem;
+  }
+}
+class Context;
+
+/// EmbeddedResource - A resource file compiled into the executable.
+/// The path is relative to the directory holding the castxml and Clang
+/// resource directories, e.g. "castxml/empty.cpp".
+struct EmbeddedResource
+{
+  const char* Path;
+  const char* Data;
+  size_t Size;
+};
+
+/// haveEmbeddedResources - Check whether resources are compiled into
+/// this build so that they need not be found on disk.
+bool haveEmbeddedResources();
+
+/// overlayResourceFileSystem - Serve the resources compiled into this
+/// build, if any, from memory at the resource directories of the
+/// context in place of the given file system.  Other paths are passed
+/// through to it.
+llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem>
+overlayResourceFileSystem(
+  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> const& base,
+  Context const& ctx);
+
+#endif // CASTXML_RESOURCEFS_H
@@ -15,50 +15,502 @@
 */
 
 #include "RunClang.h"
+#include "AsyncStream.h"
+#include "Compress.h"
+#include "Context.h"
+#include "Detect.h"
+#include "IncludeIndex.h"
 #include "Options.h"
 #include "Output.h"
+#include "OutputHandler.h"
+#include "OutputTable.h"
+#include "Prefetch.h"
+#include "ResourceFS.h"
+#include "Schedule.h"
+#include "SharedFS.h"
+#include "StringPool.h"
+#include "TimeReport.h"
 #include "Utils.h"
 
+#include <cxsys/Glob.hxx>
 #include <cxsys/SystemTools.hxx>
 
 #include "clang/AST/ASTConsumer.h"
+#include "clang/AST/ASTContext.h"
 #include "clang/AST/Decl.h"
 #include "clang/AST/DeclCXX.h"
+#include "clang/AST/DeclTemplate.h"
+#include "clang/AST/ExternalASTSource.h"
+#include "clang/AST/Mangle.h"
+#include "clang/Basic/FileManager.h"
+#include "clang/Basic/TargetInfo.h"
+#include "clang/Basic/VirtualFileSystem.h"
 #include "clang/Driver/Compilation.h"
 #include "clang/Driver/Driver.h"
 #include "clang/Driver/DriverDiagnostic.h"
 #include "clang/Driver/Options.h"
 #include "clang/Driver/Tool.h"
+#include "clang/Driver/Types.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendActions.h"
 #include "clang/Frontend/FrontendDiagnostic.h"
 #include "clang/Frontend/TextDiagnosticPrinter.h"
 #include "clang/Frontend/Utils.h"
+#include "clang/Lex/HeaderSearch.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Lex/PPCallbacks.h"
 #include "clang/Lex/Preprocessor.h"
+#include "clang/Lex/PreprocessorOptions.h"
+#include "clang/Parse/Parser.h"
 #include "clang/Sema/Sema.h"
+#include "clang/Serialization/ASTDeserializationListener.h"
+#include "clang/Serialization/ASTWriter.h"
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/Option/Arg.h"
 #include "llvm/Option/ArgList.h"
+#include "llvm/Option/Option.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/Host.h"
+#include "llvm/Support/LockFileManager.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <iostream>
+#include <list>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <queue>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GLIBC__)
+# include <malloc.h>
+#endif
+
+#if !defined(_WIN32)
+# include <errno.h>
+# include <poll.h>
+# include <sys/wait.h>
+# include <unistd.h>
+#endif
+
+//----------------------------------------------------------------------------
+static llvm::raw_ostream& getDiagnosticStream(Options const& opts)
+{
+  return opts.DiagnosticStream? *opts.DiagnosticStream : llvm::errs();
+}
+
+//----------------------------------------------------------------------------
+static size_t getCompilerMemory(clang::CompilerInstance& ci,
+                                clang::ASTContext& ctx)
+{
+  // The compiler tables are at their largest at the end of the
+  // translation unit, and dominate the memory used for an input.
+  clang::SourceManager const& sm = ci.getSourceManager();
+  clang::SourceManager::MemoryBufferSizes buffers =
+    sm.getMemoryBufferSizes();
+  return (ctx.getASTAllocatedMemory() + ctx.getSideTableAllocatedMemory() +
+          sm.getContentCacheSize() + sm.getDataStructureSizes() +
+          buffers.malloc_bytes + buffers.mmap_bytes +
+          ci.getPreprocessor().getTotalMemory());
+}
+
+//----------------------------------------------------------------------------
+static void dropSourceBuffers(clang::SourceManager& sm, Options const& opts)
+{
+  // File hashes and the header cache must see the content that was
+  // parsed, and stable ids and the index find the column of
+  // locations, which needs the content.
+  if(opts.FileHashes || !opts.HeaderCacheDir.empty() || opts.StableIds ||
+     opts.Index) {
+    return;
+  }
+
+  // Compute the line table of each file now, while its content is
+  // loaded, since the output looks up the line of every location.
+  for(unsigned int i = 0, n = sm.local_sloc_entry_size(); i < n; ++i) {
+    clang::SrcMgr::SLocEntry const& e = sm.getLocalSLocEntry(i);
+    if(!e.isFile()) {
+      continue;
+    }
+    clang::SrcMgr::ContentCache const* cc = e.getFile().getContentCache();
+    if(cc && cc->OrigEntry && !cc->SourceLineCache && cc->getRawBuffer()) {
+      sm.getSpellingLineNumber(
+        clang::SourceLocation::getFromRawEncoding(e.getOffset()));
+    }
+  }
+
+  // Drop the content of the files read from disk.  A content cache
+  // without a buffer reads its file again if the output needs the
+  // text, as for default arguments.  The lexer of the main file still
+  // points into its buffer, and buffers given in memory have no file
+  // to be read again from.
+  clang::FileEntry const* mainFile =
+    sm.getFileEntryForID(sm.getMainFileID());
+  for(clang::SourceManager::fileinfo_iterator i = sm.fileinfo_begin(),
+        e = sm.fileinfo_end(); i != e; ++i) {
+    clang::SrcMgr::ContentCache* cc = i->second;
+    if(i->first != mainFile && cc->OrigEntry &&
+       !cc->BufferOverridden && cc->getRawBuffer() &&
+       cc->shouldFreeBuffer()) {
+      cc->replaceBuffer(nullptr);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+static void releaseParseState(clang::CompilerInstance& ci,
+                              Options const& opts)
+{
+  PhaseRegion t("Release parse state");
+  TraceRegion tr("Release parse state");
+  dropSourceBuffers(ci.getSourceManager(), opts);
+
+  // The parse is over, so the header search needs no more of what it
+  // learned about each header, such as its include guard.
+  if(opts.ReleaseParseState) {
+    ci.getPreprocessor().getHeaderSearchInfo().ClearFileInfo();
+  }
+
+#if defined(__GLIBC__)
+  // Give the freed pages back so that the output starts from a lower
+  // resident size.
+  malloc_trim(0);
+#endif
+}
+
+//----------------------------------------------------------------------------
+/// Find classes that may be dumped with their members when starting from
+/// the --castxml-start declarations.  This follows the same declarations
+/// and types to which ASTVisitor propagates complete output.
+class StartReachability
+{
+  std::set<clang::Decl const*> Decls;
+  std::set<clang::Type const*> Types;
+  std::set<clang::CXXRecordDecl const*> Walked;
+  std::vector<clang::NamedDecl const*> Starts;
+
+  void AddDeclContext(clang::DeclContext const* dc) {
+    for(clang::DeclContext::decl_iterator i = dc->decls_begin(),
+          e = dc->decls_end(); i != e; ++i) {
+      if((*i)->getDeclContext() == dc ||
+         clang::isa<clang::LinkageSpecDecl>(dc)) {
+        this->AddDecl(*i);
+      }
+    }
+  }
+  void AddRecord(clang::CXXRecordDecl const* rd) {
+    this->Decls.insert(rd->getCanonicalDecl());
+    rd = rd->getDefinition();
+    if(!rd || !this->Walked.insert(rd).second) {
+      return;
+    }
+    for(clang::CXXRecordDecl::base_class_const_iterator
+          i = rd->bases_begin(), e = rd->bases_end(); i != e; ++i) {
+      this->AddType(i->getType());
+    }
+    this->AddDeclContext(rd);
+  }
+public:
+  bool Contains(clang::CXXRecordDecl const* rd) const {
+    // Classes nested in a start declaration are always dumped.
+    for(clang::DeclContext const* dc = rd; dc; dc = dc->getParent()) {
+      clang::Decl const* d = clang::Decl::castFromDeclContext(dc);
+      if(this->Decls.count(d->getCanonicalDecl())) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void AddStartNames(clang::CompilerInstance& ci, clang::ASTContext& ctx,
+                     std::vector<std::string> const& names) {
+    std::vector<std::vector<clang::NamedDecl const*>> found;
+    lookupStartDecls(ci, ctx.getTranslationUnitDecl(), names, found);
+    for(std::vector<clang::NamedDecl const*> const& d : found) {
+      this->Starts.insert(this->Starts.end(), d.begin(), d.end());
+    }
+    this->Update();
+  }
+
+  void Update() {
+    // Walk again from the start to find what new definitions reach.
+    this->Decls.clear();
+    this->Types.clear();
+    this->Walked.clear();
+    for(clang::NamedDecl const* n : this->Starts) {
+      this->AddDecl(n);
+    }
+  }
+
+  void AddDecl(clang::Decl const* d) {
+    if(clang::CXXRecordDecl const* rd =
+       clang::dyn_cast<clang::CXXRecordDecl>(d)) {
+      if(!rd->isInjectedClassName()) {
+        this->AddRecord(rd);
+      }
+      return;
+    }
+    if(!this->Decls.insert(d->getCanonicalDecl()).second) {
+      return;
+    }
+    if(clang::ClassTemplateDecl const* ctd =
+       clang::dyn_cast<clang::ClassTemplateDecl>(d)) {
+      for(clang::ClassTemplateDecl::spec_iterator i = ctd->spec_begin(),
+            e = ctd->spec_end(); i != e; ++i) {
+        this->AddRecord(*i);
+      }
+    } else if(clang::FunctionTemplateDecl const* ftd =
+              clang::dyn_cast<clang::FunctionTemplateDecl>(d)) {
+      for(clang::FunctionTemplateDecl::spec_iterator i = ftd->spec_begin(),
+            e = ftd->spec_end(); i != e; ++i) {
+        this->AddDecl(*i);
+      }
+    } else if(clang::UsingDecl const* ud =
+              clang::dyn_cast<clang::UsingDecl>(d)) {
+      for(clang::UsingDecl::shadow_iterator i = ud->shadow_begin(),
+            e = ud->shadow_end(); i != e; ++i) {
+        this->AddDecl((*i)->getTargetDecl());
+      }
+    } else if(clang::UsingShadowDecl const* sd =
+              clang::dyn_cast<clang::UsingShadowDecl>(d)) {
+      this->AddDecl(sd->getTargetDecl());
+    } else if(clang::TypedefNameDecl const* td =
+              clang::dyn_cast<clang::TypedefNameDecl>(d)) {
+      this->AddType(td->getUnderlyingType());
+    } else if(clang::ValueDecl const* vd =
+              clang::dyn_cast<clang::ValueDecl>(d)) {
+      this->AddType(vd->getType());
+    } else if(clang::NamespaceDecl const* nd =
+              clang::dyn_cast<clang::NamespaceDecl>(d)) {
+      for(clang::NamespaceDecl const* r : nd->redecls()) {
+        this->AddDeclContext(r);
+      }
+    } else if(clang::LinkageSpecDecl const* lsd =
+              clang::dyn_cast<clang::LinkageSpecDecl>(d)) {
+      this->AddDeclContext(lsd);
+    }
+  }
+
+  void AddType(clang::QualType qt) {
+    if(qt.isNull()) {
+      return;
+    }
+    clang::Type const* t = qt.getCanonicalType().getTypePtr();
+    if(!this->Types.insert(t).second) {
+      return;
+    }
+    if(clang::CXXRecordDecl const* rd = t->getAsCXXRecordDecl()) {
+      this->AddRecord(rd);
+    } else if(clang::PointerType const* pt =
+              clang::dyn_cast<clang::PointerType>(t)) {
+      this->AddType(pt->getPointeeType());
+    } else if(clang::ReferenceType const* rt =
+              clang::dyn_cast<clang::ReferenceType>(t)) {
+      this->AddType(rt->getPointeeType());
+    } else if(clang::MemberPointerType const* mpt =
+              clang::dyn_cast<clang::MemberPointerType>(t)) {
+      this->AddType(clang::QualType(mpt->getClass(), 0));
+      this->AddType(mpt->getPointeeType());
+    } else if(clang::ArrayType const* at =
+              clang::dyn_cast<clang::ArrayType>(t)) {
+      this->AddType(at->getElementType());
+    } else if(clang::FunctionType const* ft =
+              clang::dyn_cast<clang::FunctionType>(t)) {
+      this->AddType(ft->getReturnType());
+      if(clang::FunctionProtoType const* fpt =
+         clang::dyn_cast<clang::FunctionProtoType>(ft)) {
+        for(clang::FunctionProtoType::param_type_iterator
+              i = fpt->param_type_begin(), e = fpt->param_type_end();
+            i != e; ++i) {
+          this->AddType(*i);
+        }
+        for(clang::FunctionProtoType::exception_iterator
+              i = fpt->exception_begin(), e = fpt->exception_end();
+            i != e; ++i) {
+          this->AddType(*i);
+        }
+      }
+    }
+  }
+};
+
+//----------------------------------------------------------------------------
+static std::string getDefaultOutputName(Options const& opts,
+                                        llvm::StringRef input)
+{
+  // Match the name createDefaultOutputFile gives our output, placed in
+  // the output directory if any.
+  if(input == "-") {
+    return "-";
+  }
+  llvm::SmallString<128> name(opts.OutputDir);
+  llvm::sys::path::append(name, llvm::sys::path::filename(input));
+  llvm::sys::path::replace_extension(
+    name, opts.OutputFormat.empty()? "xml" : opts.OutputFormat);
+  return name.str();
+}
 
 //----------------------------------------------------------------------------
-class ASTConsumer: public clang::ASTConsumer
+class ASTConsumer: public clang::ASTConsumer,
+                   public clang::ASTDeserializationListener
 {
   clang::CompilerInstance& CI;
+  std::unique_ptr<llvm::raw_ostream> Compressed;
+  std::unique_ptr<llvm::raw_ostream> Async;
   llvm::raw_ostream& OS;
+
+  // With '--castxml-template-report', a copy of the options naming
+  // TemplateOutput for the output to fill.
+  TemplateOutputCounts TemplateOutput;
+  Options ReportOpts;
+
   Options const& Opts;
   std::queue<clang::CXXRecordDecl*> Classes;
+  StartReachability Reachable;
+  std::unique_ptr<PhaseRegion> ParseRegion;
+  std::unique_ptr<TraceRegion> ParseTrace;
+
+  struct ClassCost {
+    clang::CXXRecordDecl const* Record;
+    double Seconds;
+    unsigned int Instantiations;
+    bool operator<(ClassCost const& r) const {
+      return this->Seconds > r.Seconds;
+    }
+  };
+  std::vector<ClassCost> ClassCosts;
+  unsigned int Instantiations;
+
+  // The mangling context of OutputDecls.
+  std::unique_ptr<clang::MangleContext> Mangle;
+
+  struct TemplateCost {
+    TemplateCost(): Seconds(0), Instantiations(0) {}
+    double Seconds;
+    unsigned int Instantiations;
+  };
+  typedef std::map<clang::ClassTemplateDecl const*, TemplateCost>
+    TemplateCostMap;
+  TemplateCostMap TemplateCosts;
+
+  void StopParseTimer() {
+    this->ParseRegion.reset();
+    this->ParseTrace.reset();
+  }
+
+  bool LimitExceeded() {
+    return this->Opts.Limits &&
+      this->Opts.Limits->Exceeded(this->CI.getDiagnostics());
+  }
 public:
   ASTConsumer(clang::CompilerInstance& ci, llvm::raw_ostream& os,
               Options const& opts):
-    CI(ci), OS(os), Opts(opts) {}
+    CI(ci),
+    Compressed(createCompressedStream(opts.OutputCompression, os,
+                                      ci.getDiagnostics())),
+    Async(opts.AsyncOutput?
+          createAsyncStream(this->Compressed? *this->Compressed : os,
+                            opts.OutputBufferSize) :
+          std::unique_ptr<llvm::raw_ostream>()),
+    OS(this->Async? *this->Async :
+       this->Compressed? *this->Compressed : os),
+    ReportOpts(opts.TemplateReport? opts : Options()),
+    Opts(opts.TemplateReport? this->ReportOpts : opts),
+    ParseTrace(new TraceRegion("Parsing", traceEnabled()?
+                               ci.getFrontendOpts().Inputs[0].getFile().str() :
+                               std::string())),
+    Instantiations(0) {
+    if(opts.TemplateReport) {
+      this->ReportOpts.TemplateOutput = &this->TemplateOutput;
+    }
+    if(opts.Limits) {
+      opts.Limits->SetMemoryProbe([this]() {
+          return getCompilerMemory(this->CI, this->CI.getASTContext());
+        });
+    }
+
+    // The parser runs from now until the translation unit is handled.
+    this->ParseRegion.reset(new PhaseRegion("Parsing"));
+  }
+
+  /** Instantiate the templates and declare the implicit members of
+      the classes that the declarations parsed so far need, as the end
+      of the translation unit does, for a translation unit continued by
+      '--castxml-snippets'.  */
+  void CompleteDecls() {
+    this->StopParseTimer();
+    clang::Sema& sema = this->CI.getSema();
+    sema.PerformPendingInstantiations();
+
+    // Failures in implicit members are not diagnosed, as at the end of
+    // the translation unit.  The layout needs no implicit members.
+    clang::DiagnosticsEngine& diags = sema.getDiagnostics();
+    bool const suppressed = diags.getSuppressAllDiagnostics();
+    diags.setSuppressAllDiagnostics(true);
+    while(!this->Classes.empty()) {
+      clang::CXXRecordDecl* rd = this->Classes.front();
+      this->Classes.pop();
+      if(!this->Opts.Layout) {
+        this->AddImplicitMembers(rd);
+      }
+    }
+    sema.PerformPendingInstantiations();
+    diags.setSuppressAllDiagnostics(suppressed);
+  }
+
+  /** Write the output starting from the given declarations, sharing
+      one mangling context among the calls.  */
+  void OutputDecls(clang::ASTContext& ctx,
+                   std::vector<clang::Decl const*> const& decls,
+                   llvm::raw_ostream& os) {
+    if(!this->Mangle && ctx.getLangOpts().CPlusPlus) {
+      this->Mangle.reset(ctx.createMangleContext());
+    }
+    Options opts = this->Opts;
+    opts.StartDecls = &decls;
+    outputXML(this->CI, ctx, os, opts, this->Mangle.get());
+  }
+
+  ~ASTConsumer() {
+    this->StopParseTimer();
+    if(this->Opts.Limits) {
+      this->Opts.Limits->SetMemoryProbe(std::function<size_t()>());
+    }
+  }
 
   void AddImplicitMembers(clang::CXXRecordDecl* rd) {
+    std::string name;
+    if(traceEnabled()) {
+      llvm::raw_string_ostream os(name);
+      clang::PrintingPolicy const& pp =
+        this->CI.getASTContext().getPrintingPolicy();
+      rd->getNameForDiagnostic(os, pp, true);
+    }
+    TraceRegion tr("Add implicit members", name);
+    std::chrono::steady_clock::time_point start;
+    unsigned int const instantiations = this->Instantiations;
+    bool const timed =
+      this->Opts.ImplicitMembersReport || this->Opts.TemplateReport;
+    if(timed) {
+      start = std::chrono::steady_clock::now();
+    }
     clang::Sema& sema = this->CI.getSema();
     sema.ForceDeclarationOfImplicitMembers(rd);
 
@@ -79,17 +531,218 @@ public:
           mark = (m->isCopyAssignmentOperator() ||
                   m->isMoveAssignmentOperator());
         }
-        if (mark) {
+        if (mark && this->Opts.DeclareImplicitMembers) {
+          /* Declaring the member decided whether it is deleted or
+             trivial.  Compute its exception specification for the
+             throw attribute without defining it.  */
+          clang::FunctionProtoType const* fpt =
+            m->getType()->getAs<clang::FunctionProtoType>();
+          if (fpt && clang::isUnresolvedExceptionSpec(
+                fpt->getExceptionSpecType())) {
+            sema.ResolveExceptionSpec(clang::SourceLocation(), fpt);
+          }
+        } else if (mark) {
           /* Ensure the member is defined.  */
           sema.MarkFunctionReferenced(clang::SourceLocation(), m);
           /* Finish implicitly instantiated member.  */
-          sema.PerformPendingInstantiations();
+          if (!this->Opts.DeferInstantiations) {
+            sema.PerformPendingInstantiations();
+          }
+        }
+      }
+    }
+
+    if(!timed) {
+      return;
+    }
+    std::chrono::duration<double> d =
+      std::chrono::steady_clock::now() - start;
+    if(this->Opts.ImplicitMembersReport) {
+      ClassCost cost = { rd, d.count(),
+                         this->Instantiations - instantiations };
+      this->ClassCosts.push_back(cost);
+    }
+    if(this->Opts.TemplateReport) {
+      if(clang::ClassTemplateSpecializationDecl* s =
+         clang::dyn_cast<clang::ClassTemplateSpecializationDecl>(rd)) {
+        this->TemplateCosts[
+          s->getSpecializedTemplate()->getCanonicalDecl()].Seconds +=
+          d.count();
+      }
+    }
+  }
+
+  void WriteImplicitMembersReport() {
+    size_t const n = std::min<size_t>(this->ClassCosts.size(),
+                                      this->Opts.ImplicitMembersReport);
+    std::partial_sort(this->ClassCosts.begin(),
+                      this->ClassCosts.begin() + n, this->ClassCosts.end());
+    clang::PrintingPolicy const& pp =
+      this->CI.getASTContext().getPrintingPolicy();
+    llvm::raw_ostream& os = getDiagnosticStream(this->Opts);
+    os << "castxml implicit members report (" << n << " of " <<
+      this->ClassCosts.size() << " classes):\n"
+      "     Seconds  Instantiations  Class\n";
+    for(size_t i = 0; i < n; ++i) {
+      ClassCost const& c = this->ClassCosts[i];
+      os << llvm::format("%12.6f  %14u  ", c.Seconds, c.Instantiations);
+      c.Record->getNameForDiagnostic(os, pp, true);
+      os << "\n";
+    }
+  }
+
+  void WriteTemplateReport() {
+    struct Entry {
+      clang::ClassTemplateDecl const* Template;
+      TemplateCost Cost;
+      size_t Output;
+      bool operator<(Entry const& r) const {
+        if(this->Cost.Seconds != r.Cost.Seconds) {
+          return this->Cost.Seconds > r.Cost.Seconds;
         }
+        return this->Cost.Instantiations > r.Cost.Instantiations;
+      }
+    };
+    std::vector<Entry> entries;
+    for(TemplateCostMap::const_iterator i = this->TemplateCosts.begin(),
+          e = this->TemplateCosts.end(); i != e; ++i) {
+      Entry entry = { i->first, i->second,
+                      this->TemplateOutput.Specializations[i->first].size() };
+      entries.push_back(entry);
+    }
+    size_t const n = std::min<size_t>(entries.size(),
+                                      this->Opts.TemplateReport);
+    std::partial_sort(entries.begin(), entries.begin() + n, entries.end());
+    llvm::raw_ostream& os = getDiagnosticStream(this->Opts);
+    os << "castxml template report (" << n << " of " << entries.size() <<
+      " class templates):\n"
+      "     Seconds  Instantiations    Output  Template\n";
+    for(size_t i = 0; i < n; ++i) {
+      Entry const& e = entries[i];
+      os << llvm::format("%12.6f  %14u  %8u  ", e.Cost.Seconds,
+                         e.Cost.Instantiations, unsigned(e.Output)) <<
+        e.Template->getQualifiedNameAsString() << "\n";
+    }
+  }
+
+  void OutputAll(clang::ASTContext& ctx) {
+    // Traverse once into a table and write it in every format.
+    OutputTable table;
+    table.SetStringPool(this->Opts.Strings);
+    outputTable(this->CI, ctx, table, this->Opts);
+    if(this->Opts.TopologicalOrder) {
+      table.SortTopologically();
+    }
+    writeOutputTable(table, this->OS, this->Opts.OutputFormat,
+                     this->Opts.InternStrings);
+    for(Options::Output const& o : this->Opts.ExtraOutputs) {
+      llvm::raw_ostream* os =
+        this->CI.createOutputFile(o.File, o.Format == "bin",
+                                  /*RemoveFileOnSignal=*/true, "", "",
+                                  /*UseTemporary=*/true);
+      if(!os) {
+        continue;
+      }
+      std::unique_ptr<llvm::raw_ostream> compressed =
+        createCompressedStream(this->Opts.OutputCompression, *os,
+                               this->CI.getDiagnostics());
+      writeOutputTable(table, compressed? *compressed : *os, o.Format,
+                       this->Opts.InternStrings);
+    }
+  }
+
+  void EmitAST(clang::ASTContext& ctx) {
+    PhaseRegion t("AST serialization");
+    TraceRegion tr("AST serialization", this->Opts.EmitASTFile);
+    llvm::raw_ostream* os =
+      this->CI.createOutputFile(this->Opts.EmitASTFile, /*Binary=*/true,
+                                /*RemoveFileOnSignal=*/true, "", "",
+                                /*UseTemporary=*/true);
+    if(!os) {
+      return;
+    }
+    // Write the AST as Clang writes a PCH for '-emit-ast'.
+    clang::PCHGenerator writer(this->CI.getPreprocessor(),
+                               this->Opts.EmitASTFile, nullptr, "", os);
+    writer.InitializeSema(this->CI.getSema());
+    writer.HandleTranslationUnit(ctx);
+  }
+
+  void OutputStartGroups(clang::ASTContext& ctx) {
+    // Share one mangling context so that names needing discriminators
+    // are numbered the same way in every group's output.  C needs none.
+    std::unique_ptr<clang::MangleContext> mangle(
+      ctx.getLangOpts().CPlusPlus? ctx.createMangleContext() : nullptr);
+    for(Options::StartGroup const& g : this->Opts.StartGroups) {
+      TraceRegion tr("Start group", g.File);
+      llvm::raw_ostream* os =
+        this->CI.createOutputFile(g.File, this->Opts.OutputFormat == "bin",
+                                  /*RemoveFileOnSignal=*/true, "", "",
+                                  /*UseTemporary=*/true);
+      if(!os) {
+        continue;
+      }
+      os->SetBufferSize(this->Opts.OutputBufferSize);
+      std::unique_ptr<llvm::raw_ostream> compressed =
+        createCompressedStream(this->Opts.OutputCompression, *os,
+                               this->CI.getDiagnostics());
+      Options opts = this->Opts;
+      opts.StartNames = g.Names;
+      outputXML(this->CI, ctx, compressed? *compressed : *os, opts,
+                mangle.get());
+    }
+  }
+
+  void OutputUnityHeaders(clang::ASTContext& ctx) {
+    // Traverse once, completing the declarations of every header, and
+    // let the handler give each header its own output.
+    // The handler finds the headers by the names of File elements, so
+    // it is given them as mapped by '--castxml-path-prefix-map'.
+    Options opts = this->Opts;
+    std::vector<std::string> headers;
+    std::vector<std::string> files;
+    for(std::string const& header : opts.UnityHeaders) {
+      opts.FileFilters.push_back(
+        cxsys::Glob::PatternToRegex(header, true, true));
+      files.push_back(getDefaultOutputName(opts, header));
+      std::string mapped = header;
+      if(!opts.PathPrefixMaps.empty()) {
+        mapped = cxsys::SystemTools::CollapseFullPath(
+          mapPathPrefix(opts, header));
+        cxsys::SystemTools::ConvertToUnixSlashes(mapped);
       }
+      headers.push_back(mapped);
     }
+    std::unique_ptr<OutputHandler> handler =
+      createUnityHandler(this->CI, headers, files, opts.OutputCompression);
+    outputEvents(this->CI, ctx, *handler, opts);
+  }
+
+  bool HandleTopLevelDecl(clang::DeclGroupRef) {
+    // The parser stops at once if we return false.
+    return !this->LimitExceeded();
+  }
+
+  void HandleCXXImplicitFunctionInstantiation(clang::FunctionDecl*) {
+    ++this->Instantiations;
   }
 
   void HandleTagDeclDefinition(clang::TagDecl* d) {
+    // C has no templates or implicit members to keep track of.
+    if(!this->CI.getLangOpts().CPlusPlus) {
+      return;
+    }
+    if(clang::ClassTemplateSpecializationDecl* s =
+       clang::dyn_cast<clang::ClassTemplateSpecializationDecl>(d)) {
+      if(s->getTemplateSpecializationKind() !=
+         clang::TSK_ExplicitSpecialization) {
+        ++this->Instantiations;
+        if(this->Opts.TemplateReport) {
+          ++this->TemplateCosts[
+            s->getSpecializedTemplate()->getCanonicalDecl()].Instantiations;
+        }
+      }
+    }
     if(clang::CXXRecordDecl* rd = clang::dyn_cast<clang::CXXRecordDecl>(d)) {
       if(!rd->isDependentContext()) {
         this->Classes.push(rd);
@@ -97,29 +750,195 @@ public:
     }
   }
 
+  clang::ASTDeserializationListener* GetASTDeserializationListener() {
+    return this;
+  }
+
+  void DeclRead(clang::serialization::DeclID, clang::Decl const* d) {
+    // Classes defined in a precompiled prelude are not given to
+    // HandleTagDeclDefinition.  Queue them as they are loaded.
+    if(clang::CXXRecordDecl const* rd =
+       clang::dyn_cast<clang::CXXRecordDecl>(d)) {
+      if(rd->isCompleteDefinition() && !rd->isDependentContext()) {
+        this->Classes.push(const_cast<clang::CXXRecordDecl*>(rd));
+      }
+    }
+  }
+
+  void LoadModuleDecls(clang::DeclContext const* dc) {
+    // Iterating a context deserializes its members, and DeclRead queues
+    // the classes among them.
+    for(clang::Decl const* d : dc->decls()) {
+      if(d->isHidden()) {
+        continue;
+      }
+      if(clang::NamespaceDecl const* nd =
+         clang::dyn_cast<clang::NamespaceDecl>(d)) {
+        this->LoadModuleDecls(nd);
+      } else if(clang::LinkageSpecDecl const* lsd =
+                clang::dyn_cast<clang::LinkageSpecDecl>(d)) {
+        this->LoadModuleDecls(lsd);
+      } else if(clang::CXXRecordDecl const* rd =
+                clang::dyn_cast<clang::CXXRecordDecl>(d)) {
+        if(rd->isCompleteDefinition()) {
+          this->LoadModuleDecls(rd);
+        }
+      }
+    }
+  }
+
   void HandleTranslationUnit(clang::ASTContext& ctx) {
     clang::Sema& sema = this->CI.getSema();
+    this->StopParseTimer();
+    if(this->LimitExceeded()) {
+      return;
+    }
+
+    // An AST loaded from --castxml-load-ast was completed before it was
+    // stored.  Skip the passes below so that declarations are read from
+    // it lazily, only as the output reaches them from the start names.
+    bool const loaded = !this->Opts.LoadASTFile.empty();
+
+    // Declarations from imported modules are loaded lazily, so classes
+    // first loaded by the output would miss their implicit members.
+    // Load the visible declarations now.
+    if(!loaded && ctx.getLangOpts().Modules) {
+      PhaseRegion t("Module loading");
+      TraceRegion tr("Module loading");
+      this->LoadModuleDecls(ctx.getTranslationUnitDecl());
+    }
 
     // Perform instantiations needed by the original translation unit.
-    sema.PerformPendingInstantiations();
+    bool const cxx = ctx.getLangOpts().CPlusPlus;
+    if(!loaded && cxx) {
+      PhaseRegion t("Template instantiation");
+      TraceRegion tr("Template instantiation");
+      sema.PerformPendingInstantiations();
+    }
+
+    // The index and layout list only declarations written in the source.
+    if (!loaded && !this->Opts.Index && !this->Opts.Layout &&
+        !sema.getDiagnostics().hasErrorOccurred()) {
+      PhaseRegion t("Implicit members");
+      TraceRegion tr("Implicit members");
 
-    if (!sema.getDiagnostics().hasErrorOccurred()) {
       // Suppress diagnostics from below extensions to the translation unit.
       sema.getDiagnostics().setSuppressAllDiagnostics(true);
 
-      // Add implicit members to classes.
-      while (!this->Classes.empty()) {
-        clang::CXXRecordDecl* rd = this->Classes.front();
-        this->Classes.pop();
-        this->AddImplicitMembers(rd);
+      // Add implicit members to classes, optionally only to those
+      // that the start declarations may dump with their members.  C has
+      // no classes, so there is nothing to limit.
+      bool const limit = cxx && this->Opts.LimitImplicitMembers &&
+        (!this->Opts.StartNames.empty() || !this->Opts.StartGroups.empty());
+      if (limit) {
+        std::vector<std::string> names = this->Opts.StartNames;
+        for(Options::StartGroup const& g : this->Opts.StartGroups) {
+          names.insert(names.end(), g.Names.begin(), g.Names.end());
+        }
+        this->Reachable.AddStartNames(this->CI, ctx, names);
+      }
+      std::vector<clang::CXXRecordDecl*> skipped;
+      while (!this->Classes.empty() && !this->LimitExceeded()) {
+        while (!this->Classes.empty() && !this->LimitExceeded()) {
+          clang::CXXRecordDecl* rd = this->Classes.front();
+          this->Classes.pop();
+          if (!limit || this->Reachable.Contains(rd)) {
+            this->AddImplicitMembers(rd);
+          } else {
+            skipped.push_back(rd);
+          }
+        }
+        if (this->LimitExceeded()) {
+          break;
+        }
+        if (this->Opts.DeferInstantiations) {
+          // Finish the members marked above in one batch.  It may
+          // define more classes and queue them for another round.
+          TraceRegion tbr("Deferred instantiations");
+          sema.PerformPendingInstantiations();
+        }
+        if (limit && !skipped.empty()) {
+          // Instantiations may have made more classes reachable.
+          this->Reachable.Update();
+          std::vector<clang::CXXRecordDecl*> pending;
+          pending.swap(skipped);
+          for (clang::CXXRecordDecl* rd : pending) {
+            if (this->Reachable.Contains(rd)) {
+              this->Classes.push(rd);
+            } else {
+              skipped.push_back(rd);
+            }
+          }
+        }
+      }
+      if (this->Opts.ImplicitMembersReport) {
+        this->WriteImplicitMembersReport();
       }
     }
 
+    // A job out of time writes no output.
+    if(this->LimitExceeded()) {
+      return;
+    }
+
     // Tell Clang to finish the translation unit and tear down the parser.
-    sema.ActOnEndOfTranslationUnit();
+    if(!loaded) {
+      PhaseRegion t("End of translation unit");
+      TraceRegion tr("End of translation unit");
+      sema.ActOnEndOfTranslationUnit();
+    }
+
+    // Store the AST for later runs if requested.
+    if(!this->Opts.EmitASTFile.empty() &&
+       !sema.getDiagnostics().hasErrorOccurred()) {
+      this->EmitAST(ctx);
+    }
+
+    // Free what only the parse needed before the output builds its
+    // tables, if requested.  A translation unit continued by snippets
+    // or retained for later requests still needs it.
+    if((this->Opts.DropSourceBuffers || this->Opts.ReleaseParseState) &&
+       !this->Opts.Snippets && !this->Opts.RetainAST) {
+      releaseParseState(this->CI, this->Opts);
+    }
+
+    // Let the next job of a pipeline parse while this one writes.
+    if(this->Opts.Pipeline) {
+      this->Opts.Pipeline->StartOutput();
+    }
 
     // Process the AST.
-    outputXML(this->CI, ctx, this->OS, this->Opts);
+    if(this->Opts.Estimate) {
+      outputEstimate(this->CI, ctx, this->OS, this->Opts);
+    } else if(this->Opts.Table) {
+      outputTable(this->CI, ctx, *this->Opts.Table, this->Opts);
+    } else if(this->Opts.Handler) {
+      outputEvents(this->CI, ctx, *this->Opts.Handler, this->Opts);
+    } else if(!this->Opts.StartGroups.empty()) {
+      this->OutputStartGroups(ctx);
+    } else if(!this->Opts.UnityHeaders.empty()) {
+      this->OutputUnityHeaders(ctx);
+    } else if(this->Opts.ExtraOutputs.empty() &&
+              !this->Opts.TopologicalOrder) {
+      outputXML(this->CI, ctx, this->OS, this->Opts);
+    } else {
+      this->OutputAll(ctx);
+    }
+
+    if(this->Opts.TemplateReport) {
+      this->WriteTemplateReport();
+    }
+
+    // Finish writing and compressing output before the output file
+    // is closed.
+    this->Async.reset();
+    this->Compressed.reset();
+
+    // Tell a scheduler how much memory this input took so that it can
+    // predict the memory of later runs.
+    if(this->Opts.MemoryUsed) {
+      *this->Opts.MemoryUsed = getCompilerMemory(this->CI, ctx);
+    }
   }
 };
 
@@ -130,7 +949,12 @@ class CastXMLPredefines: public T
 protected:
   Options const& Opts;
 
-  CastXMLPredefines(Options const& opts): Opts(opts) {}
+  // Whether the PCH loaded by the translation unit was built by one of
+  // our actions and so already defines our predefines.
+  bool PredefinesInPCH;
+
+  CastXMLPredefines(Options const& opts, bool predefinesInPCH = false):
+    Opts(opts), PredefinesInPCH(predefinesInPCH) {}
   std::string UpdatePredefines(std::string const& predefines) {
     // Clang's InitializeStandardPredefinedMacros forces some
     // predefines even when -undef is given.  Filter them out.
@@ -149,12 +973,19 @@ protected:
     }
   }
 
-  bool BeginSourceFileAction(clang::CompilerInstance& CI,
-                             llvm::StringRef /*Filename*/) {
-    if(this->Opts.HaveCC) {
+  void ApplyPredefines(clang::CompilerInstance& CI) {
+    // The PCH reader has already replaced the predefines with only
+    // those the command line adds to the PCH.  Lexing ours again would
+    // just define every macro a second time.
+    if(this->Opts.HaveCC && !this->PredefinesInPCH) {
       CI.getPreprocessor().setPredefines(
       this->UpdatePredefines(CI.getPreprocessor().getPredefines()));
     }
+  }
+
+  bool BeginSourceFileAction(clang::CompilerInstance& CI,
+                             llvm::StringRef /*Filename*/) {
+    this->ApplyPredefines(CI);
 
     // Tell Clang not to tear down the parser at EOF.
     CI.getPreprocessor().enableIncrementalProcessing();
@@ -168,8 +999,88 @@ class CastXMLPrintPreprocessedAction:
   public CastXMLPredefines<clang::PrintPreprocessedAction>
 {
 public:
-  CastXMLPrintPreprocessedAction(Options const& opts):
-    CastXMLPredefines(opts) {}
+  CastXMLPrintPreprocessedAction(Options const& opts, bool predefinesInPCH):
+    CastXMLPredefines(opts, predefinesInPCH) {}
+};
+
+//----------------------------------------------------------------------------
+/// Preprocessor callbacks recording each file entered, in order of
+/// first entry.
+class IncludeClosure: public clang::PPCallbacks
+{
+  clang::SourceManager& SM;
+  llvm::SmallPtrSet<clang::FileEntry const*, 64> Seen;
+public:
+  IncludeClosure(clang::SourceManager& sm): SM(sm) {}
+  std::vector<clang::FileEntry const*> Files;
+
+  void FileChanged(clang::SourceLocation loc, FileChangeReason reason,
+                   clang::SrcMgr::CharacteristicKind,
+                   clang::FileID) override {
+    if(reason != EnterFile) {
+      return;
+    }
+    clang::FileID const fid =
+      this->SM.getFileID(this->SM.getExpansionLoc(loc));
+    if(clang::FileEntry const* fe = this->SM.getFileEntryForID(fid)) {
+      if(this->Seen.insert(fe).second) {
+        this->Files.push_back(fe);
+      }
+    }
+  }
+};
+
+//----------------------------------------------------------------------------
+static void writeDependencyWord(llvm::raw_ostream& os, llvm::StringRef w)
+{
+  for(char c : w) {
+    if(c == ' ') {
+      os << '\\';
+    }
+    os << c;
+  }
+}
+
+//----------------------------------------------------------------------------
+/// Action writing the files the input includes as a dependency rule
+/// for '--castxml-scan-deps'.  Only the preprocessor runs, and it does
+/// not expand macros outside of directives since the tokens are not
+/// kept.
+class CastXMLScanDepsAction:
+  public CastXMLPredefines<clang::PreprocessOnlyAction>
+{
+  void ExecuteAction() override {
+    using llvm::sys::path::filename;
+    clang::CompilerInstance& CI = this->getCompilerInstance();
+    clang::Preprocessor& PP = CI.getPreprocessor();
+    IncludeClosure* closure = new IncludeClosure(CI.getSourceManager());
+    PP.addPPCallbacks(std::unique_ptr<clang::PPCallbacks>(closure));
+    PP.EnterMainSourceFile();
+    clang::Token tok;
+    do {
+      PP.LexUnexpandedToken(tok);
+    } while(tok.isNot(clang::tok::eof));
+    if(CI.getDiagnostics().hasErrorOccurred()) {
+      return;
+    }
+
+    llvm::StringRef const input = this->getCurrentFile();
+    llvm::raw_ostream* OS =
+      CI.createDefaultOutputFile(false, filename(input), "d");
+    if(!OS) {
+      return;
+    }
+    writeDependencyWord(*OS, mapPathPrefix(this->Opts, input));
+    *OS << ':';
+    for(clang::FileEntry const* fe : closure->Files) {
+      *OS << " \\\n  ";
+      writeDependencyWord(*OS, mapPathPrefix(this->Opts, fe->getName()));
+    }
+    *OS << '\n';
+  }
+public:
+  CastXMLScanDepsAction(Options const& opts, bool predefinesInPCH):
+    CastXMLPredefines(opts, predefinesInPCH) {}
 };
 
 //----------------------------------------------------------------------------
@@ -180,54 +1091,1412 @@ class CastXMLSyntaxOnlyAction:
   CreateASTConsumer(clang::CompilerInstance &CI,
                     llvm::StringRef InFile) override {
     using llvm::sys::path::filename;
+    bool const binary = this->Opts.OutputFormat == "bin";
+    const char* extension = "xml";
+    if(!this->Opts.OutputFormat.empty()) {
+      extension = this->Opts.OutputFormat.c_str();
+    }
     if(!this->Opts.GccXml) {
       return clang::SyntaxOnlyAction::CreateASTConsumer(CI, InFile);
+    } else if(!this->Opts.StartGroups.empty() ||
+              !this->Opts.UnityHeaders.empty()) {
+      // Each group or header opens its own output file.
+      return llvm::make_unique<ASTConsumer>(CI, this->NullOS, this->Opts);
+    } else if(this->Opts.Table || this->Opts.Handler) {
+      // The embedding application takes the output table or events.
+      return llvm::make_unique<ASTConsumer>(CI, this->NullOS, this->Opts);
+    } else if(this->Opts.OutputStream) {
+      // The embedding application takes the output.
+      return llvm::make_unique<ASTConsumer>(CI, *this->Opts.OutputStream,
+                                            this->Opts);
     } else if(llvm::raw_ostream* OS =
-              CI.createDefaultOutputFile(false, filename(InFile), "xml")) {
+              CI.createOutputFile(CI.getFrontendOpts().OutputFile, binary,
+                                  /*RemoveFileOnSignal=*/true,
+                                  filename(InFile), extension,
+                                  /*UseTemporary=*/!this->Opts.Progressive)) {
+      // Write large dumps with few system calls.
+      OS->SetBufferSize(this->Opts.OutputBufferSize);
+      if(CI.getFrontendOpts().OutputFile == "-") {
+        growOutputPipe(this->Opts.OutputBufferSize);
+      }
       return llvm::make_unique<ASTConsumer>(CI, *OS, this->Opts);
     } else {
       return 0;
     }
   }
+  llvm::raw_null_ostream NullOS;
 public:
-  CastXMLSyntaxOnlyAction(Options const& opts):
-    CastXMLPredefines(opts) {}
+  CastXMLSyntaxOnlyAction(Options const& opts, bool predefinesInPCH):
+    CastXMLPredefines(opts, predefinesInPCH) {}
 };
 
 //----------------------------------------------------------------------------
-static clang::FrontendAction*
-CreateFrontendAction(clang::CompilerInstance* CI, Options const& opts)
+class CastXMLPreludePCHAction:
+  public CastXMLPredefines<clang::GeneratePCHAction>
 {
-  clang::frontend::ActionKind action =
-    CI->getInvocation().getFrontendOpts().ProgramAction;
-  switch(action) {
-  case clang::frontend::PrintPreprocessedInput:
-    return new CastXMLPrintPreprocessedAction(opts);
-  case clang::frontend::ParseSyntaxOnly:
-    return new CastXMLSyntaxOnlyAction(opts);
-  default:
-    std::cerr << "error: unsupported action: " << int(action) << "\n";
-    return 0;
+  bool BeginSourceFileAction(clang::CompilerInstance& CI,
+                             llvm::StringRef /*Filename*/) override {
+    // Store our predefines in the PCH.  Unlike the other actions
+    // the translation unit is finished normally at EOF.
+    this->ApplyPredefines(CI);
+    return true;
   }
-}
+public:
+  CastXMLPreludePCHAction(Options const& opts):
+    CastXMLPredefines(opts) {}
+};
 
 //----------------------------------------------------------------------------
-static bool runClangCI(clang::CompilerInstance* CI, Options const& opts)
+/// Action parsing the input as the base of a translation unit that is
+/// continued by each snippet read from standard input, writing the
+/// output of the declarations of each snippet, for '--castxml-snippets'.
+class CastXMLSnippetAction:
+  public CastXMLPredefines<clang::SyntaxOnlyAction>
 {
-  // Create a diagnostics engine for this compiler instance.
-  CI->createDiagnostics();
-  if(!CI->hasDiagnostics()) {
-    return false;
+  llvm::raw_null_ostream NullOS;
+
+  std::unique_ptr<clang::ASTConsumer>
+  CreateASTConsumer(clang::CompilerInstance &CI,
+                    llvm::StringRef /*InFile*/) override {
+    // The base writes no output of its own.
+    return llvm::make_unique<ASTConsumer>(CI, this->NullOS, this->Opts);
   }
 
-  // Set frontend options we captured directly.
-  CI->getFrontendOpts().OutputFile = opts.OutputFile;
+  void ExecuteAction() override;
+  bool RunSnippet(clang::CompilerInstance& CI, clang::Parser& parser,
+                  ASTConsumer& consumer, std::string const& text,
+                  unsigned int n);
+public:
+  CastXMLSnippetAction(Options const& opts, bool predefinesInPCH):
+    CastXMLPredefines(opts, predefinesInPCH) {}
+};
 
-  if(opts.GccXml) {
-#   define MSG(x) "error: '--castxml-gccxml' does not work with " x "\n"
-    if(CI->getLangOpts().ObjC1 || CI->getLangOpts().ObjC2) {
-      std::cerr << MSG("Objective C");
-      return false;
+//----------------------------------------------------------------------------
+void CastXMLSnippetAction::ExecuteAction()
+{
+  clang::CompilerInstance& CI = this->getCompilerInstance();
+  if(!CI.hasSema()) {
+    CI.createSema(this->getTranslationUnitKind(), nullptr);
+  }
+  clang::Sema& sema = CI.getSema();
+  ASTConsumer& consumer = static_cast<ASTConsumer&>(sema.getASTConsumer());
+
+  // Parse the base as ParseAST would, stopping at its end.  The
+  // preprocessor was told not to tear down the parser there.
+  clang::Parser parser(CI.getPreprocessor(), sema,
+                       CI.getFrontendOpts().SkipFunctionBodies);
+  CI.getPreprocessor().EnterMainSourceFile();
+  parser.Initialize();
+  if(clang::ExternalASTSource* external =
+     CI.getASTContext().getExternalSource()) {
+    external->StartTranslationUnit(&consumer);
+  }
+  clang::Parser::DeclGroupPtrTy decl;
+  while(!parser.ParseTopLevelDecl(decl)) {
+    if(decl) {
+      consumer.HandleTopLevelDecl(decl.get());
+    }
+  }
+  if(CI.getDiagnostics().hasErrorOccurred()) {
+    return;
+  }
+  consumer.CompleteDecls();
+
+  // Each snippet is a line holding its size in bytes followed by its
+  // text, as for the source buffer of a '--castxml-server' request.
+  std::string line;
+  unsigned int n = 0;
+  while(std::getline(std::cin, line)) {
+    if(line.empty()) {
+      continue;
+    }
+    char* end;
+    unsigned long const size = strtoul(line.c_str(), &end, 10);
+    int result = 1;
+    if(*end != '\0') {
+      std::cerr << "error: snippet size '" << line << "' is not a number\n";
+    } else {
+      std::string text(size, '\0');
+      if(size > 0 && !std::cin.read(&text[0], size)) {
+        std::cerr << "error: snippet " << (n + 1) << " ends early\n";
+        std::cout << "castxml-result 1" << std::endl;
+        return;
+      }
+      result = this->RunSnippet(CI, parser, consumer, text, ++n)? 0 : 1;
+    }
+    llvm::outs().flush();
+    llvm::errs().flush();
+    std::cerr.flush();
+    std::cout << "castxml-result " << result << std::endl;
+  }
+}
+
+//----------------------------------------------------------------------------
+bool CastXMLSnippetAction::RunSnippet(clang::CompilerInstance& CI,
+                                      clang::Parser& parser,
+                                      ASTConsumer& consumer,
+                                      std::string const& text,
+                                      unsigned int n)
+{
+  clang::DiagnosticConsumer const& client = *CI.getDiagnostics().getClient();
+  unsigned int const errors = client.getNumErrors();
+
+  // Continue parsing with the snippet as if it followed the base in
+  // the same file.  The parser holds the end of the text parsed last
+  // as its current token, so consume that to lex the snippet next.
+  std::string const name = "<castxml-snippet-" + std::to_string(n) + ">";
+  clang::FileID fid = CI.getSourceManager().createFileID(
+    llvm::MemoryBuffer::getMemBufferCopy(text, name));
+  CI.getPreprocessor().EnterSourceFile(fid, nullptr,
+                                       clang::SourceLocation());
+  if(parser.getCurToken().is(clang::tok::eof)) {
+    parser.ConsumeToken();
+  }
+  std::vector<clang::Decl const*> decls;
+  clang::Parser::DeclGroupPtrTy decl;
+  while(!parser.ParseTopLevelDecl(decl)) {
+    if(decl) {
+      consumer.HandleTopLevelDecl(decl.get());
+      for(clang::Decl* d : decl.get()) {
+        decls.push_back(d);
+      }
+    }
+  }
+
+  // Only the new declarations are written.
+  consumer.CompleteDecls();
+  if(client.getNumErrors() != errors) {
+    return false;
+  }
+  consumer.OutputDecls(CI.getASTContext(), decls, llvm::outs());
+  return true;
+}
+
+//----------------------------------------------------------------------------
+class CastXMLTokenCacheAction:
+  public CastXMLPredefines<clang::GeneratePTHAction>
+{
+  bool BeginSourceFileAction(clang::CompilerInstance& CI,
+                             llvm::StringRef /*Filename*/) override {
+    // Lex the input with our predefines so that it reads the same
+    // files as the translation unit.  It is finished normally at EOF.
+    this->ApplyPredefines(CI);
+    return true;
+  }
+public:
+  CastXMLTokenCacheAction(Options const& opts):
+    CastXMLPredefines(opts) {}
+};
+
+//----------------------------------------------------------------------------
+/// A stream forwarding to another chosen after it is created, or to
+/// nothing before that.  It buffers nothing so that a forked process
+/// does not write text written before the fork.
+class ForwardStream: public llvm::raw_ostream
+{
+  llvm::raw_ostream* Target;
+  uint64_t Pos;
+  void write_impl(const char* ptr, size_t size) override {
+    if(this->Target) {
+      this->Target->write(ptr, size);
+    }
+    this->Pos += size;
+  }
+  uint64_t current_pos() const override { return this->Pos; }
+public:
+  ForwardStream(): Target(nullptr), Pos(0) { this->SetUnbuffered(); }
+  void SetTarget(llvm::raw_ostream* os) {
+    if(this->Target) {
+      this->Target->flush();
+    }
+    this->Target = os;
+  }
+};
+
+//----------------------------------------------------------------------------
+/// The inputs finished by the processes forked after parsing their
+/// common prelude once for '--castxml-fork-prelude', and the
+/// diagnostics and result of each.
+struct ForkPrelude
+{
+  ForkPrelude(): Result(true) {}
+  std::vector<std::string> Files;
+  std::vector<std::string> Diagnostics;
+  ForwardStream DiagOS;
+  bool Result;
+};
+
+//----------------------------------------------------------------------------
+// The main file of the prelude parsed before forking for each input.
+static char const forkPreludeName[] = "<castxml-prelude>";
+
+#if !defined(_WIN32)
+//----------------------------------------------------------------------------
+static void writeDiagnosticCounts(clang::CompilerInstance& ci,
+                                  llvm::raw_ostream& os)
+{
+  // Summarize the diagnostics as the compiler instance does at the
+  // end of a normal run.
+  if(!ci.getDiagnosticOpts().ShowCarets) {
+    return;
+  }
+  clang::DiagnosticConsumer const& client = *ci.getDiagnostics().getClient();
+  unsigned int const warnings = client.getNumWarnings();
+  unsigned int const errors = client.getNumErrors();
+  if(warnings) {
+    os << warnings << " warning" << (warnings == 1? "" : "s");
+  }
+  if(warnings && errors) {
+    os << " and ";
+  }
+  if(errors) {
+    os << errors << " error" << (errors == 1? "" : "s");
+  }
+  if(warnings || errors) {
+    os << " generated.\n";
+  }
+}
+
+//----------------------------------------------------------------------------
+class CastXMLForkPreludeAction:
+  public CastXMLPredefines<clang::SyntaxOnlyAction>
+{
+  ForkPrelude& Fork;
+  ForwardStream OutOS;
+  Options ConsumerOpts;
+
+  std::unique_ptr<clang::ASTConsumer>
+  CreateASTConsumer(clang::CompilerInstance &CI,
+                    llvm::StringRef /*InFile*/) override {
+    // Each forked process names the output after its own input.
+    return llvm::make_unique<ASTConsumer>(CI, this->OutOS,
+                                          this->ConsumerOpts);
+  }
+
+  void ExecuteAction() override {
+    clang::CompilerInstance& CI = this->getCompilerInstance();
+    if(!CI.hasSema()) {
+      CI.createSema(this->getTranslationUnitKind(), nullptr);
+    }
+    clang::Sema& sema = CI.getSema();
+    clang::ASTConsumer& consumer = sema.getASTConsumer();
+
+    // Parse the prelude as ParseAST would, stopping at its end.  The
+    // preprocessor was told not to tear down the parser there.
+    clang::Parser parser(CI.getPreprocessor(), sema,
+                         CI.getFrontendOpts().SkipFunctionBodies);
+    CI.getPreprocessor().EnterMainSourceFile();
+    parser.Initialize();
+    if(clang::ExternalASTSource* external =
+       CI.getASTContext().getExternalSource()) {
+      external->StartTranslationUnit(&consumer);
+    }
+    clang::Parser::DeclGroupPtrTy decl;
+    while(!parser.ParseTopLevelDecl(decl)) {
+      if(decl && !consumer.HandleTopLevelDecl(decl.get())) {
+        break;
+      }
+    }
+    if(CI.getDiagnostics().hasErrorOccurred()) {
+      this->Fork.Result = false;
+      return;
+    }
+    this->RunInputs(CI, parser, consumer);
+  }
+
+  void RunInputs(clang::CompilerInstance& CI, clang::Parser& parser,
+                 clang::ASTConsumer& consumer);
+  bool StartInput(size_t i, int& fd, pid_t& pid,
+                  clang::CompilerInstance& CI, clang::Parser& parser,
+                  clang::ASTConsumer& consumer);
+  bool FinishInput(std::string const& file, clang::CompilerInstance& CI,
+                   clang::Parser& parser, clang::ASTConsumer& consumer);
+public:
+  CastXMLForkPreludeAction(Options const& opts, ForkPrelude& fork,
+                           bool predefinesInPCH):
+    CastXMLPredefines(opts, predefinesInPCH), Fork(fork), ConsumerOpts(opts) {
+    // A thread writing the output would not survive the fork.
+    this->ConsumerOpts.AsyncOutput = false;
+  }
+};
+
+//----------------------------------------------------------------------------
+void CastXMLForkPreludeAction::RunInputs(clang::CompilerInstance& CI,
+                                         clang::Parser& parser,
+                                         clang::ASTConsumer& consumer)
+{
+  size_t const n = this->Fork.Files.size();
+  size_t const processes = std::max(this->Opts.Jobs, 1u);
+  this->Fork.Diagnostics.assign(n, std::string());
+  std::vector<int> fds(n, -1);
+  std::vector<pid_t> pids(n, -1);
+  size_t next = 0;
+  size_t running = 0;
+  while(next < n || running > 0) {
+    for(; next < n && running < processes; ++next) {
+      if(this->StartInput(next, fds[next], pids[next], CI, parser,
+                          consumer)) {
+        ++running;
+      } else {
+        this->Fork.Result = false;
+        this->Fork.Diagnostics[next] = "error: unable to start a castxml "
+          "process for '" + this->Fork.Files[next] + "'\n";
+      }
+    }
+    if(running == 0) {
+      break;
+    }
+
+    // Collect the diagnostics of each process until it exits.
+    std::vector<struct pollfd> polled;
+    std::vector<size_t> inputs;
+    for(size_t i = 0; i < n; ++i) {
+      if(fds[i] >= 0) {
+        struct pollfd pfd;
+        pfd.fd = fds[i];
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        polled.push_back(pfd);
+        inputs.push_back(i);
+      }
+    }
+    if(poll(&polled[0], polled.size(), -1) < 0) {
+      continue;
+    }
+    for(size_t p = 0; p < polled.size(); ++p) {
+      if(!polled[p].revents) {
+        continue;
+      }
+      size_t const i = inputs[p];
+      char buf[4096];
+      ssize_t r = read(fds[i], buf, sizeof(buf));
+      if(r < 0 && errno == EINTR) {
+        continue;
+      }
+      if(r > 0) {
+        this->Fork.Diagnostics[i].append(buf, size_t(r));
+        continue;
+      }
+      close(fds[i]);
+      fds[i] = -1;
+      --running;
+      int status = 0;
+      while(waitpid(pids[i], &status, 0) < 0 && errno == EINTR) {
+      }
+      if(WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        continue;
+      }
+      this->Fork.Result = false;
+      if(WIFSIGNALED(status)) {
+        this->Fork.Diagnostics[i] += "error: castxml process killed by "
+          "signal " + std::to_string(WTERMSIG(status)) +
+          " while processing '" + this->Fork.Files[i] + "'\n";
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+bool CastXMLForkPreludeAction::StartInput(size_t i, int& fd, pid_t& pid,
+                                          clang::CompilerInstance& CI,
+                                          clang::Parser& parser,
+                                          clang::ASTConsumer& consumer)
+{
+  int diagPipe[2];
+  if(pipe(diagPipe) != 0) {
+    return false;
+  }
+
+  // Flush buffered output so the child does not write it again.
+  llvm::outs().flush();
+  llvm::errs().flush();
+  std::cout.flush();
+  std::cerr.flush();
+
+  pid = fork();
+  if(pid < 0) {
+    close(diagPipe[0]);
+    close(diagPipe[1]);
+    return false;
+  }
+  if(pid == 0) {
+    close(diagPipe[0]);
+    bool result;
+    {
+      llvm::raw_fd_ostream diagOS(diagPipe[1], /*shouldClose=*/true);
+      this->Fork.DiagOS.SetTarget(&diagOS);
+      result = this->FinishInput(this->Fork.Files[i], CI, parser,
+                                 consumer);
+      writeDiagnosticCounts(CI, diagOS);
+      this->Fork.DiagOS.SetTarget(nullptr);
+    }
+
+    // Skip the exit-time reports and teardown of the parent process.
+    _exit(result? 0 : 1);
+  }
+  close(diagPipe[1]);
+  fd = diagPipe[0];
+  return true;
+}
+
+//----------------------------------------------------------------------------
+bool CastXMLForkPreludeAction::FinishInput(std::string const& file,
+                                           clang::CompilerInstance& CI,
+                                           clang::Parser& parser,
+                                           clang::ASTConsumer& consumer)
+{
+  using llvm::sys::path::filename;
+  bool const binary = this->Opts.OutputFormat == "bin";
+  const char* extension = "xml";
+  if(!this->Opts.OutputFormat.empty()) {
+    extension = this->Opts.OutputFormat.c_str();
+  }
+  if(!this->Opts.OutputDir.empty()) {
+    // This forked process writes only the output of this input.
+    CI.getFrontendOpts().OutputFile =
+      getDefaultOutputName(this->Opts, file);
+  }
+  llvm::raw_ostream* OS =
+    CI.createDefaultOutputFile(binary, filename(file), extension);
+  if(!OS) {
+    return false;
+  }
+  OS->SetBufferSize(this->Opts.OutputBufferSize);
+  this->OutOS.SetTarget(OS);
+
+  clang::DiagnosticsEngine& diags = CI.getDiagnostics();
+  clang::SourceManager& sm = CI.getSourceManager();
+  if(clang::FileEntry const* fe = CI.getFileManager().getFile(file)) {
+    // Continue parsing with the input as if it followed the prelude in
+    // the same file.  The parser holds the end of the prelude as its
+    // current token, so consume that to lex the input next.
+    clang::FileID fid =
+      sm.createFileID(fe, clang::SourceLocation(), clang::SrcMgr::C_User);
+    CI.getPreprocessor().EnterSourceFile(fid, nullptr,
+                                         clang::SourceLocation());
+    if(parser.getCurToken().is(clang::tok::eof)) {
+      parser.ConsumeToken();
+    }
+    clang::Parser::DeclGroupPtrTy decl;
+    bool done = false;
+    while(!done && !parser.ParseTopLevelDecl(decl)) {
+      if(decl && !consumer.HandleTopLevelDecl(decl.get())) {
+        done = true;
+      }
+    }
+
+    // Finish the translation unit as ParseAST does, unless the consumer
+    // stopped the parser.
+    if(!done) {
+      clang::Sema& sema = CI.getSema();
+      for(clang::Decl* d : sema.WeakTopLevelDecls()) {
+        consumer.HandleTopLevelDecl(clang::DeclGroupRef(d));
+      }
+      consumer.HandleTranslationUnit(CI.getASTContext());
+    }
+  } else {
+    diags.Report(clang::diag::err_fe_error_reading) << file;
+  }
+
+  this->OutOS.SetTarget(nullptr);
+  bool const result = !diags.hasErrorOccurred();
+  CI.clearOutputFiles(/*EraseFiles=*/!result);
+  return result;
+}
+
+#endif
+//----------------------------------------------------------------------------
+static bool cacheEntryIsUpToDate(std::string const& entry)
+{
+  if(!cxsys::SystemTools::FileExists(entry.c_str(), true)) {
+    return false;
+  }
+
+  // A prelude PCH or preprocessed snapshot is out of date if any file
+  // it was built from is newer.
+  std::ifstream fin((entry + ".deps").c_str());
+  std::string line;
+  while(std::getline(fin, line)) {
+    int result;
+    if(!cxsys::SystemTools::FileTimeCompare(entry, line, &result) ||
+       result < 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+static void saveCacheEntryDeps(clang::FileManager const& fm,
+                               std::string const& entry)
+{
+  std::string text;
+  llvm::SmallVector<clang::FileEntry const*, 256> files;
+  fm.GetUniqueIDMapping(files);
+  for(clang::FileEntry const* fe : files) {
+    if(fe) {
+      text += cxsys::SystemTools::CollapseFullPath(fe->getName()) + "\n";
+    }
+  }
+  // An entry without its dependencies is not used by a later run.
+  std::string msg;
+  replaceFile(entry + ".deps", text, msg);
+}
+
+//----------------------------------------------------------------------------
+static std::string getPreludePCH(clang::CompilerInstance* CI,
+                                 Options const& opts,
+                                 Context const& ctx,
+                                 const char* const* argBeg,
+                                 const char* const* argEnd)
+{
+  clang::FrontendOptions const& feOpts = CI->getFrontendOpts();
+  if(feOpts.Inputs.size() != 1) {
+    return std::string();
+  }
+  std::string const input = feOpts.Inputs[0].getFile();
+
+  // Key the prelude on everything that affects its content except
+  // the name of the input file and the output location.
+  Hasher h;
+  h.Append(getVersionString());
+  h.Append(opts.Predefines);
+  h.Append(opts.PrefixHeader);
+  h.Append(feOpts.SkipFunctionBodies? "skip-function-bodies" : "");
+  for(const char* const* a = argBeg; a != argEnd; ++a) {
+    if(strcmp(*a, "-main-file-name") == 0 || strcmp(*a, "-o") == 0) {
+      if((a+1) != argEnd) {
+        ++a;
+      }
+    } else if(input != *a) {
+      h.Append(*a);
+    }
+  }
+  std::string pch = opts.PreludePCHDir + "/" + h.FinalizeHex() + ".pch";
+  if(cacheEntryIsUpToDate(pch)) {
+    countMetric(MetricPreludePCHHits);
+    return pch;
+  }
+
+  // Let only one process build a given prelude.
+  cxsys::SystemTools::MakeDirectory(opts.PreludePCHDir);
+  llvm::LockFileManager lock(pch);
+  if(lock.getState() == llvm::LockFileManager::LFS_Shared) {
+    // Use the prelude built by the owner, if it succeeded.
+    lock.waitForUnlock();
+    if(cacheEntryIsUpToDate(pch)) {
+      countMetric(MetricPreludePCHHits);
+      return pch;
+    }
+    return std::string();
+  }
+  if(cacheEntryIsUpToDate(pch)) {
+    countMetric(MetricPreludePCHHits);
+    return pch;
+  }
+
+  countMetric(MetricPreludePCHMisses);
+
+  // Build the prelude from the prefix header, or an empty source file,
+  // using the same invocation as the real input so that the PCH is
+  // compatible.
+  std::unique_ptr<clang::CompilerInstance>
+    PCI(new clang::CompilerInstance());
+  PCI->setInvocation(new clang::CompilerInvocation(CI->getInvocation()));
+  clang::FrontendOptions& pchOpts = PCI->getFrontendOpts();
+  pchOpts.Inputs.clear();
+  pchOpts.Inputs.push_back(
+    clang::FrontendInputFile(opts.PrefixHeader.empty()?
+                             ctx.ResourceDir + "/empty.cpp" :
+                             opts.PrefixHeader,
+                             feOpts.Inputs[0].getKind()));
+  pchOpts.OutputFile = pch;
+  pchOpts.ProgramAction = clang::frontend::GeneratePCH;
+  PCI->getDependencyOutputOpts() = clang::DependencyOutputOptions();
+  PCI->createDiagnostics();
+  if(!PCI->hasDiagnostics()) {
+    return std::string();
+  }
+  PCI->setVirtualFileSystem(overlayResourceFileSystem(
+    clang::createVFSFromCompilerInvocation(PCI->getInvocation(),
+                                           PCI->getDiagnostics()), ctx));
+  CastXMLPreludePCHAction action(opts);
+  if(PCI->ExecuteAction(action) &&
+     cxsys::SystemTools::FileExists(pch.c_str(), true)) {
+    if(PCI->hasFileManager()) {
+      saveCacheEntryDeps(PCI->getFileManager(), pch);
+    }
+    return pch;
+  }
+  return std::string();
+}
+
+//----------------------------------------------------------------------------
+static std::string getPreprocessedSnapshot(clang::CompilerInstance* CI,
+                                           Options const& opts,
+                                           Context const& ctx,
+                                           const char* const* argBeg,
+                                           const char* const* argEnd)
+{
+  // Key the snapshot on everything that affects the preprocessed text
+  // except the output location.
+  Hasher h;
+  h.Append(getVersionString());
+  h.Append("preprocessed");
+  h.Append(opts.Predefines);
+  h.Append(opts.PrefixHeader);
+  for(const char* const* a = argBeg; a != argEnd; ++a) {
+    if(strcmp(*a, "-o") == 0) {
+      if((a+1) != argEnd) {
+        ++a;
+      }
+    } else {
+      h.Append(*a);
+    }
+  }
+  std::string entry = opts.PreprocessedCacheDir + "/" + h.FinalizeHex() +
+    ".ii";
+  if(cacheEntryIsUpToDate(entry)) {
+    countMetric(MetricPreprocessedCacheHits);
+    return entry;
+  }
+
+  // Let only one process preprocess a given translation unit.
+  cxsys::SystemTools::MakeDirectory(opts.PreprocessedCacheDir);
+  llvm::LockFileManager lock(entry);
+  if(lock.getState() == llvm::LockFileManager::LFS_Shared) {
+    lock.waitForUnlock();
+  }
+  if(cacheEntryIsUpToDate(entry)) {
+    countMetric(MetricPreprocessedCacheHits);
+    return entry;
+  }
+  countMetric(MetricPreprocessedCacheMisses);
+
+  // Preprocess the input with the same invocation as it is parsed,
+  // keeping the line markers that name the original files.  The parse
+  // reports any errors, so the diagnostics of this run are dropped.
+  llvm::SmallString<128> tmp;
+  if(llvm::sys::fs::createUniqueFile(entry + "-%%%%%%%%.tmp", tmp)) {
+    return std::string();
+  }
+  std::unique_ptr<clang::CompilerInstance>
+    PCI(new clang::CompilerInstance());
+  PCI->setInvocation(new clang::CompilerInvocation(CI->getInvocation()));
+  clang::FrontendOptions& ppFEOpts = PCI->getFrontendOpts();
+  ppFEOpts.OutputFile = tmp.str();
+  ppFEOpts.ProgramAction = clang::frontend::PrintPreprocessedInput;
+  clang::PreprocessorOutputOptions& ppOutOpts =
+    PCI->getPreprocessorOutputOpts();
+  ppOutOpts.ShowCPP = 1;
+  ppOutOpts.ShowLineMarkers = 1;
+  ppOutOpts.ShowComments = 0;
+  ppOutOpts.ShowMacroComments = 0;
+  ppOutOpts.ShowMacros = 0;
+  PCI->getDependencyOutputOpts() = clang::DependencyOutputOptions();
+  if(!opts.PrefixHeader.empty()) {
+    std::vector<std::string>& includes = PCI->getPreprocessorOpts().Includes;
+    includes.insert(includes.begin(), opts.PrefixHeader);
+  }
+  PCI->createDiagnostics(new clang::IgnoringDiagConsumer);
+  if(!PCI->hasDiagnostics()) {
+    llvm::sys::fs::remove(tmp.str());
+    return std::string();
+  }
+  PCI->setVirtualFileSystem(overlayResourceFileSystem(
+    clang::createVFSFromCompilerInvocation(PCI->getInvocation(),
+                                           PCI->getDiagnostics()), ctx));
+  CastXMLPrintPreprocessedAction action(opts, false);
+  if(!PCI->ExecuteAction(action) ||
+     PCI->getDiagnostics().hasErrorOccurred() || !PCI->hasFileManager()) {
+    llvm::sys::fs::remove(tmp.str());
+    return std::string();
+  }
+
+  // List the files read before adding the snapshot so that a reader
+  // never finds it without them.
+  saveCacheEntryDeps(PCI->getFileManager(), entry);
+  if(llvm::sys::fs::rename(tmp.str(), entry)) {
+    llvm::sys::fs::remove(tmp.str());
+    return std::string();
+  }
+  return entry;
+}
+
+//----------------------------------------------------------------------------
+static std::string getOutputName(clang::CompilerInstance* CI,
+                                 Options const& opts)
+{
+  if(!opts.OutputFile.empty()) {
+    return opts.OutputFile;
+  }
+  return getDefaultOutputName(opts,
+                              CI->getFrontendOpts().Inputs[0].getFile());
+}
+
+//----------------------------------------------------------------------------
+static std::string getResultCacheKey(Options const& opts,
+                                     const char* const* argBeg,
+                                     const char* const* argEnd)
+{
+  // Key the result on everything that affects its content except the
+  // content of the files read, which the manifest records.
+  Hasher h;
+  h.Append(getVersionString());
+  for(const char* const* a = argBeg; a != argEnd; ++a) {
+    if(strcmp(*a, "-o") == 0) {
+      if((a+1) != argEnd) {
+        ++a;
+      }
+    } else {
+      h.Append(*a);
+    }
+  }
+  h.Append(opts.Predefines);
+  h.Append(opts.PrefixHeader);
+  appendOutputOptions(h, opts);
+  h.Append(opts.OutputCompression);
+  h.Append(opts.OutputFormat);
+  for(std::string const& n : opts.StartNames) {
+    h.Append("start");
+    h.Append(n);
+  }
+  if(opts.PartitionCount > 1) {
+    h.Append("partition");
+    h.Append(std::to_string(opts.PartitionIndex) + "/" +
+             std::to_string(opts.PartitionCount));
+  }
+  return h.FinalizeHex();
+}
+
+//----------------------------------------------------------------------------
+static bool hashFileContent(std::string const& path, std::string& hex)
+{
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+    llvm::MemoryBuffer::getFile(path);
+  if(!buffer) {
+    return false;
+  }
+  Hasher h;
+  h.Append(buffer.get()->getBuffer().str());
+  hex = h.FinalizeHex();
+  return true;
+}
+
+//----------------------------------------------------------------------------
+static bool runResultCacheRemote(std::string const& remote,
+                                 const char* verb, std::string const& dir,
+                                 std::string const& name)
+{
+  // Fetch into a file of our own and move it into place so that
+  // readers of the local cache never see a partial entry.
+  std::string const path = dir + "/" + name;
+  std::string file = path;
+  if(strcmp(verb, "get") == 0) {
+    llvm::SmallString<128> tmp;
+    if(llvm::sys::fs::createUniqueFile(path + "-%%%%%%%%.tmp", tmp)) {
+      return false;
+    }
+    file = tmp.str();
+  }
+  const char* const args[] = {
+    remote.c_str(), verb, name.c_str(), file.c_str()
+  };
+  int ret;
+  std::string out;
+  std::string err;
+  std::string msg;
+  bool const ok = runCommand(4, args, ret, out, err, msg) && ret == 0;
+  if(file != path) {
+    if(!ok || llvm::sys::fs::rename(file, path)) {
+      llvm::sys::fs::remove(file);
+      return false;
+    }
+  }
+  return ok;
+}
+
+//----------------------------------------------------------------------------
+static bool loadCachedResult(std::string const& dir,
+                             std::string const& remote,
+                             std::string const& key,
+                             std::string const& output)
+{
+  // Fetch an entry missing from the local cache from the remote one,
+  // if any, and check it as a local entry.
+  std::string const manifest = key + ".manifest";
+  if(!remote.empty() &&
+     !cxsys::SystemTools::FileExists(dir + "/" + manifest)) {
+    cxsys::SystemTools::MakeDirectory(dir);
+    bool fetched = false;
+    if(runResultCacheRemote(remote, "get", dir, manifest)) {
+      std::ifstream fin((dir + "/" + manifest).c_str());
+      std::string result;
+      fetched = std::getline(fin, result) && !result.empty() &&
+        (cxsys::SystemTools::FileExists(dir + "/" + result) ||
+         runResultCacheRemote(remote, "get", dir, result));
+    }
+    countMetric(fetched? MetricRemoteResultCacheHits :
+                MetricRemoteResultCacheMisses);
+  }
+
+  // The manifest names the result and then lists the digest and path
+  // of each file read to produce it.
+  std::ifstream fin((dir + "/" + manifest).c_str());
+  std::string result;
+  if(!std::getline(fin, result) || result.empty()) {
+    return false;
+  }
+  std::string line;
+  while(std::getline(fin, line)) {
+    std::string::size_type pos = line.find(' ');
+    std::string hex;
+    if(pos == std::string::npos ||
+       !hashFileContent(line.substr(pos + 1), hex) ||
+       line.compare(0, pos, hex) != 0) {
+      return false;
+    }
+  }
+  return cxsys::SystemTools::CopyFileAlways(dir + "/" + result, output);
+}
+
+//----------------------------------------------------------------------------
+static void saveCachedResult(clang::CompilerInstance* CI,
+                             std::string const& dir,
+                             std::string const& remote,
+                             std::string const& key,
+                             std::string const& output)
+{
+  std::string const& workDir = CI->getFileSystemOpts().WorkingDir;
+  std::string manifest;
+  llvm::SmallVector<clang::FileEntry const*, 256> files;
+  CI->getFileManager().GetUniqueIDMapping(files);
+  for(clang::FileEntry const* fe : files) {
+    if(!fe) {
+      continue;
+    }
+    std::string const path = workDir.empty()?
+      cxsys::SystemTools::CollapseFullPath(fe->getName()) :
+      cxsys::SystemTools::CollapseFullPath(fe->getName(), workDir);
+    std::string hex;
+    if(!hashFileContent(path, hex)) {
+      return;
+    }
+    manifest += hex + " " + path + "\n";
+  }
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+    llvm::MemoryBuffer::getFile(output);
+  if(!buffer) {
+    return;
+  }
+
+  // Name the result after its manifest so that concurrent writers of
+  // the same key never pair one's manifest with another's result.
+  Hasher h;
+  h.Append(manifest);
+  std::string const result = key + "-" + h.FinalizeHex() + ".result";
+  cxsys::SystemTools::MakeDirectory(dir);
+  std::string msg;
+  if(replaceFile(dir + "/" + result, buffer.get()->getBuffer(), msg) &&
+     replaceFile(dir + "/" + key + ".manifest", result + "\n" + manifest,
+                 msg) &&
+     !remote.empty()) {
+    // Send the result before the manifest naming it.
+    if(runResultCacheRemote(remote, "put", dir, result)) {
+      runResultCacheRemote(remote, "put", dir, key + ".manifest");
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+static clang::FrontendAction*
+CreateFrontendAction(clang::CompilerInstance* CI, Options const& opts,
+                     bool predefinesInPCH)
+{
+  clang::frontend::ActionKind action =
+    CI->getInvocation().getFrontendOpts().ProgramAction;
+  switch(action) {
+  case clang::frontend::PrintPreprocessedInput:
+    return new CastXMLPrintPreprocessedAction(opts, predefinesInPCH);
+  case clang::frontend::ParseSyntaxOnly:
+    if(opts.Snippets) {
+      return new CastXMLSnippetAction(opts, predefinesInPCH);
+    }
+    if(opts.ScanDeps) {
+      return new CastXMLScanDepsAction(opts, predefinesInPCH);
+    }
+    return new CastXMLSyntaxOnlyAction(opts, predefinesInPCH);
+  default:
+    std::cerr << "error: unsupported action: " << int(action) << "\n";
+    return 0;
+  }
+}
+
+//----------------------------------------------------------------------------
+static clang::FrontendAction*
+createForkPreludeAction(Options const& opts, ForkPrelude& fork,
+                        bool predefinesInPCH)
+{
+#if !defined(_WIN32)
+  return new CastXMLForkPreludeAction(opts, fork, predefinesInPCH);
+#else
+  return 0;
+#endif
+}
+
+//----------------------------------------------------------------------------
+static const char* getTargetBackendName(llvm::Triple const& triple)
+{
+  switch(triple.getArch()) {
+  case llvm::Triple::x86:
+  case llvm::Triple::x86_64:
+    return "X86";
+  case llvm::Triple::arm:
+  case llvm::Triple::armeb:
+  case llvm::Triple::thumb:
+  case llvm::Triple::thumbeb:
+    return "ARM";
+  case llvm::Triple::aarch64:
+  case llvm::Triple::aarch64_be:
+    return "AArch64";
+  case llvm::Triple::mips:
+  case llvm::Triple::mipsel:
+  case llvm::Triple::mips64:
+  case llvm::Triple::mips64el:
+    return "Mips";
+  case llvm::Triple::ppc:
+  case llvm::Triple::ppc64:
+  case llvm::Triple::ppc64le:
+    return "PowerPC";
+  case llvm::Triple::sparc:
+  case llvm::Triple::sparcv9:
+    return "Sparc";
+  case llvm::Triple::systemz:
+    return "SystemZ";
+  default:
+    return "";
+  }
+}
+
+//----------------------------------------------------------------------------
+static void initializeTarget(std::string const& triple)
+{
+  // We never generate code so Clang needs an LLVM target only to parse
+  // Microsoft-style inline assembly.  Register just the one for this
+  // triple, once, rather than every target at startup.
+  static std::mutex mutex;
+  static std::set<std::string> initialized;
+  std::string const name = getTargetBackendName(llvm::Triple(triple));
+  ReportedLock lock(mutex, "Target initialization");
+  if(!initialized.insert(name).second) {
+    return;
+  }
+  bool found = false;
+# define LLVM_TARGET(t)                            \
+  if(name == #t) {                                 \
+    LLVMInitialize##t##TargetInfo();               \
+    LLVMInitialize##t##TargetMC();                 \
+    found = true;                                  \
+  }
+# include "llvm/Config/Targets.def"
+# define LLVM_ASM_PARSER(t)                        \
+  if(name == #t) {                                 \
+    LLVMInitialize##t##AsmParser();                \
+  }
+# include "llvm/Config/AsmParsers.def"
+  if(!found) {
+    // Fall back to all targets for an architecture we do not map.
+    llvm::InitializeAllTargetInfos();
+    llvm::InitializeAllTargetMCs();
+    llvm::InitializeAllAsmParsers();
+  }
+}
+
+//----------------------------------------------------------------------------
+static bool fileIsStale(clang::FileEntry const* fe)
+{
+  // Check whether the file changed on disk since it was read.
+  llvm::sys::fs::file_status st;
+  return (llvm::sys::fs::status(fe->getName(), st) ||
+          st.getSize() != static_cast<uint64_t>(fe->getSize()) ||
+          st.getLastModificationTime().toEpochTime() !=
+          fe->getModificationTime());
+}
+
+//----------------------------------------------------------------------------
+static bool fileManagerIsStale(clang::FileManager const& fm,
+                               llvm::StringRef ignore = llvm::StringRef())
+{
+  // Check whether any file known to the FileManager changed on disk.
+  llvm::SmallVector<clang::FileEntry const*, 256> files;
+  fm.GetUniqueIDMapping(files);
+  for(clang::FileEntry const* fe : files) {
+    if(fe && ignore != fe->getName() && fileIsStale(fe)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+//----------------------------------------------------------------------------
+static void useFileManager(clang::CompilerInstance* CI,
+                           Options const& opts,
+                           Context const& ctx,
+                           llvm::IntrusiveRefCntPtr<clang::FileManager>& fm)
+{
+  // A virtual file system overlay may differ between invocations.
+  if(!CI->getHeaderSearchOpts().VFSOverlayFiles.empty()) {
+    CI->setVirtualFileSystem(overlayResourceFileSystem(
+      clang::createVFSFromCompilerInvocation(CI->getInvocation(),
+                                             CI->getDiagnostics()), ctx));
+    return;
+  }
+  // Index the detected include directories even when reusing a
+  // FileManager since its inputs may name different compilers.
+  // Files read by other target configurations of this invocation are
+  // shared with them.
+  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> base =
+    clang::vfs::getRealFileSystem();
+  if(opts.SharedFiles) {
+    base = opts.SharedFiles;
+  }
+  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> fs =
+    overlayIncludeIndex(base, opts);
+  clang::FileSystemOptions const& fsOpts = CI->getFileSystemOpts();
+  if(!fm || fm->getFileSystemOpts().WorkingDir != fsOpts.WorkingDir) {
+    fm = new clang::FileManager(fsOpts, overlayResourceFileSystem(fs, ctx));
+  }
+  CI->setVirtualFileSystem(fm->getVirtualFileSystem());
+  CI->setFileManager(fm.get());
+}
+
+//----------------------------------------------------------------------------
+static void addPredefinesAsMacros(
+  clang::PreprocessorOptions& ppOpts,
+  std::map<std::string, std::string> const& macros)
+{
+  // Convert each "<name>[(<params>)] <value>" definition to the
+  // "<name>[(<params>)]=<value>" form of '-D'.  Undefine the name first
+  // in case Clang predefines it differently.
+  for(auto const& m : macros) {
+    llvm::StringRef rest = m.second;
+    size_t end = 0;
+    if(rest.startswith("(")) {
+      end = rest.find(')');
+      end = end != llvm::StringRef::npos? end + 1 : rest.size();
+    }
+    llvm::StringRef const params = rest.substr(0, end);
+    llvm::StringRef const value = rest.substr(end).ltrim();
+    ppOpts.addMacroUndef(m.first);
+    ppOpts.addMacroDef(m.first + params.str() + "=" + value.str());
+  }
+}
+
+//----------------------------------------------------------------------------
+static void usePreamble(clang::CompilerInstance* CI, Options const& opts,
+                        Context const& ctx,
+                        const char* const* argBeg,
+                        const char* const* argEnd,
+                        Context::Preamble& p)
+{
+  clang::FrontendOptions const& feOpts = CI->getFrontendOpts();
+  std::string const input = feOpts.Inputs[0].getFile();
+
+  // Find the leading block of includes and macros of the input as
+  // Clang's ASTUnit does.
+  std::string text;
+  if(!opts.SourceBufferName.empty()) {
+    text = opts.SourceBuffer;
+  } else if(llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer> > buf =
+            llvm::MemoryBuffer::getFile(input)) {
+    text = (*buf)->getBuffer();
+  } else {
+    return;
+  }
+  std::pair<unsigned, bool> const bounds =
+    clang::Lexer::ComputePreamble(text, CI->getLangOpts());
+  if(bounds.first == 0) {
+    return;
+  }
+  text.resize(bounds.first);
+
+  Hasher h;
+  h.Append(getVersionString());
+  h.Append(opts.Predefines);
+  h.Append(feOpts.SkipFunctionBodies? "skip-function-bodies" : "");
+  for(const char* const* a = argBeg; a != argEnd; ++a) {
+    h.Append(*a);
+  }
+  std::string const key = h.FinalizeHex();
+
+  // Build the preamble again if the text it covers or a file it read
+  // has changed.
+  if(p.Key != key || p.Text != text || !p.Files ||
+     fileManagerIsStale(*p.Files, input)) {
+    countMetric(MetricPreamblePCHMisses);
+    p.Key.clear();
+    p.Files.reset();
+    if(p.File.empty()) {
+      llvm::SmallString<128> pch;
+      if(llvm::sys::fs::createTemporaryFile("castxml-preamble", "pch",
+                                            pch)) {
+        return;
+      }
+      p.File = pch.str();
+    }
+
+    // Precompile the leading text alone in place of the input using
+    // the same invocation so that the PCH is compatible.
+    std::unique_ptr<clang::CompilerInstance>
+      PCI(new clang::CompilerInstance());
+    PCI->setInvocation(new clang::CompilerInvocation(CI->getInvocation()));
+    clang::FrontendOptions& pchOpts = PCI->getFrontendOpts();
+    pchOpts.OutputFile = p.File;
+    pchOpts.ProgramAction = clang::frontend::GeneratePCH;
+    PCI->getDependencyOutputOpts() = clang::DependencyOutputOptions();
+    clang::PreprocessorOptions& pchPPOpts = PCI->getPreprocessorOpts();
+    pchPPOpts.clearRemappedFiles();
+    pchPPOpts.addRemappedFile(
+      input, llvm::MemoryBuffer::getMemBufferCopy(text, input).release());
+    PCI->createDiagnostics();
+    if(!PCI->hasDiagnostics()) {
+      return;
+    }
+    PCI->setVirtualFileSystem(overlayResourceFileSystem(
+      clang::createVFSFromCompilerInvocation(PCI->getInvocation(),
+                                             PCI->getDiagnostics()), ctx));
+    CastXMLPreludePCHAction action(opts);
+    if(!PCI->ExecuteAction(action) || !PCI->hasFileManager()) {
+      return;
+    }
+    p.Key = key;
+    p.Text = text;
+    p.EndsAtStartOfLine = bounds.second;
+    p.Files = &PCI->getFileManager();
+  } else {
+    countMetric(MetricPreamblePCHHits);
+  }
+
+  // Load the preamble and skip the text it covers.  Its files were
+  // checked above.
+  clang::PreprocessorOptions& ppOpts = CI->getPreprocessorOpts();
+  ppOpts.ImplicitPCHInclude = p.File;
+  ppOpts.PrecompiledPreambleBytes =
+    std::make_pair(static_cast<unsigned>(p.Text.size()),
+                   p.EndsAtStartOfLine);
+  ppOpts.DisablePCHValidation = true;
+}
+
+//----------------------------------------------------------------------------
+static bool useTokenCache(clang::CompilerInstance* CI, Options const& opts,
+                          Context const& ctx, Context::Tokens& t)
+{
+  // Raw tokens do not depend on macros, but the lexer follows the
+  // language options.
+  clang::LangOptions const& lo = CI->getLangOpts();
+  unsigned int const bits[] = {
+    lo.CPlusPlus, lo.CPlusPlus11, lo.CPlusPlus14, lo.C99, lo.C11,
+    lo.Digraphs, lo.Trigraphs, lo.LineComment, lo.DollarIdents,
+    lo.MicrosoftExt, lo.GNUMode, lo.Bool, lo.WChar, lo.ObjC1
+  };
+  Hasher h;
+  h.Append(getVersionString());
+  h.Append(CI->getTargetOpts().Triple);
+  for(unsigned int b : bits) {
+    h.Append(b? "1" : "0");
+  }
+  std::string const key = h.FinalizeHex();
+
+  // Lex the files of this input into the cache if the cache is for
+  // other options or a file it holds has changed.
+  if(t.Key != key || !t.Files || fileManagerIsStale(*t.Files)) {
+    countMetric(MetricTokenCacheMisses);
+    t.Key.clear();
+    t.Files.reset();
+    if(t.File.empty()) {
+      llvm::SmallString<128> pth;
+      if(llvm::sys::fs::createTemporaryFile("castxml-tokens", "pth", pth)) {
+        return false;
+      }
+      t.File = pth.str();
+    }
+    std::unique_ptr<clang::CompilerInstance>
+      TCI(new clang::CompilerInstance());
+    TCI->setInvocation(new clang::CompilerInvocation(CI->getInvocation()));
+    clang::FrontendOptions& pthOpts = TCI->getFrontendOpts();
+    pthOpts.OutputFile = t.File;
+    pthOpts.ProgramAction = clang::frontend::GeneratePTH;
+    TCI->getDependencyOutputOpts() = clang::DependencyOutputOptions();
+
+    // The translation unit reports its own diagnostics.
+    TCI->createDiagnostics(new clang::IgnoringDiagConsumer,
+                           /*ShouldOwnClient=*/true);
+    TCI->setVirtualFileSystem(overlayResourceFileSystem(
+      clang::createVFSFromCompilerInvocation(TCI->getInvocation(),
+                                             TCI->getDiagnostics()), ctx));
+    CastXMLTokenCacheAction action(opts);
+    if(!TCI->ExecuteAction(action) || !TCI->hasFileManager()) {
+      return false;
+    }
+    t.Key = key;
+    t.Files = &TCI->getFileManager();
+  } else {
+    countMetric(MetricTokenCacheHits);
+  }
+
+  // Lex the files the cache holds from it.  They were checked above.
+  CI->getPreprocessorOpts().TokenCache = t.File;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+/// RetainedAST - A translation unit parsed by a server request with
+/// '--castxml-retain-ast'.  Its action has not ended the source file,
+/// so the AST, Sema and Preprocessor stay alive for later queries.
+class RetainedAST
+{
+public:
+  RetainedAST(Options const& opts): Opts(opts), Memory(0) {}
+  ~RetainedAST() {
+    if(this->Action) {
+      this->Action->EndSourceFile();
+    }
+    if(this->Opts.DisableFree && this->CI) {
+      clang::BuryPointer(this->CI.release());
+    }
+  }
+
+  // The options of the request that parsed the translation unit.  The
+  // action and its consumer refer to them.
+  Options Opts;
+
+  std::unique_ptr<clang::CompilerInstance> CI;
+  std::unique_ptr<clang::FrontendAction> Action;
+
+  // Shared by all queries so that names needing discriminators are
+  // numbered the same way in every answer.
+  std::unique_ptr<clang::MangleContext> Mangle;
+
+  // The hash of the command, options and input it was parsed from,
+  // and the memory its compiler holds.
+  std::string Key;
+  size_t Memory;
+};
+
+//----------------------------------------------------------------------------
+static bool retainedIsStale(RetainedAST const& r)
+{
+  // Check only the files this translation unit read since the file
+  // manager is shared with other requests.  The content of a source
+  // buffer is part of the key.
+  clang::SourceManager const& sm = r.CI->getSourceManager();
+  for(clang::SourceManager::fileinfo_iterator i = sm.fileinfo_begin(),
+        e = sm.fileinfo_end(); i != e; ++i) {
+    if(!i->second->BufferOverridden && fileIsStale(i->first)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+//----------------------------------------------------------------------------
+static bool executeRetainedAction(clang::CompilerInstance& CI,
+                                  clang::FrontendAction& action)
+{
+  // Do what CompilerInstance::ExecuteAction does for one input but
+  // leave the source file open.
+  clang::FrontendOptions const& feOpts = CI.getFrontendOpts();
+  if(feOpts.Inputs.size() != 1) {
+    return false;
+  }
+  CI.setTarget(clang::TargetInfo::CreateTargetInfo(
+                 CI.getDiagnostics(), CI.getInvocation().TargetOpts));
+  if(!CI.hasTarget()) {
+    return false;
+  }
+  CI.getTarget().adjust(CI.getLangOpts());
+  if(!action.BeginSourceFile(CI, feOpts.Inputs[0])) {
+    return false;
+  }
+  action.Execute();
+
+  // Finish the output of the request now as EndSourceFile would.
+  bool const result = !CI.getDiagnostics().hasErrorOccurred();
+  CI.clearOutputFiles(/*EraseFiles=*/!result);
+  if(!result) {
+    action.EndSourceFile();
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------
+static bool runClangCI(clang::CompilerInstance* CI, Options const& opts,
+                       Context const& ctx,
+                       const char* const* argBeg,
+                       const char* const* argEnd,
+                       llvm::raw_ostream* diagOS,
+                       llvm::IntrusiveRefCntPtr<clang::FileManager>& fm,
+                       ForkPrelude* fork = nullptr,
+                       RetainedAST* retain = nullptr,
+                       Context::Preamble* preamble = nullptr,
+                       Context::Tokens* tokens = nullptr)
+{
+  // Create a diagnostics engine for this compiler instance.
+  if(diagOS) {
+    CI->createDiagnostics(
+      new clang::TextDiagnosticPrinter(*diagOS, &CI->getDiagnosticOpts()));
+  } else {
+    CI->createDiagnostics();
+  }
+  if(!CI->hasDiagnostics()) {
+    return false;
+  }
+
+  // Read an inline source buffer in place of the file it names.  The
+  // driver saw it as standard input since the file need not exist.
+  clang::FrontendOptions& feOpts = CI->getFrontendOpts();
+  if(!opts.SourceBufferName.empty() && feOpts.Inputs.size() == 1 &&
+     feOpts.Inputs[0].getFile() == "-") {
+    feOpts.Inputs[0] = clang::FrontendInputFile(opts.SourceBufferName,
+                                                feOpts.Inputs[0].getKind());
+    CI->getPreprocessorOpts().addRemappedFile(
+      opts.SourceBufferName,
+      llvm::MemoryBuffer::getMemBufferCopy(opts.SourceBuffer,
+                                           opts.SourceBufferName).release());
+  }
+
+  {
+    PhaseRegion t("Target initialization");
+    TraceRegion tr("Target initialization");
+    initializeTarget(CI->getTargetOpts().Triple);
+  }
+
+  // Set frontend options we captured directly.  Name the output of
+  // each input in the output directory if requested.
+  CI->getFrontendOpts().OutputFile = opts.OutputFile;
+  if(!opts.OutputDir.empty() && opts.GccXml && !opts.PPOnly &&
+     CI->getFrontendOpts().Inputs.size() == 1) {
+    CI->getFrontendOpts().OutputFile = getOutputName(CI, opts);
+  }
+
+  // Let Clang leak the AST, Sema and Preprocessor at the end of the
+  // source file instead of destroying them.
+  CI->getFrontendOpts().DisableFree = opts.DisableFree;
+
+  // Name our output as the target in a dependency file requested by
+  // '-MD' or '-MMD' unless the command line names one.
+  clang::DependencyOutputOptions& depOpts = CI->getDependencyOutputOpts();
+  if(opts.GccXml && !opts.HaveDepTarget && !depOpts.OutputFile.empty() &&
+     CI->getFrontendOpts().Inputs.size() == 1) {
+    depOpts.Targets.assign(1, getOutputName(CI, opts));
+  }
+
+  if(opts.GccXml) {
+#   define MSG(x) "error: '--castxml-gccxml' does not work with " x "\n"
+    if(CI->getLangOpts().ObjC1 || CI->getLangOpts().ObjC2) {
+      std::cerr << MSG("Objective C");
+      return false;
     }
     if(CI->getLangOpts().CPlusPlus14) {
       std::cerr << MSG("c++14");
@@ -244,21 +2513,187 @@ static bool runClangCI(clang::CompilerInstance* CI, Options const& opts)
 #   undef MSG
   }
 
+  // Modules built implicitly for this translation unit are configured
+  // by the command line macros but not by the predefines our actions
+  // substitute.  Give our predefines to them as command line macros.
+  if(opts.HaveCC && CI->getLangOpts().Modules) {
+    addPredefinesAsMacros(CI->getPreprocessorOpts(),
+                          opts.PredefinedMacros);
+  }
+
+  // Reuse the output of an earlier identical invocation if requested.
+  // Invocations with outputs other than one file, or with an input not
+  // read from a file, are not cached.
+  std::string resultKey;
+  std::string resultOutput;
+  if(!opts.ResultCacheDir.empty() && opts.GccXml && !fork && !retain &&
+     CI->getFrontendOpts().ProgramAction == clang::frontend::ParseSyntaxOnly &&
+     CI->getFrontendOpts().Inputs.size() == 1 &&
+     CI->getFrontendOpts().Inputs[0].getFile() != "-" &&
+     opts.SourceBufferName.empty() && !opts.OutputStream && !opts.Table &&
+     !opts.Handler && depOpts.OutputFile.empty() && opts.OutputFile != "-" &&
+     opts.OutputIndexFile.empty() && opts.OutputShardDir.empty() &&
+     opts.DiffAgainstFile.empty() && opts.ExtraOutputs.empty()) {
+    resultKey = getResultCacheKey(opts, argBeg, argEnd);
+    resultOutput = getOutputName(CI, opts);
+    if(loadCachedResult(opts.ResultCacheDir, opts.ResultCacheRemote,
+                        resultKey, resultOutput)) {
+      countMetric(MetricResultCacheHits);
+      return true;
+    }
+    countMetric(MetricResultCacheMisses);
+  }
+
+  // The gccxml format has no statements so skip parsing function bodies
+  // if requested.  Set this before building any prelude PCH.
+  if(opts.GccXml && opts.SkipFunctionBodies) {
+    CI->getFrontendOpts().SkipFunctionBodies = true;
+  }
+
+  // Parse the input from a snapshot of its preprocessed text if
+  // requested, so that its headers need not be searched for and read.
+  // The line markers of the snapshot name the original files, which
+  // the output reports in place of the snapshot.
+  std::unique_ptr<Options> snapshotOpts;
+  if(!opts.PreprocessedCacheDir.empty() && opts.GccXml && !fork &&
+     !retain &&
+     CI->getFrontendOpts().ProgramAction == clang::frontend::ParseSyntaxOnly &&
+     CI->getFrontendOpts().Inputs.size() == 1 &&
+     CI->getFrontendOpts().Inputs[0].getFile() != "-" &&
+     CI->getFrontendOpts().Inputs[0].getKind() != clang::IK_AST &&
+     opts.SourceBufferName.empty() && opts.EmitASTFile.empty() &&
+     opts.PrefetchFile.empty() && depOpts.OutputFile.empty() &&
+     !CI->getLangOpts().Modules &&
+     CI->getPreprocessorOpts().ImplicitPCHInclude.empty()) {
+    std::string const snapshot =
+      getPreprocessedSnapshot(CI, opts, ctx, argBeg, argEnd);
+    if(snapshot.empty()) {
+      // Parse the input itself.
+    } else if(llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer> > buf =
+              llvm::MemoryBuffer::getFile(snapshot)) {
+      // The snapshot already holds the text of any '-include' files.
+      std::string const input = CI->getFrontendOpts().Inputs[0].getFile();
+      clang::PreprocessorOptions& ppOpts = CI->getPreprocessorOpts();
+      ppOpts.addRemappedFile(input, buf->release());
+      ppOpts.Includes.clear();
+      ppOpts.MacroIncludes.clear();
+      snapshotOpts.reset(new Options(opts));
+      snapshotOpts->PreprocessedSnapshot = true;
+    }
+  }
+
+  // Parse the leading includes of an input parsed again by a server
+  // or watch from a precompiled preamble if they have not changed.
+  // It holds our predefines as a prelude would.
+  bool predefinesInPCH = false;
+  if(preamble && !snapshotOpts && opts.GccXml && opts.PrefixHeader.empty() &&
+     opts.EmitASTFile.empty() &&
+     CI->getFrontendOpts().ProgramAction == clang::frontend::ParseSyntaxOnly &&
+     CI->getFrontendOpts().Inputs.size() == 1 &&
+     CI->getFrontendOpts().Inputs[0].getKind() != clang::IK_AST &&
+     CI->getPreprocessorOpts().ImplicitPCHInclude.empty() &&
+     CI->getPreprocessorOpts().Includes.empty()) {
+    usePreamble(CI, opts, ctx, argBeg, argEnd, *preamble);
+    predefinesInPCH =
+      !CI->getPreprocessorOpts().ImplicitPCHInclude.empty();
+  }
+
+  // Load our predefines and prefix header from a precompiled prelude
+  // if requested.
+  bool havePreludePCH = false;
+  if(!opts.PreludePCHDir.empty() && !snapshotOpts &&
+     opts.EmitASTFile.empty() &&
+     (opts.HaveCC || !opts.PrefixHeader.empty()) &&
+     CI->getFrontendOpts().ProgramAction == clang::frontend::ParseSyntaxOnly &&
+     CI->getPreprocessorOpts().ImplicitPCHInclude.empty()) {
+    std::string pch = getPreludePCH(CI, opts, ctx, argBeg, argEnd);
+    if(!pch.empty()) {
+      CI->getPreprocessorOpts().ImplicitPCHInclude = pch;
+      havePreludePCH = true;
+      predefinesInPCH = true;
+    }
+  }
+
+  // Parse the prefix header as the prelude shared by forked inputs,
+  // or else include it at the top of the input, unless the prelude
+  // PCH holds it.
+  std::string const prefix =
+    havePreludePCH || snapshotOpts || opts.PrefixHeader.empty()?
+    std::string() : "#include \"" + opts.PrefixHeader + "\"\n";
+  if(fork) {
+    CI->getPreprocessorOpts().addRemappedFile(
+      forkPreludeName,
+      llvm::MemoryBuffer::getMemBufferCopy(prefix,
+                                           forkPreludeName).release());
+  } else if(!prefix.empty() &&
+            CI->getFrontendOpts().Inputs[0].getKind() != clang::IK_AST) {
+    std::vector<std::string>& includes = CI->getPreprocessorOpts().Includes;
+    includes.insert(includes.begin(), opts.PrefixHeader);
+  }
+
+  // Lex the files read by an earlier input of a batch or server from
+  // their cached tokens.  The source of a buffer given in place of a
+  // file, and files covered by a PCH, are not lexed from the cache.
+  bool usedTokens = false;
+  if(tokens && !fork && !retain && !snapshotOpts &&
+     opts.SourceBufferName.empty() &&
+     (CI->getFrontendOpts().ProgramAction ==
+      clang::frontend::ParseSyntaxOnly ||
+      CI->getFrontendOpts().ProgramAction ==
+      clang::frontend::PrintPreprocessedInput) &&
+     CI->getFrontendOpts().Inputs.size() == 1 &&
+     CI->getFrontendOpts().Inputs[0].getKind() != clang::IK_AST &&
+     CI->getPreprocessorOpts().ImplicitPCHInclude.empty() &&
+     CI->getPreprocessorOpts().TokenCache.empty() &&
+     CI->getPreprocessorOpts().RemappedFiles.empty() &&
+     CI->getPreprocessorOpts().RemappedFileBuffers.empty()) {
+    usedTokens = useTokenCache(CI, opts, ctx, *tokens);
+  }
+
+  // Reuse the file information cached by earlier compiler instances.
+  useFileManager(CI, opts, ctx, fm);
+
   // Construct our Clang front-end action.  This dispatches
   // handling of each input file with an action based on the
   // flags provided (e.g. -E to preprocess-only).
   std::unique_ptr<clang::FrontendAction>
-    action(CreateFrontendAction(CI, opts));
-  if(action) {
-    return CI->ExecuteAction(*action);
-  } else {
+    action(fork? createForkPreludeAction(opts, *fork, predefinesInPCH) :
+           CreateFrontendAction(CI, snapshotOpts? *snapshotOpts : opts,
+                                predefinesInPCH));
+  if(!action) {
+    return false;
+  }
+  if(retain) {
+    if(!executeRetainedAction(*CI, *action)) {
+      return false;
+    }
+    retain->Action = std::move(action);
+    return true;
+  }
+  bool const executed = CI->ExecuteAction(*action);
+
+  // The token cache gave the FileManager a stat cache that refers to
+  // its data, which goes away with the preprocessor.
+  if(usedTokens && CI->hasFileManager()) {
+    CI->getFileManager().clearStatCaches();
+  }
+  if(!executed) {
     return false;
   }
+  if(!opts.PrefetchFile.empty()) {
+    recordPrefetch(*CI);
+  }
+  if(!resultKey.empty()) {
+    saveCachedResult(CI, opts.ResultCacheDir, opts.ResultCacheRemote,
+                     resultKey, resultOutput);
+  }
+  return true;
 }
 
 //----------------------------------------------------------------------------
 static llvm::IntrusiveRefCntPtr<clang::DiagnosticsEngine>
-runClangCreateDiagnostics(const char* const* argBeg, const char* const* argEnd)
+runClangCreateDiagnostics(const char* const* argBeg, const char* const* argEnd,
+                          llvm::raw_ostream& os)
 {
   llvm::IntrusiveRefCntPtr<clang::DiagnosticOptions>
     diagOpts(new clang::DiagnosticOptions);
@@ -271,7 +2706,7 @@ runClangCreateDiagnostics(const char* const* argBeg, const char* const* argEnd)
     args(opts->ParseArgs(argBeg, argEnd, missingArgIndex, missingArgCount));
   clang::ParseDiagnosticArgs(*diagOpts, *args);
   clang::TextDiagnosticPrinter* diagClient =
-    new clang::TextDiagnosticPrinter(llvm::errs(), &*diagOpts);
+    new clang::TextDiagnosticPrinter(os, &*diagOpts);
   llvm::IntrusiveRefCntPtr<clang::DiagnosticsEngine>
     diags(new clang::DiagnosticsEngine(diagID, &*diagOpts, diagClient));
   clang::ProcessWarningOptions(*diags, *diagOpts, /*ReportDiags=*/false);
@@ -279,21 +2714,289 @@ runClangCreateDiagnostics(const char* const* argBeg, const char* const* argEnd)
 }
 
 //----------------------------------------------------------------------------
-static int runClangImpl(const char* const* argBeg,
-                        const char* const* argEnd,
-                        Options const& opts)
+/// Clang command lines computed by the driver for one invocation.
+/// Each starts with "-cc1" and is given to CreateFromArgs.
+typedef std::vector<std::vector<std::string> > DriverCommands;
+
+//----------------------------------------------------------------------------
+static bool runClangCommand(std::vector<std::string> const& cmd,
+                            clang::DiagnosticsEngine& diags,
+                            llvm::raw_ostream* diagOS,
+                            Options const& opts,
+                            Context const& ctx,
+                            llvm::IntrusiveRefCntPtr<clang::FileManager>& fm,
+                            RetainedAST* retain = nullptr,
+                            Context::Preamble* preamble = nullptr,
+                            Context::Tokens* tokens = nullptr)
 {
-  // Construct a diagnostics engine for use while processing driver options.
+  std::vector<const char*> cmdArgs;
+  for(std::string const& a : cmd) {
+    cmdArgs.push_back(a.c_str());
+  }
+
+  // Invoke Clang with this set of arguments.
+  std::unique_ptr<clang::CompilerInstance> CI(new clang::CompilerInstance());
+  const char* const* cmdArgBeg = cmdArgs.data();
+  const char* const* cmdArgEnd = cmdArgBeg + cmdArgs.size();
+  bool result = false;
+  if (clang::CompilerInvocation::CreateFromArgs
+      (CI->getInvocation(), cmdArgBeg, cmdArgEnd, diags)) {
+    result = runClangCI(CI.get(), opts, ctx, cmdArgBeg, cmdArgEnd, diagOS,
+                        fm, nullptr, retain, preamble, tokens);
+  }
+  if(retain && retain->Action) {
+    retain->CI = std::move(CI);
+    return result;
+  }
+  if(opts.DisableFree) {
+    clang::BuryPointer(CI.release());
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------
+struct ParallelJob
+{
+  ParallelJob(std::vector<std::string> const& cmd):
+    Cmd(&cmd), Size(0), Memory(0), Result(false) {}
+  std::vector<std::string> const* Cmd;
+  std::string File;
+  uint64_t Size;
+  size_t Memory;
+  std::string Diagnostics;
+  bool Result;
+};
+
+//----------------------------------------------------------------------------
+/// Write the diagnostics buffered by parallel jobs in the order of the
+/// jobs, each as soon as it and all jobs before it have finished, so
+/// that a long job holds back only the diagnostics of those after it.
+class ParallelDiagnostics
+{
+  std::vector<ParallelJob>& Jobs;
+  llvm::raw_ostream& OS;
+  std::mutex Mutex;
+  std::vector<bool> Finished;
+  size_t Next;
+public:
+  ParallelDiagnostics(std::vector<ParallelJob>& jobs, llvm::raw_ostream& os):
+    Jobs(jobs), OS(os), Finished(jobs.size(), false), Next(0) {}
+
+  void Finish(size_t i) {
+    ReportedLock lock(this->Mutex, "Diagnostics");
+    this->Finished[i] = true;
+    bool wrote = false;
+    for(; this->Next < this->Finished.size() &&
+          this->Finished[this->Next]; ++this->Next) {
+      std::string& d = this->Jobs[this->Next].Diagnostics;
+      if(!d.empty()) {
+        this->OS << d;
+        std::string().swap(d);
+        wrote = true;
+      }
+    }
+    if(wrote) {
+      this->OS.flush();
+    }
+  }
+};
+
+//----------------------------------------------------------------------------
+static void
+runClangParallelJob(ParallelJob& job,
+                    const char* const* argBeg,
+                    const char* const* argEnd,
+                    Options const& opts,
+                    Context const& ctx,
+                    llvm::IntrusiveRefCntPtr<clang::FileManager>& fm,
+                    JobCosts& costs)
+{
+  std::chrono::steady_clock::time_point const start =
+    std::chrono::steady_clock::now();
+
+  // Buffer diagnostics so they can be printed in order of the jobs.
+  llvm::raw_string_ostream diagOS(job.Diagnostics);
   llvm::IntrusiveRefCntPtr<clang::DiagnosticsEngine> diags =
-    runClangCreateDiagnostics(argBeg, argEnd);
+    runClangCreateDiagnostics(argBeg, argEnd, diagOS);
+  Options jobOpts = opts;
+  jobOpts.MemoryUsed = &job.Memory;
+
+  // Each input checks the limits of the run with its own memory.
+  std::unique_ptr<JobLimits> limits;
+  if(opts.Limits) {
+    limits.reset(new JobLimits(*opts.Limits));
+    jobOpts.Limits = limits.get();
+  }
+  job.Result = runClangCommand(*job.Cmd, *diags, &diagOS, jobOpts, ctx, fm);
+
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  costs.Record(job.File, job.Size, d.count(), job.Memory);
+}
+
+#if !defined(_WIN32)
+//----------------------------------------------------------------------------
+static bool sameCommandsButInput(DriverCommands const& cmds)
+{
+  // The driver gives each input the same command line except for the
+  // input source file, which is last, and the name of the main file.
+  for(std::vector<std::string> const& cmd : cmds) {
+    if(cmd.size() != cmds[0].size()) {
+      return false;
+    }
+    for(size_t i = 0; i + 1 < cmd.size(); ++i) {
+      if(cmd[i] != cmds[0][i] &&
+         !(i > 0 && cmd[i - 1] == "-main-file-name")) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+static bool runClangForkPrelude(DriverCommands const& cmds,
+                                clang::DiagnosticsEngine& diags,
+                                Options const& opts,
+                                Context& ctx)
+{
+  // Parse the first command with the prelude in place of its input,
+  // and fork from there to finish each input.
+  ForkPrelude fork;
+  for(std::vector<std::string> const& cmd : cmds) {
+    fork.Files.push_back(cmd.back());
+  }
+  std::vector<std::string> cmd = cmds[0];
+  cmd.back() = forkPreludeName;
+  std::vector<const char*> cmdArgs;
+  for(std::string const& a : cmd) {
+    cmdArgs.push_back(a.c_str());
+  }
+
+  // The diagnostics of the prelude are printed once, and those of
+  // each input in order of the inputs.
+  fork.DiagOS.SetTarget(&getDiagnosticStream(opts));
+  std::unique_ptr<clang::CompilerInstance> CI(new clang::CompilerInstance());
+  const char* const* cmdArgBeg = cmdArgs.data();
+  const char* const* cmdArgEnd = cmdArgBeg + cmdArgs.size();
+  bool result = false;
+  if (clang::CompilerInvocation::CreateFromArgs
+      (CI->getInvocation(), cmdArgBeg, cmdArgEnd, diags)) {
+    result = runClangCI(CI.get(), opts, ctx, cmdArgBeg, cmdArgEnd,
+                        &fork.DiagOS, ctx.FileManager, &fork);
+  }
+  fork.DiagOS.SetTarget(nullptr);
+  if(opts.DisableFree) {
+    clang::BuryPointer(CI.release());
+  }
+  for(std::string const& d : fork.Diagnostics) {
+    getDiagnosticStream(opts) << d;
+  }
+  return result && fork.Result;
+}
+#endif
+
+
+//----------------------------------------------------------------------------
+static char const driverCacheMagic[] = "castxml-driver-cache 1";
+
+//----------------------------------------------------------------------------
+static std::string driverCacheKey(const char* const* argBeg,
+                                  const char* const* argEnd,
+                                  Options const& opts,
+                                  Context const& ctx)
+{
+  // The driver resolves paths relative to the working directory and
+  // adds include directories named by some environment variables.
+  static const char* const envVars[] = {
+    "CPATH", "C_INCLUDE_PATH", "CPLUS_INCLUDE_PATH",
+    "OBJC_INCLUDE_PATH", "OBJCPLUS_INCLUDE_PATH", 0
+  };
+
+  Hasher h;
+  h.Append(driverCacheMagic);
+  h.Append(getVersionString());
+  h.Append(ctx.ClangResourceDir);
+  h.Append(llvm::sys::getDefaultTargetTriple());
+  h.Append(cxsys::SystemTools::GetCurrentWorkingDirectory());
+  h.Append(opts.PPOnly? "-E" : "-fsyntax-only");
+  h.Append(opts.OutputFile.empty()? "" : "-o");
+  for(const char* const* e = envVars; *e; ++e) {
+    const char* v = cxsys::SystemTools::GetEnv(*e);
+    h.Append(*e);
+    h.Append(v? v : "");
+  }
+  for(const char* const* a = argBeg; a != argEnd; ++a) {
+    h.Append(*a);
+  }
+  return h.FinalizeHex();
+}
+
+//----------------------------------------------------------------------------
+static bool loadDriverCache(std::string const& entry, DriverCommands& cmds)
+{
+  // Each command is a line with its argument count followed by one
+  // line per argument.
+  std::ifstream fin(entry.c_str());
+  std::string line;
+  if(!std::getline(fin, line) || line != driverCacheMagic) {
+    return false;
+  }
+  while(std::getline(fin, line)) {
+    char* end;
+    unsigned long n = strtoul(line.c_str(), &end, 10);
+    if(line.empty() || *end) {
+      return false;
+    }
+    std::vector<std::string> cmd;
+    for(unsigned long i = 0; i < n; ++i) {
+      if(!std::getline(fin, line)) {
+        return false;
+      }
+      cmd.push_back(line);
+    }
+    cmds.push_back(cmd);
+  }
+  return !cmds.empty();
+}
+
+//----------------------------------------------------------------------------
+static void saveDriverCache(std::string const& entry,
+                            DriverCommands const& cmds)
+{
+  std::string content = driverCacheMagic;
+  content += "\n";
+  for(std::vector<std::string> const& cmd : cmds) {
+    content += std::to_string(cmd.size()) + "\n";
+    for(std::string const& a : cmd) {
+      if(a.find('\n') != std::string::npos) {
+        return;
+      }
+      content += a + "\n";
+    }
+  }
 
+  cxsys::SystemTools::MakeDirectory(
+    cxsys::SystemTools::GetFilenamePath(entry));
+  std::string msg;
+  replaceFile(entry, content, msg);
+}
+
+//----------------------------------------------------------------------------
+static bool runClangDriver(const char* const* argBeg,
+                           const char* const* argEnd,
+                           Options const& opts,
+                           Context const& ctx,
+                           clang::DiagnosticsEngine& diags,
+                           DriverCommands& cmds,
+                           bool& printOnly)
+{
   // Use the approach in clang::createInvocationFromCommandLine to
   // get system compiler setting arguments from the Driver.
   clang::driver::Driver d("clang", llvm::sys::getDefaultTargetTriple(),
-                          *diags);
+                          diags);
   if(!cxsys::SystemTools::FileIsFullPath(d.ResourceDir.c_str()) ||
      !cxsys::SystemTools::FileIsDirectory(d.ResourceDir.c_str())) {
-    d.ResourceDir = getClangResourceDir();
+    d.ResourceDir = ctx.ClangResourceDir;
   }
   llvm::SmallVector<const char *, 16> cArgs;
   cArgs.push_back("<clang>");
@@ -311,100 +3014,454 @@ static int runClangImpl(const char* const* argBeg,
 
   // For '-###' just print the jobs and exit early.
   if(c->getArgs().hasArg(clang::driver::options::OPT__HASH_HASH_HASH)) {
-    c->getJobs().Print(llvm::errs(), "\n", true);
-    return 0;
+    c->getJobs().Print(getDiagnosticStream(opts), "\n", true);
+    printOnly = true;
+    return true;
   }
 
-  // Reject '-o' with multiple inputs.
-  if(!opts.OutputFile.empty() && c->getJobs().size() > 1) {
-    diags->Report(clang::diag::err_drv_output_argument_with_multiple_files);
-    return 1;
+  // Reject '-o', start groups, or a stored AST with multiple inputs.
+  if((!opts.OutputFile.empty() || !opts.StartGroups.empty() ||
+      !opts.EmitASTFile.empty()) &&
+     c->getJobs().size() > 1) {
+    diags.Report(clang::diag::err_drv_output_argument_with_multiple_files);
+    return false;
   }
 
-  // Run Clang for each compilation computed by the driver.
-  // This should be once per input source file.
+  // Collect the Clang command for each compilation computed by the
+  // driver.  This should be once per input source file.
   bool result = true;
   for(clang::driver::Job const& job : c->getJobs()) {
     clang::driver::Command const* cmd =
       llvm::dyn_cast<clang::driver::Command>(&job);
     if(cmd && strcmp(cmd->getCreator().getName(), "clang") == 0) {
-      // Invoke Clang with this set of arguments.
-      std::unique_ptr<clang::CompilerInstance>
-        CI(new clang::CompilerInstance());
-      const char* const* cmdArgBeg = cmd->getArguments().data();
-      const char* const* cmdArgEnd = cmdArgBeg + cmd->getArguments().size();
-      if (clang::CompilerInvocation::CreateFromArgs
-          (CI->getInvocation(), cmdArgBeg, cmdArgEnd, *diags)) {
-        result = runClangCI(CI.get(), opts) && result;
-      } else {
-        result = false;
-      }
+      cmds.push_back(std::vector<std::string>(cmd->getArguments().begin(),
+                                              cmd->getArguments().end()));
     } else {
       // Skip this unexpected job.
       llvm::SmallString<128> buf;
       llvm::raw_svector_ostream msg(buf);
       job.Print(msg, "\n", true);
-      diags->Report(clang::diag::err_fe_expected_clang_command);
-      diags->Report(clang::diag::err_fe_expected_compiler_job)
+      diags.Report(clang::diag::err_fe_expected_clang_command);
+      diags.Report(clang::diag::err_fe_expected_compiler_job)
         << msg.str();
       result = false;
     }
   }
-  return result? 0:1;
+  return result;
 }
 
 //----------------------------------------------------------------------------
-int runClang(const char* const* argBeg,
-             const char* const* argEnd,
-             Options const& opts)
+static bool getDriverCommands(const char* const* argBeg,
+                              const char* const* argEnd,
+                              Options const& opts,
+                              Context const& ctx,
+                              clang::DiagnosticsEngine& diags,
+                              DriverCommands& cmds,
+                              bool& printOnly)
 {
-  llvm::SmallVector<const char*, 32> args(argBeg, argEnd);
-  std::string fmsc_version = "-fmsc-version=";
+  PhaseRegion t("Driver");
+  TraceRegion tr("Driver");
 
-  if(opts.HaveCC) {
-    // Configure target to match that of given compiler.
-    if(!opts.HaveTarget && !opts.Triple.empty()) {
-      args.push_back("-target");
-      args.push_back(opts.Triple.c_str());
+  // Reuse the commands computed by the driver for an earlier identical
+  // invocation if requested.  Always run the driver for '-###'.
+  std::string cacheEntry;
+  if(!opts.DriverCacheDir.empty()) {
+    cacheEntry = opts.DriverCacheDir + "/" +
+      driverCacheKey(argBeg, argEnd, opts, ctx) + ".cc1";
+    for(const char* const* a = argBeg; a != argEnd; ++a) {
+      if(strcmp(*a, "-###") == 0) {
+        cacheEntry.clear();
+      }
+    }
+  }
+  if(!cacheEntry.empty()) {
+    if(loadDriverCache(cacheEntry, cmds)) {
+      countMetric(MetricDriverCacheHits);
+      return true;
     }
+    countMetric(MetricDriverCacheMisses);
+  }
+  cmds.clear();
+
+  bool result =
+    runClangDriver(argBeg, argEnd, opts, ctx, diags, cmds, printOnly);
+  if(result && !printOnly && !cacheEntry.empty() &&
+     !diags.hasErrorOccurred()) {
+    saveDriverCache(cacheEntry, cmds);
+  }
+  return result;
+}
 
-    // Tell Clang driver not to add its header search paths.
-    args.push_back("-nobuiltininc");
-    args.push_back("-nostdlibinc");
+//----------------------------------------------------------------------------
+static int writeRetainedOutput(RetainedAST& r, Options const& opts)
+{
+  clang::CompilerInstance& CI = *r.CI;
+  clang::ASTContext& astCtx = CI.getASTContext();
+  if(!r.Mangle && astCtx.getLangOpts().CPlusPlus) {
+    r.Mangle.reset(astCtx.createMangleContext());
+  }
 
-    // Add header search paths detected from given compiler.
-    for(std::vector<Options::Include>::const_iterator
-          i = opts.Includes.begin(), e = opts.Includes.end();
-        i != e; ++i) {
-      if(i->Framework) {
-        args.push_back("-iframework");
-      } else {
-        args.push_back("-isystem");
+  // Answer with the output the retaining request would have written
+  // for the queried start names.
+  Options qopts = r.Opts;
+  qopts.StartNames = opts.StartNames;
+  qopts.OutputFile = getOutputName(&CI, opts);
+  qopts.OutputIndexFile.clear();
+  llvm::raw_ostream* os =
+    CI.createOutputFile(qopts.OutputFile, qopts.OutputFormat == "bin",
+                        /*RemoveFileOnSignal=*/true, "", "",
+                        /*UseTemporary=*/true);
+  if(!os) {
+    CI.clearOutputFiles(/*EraseFiles=*/true);
+    return 1;
+  }
+  {
+    std::unique_ptr<llvm::raw_ostream> compressed =
+      createCompressedStream(qopts.OutputCompression, *os,
+                             CI.getDiagnostics());
+    outputXML(CI, astCtx, compressed? *compressed : *os, qopts,
+              r.Mangle.get());
+  }
+  CI.clearOutputFiles(/*EraseFiles=*/false);
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+static std::string getRetainedKey(std::vector<std::string> const& cmd,
+                                  Options const& opts)
+{
+  // Key a kept translation unit on the command that parsed it, the
+  // options that change what is parsed or written, and the content of
+  // its input.
+  Hasher h;
+  for(std::string const& a : cmd) {
+    h.Append(a);
+  }
+  h.Append(opts.Predefines);
+  h.Append(opts.PrefixHeader);
+  appendOutputOptions(h, opts);
+  h.Append(opts.SourceBufferName);
+  h.Append(opts.SourceBuffer);
+  std::string hex;
+  if(opts.SourceBufferName.empty() && hashFileContent(cmd.back(), hex)) {
+    h.Append(hex);
+  }
+  return h.FinalizeHex();
+}
+
+//----------------------------------------------------------------------------
+static void evictRetained(std::list<std::shared_ptr<RetainedAST> >& kept,
+                          size_t limit)
+{
+  // Keep the most recently used translation units that fit in the
+  // limit, and the most recent one even if it alone does not.  Without
+  // a limit only that one is kept.
+  size_t total = 0;
+  for(std::list<std::shared_ptr<RetainedAST> >::iterator
+        i = kept.begin(); i != kept.end(); ++i) {
+    total += (*i)->Memory;
+    if(i != kept.begin() && (!limit || total > limit)) {
+      kept.erase(i, kept.end());
+      return;
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+static bool runClangRetained(std::vector<std::string> const& cmd,
+                             clang::DiagnosticsEngine& diags,
+                             Options const& opts,
+                             Context& ctx)
+{
+  // Answer from a translation unit kept for the same command and input
+  // if none of the files it read changed.  A stale or failing one is
+  // dropped.
+  std::string const key = getRetainedKey(cmd, opts);
+  std::list<std::shared_ptr<RetainedAST> >& kept = ctx.Retained;
+  for(std::list<std::shared_ptr<RetainedAST> >::iterator
+        i = kept.begin(); i != kept.end(); ++i) {
+    if((*i)->Key == key) {
+      std::shared_ptr<RetainedAST> r = *i;
+      kept.erase(i);
+      if(retainedIsStale(*r)) {
+        break;
       }
-      args.push_back(i->Directory.c_str());
+      kept.push_front(r);
+      return writeRetainedOutput(*r, opts) == 0;
+    }
+  }
+
+  // Parse the translation unit and keep it for later requests.
+  std::shared_ptr<RetainedAST> retained =
+    std::make_shared<RetainedAST>(opts);
+  bool const result =
+    runClangCommand(cmd, diags, nullptr, retained->Opts, ctx,
+                    ctx.FileManager, retained.get(), &ctx.MainPreamble);
+  if(retained->Action) {
+    retained->Key = key;
+    retained->Memory =
+      getCompilerMemory(*retained->CI, retained->CI->getASTContext());
+    kept.push_front(retained);
+    evictRetained(kept, opts.RetainMemory);
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------
+static int runClangImpl(const char* const* argBeg,
+                        const char* const* argEnd,
+                        Options const& opts,
+                        Context& ctx)
+{
+  // Construct a diagnostics engine for use while processing driver options.
+  llvm::IntrusiveRefCntPtr<clang::DiagnosticsEngine> diags =
+    runClangCreateDiagnostics(argBeg, argEnd, getDiagnosticStream(opts));
+
+  DriverCommands cmds;
+  bool printOnly = false;
+  bool result =
+    getDriverCommands(argBeg, argEnd, opts, ctx, *diags, cmds, printOnly);
+  if(printOnly) {
+    return 0;
+  }
+  if(!result && cmds.empty()) {
+    return 1;
+  }
+
+  if(opts.Snippets && cmds.size() != 1) {
+    std::cerr << "error: '--castxml-snippets' requires exactly one input\n";
+    return 1;
+  }
+
+  if(opts.RetainAST) {
+    if(cmds.size() != 1 || !opts.GccXml || opts.PPOnly) {
+      std::cerr <<
+        "error: '--castxml-retain-ast' requires '--castxml-gccxml' and "
+        "exactly one input\n";
+      return 1;
     }
+  }
 
-    // Tell Clang not to add its predefines.
-    args.push_back("-undef");
+  // Preprocessed output goes to stdout, and output to an embedding
+  // application's stream, table, or handler is taken in order, so none
+  // is run in parallel.
+  size_t const threads = std::min<size_t>(opts.Jobs, cmds.size());
+#if !defined(_WIN32)
+  // Parse the prelude of inputs compiled alike once and fork a process
+  // to finish each one if requested.
+  if(opts.ForkPrelude && cmds.size() > 1 && opts.GccXml && !opts.PPOnly &&
+     !opts.OutputStream && !opts.Table && !opts.Handler &&
+     opts.SourceBufferName.empty() && opts.LoadASTFile.empty() &&
+     sameCommandsButInput(cmds)) {
+    result = runClangForkPrelude(cmds, *diags, opts, ctx) && result;
+    saveIncludeIndex();
+    return result? 0:1;
+  }
+#endif
+  if(threads > 1 && !opts.PPOnly && !opts.OutputStream && !opts.Table &&
+     !opts.Handler) {
+    // Start the inputs expected to take longest first.  The input
+    // source file of each command is its last argument.
+    std::vector<ParallelJob> jobs(cmds.begin(), cmds.end());
+    JobCosts costs;
+    if(!opts.JobCostsFile.empty()) {
+      costs.Load(opts.JobCostsFile);
+    }
+    std::vector<double> estimates;
+    std::vector<uint64_t> memory;
+    for(ParallelJob& job : jobs) {
+      job.File = cxsys::SystemTools::CollapseFullPath(job.Cmd->back());
+      job.Size = cxsys::SystemTools::FileLength(job.File);
+      estimates.push_back(costs.Estimate(job.File, job.Size));
+      memory.push_back(costs.EstimateMemory(job.File, job.Size));
+    }
+    std::vector<llvm::IntrusiveRefCntPtr<clang::FileManager> > fms(threads);
 
-    // Configure language options to match given compiler.
-    const char* pd = opts.Predefines.c_str();
-    if(strstr(pd, "#define _MSC_EXTENSIONS ")) {
-      args.push_back("-fms-extensions");
+    // The inputs intern the strings of their output in one pool.
+    StringPool strings;
+    Options poolOpts = opts;
+    if(!poolOpts.Strings) {
+      poolOpts.Strings = &strings;
     }
-    if(const char* d = strstr(pd, "#define _MSC_VER ")) {
-      args.push_back("-fms-compatibility");
-      // Extract the _MSC_VER value to give to -fmsc-version=.
-      d += 17;
-      if(const char* e = strchr(d, '\n')) {
-        if(*(e - 1) == '\r') {
-          --e;
+
+    // Bind the workers to NUMA nodes if requested, with the files read
+    // by the workers of each node shared by them alone.
+    std::unique_ptr<NumaPlacement> numa;
+    std::vector<Options> nodeOpts;
+    std::vector<llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> > nodeFiles;
+    if(opts.Numa) {
+      numa.reset(new NumaPlacement(threads));
+      nodeOpts.assign(numa->NodeCount(), poolOpts);
+      for(Options& o : nodeOpts) {
+        if(!o.SharedFiles) {
+          nodeFiles.push_back(
+            createSharedFileSystem(clang::vfs::getRealFileSystem()));
+          o.SharedFiles = nodeFiles.back().get();
         }
-        fmsc_version.append(d, e-d);
-        args.push_back(fmsc_version.c_str());
       }
     }
+    ParallelDiagnostics diagnostics(jobs, getDiagnosticStream(opts));
+    runJobs(estimates, memory, opts.MemoryBudget, threads,
+            [&](size_t i, size_t worker) {
+              runClangParallelJob(jobs[i], argBeg, argEnd,
+                                  numa? nodeOpts[numa->NodeOf(worker)] :
+                                  poolOpts, ctx, fms[worker], costs);
+              diagnostics.Finish(i);
+            }, numa.get());
+    if(!opts.JobCostsFile.empty()) {
+      costs.Save(opts.JobCostsFile);
+    }
+    for(ParallelJob const& job : jobs) {
+      result = job.Result && result;
+    }
+  } else {
+    // A server may see files change between requests, and a watch
+    // runs again because they did.
+    if((opts.Server || opts.Watch) && ctx.FileManager &&
+       fileManagerIsStale(*ctx.FileManager)) {
+      ctx.FileManager.reset();
+    }
+    if(opts.RetainAST) {
+      result = runClangRetained(cmds[0], *diags, opts, ctx) && result;
+    } else {
+      // Keep a preamble for the input of a server request or watch,
+      // which is likely to be parsed again.
+      Context::Preamble* preamble =
+        (opts.Server || opts.Watch) && cmds.size() == 1?
+        &ctx.MainPreamble : nullptr;
+      Context::Tokens* tokens =
+        opts.TokenCache? &ctx.SessionTokens : nullptr;
+      for(std::vector<std::string> const& cmd : cmds) {
+        result = runClangCommand(cmd, *diags, nullptr, opts, ctx,
+                                 ctx.FileManager, nullptr, preamble,
+                                 tokens) &&
+          result;
+      }
+    }
+  }
+  saveIncludeIndex();
+  return result? 0:1;
+}
+
+//----------------------------------------------------------------------------
+void prepareRunClang(Options const& opts, Context const& ctx)
+{
+  // Inputs that do not choose a target use the detected or default one.
+  initializeTarget(opts.HaveTarget || opts.Triple.empty()?
+                   llvm::sys::getDefaultTargetTriple() : opts.Triple);
+  overlayResourceFileSystem(clang::vfs::getRealFileSystem(), ctx);
+}
+
+//----------------------------------------------------------------------------
+static void addStdinLanguage(llvm::SmallVectorImpl<const char*>& args)
+{
+  // The driver reads standard input only with a '-x' language.  Give
+  // C++ to a '-' input that follows none.
+  std::unique_ptr<llvm::opt::OptTable>
+    table(clang::driver::createDriverOptTable());
+  unsigned missingArgIndex, missingArgCount;
+  std::unique_ptr<llvm::opt::InputArgList>
+    parsed(table->ParseArgs(args.data(), args.data() + args.size(),
+                            missingArgIndex, missingArgCount));
+  for(llvm::opt::Arg const* a : *parsed) {
+    if(a->getOption().matches(clang::driver::options::OPT_x)) {
+      return;
+    }
+    if(a->getOption().getKind() == llvm::opt::Option::InputClass &&
+       strcmp(a->getValue(), "-") == 0) {
+      static const char* const lang[] = { "-x", "c++" };
+      args.insert(args.begin() + a->getIndex(), lang, lang + 2);
+      return;
+    }
   }
+}
+
+//----------------------------------------------------------------------------
+static const char* getSourceBufferType(std::string const& name)
+{
+  // Choose the language by file extension as the driver would.
+  llvm::StringRef ext = llvm::sys::path::extension(name);
+  clang::driver::types::ID id = clang::driver::types::TY_INVALID;
+  if(!ext.empty()) {
+    id = clang::driver::types::lookupTypeForExtension(ext.substr(1));
+  }
+  if(id == clang::driver::types::TY_INVALID) {
+    id = clang::driver::types::TY_CXX;
+  }
+  return clang::driver::types::getTypeName(id);
+}
+
+//----------------------------------------------------------------------------
+int runClang(const char* const* argBeg,
+             const char* const* argEnd,
+             Options const& opts,
+             Context& ctx)
+{
+  llvm::SmallVector<const char*, 32> args(argBeg, argEnd);
+
+  // Configure Clang to match the detected compiler.
+  std::vector<std::string> const detected = getDetectedArgs(opts);
+  for(std::string const& a : detected) {
+    args.push_back(a.c_str());
+  }
+
+  // Give an inline source buffer to the driver as standard input.
+  // The compiler instance reads it from memory under its own name.
+  if(!opts.SourceBufferName.empty()) {
+    args.push_back("-x");
+    args.push_back(getSourceBufferType(opts.SourceBufferName));
+    args.push_back("-");
+  } else if(opts.GccXml) {
+    addStdinLanguage(args);
+  }
+
+  int const result =
+    runClangImpl(args.data(), args.data() + args.size(), opts, ctx);
+  countMetric(MetricRuns);
+  if(result != 0) {
+    countMetric(MetricRunFailures);
+  }
+  return result;
+}
+
+//----------------------------------------------------------------------------
+int runClangWatch(const char* const* argBeg,
+                  const char* const* argEnd,
+                  Options const& opts,
+                  Context& ctx)
+{
+  // Run the inputs one at a time with the FileManager of the context
+  // so that it records every file read.  Settings such as those
+  // detected by '--castxml-cc-<id>' are kept from one run to the next.
+  Options wopts = opts;
+  wopts.Jobs = 1;
+  wopts.ForkPrelude = false;
+  for(;;) {
+    int const result = runClang(argBeg, argEnd, wopts, ctx);
+    if(!ctx.FileManager) {
+      std::cerr << "error: '--castxml-watch' found no files to watch\n";
+      return result;
+    }
+    std::cerr << "castxml-watch: " << (result? "failed" : "done") <<
+      ", waiting for changes\n";
 
-  return runClangImpl(args.data(), args.data() + args.size(), opts);
+    // Poll the files since a native change notification API would
+    // differ on each platform.  Stat calls on the few hundred headers
+    // of a typical input are cheap next to parsing them.
+    while(!fileManagerIsStale(*ctx.FileManager)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+int queryRetainedAST(Options const& opts, Context& ctx)
+{
+  if(ctx.Retained.empty()) {
+    std::cerr <<
+      "error: '--castxml-query' requires a translation unit kept by an "
+      "earlier '--castxml-retain-ast' request\n";
+    return 1;
+  }
+  return writeRetainedOutput(*ctx.Retained.front(), opts);
 }
@@ -16,11 +16,35 @@
 #ifndef CASTXML_RUNCLANG_H
 #define CASTXML_RUNCLANG_H
 
+class Context;
 struct Options;
 
 /// runClang - Run Clang with given user arguments and detected options.
+/// The context holds the resource directories and keeps file
+/// information for later runs with it.
 int runClang(const char* const* argBeg,
              const char* const* argEnd,
-             Options const& opts);
+             Options const& opts,
+             Context& ctx);
+
+/// runClangWatch - Call runClang with the given arguments, then again
+/// each time a file it read changes, until the process is killed.
+/// The inputs are run one at a time so that the files read by all of
+/// them are known.
+int runClangWatch(const char* const* argBeg,
+                  const char* const* argEnd,
+                  Options const& opts,
+                  Context& ctx);
+
+/// queryRetainedAST - Write the gccxml-format output for the start
+/// names and to the output file given by the options from the
+/// translation unit kept in the context by an earlier run with
+/// Options::RetainAST.  Nothing is parsed again.
+int queryRetainedAST(Options const& opts, Context& ctx);
+
+/// prepareRunClang - Do the setup that runClang would otherwise do on
+/// first use for inputs given the options, so that processes forked
+/// afterwards share it or so that it overlaps other work.
+void prepareRunClang(Options const& opts, Context const& ctx);
 
 #endif // CASTXML_RUNCLANG_H
@@ -0,0 +1,739 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "Schedule.h"
+#include "TimeReport.h"
+#include "Utils.h"
+
+#include <cxsys/SystemTools.hxx>
+
+#include "clang/Basic/Diagnostic.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/YAMLParser.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+#include <stdlib.h>
+
+#if defined(__linux__)
+# include <sched.h>
+#endif
+
+static const char* const jobCostsMagic = "castxml-job-costs 2";
+
+// Seconds per byte of an input source file assumed before any times
+// are recorded.  Only the order of the estimates matters then.
+static double const defaultSecondsPerByte = 1e-6;
+
+//----------------------------------------------------------------------------
+JobCosts::JobCosts():
+  TotalSeconds(0), TotalMemory(0), TotalSize(0), Dirty(false)
+{
+}
+
+//----------------------------------------------------------------------------
+void JobCosts::Load(std::string const& fname)
+{
+  std::lock_guard<std::mutex> lock(this->Mutex);
+  std::ifstream fin(fname.c_str(), std::ios::in | std::ios::binary);
+  std::string line;
+  if(!fin || !cxsys::SystemTools::GetLineFromStream(fin, line) ||
+     line != jobCostsMagic) {
+    return;
+  }
+
+  // Each line holds the seconds, memory and size followed by the file
+  // path.
+  while(cxsys::SystemTools::GetLineFromStream(fin, line)) {
+    char* end;
+    double const seconds = strtod(line.c_str(), &end);
+    if(*end != ' ' || !(seconds >= 0)) {
+      return;
+    }
+    uint64_t const memory = strtoull(end + 1, &end, 10);
+    if(*end != ' ') {
+      return;
+    }
+    uint64_t const size = strtoull(end + 1, &end, 10);
+    if(*end != ' ') {
+      return;
+    }
+    Entry& e = this->Entries[end + 1];
+    e.Seconds = seconds;
+    e.Memory = memory;
+    e.Size = size;
+    this->TotalSeconds += seconds;
+    this->TotalMemory += memory;
+    this->TotalSize += size;
+  }
+}
+
+//----------------------------------------------------------------------------
+void JobCosts::Save(std::string const& fname)
+{
+  std::lock_guard<std::mutex> lock(this->Mutex);
+  if(!this->Dirty) {
+    return;
+  }
+  this->Dirty = false;
+
+  std::string text;
+  {
+    llvm::raw_string_ostream out(text);
+    out << jobCostsMagic << "\n";
+    for(std::map<std::string, Entry>::const_iterator
+          i = this->Entries.begin(), e = this->Entries.end(); i != e; ++i) {
+      if(i->first.find('\n') != std::string::npos) {
+        continue;
+      }
+      out << llvm::format("%.6f", i->second.Seconds) << " " <<
+        i->second.Memory << " " << i->second.Size << " " << i->first << "\n";
+    }
+  }
+  // Costs that cannot be written are measured again by a later run.
+  std::string msg;
+  std::string const dir = llvm::sys::path::parent_path(fname).str();
+  if(!dir.empty()) {
+    cxsys::SystemTools::MakeDirectory(dir.c_str());
+  }
+  replaceFile(fname, text, msg);
+}
+
+//----------------------------------------------------------------------------
+double JobCosts::Estimate(std::string const& file, uint64_t size)
+{
+  ReportedLock lock(this->Mutex, "Job costs");
+
+  // Scale a recorded time by the change in size of the source file
+  // since it was recorded.  The size of the translation unit after
+  // preprocessing is not known before it is processed, but the time
+  // recorded for it already accounts for everything it included.
+  std::map<std::string, Entry>::const_iterator i = this->Entries.find(file);
+  if(i != this->Entries.end()) {
+    Entry const& e = i->second;
+    if(e.Size > 0 && size > 0) {
+      return e.Seconds * double(size) / double(e.Size);
+    }
+    return e.Seconds;
+  }
+
+  // Estimate a file with no recorded time from its size at the
+  // average rate of those recorded.
+  double rate = defaultSecondsPerByte;
+  if(this->TotalSize > 0 && this->TotalSeconds > 0) {
+    rate = this->TotalSeconds / double(this->TotalSize);
+  }
+  return rate * double(size);
+}
+
+//----------------------------------------------------------------------------
+uint64_t JobCosts::EstimateMemory(std::string const& file, uint64_t size)
+{
+  ReportedLock lock(this->Mutex, "Job costs");
+  std::map<std::string, Entry>::const_iterator i = this->Entries.find(file);
+  if(i != this->Entries.end() && i->second.Memory > 0) {
+    Entry const& e = i->second;
+    if(e.Size > 0 && size > 0) {
+      return uint64_t(double(e.Memory) * double(size) / double(e.Size));
+    }
+    return e.Memory;
+  }
+  if(this->TotalSize > 0 && this->TotalMemory > 0) {
+    return uint64_t(double(this->TotalMemory) * double(size) /
+                    double(this->TotalSize));
+  }
+  return 0;
+}
+
+//----------------------------------------------------------------------------
+void JobCosts::Record(std::string const& file, uint64_t size,
+                      double seconds, uint64_t memory)
+{
+  ReportedLock lock(this->Mutex, "Job costs");
+  Entry& e = this->Entries[file];
+  this->TotalSeconds += seconds - e.Seconds;
+  this->TotalMemory += memory - e.Memory;
+  this->TotalSize += size - e.Size;
+  e.Seconds = seconds;
+  e.Memory = memory;
+  e.Size = size;
+  this->Dirty = true;
+}
+
+//----------------------------------------------------------------------------
+#if defined(__linux__)
+static bool readCPUList(std::string const& fname,
+                        std::vector<unsigned int>& list)
+{
+  // A list such as "0-7,16-23" of numbers and ranges of them.
+  std::ifstream fin(fname.c_str());
+  std::string text;
+  if(!std::getline(fin, text)) {
+    return false;
+  }
+  const char* p = text.c_str();
+  while(*p >= '0' && *p <= '9') {
+    char* end;
+    unsigned long first = strtoul(p, &end, 10);
+    unsigned long last = first;
+    if(*end == '-') {
+      last = strtoul(end + 1, &end, 10);
+    }
+    for(unsigned long n = first; n <= last; ++n) {
+      list.push_back(static_cast<unsigned int>(n));
+    }
+    p = *end == ','? end + 1 : end;
+  }
+  return !list.empty();
+}
+#endif
+
+//----------------------------------------------------------------------------
+NumaPlacement::NumaPlacement(size_t workers): Workers(workers)
+{
+#if defined(__linux__)
+  std::string const sys = "/sys/devices/system/node/";
+  std::vector<unsigned int> online;
+  if(readCPUList(sys + "online", online)) {
+    for(unsigned int n : online) {
+      std::vector<unsigned int> cpus;
+      if(readCPUList(sys + "node" + std::to_string(n) + "/cpulist", cpus)) {
+        this->Nodes.push_back(cpus);
+      }
+    }
+  }
+#endif
+}
+
+//----------------------------------------------------------------------------
+size_t NumaPlacement::NodeCount() const
+{
+  return std::max<size_t>(this->Nodes.size(), 1);
+}
+
+//----------------------------------------------------------------------------
+size_t NumaPlacement::NodeOf(size_t worker) const
+{
+  if(this->Workers == 0) {
+    return 0;
+  }
+  return std::min(worker, this->Workers - 1) * this->NodeCount() /
+    this->Workers;
+}
+
+//----------------------------------------------------------------------------
+bool NumaPlacement::Bind(size_t worker) const
+{
+#if defined(__linux__)
+  if(this->Nodes.size() < 2) {
+    return false;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for(unsigned int cpu : this->Nodes[this->NodeOf(worker)]) {
+    if(cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+  (void)worker;
+  return false;
+#endif
+}
+
+//----------------------------------------------------------------------------
+std::vector<size_t> orderJobs(std::vector<double> const& costs)
+{
+  std::vector<size_t> order(costs.size());
+  for(size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [&costs](size_t l, size_t r) {
+                     return costs[l] > costs[r];
+                   });
+  return order;
+}
+
+//----------------------------------------------------------------------------
+/// Jobs taken by the workers of runJobs and the memory they hold.
+struct JobQueue
+{
+  JobQueue(std::vector<uint64_t> const& memory, uint64_t budget,
+           std::function<void(size_t, size_t)> const& run):
+    Memory(memory), Budget(budget), Run(run), Numa(nullptr), Next(0),
+    Running(0), Reserved(0) {}
+  std::vector<size_t> Order;
+  std::vector<uint64_t> const& Memory;
+  uint64_t const Budget;
+  std::function<void(size_t, size_t)> const& Run;
+  NumaPlacement const* Numa;
+  std::atomic<size_t> Next;
+  std::mutex Mutex;
+  std::condition_variable Finished;
+  size_t Running;
+  uint64_t Reserved;
+
+  void Admit(uint64_t memory) {
+    std::unique_lock<std::mutex> lock(this->Mutex);
+    // Sample the resident size again from time to time while waiting
+    // since it grows as the running jobs proceed.
+    while(this->Running > 0 &&
+          std::max<uint64_t>(this->Reserved, getCurrentResidentSize()) +
+          memory > this->Budget) {
+      this->Finished.wait_for(lock, std::chrono::milliseconds(100));
+    }
+    ++this->Running;
+    this->Reserved += memory;
+  }
+
+  void Release(uint64_t memory) {
+    {
+      std::lock_guard<std::mutex> lock(this->Mutex);
+      --this->Running;
+      this->Reserved -= memory;
+    }
+    this->Finished.notify_all();
+  }
+};
+
+//----------------------------------------------------------------------------
+static void runJobsWorker(JobQueue* queue, size_t worker)
+{
+  if(queue->Numa) {
+    queue->Numa->Bind(worker);
+  }
+  for(size_t i = queue->Next++; i < queue->Order.size();
+      i = queue->Next++) {
+    size_t const job = queue->Order[i];
+    if(queue->Budget == 0) {
+      queue->Run(job, worker);
+      continue;
+    }
+    uint64_t const memory =
+      job < queue->Memory.size()? queue->Memory[job] : 0;
+    queue->Admit(memory);
+    queue->Run(job, worker);
+    queue->Release(memory);
+  }
+}
+
+//----------------------------------------------------------------------------
+void runJobs(std::vector<double> const& costs,
+             std::vector<uint64_t> const& memory, uint64_t budget,
+             size_t threads,
+             std::function<void(size_t, size_t)> const& run,
+             NumaPlacement const* numa)
+{
+  size_t const n = costs.size();
+  threads = std::min(threads, n);
+  if(threads <= 1) {
+    for(size_t i = 0; i < n; ++i) {
+      run(i, 0);
+    }
+    return;
+  }
+
+  JobQueue queue(memory, budget, run);
+  queue.Order = orderJobs(costs);
+  queue.Numa = numa;
+
+  std::vector<std::thread> workers;
+  for(size_t w = 0; w < threads; ++w) {
+    workers.push_back(std::thread(runJobsWorker, &queue, w));
+  }
+  for(std::thread& w : workers) {
+    w.join();
+  }
+}
+
+//----------------------------------------------------------------------------
+static double sharedFraction(std::vector<uint32_t> const& l,
+                             std::vector<uint32_t> const& r)
+{
+  // The share of the files in either sorted set that are in both.
+  size_t common = 0;
+  for(size_t i = 0, j = 0; i < l.size() && j < r.size();) {
+    if(l[i] < r[j]) {
+      ++i;
+    } else if(r[j] < l[i]) {
+      ++j;
+    } else {
+      ++common;
+      ++i;
+      ++j;
+    }
+  }
+  size_t const all = l.size() + r.size() - common;
+  return all? double(common) / double(all) : 0;
+}
+
+//----------------------------------------------------------------------------
+std::vector<std::vector<size_t> >
+groupJobs(std::vector<double> const& costs,
+          std::vector<std::vector<std::string> > const& includes,
+          size_t threads)
+{
+  // Number the files so that sets of them compare as sorted integers.
+  std::map<std::string, uint32_t> ids;
+  std::vector<std::vector<uint32_t> > sets(costs.size());
+  for(size_t i = 0; i < costs.size() && i < includes.size(); ++i) {
+    for(std::string const& f : includes[i]) {
+      std::map<std::string, uint32_t>::iterator id = ids.find(f);
+      if(id == ids.end()) {
+        id = ids.insert(std::make_pair(
+          f, static_cast<uint32_t>(ids.size()))).first;
+      }
+      sets[i].push_back(id->second);
+    }
+    std::sort(sets[i].begin(), sets[i].end());
+    sets[i].erase(std::unique(sets[i].begin(), sets[i].end()),
+                  sets[i].end());
+  }
+
+  // Give each job, largest first, to the group sharing the most of its
+  // files among those it leaves within a tenth of an even share of the
+  // total cost, or else to the group of least cost.
+  double total = 0;
+  for(double c : costs) {
+    total += c;
+  }
+  double const limit = total / double(threads) * 1.1;
+  std::vector<std::vector<size_t> > groups(threads);
+  std::vector<std::vector<uint32_t> > groupFiles(threads);
+  std::vector<double> groupCosts(threads, 0);
+  for(size_t job : orderJobs(costs)) {
+    size_t best = threads;
+    double bestShare = -1;
+    size_t least = 0;
+    for(size_t g = 0; g < threads; ++g) {
+      if(groupCosts[g] < groupCosts[least]) {
+        least = g;
+      }
+      if(groupCosts[g] + costs[job] > limit) {
+        continue;
+      }
+      double const share = sharedFraction(sets[job], groupFiles[g]);
+      if(share > bestShare ||
+         (share == bestShare && groupCosts[g] < groupCosts[best])) {
+        best = g;
+        bestShare = share;
+      }
+    }
+    if(best == threads) {
+      best = least;
+    }
+    groups[best].push_back(job);
+    groupCosts[best] += costs[job];
+    std::vector<uint32_t> files;
+    std::set_union(groupFiles[best].begin(), groupFiles[best].end(),
+                   sets[job].begin(), sets[job].end(),
+                   std::back_inserter(files));
+    groupFiles[best].swap(files);
+  }
+
+  // Run the jobs of each group so that each follows the one sharing
+  // the most of its files, starting from the largest.
+  for(std::vector<size_t>& group : groups) {
+    for(size_t i = 1; i < group.size(); ++i) {
+      size_t next = i;
+      double nextShare = -1;
+      for(size_t j = i; j < group.size(); ++j) {
+        double const share = sharedFraction(sets[group[i - 1]],
+                                            sets[group[j]]);
+        if(share > nextShare) {
+          next = j;
+          nextShare = share;
+        }
+      }
+      std::swap(group[i], group[next]);
+    }
+  }
+  return groups;
+}
+
+//----------------------------------------------------------------------------
+/// Jobs of the groups given to each worker by runJobsByAffinity.
+struct AffinityQueue
+{
+  AffinityQueue(std::vector<double> const& costs,
+                std::vector<uint64_t> const& memory, uint64_t budget,
+                std::function<void(size_t, size_t)> const& run):
+    Costs(costs), Admission(memory, budget, run) {}
+  std::vector<double> const& Costs;
+  JobQueue Admission;
+  std::mutex Mutex;
+  std::vector<std::deque<size_t> > Groups;
+  std::vector<double> Remaining;
+
+  bool Take(size_t worker, size_t& job) {
+    ReportedLock lock(this->Mutex, "Job groups");
+
+    // Take the next job of the worker's own group, or else the last
+    // job of the group with the most work left, which is least likely
+    // to share files with the jobs run before it.
+    size_t g = worker;
+    if(this->Groups[g].empty()) {
+      for(size_t i = 0; i < this->Groups.size(); ++i) {
+        if(!this->Groups[i].empty() &&
+           (this->Groups[g].empty() ||
+            this->Remaining[i] > this->Remaining[g])) {
+          g = i;
+        }
+      }
+      if(this->Groups[g].empty()) {
+        return false;
+      }
+      job = this->Groups[g].back();
+      this->Groups[g].pop_back();
+    } else {
+      job = this->Groups[g].front();
+      this->Groups[g].pop_front();
+    }
+    this->Remaining[g] -= this->Costs[job];
+    return true;
+  }
+};
+
+//----------------------------------------------------------------------------
+static void runJobsByAffinityWorker(AffinityQueue* queue, size_t worker)
+{
+  JobQueue& admission = queue->Admission;
+  if(admission.Numa) {
+    admission.Numa->Bind(worker);
+  }
+  size_t job;
+  while(queue->Take(worker, job)) {
+    if(admission.Budget == 0) {
+      admission.Run(job, worker);
+      continue;
+    }
+    uint64_t const memory =
+      job < admission.Memory.size()? admission.Memory[job] : 0;
+    admission.Admit(memory);
+    admission.Run(job, worker);
+    admission.Release(memory);
+  }
+}
+
+//----------------------------------------------------------------------------
+void runJobsByAffinity(std::vector<double> const& costs,
+                       std::vector<uint64_t> const& memory,
+                       uint64_t budget, size_t threads,
+                       std::vector<std::vector<std::string> > const& includes,
+                       std::function<void(size_t, size_t)> const& run,
+                       NumaPlacement const* numa)
+{
+  size_t const n = costs.size();
+  threads = std::min(threads, n);
+  if(threads <= 1) {
+    for(size_t i = 0; i < n; ++i) {
+      run(i, 0);
+    }
+    return;
+  }
+
+  AffinityQueue queue(costs, memory, budget, run);
+  queue.Admission.Numa = numa;
+  std::vector<std::vector<size_t> > const groups =
+    groupJobs(costs, includes, threads);
+  for(std::vector<size_t> const& group : groups) {
+    queue.Groups.push_back(std::deque<size_t>(group.begin(), group.end()));
+    double remaining = 0;
+    for(size_t job : group) {
+      remaining += costs[job];
+    }
+    queue.Remaining.push_back(remaining);
+  }
+
+  std::vector<std::thread> workers;
+  for(size_t w = 0; w < threads; ++w) {
+    workers.push_back(std::thread(runJobsByAffinityWorker, &queue, w));
+  }
+  for(std::thread& w : workers) {
+    w.join();
+  }
+}
+
+//----------------------------------------------------------------------------
+JobLimits::JobLimits(unsigned int timeout, size_t memoryLimit):
+  Deadline(std::chrono::steady_clock::now() + std::chrono::seconds(timeout)),
+  NextMemorySample(), CancelFlag(nullptr), Timeout(timeout),
+  MemoryLimit(memoryLimit), Reported(false)
+{
+}
+
+//----------------------------------------------------------------------------
+bool JobLimits::Exceeded(clang::DiagnosticsEngine& diags)
+{
+  if(this->Reported) {
+    return true;
+  }
+  bool const cancelled = this->CancelFlag && this->CancelFlag->load();
+  std::chrono::steady_clock::time_point const now =
+    std::chrono::steady_clock::now();
+  bool const late = !cancelled && this->Timeout && now >= this->Deadline;
+
+  // Measuring the memory walks the compiler tables, so sample it only
+  // from time to time.
+  bool large = false;
+  if(!cancelled && !late && this->MemoryLimit && this->MemoryProbe &&
+     now >= this->NextMemorySample) {
+    this->NextMemorySample = now + std::chrono::milliseconds(50);
+    large = this->MemoryProbe() > this->MemoryLimit;
+  }
+  if(!cancelled && !late && !large) {
+    return false;
+  }
+  this->Reported = true;
+
+  // Diagnostics are suppressed while adding implicit members and after,
+  // but this error must fail the job.
+  bool const suppress = diags.getSuppressAllDiagnostics();
+  diags.setSuppressAllDiagnostics(false);
+  if(cancelled) {
+    diags.Report(diags.getCustomDiagID(
+      clang::DiagnosticsEngine::Error, "job was cancelled by the client"));
+  } else if(late) {
+    diags.Report(diags.getCustomDiagID(
+      clang::DiagnosticsEngine::Error,
+      "job exceeded the '--castxml-timeout' of %0 seconds")) <<
+      this->Timeout;
+  } else {
+    diags.Report(diags.getCustomDiagID(
+      clang::DiagnosticsEngine::Error,
+      "job exceeded the '--castxml-mem-limit' of %0 bytes")) <<
+      std::to_string(uint64_t(this->MemoryLimit));
+  }
+  diags.setSuppressAllDiagnostics(suppress);
+  return true;
+}
+
+//----------------------------------------------------------------------------
+static bool getMetricsNumber(llvm::yaml::Node* node, double& value)
+{
+  llvm::yaml::ScalarNode* scalar =
+    llvm::dyn_cast_or_null<llvm::yaml::ScalarNode>(node);
+  if(!scalar) {
+    return false;
+  }
+  llvm::SmallString<32> storage;
+  std::string const text = scalar->getValue(storage).str();
+  if(text == "true" || text == "false") {
+    value = text == "true"? 1 : 0;
+    return true;
+  }
+  char* end;
+  value = strtod(text.c_str(), &end);
+  return !text.empty() && !*end;
+}
+
+//----------------------------------------------------------------------------
+static void getMetricsNumbers(llvm::yaml::Node* node,
+                              std::map<std::string, double>& values,
+                              std::string const& prefix)
+{
+  llvm::yaml::MappingNode* object =
+    llvm::dyn_cast_or_null<llvm::yaml::MappingNode>(node);
+  if(!object) {
+    return;
+  }
+  for(llvm::yaml::KeyValueNode& kv : *object) {
+    llvm::yaml::ScalarNode* key =
+      llvm::dyn_cast_or_null<llvm::yaml::ScalarNode>(kv.getKey());
+    if(!key) {
+      continue;
+    }
+    llvm::SmallString<32> storage;
+    std::string const name = prefix + key->getValue(storage).str();
+    llvm::yaml::Node* value = kv.getValue();
+    if(name == "counters" || name == "settings") {
+      getMetricsNumbers(value, values, name + ".");
+    } else {
+      double n;
+      if(getMetricsNumber(value, n)) {
+        values[name] = n;
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+AutoTune autoTune(std::string const& fname)
+{
+  AutoTune tune;
+  unsigned int const processors =
+    std::max<unsigned int>(std::thread::hardware_concurrency(), 1);
+  uint64_t const budget = uint64_t(getPhysicalMemorySize()) / 4 * 3;
+  tune.Jobs = processors;
+  tune.MemoryBudget = processors > 1? budget : 0;
+
+  // The numbers of the top-level, counters and settings objects of the
+  // metrics file, the last with names such as "counters.runs".
+  std::map<std::string, double> values;
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+    llvm::MemoryBuffer::getFile(fname);
+  if(buffer) {
+    llvm::SourceMgr sm;
+    sm.setDiagHandler([](llvm::SMDiagnostic const&, void*) {});
+    llvm::yaml::Stream stream(buffer.get()->getBuffer(), sm);
+    llvm::yaml::document_iterator di = stream.begin();
+    if(di != stream.end()) {
+      getMetricsNumbers(di->getRoot(), values, "");
+    }
+  }
+  if(values.empty()) {
+    return tune;
+  }
+
+  // The threads of the earlier run shared one peak resident size.
+  double const jobs = std::max(values["settings.jobs"], 1.0);
+  double const perJob = values["peak_resident_bytes"] / jobs;
+  if(budget && perJob >= 1) {
+    double const fit = std::max(std::floor(double(budget) / perJob), 1.0);
+    if(fit < processors) {
+      tune.Jobs = static_cast<unsigned int>(fit);
+    }
+  }
+  if(tune.Jobs < 2) {
+    tune.MemoryBudget = 0;
+  }
+
+  // A prelude that is built again for most runs costs more than it
+  // saves.  Once turned off it stays off, as its use is not seen.
+  double const runs = values["counters.runs"];
+  double const misses = values["counters.prelude_pch_misses"];
+  if(values["settings.prelude_pch_disabled"] != 0 ||
+     (runs > 1 && misses * 2 > runs)) {
+    tune.PreludePCH = false;
+  }
+  return tune;
+}
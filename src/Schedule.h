@@ -0,0 +1,253 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_SCHEDULE_H
+#define CASTXML_SCHEDULE_H
+
+#include <cxsys/Configure.hxx>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace clang {
+  class DiagnosticsEngine;
+}
+
+/// JobCosts - Estimate the time and memory to process each input source
+/// file from what it took in an earlier run, as recorded in the file
+/// given by '--castxml-job-costs', or else from its size.  Costs may be
+/// recorded from any thread.
+class JobCosts
+{
+  struct Entry
+  {
+    Entry(): Seconds(0), Memory(0), Size(0) {}
+    double Seconds;
+    uint64_t Memory;
+    uint64_t Size;
+  };
+  std::mutex Mutex;
+  std::map<std::string, Entry> Entries;
+  double TotalSeconds;
+  uint64_t TotalMemory;
+  uint64_t TotalSize;
+  bool Dirty;
+
+public:
+  JobCosts();
+
+  /** Load the times recorded in the named file, if it exists.  */
+  void Load(std::string const& fname);
+
+  /** Store the costs known, including those given to Record, in the
+      named file.  */
+  void Save(std::string const& fname);
+
+  /** Estimate the seconds needed to process the named source file of
+      the given size in bytes.  */
+  double Estimate(std::string const& file, uint64_t size);
+
+  /** Estimate the bytes of memory needed to process the named source
+      file of the given size, or 0 if no memory use is recorded.  */
+  uint64_t EstimateMemory(std::string const& file, uint64_t size);
+
+  /** Record the seconds and the bytes of memory taken to process the
+      named source file.  A memory use of 0 is not known.  */
+  void Record(std::string const& file, uint64_t size, double seconds,
+              uint64_t memory);
+};
+
+/// NumaPlacement - The processors of each NUMA node of the host, as
+/// listed by the kernel, and the node given to each of a number of
+/// workers by '--castxml-numa'.  Consecutive workers share a node, so
+/// that worker 0 runs on the first.  Memory is allocated from the node
+/// of the thread first touching it, so a job run by a worker bound to
+/// its node, from Sema to building the output node table, keeps its
+/// memory local.
+class NumaPlacement
+{
+  std::vector<std::vector<unsigned int> > Nodes;
+  size_t Workers;
+
+public:
+  /** Find the nodes of the host for the given number of workers.  */
+  NumaPlacement(size_t workers);
+
+  /** The number of nodes found, or 1 if the host lists none.  */
+  size_t NodeCount() const;
+
+  /** The node of the given worker, from 0 to NodeCount()-1.  */
+  size_t NodeOf(size_t worker) const;
+
+  /** Bind the calling thread, or the process when it has one thread,
+      to the processors of the node of the given worker.  Return false
+      if the host has fewer than two nodes or does not support it.  */
+  bool Bind(size_t worker) const;
+};
+
+/// orderJobs - Get the numbers of the jobs with the given costs in the
+/// order to start them: largest cost first, keeping the order of jobs
+/// of equal cost.
+std::vector<size_t> orderJobs(std::vector<double> const& costs);
+
+/// runJobs - Call run(job, worker) for each job numbered from 0 to
+/// costs.size()-1 on up to the given number of worker threads, also
+/// numbered from 0.  Jobs of largest cost start first, and each worker
+/// takes the next one as soon as it is free, so that a few long jobs
+/// do not leave the other workers idle at the end.  With one worker
+/// the jobs run in order on the calling thread.
+///
+/// With a non-zero memory budget in bytes, a job starts only when its
+/// predicted memory plus that in use by the jobs running stays within
+/// the budget, or when no other job is running.  The memory in use is
+/// the larger of the predictions for the running jobs and the resident
+/// size of the process sampled while waiting.
+///
+/// With a placement, each worker thread binds itself to the NUMA node
+/// of its number before taking a job.
+void runJobs(std::vector<double> const& costs,
+             std::vector<uint64_t> const& memory, uint64_t budget,
+             size_t threads,
+             std::function<void(size_t, size_t)> const& run,
+             NumaPlacement const* numa = nullptr);
+
+/// groupJobs - Divide the jobs with the given costs among the given
+/// number of workers so that jobs listing many of the same files in
+/// includes, such as the headers an earlier run of each read, share a
+/// worker, with the cost of each worker kept close to an even share.
+/// The jobs of each group are ordered so that each follows one sharing
+/// most of its files.
+std::vector<std::vector<size_t> >
+groupJobs(std::vector<double> const& costs,
+          std::vector<std::vector<std::string> > const& includes,
+          size_t threads);
+
+/// runJobsByAffinity - Call run(job, worker) for each job as runJobs
+/// does, but run the jobs of each group given by groupJobs on its own
+/// worker one after another, so that state a worker keeps from one job
+/// to the next, such as the files its FileManager has read, serves
+/// jobs that include the same headers.  A worker whose group is done
+/// takes the last jobs of the group with the most work left.
+void runJobsByAffinity(std::vector<double> const& costs,
+                       std::vector<uint64_t> const& memory,
+                       uint64_t budget, size_t threads,
+                       std::vector<std::vector<std::string> > const& includes,
+                       std::function<void(size_t, size_t)> const& run,
+                       NumaPlacement const* numa = nullptr);
+
+/// JobLimits - The limits given by '--castxml-timeout' and
+/// '--castxml-mem-limit' to one job, such as a batch entry or server
+/// request, checked at safe points of its processing so that a job
+/// exceeding them fails with a diagnostic and leaves the process free
+/// to run the next one.
+class JobLimits
+{
+  std::chrono::steady_clock::time_point Deadline;
+  std::chrono::steady_clock::time_point NextMemorySample;
+  std::function<size_t()> MemoryProbe;
+  std::atomic<bool> const* CancelFlag;
+  unsigned int Timeout;
+  size_t MemoryLimit;
+  bool Reported;
+
+public:
+  /** Start the clock of a job allowed the given wall-clock seconds and
+      bytes of memory, or any amount of either if 0.  */
+  JobLimits(unsigned int timeout, size_t memoryLimit);
+
+  /** Measure the memory of the job by calling the given function, or
+      not at all if it is empty.  The compiler instance of the job sets
+      this while it exists, since the resident size of the process also
+      counts the jobs of other threads.  */
+  void SetMemoryProbe(std::function<size_t()> const& probe) {
+    this->MemoryProbe = probe;
+  }
+
+  /** Fail the job at its next safe point once the given flag is set,
+      as by another thread when the client of a '--castxml-server'
+      request cancels it.  */
+  void SetCancelFlag(std::atomic<bool> const* flag) {
+    this->CancelFlag = flag;
+  }
+
+  /** Return whether the job has exceeded its limits, reporting an
+      error to the diagnostics engine the first time it has.  */
+  bool Exceeded(clang::DiagnosticsEngine& diags);
+};
+
+/// AutoTune - The settings '--castxml-auto-tune' gives a run unless
+/// they are given on the command line.
+struct AutoTune
+{
+  AutoTune(): Jobs(1), MemoryBudget(0), PreludePCH(true) {}
+
+  // The number of jobs and memory budget in bytes, if not 0, to run
+  // them with.
+  unsigned int Jobs;
+  uint64_t MemoryBudget;
+
+  // Whether a prelude PCH may be used.
+  bool PreludePCH;
+};
+
+/// autoTune - Choose the settings of a run from the metrics written to
+/// the named file by an earlier run, or for a first run if it does not
+/// exist: one job for each processor, as many as the memory per job of
+/// the earlier run allows in a budget of three quarters of the physical
+/// memory, and no prelude PCH if the earlier run built one for most of
+/// its runs instead of reusing it.
+AutoTune autoTune(std::string const& fname);
+
+/// JobPipeline - The two stages, parsing and output, through which the
+/// jobs of '--castxml-pipeline' pass.  Each stage is held by one job at
+/// a time, so with two workers the output of one translation unit is
+/// written while the next is parsed, and at most two are held at once.
+class JobPipeline
+{
+  std::mutex ParseStage;
+  std::mutex OutputStage;
+  friend class PipelineJob;
+};
+
+/// PipelineJob - The place of one job in a JobPipeline.  The job takes
+/// the parsing stage when constructed, moves to the output stage when
+/// StartOutput is called, and leaves the stage it holds when destroyed.
+class PipelineJob
+{
+  JobPipeline& Pipeline;
+  std::unique_lock<std::mutex> Parse;
+  std::unique_lock<std::mutex> Output;
+
+public:
+  PipelineJob(JobPipeline& pipeline):
+    Pipeline(pipeline), Parse(pipeline.ParseStage) {}
+
+  /** Let the next job parse, and wait for the output stage.  */
+  void StartOutput() {
+    if(this->Parse.owns_lock()) {
+      this->Parse.unlock();
+      this->Output = std::unique_lock<std::mutex>(this->Pipeline.OutputStage);
+    }
+  }
+};
+
+#endif // CASTXML_SCHEDULE_H
@@ -0,0 +1,418 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "SharedFS.h"
+#include "TimeReport.h"
+
+#include "clang/Basic/VirtualFileSystem.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#if defined(CASTXML_HAVE_IO_URING)
+# include <linux/io_uring.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <string.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+//----------------------------------------------------------------------------
+class SharedFile: public clang::vfs::File
+{
+  clang::vfs::Status Status;
+  llvm::MemoryBuffer const& Buffer;
+public:
+  SharedFile(clang::vfs::Status const& status,
+             llvm::MemoryBuffer const& buffer):
+    Status(status), Buffer(buffer) {}
+
+  llvm::ErrorOr<clang::vfs::Status> status() override {
+    return this->Status;
+  }
+
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>>
+  getBuffer(llvm::Twine const& name, int64_t, bool, bool) override {
+    // The shared buffer was read with a null terminator.
+    return llvm::MemoryBuffer::getMemBuffer(this->Buffer.getBuffer(),
+                                            name.str(), true);
+  }
+
+  std::error_code close() override {
+    return std::error_code();
+  }
+
+  void setName(llvm::StringRef name) override {
+    this->Status.setName(name);
+  }
+};
+
+#if defined(CASTXML_HAVE_IO_URING)
+//----------------------------------------------------------------------------
+/// A submission and completion queue pair of io_uring, driven by the
+/// system calls directly so that no library is needed.  One thread
+/// queues a batch of requests, then runs them all at once.
+class IoRing
+{
+  int FD;
+  unsigned int Entries;
+  void* SQRing;
+  size_t SQRingSize;
+  void* CQRing;
+  size_t CQRingSize;
+  void* SQEMap;
+  size_t SQEMapSize;
+  io_uring_sqe* SQEs;
+  unsigned int* SQTail;
+  unsigned int* SQMask;
+  unsigned int* SQArray;
+  io_uring_cqe* CQEs;
+  unsigned int* CQHead;
+  unsigned int* CQTail;
+  unsigned int* CQMask;
+  unsigned int Tail;
+  unsigned int Queued;
+
+  void* Map(size_t size, off_t offset) {
+    return mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, this->FD, offset);
+  }
+
+  template <typename T> static T* At(void* ring, unsigned int offset) {
+    return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+  }
+
+public:
+  IoRing(unsigned int entries): FD(-1), Entries(0),
+    SQRing(MAP_FAILED), SQRingSize(0), CQRing(MAP_FAILED), CQRingSize(0),
+    SQEMap(MAP_FAILED), SQEMapSize(0), Tail(0), Queued(0) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    this->FD = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+    if(this->FD < 0) {
+      return;
+    }
+    this->SQRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    this->CQRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    this->SQEMapSize = p.sq_entries * sizeof(io_uring_sqe);
+    this->SQRing = this->Map(this->SQRingSize, IORING_OFF_SQ_RING);
+    this->CQRing = this->Map(this->CQRingSize, IORING_OFF_CQ_RING);
+    this->SQEMap = this->Map(this->SQEMapSize, IORING_OFF_SQES);
+    if(this->SQRing == MAP_FAILED || this->CQRing == MAP_FAILED ||
+       this->SQEMap == MAP_FAILED) {
+      return;
+    }
+    this->SQEs = static_cast<io_uring_sqe*>(this->SQEMap);
+    this->SQTail = At<unsigned int>(this->SQRing, p.sq_off.tail);
+    this->SQMask = At<unsigned int>(this->SQRing, p.sq_off.ring_mask);
+    this->SQArray = At<unsigned int>(this->SQRing, p.sq_off.array);
+    this->CQEs = At<io_uring_cqe>(this->CQRing, p.cq_off.cqes);
+    this->CQHead = At<unsigned int>(this->CQRing, p.cq_off.head);
+    this->CQTail = At<unsigned int>(this->CQRing, p.cq_off.tail);
+    this->CQMask = At<unsigned int>(this->CQRing, p.cq_off.ring_mask);
+    this->Tail = *this->SQTail;
+    this->Entries = p.sq_entries;
+  }
+
+  ~IoRing() {
+    if(this->SQEMap != MAP_FAILED) {
+      munmap(this->SQEMap, this->SQEMapSize);
+    }
+    if(this->CQRing != MAP_FAILED) {
+      munmap(this->CQRing, this->CQRingSize);
+    }
+    if(this->SQRing != MAP_FAILED) {
+      munmap(this->SQRing, this->SQRingSize);
+    }
+    if(this->FD >= 0) {
+      close(this->FD);
+    }
+  }
+
+  /** Number of requests that may be queued for one Run, or 0 if the
+      host has no io_uring.  */
+  unsigned int Size() const { return this->Entries; }
+
+  /** Queue a request, cleared but for the given user data.  */
+  io_uring_sqe* Queue(uint64_t data) {
+    unsigned int const i = this->Tail & *this->SQMask;
+    io_uring_sqe* sqe = &this->SQEs[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = data;
+    this->SQArray[i] = i;
+    ++this->Tail;
+    ++this->Queued;
+    return sqe;
+  }
+
+  /** Submit the queued requests and wait for all of them, giving the
+      user data and result of each to done.  On failure the requests
+      may still be in flight, so their buffers must be kept.  */
+  template <typename F> bool Run(F const& done) {
+    unsigned int const n = this->Queued;
+    this->Queued = 0;
+    __atomic_store_n(this->SQTail, this->Tail, __ATOMIC_RELEASE);
+    unsigned int submitted = 0;
+    unsigned int completed = 0;
+    while(completed < n) {
+      long const r = syscall(__NR_io_uring_enter, this->FD, n - submitted,
+                             1, IORING_ENTER_GETEVENTS, nullptr, 0);
+      if(r < 0) {
+        if(errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      submitted += static_cast<unsigned int>(r);
+      unsigned int head = *this->CQHead;
+      unsigned int const tail =
+        __atomic_load_n(this->CQTail, __ATOMIC_ACQUIRE);
+      for(; head != tail; ++head) {
+        io_uring_cqe const& cqe = this->CQEs[head & *this->CQMask];
+        done(cqe.user_data, cqe.res);
+        ++completed;
+      }
+      __atomic_store_n(this->CQHead, head, __ATOMIC_RELEASE);
+    }
+    return true;
+  }
+};
+
+//----------------------------------------------------------------------------
+static bool readRest(int fd, std::string& content)
+{
+  char buffer[64 * 1024];
+  for(;;) {
+    ssize_t const r = pread(fd, buffer, sizeof(buffer),
+                            static_cast<off_t>(content.size()));
+    if(r < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if(r == 0) {
+      return true;
+    }
+    content.append(buffer, static_cast<size_t>(r));
+  }
+}
+#endif
+
+//----------------------------------------------------------------------------
+/// Answer status lookups and reads from what an earlier lookup or read
+/// of the same path found.  Each path has its own lock for its first
+/// read, so threads reading different files do not wait for each other.
+class SharedFileSystem: public clang::vfs::FileSystem
+{
+  struct Entry
+  {
+    Entry(): HaveStatus(false),
+      Status(std::make_error_code(std::errc::no_such_file_or_directory)),
+      HaveContent(false), Preloaded(false) {}
+    std::mutex Mutex;
+    bool HaveStatus;
+    llvm::ErrorOr<clang::vfs::Status> Status;
+    bool HaveContent;
+    std::error_code ContentError;
+    std::unique_ptr<llvm::MemoryBuffer> Content;
+    clang::vfs::Status ContentStatus;
+
+    // Whether the content was preloaded without looking up its status.
+    bool Preloaded;
+  };
+
+  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> Base;
+  std::mutex Mutex;
+  std::map<std::string, std::unique_ptr<Entry>> Entries;
+
+  Entry& GetEntry(llvm::StringRef path) {
+    ReportedLock lock(this->Mutex, "Shared files");
+    std::unique_ptr<Entry>& e = this->Entries[path.str()];
+    if(!e) {
+      e.reset(new Entry);
+    }
+    return *e;
+  }
+
+  void Preload(std::string const& path, llvm::StringRef content) {
+    Entry& e = this->GetEntry(path);
+    std::lock_guard<std::mutex> lock(e.Mutex);
+    if(!e.HaveContent) {
+      e.HaveContent = true;
+      e.Content = llvm::MemoryBuffer::getMemBufferCopy(content, path);
+      e.Preloaded = true;
+    }
+  }
+
+public:
+  SharedFileSystem(
+    llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> const& base):
+    Base(base) {}
+
+  /** Read the given files in batches through io_uring, if available.
+      Each batch opens its files with one request each, all at once,
+      then reads the start of each opened file in the same way.  The
+      status of a file is looked up on its first use, from the cache
+      of the operating system filled by the open.  */
+  void PreloadFiles(std::vector<std::string> const& files) {
+#if defined(CASTXML_HAVE_IO_URING)
+    TraceRegion tr("Preload files");
+    IoRing ring(64);
+    size_t const batch = ring.Size();
+    if(batch == 0) {
+      return;
+    }
+    size_t const chunk = 64 * 1024;
+    std::unique_ptr<char[]> buffers(new char[batch * chunk]);
+    std::vector<int> fds(batch);
+    std::vector<int> sizes(batch);
+    for(size_t first = 0; first < files.size(); first += batch) {
+      size_t const n = std::min(batch, files.size() - first);
+      for(size_t i = 0; i < n; ++i) {
+        io_uring_sqe* sqe = ring.Queue(i);
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uintptr_t>(files[first + i].c_str());
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+      }
+      if(!ring.Run([&fds](uint64_t i, int res) { fds[i] = res; })) {
+        return;
+      }
+      for(size_t i = 0; i < n; ++i) {
+        sizes[i] = -1;
+        if(fds[i] >= 0) {
+          io_uring_sqe* sqe = ring.Queue(i);
+          sqe->opcode = IORING_OP_READ;
+          sqe->fd = fds[i];
+          sqe->addr = reinterpret_cast<uintptr_t>(buffers.get() + i * chunk);
+          sqe->len = chunk;
+        }
+      }
+      if(!ring.Run([&sizes](uint64_t i, int res) { sizes[i] = res; })) {
+        // The kernel may still write to the buffers.
+        buffers.release();
+        return;
+      }
+      for(size_t i = 0; i < n; ++i) {
+        if(fds[i] < 0) {
+          continue;
+        }
+        if(sizes[i] >= 0) {
+          // A file filling its chunk may be longer.
+          llvm::StringRef start(buffers.get() + i * chunk,
+                                static_cast<size_t>(sizes[i]));
+          if(static_cast<size_t>(sizes[i]) < chunk) {
+            this->Preload(files[first + i], start);
+          } else {
+            std::string content = start.str();
+            if(readRest(fds[i], content)) {
+              this->Preload(files[first + i], content);
+            }
+          }
+        }
+        close(fds[i]);
+      }
+    }
+#else
+    (void)files;
+#endif
+  }
+
+  llvm::ErrorOr<clang::vfs::Status> status(llvm::Twine const& path) override {
+    llvm::SmallString<256> p;
+    Entry& e = this->GetEntry(path.toStringRef(p));
+    std::lock_guard<std::mutex> lock(e.Mutex);
+    if(!e.HaveStatus) {
+      e.Status = this->Base->status(p);
+      e.HaveStatus = true;
+    }
+    return e.Status;
+  }
+
+  llvm::ErrorOr<std::unique_ptr<clang::vfs::File>>
+  openFileForRead(llvm::Twine const& path) override {
+    llvm::SmallString<256> p;
+    Entry& e = this->GetEntry(path.toStringRef(p));
+    std::lock_guard<std::mutex> lock(e.Mutex);
+    if(!e.HaveContent) {
+      e.HaveContent = true;
+      llvm::ErrorOr<std::unique_ptr<clang::vfs::File>> f =
+        this->Base->openFileForRead(p);
+      if(!f) {
+        e.ContentError = f.getError();
+        return e.ContentError;
+      }
+      llvm::ErrorOr<clang::vfs::Status> st = (*f)->status();
+      llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> b = st?
+        (*f)->getBuffer(p, st->getSize(), true, false) :
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>>(st.getError());
+      (*f)->close();
+      if(!b) {
+        e.ContentError = b.getError();
+        return e.ContentError;
+      }
+      e.Content = std::move(*b);
+      e.ContentStatus = *st;
+    }
+    if(e.Preloaded) {
+      e.Preloaded = false;
+      if(!e.HaveStatus) {
+        e.Status = this->Base->status(p);
+        e.HaveStatus = true;
+      }
+      if(e.Status) {
+        e.ContentStatus = *e.Status;
+      } else {
+        e.Content.reset();
+        e.ContentError = e.Status.getError();
+      }
+    }
+    if(!e.Content) {
+      return e.ContentError;
+    }
+    return std::unique_ptr<clang::vfs::File>(
+      new SharedFile(e.ContentStatus, *e.Content));
+  }
+
+  clang::vfs::directory_iterator
+  dir_begin(llvm::Twine const& dir, std::error_code& ec) override {
+    return this->Base->dir_begin(dir, ec);
+  }
+};
+
+//----------------------------------------------------------------------------
+llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem>
+createSharedFileSystem(
+  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> const& base,
+  std::vector<std::string> const* preload)
+{
+  SharedFileSystem* fs = new SharedFileSystem(base);
+  if(preload) {
+    fs->PreloadFiles(*preload);
+  }
+  return fs;
+}
@@ -0,0 +1,46 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_SHAREDFS_H
+#define CASTXML_SHAREDFS_H
+
+#include <cxsys/Configure.hxx>
+
+#include "llvm/ADT/IntrusiveRefCntPtr.h"
+
+#include <string>
+#include <vector>
+
+namespace clang {
+  namespace vfs {
+    class FileSystem;
+  }
+}
+
+/// createSharedFileSystem - Keep the status of each path looked up and
+/// the content of each file read through the given file system, so
+/// that compiler instances sharing the result on several threads stat
+/// and read each file once.  Files are assumed not to change while it
+/// is in use.  Directory listings are passed through.  The content of
+/// the files named by preload, if given, is read up front in batches
+/// of concurrent requests through io_uring on Linux hosts that support
+/// it, and looked up by the same paths.  Elsewhere the files are read
+/// on first use as usual.
+llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem>
+createSharedFileSystem(
+  llvm::IntrusiveRefCntPtr<clang::vfs::FileSystem> const& base,
+  std::vector<std::string> const* preload = nullptr);
+
+#endif // CASTXML_SHAREDFS_H
@@ -0,0 +1,53 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "StringPool.h"
+
+#include "llvm/ADT/Hashing.h"
+
+//----------------------------------------------------------------------------
+llvm::StringRef StringPool::Intern(llvm::StringRef s)
+{
+  // Pick the shard by a hash other than the one the shard's map uses,
+  // so that the strings of a shard still spread over its buckets.
+  size_t const h = llvm::hash_value(s);
+  Shard& shard = this->Shards[h % ShardCount];
+  std::lock_guard<std::mutex> lock(shard.Mutex);
+  return shard.Strings.insert(std::make_pair(s, '\0')).first->getKey();
+}
+
+//----------------------------------------------------------------------------
+size_t StringPool::GetSize()
+{
+  size_t n = 0;
+  for(Shard& shard : this->Shards) {
+    std::lock_guard<std::mutex> lock(shard.Mutex);
+    n += shard.Strings.size();
+  }
+  return n;
+}
+
+//----------------------------------------------------------------------------
+size_t StringPool::GetMemorySize()
+{
+  size_t n = 0;
+  for(Shard& shard : this->Shards) {
+    std::lock_guard<std::mutex> lock(shard.Mutex);
+    n += shard.Strings.getAllocator().getTotalMemory() +
+      shard.Strings.getNumBuckets() * sizeof(void*) * 2;
+  }
+  return n;
+}
@@ -0,0 +1,56 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_STRINGPOOL_H
+#define CASTXML_STRINGPOOL_H
+
+#include <cxsys/Configure.hxx>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+
+#include <mutex>
+
+/// StringPool - One copy of each distinct string interned by the jobs
+/// of a run on any thread, such as the names, mangled names, and file
+/// paths their output tables and String elements hold.  The strings
+/// are divided among shards by hash, each with its own lock, so jobs
+/// interning different strings seldom wait for each other.  A string
+/// stays at the same address for the life of the pool, so a job can
+/// index the strings it uses by address without hashing them again.
+class StringPool
+{
+  struct Shard
+  {
+    std::mutex Mutex;
+    llvm::StringMap<char, llvm::BumpPtrAllocator> Strings;
+  };
+  static unsigned int const ShardCount = 64;
+  Shard Shards[ShardCount];
+  StringPool(StringPool const&);
+  void operator=(StringPool const&);
+public:
+  StringPool() {}
+
+  /** Get the pool's copy of the given string, adding it if needed.  */
+  llvm::StringRef Intern(llvm::StringRef s);
+
+  /** Get the number of strings and the memory used by the pool.  */
+  size_t GetSize();
+  size_t GetMemorySize();
+};
+
+#endif // CASTXML_STRINGPOOL_H
@@ -0,0 +1,845 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+#include "TimeReport.h"
+#include "Utils.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+# include <errno.h>
+# include <linux/perf_event.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+#if defined(CASTXML_ALLOC_PROFILE)
+# include <new>
+#endif
+
+//----------------------------------------------------------------------------
+// The allocations made by each thread through operator new, counted by
+// the replacement operators below when built with allocation profiling.
+static thread_local uint64_t threadAllocations;
+static thread_local uint64_t threadAllocatedBytes;
+
+#if defined(CASTXML_ALLOC_PROFILE)
+//----------------------------------------------------------------------------
+static void* countedAlloc(size_t n)
+{
+  ++threadAllocations;
+  threadAllocatedBytes += n;
+  return malloc(n? n : 1);
+}
+
+//----------------------------------------------------------------------------
+void* operator new(size_t n)
+{
+  if(void* p = countedAlloc(n)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+//----------------------------------------------------------------------------
+void* operator new[](size_t n)
+{
+  if(void* p = countedAlloc(n)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+//----------------------------------------------------------------------------
+void* operator new(size_t n, std::nothrow_t const&) noexcept
+{
+  return countedAlloc(n);
+}
+
+//----------------------------------------------------------------------------
+void* operator new[](size_t n, std::nothrow_t const&) noexcept
+{
+  return countedAlloc(n);
+}
+
+//----------------------------------------------------------------------------
+void operator delete(void* p) noexcept
+{
+  free(p);
+}
+
+//----------------------------------------------------------------------------
+void operator delete[](void* p) noexcept
+{
+  free(p);
+}
+
+//----------------------------------------------------------------------------
+void operator delete(void* p, std::nothrow_t const&) noexcept
+{
+  free(p);
+}
+
+//----------------------------------------------------------------------------
+void operator delete[](void* p, std::nothrow_t const&) noexcept
+{
+  free(p);
+}
+#endif
+
+//----------------------------------------------------------------------------
+/// Hardware event counters of the calling thread, read together.
+class HardwareCounters
+{
+public:
+  enum { Count = 4 };
+  static const char* const Names[Count];
+
+private:
+  int Leader;
+  int Fds[Count];
+  std::string Error;
+
+public:
+  HardwareCounters();
+  ~HardwareCounters();
+
+  /** Read the running counts, with those of events the hardware does
+      not count left zero.  Return false if counting is unavailable.  */
+  bool Read(uint64_t values[Count]) const;
+
+  /** Explain why counting is unavailable, or return empty.  */
+  std::string const& GetError() const { return this->Error; }
+};
+
+const char* const HardwareCounters::Names[Count] = {
+  "cycles", "instructions", "LLC misses", "branch misses"
+};
+
+#if defined(__linux__)
+//----------------------------------------------------------------------------
+HardwareCounters::HardwareCounters(): Leader(-1)
+{
+  std::fill(this->Fds, this->Fds + Count, -1);
+  static uint64_t const configs[Count] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+  };
+
+  // Count in one group for this thread only, in user space, so that
+  // one read gives consistent counts of all events.
+  for(int i = 0; i < Count; ++i) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = configs[i];
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    this->Fds[i] = static_cast<int>(
+      syscall(__NR_perf_event_open, &attr, 0, -1, this->Leader, 0));
+    if(this->Fds[i] < 0 && i == 0) {
+      this->Error = strerror(errno);
+      return;
+    }
+    if(i == 0) {
+      this->Leader = this->Fds[0];
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+HardwareCounters::~HardwareCounters()
+{
+  for(int i = 0; i < Count; ++i) {
+    if(this->Fds[i] >= 0) {
+      close(this->Fds[i]);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+bool HardwareCounters::Read(uint64_t values[Count]) const
+{
+  if(this->Leader < 0) {
+    return false;
+  }
+
+  // The group lists the count of each event opened, in order.
+  uint64_t data[1 + Count];
+  ssize_t const n = read(this->Leader, data, sizeof(data));
+  if(n < static_cast<ssize_t>(sizeof(uint64_t))) {
+    return false;
+  }
+  uint64_t next = 0;
+  for(int i = 0; i < Count; ++i) {
+    values[i] = 0;
+    if(this->Fds[i] >= 0 && next < data[0]) {
+      values[i] = data[1 + next++];
+    }
+  }
+  return true;
+}
+#else
+//----------------------------------------------------------------------------
+HardwareCounters::HardwareCounters():
+  Leader(-1), Error("not supported on this platform")
+{
+  std::fill(this->Fds, this->Fds + Count, -1);
+}
+
+//----------------------------------------------------------------------------
+HardwareCounters::~HardwareCounters()
+{
+}
+
+//----------------------------------------------------------------------------
+bool HardwareCounters::Read(uint64_t[Count]) const
+{
+  return false;
+}
+#endif
+
+//----------------------------------------------------------------------------
+class TimeReport
+{
+  llvm::TimerGroup Group;
+  llvm::StringMap<std::unique_ptr<llvm::Timer>> Timers;
+  std::thread::id MainThread;
+  double Startup;
+
+  // The hardware event counts of each phase, if enabled, and its
+  // allocations, if profiled, in the order the phases first ran.
+  struct PhaseCounts
+  {
+    PhaseCounts(const char* name): Name(name), Allocations(0), Bytes(0) {
+      std::fill(this->Values, this->Values + HardwareCounters::Count, 0);
+    }
+    const char* Name;
+    uint64_t Values[HardwareCounters::Count];
+    uint64_t Allocations;
+    uint64_t Bytes;
+  };
+  std::unique_ptr<HardwareCounters> Counters;
+  std::vector<PhaseCounts> Counts;
+  llvm::StringMap<size_t> CountIndex;
+
+  // The use of each lock taken through ReportedLock, by its name, from
+  // any thread.
+  struct LockUse
+  {
+    LockUse(): Taken(0), Contended(0), Seconds(0) {}
+    uint64_t Taken;
+    uint64_t Contended;
+    double Seconds;
+  };
+  std::mutex LockUsesMutex;
+  std::map<std::string, LockUse> LockUses;
+
+  PhaseCounts& GetCounts(const char* name);
+  void PrintCounts() const;
+  void PrintAllocations() const;
+  void PrintLockUses() const;
+public:
+  TimeReport(bool counters):
+    Group("castxml time report"), MainThread(std::this_thread::get_id()),
+    Startup(0) {
+    // Time used by the process before the report was enabled, such as
+    // loading and initializing the executable.
+    llvm::sys::TimeValue elapsed, user, sys;
+    llvm::sys::Process::GetTimeUsage(elapsed, user, sys);
+    this->Startup = (user + sys).seconds() +
+      (user + sys).nanoseconds() / 1e9;
+    if(counters) {
+      this->Counters.reset(new HardwareCounters);
+    }
+  }
+
+  ~TimeReport() {
+    llvm::errs() << "castxml process startup: " <<
+      llvm::format("%.4f", this->Startup) << " seconds (user+system)\n";
+    // Destroying the timers prints those that ran to stderr.
+    this->Timers.clear();
+    if(this->Counters) {
+      this->PrintCounts();
+    }
+#if defined(CASTXML_ALLOC_PROFILE)
+    this->PrintAllocations();
+#endif
+    if(!this->LockUses.empty()) {
+      this->PrintLockUses();
+    }
+  }
+
+  bool OnMainThread() const {
+    return std::this_thread::get_id() == this->MainThread;
+  }
+
+  llvm::Timer* GetTimer(const char* name) {
+    if(!this->OnMainThread()) {
+      return 0;
+    }
+    std::unique_ptr<llvm::Timer>& t = this->Timers[name];
+    if(!t) {
+      t.reset(new llvm::Timer(name, this->Group));
+    }
+    return t.get();
+  }
+
+  bool ReadCounters(uint64_t values[HardwareCounters::Count]) const {
+    return this->Counters && this->OnMainThread() &&
+      this->Counters->Read(values);
+  }
+
+  void AddCounts(const char* name,
+                 uint64_t const start[HardwareCounters::Count]) {
+    uint64_t now[HardwareCounters::Count];
+    if(!this->ReadCounters(now)) {
+      return;
+    }
+    PhaseCounts& pc = this->GetCounts(name);
+    for(int c = 0; c < HardwareCounters::Count; ++c) {
+      pc.Values[c] += now[c] - start[c];
+    }
+  }
+
+  void AddLockUse(const char* name, bool contended, double seconds) {
+    std::lock_guard<std::mutex> lock(this->LockUsesMutex);
+    LockUse& u = this->LockUses[name];
+    ++u.Taken;
+    if(contended) {
+      ++u.Contended;
+      u.Seconds += seconds;
+    }
+  }
+
+  void AddAllocations(const char* name, uint64_t allocations,
+                      uint64_t bytes) {
+    if(this->OnMainThread()) {
+      PhaseCounts& pc = this->GetCounts(name);
+      pc.Allocations += allocations;
+      pc.Bytes += bytes;
+    }
+  }
+};
+
+//----------------------------------------------------------------------------
+TimeReport::PhaseCounts& TimeReport::GetCounts(const char* name)
+{
+  llvm::StringMap<size_t>::iterator i = this->CountIndex.find(name);
+  if(i != this->CountIndex.end()) {
+    return this->Counts[i->second];
+  }
+  this->CountIndex[name] = this->Counts.size();
+  this->Counts.push_back(PhaseCounts(name));
+  return this->Counts.back();
+}
+
+//----------------------------------------------------------------------------
+void TimeReport::PrintCounts() const
+{
+  llvm::raw_ostream& os = llvm::errs();
+  if(!this->Counters->GetError().empty()) {
+    os << "castxml phase counters unavailable: " <<
+      this->Counters->GetError() << "\n";
+    return;
+  }
+
+  // Few instructions per cycle and many cache misses per thousand
+  // instructions mark a phase bound by memory rather than computation.
+  os << "castxml phase counters:\n";
+  for(int c = 0; c < HardwareCounters::Count; ++c) {
+    os << llvm::format("%15s", HardwareCounters::Names[c]);
+  }
+  os << "    IPC  LLC MPKI  phase\n";
+  for(PhaseCounts const& pc : this->Counts) {
+    for(int c = 0; c < HardwareCounters::Count; ++c) {
+      os << llvm::format("%15llu", (unsigned long long)pc.Values[c]);
+    }
+    double const cycles = double(pc.Values[0]);
+    double const instructions = double(pc.Values[1]);
+    os << llvm::format("%7.2f", cycles? instructions / cycles : 0.0) <<
+      llvm::format("%10.2f", instructions?
+                   1000 * double(pc.Values[2]) / instructions : 0.0) <<
+      "  " << pc.Name << "\n";
+  }
+}
+
+//----------------------------------------------------------------------------
+void TimeReport::PrintAllocations() const
+{
+  // Many small allocations mark a phase whose cost is in the allocator,
+  // as for node-based containers and temporary strings.
+  llvm::raw_ostream& os = llvm::errs();
+  os << "castxml phase allocations:\n"
+    "    allocations          bytes  bytes/alloc  phase\n";
+  for(PhaseCounts const& pc : this->Counts) {
+    os << llvm::format("%15llu", (unsigned long long)pc.Allocations) <<
+      llvm::format("%15llu", (unsigned long long)pc.Bytes) <<
+      llvm::format("%13.1f", pc.Allocations?
+                   double(pc.Bytes) / double(pc.Allocations) : 0.0) <<
+      "  " << pc.Name << "\n";
+  }
+}
+
+//----------------------------------------------------------------------------
+void TimeReport::PrintLockUses() const
+{
+  // Waiting threads do no work, so long waits limit the speedup of
+  // parallel jobs.
+  llvm::raw_ostream& os = llvm::errs();
+  os << "castxml lock waits:\n"
+    "          taken      contended   wait seconds  lock\n";
+  for(std::map<std::string, LockUse>::const_iterator
+        i = this->LockUses.begin(), e = this->LockUses.end(); i != e; ++i) {
+    os << llvm::format("%15llu", (unsigned long long)i->second.Taken) <<
+      llvm::format("%15llu", (unsigned long long)i->second.Contended) <<
+      llvm::format("%15.4f", i->second.Seconds) <<
+      "  " << i->first << "\n";
+  }
+}
+
+//----------------------------------------------------------------------------
+static TimeReport* timeReport;
+
+//----------------------------------------------------------------------------
+static void printTimeReport()
+{
+  delete timeReport;
+  timeReport = 0;
+}
+
+//----------------------------------------------------------------------------
+void enableTimeReport(bool counters)
+{
+  if(!timeReport) {
+    timeReport = new TimeReport(counters);
+    atexit(printTimeReport);
+  }
+}
+
+//----------------------------------------------------------------------------
+// Phase timing for the metrics file, defined with it below.
+static long long metricsPhaseStart();
+static void metricsPhaseEnd(const char* name, long long start);
+
+//----------------------------------------------------------------------------
+PhaseRegion::PhaseRegion(const char* name):
+  Name(name), Timer(timeReport? timeReport->GetTimer(name) : 0),
+  Counting(timeReport && timeReport->ReadCounters(this->Start)),
+  StartAllocations(threadAllocations), StartBytes(threadAllocatedBytes),
+  MetricsStart(metricsPhaseStart())
+{
+  if(this->Timer) {
+    this->Timer->startTimer();
+  }
+}
+
+//----------------------------------------------------------------------------
+PhaseRegion::~PhaseRegion()
+{
+#if defined(CASTXML_ALLOC_PROFILE)
+  // Take the counts before the report itself allocates.
+  if(timeReport) {
+    timeReport->AddAllocations(this->Name,
+                               threadAllocations - this->StartAllocations,
+                               threadAllocatedBytes - this->StartBytes);
+  }
+#endif
+  if(this->Timer) {
+    this->Timer->stopTimer();
+  }
+  if(this->Counting && timeReport) {
+    timeReport->AddCounts(this->Name, this->Start);
+  }
+  metricsPhaseEnd(this->Name, this->MetricsStart);
+}
+
+//----------------------------------------------------------------------------
+ReportedLock::ReportedLock(std::mutex& mutex, const char* name):
+  Lock(mutex, std::defer_lock)
+{
+  if(!timeReport) {
+    this->Lock.lock();
+    return;
+  }
+  if(this->Lock.try_lock()) {
+    timeReport->AddLockUse(name, false, 0);
+    return;
+  }
+  std::chrono::steady_clock::time_point const start =
+    std::chrono::steady_clock::now();
+  this->Lock.lock();
+  std::chrono::duration<double> const waited =
+    std::chrono::steady_clock::now() - start;
+  timeReport->AddLockUse(name, true, waited.count());
+}
+
+//----------------------------------------------------------------------------
+struct TraceEvent
+{
+  const char* Name;
+  std::string Detail;
+  long long Start;
+  long long Duration;
+  size_t Thread;
+};
+
+//----------------------------------------------------------------------------
+class Trace
+{
+  std::string FileName;
+  std::mutex Lock;
+  std::vector<TraceEvent> Events;
+  std::chrono::steady_clock::time_point Origin;
+public:
+  Trace(std::string const& fname):
+    FileName(fname), Origin(std::chrono::steady_clock::now()) {}
+
+  long long Now() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - this->Origin).count();
+  }
+
+  void Add(const char* name, std::string const& detail, long long start) {
+    TraceEvent e;
+    e.Name = name;
+    e.Detail = detail;
+    e.Start = start;
+    e.Duration = this->Now() - start;
+    e.Thread = std::hash<std::thread::id>()(std::this_thread::get_id());
+    std::lock_guard<std::mutex> guard(this->Lock);
+    this->Events.push_back(e);
+  }
+
+  void Write();
+};
+
+//----------------------------------------------------------------------------
+static void writeJSONString(llvm::raw_ostream& os, llvm::StringRef s)
+{
+  os << '"';
+  const char* last = s.begin();
+  for(const char* c = s.begin(), *e = s.end(); c != e; ++c) {
+    unsigned char const ch = static_cast<unsigned char>(*c);
+    if(ch != '"' && ch != '\\' && ch >= 0x20) {
+      continue;
+    }
+    os.write(last, c - last);
+    last = c + 1;
+    switch(ch) {
+    case '"': os << "\\\""; break;
+    case '\\': os << "\\\\"; break;
+    case '\n': os << "\\n"; break;
+    case '\t': os << "\\t"; break;
+    default: os << llvm::format("\\u%04x", ch); break;
+    }
+  }
+  os.write(last, s.end() - last);
+  os << '"';
+}
+
+//----------------------------------------------------------------------------
+void Trace::Write()
+{
+  std::error_code ec;
+  llvm::raw_fd_ostream os(this->FileName, ec, llvm::sys::fs::F_Text);
+  if(ec) {
+    std::cerr << "error: unable to write trace file '" << this->FileName <<
+      "': " << ec.message() << "\n";
+    return;
+  }
+
+  // Number threads in order of their first event so the main thread
+  // is normally listed first.
+  std::vector<size_t> threads;
+  os << "{\"traceEvents\":[";
+  const char* sep = "\n";
+  for(TraceEvent const& e : this->Events) {
+    size_t tid = 0;
+    while(tid < threads.size() && threads[tid] != e.Thread) {
+      ++tid;
+    }
+    if(tid == threads.size()) {
+      threads.push_back(e.Thread);
+    }
+    os << sep << "{\"pid\":1,\"tid\":" << tid << ",\"ph\":\"X\","
+      "\"ts\":" << e.Start << ",\"dur\":" << e.Duration << ","
+      "\"name\":";
+    writeJSONString(os, e.Name);
+    if(!e.Detail.empty()) {
+      os << ",\"args\":{\"detail\":";
+      writeJSONString(os, e.Detail);
+      os << "}";
+    }
+    os << "}";
+    sep = ",\n";
+  }
+  os << "\n]}\n";
+}
+
+//----------------------------------------------------------------------------
+static Trace* trace;
+
+//----------------------------------------------------------------------------
+static void writeTrace()
+{
+  trace->Write();
+  delete trace;
+  trace = 0;
+}
+
+//----------------------------------------------------------------------------
+void enableTrace(std::string const& fname)
+{
+  if(!trace) {
+    trace = new Trace(fname);
+    atexit(writeTrace);
+  }
+}
+
+//----------------------------------------------------------------------------
+bool traceEnabled()
+{
+  return trace != 0;
+}
+
+//----------------------------------------------------------------------------
+TraceRegion::TraceRegion(const char* name, std::string const& detail):
+  Name(name), Detail(detail), Start(trace? trace->Now() : 0)
+{
+}
+
+//----------------------------------------------------------------------------
+TraceRegion::~TraceRegion()
+{
+  if(trace) {
+    trace->Add(this->Name, this->Detail, this->Start);
+  }
+}
+
+//----------------------------------------------------------------------------
+static const char* const metricNames[MetricCount] = {
+  "runs",
+  "run_failures",
+  "detect_cache_hits",
+  "detect_cache_misses",
+  "driver_cache_hits",
+  "driver_cache_misses",
+  "result_cache_hits",
+  "result_cache_misses",
+  "prelude_pch_hits",
+  "prelude_pch_misses",
+  "preamble_pch_hits",
+  "preamble_pch_misses",
+  "header_cache_hits",
+  "header_cache_misses",
+  "preprocessed_cache_hits",
+  "preprocessed_cache_misses",
+  "token_cache_hits",
+  "token_cache_misses",
+  "remote_result_cache_hits",
+  "remote_result_cache_misses"
+};
+
+//----------------------------------------------------------------------------
+class Metrics
+{
+  std::string FileName;
+  std::chrono::steady_clock::time_point Origin;
+  std::thread::id MainThread;
+  std::atomic<uint64_t> Counts[MetricCount];
+
+  // The runs and total time of each phase on the main thread, in the
+  // order the phases first ran.
+  struct PhaseTime
+  {
+    PhaseTime(const char* name): Name(name), Runs(0), Micros(0) {}
+    const char* Name;
+    uint64_t Runs;
+    long long Micros;
+  };
+  std::vector<PhaseTime> Phases;
+  llvm::StringMap<size_t> PhaseIndex;
+public:
+  // The settings given by setMetricsSettings.
+  unsigned int Jobs;
+  uint64_t MemoryBudget;
+  bool PreludePCHDisabled;
+
+  Metrics(std::string const& fname):
+    FileName(fname), Origin(std::chrono::steady_clock::now()),
+    MainThread(std::this_thread::get_id()), Jobs(1), MemoryBudget(0),
+    PreludePCHDisabled(false) {
+    for(int m = 0; m < MetricCount; ++m) {
+      this->Counts[m] = 0;
+    }
+  }
+
+  long long Now() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - this->Origin).count();
+  }
+
+  bool OnMainThread() const {
+    return std::this_thread::get_id() == this->MainThread;
+  }
+
+  void Count(Metric m, uint64_t n) {
+    this->Counts[m] += n;
+  }
+
+  void AddPhase(const char* name, long long start) {
+    size_t index = this->Phases.size();
+    llvm::StringMap<size_t>::iterator i = this->PhaseIndex.find(name);
+    if(i != this->PhaseIndex.end()) {
+      index = i->second;
+    } else {
+      this->PhaseIndex[name] = index;
+      this->Phases.push_back(PhaseTime(name));
+    }
+    PhaseTime& p = this->Phases[index];
+    ++p.Runs;
+    p.Micros += this->Now() - start;
+  }
+
+  void Write();
+};
+
+//----------------------------------------------------------------------------
+void Metrics::Write()
+{
+  std::error_code ec;
+  llvm::raw_fd_ostream os(this->FileName, ec, llvm::sys::fs::F_Text);
+  if(ec) {
+    std::cerr << "error: unable to write metrics file '" <<
+      this->FileName << "': " << ec.message() << "\n";
+    return;
+  }
+
+  // Keep the names and layout fixed so that metrics from many runs
+  // can be collected without parsing each one differently.  Add new
+  // fields only at the end of an object, and change the version if
+  // the meaning of one changes.
+  llvm::sys::TimeValue elapsed, user, sys;
+  llvm::sys::Process::GetTimeUsage(elapsed, user, sys);
+  os << "{\n\"schema\":\"castxml-metrics\",\n\"version\":1,\n"
+    "\"castxml\":";
+  writeJSONString(os, getVersionString());
+  os << ",\n\"wall_seconds\":" <<
+    llvm::format("%.6f", double(this->Now()) / 1e6) <<
+    ",\n\"user_seconds\":" <<
+    llvm::format("%.6f", user.seconds() + user.nanoseconds() / 1e9) <<
+    ",\n\"system_seconds\":" <<
+    llvm::format("%.6f", sys.seconds() + sys.nanoseconds() / 1e9) <<
+    ",\n\"peak_resident_bytes\":" << uint64_t(getPeakResidentSize()) <<
+    ",\n\"counters\":{";
+  const char* sep = "\n";
+  for(int m = 0; m < MetricCount; ++m) {
+    os << sep << "\"" << metricNames[m] << "\":" <<
+      uint64_t(this->Counts[m]);
+    sep = ",\n";
+  }
+  os << "\n},\n\"phases\":[";
+  sep = "\n";
+  for(PhaseTime const& p : this->Phases) {
+    os << sep << "{\"name\":";
+    writeJSONString(os, p.Name);
+    os << ",\"runs\":" << p.Runs << ",\"seconds\":" <<
+      llvm::format("%.6f", double(p.Micros) / 1e6) << "}";
+    sep = ",\n";
+  }
+  os << "\n],\n\"settings\":{\n\"jobs\":" << this->Jobs <<
+    ",\n\"mem_budget_bytes\":" << this->MemoryBudget <<
+    ",\n\"prelude_pch_disabled\":" <<
+    (this->PreludePCHDisabled? "true" : "false") << "\n}\n}\n";
+}
+
+//----------------------------------------------------------------------------
+static Metrics* metrics;
+
+//----------------------------------------------------------------------------
+static void writeMetrics()
+{
+  metrics->Write();
+  delete metrics;
+  metrics = 0;
+}
+
+//----------------------------------------------------------------------------
+void enableMetrics(std::string const& fname)
+{
+  if(!metrics) {
+    metrics = new Metrics(fname);
+    atexit(writeMetrics);
+  }
+}
+
+//----------------------------------------------------------------------------
+void countMetric(Metric m, uint64_t n)
+{
+  if(metrics) {
+    metrics->Count(m, n);
+  }
+}
+
+//----------------------------------------------------------------------------
+void setMetricsSettings(unsigned int jobs, uint64_t memoryBudget,
+                        bool preludePCHDisabled)
+{
+  if(metrics) {
+    metrics->Jobs = jobs;
+    metrics->MemoryBudget = memoryBudget;
+    metrics->PreludePCHDisabled = preludePCHDisabled;
+  }
+}
+
+//----------------------------------------------------------------------------
+static long long metricsPhaseStart()
+{
+  return metrics? metrics->Now() : 0;
+}
+
+//----------------------------------------------------------------------------
+static void metricsPhaseEnd(const char* name, long long start)
+{
+  // Phases run on worker threads overlap those of the main thread, so
+  // only the main thread's are added up, as for the time report.
+  if(metrics && metrics->OnMainThread()) {
+    metrics->AddPhase(name, start);
+  }
+}
@@ -0,0 +1,136 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+#ifndef CASTXML_TIMEREPORT_H
+#define CASTXML_TIMEREPORT_H
+
+#include <cxsys/Configure.hxx>
+
+#include <mutex>
+#include <string>
+#include <stdint.h>
+
+namespace llvm {
+  class Timer;
+}
+
+/// enableTimeReport - Time the phases named by PhaseRegion and print a
+/// report of them to stderr when the process exits.  If counters is
+/// true, also count hardware events such as instructions and cache
+/// misses in each phase where the platform supports it.
+void enableTimeReport(bool counters = false);
+
+/// PhaseRegion - Time a named phase of processing, and count its
+/// hardware events if enabled, over the lifetime of the object if the
+/// time report is enabled.  Phases run on worker threads are not timed.
+/// When built with CastXML_ALLOC_PROFILE, also count the allocations
+/// made by the phase through operator new.
+class PhaseRegion
+{
+  const char* Name;
+  llvm::Timer* Timer;
+
+  // The hardware event counts when the phase began.
+  uint64_t Start[4];
+  bool Counting;
+
+  // The allocations of the thread when the phase began.
+  uint64_t StartAllocations;
+  uint64_t StartBytes;
+
+  // The time the phase began, in microseconds, if metrics are enabled.
+  long long MetricsStart;
+public:
+  PhaseRegion(const char* name);
+  ~PhaseRegion();
+};
+
+/// ReportedLock - Lock a mutex shared by parallel jobs for the lifetime
+/// of the object, as std::lock_guard does.  If the time report is
+/// enabled, record under the given name how often the lock was taken
+/// from any thread, how often it was held by another thread, and how
+/// long the threads waited for it.
+class ReportedLock
+{
+  std::unique_lock<std::mutex> Lock;
+public:
+  ReportedLock(std::mutex& mutex, const char* name);
+};
+
+/// enableTrace - Record TraceRegion events and write them to the named
+/// file in Chrome trace event format when the process exits.
+void enableTrace(std::string const& fname);
+
+/// traceEnabled - Return whether TraceRegion events are recorded.  Use
+/// this to avoid computing event details that would not be used.
+bool traceEnabled();
+
+/// TraceRegion - Record a complete trace event spanning the lifetime of
+/// the object.  Events may be recorded from any thread.
+class TraceRegion
+{
+  const char* Name;
+  std::string Detail;
+  long long Start;
+public:
+  TraceRegion(const char* name, std::string const& detail = std::string());
+  ~TraceRegion();
+};
+
+/// Metric - The events counted for '--castxml-metrics'.  Each is
+/// written to the metrics file under a fixed name, even if zero, so
+/// the schema does not depend on what a run did.
+enum Metric
+{
+  MetricRuns,
+  MetricRunFailures,
+  MetricDetectCacheHits,
+  MetricDetectCacheMisses,
+  MetricDriverCacheHits,
+  MetricDriverCacheMisses,
+  MetricResultCacheHits,
+  MetricResultCacheMisses,
+  MetricPreludePCHHits,
+  MetricPreludePCHMisses,
+  MetricPreamblePCHHits,
+  MetricPreamblePCHMisses,
+  MetricHeaderCacheHits,
+  MetricHeaderCacheMisses,
+  MetricPreprocessedCacheHits,
+  MetricPreprocessedCacheMisses,
+  MetricTokenCacheHits,
+  MetricTokenCacheMisses,
+  MetricRemoteResultCacheHits,
+  MetricRemoteResultCacheMisses,
+  MetricCount
+};
+
+/// enableMetrics - Count Metric events and time the phases named by
+/// PhaseRegion, and write them with the time and memory used by the
+/// process to the named file as JSON when the process exits.
+void enableMetrics(std::string const& fname);
+
+/// countMetric - Add n to the count of the given event, if metrics are
+/// enabled.  Events may be counted from any thread.
+void countMetric(Metric m, uint64_t n = 1);
+
+/// setMetricsSettings - Give the settings of the run to write to the
+/// metrics file for '--castxml-auto-tune' to read back: the number of
+/// jobs, the memory budget in bytes, and whether the prelude PCH was
+/// turned off by the tuning.
+void setMetricsSettings(unsigned int jobs, uint64_t memoryBudget,
+                        bool preludePCHDisabled);
+
+#endif // CASTXML_TIMEREPORT_H
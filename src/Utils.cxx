@@ -15,16 +15,41 @@
 */
 
 #include "Utils.h"
+#include "Context.h"
+#include "Options.h"
+#include "TimeReport.h"
 #include "Version.h"
 
+#include <cxsys/MD5.h>
 #include <cxsys/Process.h>
 #include <cxsys/SystemTools.hxx>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/raw_ostream.h>
+#include <algorithm>
 #include <fstream>
 #include <vector>
+#include <string.h>
 
-static std::string castxmlResourceDir;
-static std::string castxmlClangResourceDir;
+#if !defined(_WIN32)
+# include <errno.h>
+# include <fcntl.h>
+# include <poll.h>
+# include <spawn.h>
+# include <sys/resource.h>
+# include <sys/stat.h>
+# include <sys/wait.h>
+# include <unistd.h>
+extern char** environ;
+#endif
+#if defined(__APPLE__)
+# include <mach/mach.h>
+# include <sys/sysctl.h>
+#endif
+#if defined(_WIN32)
+# include <windows.h>
+#endif
 
 //----------------------------------------------------------------------------
 static std::string GetMainExecutable(const char* argv0)
@@ -34,7 +59,7 @@ static std::string GetMainExecutable(const char* argv0)
 }
 
 //----------------------------------------------------------------------------
-static bool tryBuildDir(std::string const& dir)
+static bool tryBuildDir(std::string const& dir, Context& ctx)
 {
   // Build tree has
   //   <build>/CMakeFiles/castxmlSourceDir.txt
@@ -49,15 +74,16 @@ static bool tryBuildDir(std::string const& dir)
      cxsys::SystemTools::FileIsDirectory(src_dir.c_str()) &&
      cl_fin && cxsys::SystemTools::GetLineFromStream(cl_fin, cl_dir) &&
      cxsys::SystemTools::FileIsDirectory(cl_dir.c_str())) {
-    castxmlResourceDir = src_dir + "/share/castxml";
-    castxmlClangResourceDir = cl_dir;
+    ctx.ResourceDir = src_dir + "/share/castxml";
+    ctx.ClangResourceDir = cl_dir;
     return true;
   }
   return false;
 }
 
 //----------------------------------------------------------------------------
-bool findResourceDir(const char* argv0, std::ostream& error)
+bool findResourceDir(const char* argv0, Context& ctx,
+                     std::ostream& error)
 {
   std::string exe = GetMainExecutable(argv0);
   if(!cxsys::SystemTools::FileIsFullPath(exe.c_str())) {
@@ -71,14 +97,19 @@ bool findResourceDir(const char* argv0, std::ostream& error)
   //   <prefix>/<CASTXML_INSTALL_DATA_DIR>
   //   <prefix>/<CASTXML_INSTALL_DATA_DIR>/clang
   std::string dir = cxsys::SystemTools::GetFilenamePath(exe_dir);
-  castxmlResourceDir = dir + "/" + CASTXML_INSTALL_DATA_DIR;
-  castxmlClangResourceDir = castxmlResourceDir + "/clang";
-  if(!cxsys::SystemTools::FileIsDirectory(castxmlResourceDir.c_str()) ||
-     !cxsys::SystemTools::FileIsDirectory(castxmlClangResourceDir.c_str())) {
+  ctx.ResourceDir = dir + "/" + CASTXML_INSTALL_DATA_DIR;
+  ctx.ClangResourceDir = ctx.ResourceDir + "/clang";
+#ifdef CASTXML_EMBED_RESOURCES
+  // Resources compiled into this build are served from memory at the
+  // install tree locations so nothing need be found on disk.
+  return true;
+#endif
+  if(!cxsys::SystemTools::FileIsDirectory(ctx.ResourceDir.c_str()) ||
+     !cxsys::SystemTools::FileIsDirectory(ctx.ClangResourceDir.c_str())) {
     // Build tree has
     //   <build>/bin[/<config>]/castxml
-    if(!tryBuildDir(dir) &&
-       !tryBuildDir(cxsys::SystemTools::GetFilenamePath(dir))) {
+    if(!tryBuildDir(dir, ctx) &&
+       !tryBuildDir(cxsys::SystemTools::GetFilenamePath(dir), ctx)) {
       error << "Unable to locate resources for " << exe << "\n";
       return false;
     }
@@ -88,28 +119,138 @@ bool findResourceDir(const char* argv0, std::ostream& error)
 }
 
 //----------------------------------------------------------------------------
-std::string getResourceDir()
+std::string getVersionString()
 {
-  return castxmlResourceDir;
+  return CASTXML_VERSION;
 }
 
+#if !defined(_WIN32)
 //----------------------------------------------------------------------------
-std::string getClangResourceDir()
+static bool spawnPipe(int fds[2])
 {
-  return castxmlClangResourceDir;
+  if(pipe(fds) != 0) {
+    return false;
+  }
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  return true;
 }
 
 //----------------------------------------------------------------------------
-std::string getVersionString()
+static bool runCommandSpawn(int argc, const char* const* argv,
+                            int& ret, std::string& out, std::string& err,
+                            std::string& msg)
 {
-  return CASTXML_VERSION;
+  // Spawn the child without copying our address space, as fork would,
+  // and connect its stdin to the null device and its output to pipes.
+  std::vector<char*> cmd;
+  for(int i = 0; i < argc; ++i) {
+    cmd.push_back(const_cast<char*>(argv[i]));
+  }
+  cmd.push_back(0);
+
+  int outPipe[2];
+  int errPipe[2];
+  if(!spawnPipe(outPipe)) {
+    msg = strerror(errno);
+    return false;
+  }
+  if(!spawnPipe(errPipe)) {
+    msg = strerror(errno);
+    close(outPipe[0]);
+    close(outPipe[1]);
+    return false;
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2(&actions, outPipe[1], 1);
+  posix_spawn_file_actions_adddup2(&actions, errPipe[1], 2);
+  pid_t pid;
+  int e = posix_spawnp(&pid, cmd[0], &actions, 0, &cmd[0], environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(outPipe[1]);
+  close(errPipe[1]);
+  if(e != 0) {
+    msg = strerror(e);
+    close(outPipe[0]);
+    close(errPipe[0]);
+    return false;
+  }
+
+  // Drain both pipes with large reads straight into the results.
+  out.reserve(1 << 16);
+  struct pollfd fds[2] = { { outPipe[0], POLLIN, 0 },
+                           { errPipe[0], POLLIN, 0 } };
+  std::string* bufs[2] = { &out, &err };
+  int active = 2;
+  char data[1 << 16];
+  while(active > 0) {
+    if(poll(fds, 2, -1) < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    for(int i = 0; i < 2; ++i) {
+      if(fds[i].fd < 0 || !fds[i].revents) {
+        continue;
+      }
+      ssize_t n = read(fds[i].fd, data, sizeof(data));
+      if(n > 0) {
+        bufs[i]->append(data, size_t(n));
+      } else if(n == 0 || errno != EINTR) {
+        close(fds[i].fd);
+        fds[i].fd = -1;
+        --active;
+      }
+    }
+  }
+  for(int i = 0; i < 2; ++i) {
+    if(fds[i].fd >= 0) {
+      close(fds[i].fd);
+    }
+  }
+
+  int status;
+  while(waitpid(pid, &status, 0) < 0) {
+    if(errno != EINTR) {
+      msg = strerror(errno);
+      return false;
+    }
+  }
+  if(WIFEXITED(status)) {
+    ret = WEXITSTATUS(status);
+    return true;
+  } else if(WIFSIGNALED(status)) {
+    msg = strsignal(WTERMSIG(status));
+    return false;
+  }
+  msg = "Process terminated in unexpected state.\n";
+  return false;
 }
+#endif
 
 //----------------------------------------------------------------------------
 bool runCommand(int argc, const char* const* argv,
                 int& ret, std::string& out, std::string& err,
                 std::string& msg)
 {
+  std::string detail;
+  if(traceEnabled()) {
+    for(int i = 0; i < argc; ++i) {
+      detail += i? " " : "";
+      detail += argv[i];
+    }
+  }
+  TraceRegion tr("Run command", detail);
+#if !defined(_WIN32)
+  ret = 1;
+  out = "";
+  err = "";
+  return runCommandSpawn(argc, argv, ret, out, err, msg);
+#else
   std::vector<const char*> cmd(argv, argv + argc);
   cmd.push_back(0);
   ret = 1;
@@ -168,43 +309,344 @@ bool runCommand(int argc, const char* const* argv,
 
   cxsysProcess_Delete(cp);
   return result;
+#endif
+}
+
+//----------------------------------------------------------------------------
+bool replaceFile(std::string const& path, llvm::StringRef content,
+                 std::string& msg)
+{
+  int fd;
+  llvm::SmallString<128> tmp;
+  if(std::error_code ec =
+     llvm::sys::fs::createUniqueFile(path + "-%%%%%%%%.tmp", fd, tmp)) {
+    msg = "unable to create a temporary file for '" + path + "': " +
+      ec.message();
+    return false;
+  }
+  {
+    llvm::raw_fd_ostream fout(fd, /*shouldClose=*/true);
+    fout << content;
+    fout.close();
+    if(fout.has_error()) {
+      fout.clear_error();
+      llvm::sys::fs::remove(tmp.str());
+      msg = "unable to write '" + tmp.str().str() + "'";
+      return false;
+    }
+  }
+  if(std::error_code ec = llvm::sys::fs::rename(tmp.str(), path)) {
+    llvm::sys::fs::remove(tmp.str());
+    msg = "unable to rename '" + tmp.str().str() + "' to '" + path +
+      "': " + ec.message();
+    return false;
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+void parseDependencyFile(llvm::StringRef text,
+                         std::vector<std::string>& files)
+{
+  // Take the prerequisites of each rule, following line continuations
+  // and spaces escaped by a backslash.  A colon followed by a space or
+  // the end of a line ends the targets, unlike that of a drive letter.
+  bool inTargets = true;
+  std::string word;
+  for(size_t i = 0; i <= text.size(); ++i) {
+    char const c = i < text.size()? text[i] : '\n';
+    if(c == '\\' && i + 1 < text.size() &&
+       (text[i + 1] == '\n' || text[i + 1] == '\r')) {
+      // A line continuation separates words within one rule.
+      i += (text[i + 1] == '\r' && i + 2 < text.size() &&
+            text[i + 2] == '\n')? 2 : 1;
+      if(!word.empty() && !inTargets) {
+        files.push_back(word);
+      }
+      word.clear();
+      continue;
+    }
+    if(c == '\\' && i + 1 < text.size() && text[i + 1] == ' ') {
+      word += ' ';
+      ++i;
+      continue;
+    }
+    if(inTargets && c == ':' &&
+       (i + 1 >= text.size() || text[i + 1] == ' ' ||
+        text[i + 1] == '\t' || text[i + 1] == '\n' ||
+        text[i + 1] == '\r')) {
+      inTargets = false;
+      word.clear();
+      continue;
+    }
+    if(c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+      if(!word.empty() && !inTargets) {
+        files.push_back(word);
+      }
+      word.clear();
+      if(c == '\n') {
+        inTargets = true;
+      }
+      continue;
+    }
+    word += c;
+  }
+}
+
+//----------------------------------------------------------------------------
+size_t getPeakResidentSize()
+{
+#if !defined(_WIN32)
+  struct rusage ru;
+  if(getrusage(RUSAGE_SELF, &ru) != 0) {
+    return 0;
+  }
+# if defined(__APPLE__)
+  return size_t(ru.ru_maxrss);
+# else
+  return size_t(ru.ru_maxrss) * 1024;
+# endif
+#else
+  return 0;
+#endif
+}
+
+//----------------------------------------------------------------------------
+size_t getPhysicalMemorySize()
+{
+#if defined(__APPLE__)
+  uint64_t size = 0;
+  size_t len = sizeof(size);
+  if(sysctlbyname("hw.memsize", &size, &len, nullptr, 0) != 0) {
+    return 0;
+  }
+  return size_t(size);
+#elif !defined(_WIN32)
+  long const pages = sysconf(_SC_PHYS_PAGES);
+  long const pageSize = sysconf(_SC_PAGESIZE);
+  if(pages <= 0 || pageSize <= 0) {
+    return 0;
+  }
+  return size_t(pages) * size_t(pageSize);
+#else
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if(!GlobalMemoryStatusEx(&status)) {
+    return 0;
+  }
+  return size_t(status.ullTotalPhys);
+#endif
+}
+
+//----------------------------------------------------------------------------
+size_t getCurrentResidentSize()
+{
+#if defined(__linux__)
+  // The second field of statm is the resident size in pages.
+  std::ifstream fin("/proc/self/statm");
+  unsigned long size = 0;
+  unsigned long resident = 0;
+  if(!(fin >> size >> resident)) {
+    return 0;
+  }
+  return size_t(resident) * size_t(sysconf(_SC_PAGESIZE));
+#elif defined(__APPLE__)
+  mach_task_basic_info_data_t info;
+  mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+  if(task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+               reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS) {
+    return 0;
+  }
+  return size_t(info.resident_size);
+#else
+  return 0;
+#endif
 }
 
 //----------------------------------------------------------------------------
 std::string encodeXML(std::string const& in, bool cdata)
 {
   std::string xml;
-  const char* last = in.c_str();
-  for(const char* c = last; *c; ++c) {
-    switch(*c) {
-#   define XML(OUT)               \
-      xml.append(last, c - last); \
-      last = c + 1;               \
-      xml.append(OUT)
-    case '&': XML("&amp;"); break;
-    case '<': XML("&lt;"); break;
-    case '>': XML("&gt;"); break;
-    case '\'':
-      if(!cdata) {
-        XML("&apos;");
-      }
-      break;
-    case '"':
-      if(!cdata) {
-        XML("&quot;");
+  llvm::raw_string_ostream os(xml);
+  writeXML(os, in.c_str(), cdata);
+  return os.str();
+}
+
+//----------------------------------------------------------------------------
+static inline uint64_t xmlSpecialBytes(uint64_t w, bool cdata)
+{
+  // Set the high bit of each byte in w that needs escaping.
+  // A byte of w^p is zero exactly where w matches the pattern byte.
+  uint64_t const ones = 0x0101010101010101ull;
+  uint64_t const highs = 0x8080808080808080ull;
+# define XML_ZERO_BYTES(x) (((x) - ones) & ~(x) & highs)
+  uint64_t m = (XML_ZERO_BYTES(w ^ (ones * '&')) |
+                XML_ZERO_BYTES(w ^ (ones * '<')) |
+                XML_ZERO_BYTES(w ^ (ones * '>')));
+  if(!cdata) {
+    m |= (XML_ZERO_BYTES(w ^ (ones * '\'')) |
+          XML_ZERO_BYTES(w ^ (ones * '"')));
+  }
+# undef XML_ZERO_BYTES
+  return m;
+}
+
+//----------------------------------------------------------------------------
+template <typename Write>
+static void escapeXML(llvm::StringRef in, bool cdata, Write const& write)
+{
+  const char* last = in.begin();
+  const char* const end = in.end();
+  const char* c = last;
+  while(c != end) {
+    // Skip a word at a time while no byte in it needs escaping.
+    if(end - c >= 8) {
+      uint64_t w;
+      memcpy(&w, c, sizeof(w));
+      if(!xmlSpecialBytes(w, cdata)) {
+        c += 8;
+        continue;
       }
-      break;
+    }
+
+    // Check the bytes one at a time.
+    const char* out = nullptr;
+    switch(*c) {
+    case '&': out = "&amp;"; break;
+    case '<': out = "&lt;"; break;
+    case '>': out = "&gt;"; break;
+    case '\'': out = cdata? nullptr : "&apos;"; break;
+    case '"': out = cdata? nullptr : "&quot;"; break;
     default: break;
-#   undef XML
     }
+    if(out) {
+      write(last, c - last);
+      write(out, strlen(out));
+      last = c + 1;
+    }
+    ++c;
   }
-  xml.append(last);
-  return xml;
+  write(last, end - last);
 }
 
-#if defined(_WIN32)
-# include <windows.h>
+//----------------------------------------------------------------------------
+void writeXML(llvm::raw_ostream& os, llvm::StringRef in, bool cdata)
+{
+  escapeXML(in, cdata, [&os](char const* p, size_t n) { os.write(p, n); });
+}
+
+//----------------------------------------------------------------------------
+void appendXML(llvm::SmallVectorImpl<char>& buf, llvm::StringRef in,
+               bool cdata)
+{
+  escapeXML(in, cdata,
+            [&buf](char const* p, size_t n) { buf.append(p, p + n); });
+}
+
+//----------------------------------------------------------------------------
+Hasher::Hasher(): MD5(cxsysMD5_New())
+{
+  cxsysMD5_Initialize(this->MD5);
+}
+
+//----------------------------------------------------------------------------
+Hasher::~Hasher()
+{
+  cxsysMD5_Delete(this->MD5);
+}
+
+//----------------------------------------------------------------------------
+void Hasher::Append(std::string const& s)
+{
+  // Include the terminating null to separate consecutive strings.
+  cxsysMD5_Append(this->MD5, reinterpret_cast<unsigned char const*>(s.c_str()),
+                  int(s.size() + 1));
+}
+
+//----------------------------------------------------------------------------
+void Hasher::AppendBytes(char const* data, size_t size)
+{
+  cxsysMD5_Append(this->MD5, reinterpret_cast<unsigned char const*>(data),
+                  int(size));
+}
+
+//----------------------------------------------------------------------------
+std::string Hasher::FinalizeHex()
+{
+  char hex[32];
+  cxsysMD5_FinalizeHex(this->MD5, hex);
+  return std::string(hex, 32);
+}
+
+//----------------------------------------------------------------------------
+void appendOutputOptions(Hasher& h, Options const& opts)
+{
+  h.Append(std::to_string(opts.Attributes));
+  h.Append(std::to_string(opts.MaxDepth));
+  h.Append(opts.SkipFunctionBodies? "skip-function-bodies" : "");
+  h.Append(opts.LimitImplicitMembers? "limit-implicit-members" : "");
+  h.Append(opts.DeclareImplicitMembers? "declare-implicit-members" : "");
+  h.Append(opts.PublicOnly? "public-only" : "");
+  h.Append(opts.SkipInternal? "skip-internal" : "");
+  for(std::string const& n : opts.SkipNamespaces) {
+    h.Append("skip-namespace");
+    h.Append(n);
+  }
+  h.Append(opts.StubSystemHeaders? "stub-system-headers" : "");
+  h.Append(opts.ReferencedSpecializations? "referenced-specializations" : "");
+  h.Append(opts.CanonicalTypes? "canonical-types" : "");
+  h.Append(opts.StableIds? "stable-ids" : "");
+  h.Append(opts.InternStrings? "intern-strings" : "");
+  h.Append(opts.FileHashes? "file-hashes" : "");
+  h.Append(opts.TopologicalOrder? "topological-order" : "");
+  h.Append(opts.Index? "index" : "");
+  h.Append(opts.Layout? "layout" : "");
+  h.Append(opts.Estimate? "estimate" : "");
+  for(std::string const& f : opts.FileFilters) {
+    h.Append("file-filter");
+    h.Append(f);
+  }
+  for(Options::PathPrefix const& p : opts.PathPrefixMaps) {
+    h.Append("path-prefix-map");
+    h.Append(p.From);
+    h.Append(p.To);
+  }
+}
+
+//----------------------------------------------------------------------------
+void growOutputPipe(size_t size)
+{
+#if defined(__linux__) && defined(F_SETPIPE_SZ)
+  struct stat st;
+  if(fstat(STDOUT_FILENO, &st) != 0 || !S_ISFIFO(st.st_mode)) {
+    return;
+  }
+  // Unprivileged processes may not exceed /proc/sys/fs/pipe-max-size,
+  // so halve the size until the kernel accepts it.
+  size = std::min<size_t>(size, 1 << 30);
+  for(size_t s = size; s > 65536; s /= 2) {
+    if(fcntl(STDOUT_FILENO, F_SETPIPE_SZ, static_cast<int>(s)) >= 0) {
+      break;
+    }
+  }
+#else
+  static_cast<void>(size);
 #endif
+}
+
+//----------------------------------------------------------------------------
+std::string mapPathPrefix(Options const& opts, llvm::StringRef path)
+{
+  // Later maps take precedence, as with the compiler's -ffile-prefix-map.
+  for(std::vector<Options::PathPrefix>::const_reverse_iterator
+        i = opts.PathPrefixMaps.rbegin(), e = opts.PathPrefixMaps.rend();
+      i != e; ++i) {
+    if(path.startswith(i->From)) {
+      return i->To + path.substr(i->From.size()).str();
+    }
+  }
+  return path;
+}
 
 //----------------------------------------------------------------------------
 void suppressInteractiveErrors()
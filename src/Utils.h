@@ -17,18 +17,23 @@
 #define CASTXML_UTILS_H
 
 #include <cxsys/Configure.hxx>
+#include <llvm/ADT/StringRef.h>
 #include <string>
+#include <vector>
 
-/// findResources - Call from main() to find resources
-/// relative to the executable.  On success returns true.
-/// On failure returns false and stores a message in the stream.
-bool findResourceDir(const char* argv0, std::ostream& error);
+namespace llvm {
+  class raw_ostream;
+  template <typename T> class SmallVectorImpl;
+}
+class Context;
+struct Options;
 
-/// getResourceDir - Get resource directory found at startup
-std::string getResourceDir();
-
-/// getClangResourceDir - Get Clang resource directory found at startup
-std::string getClangResourceDir();
+/// findResources - Call from main() to find resources relative to
+/// the executable and store their directories in the context.  On
+/// success returns true.  On failure returns false and stores a
+/// message in the stream.
+bool findResourceDir(const char* argv0, Context& ctx,
+                     std::ostream& error);
 
 /// getVersionString - Get the CastXML version string
 std::string getVersionString();
@@ -38,10 +43,101 @@ bool runCommand(int argc, const char* const* argv,
                 int& ret, std::string& out, std::string& err,
                 std::string& msg);
 
+/// replaceFile - Write the content of a file to a uniquely named
+/// temporary file beside it and rename that into place, so that
+/// concurrent readers see the old or the new file but never a partial
+/// one.  On failure removes the temporary file, stores a message, and
+/// returns false.
+bool replaceFile(std::string const& path, llvm::StringRef content,
+                 std::string& msg);
+
+/// parseDependencyFile - Get the prerequisites of the rules of a
+/// dependency file in Make syntax, such as one written by '-MD'.
+void parseDependencyFile(llvm::StringRef text,
+                         std::vector<std::string>& files);
+
+/// getPeakResidentSize - Get the peak resident set size of this process
+/// in bytes, or 0 if it is not known on this platform.
+size_t getPeakResidentSize();
+
+/// getCurrentResidentSize - Get the resident set size of this process
+/// now in bytes, or 0 if it is not known on this platform.
+size_t getCurrentResidentSize();
+
+/// getPhysicalMemorySize - Get the physical memory of the host in
+/// bytes, or 0 if it is not known on this platform.
+size_t getPhysicalMemorySize();
+
+/// growOutputPipe - If standard output is a pipe, grow its capacity
+/// toward the given size so that a write of output buffered up to that
+/// size is taken by the pipe at once instead of in many small pieces
+/// as the reading process drains it.
+void growOutputPipe(size_t size);
+
+/// mapPathPrefix - Get a path as written to the output, with its
+/// leading <old> replaced by <new> for the last pair given by
+/// '--castxml-path-prefix-map <old>=<new>' whose <old> starts it.
+std::string mapPathPrefix(Options const& opts, llvm::StringRef path);
+
 /// suppressInteractiveErrors - Disable Windows error dialog popups
 void suppressInteractiveErrors();
 
 /// encodeXML - Convert character string to XML representation
 std::string encodeXML(std::string const& in, bool cdata = false);
 
+/// writeXML - Write character string to a stream in XML representation
+void writeXML(llvm::raw_ostream& os, llvm::StringRef in, bool cdata = false);
+
+/// appendXML - Append character string to a buffer in XML representation
+void appendXML(llvm::SmallVectorImpl<char>& buf, llvm::StringRef in,
+               bool cdata = false);
+
+/// XMLEscaped - Refer to a string to be written in XML representation
+struct XMLEscaped
+{
+  XMLEscaped(llvm::StringRef in, bool cdata): In(in), CData(cdata) {}
+  llvm::StringRef In;
+  bool CData;
+};
+
+/// escapeXML - Stream a character string in XML representation
+inline XMLEscaped escapeXML(llvm::StringRef in, bool cdata = false)
+{
+  return XMLEscaped(in, cdata);
+}
+
+inline llvm::raw_ostream& operator<<(llvm::raw_ostream& os,
+                                     XMLEscaped const& x)
+{
+  writeXML(os, x.In, x.CData);
+  return os;
+}
+
+struct cxsysMD5_s;
+
+/// Hasher - Compute an MD5 digest over a sequence of strings.
+class Hasher
+{
+  cxsysMD5_s* MD5;
+  Hasher(Hasher const&);
+  void operator=(Hasher const&);
+public:
+  Hasher();
+  ~Hasher();
+
+  /// Append - Add a string and its terminating null to the digest.
+  void Append(std::string const& s);
+
+  /// AppendBytes - Add bytes to the digest without a separator.
+  void AppendBytes(char const* data, size_t size);
+
+  /// FinalizeHex - Get the 32-character hexadecimal digest.
+  std::string FinalizeHex();
+};
+
+/// appendOutputOptions - Add to a digest the options that change the
+/// text of gccxml-format output elements, for the keys of the header
+/// cache, the result cache and the kept translation units alike.
+void appendOutputOptions(Hasher& h, Options const& opts);
+
 #endif // CASTXML_UTILS_H
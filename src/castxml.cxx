@@ -14,62 +14,146 @@
   limitations under the License.
 */
 
+#include "Batch.h"
+#include "Merge.h"
+#include "Compress.h"
+#include "Context.h"
 #include "Detect.h"
 #include "Options.h"
+#include "Prefetch.h"
 #include "RunClang.h"
+#include "Schedule.h"
+#include "TimeReport.h"
 #include "Utils.h"
 
+#include <cxsys/Glob.hxx>
+#include <cxsys/RegularExpression.hxx>
+#include <cxsys/SystemTools.hxx>
+
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/Support/Allocator.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Process.h"
-#include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <fstream>
 #include <iostream>
-#include <set>
 #include <system_error>
+#include <thread>
 #include <vector>
+#include <stdlib.h>
 #include <string.h>
 
 class StringSaver: public llvm::cl::StringSaver {
-  std::set<std::string> Strings;
+  llvm::BumpPtrAllocator Strings;
 public:
   const char* SaveString(const char* s) {
-    return this->Strings.insert(s).first->c_str();
+    size_t const n = strlen(s) + 1;
+    char* p = this->Strings.Allocate<char>(n);
+    memcpy(p, s, n);
+    return p;
   }
 };
 
+//----------------------------------------------------------------------------
+/// parseByteSize - Parse a positive size in bytes with an optional K, M,
+/// or G suffix that fits in size_t.  Anything not starting with a digit
+/// is rejected, as strtoull would skip spaces and wrap a negative value.
+static bool parseByteSize(const char* arg, unsigned long long& size)
+{
+  if(*arg < '0' || *arg > '9') {
+    return false;
+  }
+  char* end;
+  unsigned long long n = strtoull(arg, &end, 10);
+  unsigned int shift = 0;
+  switch(*end) {
+    case 'K': case 'k': shift = 10; ++end; break;
+    case 'M': case 'm': shift = 20; ++end; break;
+    case 'G': case 'g': shift = 30; ++end; break;
+    default: break;
+  }
+  if(*end || n < 1 ||
+     n > (static_cast<unsigned long long>(size_t(-1)) >> shift)) {
+    return false;
+  }
+  size = n << shift;
+  return true;
+}
+
 //----------------------------------------------------------------------------
 int main(int argc_in, const char** argv_in)
 {
   suppressInteractiveErrors();
 
-  llvm::InitializeAllTargets();
-  llvm::InitializeAllTargetMCs();
-  llvm::InitializeAllAsmPrinters();
-  llvm::InitializeAllAsmParsers();
+  // Enable the time report from the raw arguments so that it covers
+  // getting and expanding them.  Options given in response files are
+  // found below.
+  for(int i = 1; i < argc_in; ++i) {
+    if(strcmp(argv_in[i], "--castxml-time-report") == 0) {
+      enableTimeReport();
+    } else if(strcmp(argv_in[i], "--castxml-time-report-counters") == 0) {
+      enableTimeReport(/*counters=*/true);
+    }
+  }
 
   llvm::SmallVector<const char*, 64> argv;
   llvm::SpecificBumpPtrAllocator<char> argAlloc;
-  if(std::error_code e =
-     llvm::sys::Process::GetArgumentVector(
-       argv, llvm::ArrayRef<const char*>(argv_in, argc_in), argAlloc)) {
-    llvm::errs() << "error: could not get arguments: " << e.message() << "\n";
-    return 1;
-  } else if(argv.empty()) {
-    llvm::errs() << "error: no argv[0]?!\n";
-    return 1;
+  {
+    PhaseRegion t("Argument vector");
+    if(std::error_code e =
+       llvm::sys::Process::GetArgumentVector(
+         argv, llvm::ArrayRef<const char*>(argv_in, argc_in), argAlloc)) {
+      llvm::errs() << "error: could not get arguments: " <<
+        e.message() << "\n";
+      return 1;
+    } else if(argv.empty()) {
+      llvm::errs() << "error: no argv[0]?!\n";
+      return 1;
+    }
   }
 
   StringSaver argSaver;
-  llvm::cl::ExpandResponseFiles(
-    argSaver, llvm::cl::TokenizeGNUCommandLine, argv);
+  {
+    PhaseRegion t("Response files");
+    llvm::cl::ExpandResponseFiles(
+      argSaver, llvm::cl::TokenizeGNUCommandLine, argv);
+  }
 
   size_t const argc = argv.size();
 
-  if(!findResourceDir(argv[0], std::cerr)) {
-    return 1;
+  // Enable the time report, trace and metrics before any phase they
+  // cover.  '--castxml-auto-tune' reads back the metrics it writes.
+  std::string metrics_file;
+  std::string auto_tune_file;
+  for(size_t i = 1; i < argc; ++i) {
+    if(strcmp(argv[i], "--castxml-time-report") == 0) {
+      enableTimeReport();
+    } else if(strcmp(argv[i], "--castxml-time-report-counters") == 0) {
+      enableTimeReport(/*counters=*/true);
+    } else if(strcmp(argv[i], "--castxml-trace") == 0 && (i+1) < argc) {
+      enableTrace(argv[++i]);
+    } else if(strcmp(argv[i], "--castxml-metrics") == 0 && (i+1) < argc) {
+      metrics_file = argv[++i];
+    } else if(strcmp(argv[i], "--castxml-auto-tune") == 0 && (i+1) < argc) {
+      auto_tune_file = argv[++i];
+    }
+  }
+  if(metrics_file.empty()) {
+    metrics_file = auto_tune_file;
+  }
+  if(!metrics_file.empty()) {
+    enableMetrics(metrics_file);
+  }
+
+  Context ctx;
+  {
+    PhaseRegion t("Resource lookup");
+    TraceRegion tr("Resource lookup");
+    if(!findResourceDir(argv[0], ctx, std::cerr)) {
+      return 1;
+    }
   }
 
   const char* usage =
@@ -80,6 +164,28 @@ int main(int argc_in, const char** argv_in)
     "\n"
     "Options:\n"
     "\n"
+    "  --castxml-async-output\n"
+    "    Write and compress gccxml-format output on a separate thread\n"
+    "\n"
+    "  --castxml-attributes <attr>[,<attr>]...\n"
+    "    Compute and write only the given optional attributes in\n"
+    "    gccxml-format output.  Each <attr> must be \"mangled\",\n"
+    "    \"location\", \"size\", \"offset\", \"init\", or \"default\".\n"
+    "\n"
+    "  --castxml-auto-tune <file.json>\n"
+    "    Choose the jobs, memory budget, job order and prelude PCH use\n"
+    "    not given on the command line from the metrics an earlier run\n"
+    "    wrote to <file.json>, and write those of this run there\n"
+    "\n"
+    "  --castxml-batch <file>\n"
+    "    Process each entry of the JSON compilation database <file>\n"
+    "    (e.g. compile_commands.json) in one castxml process\n"
+    "\n"
+    "  --castxml-canonical-types\n"
+    "    Write one gccxml-format element for each pointer, reference,\n"
+    "    array, function, and member pointer type however its parts\n"
+    "    are spelled through typedefs\n"
+    "\n"
     "  --castxml-cc-<id> <cc>\n"
     "  --castxml-cc-<id> \"(\" <cc> <cc-opt>... \")\"\n"
     "    Configure the internal Clang preprocessor and target\n"
@@ -88,11 +194,328 @@ int main(int argc_in, const char** argv_in)
     "    compiler (e.g. \"gcc\") and <cc-opt>... specifies\n"
     "    options that may affect its target (e.g. \"-m32\").\n"
     "\n"
+    "  --castxml-cc-emit-config <file>\n"
+    "    Write the settings detected by '--castxml-cc-<id>' to the\n"
+    "    response file <file>, to be given as '@<file>' in place of\n"
+    "    detection, with the predefines in '<file>.h', and exit\n"
+    "\n"
+    "  --castxml-cc-emit-profile <file>\n"
+    "    Write the settings detected by '--castxml-cc-<id>' to the\n"
+    "    profile <file> for '--castxml-cc-profile', naming include\n"
+    "    directories relative to any '--sysroot', and exit\n"
+    "\n"
+    "  --castxml-cc-profile <name>\n"
+    "    Configure the internal Clang preprocessor and target platform\n"
+    "    from a profile of settings written by\n"
+    "    '--castxml-cc-emit-profile' instead of running a compiler.\n"
+    "    <name> is a profile file or the name of one bundled with\n"
+    "    castxml (e.g. \"gcc-12-x86_64-linux-gnu\").  Its include\n"
+    "    directories are placed under any '--sysroot'\n"
+    "\n"
+    "  --castxml-declare-implicit-members\n"
+    "    Declare the implicit members of classes without defining them,\n"
+    "    so that no template instantiations are done for their bodies\n"
+    "\n"
+    "  --castxml-defer-instantiations\n"
+    "    Mark the implicit members of all classes before performing\n"
+    "    the template instantiations they need, in batches\n"
+    "\n"
+    "  --castxml-detect-cache <dir>\n"
+    "    Cache settings detected by '--castxml-cc-<id>' in <dir>\n"
+    "    and reuse them without running the compiler again, along\n"
+    "    with a prelude PCH unless '--castxml-prelude-pch' is given\n"
+    "\n"
+    "  --castxml-diff-against <file>\n"
+    "    Write only the gccxml-format output elements that differ from\n"
+    "    those with the same '--castxml-stable-ids' id in <file>\n"
+    "\n"
+    "  --castxml-disable-free\n"
+    "    Exit without freeing the AST and output tables of each input\n"
+    "\n"
+    "  --castxml-driver-cache <dir>\n"
+    "    Cache the Clang command lines computed by the compiler driver\n"
+    "    in <dir> and reuse them without running the driver again\n"
+    "\n"
+    "  --castxml-drop-source-buffers\n"
+    "    Compute the line tables of all files once parsed, then free\n"
+    "    the content of the headers before the output is written\n"
+    "\n"
+    "  --castxml-emit-ast <file>\n"
+    "    Write the AST, with implicit members added, to <file> for\n"
+    "    later runs given '--castxml-load-ast'\n"
+    "\n"
+    "  --castxml-estimate\n"
+    "    With '--castxml-gccxml', write the number of nodes and bytes\n"
+    "    the output would have in its place\n"
+    "\n"
+    "  --castxml-file-filter <pattern>\n"
+    "    Output declarations completely only if they are in files\n"
+    "    matching the glob <pattern>, or regex:<regex> if so prefixed\n"
+    "\n"
+    "  --castxml-file-hashes\n"
+    "    With '--castxml-gccxml', give each File element a hash\n"
+    "    attribute holding the MD5 digest of the file's content\n"
+    "\n"
+    "  --castxml-fork-prelude\n"
+    "    With '--castxml-gccxml' and many inputs, parse the detected\n"
+    "    predefines and '--castxml-prefix-header' once and fork a process\n"
+    "    to finish each input\n"
+    "\n"
     "  --castxml-gccxml\n"
     "    Write gccxml-format output to <src>.xml or file named by '-o'\n"
     "\n"
+    "  --castxml-header-cache <dir>\n"
+    "    With '--castxml-stable-ids', reuse the gccxml-format text of\n"
+    "    the elements of unchanged headers cached in <dir>\n"
+    "\n"
+    "  --castxml-implicit-members-report <n>\n"
+    "    Print to stderr the <n> classes whose implicit members took the\n"
+    "    most time to add, with the instantiations each triggered\n"
+    "\n"
+    "  --castxml-index\n"
+    "    With '--castxml-gccxml', write in place of the output one\n"
+    "    line with the kind, qualified name, file:line and mangled\n"
+    "    name of each declaration reached from the start\n"
+    "\n"
+    "  --castxml-intern-strings\n"
+    "    Write each name, mangled name and file name once in a String\n"
+    "    element and refer to it by id in gccxml-format output\n"
+    "\n"
+    "  --castxml-job-affinity\n"
+    "    With '--castxml-batch' and '--castxml-jobs', run entries whose\n"
+    "    dependency files list the same headers on the same worker\n"
+    "\n"
+    "  --castxml-job-costs <file>\n"
+    "    Order parallel inputs by the time each took in earlier runs\n"
+    "    as recorded in <file>, and record the times of this run\n"
+    "\n"
+    "  --castxml-jobs <n>\n"
+    "    Process up to <n> input source files or batch entries in\n"
+    "    parallel, starting those expected to take longest first\n"
+    "\n"
+    "  --castxml-layout\n"
+    "    With '--castxml-gccxml', write only records, fields, enums and\n"
+    "    typedefs with their size, align and offset\n"
+    "\n"
+    "  --castxml-limit-implicit-members\n"
+    "    Generate implicit members only for classes reachable from\n"
+    "    the declarations named by '--castxml-start'\n"
+    "\n"
+    "  --castxml-load-ast <file>\n"
+    "    Write gccxml-format output for the AST stored in <file> by\n"
+    "    '--castxml-emit-ast' instead of parsing a source file\n"
+    "\n"
+    "  --castxml-mangle-threads <n>\n"
+    "    Compute the mangled names of gccxml-format output on up to <n>\n"
+    "    threads\n"
+    "\n"
+    "  --castxml-max-depth <n>\n"
+    "    Output declarations completely only if they are at most <n>\n"
+    "    references away from the starting declarations\n"
+    "\n"
+    "  --castxml-mem-budget <bytes>[K|M|G]\n"
+    "    With '--castxml-jobs', start another input only while the\n"
+    "    memory predicted for those running stays within <bytes>\n"
+    "\n"
+    "  --castxml-mem-limit <bytes>[K|M|G]\n"
+    "    Fail an input, batch entry or server request whose compiler\n"
+    "    tables grow past <bytes>\n"
+    "\n"
+    "  --castxml-mem-report\n"
+    "    Print the memory used by the AST and by gccxml-format output\n"
+    "    tables to stderr\n"
+    "\n"
+    "  --castxml-merge\n"
+    "    Merge the gccxml-format output files given as inputs into the\n"
+    "    file named by '-o', writing shared declarations only once\n"
+    "\n"
+    "  --castxml-merge-variants\n"
+    "    With '--castxml-merge' inputs <config>=<file>, or with\n"
+    "    '--castxml-target', write one document annotating the sizes,\n"
+    "    offsets, and names that differ between configurations\n"
+    "\n"
+    "  --castxml-metrics <file.json>\n"
+    "    Write the times, memory and cache hits and misses of the run\n"
+    "    to <file.json> as JSON\n"
+    "\n"
+    "  --castxml-numa\n"
+    "    With '--castxml-jobs', bind the workers to the NUMA nodes of\n"
+    "    the host in turn, sharing the files read by each node's workers\n"
+    "\n"
+    "  --castxml-output <format>[:<file>][,<format>:<file>]...\n"
+    "    Write gccxml-format output in the given format.\n"
+    "    The <format> must be \"xml\" (default), \"bin\", \"json\",\n"
+    "    \"sql\", or \"fingerprint\".\n"
+    "    Further entries write the same output to more files\n"
+    "\n"
+    "  --castxml-output-buffer <bytes>\n"
+    "    Buffer up to <bytes> of gccxml-format output between writes\n"
+    "\n"
+    "  --castxml-output-compression <format>\n"
+    "    Compress gccxml-format output as it is written.\n"
+    "    The <format> must be \"gzip\" or \"none\".\n"
+    "\n"
+    "  --castxml-output-dir <dir>\n"
+    "    Write the output for each input to the file in <dir> named\n"
+    "    after it, allowing more than one input\n"
+    "\n"
+    "  --castxml-output-index <file>\n"
+    "    Write the offset of each gccxml-format output element to <file>\n"
+    "\n"
+    "  --castxml-output-shards <dir>\n"
+    "    Write gccxml-format output for each source file to its own\n"
+    "    file in <dir> and a manifest of them to the output file\n"
+    "\n"
+    "  --castxml-partition <index>/<count>\n"
+    "    Write only the part numbered <index> (from 0) of <count>\n"
+    "    parts of the start names, or of the top-level declarations\n"
+    "    without '--castxml-start', to merge with '--castxml-merge'\n"
+    "\n"
+    "  --castxml-path-prefix-map <old>=<new>\n"
+    "    Write paths starting with <old> in the output starting with\n"
+    "    <new> instead, as with the compiler's '-ffile-prefix-map'\n"
+    "\n"
+    "  --castxml-pipeline\n"
+    "    With '--castxml-batch', write the output of each entry while\n"
+    "    the next one is parsed\n"
+    "\n"
+    "  --castxml-prefetch <file>\n"
+    "    Read the files listed in <file> by an earlier run, or by a\n"
+    "    dependency file, on background threads while parsing\n"
+    "\n"
+    "  --castxml-prefetch-io-uring\n"
+    "    With '--castxml-batch', load the files of '--castxml-prefetch'\n"
+    "    in batches through io_uring for the entries to share\n"
+    "\n"
+    "  --castxml-prefix-header <file>\n"
+    "    Process <file> before each input and precompile it into\n"
+    "    the prelude PCH given by '--castxml-prelude-pch'\n"
+    "\n"
+    "  --castxml-prelude-pch <dir>\n"
+    "    Precompile settings detected by '--castxml-cc-<id>' into a\n"
+    "    prelude PCH cached in <dir> and load it for each input\n"
+    "\n"
+    "  --castxml-preprocessed-cache <dir>\n"
+    "    Cache the preprocessed text of each input in <dir> and parse\n"
+    "    it in place of the input and its headers while unchanged\n"
+    "\n"
+    "  --castxml-progressive\n"
+    "    Write and flush the elements reached from each\n"
+    "    '--castxml-start' name in turn, in the order given\n"
+    "\n"
+    "  --castxml-public-only\n"
+    "    Output only the public members of classes, and what they\n"
+    "    reference\n"
+    "\n"
+    "  --castxml-referenced-specializations\n"
+    "    Output specializations of class templates that are members of\n"
+    "    traversed contexts only where they are referenced\n"
+    "\n"
+    "  --castxml-release-parse-state\n"
+    "    Free the header content and header search state of the\n"
+    "    translation unit once parsed, before the output is written\n"
+    "\n"
+    "  --castxml-result-cache <dir>\n"
+    "    Cache gccxml-format output in <dir> and reuse it for later\n"
+    "    identical invocations whose input files are unchanged\n"
+    "\n"
+    "  --castxml-result-cache-remote <command>\n"
+    "    Fetch result cache entries missing from '--castxml-result-cache'\n"
+    "    with '<command> get <name> <file>', and send those added with\n"
+    "    '<command> put <name> <file>'\n"
+    "\n"
+    "  --castxml-retain-ast-memory <bytes>[K|M|G]\n"
+    "    With '--castxml-server', keep the translation units of the most\n"
+    "    recent '--castxml-retain-ast' requests within this much memory\n"
+    "\n"
+    "  --castxml-scan-deps\n"
+    "    Write the files each input includes as a dependency rule,\n"
+    "    running only the preprocessor\n"
+    "\n"
+    "  --castxml-server\n"
+    "    Read castxml command lines from stdin, one per line, and\n"
+    "    process each one in this process as it arrives\n"
+    "\n"
+    "  --castxml-skip-function-bodies\n"
+    "    Do not parse function bodies when writing gccxml-format output\n"
+    "\n"
+    "  --castxml-skip-internal\n"
+    "    Leave out anonymous namespaces and the functions and variables\n"
+    "    declared 'static' at namespace scope\n"
+    "\n"
+    "  --castxml-skip-namespace <pattern>\n"
+    "    Leave out the namespaces whose name matches <pattern>, such as\n"
+    "    'detail', or whose qualified name does if it contains '::'\n"
+    "\n"
+    "  --castxml-snippets\n"
+    "    With '--castxml-gccxml', parse the input once and then write to\n"
+    "    stdout the output of each code snippet read from stdin\n"
+    "\n"
+    "  --castxml-stable-ids\n"
+    "    Derive gccxml-format output ids from the identity of each\n"
+    "    declaration or type instead of numbering them in order\n"
+    "\n"
     "  --castxml-start <name>\n"
-    "    Start AST traversal at declaration with given (qualified) name\n"
+    "    Start AST traversal at declaration with given (qualified) name,\n"
+    "    whose components may be patterns using '*' and '?'\n"
+    "\n"
+    "  --castxml-start-file <file>\n"
+    "    Read '--castxml-start' names from <file>, one per line\n"
+    "\n"
+    "  --castxml-start-group <name>[,<name>]...=<file>\n"
+    "    Write gccxml-format output starting at the given names to <file>\n"
+    "    instead of the main output.  Groups share one parse.\n"
+    "\n"
+    "  --castxml-stats\n"
+    "    Print counts of gccxml-format output elements and of the work\n"
+    "    done to write them to stderr\n"
+    "\n"
+    "  --castxml-stub-system-headers\n"
+    "    Output only minimal elements for declarations in the system\n"
+    "    headers detected by '--castxml-cc-<id>'\n"
+    "\n"
+    "  --castxml-target <name>=<clang-args>\n"
+    "    Also parse the inputs for a target configured by <clang-args>,\n"
+    "    such as '-m32' or '-target <triple>', on a thread of its own,\n"
+    "    writing '-o <out>.xml' to '<out>.<name>.xml'.  Targets share\n"
+    "    the files they read.\n"
+    "\n"
+    "  --castxml-template-report <n>\n"
+    "    Print to stderr the <n> class templates whose instantiations\n"
+    "    took the most time, with how many were instantiated and output\n"
+    "\n"
+    "  --castxml-time-report\n"
+    "    Print the time spent in each phase of processing to stderr\n"
+    "\n"
+    "  --castxml-time-report-counters\n"
+    "    Print the time report with the hardware event counts of each\n"
+    "    phase, such as instructions, cycles and cache misses\n"
+    "\n"
+    "  --castxml-timeout <seconds>\n"
+    "    Fail a run, batch entry or server request not done within\n"
+    "    <seconds> of wall-clock time\n"
+    "\n"
+    "  --castxml-token-cache\n"
+    "    With '--castxml-batch' or '--castxml-server', lex the headers\n"
+    "    read by an earlier input from tokens cached for the session\n"
+    "\n"
+    "  --castxml-topological-order\n"
+    "    With '--castxml-gccxml', write each element after the elements\n"
+    "    it references, with Forward elements to break cycles\n"
+    "\n"
+    "  --castxml-trace <file.json>\n"
+    "    Write Chrome trace events for processing phases to <file.json>\n"
+    "\n"
+    "  --castxml-unity <file>\n"
+    "    Parse the headers listed in <file> as one translation unit\n"
+    "    and write the output for each header to '--castxml-output-dir'\n"
+    "\n"
+    "  --castxml-watch\n"
+    "    Run again whenever a file read by the last run changes\n"
+    "\n"
+    "  --castxml-worker-processes\n"
+    "    With '--castxml-batch' and '--castxml-jobs', run the entries in\n"
+    "    forked worker processes so that a crash fails only one entry\n"
     "\n"
     "  -help, --help\n"
     "    Print castxml and internal Clang compiler usage information\n"
@@ -109,6 +532,29 @@ int main(int argc_in, const char** argv_in)
   llvm::SmallVector<const char *, 16> clang_args;
   llvm::SmallVector<const char *, 16> cc_args;
   const char* cc_id = 0;
+  std::string cc_profile;
+  std::string sysroot;
+  std::string output_format_file;
+
+  // Start from the tuned settings so that those given on the command
+  // line replace them.
+  bool tuned_prelude = true;
+  if(!auto_tune_file.empty()) {
+    if(metrics_file != auto_tune_file) {
+      std::cerr <<
+        "error: '--castxml-auto-tune' and '--castxml-metrics' may not "
+        "name different files\n"
+        "\n" <<
+        usage
+        ;
+      return 1;
+    }
+    AutoTune const tune = autoTune(auto_tune_file);
+    opts.Jobs = tune.Jobs;
+    opts.MemoryBudget = static_cast<size_t>(tune.MemoryBudget);
+    opts.JobCostsFile = auto_tune_file + ".costs";
+    tuned_prelude = tune.PreludePCH;
+  }
 
   for(size_t i=1; i < argc; ++i) {
     if(strcmp(argv[i], "--castxml-gccxml") == 0) {
@@ -116,7 +562,797 @@ int main(int argc_in, const char** argv_in)
         opts.GccXml = true;
       } else {
         std::cerr <<
-          "error: '--castxml-gccxml' may be given at most once!\n"
+          "error: '--castxml-gccxml' may be given at most once!\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-async-output") == 0) {
+      opts.AsyncOutput = true;
+    } else if(strcmp(argv[i], "--castxml-attributes") == 0) {
+      if((i+1) < argc) {
+        opts.Attributes = 0;
+        llvm::SmallVector<llvm::StringRef, 8> attrs;
+        llvm::StringRef(argv[++i]).split(attrs, ",");
+        for(llvm::StringRef const& a : attrs) {
+          if(a == "mangled") {
+            opts.Attributes |= Options::AttributeMangled;
+          } else if(a == "location") {
+            opts.Attributes |= Options::AttributeLocation;
+          } else if(a == "size") {
+            opts.Attributes |= Options::AttributeSize;
+          } else if(a == "offset") {
+            opts.Attributes |= Options::AttributeOffset;
+          } else if(a == "init") {
+            opts.Attributes |= Options::AttributeInit;
+          } else if(a == "default") {
+            opts.Attributes |= Options::AttributeDefault;
+          } else if(!a.empty()) {
+            std::cerr <<
+              "error: attribute '" << a << "' given to "
+              "'--castxml-attributes' is not known\n"
+              "\n" <<
+              usage
+              ;
+            return 1;
+          }
+        }
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-attributes' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-batch") == 0) {
+      if((i+1) < argc) {
+        opts.BatchFile = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-batch' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-canonical-types") == 0) {
+      opts.CanonicalTypes = true;
+    } else if(strcmp(argv[i], "--castxml-file-filter") == 0) {
+      if((i+1) < argc) {
+        std::string filter = argv[++i];
+        if(filter.compare(0, 6, "regex:") == 0) {
+          filter = filter.substr(6);
+        } else {
+          filter = cxsys::Glob::PatternToRegex(filter, true, true);
+        }
+        cxsys::RegularExpression regex;
+        if(!regex.compile(filter)) {
+          std::cerr <<
+            "error: argument to '--castxml-file-filter' is not a valid "
+            "pattern\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+        opts.FileFilters.push_back(filter);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-file-filter' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-implicit-members-report") == 0) {
+      if((i+1) < argc) {
+        char* end;
+        unsigned long n = strtoul(argv[++i], &end, 10);
+        if(*end || n < 1 || n >= ~0u) {
+          std::cerr <<
+            "error: argument to '--castxml-implicit-members-report' must "
+            "be a positive integer\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+        opts.ImplicitMembersReport = static_cast<unsigned int>(n);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-implicit-members-report' is "
+          "missing (expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-template-report") == 0) {
+      if((i+1) < argc) {
+        char* end;
+        unsigned long n = strtoul(argv[++i], &end, 10);
+        if(*end || n < 1 || n >= ~0u) {
+          std::cerr <<
+            "error: argument to '--castxml-template-report' must "
+            "be a positive integer\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+        opts.TemplateReport = static_cast<unsigned int>(n);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-template-report' is "
+          "missing (expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-timeout") == 0) {
+      if((i+1) < argc) {
+        char* end;
+        unsigned long n = strtoul(argv[++i], &end, 10);
+        if(*end || n < 1 || n >= ~0u) {
+          std::cerr <<
+            "error: argument to '--castxml-timeout' must be a positive "
+            "number of seconds\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+        opts.Timeout = static_cast<unsigned int>(n);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-timeout' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-intern-strings") == 0) {
+      opts.InternStrings = true;
+    } else if(strcmp(argv[i], "--castxml-job-affinity") == 0) {
+      opts.JobAffinity = true;
+    } else if(strcmp(argv[i], "--castxml-numa") == 0) {
+      opts.Numa = true;
+    } else if(strcmp(argv[i], "--castxml-prefetch-io-uring") == 0) {
+      opts.PrefetchIoUring = true;
+    } else if(strcmp(argv[i], "--castxml-job-costs") == 0) {
+      if((i+1) < argc) {
+        opts.JobCostsFile = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-job-costs' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-jobs") == 0) {
+      if((i+1) < argc) {
+        char* end;
+        unsigned long n = strtoul(argv[++i], &end, 10);
+        if(*end || n < 1) {
+          std::cerr <<
+            "error: argument to '--castxml-jobs' must be a positive integer\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+        opts.Jobs = static_cast<unsigned int>(n);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-jobs' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-declare-implicit-members") == 0) {
+      opts.DeclareImplicitMembers = true;
+    } else if(strcmp(argv[i], "--castxml-defer-instantiations") == 0) {
+      opts.DeferInstantiations = true;
+    } else if(strcmp(argv[i], "--castxml-layout") == 0) {
+      opts.Layout = true;
+    } else if(strcmp(argv[i], "--castxml-limit-implicit-members") == 0) {
+      opts.LimitImplicitMembers = true;
+    } else if(strcmp(argv[i], "--castxml-mangle-threads") == 0) {
+      if((i+1) < argc) {
+        char* end;
+        unsigned long n = strtoul(argv[++i], &end, 10);
+        if(*end || n < 1) {
+          std::cerr <<
+            "error: argument to '--castxml-mangle-threads' must be a "
+            "positive integer\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+        opts.MangleThreads = static_cast<unsigned int>(n);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-mangle-threads' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-max-depth") == 0) {
+      if((i+1) < argc) {
+        char* end;
+        const char* arg = argv[++i];
+        unsigned long n = strtoul(arg, &end, 10);
+        if(*end || !*arg || *arg == '-' || n >= ~0u) {
+          std::cerr <<
+            "error: argument to '--castxml-max-depth' must be a "
+            "non-negative integer\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+        opts.MaxDepth = static_cast<unsigned int>(n);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-max-depth' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-mem-budget") == 0) {
+      if((i+1) < argc) {
+        unsigned long long n;
+        if(!parseByteSize(argv[++i], n)) {
+          std::cerr <<
+            "error: argument to '--castxml-mem-budget' must be a "
+            "positive size in bytes\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+        opts.MemoryBudget = static_cast<size_t>(n);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-mem-budget' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-mem-limit") == 0) {
+      if((i+1) < argc) {
+        unsigned long long n;
+        if(!parseByteSize(argv[++i], n)) {
+          std::cerr <<
+            "error: argument to '--castxml-mem-limit' must be a "
+            "positive size in bytes\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+        opts.MemoryLimit = static_cast<size_t>(n);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-mem-limit' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-output") == 0) {
+      if((i+1) < argc) {
+        // The value is a list of <format>[:<file>] entries.  The first
+        // names the format of the main output and optionally its file.
+        // Others name additional outputs from the same traversal.
+        llvm::SmallVector<llvm::StringRef, 4> entries;
+        llvm::StringRef(argv[++i]).split(entries, ",");
+        opts.ExtraOutputs.clear();
+        for(size_t j = 0; j < entries.size(); ++j) {
+          std::pair<llvm::StringRef, llvm::StringRef> entry =
+            entries[j].split(':');
+          std::string const format = entry.first.str();
+          if(format != "xml" && format != "bin" && format != "json" &&
+             format != "sql" && format != "fingerprint") {
+            std::cerr <<
+              "error: output format '" << format << "' is not known\n"
+              "\n" <<
+              usage
+              ;
+            return 1;
+          }
+          if(j == 0) {
+            opts.OutputFormat = format;
+            output_format_file = entry.second.str();
+          } else if(!entry.second.empty()) {
+            opts.ExtraOutputs.push_back(
+              Options::Output(format, entry.second.str()));
+          } else {
+            std::cerr <<
+              "error: output format '" << format << "' after the first "
+              "in '--castxml-output' must name a file\n"
+              "\n" <<
+              usage
+              ;
+            return 1;
+          }
+        }
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-output' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-output-buffer") == 0) {
+      if((i+1) < argc) {
+        char* end;
+        unsigned long n = strtoul(argv[++i], &end, 10);
+        if(*end || n < 1) {
+          std::cerr <<
+            "error: argument to '--castxml-output-buffer' must be a "
+            "positive integer\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+        opts.OutputBufferSize = static_cast<size_t>(n);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-output-buffer' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-output-compression") == 0) {
+      if((i+1) < argc) {
+        opts.OutputCompression = argv[++i];
+        if(!haveCompression(opts.OutputCompression)) {
+          std::cerr <<
+            "error: output compression '" << opts.OutputCompression <<
+            "' is not supported by this castxml\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-output-compression' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-output-index") == 0) {
+      if((i+1) < argc) {
+        opts.OutputIndexFile = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-output-index' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-output-dir") == 0) {
+      if((i+1) < argc) {
+        opts.OutputDir = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-output-dir' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-output-shards") == 0) {
+      if((i+1) < argc) {
+        opts.OutputShardDir = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-output-shards' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-prefetch") == 0) {
+      if((i+1) < argc) {
+        opts.PrefetchFile = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-prefetch' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-prefix-header") == 0) {
+      if((i+1) < argc) {
+        opts.PrefixHeader =
+          cxsys::SystemTools::CollapseFullPath(argv[++i]);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-prefix-header' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-prelude-pch") == 0) {
+      if((i+1) < argc) {
+        opts.PreludePCHDir = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-prelude-pch' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-preprocessed-cache") == 0) {
+      if((i+1) < argc) {
+        opts.PreprocessedCacheDir = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-preprocessed-cache' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-progressive") == 0) {
+      opts.Progressive = true;
+    } else if(strcmp(argv[i], "--castxml-public-only") == 0) {
+      opts.PublicOnly = true;
+    } else if(strcmp(argv[i], "--castxml-release-parse-state") == 0) {
+      opts.ReleaseParseState = true;
+    } else if(strcmp(argv[i], "--castxml-result-cache") == 0) {
+      if((i+1) < argc) {
+        opts.ResultCacheDir = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-result-cache' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-result-cache-remote") == 0) {
+      if((i+1) < argc) {
+        opts.ResultCacheRemote = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-result-cache-remote' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-retain-ast-memory") == 0) {
+      if((i+1) < argc) {
+        unsigned long long n;
+        if(!parseByteSize(argv[++i], n)) {
+          std::cerr <<
+            "error: argument to '--castxml-retain-ast-memory' must be a "
+            "positive size in bytes\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+        opts.RetainMemory = static_cast<size_t>(n);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-retain-ast-memory' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-scan-deps") == 0) {
+      opts.ScanDeps = true;
+    } else if(strcmp(argv[i], "--castxml-server") == 0) {
+      opts.Server = true;
+    } else if(strcmp(argv[i], "--castxml-skip-function-bodies") == 0) {
+      opts.SkipFunctionBodies = true;
+    } else if(strcmp(argv[i], "--castxml-skip-internal") == 0) {
+      opts.SkipInternal = true;
+    } else if(strcmp(argv[i], "--castxml-skip-namespace") == 0) {
+      if((i+1) < argc) {
+        opts.SkipNamespaces.push_back(argv[++i]);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-skip-namespace' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-snippets") == 0) {
+      opts.Snippets = true;
+    } else if(strcmp(argv[i], "--castxml-stable-ids") == 0) {
+      opts.StableIds = true;
+    } else if(strcmp(argv[i], "--castxml-mem-report") == 0) {
+      opts.MemReport = true;
+    } else if(strcmp(argv[i], "--castxml-merge") == 0) {
+      opts.Merge = true;
+    } else if(strcmp(argv[i], "--castxml-merge-variants") == 0) {
+      opts.MergeVariants = true;
+    } else if(strcmp(argv[i], "--castxml-stats") == 0) {
+      opts.Stats = true;
+    } else if(strcmp(argv[i], "--castxml-stub-system-headers") == 0) {
+      opts.StubSystemHeaders = true;
+    } else if(strcmp(argv[i], "--castxml-file-hashes") == 0) {
+      opts.FileHashes = true;
+    } else if(strcmp(argv[i], "--castxml-topological-order") == 0) {
+      opts.TopologicalOrder = true;
+    } else if(strcmp(argv[i], "--castxml-fork-prelude") == 0) {
+      opts.ForkPrelude = true;
+    } else if(strcmp(argv[i], "--castxml-header-cache") == 0) {
+      if((i+1) < argc) {
+        opts.HeaderCacheDir = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-header-cache' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i],
+                     "--castxml-referenced-specializations") == 0) {
+      opts.ReferencedSpecializations = true;
+    } else if(strcmp(argv[i], "--castxml-unity") == 0) {
+      if((i+1) < argc) {
+        std::string const list = argv[++i];
+        std::ifstream fin(list.c_str());
+        if(!fin) {
+          std::cerr << "error: unable to read '" << list << "'\n";
+          return 1;
+        }
+        std::string line;
+        while(cxsys::SystemTools::GetLineFromStream(fin, line)) {
+          if(!line.empty()) {
+            std::string header = cxsys::SystemTools::CollapseFullPath(line);
+            cxsys::SystemTools::ConvertToUnixSlashes(header);
+            opts.UnityHeaders.push_back(header);
+          }
+        }
+        if(opts.UnityHeaders.empty()) {
+          std::cerr << "error: '" << list << "' names no headers\n";
+          return 1;
+        }
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-unity' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-partition") == 0) {
+      if((i+1) < argc) {
+        char const* arg = argv[++i];
+        char* end;
+        unsigned long index = strtoul(arg, &end, 10);
+        unsigned long count = 0;
+        if(end != arg && *arg != '-' && *end == '/') {
+          char const* c = end + 1;
+          count = strtoul(c, &end, 10);
+          if(end == c || *c == '-' || *end) {
+            count = 0;
+          }
+        }
+        if(count < 1 || index >= count || count >= ~0u) {
+          std::cerr <<
+            "error: argument to '--castxml-partition' must be of the "
+            "form <index>/<count> with <index> less than <count>\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+        opts.PartitionIndex = static_cast<unsigned int>(index);
+        opts.PartitionCount = static_cast<unsigned int>(count);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-partition' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-path-prefix-map") == 0) {
+      if((i+1) < argc) {
+        std::string const map = argv[++i];
+        std::string::size_type const eq = map.find('=');
+        if(eq == std::string::npos) {
+          std::cerr <<
+            "error: argument to '--castxml-path-prefix-map' must be of "
+            "the form <old>=<new>\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+        opts.PathPrefixMaps.push_back(
+          Options::PathPrefix(map.substr(0, eq), map.substr(eq + 1)));
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-path-prefix-map' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-pipeline") == 0) {
+      opts.Pipelined = true;
+    } else if(strcmp(argv[i], "--castxml-token-cache") == 0) {
+      opts.TokenCache = true;
+    } else if(strcmp(argv[i], "--castxml-watch") == 0) {
+      opts.Watch = true;
+    } else if(strcmp(argv[i], "--castxml-worker-processes") == 0) {
+      opts.WorkerProcesses = true;
+    } else if(strcmp(argv[i], "--castxml-time-report") == 0 ||
+              strcmp(argv[i], "--castxml-time-report-counters") == 0) {
+      // Enabled above before finding resources.
+    } else if(strcmp(argv[i], "--castxml-metrics") == 0) {
+      if((i+1) < argc) {
+        // Enabled above before finding resources.
+        ++i;
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-metrics' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-auto-tune") == 0) {
+      if((i+1) < argc) {
+        // Enabled above before finding resources.
+        ++i;
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-auto-tune' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-trace") == 0) {
+      if((i+1) < argc) {
+        // Enabled above before finding resources.
+        ++i;
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-trace' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-start-group") == 0) {
+      if((i+1) < argc) {
+        std::pair<llvm::StringRef, llvm::StringRef> group =
+          llvm::StringRef(argv[++i]).rsplit('=');
+        llvm::SmallVector<llvm::StringRef, 4> names;
+        group.first.split(names, ",", -1, false);
+        if(names.empty() || group.second.empty()) {
+          std::cerr <<
+            "error: argument to '--castxml-start-group' must be of the "
+            "form <name>[,<name>]...=<file>\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+        Options::StartGroup g;
+        for(llvm::StringRef n : names) {
+          g.Names.push_back(n.str());
+        }
+        g.File = group.second.str();
+        opts.StartGroups.push_back(g);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-start-group' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-target") == 0) {
+      if((i+1) < argc) {
+        std::pair<llvm::StringRef, llvm::StringRef> target =
+          llvm::StringRef(argv[++i]).split('=');
+        if(target.first.empty() || target.second.empty()) {
+          std::cerr <<
+            "error: argument to '--castxml-target' must be of the "
+            "form <name>=<clang-args>\n"
+            "\n" <<
+            usage
+            ;
+          return 1;
+        }
+        Options::Target t(target.first.str());
+        llvm::SmallVector<const char*, 8> targetArgs;
+        llvm::cl::TokenizeGNUCommandLine(target.second, argSaver,
+                                         targetArgs);
+        t.Arguments.assign(targetArgs.begin(), targetArgs.end());
+        opts.Targets.push_back(t);
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-target' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-start-file") == 0) {
+      if((i+1) < argc) {
+        std::string const list = argv[++i];
+        std::ifstream fin(list.c_str());
+        if(!fin) {
+          std::cerr << "error: unable to read '" << list << "'\n";
+          return 1;
+        }
+        std::string line;
+        while(cxsys::SystemTools::GetLineFromStream(fin, line)) {
+          if(!line.empty()) {
+            opts.StartNames.push_back(line);
+          }
+        }
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-start-file' is missing "
+          "(expected 1 value)\n"
           "\n" <<
           usage
           ;
@@ -134,6 +1370,110 @@ int main(int argc_in, const char** argv_in)
           ;
         return 1;
       }
+    } else if(strcmp(argv[i], "--castxml-detect-cache") == 0) {
+      if((i+1) < argc) {
+        opts.DetectCacheDir = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-detect-cache' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-cc-emit-config") == 0) {
+      if((i+1) < argc) {
+        opts.EmitConfigFile = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-cc-emit-config' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-cc-emit-profile") == 0) {
+      if((i+1) < argc) {
+        opts.EmitProfileFile = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-cc-emit-profile' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-cc-profile") == 0) {
+      if((i+1) < argc) {
+        cc_profile = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-cc-profile' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-diff-against") == 0) {
+      if((i+1) < argc) {
+        opts.DiffAgainstFile = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-diff-against' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-disable-free") == 0) {
+      opts.DisableFree = true;
+    } else if(strcmp(argv[i], "--castxml-emit-ast") == 0) {
+      if((i+1) < argc) {
+        opts.EmitASTFile = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-emit-ast' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-estimate") == 0) {
+      opts.Estimate = true;
+    } else if(strcmp(argv[i], "--castxml-index") == 0) {
+      opts.Index = true;
+    } else if(strcmp(argv[i], "--castxml-load-ast") == 0) {
+      if((i+1) < argc) {
+        opts.LoadASTFile = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-load-ast' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
+    } else if(strcmp(argv[i], "--castxml-drop-source-buffers") == 0) {
+      opts.DropSourceBuffers = true;
+    } else if(strcmp(argv[i], "--castxml-driver-cache") == 0) {
+      if((i+1) < argc) {
+        opts.DriverCacheDir = argv[++i];
+      } else {
+        std::cerr <<
+          "error: argument to '--castxml-driver-cache' is missing "
+          "(expected 1 value)\n"
+          "\n" <<
+          usage
+          ;
+        return 1;
+      }
     } else if(strncmp(argv[i], "--castxml-cc-", 13) == 0) {
       if(!cc_id) {
         cc_id = argv[i] + 13;
@@ -234,10 +1574,60 @@ int main(int argc_in, const char** argv_in)
           strncmp(argv[i], "-target=", 8) == 0 ||
           strncmp(argv[i], "--target=", 9) == 0) {
         opts.HaveTarget = true;
+      } else if(strncmp(argv[i], "-MT", 3) == 0 ||
+                strncmp(argv[i], "-MQ", 3) == 0) {
+        opts.HaveDepTarget = true;
+      } else if(strcmp(argv[i], "--sysroot") == 0 && (i+1) < argc) {
+        // The value is passed to Clang as the next argument.
+        sysroot = argv[i+1];
+      } else if(strncmp(argv[i], "--sysroot=", 10) == 0) {
+        sysroot = argv[i] + 10;
       }
     }
   }
 
+  // Give a stored AST to Clang as an input of that kind.
+  if(!opts.LoadASTFile.empty()) {
+    clang_args.push_back("-x");
+    clang_args.push_back("ast");
+    clang_args.push_back(opts.LoadASTFile.c_str());
+  }
+
+  if(!opts.EmitConfigFile.empty() && !cc_id) {
+    std::cerr <<
+      "error: '--castxml-cc-emit-config' requires '--castxml-cc-<id>'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(!opts.EmitProfileFile.empty() && !cc_id) {
+    std::cerr <<
+      "error: '--castxml-cc-emit-profile' requires '--castxml-cc-<id>'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(!cc_profile.empty() && cc_id) {
+    std::cerr <<
+      "error: '--castxml-cc-profile' may not be given with "
+      "'--castxml-cc-<id>'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  // Start reading the headers of earlier runs while the compiler is
+  // detected and the inputs parsed.  A batch loading them through
+  // io_uring reads them itself.
+  if(!opts.PrefetchFile.empty()) {
+    startPrefetch(opts.PrefetchFile, opts.PrefetchIoUring? 0 : 4);
+  }
+
   if(cc_id) {
     opts.HaveCC = true;
     if(cc_args.empty()) {
@@ -249,16 +1639,574 @@ int main(int argc_in, const char** argv_in)
         ;
       return 1;
     }
-    if(!detectCC(cc_id, cc_args.data(), cc_args.data() + cc_args.size(),
-                 opts)) {
+
+    // Wait for the compiler on another thread while this one sets up
+    // the LLVM target of the host, which the detected one usually is,
+    // and the other state shared by all inputs.
+    Options detected = opts;
+    bool haveDetected = false;
+    {
+      PhaseRegion t("Compiler detection");
+      std::thread detection([&]() {
+        TraceRegion tr("Compiler detection");
+        haveDetected = detectCC(cc_id, cc_args.data(),
+                                cc_args.data() + cc_args.size(), ctx,
+                                detected);
+      });
+      {
+        PhaseRegion tt("Target initialization");
+        TraceRegion tr("Target initialization");
+        prepareRunClang(opts, ctx);
+      }
+      detection.join();
+    }
+    if(!haveDetected) {
+      return 1;
+    }
+    opts.Predefines.swap(detected.Predefines);
+    opts.PredefinedMacros.swap(detected.PredefinedMacros);
+    opts.Includes.swap(detected.Includes);
+    opts.Triple.swap(detected.Triple);
+
+    // Write the detected settings for later runs to give instead of
+    // detecting them again, and do nothing else.
+    if(!opts.EmitConfigFile.empty()) {
+      return writeDetectedConfig(opts.EmitConfigFile, opts)? 0 : 1;
+    }
+    if(!opts.EmitProfileFile.empty()) {
+      return writeDetectedProfile(opts.EmitProfileFile, sysroot, ctx,
+                                  opts)? 0 : 1;
+    }
+  } else if(!cc_profile.empty()) {
+    // Take the settings from the profile with no compiler to run.
+    opts.HaveCC = true;
+    if(!loadCCProfile(cc_profile, sysroot, ctx, opts)) {
+      return 1;
+    }
+  }
+
+  if(!opts.OutputShardDir.empty() && !opts.OutputFormat.empty() &&
+     opts.OutputFormat != "xml") {
+    std::cerr <<
+      "error: '--castxml-output-shards' may not be given with "
+      "'--castxml-output " << opts.OutputFormat << "'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(!output_format_file.empty()) {
+    if(!opts.OutputFile.empty()) {
+      std::cerr <<
+        "error: '-o' may not be given with an output file in "
+        "'--castxml-output'\n"
+        "\n" <<
+        usage
+        ;
+      return 1;
+    }
+    opts.OutputFile = output_format_file;
+  }
+
+  if(!opts.StartGroups.empty() &&
+     (!opts.StartNames.empty() || !opts.OutputFile.empty() ||
+      !opts.ExtraOutputs.empty() || !opts.OutputShardDir.empty() ||
+      !opts.OutputIndexFile.empty() ||
+      opts.Server || !opts.BatchFile.empty())) {
+    std::cerr <<
+      "error: '--castxml-start-group' may not be given with "
+      "'--castxml-start', '-o', more than one '--castxml-output', "
+      "'--castxml-output-shards', '--castxml-output-index', "
+      "'--castxml-batch', or '--castxml-server'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(!opts.ExtraOutputs.empty() &&
+     (!opts.OutputShardDir.empty() || !opts.OutputIndexFile.empty() ||
+      opts.Server || !opts.BatchFile.empty())) {
+    std::cerr <<
+      "error: '--castxml-output' with more than one output may not be "
+      "given with '--castxml-output-shards', '--castxml-output-index', "
+      "'--castxml-batch', or '--castxml-server'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if((!opts.EmitASTFile.empty() || !opts.LoadASTFile.empty()) &&
+     (!opts.GccXml || opts.Server || !opts.BatchFile.empty())) {
+    std::cerr <<
+      "error: '--castxml-emit-ast' and '--castxml-load-ast' require "
+      "'--castxml-gccxml' and may not be given with '--castxml-batch' "
+      "or '--castxml-server'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(!opts.DiffAgainstFile.empty() &&
+     (!opts.GccXml || !opts.StableIds ||
+      (!opts.OutputFormat.empty() && opts.OutputFormat != "xml") ||
+      !opts.ExtraOutputs.empty() || !opts.OutputShardDir.empty() ||
+      !opts.StartGroups.empty())) {
+    std::cerr <<
+      "error: '--castxml-diff-against' requires '--castxml-gccxml' and "
+      "'--castxml-stable-ids' and may not be given with "
+      "'--castxml-output' other than one xml output, "
+      "'--castxml-output-shards', or '--castxml-start-group'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(!opts.StableIds) {
+    bool fingerprint = opts.OutputFormat == "fingerprint";
+    for(Options::Output const& o : opts.ExtraOutputs) {
+      fingerprint = fingerprint || o.Format == "fingerprint";
+    }
+    if(fingerprint) {
+      std::cerr <<
+        "error: '--castxml-output fingerprint' requires "
+        "'--castxml-stable-ids'\n"
+        "\n" <<
+        usage
+        ;
+      return 1;
+    }
+  }
+
+  if(opts.Pipelined &&
+     (!opts.GccXml || opts.BatchFile.empty() || opts.PPOnly ||
+      opts.Jobs > 1 || opts.WorkerProcesses)) {
+    std::cerr <<
+      "error: '--castxml-pipeline' requires '--castxml-gccxml' and "
+      "'--castxml-batch' and may not be given with '-E', "
+      "'--castxml-jobs', or '--castxml-worker-processes'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(!opts.HeaderCacheDir.empty() &&
+     (!opts.GccXml || !opts.StableIds || opts.InternStrings ||
+      !opts.ExtraOutputs.empty() || !opts.StartGroups.empty() ||
+      !opts.UnityHeaders.empty())) {
+    std::cerr <<
+      "error: '--castxml-header-cache' requires '--castxml-gccxml' and "
+      "'--castxml-stable-ids' and may not be given with "
+      "'--castxml-intern-strings', more than one '--castxml-output', "
+      "'--castxml-start-group', or '--castxml-unity'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(opts.StableIds && !opts.OutputIndexFile.empty()) {
+    std::cerr <<
+      "error: '--castxml-output-index' may not be given with "
+      "'--castxml-stable-ids'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(!opts.UnityHeaders.empty()) {
+    if(!opts.GccXml || opts.OutputDir.empty() || !opts.FileFilters.empty() ||
+       (!opts.OutputFormat.empty() && opts.OutputFormat != "xml")) {
+      std::cerr <<
+        "error: '--castxml-unity' requires '--castxml-gccxml' and "
+        "'--castxml-output-dir' and may not be given with "
+        "'--castxml-file-filter' or '--castxml-output' other than xml\n"
+        "\n" <<
+        usage
+        ;
+      return 1;
+    }
+
+    // Parse one translation unit including every header.
+    opts.SourceBufferName = opts.OutputDir + "/castxml-unity.cxx";
+    for(std::string const& header : opts.UnityHeaders) {
+      opts.SourceBuffer += "#include \"" + header + "\"\n";
+    }
+  }
+
+  if(!opts.OutputDir.empty() &&
+     (!opts.OutputFile.empty() || !opts.ExtraOutputs.empty() ||
+      !opts.OutputShardDir.empty() || !opts.OutputIndexFile.empty() ||
+      !opts.StartGroups.empty() || !opts.EmitASTFile.empty() ||
+      opts.Server || !opts.BatchFile.empty())) {
+    std::cerr <<
+      "error: '--castxml-output-dir' may not be given with '-o', "
+      "more than one '--castxml-output', '--castxml-output-shards', "
+      "'--castxml-output-index', '--castxml-start-group', "
+      "'--castxml-emit-ast', '--castxml-batch', or '--castxml-server'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+  if(!opts.OutputDir.empty()) {
+    cxsys::SystemTools::MakeDirectory(opts.OutputDir.c_str());
+  }
+
+  if(opts.Estimate &&
+     (!opts.ExtraOutputs.empty() || !opts.OutputShardDir.empty() ||
+      !opts.OutputIndexFile.empty() || !opts.StartGroups.empty() ||
+      !opts.UnityHeaders.empty() || !opts.DiffAgainstFile.empty() ||
+      !opts.ResultCacheDir.empty() ||
+      (!opts.OutputFormat.empty() && opts.OutputFormat != "xml"))) {
+    std::cerr <<
+      "error: '--castxml-estimate' may not be given with "
+      "'--castxml-output' other than xml, '--castxml-output-shards', "
+      "'--castxml-output-index', '--castxml-start-group', "
+      "'--castxml-unity', '--castxml-diff-against', or "
+      "'--castxml-result-cache'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(opts.Index &&
+     (!opts.GccXml || opts.Estimate || opts.TopologicalOrder ||
+      !opts.ExtraOutputs.empty() || !opts.OutputShardDir.empty() ||
+      !opts.OutputIndexFile.empty() || !opts.StartGroups.empty() ||
+      !opts.UnityHeaders.empty() || !opts.DiffAgainstFile.empty() ||
+      !opts.HeaderCacheDir.empty() ||
+      (!opts.OutputFormat.empty() && opts.OutputFormat != "xml"))) {
+    std::cerr <<
+      "error: '--castxml-index' requires '--castxml-gccxml' and may not "
+      "be given with '--castxml-estimate', '--castxml-topological-order', "
+      "'--castxml-output' other than xml, '--castxml-output-shards', "
+      "'--castxml-output-index', '--castxml-start-group', "
+      "'--castxml-unity', '--castxml-diff-against', or "
+      "'--castxml-header-cache'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(opts.Layout) {
+    if(!opts.GccXml || opts.Index) {
+      std::cerr <<
+        "error: '--castxml-layout' requires '--castxml-gccxml' and may "
+        "not be given with '--castxml-index'\n"
+        "\n" <<
+        usage
+        ;
+      return 1;
+    }
+    // Layout elements have no attributes computed for functions.
+    opts.Attributes &= ~(Options::AttributeMangled |
+                         Options::AttributeInit |
+                         Options::AttributeDefault);
+  }
+
+  if(opts.ScanDeps && (opts.GccXml || opts.PPOnly)) {
+    std::cerr <<
+      "error: '--castxml-scan-deps' may not be given with "
+      "'--castxml-gccxml' or '-E'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(opts.Snippets &&
+     (!opts.GccXml || opts.PPOnly || opts.Server || opts.Watch ||
+      !opts.BatchFile.empty() || opts.Index || opts.Estimate ||
+      !opts.LoadASTFile.empty() || !opts.ResultCacheDir.empty() ||
+      !opts.ExtraOutputs.empty() || !opts.OutputShardDir.empty() ||
+      !opts.OutputIndexFile.empty() || !opts.StartGroups.empty() ||
+      !opts.UnityHeaders.empty() ||
+      (!opts.OutputFile.empty() && opts.OutputFile != "-"))) {
+    std::cerr <<
+      "error: '--castxml-snippets' requires '--castxml-gccxml' and may "
+      "not be given with '-E', '-o' other than '-', '--castxml-server', "
+      "'--castxml-watch', '--castxml-batch', '--castxml-index', "
+      "'--castxml-estimate', '--castxml-load-ast', "
+      "'--castxml-result-cache', more than one '--castxml-output', "
+      "'--castxml-output-shards', '--castxml-output-index', "
+      "'--castxml-start-group', or '--castxml-unity'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(opts.Progressive &&
+     (!opts.GccXml || (opts.StartNames.empty() && !opts.Server) ||
+      opts.Estimate ||
+      opts.Index || opts.TopologicalOrder || !opts.ExtraOutputs.empty() ||
+      !opts.OutputShardDir.empty() || !opts.OutputIndexFile.empty() ||
+      !opts.StartGroups.empty() || !opts.UnityHeaders.empty() ||
+      !opts.DiffAgainstFile.empty() ||
+      (!opts.OutputFormat.empty() && opts.OutputFormat != "xml"))) {
+    std::cerr <<
+      "error: '--castxml-progressive' requires '--castxml-gccxml' and "
+      "'--castxml-start' and may not be given with '--castxml-estimate', "
+      "'--castxml-index', '--castxml-topological-order', "
+      "'--castxml-output' other than xml, '--castxml-output-shards', "
+      "'--castxml-output-index', '--castxml-start-group', "
+      "'--castxml-unity', or '--castxml-diff-against'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(opts.PartitionCount > 1 &&
+     (!opts.GccXml || !opts.StartGroups.empty() ||
+      !opts.UnityHeaders.empty() || opts.Server ||
+      !opts.BatchFile.empty())) {
+    std::cerr <<
+      "error: '--castxml-partition' requires '--castxml-gccxml' and may "
+      "not be given with '--castxml-start-group', '--castxml-unity', "
+      "'--castxml-batch', or '--castxml-server'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if((opts.SkipInternal || !opts.SkipNamespaces.empty()) && !opts.GccXml) {
+    std::cerr <<
+      "error: '--castxml-skip-internal' and '--castxml-skip-namespace' "
+      "require '--castxml-gccxml'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(opts.PublicOnly && (!opts.GccXml || opts.Layout)) {
+    std::cerr <<
+      "error: '--castxml-public-only' requires '--castxml-gccxml' and "
+      "may not be given with '--castxml-layout'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(opts.TopologicalOrder &&
+     (!opts.GccXml || opts.Estimate || !opts.OutputShardDir.empty() ||
+      !opts.OutputIndexFile.empty() || !opts.StartGroups.empty() ||
+      !opts.UnityHeaders.empty() || !opts.DiffAgainstFile.empty() ||
+      !opts.HeaderCacheDir.empty())) {
+    std::cerr <<
+      "error: '--castxml-topological-order' requires '--castxml-gccxml' "
+      "and may not be given with '--castxml-estimate', "
+      "'--castxml-output-shards', '--castxml-output-index', "
+      "'--castxml-start-group', '--castxml-unity', "
+      "'--castxml-diff-against', or '--castxml-header-cache'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(!opts.PreprocessedCacheDir.empty() &&
+     (!opts.GccXml || !opts.HeaderCacheDir.empty() ||
+      !opts.UnityHeaders.empty())) {
+    std::cerr <<
+      "error: '--castxml-preprocessed-cache' requires '--castxml-gccxml' "
+      "and may not be given with '--castxml-header-cache' or "
+      "'--castxml-unity'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(!opts.OutputShardDir.empty() && !opts.OutputIndexFile.empty()) {
+    std::cerr <<
+      "error: '--castxml-output-index' may not be given with "
+      "'--castxml-output-shards'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  // Cache a prelude PCH for each detected compiler configuration
+  // along with the detected settings unless told where to put it.
+  if(opts.PreludePCHDir.empty() && opts.HaveCC &&
+     !opts.DetectCacheDir.empty()) {
+    opts.PreludePCHDir = opts.DetectCacheDir + "/prelude-pch";
+  }
+
+  // Parse the prelude with each input if tuning found its PCH built
+  // again more often than reused.  A prefix header still needs one.
+  if(!tuned_prelude && opts.PrefixHeader.empty()) {
+    opts.PreludePCHDir.clear();
+  }
+  setMetricsSettings(opts.Jobs, opts.MemoryBudget, !tuned_prelude);
+
+  if(!opts.PrefixHeader.empty() && opts.PreludePCHDir.empty() &&
+     !opts.ForkPrelude) {
+    std::cerr <<
+      "error: '--castxml-prefix-header' requires '--castxml-prelude-pch' "
+      "or '--castxml-fork-prelude'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  // Batch and server runs process many inputs in one process so they
+  // must free each one.  The AST and our node tables live in arenas
+  // that are released in bulk anyway.
+  if(opts.Server || !opts.BatchFile.empty() || opts.Watch) {
+    opts.DisableFree = false;
+  }
+
+  if(opts.MergeVariants && !opts.Merge && opts.Targets.empty()) {
+    std::cerr <<
+      "error: '--castxml-merge-variants' requires '--castxml-merge' or "
+      "'--castxml-target'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(!opts.Targets.empty()) {
+    if(!opts.GccXml || opts.HaveCC || opts.PPOnly || opts.Watch ||
+       opts.Server || !opts.BatchFile.empty() ||
+       opts.OutputFile.empty() || opts.OutputFile == "-") {
+      std::cerr <<
+        "error: '--castxml-target' requires '--castxml-gccxml' and "
+        "'-o <file>' and may not be given with '--castxml-cc-<id>', "
+        "'-E', '--castxml-watch', '--castxml-server', or "
+        "'--castxml-batch'\n"
+        "\n" <<
+        usage
+        ;
+      return 1;
+    }
+    return runTargets(clang_args.data(),
+                      clang_args.data() + clang_args.size(), opts, ctx);
+  }
+
+  if(opts.Merge) {
+    if(opts.Server || !opts.BatchFile.empty() || opts.GccXml ||
+       clang_args.empty()) {
+      std::cerr <<
+        "error: '--castxml-merge' requires input files and may not be "
+        "given with '--castxml-gccxml', '--castxml-batch', or "
+        "'--castxml-server'\n"
+        "\n" <<
+        usage
+        ;
+      return 1;
+    }
+    if(opts.OutputFile.empty()) {
+      opts.OutputFile = "-";
+    }
+    return runMerge(clang_args.data(), clang_args.data() + clang_args.size(),
+                    opts);
+  }
+
+  if(opts.Watch && (opts.Server || !opts.BatchFile.empty())) {
+    std::cerr <<
+      "error: '--castxml-watch' may not be given with '--castxml-batch' "
+      "or '--castxml-server'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(opts.PrefetchIoUring &&
+     (opts.BatchFile.empty() || opts.PrefetchFile.empty())) {
+    std::cerr <<
+      "error: '--castxml-prefetch-io-uring' requires '--castxml-batch' "
+      "and '--castxml-prefetch'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(opts.TokenCache && !opts.Server && opts.BatchFile.empty()) {
+    std::cerr <<
+      "error: '--castxml-token-cache' requires '--castxml-batch' or "
+      "'--castxml-server'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(!opts.ResultCacheRemote.empty() && opts.ResultCacheDir.empty()) {
+    std::cerr <<
+      "error: '--castxml-result-cache-remote' requires "
+      "'--castxml-result-cache'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(opts.RetainMemory && !opts.Server) {
+    std::cerr <<
+      "error: '--castxml-retain-ast-memory' requires '--castxml-server'\n"
+      "\n" <<
+      usage
+      ;
+    return 1;
+  }
+
+  if(opts.Server) {
+    if(!opts.BatchFile.empty() || !opts.OutputFile.empty()) {
+      std::cerr <<
+        "error: '--castxml-batch' and '-o' may not be given with "
+        "'--castxml-server'\n"
+        "\n" <<
+        usage
+        ;
+      return 1;
+    }
+    return runServer(clang_args.data(), clang_args.data() + clang_args.size(),
+                     opts, ctx);
+  }
+
+  if(!opts.BatchFile.empty()) {
+    if(!opts.OutputFile.empty()) {
+      std::cerr <<
+        "error: '-o' may not be given with '--castxml-batch'\n"
+        "\n" <<
+        usage
+        ;
       return 1;
     }
+    return runBatch(clang_args.data(), clang_args.data() + clang_args.size(),
+                    opts, ctx);
   }
 
   if(clang_args.empty()) {
     return 0;
   }
 
+  if(opts.Watch) {
+    return runClangWatch(clang_args.data(),
+                         clang_args.data() + clang_args.size(), opts, ctx);
+  }
+
+  JobLimits limits(opts.Timeout, opts.MemoryLimit);
+  opts.Limits = &limits;
   return runClang(clang_args.data(), clang_args.data() + clang_args.size(),
-                  opts);
+                  opts, ctx);
 }
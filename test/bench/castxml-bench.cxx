@@ -0,0 +1,544 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/* castxml-bench - Run castxml over synthetic inputs and report time.
+
+   Usage: castxml-bench <castxml> <dir> [<name> <N> <M> <D> <W> <K>]...
+          castxml-bench --measure <command> [<arg>...]
+          castxml-bench --scaling <castxml> <dir> <inputs> <workers>
+                        [<castxml-arg>...]
+          castxml-bench --stress <kind> <n> <file>
+          castxml-bench --startup <castxml> <dir> <runs>
+
+   Each case generates <dir>/<name>.cxx with
+     N classes with a data member and a method,
+     M instantiations of a class template,
+     an inheritance chain of depth D,
+     W sibling namespaces each holding a class, and
+     K overloads of one function
+   and runs "castxml --castxml-gccxml" on it, printing the wall time
+   and the peak resident size of the castxml process.  Without cases
+   a default set is run.
+
+   With --measure the given command is run once and only its wall time
+   and peak resident size are printed, as "<seconds> <peak-KiB>".  The
+   corpus benchmark uses this to measure castxml on real headers.
+
+   With --scaling, <inputs> sources like the "mixed" case are written to
+   <dir> with a compilation database listing them, and castxml runs the
+   whole database with --castxml-batch and --castxml-jobs at 1, 2, 4 ...
+   up to <workers> jobs.  Each run prints its wall time, its throughput
+   in inputs per second, its speedup and parallel efficiency over one
+   job, and the share of the CPU time of its jobs spent working.  The
+   lock waits castxml records with --castxml-time-report name the
+   contention behind any loss of efficiency.
+
+   With --stress one pathological input of the given kind and size is
+   written to <file> for the stress tests:
+     enum     an enumeration with <n> enumerators
+     members  a class with <n> data members
+     bases    an inheritance chain <n> classes deep
+     nested   a class template instantiated <n> levels deep
+     params   a function with <n> parameters
+   All are declared in namespace "start".
+
+   With --startup the fixed cost of a castxml process is measured by
+   running "castxml --version", a gccxml run on an empty source, and a
+   gccxml run on a source with one class, each <runs> times, printing
+   the fastest and median wall time and the peak resident size.  The
+   time report of one more trivial run then breaks its startup into
+   phases such as argument expansion, resource lookup, compiler
+   detection, target initialization and the driver.  */
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+struct BenchCase
+{
+  std::string Name;
+  unsigned long Classes;
+  unsigned long Instantiations;
+  unsigned long Depth;
+  unsigned long Width;
+  unsigned long Overloads;
+};
+
+static void generateCase(BenchCase const& c, std::ostream& os)
+{
+  unsigned long i;
+  os << "namespace start {\n";
+
+  for(i = 0; i < c.Classes; ++i) {
+    os << "struct C" << i << " { int m; C" << i << "* next(); };\n";
+  }
+
+  os << "template <typename T, int I> struct T0 { T v[I]; T get(); };\n";
+  for(i = 0; i < c.Instantiations; ++i) {
+    os << "template struct T0<int, " << (i + 1) << ">;\n";
+  }
+
+  os << "struct B0 { int b; };\n";
+  for(i = 1; i < c.Depth; ++i) {
+    os << "struct B" << i << ": public B" << (i - 1) <<
+      " { virtual ~B" << i << "(); };\n";
+  }
+
+  for(i = 0; i < c.Width; ++i) {
+    os << "namespace n" << i << " { struct S { int x; }; }\n";
+  }
+
+  for(i = 0; i < c.Overloads; ++i) {
+    os << "void f(char (&)[" << (i + 1) << "]);\n";
+  }
+
+  os << "}\n";
+}
+
+static bool runCommand(std::vector<char*>& argv,
+                       double& seconds, long& rssKiB,
+                       double* cpuSeconds = 0, const char* errFile = 0)
+{
+  const char* cmd = argv[0];
+  struct timeval start, end;
+  gettimeofday(&start, 0);
+  pid_t pid;
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  if(errFile) {
+    posix_spawn_file_actions_addopen(&actions, 2, errFile,
+                                     O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  }
+  int e = posix_spawnp(&pid, cmd, &actions, 0, &argv[0], environ);
+  posix_spawn_file_actions_destroy(&actions);
+  if(e != 0) {
+    fprintf(stderr, "error: cannot run '%s': %s\n", cmd, strerror(e));
+    return false;
+  }
+  int status;
+  struct rusage ru;
+  while(wait4(pid, &status, 0, &ru) < 0) {
+    if(errno != EINTR) {
+      fprintf(stderr, "error: wait failed: %s\n", strerror(errno));
+      return false;
+    }
+  }
+  gettimeofday(&end, 0);
+  seconds = (end.tv_sec - start.tv_sec) +
+    (end.tv_usec - start.tv_usec) / 1e6;
+  if(cpuSeconds) {
+    *cpuSeconds = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) +
+      (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+  }
+#if defined(__APPLE__)
+  rssKiB = ru.ru_maxrss / 1024;
+#else
+  rssKiB = ru.ru_maxrss;
+#endif
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool runCase(const char* castxml, std::string const& src,
+                    std::string const& xml,
+                    double& seconds, long& rssKiB)
+{
+  std::vector<char*> argv;
+  argv.push_back(const_cast<char*>(castxml));
+  argv.push_back(const_cast<char*>("--castxml-gccxml"));
+  argv.push_back(const_cast<char*>("--castxml-start"));
+  argv.push_back(const_cast<char*>("start"));
+  argv.push_back(const_cast<char*>("-std=c++98"));
+  argv.push_back(const_cast<char*>(src.c_str()));
+  argv.push_back(const_cast<char*>("-o"));
+  argv.push_back(const_cast<char*>(xml.c_str()));
+  argv.push_back(0);
+  if(!runCommand(argv, seconds, rssKiB)) {
+    fprintf(stderr, "error: castxml failed on '%s'\n", src.c_str());
+    return false;
+  }
+  return true;
+}
+
+static int measure(int argc, const char* argv[])
+{
+  std::vector<char*> cmd;
+  for(int i = 0; i < argc; ++i) {
+    cmd.push_back(const_cast<char*>(argv[i]));
+  }
+  cmd.push_back(0);
+  double seconds;
+  long rss;
+  bool const ok = runCommand(cmd, seconds, rss);
+  printf("%.3f %ld\n", seconds, rss);
+  return ok? 0 : 1;
+}
+
+static void printLockWaits(const char* errFile)
+{
+  // Print the lock lines of the time report, which follow its title.
+  std::ifstream fin(errFile);
+  std::string line;
+  bool inLocks = false;
+  while(std::getline(fin, line)) {
+    if(line == "castxml lock waits:") {
+      inLocks = true;
+    } else if(inLocks && line.compare(0, 2, "  ") == 0) {
+      printf("    %s\n", line.c_str() + 2);
+    } else {
+      inLocks = false;
+    }
+  }
+}
+
+static int scaling(const char* castxml, std::string const& dir,
+                   unsigned long inputs, unsigned long maxWorkers,
+                   int argc, const char* argv[])
+{
+  // Write distinct inputs sized like the mixed case and a database of
+  // them, whose entries castxml writes to <dir>/s<i>.cxx.xml.
+  std::string const db = dir + "/scaling.json";
+  {
+    std::ofstream json(db.c_str());
+    json << "[\n";
+    for(unsigned long i = 0; i < inputs; ++i) {
+      char name[32];
+      sprintf(name, "s%lu", i);
+      BenchCase const c = { name, 200, 50, 20, 200, 50 };
+      std::string const src = dir + "/" + c.Name + ".cxx";
+      std::ofstream fout(src.c_str());
+      generateCase(c, fout);
+      if(!fout) {
+        fprintf(stderr, "error: cannot write '%s'\n", src.c_str());
+        return 1;
+      }
+      json << (i? ",\n" : "") << "{\"directory\": \"" << dir <<
+        "\", \"file\": \"" << c.Name << ".cxx\", \"arguments\": "
+        "[\"c++\", \"-std=c++98\", \"-c\", \"" << c.Name << ".cxx\"]}";
+    }
+    json << "\n]\n";
+    if(!json) {
+      fprintf(stderr, "error: cannot write '%s'\n", db.c_str());
+      return 1;
+    }
+  }
+
+  std::vector<unsigned long> counts;
+  for(unsigned long w = 1; w < maxWorkers; w *= 2) {
+    counts.push_back(w);
+  }
+  counts.push_back(maxWorkers);
+
+  int result = 0;
+  double base = 0;
+  printf("%8s %10s %10s %8s %11s %9s\n", "workers", "seconds",
+         "inputs/s", "speedup", "efficiency", "cpu-busy");
+  for(unsigned long w : counts) {
+    char jobs[32];
+    sprintf(jobs, "%lu", w);
+    std::string const err = dir + "/scaling." + jobs + ".stderr.txt";
+    std::vector<char*> cmd;
+    cmd.push_back(const_cast<char*>(castxml));
+    cmd.push_back(const_cast<char*>("--castxml-gccxml"));
+    cmd.push_back(const_cast<char*>("--castxml-time-report"));
+    cmd.push_back(const_cast<char*>("--castxml-start"));
+    cmd.push_back(const_cast<char*>("start"));
+    cmd.push_back(const_cast<char*>("--castxml-batch"));
+    cmd.push_back(const_cast<char*>(db.c_str()));
+    cmd.push_back(const_cast<char*>("--castxml-jobs"));
+    cmd.push_back(jobs);
+    for(int i = 0; i < argc; ++i) {
+      cmd.push_back(const_cast<char*>(argv[i]));
+    }
+    cmd.push_back(0);
+    double seconds;
+    double cpu;
+    long rss;
+    if(!runCommand(cmd, seconds, rss, &cpu, err.c_str())) {
+      fprintf(stderr, "error: castxml failed with %lu jobs; see '%s'\n",
+              w, err.c_str());
+      result = 1;
+      continue;
+    }
+    if(w == 1) {
+      base = seconds;
+    }
+    double const speedup = base > 0 && seconds > 0? base / seconds : 0;
+    printf("%8lu %10.3f %10.2f %8.2f %11.2f %9.2f\n", w, seconds,
+           seconds > 0? inputs / seconds : 0, speedup, speedup / w,
+           seconds > 0? cpu / (seconds * w) : 0);
+    printLockWaits(err.c_str());
+    fflush(stdout);
+  }
+  return result;
+}
+
+static int compareDoubles(const void* l, const void* r)
+{
+  double const a = *static_cast<double const*>(l);
+  double const b = *static_cast<double const*>(r);
+  return a < b? -1 : (b < a? 1 : 0);
+}
+
+static int startup(const char* castxml, std::string const& dir,
+                   unsigned long runs)
+{
+  std::string const empty = dir + "/startup-empty.cxx";
+  std::string const trivial = dir + "/startup-trivial.cxx";
+  std::string const xml = dir + "/startup.xml";
+  std::string const err = dir + "/startup.stderr.txt";
+  {
+    std::ofstream fempty(empty.c_str());
+    std::ofstream ftrivial(trivial.c_str());
+    ftrivial << "namespace start { struct A { int x; A(); }; }\n";
+    if(!fempty || !ftrivial) {
+      fprintf(stderr, "error: cannot write sources in '%s'\n",
+              dir.c_str());
+      return 1;
+    }
+  }
+
+  struct StartupCase {
+    const char* Name;
+    const char* Source;
+  };
+  StartupCase const cases[] = {
+    { "version", 0 },
+    { "empty", empty.c_str() },
+    { "trivial", trivial.c_str() }
+  };
+
+  int result = 0;
+  printf("%-12s %10s %10s %12s\n", "case", "min-sec", "median-sec",
+         "peak-KiB");
+  for(StartupCase const& c : cases) {
+    std::vector<char*> cmd;
+    cmd.push_back(const_cast<char*>(castxml));
+    if(c.Source) {
+      cmd.push_back(const_cast<char*>("--castxml-gccxml"));
+      cmd.push_back(const_cast<char*>("-std=c++98"));
+      cmd.push_back(const_cast<char*>(c.Source));
+      cmd.push_back(const_cast<char*>("-o"));
+      cmd.push_back(const_cast<char*>(xml.c_str()));
+    } else {
+      cmd.push_back(const_cast<char*>("--version"));
+    }
+    cmd.push_back(0);
+    std::vector<double> times;
+    long peak = 0;
+    for(unsigned long r = 0; r < runs; ++r) {
+      double seconds;
+      long rss;
+      if(!runCommand(cmd, seconds, rss, 0, err.c_str())) {
+        fprintf(stderr, "error: castxml failed on case '%s'; see '%s'\n",
+                c.Name, err.c_str());
+        result = 1;
+        break;
+      }
+      times.push_back(seconds);
+      peak = rss > peak? rss : peak;
+    }
+    if(times.size() != runs) {
+      continue;
+    }
+    qsort(&times[0], times.size(), sizeof(double), compareDoubles);
+    printf("%-12s %10.4f %10.4f %12ld\n", c.Name, times[0],
+           times[times.size() / 2], peak);
+    fflush(stdout);
+  }
+
+  // The phases of one trivial run show where the fixed cost goes.
+  std::vector<char*> cmd;
+  cmd.push_back(const_cast<char*>(castxml));
+  cmd.push_back(const_cast<char*>("--castxml-time-report"));
+  cmd.push_back(const_cast<char*>("--castxml-gccxml"));
+  cmd.push_back(const_cast<char*>("-std=c++98"));
+  cmd.push_back(const_cast<char*>(trivial.c_str()));
+  cmd.push_back(const_cast<char*>("-o"));
+  cmd.push_back(const_cast<char*>(xml.c_str()));
+  cmd.push_back(0);
+  double seconds;
+  long rss;
+  if(!runCommand(cmd, seconds, rss, 0, err.c_str())) {
+    fprintf(stderr, "error: castxml failed with the time report; see '%s'\n",
+            err.c_str());
+    return 1;
+  }
+  printf("\nstartup phases of the trivial case:\n");
+  std::ifstream fin(err.c_str());
+  std::string line;
+  while(std::getline(fin, line)) {
+    printf("%s\n", line.c_str());
+  }
+  return result;
+}
+
+static bool generateStress(std::string const& kind, unsigned long n,
+                           std::ostream& os)
+{
+  unsigned long i;
+  os << "namespace start {\n";
+  if(kind == "enum") {
+    os << "enum E {\n";
+    for(i = 0; i < n; ++i) {
+      os << "  e" << i << ",\n";
+    }
+    os << "};\n";
+  } else if(kind == "members") {
+    os << "struct S {\n";
+    for(i = 0; i < n; ++i) {
+      os << "  int m" << i << ";\n";
+    }
+    os << "};\n";
+  } else if(kind == "bases") {
+    os << "struct B0 { int b; };\n";
+    for(i = 1; i < n; ++i) {
+      os << "struct B" << i << ": public B" << (i - 1) <<
+        " { int b" << i << "; };\n";
+    }
+  } else if(kind == "nested") {
+    os << "template <unsigned long N> struct R {\n"
+      "  typedef typename R<N - 1>::type type;\n"
+      "  R<N - 1> next;\n"
+      "  type get() const;\n"
+      "};\n"
+      "template <> struct R<0> { typedef int type; };\n"
+      "typedef R<" << n << "> Top;\n"
+      "Top top;\n";
+  } else if(kind == "params") {
+    os << "void f(";
+    for(i = 0; i < n; ++i) {
+      os << (i? ",\n       " : "") << "int p" << i;
+    }
+    os << ");\n";
+  } else {
+    return false;
+  }
+  os << "}\n";
+  return true;
+}
+
+static int usage()
+{
+  fprintf(stderr,
+          "Usage: castxml-bench <castxml> <dir>"
+          " [<name> <N> <M> <D> <W> <K>]...\n"
+          "       castxml-bench --measure <command> [<arg>...]\n"
+          "       castxml-bench --scaling <castxml> <dir> <inputs>"
+          " <workers> [<castxml-arg>...]\n"
+          "       castxml-bench --stress <kind> <n> <file>\n"
+          "       castxml-bench --startup <castxml> <dir> <runs>\n");
+  return 1;
+}
+
+int main(int argc, const char* argv[])
+{
+  if(argc > 2 && strcmp(argv[1], "--measure") == 0) {
+    return measure(argc - 2, argv + 2);
+  }
+  if(argc == 5 && strcmp(argv[1], "--stress") == 0) {
+    std::ofstream fout(argv[4]);
+    if(!generateStress(argv[2], strtoul(argv[3], 0, 10), fout)) {
+      return usage();
+    }
+    if(!fout) {
+      fprintf(stderr, "error: cannot write '%s'\n", argv[4]);
+      return 1;
+    }
+    return 0;
+  }
+  if(argc == 5 && strcmp(argv[1], "--startup") == 0) {
+    unsigned long const runs = strtoul(argv[4], 0, 10);
+    if(runs == 0) {
+      return usage();
+    }
+    return startup(argv[2], argv[3], runs);
+  }
+  if(argc > 1 && strcmp(argv[1], "--scaling") == 0) {
+    unsigned long const inputs = argc > 5? strtoul(argv[4], 0, 10) : 0;
+    unsigned long const workers = argc > 5? strtoul(argv[5], 0, 10) : 0;
+    if(inputs == 0 || workers == 0) {
+      return usage();
+    }
+    return scaling(argv[2], argv[3], inputs, workers, argc - 6, argv + 6);
+  }
+  if(argc < 3 || (argc - 3) % 6 != 0) {
+    return usage();
+  }
+  const char* castxml = argv[1];
+  std::string const dir = argv[2];
+
+  std::vector<BenchCase> cases;
+  for(int i = 3; i < argc; i += 6) {
+    BenchCase c;
+    c.Name = argv[i];
+    c.Classes = strtoul(argv[i+1], 0, 10);
+    c.Instantiations = strtoul(argv[i+2], 0, 10);
+    c.Depth = strtoul(argv[i+3], 0, 10);
+    c.Width = strtoul(argv[i+4], 0, 10);
+    c.Overloads = strtoul(argv[i+5], 0, 10);
+    cases.push_back(c);
+  }
+  if(cases.empty()) {
+    BenchCase const defaults[] = {
+      { "classes", 5000, 0, 0, 0, 0 },
+      { "templates", 0, 2000, 0, 0, 0 },
+      { "hierarchy", 0, 0, 500, 0, 0 },
+      { "namespaces", 0, 0, 0, 5000, 0 },
+      { "overloads", 0, 0, 0, 0, 2000 },
+      { "mixed", 1000, 500, 100, 1000, 500 }
+    };
+    cases.assign(defaults, defaults + sizeof(defaults)/sizeof(defaults[0]));
+  }
+
+  int result = 0;
+  printf("%-12s %10s %12s\n", "case", "seconds", "peak-KiB");
+  for(std::vector<BenchCase>::const_iterator i = cases.begin();
+      i != cases.end(); ++i) {
+    std::string const src = dir + "/" + i->Name + ".cxx";
+    std::string const xml = dir + "/" + i->Name + ".xml";
+    {
+      std::ofstream fout(src.c_str());
+      generateCase(*i, fout);
+      if(!fout) {
+        fprintf(stderr, "error: cannot write '%s'\n", src.c_str());
+        return 1;
+      }
+    }
+    double seconds;
+    long rss;
+    if(runCase(castxml, src, xml, seconds, rss)) {
+      printf("%-12s %10.3f %12ld\n", i->Name.c_str(), seconds, rss);
+      fflush(stdout);
+    } else {
+      result = 1;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,461 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/* castxml-loadbench - Compare the cost of loading castxml output formats.
+
+   Usage: castxml-loadbench <castxml> <dir> <src> [<castxml-arg>...]
+
+   Runs "castxml --castxml-gccxml" once on <src> to write the same
+   output as <dir>/load.xml, <dir>/load.json and <dir>/load.bin, then
+   loads each file with a reference reader in a child process of its
+   own and prints the file size, the wall time and peak resident size
+   of the child, and the elements and attributes it saw:
+     xml   libxml2 SAX callbacks, if built with libxml2
+     json  a streaming tokenizer over fixed-size reads
+     bin   walking the records of the file mapped into memory
+   Each reader visits every element and looks at every tag, attribute
+   name and attribute value, as a consumer would.  */
+
+#include <string>
+#include <vector>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if defined(CASTXML_HAVE_LIBXML2)
+# include <libxml/parser.h>
+#endif
+
+struct LoadCounts
+{
+  uint64_t Elements;
+  uint64_t Attributes;
+  uint64_t Bytes;
+};
+
+#if defined(CASTXML_HAVE_LIBXML2)
+static void saxStartElement(void* ctx, const xmlChar* name,
+                            const xmlChar** attrs)
+{
+  // Count the elements within the document element, as the other
+  // formats hold.
+  LoadCounts* c = static_cast<LoadCounts*>(ctx);
+  if(strcmp(reinterpret_cast<const char*>(name), "GCC_XML") == 0) {
+    return;
+  }
+  ++c->Elements;
+  c->Bytes += strlen(reinterpret_cast<const char*>(name));
+  for(const xmlChar** a = attrs; a && *a; a += 2) {
+    ++c->Attributes;
+    c->Bytes += strlen(reinterpret_cast<const char*>(a[0])) +
+      strlen(reinterpret_cast<const char*>(a[1]));
+  }
+}
+
+static bool loadXML(const char* file, LoadCounts& c)
+{
+  FILE* in = fopen(file, "rb");
+  if(!in) {
+    return false;
+  }
+  xmlSAXHandler sax;
+  memset(&sax, 0, sizeof(sax));
+  sax.startElement = saxStartElement;
+  xmlParserCtxtPtr ctxt = xmlCreatePushParserCtxt(&sax, &c, 0, 0, file);
+  bool ok = ctxt != 0;
+  char buffer[65536];
+  size_t n;
+  while(ok && (n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+    ok = xmlParseChunk(ctxt, buffer, int(n), 0) == 0;
+  }
+  ok = ok && xmlParseChunk(ctxt, buffer, 0, 1) == 0 && ctxt->wellFormed;
+  if(ctxt) {
+    xmlFreeParserCtxt(ctxt);
+  }
+  fclose(in);
+  return ok;
+}
+#endif
+
+/* Tokenize the one JSON object per line written by the json format
+   without building a tree.  Strings are unescaped into one reused
+   buffer.  Each object is an element and each member other than its
+   "tag" and "children" is an attribute.  */
+class JSONReader
+{
+  FILE* In;
+  char Buffer[65536];
+  size_t Size;
+  size_t Pos;
+
+  int Get() {
+    if(this->Pos == this->Size) {
+      this->Size = fread(this->Buffer, 1, sizeof(this->Buffer), this->In);
+      this->Pos = 0;
+      if(this->Size == 0) {
+        return EOF;
+      }
+    }
+    return static_cast<unsigned char>(this->Buffer[this->Pos++]);
+  }
+
+  bool String(std::string& s) {
+    s.clear();
+    for(int ch = this->Get(); ch != '"'; ch = this->Get()) {
+      if(ch == EOF) {
+        return false;
+      }
+      if(ch == '\\') {
+        ch = this->Get();
+        switch(ch) {
+        case 'n': ch = '\n'; break;
+        case 't': ch = '\t'; break;
+        case 'u': {
+          unsigned int u = 0;
+          for(int i = 0; i < 4; ++i) {
+            int const h = this->Get();
+            u = u * 16 + (h <= '9'? h - '0' : (h | 0x20) - 'a' + 10);
+          }
+          ch = static_cast<int>(u < 0x80? u : '?');
+        } break;
+        case EOF: return false;
+        default: break;
+        }
+      }
+      s += static_cast<char>(ch);
+    }
+    return true;
+  }
+
+public:
+  JSONReader(FILE* in): In(in), Size(0), Pos(0) {}
+
+  bool Read(LoadCounts& c) {
+    std::string s;
+    for(int ch = this->Get(); ch != EOF; ch = this->Get()) {
+      switch(ch) {
+      case '{':
+        ++c.Elements;
+        break;
+      case '"':
+        if(!this->String(s)) {
+          return false;
+        }
+        c.Bytes += s.size();
+        break;
+      case ':':
+        if(s != "tag" && s != "children") {
+          ++c.Attributes;
+        }
+        break;
+      default:
+        break;
+      }
+    }
+    return true;
+  }
+};
+
+static bool loadJSON(const char* file, LoadCounts& c)
+{
+  FILE* in = fopen(file, "rb");
+  if(!in) {
+    return false;
+  }
+  JSONReader reader(in);
+  bool const ok = reader.Read(c);
+  fclose(in);
+  return ok;
+}
+
+/* Read the binary format in place, as documented for
+   --castxml-output bin.  */
+class BinaryReader
+{
+  const unsigned char* Data;
+  size_t Size;
+  const unsigned char* Strings;
+  const unsigned char* Offsets;
+  uint64_t StringCount;
+
+  static uint32_t Get32(const unsigned char* p) {
+    return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 |
+      uint32_t(p[3]) << 24;
+  }
+
+  static uint64_t Get64(const unsigned char* p) {
+    return uint64_t(Get32(p)) | uint64_t(Get32(p + 4)) << 32;
+  }
+
+  bool StringSize(uint32_t index, uint64_t& n) const {
+    if(index >= this->StringCount) {
+      return false;
+    }
+    const unsigned char* s =
+      this->Strings + Get64(this->Offsets + 8 * size_t(index));
+    n += Get32(s);
+    return true;
+  }
+
+  const unsigned char* Record(const unsigned char* p,
+                              const unsigned char* end, LoadCounts& c) {
+    if(end - p < 24) {
+      return 0;
+    }
+    const unsigned char* const next = p + 4 + Get32(p);
+    uint32_t const attributes = Get32(p + 16);
+    uint32_t const children = Get32(p + 20);
+    if(next > end || !this->StringSize(Get32(p + 4), c.Bytes)) {
+      return 0;
+    }
+    ++c.Elements;
+    p += 24;
+    for(uint32_t i = 0; i < attributes; ++i) {
+      // Only strings and stable ids have text.  Other values are read
+      // in place.
+      if(next - p < 16 || !this->StringSize(Get32(p), c.Bytes)) {
+        return 0;
+      }
+      uint32_t const kind = Get32(p + 4);
+      uint64_t const value = Get64(p + 8);
+      p += 16;
+      if(kind == 0 && !this->StringSize(uint32_t(value), c.Bytes)) {
+        return 0;
+      } else if(kind == 4) {
+        if(uint64_t(next - p) / 16 < value) {
+          return 0;
+        }
+        for(uint64_t r = 0; r < value; ++r, p += 16) {
+          if((Get32(p + 4) & 32) &&
+             !this->StringSize(uint32_t(Get64(p + 8)), c.Bytes)) {
+            return 0;
+          }
+        }
+      }
+      ++c.Attributes;
+    }
+    for(uint32_t i = 0; i < children && p; ++i) {
+      p = this->Record(p, next, c);
+    }
+    return p? next : 0;
+  }
+
+public:
+  BinaryReader(const void* data, size_t size):
+    Data(static_cast<const unsigned char*>(data)), Size(size),
+    Strings(0), Offsets(0), StringCount(0) {}
+
+  bool Read(LoadCounts& c) {
+    if(this->Size < 16 + 32 || memcmp(this->Data, "CastXMLB", 8) != 0 ||
+       Get32(this->Data + 8) != 3) {
+      return false;
+    }
+    const unsigned char* trailer = this->Data + this->Size - 32;
+    uint64_t const strings = Get64(trailer);
+    uint64_t const offsets = Get64(trailer + 8);
+    this->StringCount = Get64(trailer + 16);
+    uint64_t const records = Get64(trailer + 24);
+    if(strings > offsets || this->StringCount > this->Size ||
+       offsets + 8 * this->StringCount > this->Size - 32) {
+      return false;
+    }
+    this->Strings = this->Data + strings;
+    this->Offsets = this->Data + offsets;
+    const unsigned char* p = this->Data + 16;
+    for(uint64_t i = 0; i < records; ++i) {
+      p = this->Record(p, this->Strings, c);
+      if(!p) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+static bool loadBinary(const char* file, LoadCounts& c)
+{
+  int fd = open(file, O_RDONLY);
+  if(fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  size_t const size = static_cast<size_t>(st.st_size);
+  void* data = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == MAP_FAILED) {
+    return false;
+  }
+  BinaryReader reader(data, size);
+  bool const ok = reader.Read(c);
+  munmap(data, size);
+  return ok;
+}
+
+typedef bool (*Loader)(const char* file, LoadCounts& c);
+
+static bool runLoader(Loader load, const char* file, double& seconds,
+                      long& rssKiB, LoadCounts& c)
+{
+  // Load in a child so that its peak resident size is its own, and
+  // hand the counts back through a pipe.
+  int fds[2];
+  if(pipe(fds) != 0) {
+    return false;
+  }
+  struct timeval start, end;
+  gettimeofday(&start, 0);
+  pid_t pid = fork();
+  if(pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if(pid == 0) {
+    close(fds[0]);
+    LoadCounts counts = { 0, 0, 0 };
+    bool const ok = load(file, counts);
+    ssize_t const n = write(fds[1], &counts, sizeof(counts));
+    _exit(ok && n == sizeof(counts)? 0 : 1);
+  }
+  close(fds[1]);
+  ssize_t const n = read(fds[0], &c, sizeof(c));
+  close(fds[0]);
+  int status;
+  struct rusage ru;
+  while(wait4(pid, &status, 0, &ru) < 0) {
+    if(errno != EINTR) {
+      return false;
+    }
+  }
+  gettimeofday(&end, 0);
+  seconds = (end.tv_sec - start.tv_sec) +
+    (end.tv_usec - start.tv_usec) / 1e6;
+#if defined(__APPLE__)
+  rssKiB = ru.ru_maxrss / 1024;
+#else
+  rssKiB = ru.ru_maxrss;
+#endif
+  return n == sizeof(c) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static bool runCastXML(const char* argv[])
+{
+  pid_t pid = fork();
+  if(pid < 0) {
+    return false;
+  }
+  if(pid == 0) {
+    execvp(argv[0], const_cast<char* const*>(argv));
+    fprintf(stderr, "error: cannot run '%s': %s\n", argv[0],
+            strerror(errno));
+    _exit(127);
+  }
+  int status;
+  while(waitpid(pid, &status, 0) < 0) {
+    if(errno != EINTR) {
+      return false;
+    }
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, const char* argv[])
+{
+  if(argc < 4) {
+    fprintf(stderr,
+            "Usage: castxml-loadbench <castxml> <dir> <src>"
+            " [<castxml-arg>...]\n");
+    return 1;
+  }
+  std::string const dir = argv[2];
+  std::string const xml = dir + "/load.xml";
+  std::string const json = dir + "/load.json";
+  std::string const bin = dir + "/load.bin";
+  std::string const outputs =
+    "xml:" + xml + ",json:" + json + ",bin:" + bin;
+
+  std::vector<const char*> cmd;
+  cmd.push_back(argv[1]);
+  cmd.push_back("--castxml-gccxml");
+  cmd.push_back("--castxml-output");
+  cmd.push_back(outputs.c_str());
+  for(int i = 4; i < argc; ++i) {
+    cmd.push_back(argv[i]);
+  }
+  cmd.push_back(argv[3]);
+  cmd.push_back(0);
+  if(!runCastXML(&cmd[0])) {
+    fprintf(stderr, "error: castxml failed on '%s'\n", argv[3]);
+    return 1;
+  }
+
+  struct Format
+  {
+    const char* Name;
+    std::string const* File;
+    Loader Load;
+  };
+  Format const formats[] = {
+#if defined(CASTXML_HAVE_LIBXML2)
+    { "xml", &xml, loadXML },
+#else
+    { "xml", &xml, 0 },
+#endif
+    { "json", &json, loadJSON },
+    { "bin", &bin, loadBinary }
+  };
+
+  int result = 0;
+  printf("%-6s %12s %10s %12s %10s %12s\n", "format", "file-bytes",
+         "seconds", "peak-KiB", "elements", "attributes");
+  for(Format const& f : formats) {
+    struct stat st;
+    long long const size =
+      stat(f.File->c_str(), &st) == 0? (long long)st.st_size : 0;
+    if(!f.Load) {
+      printf("%-6s %12lld  (skipped: built without libxml2)\n", f.Name,
+             size);
+      continue;
+    }
+    double seconds;
+    long rss;
+    LoadCounts c = { 0, 0, 0 };
+    if(!runLoader(f.Load, f.File->c_str(), seconds, rss, c)) {
+      fprintf(stderr, "error: cannot load '%s'\n", f.File->c_str());
+      result = 1;
+      continue;
+    }
+    printf("%-6s %12lld %10.3f %12ld %10llu %12llu\n", f.Name, size,
+           seconds, rss, (unsigned long long)c.Elements,
+           (unsigned long long)c.Attributes);
+  }
+  return result;
+}
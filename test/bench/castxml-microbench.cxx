@@ -0,0 +1,244 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/* castxml-microbench - Time the primitives behind gccxml-format output.
+
+   Usage: castxml-microbench [<classes>]
+
+   Parses a generated translation unit once and then, over its AST,
+   times writeXML and encodeXML on typical names, lookups in maps keyed
+   like the DumpNode maps in Output.cxx, sorting of (id, qualifier) keys, and
+   whole outputXML passes with and without mangled names.  The last
+   two differ by the cost of PrintMangledAttribute.  */
+
+#include "Context.h"
+#include "Options.h"
+#include "Output.h"
+#include "Utils.h"
+
+#include "clang/AST/ASTConsumer.h"
+#include "clang/AST/ASTContext.h"
+#include "clang/AST/Decl.h"
+#include "clang/AST/DeclBase.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/CompilerInvocation.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Lex/PreprocessorOptions.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+//----------------------------------------------------------------------------
+template <typename F>
+static void bench(const char* name, size_t ops, unsigned int reps, F f)
+{
+  typedef std::chrono::steady_clock clock;
+  clock::time_point start = clock::now();
+  for(unsigned int r = 0; r < reps; ++r) {
+    f();
+  }
+  std::chrono::duration<double> d = clock::now() - start;
+  double const perOp = d.count() * 1e9 / (double(ops) * reps);
+  printf("%-32s %12.3f ms %12.1f ns/op\n", name,
+         d.count() * 1e3 / reps, perOp);
+  fflush(stdout);
+}
+
+//----------------------------------------------------------------------------
+static void benchWriteXML()
+{
+  // Mostly plain identifiers with some template names and operators.
+  static const char* const names[] = {
+    "value_type", "size", "iterator", "_M_impl", "operator()",
+    "basic_string<char, std::char_traits<char>, std::allocator<char> >",
+    "operator<<", "operator&&", "pair<const int, std::vector<int> >",
+    "allocator<char>", "__normal_iterator", "begin", "end", "data"
+  };
+  size_t const n = sizeof(names) / sizeof(names[0]);
+  std::vector<std::string> strings(names, names + n);
+  llvm::raw_null_ostream os;
+  bench("writeXML", n * 1000, 100, [&]() {
+    for(unsigned int i = 0; i < 1000; ++i) {
+      for(std::string const& s : strings) {
+        writeXML(os, s);
+      }
+    }
+  });
+  size_t total = 0;
+  bench("encodeXML", n * 1000, 100, [&]() {
+    for(unsigned int i = 0; i < 1000; ++i) {
+      for(std::string const& s : strings) {
+        total += encodeXML(s).size();
+      }
+    }
+  });
+  if(total == 1) {
+    printf("\n");
+  }
+}
+
+//----------------------------------------------------------------------------
+static void collectDecls(clang::DeclContext const* dc,
+                         std::vector<clang::Decl const*>& decls)
+{
+  for(clang::Decl const* d : dc->decls()) {
+    decls.push_back(d);
+    if(clang::DeclContext const* inner =
+       clang::dyn_cast<clang::DeclContext>(d)) {
+      collectDecls(inner, decls);
+    }
+  }
+}
+
+//----------------------------------------------------------------------------
+static void benchNodeMaps(std::vector<clang::Decl const*> const& decls)
+{
+  // Keys as used by the DeclNodes and QualNodes maps.
+  llvm::DenseMap<clang::Decl const*, unsigned int> declMap;
+  llvm::DenseMap<uint64_t, unsigned int> qualMap;
+  std::vector<uint64_t> qualKeys;
+  for(size_t i = 0; i < decls.size(); ++i) {
+    declMap[decls[i]->getCanonicalDecl()] = unsigned(i);
+    if(i % 8 == 0) {
+      uint64_t key = (uint64_t(i) << 3) | (i % 7 + 1);
+      qualMap[key] = unsigned(i);
+      qualKeys.push_back(key);
+    }
+  }
+
+  unsigned int sum = 0;
+  bench("DeclNodes lookup", decls.size(), 100, [&]() {
+    for(clang::Decl const* d : decls) {
+      sum += declMap.lookup(d->getCanonicalDecl());
+    }
+  });
+  bench("QualNodes lookup", qualKeys.size(), 100, [&]() {
+    for(uint64_t k : qualKeys) {
+      sum += qualMap.lookup(k);
+    }
+  });
+
+  // Sort (id, qualifier bits) keys as for the offset index.
+  std::vector<uint64_t> shuffled(qualKeys);
+  for(size_t i = 0; i < decls.size(); ++i) {
+    shuffled.push_back(uint64_t(i) << 3);
+  }
+  std::vector<uint64_t> keys;
+  bench("DumpId sort", shuffled.size(), 20, [&]() {
+    keys = shuffled;
+    std::reverse(keys.begin(), keys.end());
+    std::sort(keys.begin(), keys.end());
+  });
+  if(sum == 1) {
+    printf("\n");
+  }
+}
+
+//----------------------------------------------------------------------------
+static void benchOutput(clang::CompilerInstance& ci, clang::ASTContext& ctx,
+                        const char* name, unsigned int attributes,
+                        size_t nodes)
+{
+  Options opts;
+  opts.GccXml = true;
+  opts.Attributes = attributes;
+  opts.StartNames.push_back("start");
+  llvm::raw_null_ostream os;
+  bench(name, nodes, 10, [&]() {
+    outputXML(ci, ctx, os, opts);
+  });
+}
+
+//----------------------------------------------------------------------------
+class MicrobenchConsumer: public clang::ASTConsumer
+{
+  clang::CompilerInstance& CI;
+public:
+  MicrobenchConsumer(clang::CompilerInstance& ci): CI(ci) {}
+  void HandleTranslationUnit(clang::ASTContext& ctx) override {
+    std::vector<clang::Decl const*> decls;
+    collectDecls(ctx.getTranslationUnitDecl(), decls);
+    printf("%lu declarations\n", static_cast<unsigned long>(decls.size()));
+    benchWriteXML();
+    benchNodeMaps(decls);
+    benchOutput(this->CI, ctx, "outputXML", Options::AttributeAll,
+                decls.size());
+    benchOutput(this->CI, ctx, "outputXML without mangled",
+                Options::AttributeAll & ~Options::AttributeMangled,
+                decls.size());
+  }
+};
+
+//----------------------------------------------------------------------------
+class MicrobenchAction: public clang::SyntaxOnlyAction
+{
+  std::unique_ptr<clang::ASTConsumer>
+  CreateASTConsumer(clang::CompilerInstance& ci, llvm::StringRef) override {
+    return llvm::make_unique<MicrobenchConsumer>(ci);
+  }
+};
+
+//----------------------------------------------------------------------------
+static std::string generateSource(unsigned long classes)
+{
+  std::string src = "namespace start {\n"
+    "template <typename T> struct Box { T v; T get() const; };\n";
+  for(unsigned long i = 0; i < classes; ++i) {
+    std::string const n = std::to_string(i);
+    src += "struct C" + n + " { int m; Box<C" + n + "*> b;"
+      " C" + n + "& operator<<(int); virtual ~C" + n + "(); };\n";
+    src += "void f" + n + "(C" + n + " const&, Box<int>*);\n";
+  }
+  src += "}\n";
+  return src;
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, const char* argv[])
+{
+  Context ctx;
+  if(!findResourceDir(argv[0], ctx, std::cerr)) {
+    return 1;
+  }
+  unsigned long const classes = argc > 1? strtoul(argv[1], 0, 10) : 2000;
+
+  std::unique_ptr<clang::CompilerInstance> CI(new clang::CompilerInstance());
+  CI->createDiagnostics();
+  const char* args[] = { "-fsyntax-only", "-x", "c++", "-std=c++98",
+                         "microbench.cxx" };
+  if(!clang::CompilerInvocation::CreateFromArgs(
+       CI->getInvocation(), args, args + sizeof(args)/sizeof(args[0]),
+       CI->getDiagnostics())) {
+    return 1;
+  }
+  CI->getHeaderSearchOpts().ResourceDir = ctx.ClangResourceDir;
+  CI->getPreprocessorOpts().addRemappedFile(
+    "microbench.cxx",
+    llvm::MemoryBuffer::getMemBufferCopy(generateSource(classes),
+                                         "microbench.cxx").release());
+  MicrobenchAction action;
+  return CI->ExecuteAction(action)? 0 : 1;
+}
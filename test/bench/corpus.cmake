@@ -0,0 +1,95 @@
+#=============================================================================
+# Copyright Kitware, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#=============================================================================
+
+# Measure castxml on one corpus input and compare with a baseline.
+#
+# Input variables:
+#   measure   = castxml-bench driver used to run castxml
+#   command   = castxml command line to measure
+#   name      = corpus case name
+#   results   = results file to write
+#   baseline  = baseline file to compare against
+#   tolerance = allowed slowdown and growth, in percent
+#
+# The results and baseline files hold one line "<seconds> <peak-KiB>".
+# A missing baseline is created from the measured results.  Set the
+# environment variable CASTXML_BENCH_UPDATE to replace the baseline.
+
+cmake_minimum_required(VERSION 2.8.5)
+
+execute_process(
+  COMMAND ${measure} --measure ${command}
+  OUTPUT_VARIABLE actual_stdout
+  ERROR_VARIABLE actual_stderr
+  RESULT_VARIABLE actual_result
+  )
+if(actual_result OR NOT actual_stdout MATCHES "^([0-9.]+) ([0-9]+)\n")
+  string(REPLACE ";" "\" \"" command_string "\"${command}\"")
+  message(FATAL_ERROR
+    "castxml failed on corpus case ${name}.\n"
+    "Command was:\n command> ${command_string}\n"
+    "${actual_stderr}")
+endif()
+set(actual_seconds ${CMAKE_MATCH_1})
+set(actual_kib ${CMAKE_MATCH_2})
+file(WRITE "${results}" "${actual_seconds} ${actual_kib}\n")
+message(STATUS "${name}: ${actual_seconds} s, ${actual_kib} KiB")
+
+if("$ENV{CASTXML_BENCH_UPDATE}" OR NOT EXISTS "${baseline}")
+  file(WRITE "${baseline}" "${actual_seconds} ${actual_kib}\n")
+  message(STATUS "${name}: baseline written to ${baseline}")
+  return()
+endif()
+
+file(READ "${baseline}" expect)
+if(NOT expect MATCHES "^([0-9.]+) ([0-9]+)")
+  message(FATAL_ERROR "baseline '${baseline}' is not valid")
+endif()
+set(expect_seconds ${CMAKE_MATCH_1})
+set(expect_kib ${CMAKE_MATCH_2})
+
+# CMake math() has only integers, so compare in milliseconds.
+foreach(v actual_seconds expect_seconds)
+  string(REGEX REPLACE "^([0-9]*)\\.([0-9]*)$" "\\1;\\2" parts "${${v}}")
+  list(GET parts 0 whole)
+  list(LENGTH parts n)
+  set(frac "000")
+  if(n GREATER 1)
+    list(GET parts 1 frac)
+    set(frac "${frac}000")
+  endif()
+  string(SUBSTRING "${frac}" 0 3 frac)
+  string(REGEX REPLACE "^0+([0-9])" "\\1" frac "${frac}")
+  if("${whole}" STREQUAL "")
+    set(whole 0)
+  endif()
+  math(EXPR ${v}_ms "${whole} * 1000 + ${frac}")
+endforeach()
+
+set(msg "")
+math(EXPR limit_ms "${expect_seconds_ms} * (100 + ${tolerance}) / 100")
+if(actual_seconds_ms GREATER limit_ms)
+  set(msg "${msg}time ${actual_seconds} s exceeds baseline")
+  set(msg "${msg} ${expect_seconds} s by more than ${tolerance}%\n")
+endif()
+math(EXPR limit_kib "${expect_kib} * (100 + ${tolerance}) / 100")
+if(actual_kib GREATER limit_kib)
+  set(msg "${msg}peak size ${actual_kib} KiB exceeds baseline")
+  set(msg "${msg} ${expect_kib} KiB by more than ${tolerance}%\n")
+endif()
+if(msg)
+  message(FATAL_ERROR "Corpus case ${name} regressed:\n${msg}")
+endif()
@@ -0,0 +1,13 @@
+// Template-heavy Boost libraries commonly wrapped for Python.
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/optional.hpp>
+#include <boost/variant.hpp>
+#include <boost/any.hpp>
+#include <boost/tuple/tuple.hpp>
+#include <boost/mpl/vector.hpp>
+#include <boost/type_traits.hpp>
+#include <boost/utility/enable_if.hpp>
+#include <boost/iterator/iterator_facade.hpp>
+#include <boost/lexical_cast.hpp>
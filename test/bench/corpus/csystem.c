@@ -0,0 +1,24 @@
+/* The standard C library headers plus common POSIX ones.  */
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <float.h>
+#include <limits.h>
+#include <locale.h>
+#include <math.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if !defined(_WIN32)
+# include <dirent.h>
+# include <fcntl.h>
+# include <pthread.h>
+# include <sys/stat.h>
+# include <sys/types.h>
+# include <unistd.h>
+#endif
@@ -0,0 +1,2 @@
+// The whole GNU C++ standard library, as in a precompiled header.
+#include <bits/stdc++.h>
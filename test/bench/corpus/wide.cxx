@@ -0,0 +1,69 @@
+// A wide single-root class hierarchy in the style of Qt: one polymorphic
+// base with many virtual methods and a thousand direct subclasses, each
+// with signals, slots, overloaded setters and a nested enumeration.
+namespace start {
+
+class Object
+{
+public:
+  Object(Object* parent = 0);
+  virtual ~Object();
+  virtual const char* className() const;
+  virtual bool event(int type, void* data);
+  virtual bool eventFilter(Object* watched, int type, void* data);
+  virtual void childEvent(Object* child);
+  virtual void timerEvent(int id);
+  Object* parent() const;
+  void setParent(Object* parent);
+  void setObjectName(const char* name);
+  const char* objectName() const;
+private:
+  Object(Object const&);
+  Object& operator=(Object const&);
+  Object* Parent;
+  const char* Name;
+};
+
+#define START_WIDGET(n)                                                 \
+  class Widget##n: public Object                                        \
+  {                                                                     \
+  public:                                                               \
+    enum State { Idle##n, Active##n, Disabled##n };                     \
+    explicit Widget##n(Object* parent = 0);                             \
+    virtual ~Widget##n();                                               \
+    virtual const char* className() const;                              \
+    virtual bool event(int type, void* data);                           \
+    State state() const;                                                \
+    void setState(State s);                                             \
+    void setValue(int v);                                               \
+    void setValue(double v);                                            \
+    void setValue(const char* v);                                       \
+    void valueChanged(int v);                                           \
+    void stateChanged(State s);                                         \
+  private:                                                              \
+    State S;                                                            \
+    int Value;                                                          \
+  };
+#define START_WIDGET10(n) \
+  START_WIDGET(n##0) START_WIDGET(n##1) START_WIDGET(n##2) \
+  START_WIDGET(n##3) START_WIDGET(n##4) START_WIDGET(n##5) \
+  START_WIDGET(n##6) START_WIDGET(n##7) START_WIDGET(n##8) \
+  START_WIDGET(n##9)
+#define START_WIDGET100(n) \
+  START_WIDGET10(n##0) START_WIDGET10(n##1) START_WIDGET10(n##2) \
+  START_WIDGET10(n##3) START_WIDGET10(n##4) START_WIDGET10(n##5) \
+  START_WIDGET10(n##6) START_WIDGET10(n##7) START_WIDGET10(n##8) \
+  START_WIDGET10(n##9)
+
+START_WIDGET100(_0)
+START_WIDGET100(_1)
+START_WIDGET100(_2)
+START_WIDGET100(_3)
+START_WIDGET100(_4)
+START_WIDGET100(_5)
+START_WIDGET100(_6)
+START_WIDGET100(_7)
+START_WIDGET100(_8)
+START_WIDGET100(_9)
+
+}
@@ -0,0 +1,94 @@
+#=============================================================================
+# Copyright Kitware, Inc.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#=============================================================================
+
+# Run castxml on one generated pathological input within a budget.
+#
+# Input variables:
+#   driver  = castxml-bench driver used to generate the input and to
+#             run castxml
+#   castxml = castxml executable
+#   kind    = kind of input for castxml-bench --stress
+#   size    = size of the input
+#   source  = generated source file to write
+#   seconds = budget of wall time, in whole seconds
+#   kib     = budget of peak resident size, in KiB
+#   scale   = factor, in percent, applied to both budgets
+#
+# The budgets are far above the cost of linear behavior, so only a
+# change in complexity, such as quadratic emission of members, should
+# exceed them.
+
+cmake_minimum_required(VERSION 2.8.5)
+
+execute_process(
+  COMMAND ${driver} --stress ${kind} ${size} ${source}
+  RESULT_VARIABLE generate_result
+  )
+if(generate_result)
+  message(FATAL_ERROR "Cannot generate stress input ${source}")
+endif()
+
+set(command ${castxml} --castxml-gccxml --castxml-start start -std=c++98
+  ${source} -o ${source}.xml)
+execute_process(
+  COMMAND ${driver} --measure ${command}
+  OUTPUT_VARIABLE actual_stdout
+  ERROR_VARIABLE actual_stderr
+  RESULT_VARIABLE actual_result
+  )
+if(actual_result OR NOT actual_stdout MATCHES "^([0-9.]+) ([0-9]+)\n")
+  string(REPLACE ";" "\" \"" command_string "\"${command}\"")
+  message(FATAL_ERROR
+    "castxml failed on stress case ${kind} ${size}.\n"
+    "Command was:\n command> ${command_string}\n"
+    "${actual_stderr}")
+endif()
+set(actual_seconds ${CMAKE_MATCH_1})
+set(actual_kib ${CMAKE_MATCH_2})
+message(STATUS "${kind} ${size}: ${actual_seconds} s, ${actual_kib} KiB")
+
+# CMake math() has only integers, so compare in milliseconds.
+string(REGEX REPLACE "^([0-9]*)\\.([0-9]*)$" "\\1;\\2" parts
+  "${actual_seconds}")
+list(GET parts 0 whole)
+list(LENGTH parts n)
+set(frac "000")
+if(n GREATER 1)
+  list(GET parts 1 frac)
+  set(frac "${frac}000")
+endif()
+string(SUBSTRING "${frac}" 0 3 frac)
+string(REGEX REPLACE "^0+([0-9])" "\\1" frac "${frac}")
+if("${whole}" STREQUAL "")
+  set(whole 0)
+endif()
+math(EXPR actual_ms "${whole} * 1000 + ${frac}")
+
+set(msg "")
+math(EXPR limit_ms "${seconds} * 1000 * ${scale} / 100")
+math(EXPR limit_seconds "${limit_ms} / 1000")
+if(actual_ms GREATER limit_ms)
+  set(msg "${msg}time ${actual_seconds} s exceeds budget")
+  set(msg "${msg} of ${limit_seconds} s\n")
+endif()
+math(EXPR limit_kib "${kib} * ${scale} / 100")
+if(actual_kib GREATER limit_kib)
+  set(msg "${msg}peak size ${actual_kib} KiB exceeds budget")
+  set(msg "${msg} of ${limit_kib} KiB\n")
+endif()
+if(msg)
+  message(FATAL_ERROR "Stress case ${kind} ${size} over budget:\n${msg}")
+endif()
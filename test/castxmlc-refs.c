@@ -0,0 +1,61 @@
+#include "CastXMLC.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int equals(castxml_string s, const char* text)
+{
+  return s.size == strlen(text) && memcmp(s.data, text, s.size) == 0;
+}
+
+/* Parse a source with a class "start" deriving from three classes and
+   check that castxml_refs gives the nodes of all its bases, including
+   those with an access prefix.  */
+int main(int argc, const char* argv[])
+{
+  const char* start = "start";
+  castxml_result* r;
+  castxml_node const* nodes;
+  castxml_attribute const* attributes;
+  castxml_ids elements;
+  castxml_ids bases;
+  size_t count;
+  size_t i;
+  size_t j;
+  int ok = 0;
+
+  if (argc != 3) {
+    fprintf(stderr, "usage: castxmlc-refs <castxml> <source>\n");
+    return 1;
+  }
+  if (castxml_initialize(argv[1]) != 0) {
+    return 1;
+  }
+  r = castxml_parse(0, 0, 0, &start, 1, argv + 2, 1);
+  if (!r || castxml_status(r) != 0) {
+    return 1;
+  }
+
+  nodes = castxml_nodes(r, &count);
+  attributes = castxml_attributes(r, &count);
+  elements = castxml_elements(r);
+  for (i = 0; i < elements.size; ++i) {
+    uint32_t n = elements.data[i];
+    uint32_t a = castxml_find_attribute(r, n, "name");
+    if (!equals(castxml_get_string(r, nodes[n].tag), "Class") ||
+        a == CASTXML_NONE ||
+        !equals(castxml_get_string(r, attributes[a].value), "start")) {
+      continue;
+    }
+    bases = castxml_refs(r, n, "bases");
+    ok = bases.size == 3;
+    for (j = 0; ok && j < bases.size; ++j) {
+      ok = bases.data[j] != CASTXML_NONE;
+    }
+  }
+  if (!ok) {
+    fprintf(stderr, "castxmlc-refs: bases of \"start\" not found\n");
+  }
+  castxml_free(r);
+  return ok? 0 : 1;
+}
@@ -0,0 +1,2 @@
+# Start from an empty detection cache.
+file(REMOVE_RECURSE "${detect_cache}")
@@ -0,0 +1,54 @@
+/*
+  Copyright Kitware, Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+*/
+
+/* castxml-embed - Run castxml through its installed library.
+
+   Usage: castxml-embed <castxml> <source>
+
+   Finds the resources installed with the given castxml executable,
+   parses the source into an output table, and fails unless the table
+   holds output elements.  */
+
+#include <CastXML.h>
+#include <Context.h>
+#include <OutputTable.h>
+
+#include <iostream>
+
+int main(int argc, const char* argv[])
+{
+  if(argc != 3) {
+    std::cerr << "usage: castxml-embed <castxml> <source>\n";
+    return 1;
+  }
+
+  Context ctx;
+  if(!castxmlInitialize(argv[1], ctx, std::cerr)) {
+    return 1;
+  }
+
+  Options opts;
+  opts.GccXml = true;
+  OutputTable table;
+  if(castxmlRunTable(argv + 2, argv + 3, opts, ctx, table) != 0) {
+    return 1;
+  }
+  if(table.GetElements().empty()) {
+    std::cerr << "castxml-embed: no output elements\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,13 @@
+# Decompress the output so that it can be checked as plain XML.  On
+# failure the XML is left missing and the check reports it.
+execute_process(
+  COMMAND ${gzip} -dc "${xml}.gz"
+  OUTPUT_FILE "${xml}"
+  RESULT_VARIABLE gunzip_result
+  )
+if(NOT gunzip_result EQUAL 0)
+  file(REMOVE "${xml}")
+endif()
+
+# Do not let a stale compressed file satisfy a later run.
+file(REMOVE "${xml}.gz")
@@ -0,0 +1 @@
+void __vectorcall start(int);
@@ -0,0 +1,5 @@
+namespace start {
+  template <typename T> class A {};
+  template class A<char>;
+  A<int>* p;
+}
@@ -0,0 +1,6 @@
+namespace start {
+  typedef int A;
+  typedef int B;
+  A* a;
+  B* b;
+}
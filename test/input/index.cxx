@@ -0,0 +1,8 @@
+namespace start {
+  class C {
+  public:
+    int method(int);
+  };
+  int var;
+  void f(C);
+}
@@ -0,0 +1 @@
+void start() { undeclared(); }
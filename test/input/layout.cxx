@@ -0,0 +1,11 @@
+namespace start {
+  struct S {
+    char c;
+    int i;
+    int method();
+    friend void f(S);
+  };
+  typedef S T;
+  enum E { e };
+  void g(S* s);
+}
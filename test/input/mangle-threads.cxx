@@ -0,0 +1,7 @@
+#define F(n) void f##n(int);
+#define F10(n) F(n##0) F(n##1) F(n##2) F(n##3) F(n##4) \
+               F(n##5) F(n##6) F(n##7) F(n##8) F(n##9)
+namespace start {
+F10(1) F10(2)
+F10(3) F10(4)
+}
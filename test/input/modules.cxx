@@ -0,0 +1 @@
+#include "start.h"
@@ -0,0 +1,8 @@
+namespace ns { int a; }
+void f(int);
+void f(char);
+struct S { int x; };
+namespace ns { int b; }
+typedef S T;
+extern "C" int c;
+int v;
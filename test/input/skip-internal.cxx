@@ -0,0 +1,10 @@
+namespace start {
+  namespace {
+    struct A;
+  }
+  static void f();
+  namespace detail {
+    struct B;
+  }
+  struct C;
+}
@@ -0,0 +1 @@
+template <typename T> struct X { T t; };
@@ -0,0 +1,8 @@
+namespace start {
+  namespace detail {
+    class A {};
+    class B {};
+  }
+  class C {};
+  int apple;
+}
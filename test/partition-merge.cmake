@@ -0,0 +1,45 @@
+# Write the output of an input in one process and in two parts of
+# '--castxml-partition', merge each with '--castxml-merge' to number
+# their ids alike, and check that the merged parts hold the same
+# elements as the whole.
+
+macro(run_castxml)
+  execute_process(COMMAND ${castxml} ${ARGN}
+    RESULT_VARIABLE result ERROR_VARIABLE error)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "castxml ${ARGN} failed:\n${error}")
+  endif()
+endmacro()
+
+run_castxml(--castxml-gccxml -std=c++98 ${input} -o partition-whole.xml)
+run_castxml(--castxml-gccxml --castxml-partition 0/2 -std=c++98 ${input}
+  -o partition-0.xml)
+run_castxml(--castxml-gccxml --castxml-partition 1/2 -std=c++98 ${input}
+  -o partition-1.xml)
+run_castxml(--castxml-merge partition-whole.xml -o partition-expect.xml)
+run_castxml(--castxml-merge partition-0.xml partition-1.xml
+  -o partition-actual.xml)
+
+# The merged ids follow the order elements are first met, which differs
+# between the inputs, so compare the sorted elements with each id and
+# file reference replaced by its kind.  The number of references in
+# each attribute, such as the members of the global namespace, remains.
+foreach(o expect actual)
+  file(STRINGS partition-${o}.xml lines)
+  set(elements "")
+  foreach(line IN LISTS lines)
+    string(REGEX REPLACE "\"_[0-9]+" "\"_" line "${line}")
+    string(REGEX REPLACE " _[0-9]+" " _" line "${line}")
+    string(REGEX REPLACE ":_[0-9]+" ":_" line "${line}")
+    string(REGEX REPLACE "\"f[0-9]+" "\"f" line "${line}")
+    string(REPLACE ";" "," line "${line}")
+    list(APPEND elements "${line}")
+  endforeach()
+  list(SORT elements)
+  string(REPLACE ";" "\n" ${o} "${elements}")
+endforeach()
+if(NOT actual STREQUAL expect)
+  message(FATAL_ERROR "Merged parts differ from the whole output.\n"
+    "Whole:\n${expect}\n"
+    "Parts:\n${actual}\n")
+endif()
@@ -23,13 +23,24 @@ if(prologue)
   include(${prologue})
 endif()
 
+if(stdin)
+  set(maybe_stdin INPUT_FILE ${stdin})
+else()
+  set(maybe_stdin)
+endif()
+
 execute_process(
   COMMAND ${command}
+  ${maybe_stdin}
   OUTPUT_VARIABLE actual_stdout
   ERROR_VARIABLE actual_stderr
   RESULT_VARIABLE actual_result
   )
 
+if(epilogue)
+  include(${epilogue})
+endif()
+
 if(xml)
   set(maybe_xml xml)
   if(EXISTS "${xml}")